@@ -10,10 +10,16 @@
 #include "freertos/task.h"
 #include "esp_heap_caps.h"
 #include "driver/timer.h"
+#include "driver/pcnt.h"
+#include "soc/pcnt_struct.h"
 #include "esp_timer.h"
-#include "freertos/stream_buffer.h"
+#include "hal/cpu_hal.h"
 
 #include "ads8689.h"
+#include "ads8689_dma_chain.h"
+#include "ads8689_stream.h"
+#include "ads8689_stats.h"
+#include "ads8689_encoder.h"
 
 
 #define LOG_TAG "ADS8689"
@@ -34,6 +40,10 @@
 
 #define USE_HW_TIMER 1
 
+/* DMA mode: ping-pong blocks, 256 samples each is 2.56ms at 100kHz */
+#define DMA_BLOCK_LEN (256)
+#define DMA_N_BLOCKS (2)
+
 #if USE_HW_TIMER
 timer_group_t timer_group = TIMER_GROUP_0;
 timer_idx_t timer_id = TIMER_0;
@@ -43,33 +53,72 @@ timer_idx_t timer_id = TIMER_0;
 static uint8_t *mosi_buffer = NULL;
 static uint8_t *miso_buffer = NULL;
 
-static StreamBufferHandle_t data_stream_buffer;
+/* DMA descriptors ring */
+static ads8689_dma_chain_t dma_chain;
 
 
 /* SPI hardware variables */
 static spi_host_device_t spi_host;
 static spi_device_handle_t spi_handle;
+static spi_device_interface_config_t dev_cfg;
 static spi_hal_context_t spi_bus_hal;
 
-/* Test variables */
-int64_t start_time;
+/* Settings in use and the stream interrupts, freed when it stops */
+static ads8689_config_t config = ADS8689_DEFAULT_CONFIG();
+static volatile bool streaming = false;
+static bool bus_intr_freed = false;
+static intr_handle_t stream_intr_handle = NULL;
+#if USE_HW_TIMER
+static intr_handle_t timer_intr_handle = NULL;
+#else
+static esp_timer_handle_t read_timer_handle = NULL;
+#endif
+/* Encoder clocked stream: the pulse counter divides the encoder edges */
+#define ENCODER_PCNT_UNIT (PCNT_UNIT_0)
+/* Glitches shorter than this many APB cycles are not counted, 1.25us */
+#define ENCODER_FILTER (100)
+static ads8689_encoder_config_t encoder_config;
+static bool encoder_clocked = false;
+static lldesc_t *dma_desc = NULL;
+static uint32_t *dma_words = NULL;
+
+/* Conversions timed since the stream started, the index of the next sample */
+static uint64_t conversions = 0;
+/* The conversion clock is latched once a block */
+#define CLOCK_LATCH_PERIOD (DMA_BLOCK_LEN)
 
 static void IRAM_ATTR spi_handler(void *arg) {
   spi_dev_t *dev = spi_bus_hal.hw;
   dev->slave.trans_done = 0; // reset the register
 
-  uint32_t data = SPI_SWAP_DATA_RX(*(dev->data_buf), 18);
-  int16_t signed_data = (int16_t) data;
+  /* Data in bits 29:14 of the frame, then the high and low input alarm flags */
+  uint32_t frame = __builtin_bswap32(*(dev->data_buf));
+  int16_t signed_data = (int16_t) (frame >> 14);
+  uint8_t flags = (frame >> 12) & 0x3;
+
+  BaseType_t task_woken = pdFALSE;
+  ads8689_stream_push(&signed_data, flags ? &flags : NULL, 1, &task_woken);
+  if (task_woken == pdTRUE) portYIELD_FROM_ISR();
+}
 
-  BaseType_t task_woken;
-  xStreamBufferSendFromISR(data_stream_buffer, (void*) &signed_data, 2, &task_woken);
+static void IRAM_ATTR dma_block_ready (const int16_t *samples, const uint8_t *flags, size_t len, void *arg) {
+  ads8689_stream_push(samples, flags, len, (BaseType_t*) arg);
+}
+
+static void IRAM_ATTR spi_dma_handler(void *arg) {
+  spi_dev_t *dev = spi_bus_hal.hw;
+  dev->dma_int_clr.in_done = 1;
+
+  BaseType_t task_woken = pdFALSE;
+  ads8689_dma_chain_service(&dma_chain, dev->inlink_dscr, dma_block_ready, &task_woken);
+  if (task_woken == pdTRUE) portYIELD_FROM_ISR();
 }
 
 esp_err_t ads8689_init (spi_bus_config_t spi_config, gpio_num_t cs_gpio, spi_host_device_t spi_host_id) {
   spi_host = spi_host_id;
 
-  spi_device_interface_config_t dev_cfg = {
-    .clock_speed_hz = SPI_MASTER_FREQ_20M,   // clock speed
+  dev_cfg = (spi_device_interface_config_t) {
+    .clock_speed_hz = config.spi_clock,      // clock speed
     .mode = SPI_TRANS_MODE_DIO,              // SPI mode 0
     .spics_io_num = cs_gpio,                 // CS GPIO
     .queue_size = 5,
@@ -118,20 +167,54 @@ esp_err_t ads8689_transmit (
     .length = (4 + read_len) * 8
   };
 
-  // xSemaphoreTake(spi_mutex, portMAX_DELAY);
-  esp_err_t ret = spi_device_transmit(spi_handle, &spi_trans);
-  // xSemaphoreGive(spi_mutex);
+  /* Polled, the bus interrupt belongs to the stream once it started */
+  esp_err_t ret = spi_device_polling_transmit(spi_handle, &spi_trans);
   
   if (ret != ESP_OK) ESP_LOGE(LOG_TAG, "Failed to transmit command %#x, address %#x", command, address);
-  memcpy(data_read, miso_buffer, read_len);
+  if (data_read != NULL) memcpy(data_read, miso_buffer, read_len);
+
+  return ret;
+}
 
+esp_err_t ads8689_configure (const ads8689_config_t *new_config) {
+  if (streaming) return ESP_ERR_INVALID_STATE;
+  esp_err_t ret = ads8689_config_check(new_config);
+  if (ret != ESP_OK) return ret;
+
+  if (new_config->spi_clock != config.spi_clock) {
+    /* The clock divider is set when the device is added */
+    spi_device_release_bus(spi_handle);
+    ESP_ERROR_CHECK(spi_bus_remove_device(spi_handle));
+    dev_cfg.clock_speed_hz = new_config->spi_clock;
+    ESP_ERROR_CHECK(spi_bus_add_device(spi_host, &dev_cfg, &spi_handle));
+    ESP_ERROR_CHECK(spi_device_acquire_bus(spi_handle, portMAX_DELAY));
+  }
+  config = *new_config;
+  ret = ads8689_config_write(&config);
+  ESP_LOGI(
+    LOG_TAG, "Range %#x, %s SDO, SPI at %u Hz, alarms %u..%u",
+    config.range, config.sdo_mode == ADS8689_SDO_DUAL ? "dual" : "single",
+    ads8689_config_spi_clock(config.spi_clock), config.alarm_low, config.alarm_high
+  );
   return ret;
 }
 
-static volatile int64_t real_timer_period;
+void ads8689_get_config (ads8689_config_t *current, uint32_t *spi_clock) {
+  *current = config;
+  if (spi_clock != NULL) *spi_clock = ads8689_config_spi_clock(config.spi_clock);
+}
 
 static void IRAM_ATTR read_timer_callback (void *arg) {
+  ads8689_stats_conversion_isr(cpu_hal_get_cycle_count());
+  int64_t time = esp_timer_get_time();
   #if USE_HW_TIMER
+  /* Counter restarted from 0 at the alarm, its value in 100ns ticks is the interrupt latency */
+  TIMERG0.hw_timer[timer_id].update = 1;
+  uint32_t latency_ns = TIMERG0.hw_timer[timer_id].cnt_low * 100;
+  ads8689_stats_latency_isr(latency_ns);
+  /* Latched on the alarm grid, the mean latency is the same offset on every board */
+  time -= (latency_ns + 500) / 1000;
+
   // Get interrupt status
 	uint32_t intr_status = TIMERG0.int_st_timers.val;
 	
@@ -144,39 +227,140 @@ static void IRAM_ATTR read_timer_callback (void *arg) {
 
   #endif
 
-  start_time = esp_timer_get_time();
+  if (conversions % CLOCK_LATCH_PERIOD == 0) ads8689_stream_latch_clock(conversions, time);
+  conversions++;
   spi_bus_hal.hw->cmd.usr = 1;
   // esp_timer_isr_dispatch_need_yield();
 }
 
-
-void ads8689_start_stream (size_t buffer_len, int64_t sample_freq) {
-  if (sample_freq > 100000) {
-    ESP_LOGE(LOG_TAG, "Invalid sample frequency, stream not started");
+/* Every edges_per_sample encoder edges, the counter limit */
+static void IRAM_ATTR encoder_edge_isr (void *arg) {
+  /* Edge before the last frame was read, the angle is off until the next TDC */
+  if (spi_bus_hal.hw->cmd.usr) {
+    ads8689_encoder_skipped_isr();
     return;
   }
+  ads8689_stats_conversion_isr(cpu_hal_get_cycle_count());
+  if (conversions % CLOCK_LATCH_PERIOD == 0) ads8689_stream_latch_clock(conversions, esp_timer_get_time());
+  conversions++;
+  spi_bus_hal.hw->cmd.usr = 1;
+}
 
-  /* Create stream buffer */
-  data_stream_buffer = xStreamBufferCreate(buffer_len, 10);
+static void IRAM_ATTR tdc_isr (void *arg) {
+  /* The division starts over on the edge after the pulse */
+  PCNT.ctrl.val |= BIT(ENCODER_PCNT_UNIT * 2);
+  PCNT.ctrl.val &= ~BIT(ENCODER_PCNT_UNIT * 2);
+  ads8689_encoder_tdc_isr(conversions);
+}
 
-  /* Switch spi trans_done interrupt for one locally defined */
-  // free spi intr
-  intr_handle_t spi_int = spi_bus_get_intr(spi_host);
-  ESP_ERROR_CHECK(esp_intr_disable(spi_int));
-  ESP_ERROR_CHECK(esp_intr_free(spi_int));
-  
+
+static void setup_per_sample_intr () {
   // select intr signal
   int spi_intr_source = spi_periph_signal[spi_host].irq;
   esp_intr_enable_source(spi_intr_source);
   
   // alloc a new lv3 intr
-  intr_handle_t spi_intr_handle;
-  ESP_ERROR_CHECK(esp_intr_alloc(spi_intr_source, ESP_INTR_FLAG_LEVEL3 | ESP_INTR_FLAG_IRAM | ESP_INTR_FLAG_INTRDISABLED, spi_handler, NULL, &spi_intr_handle));
-  ESP_ERROR_CHECK(esp_intr_enable(spi_intr_handle));
+  ESP_ERROR_CHECK(esp_intr_alloc(spi_intr_source, ESP_INTR_FLAG_LEVEL3 | ESP_INTR_FLAG_IRAM | ESP_INTR_FLAG_INTRDISABLED, spi_handler, NULL, &stream_intr_handle));
+  ESP_ERROR_CHECK(esp_intr_enable(stream_intr_handle));
+}
+
+static void setup_dma_intr () {
+  spi_dev_t *dev = spi_bus_hal.hw;
+
+  /* Kept across restarts, the chain is rebuilt over them */
+  if (dma_desc == NULL) dma_desc = (lldesc_t*) heap_caps_malloc(DMA_N_BLOCKS * sizeof(lldesc_t), MALLOC_CAP_DMA);
+  if (dma_words == NULL) dma_words = (uint32_t*) heap_caps_malloc(DMA_N_BLOCKS * DMA_BLOCK_LEN * sizeof(uint32_t), MALLOC_CAP_DMA);
+  ESP_ERROR_CHECK(ads8689_dma_chain_init(&dma_chain, dma_desc, dma_words, DMA_N_BLOCKS, DMA_BLOCK_LEN) ? ESP_OK : ESP_ERR_NO_MEM);
+
+  /* No per transaction interrupt, timer still starts each conversion */
+  dev->slave.trans_inten = 0;
+  dev->slave.trans_done = 0;
+
+  /* Same 32 bit frame as the per sample path, but received through DMA */
+  dev->user.usr_mosi = 0;
+  dev->user.usr_miso = 1;
+  dev->miso_dlen.usr_miso_dbitlen = 32 - 1;
+
+  /* Reset DMA state and keep the inlink running across transactions */
+  dev->dma_conf.val |= SPI_IN_RST | SPI_AHBM_RST | SPI_AHBM_FIFO_RST;
+  dev->dma_conf.val &= ~(SPI_IN_RST | SPI_AHBM_RST | SPI_AHBM_FIFO_RST);
+  dev->dma_conf.indscr_burst_en = 1;
+  dev->dma_conf.dma_rx_stop = 0;
+  dev->dma_conf.dma_continue = 1;
+
+  dev->dma_in_link.addr = (uint32_t) ads8689_dma_chain_head(&dma_chain) & 0xFFFFF;
+  dev->dma_in_link.start = 1;
+
+  /* One interrupt each time a descriptor (block of samples) is done */
+  dev->dma_int_clr.val = UINT32_MAX;
+  dev->dma_int_ena.val = 0;
+  dev->dma_int_ena.in_done = 1;
+
+  int dma_intr_source = spi_periph_signal[spi_host].irq_dma;
+  esp_intr_enable_source(dma_intr_source);
+
+  ESP_ERROR_CHECK(esp_intr_alloc(dma_intr_source, ESP_INTR_FLAG_LEVEL3 | ESP_INTR_FLAG_IRAM | ESP_INTR_FLAG_INTRDISABLED, spi_dma_handler, NULL, &stream_intr_handle));
+  ESP_ERROR_CHECK(esp_intr_enable(stream_intr_handle));
+}
+
+/* Data phase on one or two lines, two lines only read like the DMA frame */
+static void setup_sdo_lines () {
+  spi_dev_t *dev = spi_bus_hal.hw;
+  bool dual = config.sdo_mode == ADS8689_SDO_DUAL;
+  dev->ctrl.fread_dual = dual;
+  dev->user.doutdin = !dual;
+}
+
+/* Sample ring and stream interrupts, whatever clocks the conversions */
+static bool setup_stream (size_t buffer_len, float rate, ads8689_stream_mode_t mode) {
+  if (ads8689_stream_init(buffer_len, rate) != ESP_OK) {
+    ESP_LOGE(LOG_TAG, "Failed to allocate sample ring, stream not started");
+    return false;
+  }
+  conversions = 0;
+
+  /* Switch spi trans_done interrupt for one locally defined */
+  // free spi intr, once: the stream interrupts are freed again by ads8689_stop_stream()
+  if (!bus_intr_freed) {
+    intr_handle_t spi_int = spi_bus_get_intr(spi_host);
+    ESP_ERROR_CHECK(esp_intr_disable(spi_int));
+    ESP_ERROR_CHECK(esp_intr_free(spi_int));
+    bus_intr_freed = true;
+  }
+
+  if (mode == ADS8689_STREAM_DMA) setup_dma_intr();
+  else setup_per_sample_intr();
+  setup_sdo_lines();
+  return true;
+}
+
+float ads8689_start_stream (size_t buffer_len, int64_t sample_freq, ads8689_stream_mode_t mode) {
+  ads8689_config_t requested = config;
+  requested.sample_freq = (uint32_t) sample_freq;
+  if (streaming || ads8689_config_check(&requested) != ESP_OK) {
+    ESP_LOGE(LOG_TAG, "Invalid sample frequency, stream not started");
+    return 0;
+  }
+  config.sample_freq = requested.sample_freq;
+
+  /* Conversions on a grid of whole timer ticks */
+  #if USE_HW_TIMER
+  uint32_t ticks = ads8689_config_timer_ticks(config.sample_freq);
+  float timer_rate = ads8689_config_timer_rate(config.sample_freq);
+  #else
+  int64_t period_us = (1000000 + sample_freq / 2) / sample_freq;
+  float timer_rate = 1e6f / (float) period_us;
+  #endif
+
+  if (!setup_stream(buffer_len, timer_rate, mode)) return 0;
+  ads8689_encoder_reset(0);
+  encoder_clocked = false;
 
   /* Create the reading timer */
-  int64_t sample_period = 1000000 / sample_freq;
-  printf("sample time %lld\n", sample_period);
+  printf("sample rate %.2f Hz\n", timer_rate);
+  ads8689_stats_set_period(
+    (uint32_t) ((float) CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ * 1e6f / timer_rate), CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ
+  );
 
 
   #if USE_HW_TIMER
@@ -190,7 +374,7 @@ void ads8689_start_stream (size_t buffer_len, int64_t sample_freq) {
     .auto_reload = TIMER_AUTORELOAD_EN,
     .divider = 8
   };
-  /* With divider 8, counter resolution is 100ns, so we multiply 10 times the us time */
+  /* With divider 8, counter resolution is 100ns, ADS8689_TIMER_HZ */
 
 	timer_init(timer_group, timer_id, &hw_timer_config);
 	
@@ -198,17 +382,16 @@ void ads8689_start_stream (size_t buffer_len, int64_t sample_freq) {
 	timer_set_counter_value(timer_group, timer_id, 0x00000000ULL);
 	
 	// Set timer alarm
-  uint64_t overflow_value = sample_period * 10;
-  printf("Overflow value %lld\n", overflow_value);
-	timer_set_alarm_value(timer_group, timer_id, overflow_value);
+  printf("Overflow value %u\n", ticks);
+	timer_set_alarm_value(timer_group, timer_id, ticks);
 	timer_enable_intr(timer_group, timer_id);
-	timer_isr_register(timer_group, timer_id, read_timer_callback, NULL, ESP_INTR_FLAG_IRAM | ESP_INTR_FLAG_LEVEL1, NULL);	
+	timer_isr_register(timer_group, timer_id, read_timer_callback, NULL, ESP_INTR_FLAG_IRAM | ESP_INTR_FLAG_LEVEL1, &timer_intr_handle);	
   
+  streaming = true;
   vTaskDelay(pdMS_TO_TICKS(100));
   timer_start(timer_group, timer_id);
 
   #else
-  esp_timer_handle_t read_timer_handle;
   esp_timer_create_args_t read_timer_args = {
     .callback = &read_timer_callback,
     .arg = NULL,
@@ -217,22 +400,99 @@ void ads8689_start_stream (size_t buffer_len, int64_t sample_freq) {
   };
 
   esp_timer_create(&read_timer_args, &read_timer_handle);
-  esp_timer_start_periodic(read_timer_handle, 1000000 / sample_freq);
+  streaming = true;
+  esp_timer_start_periodic(read_timer_handle, period_us);
   #endif
+  return timer_rate;
 }
 
-static void set_avg_sample_frequency (int64_t *read_time, size_t len, float *fs) {
-  if (fs == NULL) return;
-  float avg_period = 0;
-  for (int i = 0; i < len; i++) {
-    avg_period += read_time[i];
+float ads8689_start_encoder_stream (size_t buffer_len, const ads8689_encoder_config_t *encoder, ads8689_stream_mode_t mode) {
+  if (streaming || ads8689_encoder_check(encoder, &config) != ESP_OK) {
+    ESP_LOGE(LOG_TAG, "Invalid encoder settings, stream not started");
+    return 0;
   }
-  *fs = (float) len * 1000000 / avg_period;
+  encoder_config = *encoder;
+  float rate = (float) encoder->max_rate;
+  if (!setup_stream(buffer_len, rate, mode)) return 0;
+  ads8689_encoder_reset(ads8689_encoder_cycle_len(encoder));
+  encoder_clocked = true;
+  /* No nominal period, the engine speed sets it */
+  ads8689_stats_set_period(0, CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ);
+
+  /* Rising edges only, the counter wraps to 0 at the limit and interrupts */
+  pcnt_config_t pcnt_config = {
+    .pulse_gpio_num = encoder->encoder_gpio,
+    .ctrl_gpio_num = PCNT_PIN_NOT_USED,
+    .channel = PCNT_CHANNEL_0,
+    .unit = ENCODER_PCNT_UNIT,
+    .pos_mode = PCNT_COUNT_INC,
+    .neg_mode = PCNT_COUNT_DIS,
+    .lctrl_mode = PCNT_MODE_KEEP,
+    .hctrl_mode = PCNT_MODE_KEEP,
+    .counter_h_lim = (int16_t) encoder->edges_per_sample,
+    .counter_l_lim = 0
+  };
+  ESP_ERROR_CHECK(pcnt_unit_config(&pcnt_config));
+  pcnt_set_filter_value(ENCODER_PCNT_UNIT, ENCODER_FILTER);
+  pcnt_filter_enable(ENCODER_PCNT_UNIT);
+  pcnt_event_enable(ENCODER_PCNT_UNIT, PCNT_EVT_H_LIM);
+  pcnt_counter_pause(ENCODER_PCNT_UNIT);
+  pcnt_counter_clear(ENCODER_PCNT_UNIT);
+  ESP_ERROR_CHECK(pcnt_isr_service_install(ESP_INTR_FLAG_IRAM | ESP_INTR_FLAG_LEVEL1));
+  ESP_ERROR_CHECK(pcnt_isr_handler_add(ENCODER_PCNT_UNIT, encoder_edge_isr, NULL));
+
+  /* TDC on the same level, it cannot preempt an encoder edge half way */
+  gpio_set_direction(encoder->tdc_gpio, GPIO_MODE_INPUT);
+  gpio_set_intr_type(encoder->tdc_gpio, GPIO_INTR_POSEDGE);
+  esp_err_t ret = gpio_install_isr_service(ESP_INTR_FLAG_IRAM | ESP_INTR_FLAG_LEVEL1);
+  if (ret != ESP_ERR_INVALID_STATE) ESP_ERROR_CHECK(ret);
+  ESP_ERROR_CHECK(gpio_isr_handler_add(encoder->tdc_gpio, tdc_isr, NULL));
+
+  printf("encoder clocked, %u edges a conversion, %u conversions a cycle\n",
+    encoder->edges_per_sample, ads8689_encoder_cycle_len(encoder));
+  streaming = true;
+  vTaskDelay(pdMS_TO_TICKS(100));
+  pcnt_counter_resume(ENCODER_PCNT_UNIT);
+  return rate;
 }
 
+void ads8689_stop_stream () {
+  if (!streaming) return;
+
+  if (encoder_clocked) {
+    pcnt_counter_pause(ENCODER_PCNT_UNIT);
+    pcnt_isr_handler_remove(ENCODER_PCNT_UNIT);
+    pcnt_isr_service_uninstall();
+    gpio_isr_handler_remove(encoder_config.tdc_gpio);
+    gpio_set_intr_type(encoder_config.tdc_gpio, GPIO_INTR_DISABLE);
+    encoder_clocked = false;
+  } else {
+    #if USE_HW_TIMER
+    timer_pause(TIMER_GROUP_0, TIMER_0);
+    timer_disable_intr(TIMER_GROUP_0, TIMER_0);
+    esp_intr_free(timer_intr_handle);
+    timer_intr_handle = NULL;
+    #else
+    esp_timer_stop(read_timer_handle);
+    esp_timer_delete(read_timer_handle);
+    read_timer_handle = NULL;
+    #endif
+  }
 
-size_t ads8689_read_buffer (int16_t *dest, size_t max_len, float *fs) {
-  size_t bytes_read = xStreamBufferReceive(data_stream_buffer, (void*) dest, max_len * sizeof(int16_t), 0);
-  return bytes_read / sizeof(int16_t);
+  /* The last frame the timer started finishes on its own */
+  spi_dev_t *dev = spi_bus_hal.hw;
+  while (dev->cmd.usr);
+  esp_intr_free(stream_intr_handle);
+  stream_intr_handle = NULL;
+
+  /* Back to what the driver transactions expect */
+  dev->dma_int_ena.val = 0;
+  dev->dma_int_clr.val = UINT32_MAX;
+  dev->dma_in_link.stop = 1;
+  dev->dma_conf.dma_continue = 0;
+  dev->dma_conf.val |= SPI_IN_RST | SPI_AHBM_RST | SPI_AHBM_FIFO_RST;
+  dev->dma_conf.val &= ~(SPI_IN_RST | SPI_AHBM_RST | SPI_AHBM_FIFO_RST);
+  dev->ctrl.fread_dual = 0;
+  dev->user.doutdin = 1;
+  streaming = false;
 }
-
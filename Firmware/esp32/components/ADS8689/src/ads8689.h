@@ -3,6 +3,11 @@
 
 #include "driver/gpio.h"
 #include "driver/spi_common.h"
+#include "freertos/FreeRTOS.h"
+
+#include "ads8689_stats.h"
+#include "ads8689_config.h"
+#include "ads8689_encoder.h"
 
 /* Register mapping */
 typedef enum ads8689_reg_t {
@@ -29,6 +34,14 @@ typedef enum ads8689_commands_t {
   ADS8689_SET_HWORD    = 0b1101100
 } ads8689_commands_t;
 
+/* Stream acquisition modes */
+typedef enum ads8689_stream_mode_t {
+  /** SPI interrupt for every sample */
+  ADS8689_STREAM_PER_SAMPLE = 0,
+  /** SPI DMA fills ping-pong blocks, one interrupt per block */
+  ADS8689_STREAM_DMA
+} ads8689_stream_mode_t;
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -37,21 +50,57 @@ extern "C"
 /* Init SPI driver for configuration */
 esp_err_t ads8689_init (spi_bus_config_t spi_config, gpio_num_t cs_gpio, spi_host_device_t spi_host_id);
 
-/* Transmit commands to the device */
+/* Transmit commands to the device, not while streaming */
 esp_err_t ads8689_transmit (
   ads8689_commands_t command, ads8689_reg_t address, 
   uint16_t data_write, uint8_t *data_read, size_t read_len
 );
 
 /**
- * @brief Creates an internal FIFO buffer and starts streaming data at 100kHz to this buffer 
+ * @brief Applies the run time settings: SPI clock, range, SDO and alarm
+ * registers. The rate is given to the next ads8689_start_stream()
+ * 
+ * @return ESP_ERR_INVALID_STATE while streaming, ESP_ERR_INVALID_ARG if
+ * ads8689_config_check() refuses the settings, which are then left as they were
+ */
+esp_err_t ads8689_configure (const ads8689_config_t *config);
+
+/**
+ * @brief Settings of the last ads8689_configure(), ADS8689_DEFAULT_CONFIG() before
  * 
- * @warning after stream starts ads8689_transmit() cannot be called anymore 
+ * @param spi_clock if not NULL, set to the clock the SPI divider gives
+ */
+void ads8689_get_config (ads8689_config_t *config, uint32_t *spi_clock);
+
+/**
+ * @brief Creates an internal sample ring and starts streaming data to this buffer 
+ * 
+ * @warning until ads8689_stop_stream() ads8689_transmit() cannot be called
+ * 
+ * @param buffer_len size in bytes to allocate the internal sample ring, rounded down to a power of two
+ * @param sample_freq value for sampling rate in Hz, within ads8689_config_check() limits
+ * @param mode per sample interrupt or block DMA acquisition
+ * @return rate the conversion timer runs at, 0 if the stream did not start
+ */
+float ads8689_start_stream (size_t buffer_len, int64_t sample_freq, ads8689_stream_mode_t mode);
+
+/**
+ * @brief Starts the stream with the conversions clocked by a shaft encoder
+ * instead of the timer, see ads8689_encoder.h. The sample index then counts
+ * crank angle steps, ads8689_sample_angle() gives the cycle and angle of each
  * 
- * @param buffer_len size to allocate internal FIFO buffer
- * @param sample_freq value for sampling rate in Hz, must be <= 100kHz
+ * @param buffer_len size in bytes of the internal sample ring
+ * @param encoder inputs and division, within ads8689_encoder_check() limits
+ * @param mode per sample interrupt or block DMA acquisition
+ * @return encoder->max_rate, the nominal rate until the rate is measured, 0 if the stream did not start
+ */
+float ads8689_start_encoder_stream (size_t buffer_len, const ads8689_encoder_config_t *encoder, ads8689_stream_mode_t mode);
+
+/**
+ * @brief Stops the conversion timer, or the encoder, and the SPI interrupts. Samples still in
+ * the ring are lost when the stream starts again, the reader must be done with them
  */
-void ads8689_start_stream (size_t buffer_len, int64_t sample_freq);
+void ads8689_stop_stream ();
 
 /**
  * @brief Retrieves data from internal FIFO buffers and copy it to dest
@@ -63,6 +112,73 @@ void ads8689_start_stream (size_t buffer_len, int64_t sample_freq);
  */
 size_t ads8689_read_buffer (int16_t *dest, size_t max_len, float *fs);
 
+/**
+ * @brief Zero copy read, gets a pointer to the oldest samples in the internal ring
+ * 
+ * The returned block stays valid until ads8689_read_release() is called
+ * 
+ * @param len set to the contiguous number of samples available
+ * @param min_len wait until at least this many samples are available
+ * @param timeout maximum ticks to wait for min_len samples, 0 returns immediately
+ * @param fs measured average sample frequency
+ * @return pointer to the samples or NULL if ring is empty
+ */
+const int16_t* ads8689_read_acquire (size_t *len, size_t min_len, TickType_t timeout, float *fs);
+
+/**
+ * @brief Gives len samples obtained from ads8689_read_acquire() back to the driver
+ */
+void ads8689_read_release (size_t len);
+
+/**
+ * @brief Reads len samples obtained from ads8689_read_acquire() without giving
+ * them back, the next read starts after them. They stay valid for another
+ * task until ads8689_read_free()
+ */
+void ads8689_read_claim (size_t len);
+
+/**
+ * @brief Gives the len oldest claimed samples back to the driver, from the
+ * one task the reader handed them to
+ */
+void ads8689_read_free (size_t len);
+
+/**
+ * @brief Index of the next sample returned by ads8689_read_acquire(), counted
+ * since the stream started including samples lost to overruns
+ * 
+ * @param gap if not NULL, set when samples were lost right before this index,
+ * cleared after reading
+ */
+uint64_t ads8689_read_index (bool *gap);
+
+/**
+ * @brief Set once overruns came faster than the reader could account for
+ * them, indexes are off by the samples lost in the merged gaps from then on
+ */
+bool ads8689_index_lost ();
+
+/**
+ * @brief Estimates the esp_timer time when the conversion of a sample was
+ * timed, from a line through the times the conversion timer latches every
+ * block (ads8689_stream_latch_clock()), moved by the task reading the stream
+ * 
+ * @param index sample index, as returned by ads8689_read_index()
+ * @return time in us
+ */
+int64_t ads8689_sample_time (uint64_t index);
+
+/**
+ * @brief Number of times samples were lost because the ring was full
+ * 
+ * @param dropped if not NULL, set to the total number of lost samples
+ * @return overrun count
+ */
+uint32_t ads8689_get_overruns (uint32_t *dropped);
+
+/** @brief Snapshot of the acquisition instrumentation, safe from any task */
+void ads8689_get_stats (ads8689_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif /* End of CPP guard */
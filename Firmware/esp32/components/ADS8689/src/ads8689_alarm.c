@@ -0,0 +1,65 @@
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include "ads8689_alarm.h"
+
+#define LOG_TAG "ADS8689"
+
+static QueueHandle_t events = NULL;
+/* Written by the stream ISR only */
+static volatile uint8_t current_flags = 0;
+static volatile uint32_t lost = 0;
+
+esp_err_t ads8689_alarm_init (size_t queue_len) {
+  if (events != NULL) return ESP_OK;
+  events = xQueueCreate(queue_len, sizeof(ads8689_alarm_event_t));
+  if (events == NULL) {
+    ESP_LOGE(LOG_TAG, "Failed to create the alarm event queue");
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+void ads8689_alarm_reset () {
+  current_flags = 0;
+}
+
+static void IRAM_ATTR queue_event (uint64_t index, int16_t sample, uint8_t flags, BaseType_t *task_woken) {
+  ads8689_alarm_event_t event = {
+    .index = index,
+    .sample = sample,
+    .flags = flags,
+    .previous = current_flags,
+    .detected = esp_timer_get_time()
+  };
+  current_flags = flags;
+  if (events == NULL || xQueueSendFromISR(events, &event, task_woken) != pdTRUE) lost++;
+}
+
+void IRAM_ATTR ads8689_alarm_scan_isr (
+  uint64_t first_index, const int16_t *samples, const uint8_t *flags, size_t len, BaseType_t *task_woken
+) {
+  if (len == 0) return;
+  /* Quiet block, only the end of an alarm to report */
+  if (flags == NULL) {
+    if (current_flags != 0) queue_event(first_index, samples[0], 0, task_woken);
+    return;
+  }
+  for (size_t i = 0; i < len; i++) {
+    if (flags[i] != current_flags) queue_event(first_index + i, samples[i], flags[i], task_woken);
+  }
+}
+
+bool ads8689_alarm_wait (ads8689_alarm_event_t *event, TickType_t timeout) {
+  return events != NULL && xQueueReceive(events, event, timeout) == pdTRUE;
+}
+
+uint8_t ads8689_alarm_flags () {
+  return current_flags;
+}
+
+uint32_t ads8689_alarm_lost () {
+  return lost;
+}
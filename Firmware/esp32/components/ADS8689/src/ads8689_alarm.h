@@ -0,0 +1,73 @@
+/**
+ * @file ads8689_alarm.h
+ *
+ * @brief Input alarm events. DATAOUT_CTL appends the active high and low input
+ * alarm flags to the data of every conversion frame, the stream ISRs hand them
+ * here with the samples. A change of the flags is queued as an event right in
+ * the ISR, one DMA block at most after the conversion, instead of waiting for
+ * the samples to reach a client.
+ *
+ * The thresholds and their hysteresis are ads8689_config_t settings, the ADC
+ * compares every conversion itself. No SPI dependency, the host simulator
+ * feeds it from its fake ADC.
+ */
+#ifndef ADS8689_ALARM_H
+#define ADS8689_ALARM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+/* Active input alarm flags, as they follow the data in the output frame */
+#define ADS8689_ALARM_LOW  (1 << 0)
+#define ADS8689_ALARM_HIGH (1 << 1)
+
+typedef struct ads8689_alarm_event_t {
+  /** Index of the first sample with the new flags */
+  uint64_t index;
+  int16_t sample;
+  /** ADS8689_ALARM_* flags from this sample on, and before it */
+  uint8_t flags;
+  uint8_t previous;
+  /** esp_timer time the ISR found the change, us */
+  int64_t detected;
+} ads8689_alarm_event_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** @brief Creates the event queue, before the stream starts */
+esp_err_t ads8689_alarm_init (size_t queue_len);
+
+/** @brief Forgets the flags of the last stream, called when a stream starts */
+void ads8689_alarm_reset ();
+
+/**
+ * @brief Queues an event for each change of the flags, ISR safe
+ * @param first_index stream index of samples[0]
+ * @param flags ADS8689_ALARM_* of each sample, NULL if none is set in the block
+ * @param task_woken set to pdTRUE if the waiting task was woken
+ */
+void ads8689_alarm_scan_isr (
+  uint64_t first_index, const int16_t *samples, const uint8_t *flags, size_t len, BaseType_t *task_woken
+);
+
+/** @brief Waits for the next event, false on timeout */
+bool ads8689_alarm_wait (ads8689_alarm_event_t *event, TickType_t timeout);
+
+/** @brief Flags of the last sample scanned */
+uint8_t ads8689_alarm_flags ();
+
+/** @brief Events dropped because the queue was full */
+uint32_t ads8689_alarm_lost ();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
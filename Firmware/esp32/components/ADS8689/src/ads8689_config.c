@@ -0,0 +1,93 @@
+#include "esp_log.h"
+
+#include "ads8689.h"
+#include "ads8689_config.h"
+
+#define LOG_TAG "ADS8689"
+
+/* SDO_CTL_REG: SDO-1 as the second data line */
+#define SDO1_CONFIG_DATA (0x3 << 8)
+/* ALARM_H_TH_REG upper half, INP_ALRM_HYST[3:0] in bits 31:28 */
+#define ALARM_HYST_SHIFT (12)
+#define ALARM_HYST_MAX (15)
+/* DATAOUT_CTL_REG: IN_ACTIVE_ALARM_INCL, the active high and low input alarm flags follow the data */
+#define DATAOUT_ALARM_FLAGS (0x3 << 10)
+
+static bool range_valid (ads8689_range_t range) {
+  return range <= ADS8689_RANGE_PM_0_625_VREF || (range >= ADS8689_RANGE_0_3_VREF && range <= ADS8689_RANGE_0_1_25_VREF);
+}
+
+uint32_t ads8689_config_timer_ticks (uint32_t sample_freq) {
+  if (sample_freq == 0) return 0;
+  return (ADS8689_TIMER_HZ + sample_freq / 2) / sample_freq;
+}
+
+float ads8689_config_timer_rate (uint32_t sample_freq) {
+  uint32_t ticks = ads8689_config_timer_ticks(sample_freq);
+  return ticks > 0 ? (float) ADS8689_TIMER_HZ / (float) ticks : 0;
+}
+
+uint32_t ads8689_config_spi_clock (uint32_t spi_clock) {
+  if (spi_clock == 0) return 0;
+  uint32_t divider = (ADS8689_SPI_SOURCE_HZ + spi_clock - 1) / spi_clock;
+  return ADS8689_SPI_SOURCE_HZ / divider;
+}
+
+float ads8689_config_lsb_volts (ads8689_range_t range) {
+  /* Multiples of VREF of each RANGE_SEL code, a bipolar span is twice its bound */
+  static const float spans[] = {
+    [ADS8689_RANGE_PM_3_VREF] = 6, [ADS8689_RANGE_PM_2_5_VREF] = 5, [ADS8689_RANGE_PM_1_5_VREF] = 3,
+    [ADS8689_RANGE_PM_1_25_VREF] = 2.5f, [ADS8689_RANGE_PM_0_625_VREF] = 1.25f,
+    [ADS8689_RANGE_0_3_VREF] = 3, [ADS8689_RANGE_0_2_5_VREF] = 2.5f, [ADS8689_RANGE_0_1_5_VREF] = 1.5f,
+    [ADS8689_RANGE_0_1_25_VREF] = 1.25f
+  };
+  if (!range_valid(range)) return 0;
+  return spans[range] * ADS8689_VREF / 65536;
+}
+
+uint32_t ads8689_config_max_rate (const ads8689_config_t *config) {
+  uint32_t clock = ads8689_config_spi_clock(config->spi_clock);
+  if (clock == 0) return 0;
+  uint32_t clocks = ADS8689_FRAME_BITS / (config->sdo_mode == ADS8689_SDO_DUAL ? 2 : 1);
+  uint64_t cycle_ns = ADS8689_CONV_TIME_NS + (uint64_t) clocks * 1000000000ULL / clock;
+  uint32_t rate = (uint32_t) (1000000000ULL / cycle_ns);
+  return rate < ADS8689_MAX_SAMPLE_FREQ ? rate : ADS8689_MAX_SAMPLE_FREQ;
+}
+
+esp_err_t ads8689_config_check (const ads8689_config_t *config) {
+  if (!range_valid(config->range) || config->sdo_mode > ADS8689_SDO_DUAL) {
+    ESP_LOGE(LOG_TAG, "Invalid range %d or SDO mode %d", config->range, config->sdo_mode);
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (config->spi_clock == 0 || config->spi_clock > ADS8689_MAX_SPI_CLOCK) {
+    ESP_LOGE(LOG_TAG, "SPI clock %u Hz out of range, at most %u Hz", config->spi_clock, ADS8689_MAX_SPI_CLOCK);
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (config->alarm_hysteresis > ALARM_HYST_MAX || config->alarm_low > config->alarm_high) {
+    ESP_LOGE(LOG_TAG, "Invalid alarm thresholds %u..%u, hysteresis %u", config->alarm_low, config->alarm_high, config->alarm_hysteresis);
+    return ESP_ERR_INVALID_ARG;
+  }
+  uint32_t max_rate = ads8689_config_max_rate(config);
+  if (config->sample_freq < ADS8689_MIN_SAMPLE_FREQ || config->sample_freq > max_rate) {
+    ESP_LOGE(
+      LOG_TAG, "Sample frequency %u Hz out of range, %u to %u Hz with this SPI clock and SDO mode",
+      config->sample_freq, ADS8689_MIN_SAMPLE_FREQ, max_rate
+    );
+    return ESP_ERR_INVALID_ARG;
+  }
+  return ESP_OK;
+}
+
+esp_err_t ads8689_config_write (const ads8689_config_t *config) {
+  uint16_t sdo = config->sdo_mode == ADS8689_SDO_DUAL ? SDO1_CONFIG_DATA : 0;
+  esp_err_t ret = ads8689_transmit(ADS8689_WRITE_LS, ADS8689_RANGE_SEL_REG, config->range, NULL, 0);
+  ret |= ads8689_transmit(ADS8689_WRITE_FULL, ADS8689_SDO_CTL_REG, sdo, NULL, 0);
+  ret |= ads8689_transmit(ADS8689_WRITE_FULL, ADS8689_DATAOUT_CTL_REG, DATAOUT_ALARM_FLAGS, NULL, 0);
+  ret |= ads8689_transmit(ADS8689_WRITE_FULL, ADS8689_ALARM_H_TH_REG, config->alarm_high, NULL, 0);
+  ret |= ads8689_transmit(
+    ADS8689_WRITE_FULL, (ads8689_reg_t) (ADS8689_ALARM_H_TH_REG + 2),
+    (uint16_t) config->alarm_hysteresis << ALARM_HYST_SHIFT, NULL, 0
+  );
+  ret |= ads8689_transmit(ADS8689_WRITE_FULL, ADS8689_ALARM_L_TH_REG, config->alarm_low, NULL, 0);
+  return ret == ESP_OK ? ESP_OK : ESP_FAIL;
+}
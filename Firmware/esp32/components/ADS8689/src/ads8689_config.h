@@ -0,0 +1,117 @@
+/**
+ * @file ads8689_config.h
+ *
+ * @brief Run time settings of the ADS8689: conversion rate, input range, SDO
+ * mode, SPI clock and input alarm thresholds. Checks and register values
+ * only, the SPI peripheral is set by ads8689_configure(), so the host
+ * simulator shares them with its fake ADC.
+ */
+#ifndef ADS8689_CONFIG_H
+#define ADS8689_CONFIG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+/* Fastest conversion rate of the ADS8689 */
+#define ADS8689_MAX_SAMPLE_FREQ (100000)
+/* Slowest rate, the conversion timer alarm stays within 32 bits */
+#define ADS8689_MIN_SAMPLE_FREQ (10)
+/* Time kept for the conversion between two frames, a frame is clocked out after it, ns */
+#define ADS8689_CONV_TIME_NS (8000)
+/* Bits clocked per conversion frame, data and status */
+#define ADS8689_FRAME_BITS (32)
+/* SPI clock source, the clock is this divided by a whole number */
+#define ADS8689_SPI_SOURCE_HZ (80000000)
+/* Fastest SPI clock through the GPIO matrix */
+#define ADS8689_MAX_SPI_CLOCK (ADS8689_SPI_SOURCE_HZ / 3)
+/* Conversion timer resolution, APB clock divided by 8 */
+#define ADS8689_TIMER_HZ (10000000)
+/* Internal reference the input ranges are multiples of, V */
+#define ADS8689_VREF (4.096f)
+
+/* Input range, RANGE_SEL codes as multiples of the 4.096 V internal reference */
+typedef enum ads8689_range_t {
+  ADS8689_RANGE_PM_3_VREF     = 0x0,
+  ADS8689_RANGE_PM_2_5_VREF   = 0x1,
+  ADS8689_RANGE_PM_1_5_VREF   = 0x2,
+  ADS8689_RANGE_PM_1_25_VREF  = 0x3,
+  ADS8689_RANGE_PM_0_625_VREF = 0x4,
+  ADS8689_RANGE_0_3_VREF      = 0x8,
+  ADS8689_RANGE_0_2_5_VREF    = 0x9,
+  ADS8689_RANGE_0_1_5_VREF    = 0xA,
+  ADS8689_RANGE_0_1_25_VREF   = 0xB
+} ads8689_range_t;
+
+/* Data output lines */
+typedef enum ads8689_sdo_mode_t {
+  /** Data on SDO-0 only, SDO-1 tri-stated */
+  ADS8689_SDO_SINGLE = 0,
+  /** Data on SDO-0 and SDO-1, half the clocks per frame */
+  ADS8689_SDO_DUAL
+} ads8689_sdo_mode_t;
+
+typedef struct ads8689_config_t {
+  /** Conversions per second, the timer gives the nearest whole number of ticks */
+  uint32_t sample_freq;
+  ads8689_range_t range;
+  ads8689_sdo_mode_t sdo_mode;
+  /** SPI clock in Hz, the divider gives the nearest clock below */
+  uint32_t spi_clock;
+  /** Input alarm thresholds in output codes, both crossed ways by alarm_hysteresis (0 to 15) */
+  uint16_t alarm_high;
+  uint16_t alarm_low;
+  uint8_t alarm_hysteresis;
+} ads8689_config_t;
+
+/* Settings of the boards so far: 100 kHz, +-1.25 Vref, SDO-0 at 20 MHz, alarms at the ends of the codes */
+#define ADS8689_DEFAULT_CONFIG() { \
+  .sample_freq = 100000, \
+  .range = ADS8689_RANGE_PM_1_25_VREF, \
+  .sdo_mode = ADS8689_SDO_SINGLE, \
+  .spi_clock = 20000000, \
+  .alarm_high = UINT16_MAX, \
+  .alarm_low = 0, \
+  .alarm_hysteresis = 0 \
+}
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Checks the settings, the frame must be clocked out between the end
+ * of a conversion and the start of the next
+ * @returns ESP_ERR_INVALID_ARG if a setting is out of range or the frame does not fit
+ */
+esp_err_t ads8689_config_check (const ads8689_config_t *config);
+
+/** @brief Conversion timer alarm period in ticks of ADS8689_TIMER_HZ for a rate */
+uint32_t ads8689_config_timer_ticks (uint32_t sample_freq);
+
+/** @brief Rate the conversion timer runs at when asked for sample_freq */
+float ads8689_config_timer_rate (uint32_t sample_freq);
+
+/** @brief SPI clock the divider gives when asked for spi_clock */
+uint32_t ads8689_config_spi_clock (uint32_t spi_clock);
+
+/** @brief Input voltage step of one output code in a range, the span over 2^16 */
+float ads8689_config_lsb_volts (ads8689_range_t range);
+
+/** @brief Fastest rate the frame transfer allows with these SDO mode and SPI clock */
+uint32_t ads8689_config_max_rate (const ads8689_config_t *config);
+
+/**
+ * @brief Writes the range, SDO and alarm registers with ads8689_transmit(),
+ * only while the stream is stopped. DATAOUT_CTL puts the active input alarm
+ * flags after the data of every frame, see ads8689_alarm.h
+ */
+esp_err_t ads8689_config_write (const ads8689_config_t *config);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,82 @@
+#include <string.h>
+
+#include "ads8689_dma_chain.h"
+
+#ifndef IRAM_ATTR
+#define IRAM_ATTR
+#endif
+
+/* Same as the per sample path: data in bits 29:14 of the frame, then the high and low input alarm flags */
+#define FRAME_TO_SAMPLE(frame) ((int16_t) ((frame) >> 14))
+#define FRAME_TO_FLAGS(frame) ((uint8_t) (((frame) >> 12) & 0x3))
+
+bool ads8689_dma_chain_init (
+  ads8689_dma_chain_t *chain, lldesc_t *desc, uint32_t *words,
+  size_t n_blocks, size_t block_len
+) {
+  if (chain == NULL || desc == NULL || words == NULL) return false;
+  if (n_blocks < 2 || block_len == 0 || block_len > ADS8689_DMA_MAX_BLOCK_LEN) return false;
+
+  chain->desc = desc;
+  chain->words = words;
+  chain->n_blocks = n_blocks;
+  chain->block_len = block_len;
+
+  ads8689_dma_chain_reset(chain);
+  return true;
+}
+
+void ads8689_dma_chain_reset (ads8689_dma_chain_t *chain) {
+  size_t block_bytes = chain->block_len * sizeof(uint32_t);
+  memset(chain->desc, 0, chain->n_blocks * sizeof(lldesc_t));
+
+  for (size_t i = 0; i < chain->n_blocks; i++) {
+    lldesc_t *d = &chain->desc[i];
+    d->size = block_bytes;
+    d->length = 0;
+    d->offset = 0;
+    d->sosf = 0;
+    d->eof = 0;
+    d->owner = 1;
+    d->buf = (uint8_t*) &chain->words[i * chain->block_len];
+    /* Last descriptor points back to the first, closing the ping-pong ring */
+    d->qe.stqe_next = &chain->desc[(i + 1) % chain->n_blocks];
+  }
+  chain->next = 0;
+  chain->overruns = 0;
+}
+
+size_t IRAM_ATTR ads8689_dma_chain_service (
+  ads8689_dma_chain_t *chain, uint32_t filling, ads8689_block_cb cb, void *arg
+) {
+  size_t handled = 0;
+
+  /* The DMA came around the ring to the oldest block, still full: it writes over it */
+  lldesc_t *oldest = &chain->desc[chain->next];
+  if (!oldest->owner && ((uint32_t) (uintptr_t) oldest & 0xFFFFF) == (filling & 0xFFFFF)) chain->overruns++;
+
+  while (handled < chain->n_blocks) {
+    lldesc_t *d = &chain->desc[chain->next];
+    /* DMA clears owner once the descriptor buffer is full */
+    if (d->owner) break;
+
+    uint32_t *words = (uint32_t*) d->buf;
+    int16_t *samples = (int16_t*) d->buf;
+    /* In place conversion, sample i is written before word i + 1 is read */
+    uint8_t any_flag = 0;
+    for (size_t i = 0; i < chain->block_len; i++) {
+      uint32_t frame = __builtin_bswap32(words[i]);
+      samples[i] = FRAME_TO_SAMPLE(frame);
+      chain->flags[i] = FRAME_TO_FLAGS(frame);
+      any_flag |= chain->flags[i];
+    }
+    if (cb != NULL) cb(samples, any_flag ? chain->flags : NULL, chain->block_len, arg);
+
+    d->length = 0;
+    d->owner = 1;
+    chain->next = (chain->next + 1) % chain->n_blocks;
+    handled++;
+  }
+
+  return handled;
+}
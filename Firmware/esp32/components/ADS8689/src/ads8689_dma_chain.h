@@ -0,0 +1,85 @@
+/**
+ * @file ads8689_dma_chain.h
+ *
+ * @brief Block bookkeeping for the DMA acquisition mode. A circular list of
+ * lldesc_t descriptors, each one holding a block of raw 32 bit SPI frames, is
+ * filled by the SPI DMA while the ISR converts the completed blocks to samples
+ * and the input alarm flags that follow the data of each frame.
+ *
+ * This file has no dependency on the SPI peripheral so it can be built against
+ * the lldesc_t mock in host/stubs.
+ */
+#ifndef ADS8689_DMA_CHAIN_H
+#define ADS8689_DMA_CHAIN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "rom/lldesc.h"
+
+/* Hardware limit for one descriptor is 4095 bytes, each sample uses one 32 bit word */
+#define ADS8689_DMA_MAX_BLOCK_LEN (1020)
+
+/* flags holds the ADS8689_ALARM_* bits of each sample, NULL when none is set in the block */
+typedef void (*ads8689_block_cb) (const int16_t *samples, const uint8_t *flags, size_t len, void *arg);
+
+typedef struct ads8689_dma_chain_t {
+  lldesc_t *desc;
+  uint32_t *words;
+  size_t n_blocks;
+  size_t block_len;
+  /** Index of the next descriptor the DMA will complete */
+  size_t next;
+  /** Number of services that found the DMA back in the oldest block, not read yet */
+  uint32_t overruns;
+  /** Alarm flags of the block being handed to the callback */
+  uint8_t flags[ADS8689_DMA_MAX_BLOCK_LEN];
+} ads8689_dma_chain_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Links n_blocks descriptors in a ring and gives all of them to the DMA
+ *
+ * @param desc memory for n_blocks descriptors, must be DMA capable
+ * @param words memory for n_blocks * block_len words, must be DMA capable
+ * @return false if parameters are out of the hardware limits
+ */
+bool ads8689_dma_chain_init (
+  ads8689_dma_chain_t *chain, lldesc_t *desc, uint32_t *words,
+  size_t n_blocks, size_t block_len
+);
+
+/** @brief Puts all descriptors back to the DMA and restarts from the first one */
+void ads8689_dma_chain_reset (ads8689_dma_chain_t *chain);
+
+/**
+ * @brief Converts every block completed by the DMA, calls cb for each one and
+ * returns the descriptor to the DMA. Meant to be called from the DMA ISR.
+ *
+ * Samples are converted in place, so the pointer given to cb is only valid
+ * inside the callback. Blocks the DMA completes meanwhile are handled too, an
+ * overrun is only counted when the DMA was filling the oldest block already.
+ *
+ * @param filling address of the descriptor the DMA is filling, compared on
+ * the 20 bits of the inlink address
+ * @return number of blocks handled
+ */
+size_t ads8689_dma_chain_service (
+  ads8689_dma_chain_t *chain, uint32_t filling, ads8689_block_cb cb, void *arg
+);
+
+/** @brief First descriptor of the chain, to be loaded in the inlink address */
+static inline lldesc_t* ads8689_dma_chain_head (ads8689_dma_chain_t *chain) {
+  return &chain->desc[0];
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,135 @@
+#include <string.h>
+
+#include "esp_attr.h"
+
+#include "ads8689_encoder.h"
+
+/* Angle 0 of the last two cycles seen, written by the TDC ISR and read
+ * consistently from any task, the same scheme as the sample clock */
+typedef struct angle_latch_t {
+  volatile uint32_t seq;
+  volatile uint64_t previous;
+  volatile uint32_t previous_cycle;
+  volatile uint64_t tdc;
+  volatile uint32_t cycle;
+} angle_latch_t;
+
+static angle_latch_t latch;
+static volatile uint32_t cycle_len = 0;
+
+/* TDC ISR state */
+static bool synced = false;
+static bool has_candidate = false;
+static uint64_t candidate = 0;
+static uint32_t late_run = 0;
+static ads8689_encoder_stats_t stats;
+
+esp_err_t ads8689_encoder_check (const ads8689_encoder_config_t *encoder, const ads8689_config_t *adc) {
+  if (encoder->edges_per_sample == 0 || encoder->edges_per_sample > INT16_MAX) return ESP_ERR_INVALID_ARG;
+  if (encoder->edges_per_cycle == 0 || encoder->edges_per_cycle % encoder->edges_per_sample != 0) return ESP_ERR_INVALID_ARG;
+  uint32_t len = ads8689_encoder_cycle_len(encoder);
+  if (len < 2 || len > UINT16_MAX) return ESP_ERR_INVALID_ARG;
+  if (encoder->max_rate == 0 || encoder->max_rate > ads8689_config_max_rate(adc)) return ESP_ERR_INVALID_ARG;
+  if (encoder->encoder_gpio == encoder->tdc_gpio) return ESP_ERR_INVALID_ARG;
+  return ESP_OK;
+}
+
+uint32_t ads8689_encoder_cycle_len (const ads8689_encoder_config_t *encoder) {
+  return encoder->edges_per_sample > 0 ? encoder->edges_per_cycle / encoder->edges_per_sample : 0;
+}
+
+void ads8689_encoder_reset (uint32_t len) {
+  latch.seq = 0;
+  cycle_len = len;
+  synced = false;
+  has_candidate = false;
+  late_run = 0;
+  memset(&stats, 0, sizeof(stats));
+}
+
+static inline void IRAM_ATTR write_latch (uint64_t previous, uint32_t previous_cycle, uint64_t tdc, uint32_t cycle) {
+  latch.seq++;
+  latch.previous = previous;
+  latch.previous_cycle = previous_cycle;
+  latch.tdc = tdc;
+  latch.cycle = cycle;
+  latch.seq++;
+}
+
+void IRAM_ATTR ads8689_encoder_tdc_isr (uint64_t index) {
+  uint32_t len = cycle_len;
+  if (len == 0) return;
+  stats.tdc_count++;
+
+  /* Two pulses exactly a cycle apart before trusting either */
+  if (!synced) {
+    if (has_candidate && index - candidate == len) {
+      synced = true;
+      write_latch(candidate, 0, index, 1);
+    }
+    candidate = index;
+    has_candidate = true;
+    return;
+  }
+
+  uint64_t last = latch.tdc;
+  uint32_t cycle = latch.cycle;
+  uint64_t cycles = (index - last + len / 2) / len;
+  if (cycles == 0) {
+    stats.spurious++;
+    return;
+  }
+  uint64_t expected = last + cycles * len;
+  int64_t offset = (int64_t) (index - expected);
+  uint64_t tdc = index;
+  if (offset == 0) {
+    late_run = 0;
+  } else if (offset == 1 && late_run + 1 < ADS8689_ENCODER_LATE_RUN) {
+    /* The encoder interrupt of the same edge ran first */
+    late_run++;
+    stats.tdc_late++;
+    tdc = expected;
+  } else {
+    late_run = 0;
+    stats.sync_errors++;
+    stats.last_slip = (int32_t) offset;
+  }
+  write_latch(last, cycle, tdc, cycle + (uint32_t) cycles);
+}
+
+void IRAM_ATTR ads8689_encoder_skipped_isr () {
+  stats.skipped++;
+}
+
+bool ads8689_sample_angle (uint64_t index, uint32_t *cycle, uint16_t *angle) {
+  uint32_t seq, len, ref_cycle;
+  uint64_t ref;
+  do {
+    seq = latch.seq;
+    len = cycle_len;
+    if (index >= latch.tdc) {
+      ref = latch.tdc;
+      ref_cycle = latch.cycle;
+    } else {
+      ref = latch.previous;
+      ref_cycle = latch.previous_cycle;
+    }
+  } while ((seq & 1) || seq != latch.seq);
+  if (seq == 0 || len == 0) return false;
+
+  /* Floor division, samples before the reference belong to earlier cycles */
+  int64_t since = (int64_t) (index - ref);
+  int64_t cycles = since >= 0 ? since / len : -((-since + len - 1) / len);
+  if ((int64_t) ref_cycle + cycles < 0) return false;
+  *cycle = (uint32_t) ((int64_t) ref_cycle + cycles);
+  *angle = (uint16_t) (since - cycles * len);
+  return true;
+}
+
+uint32_t ads8689_angle_cycle_len () {
+  return cycle_len;
+}
+
+void ads8689_encoder_get_stats (ads8689_encoder_stats_t *out) {
+  *out = stats;
+}
@@ -0,0 +1,120 @@
+/**
+ * @file ads8689_encoder.h
+ *
+ * @brief Crank angle synchronous sampling. Instead of the conversion timer, a
+ * shaft encoder clocks the conversions: the pulse counter divides its edges
+ * and starts a conversion every edges_per_sample of them, so the sample index
+ * advances with the crank angle whatever the engine speed. A TDC (index)
+ * pulse once per cycle latches the conversion index of angle 0, and every
+ * sample gets a cycle number and an angle, counted in samples from TDC.
+ *
+ * The TDC interrupt also clears the pulse counter, so the division starts
+ * over from the edge after the pulse and the conversions keep their phase to
+ * TDC when edges_per_sample > 1, after an edge was lost as well.
+ *
+ * TDC pulses are checked against the expected cycle length. A pulse one
+ * conversion late is taken for an interrupt that ran after the encoder one
+ * of the same edge, and snapped back, unless ADS8689_ENCODER_LATE_RUN pulses
+ * in a row are late: an extra edge. Any other offset is an edge lost or one
+ * too many: the angle realigns on the pulse and a sync error is counted, the
+ * samples of that cycle are off by the offset. The first cycle number is
+ * given once two pulses a cycle apart were seen.
+ *
+ * No peripheral access in here, ads8689.c calls it from the interrupts and the
+ * host simulator from its fake encoder.
+ */
+#ifndef ADS8689_ENCODER_H
+#define ADS8689_ENCODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "driver/gpio.h"
+
+#include "ads8689_config.h"
+
+/* Late TDC pulses in a row taken for an extra edge */
+#define ADS8689_ENCODER_LATE_RUN (3)
+
+typedef struct ads8689_encoder_config_t {
+  /** Encoder edges, counted on the rising edge */
+  gpio_num_t encoder_gpio;
+  /** Once per cycle pulse, angle 0 is the first conversion after its rising edge */
+  gpio_num_t tdc_gpio;
+  /** Encoder edges per conversion, up to INT16_MAX for the pulse counter limit */
+  uint16_t edges_per_sample;
+  /** Encoder edges between two TDC pulses, 720 for a 360 line encoder on a
+   * four stroke engine, a multiple of edges_per_sample */
+  uint32_t edges_per_cycle;
+  /** Conversion rate at the highest engine speed, Hz. Must fit the SPI frame
+   * (ads8689_config_max_rate()), also the nominal rate of the sample clock */
+  uint32_t max_rate;
+} ads8689_encoder_config_t;
+
+#define ADS8689_ENCODER_DEFAULT_CONFIG() { \
+  .encoder_gpio = GPIO_NUM_34, \
+  .tdc_gpio = GPIO_NUM_35, \
+  .edges_per_sample = 1, \
+  .edges_per_cycle = 720, \
+  .max_rate = 100000 \
+}
+
+typedef struct ads8689_encoder_stats_t {
+  /** TDC pulses seen, and the ones snapped back after a late interrupt */
+  uint32_t tdc_count;
+  uint32_t tdc_late;
+  /** Pulses off the expected angle, and the last offset in conversions */
+  uint32_t sync_errors;
+  int32_t last_slip;
+  /** Pulses within half a cycle of the last one, ignored */
+  uint32_t spurious;
+  /** Encoder edges that came while the last conversion was still being read */
+  uint32_t skipped;
+} ads8689_encoder_stats_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** @brief Edges per cycle a multiple of edges_per_sample, at most UINT16_MAX
+ * conversions a cycle and max_rate within the SPI frame of adc */
+esp_err_t ads8689_encoder_check (const ads8689_encoder_config_t *encoder, const ads8689_config_t *adc);
+
+/** @brief Conversions of one cycle */
+uint32_t ads8689_encoder_cycle_len (const ads8689_encoder_config_t *encoder);
+
+/** @brief Forgets the TDC of the last stream, called when a stream starts.
+ * cycle_len 0 stops the angle tracking, the timer clocks the conversions */
+void ads8689_encoder_reset (uint32_t cycle_len);
+
+/**
+ * @brief TDC pulse, ISR safe
+ * @param index index of the next conversion, the one at angle 0
+ */
+void ads8689_encoder_tdc_isr (uint64_t index);
+
+/** @brief An encoder edge found the last conversion still running, ISR safe */
+void ads8689_encoder_skipped_isr ();
+
+/**
+ * @brief Cycle and angle of a sample, from the last TDC pulses, safe from any
+ * task. Samples from before the previous pulse are extrapolated back
+ * @param index sample index, as returned by ads8689_read_index()
+ * @param angle conversions since TDC, below cycle_len
+ * @return false until the first cycle and without an encoder
+ */
+bool ads8689_sample_angle (uint64_t index, uint32_t *cycle, uint16_t *angle);
+
+/** @brief Conversions per cycle of the running stream, 0 without an encoder */
+uint32_t ads8689_angle_cycle_len ();
+
+void ads8689_encoder_get_stats (ads8689_encoder_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,192 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_attr.h"
+
+#include "ads8689_stats.h"
+
+#define RATE_WINDOW_US (1000000)
+
+/* Written by the conversion timer ISR */
+typedef struct timer_group_t {
+  volatile uint32_t seq;
+  uint32_t last_cycles;
+  bool started;
+  uint32_t count;
+  uint32_t latency_count;
+  uint32_t latency_min;
+  uint32_t latency_max;
+  uint64_t latency_sum;
+  uint32_t jitter_max;
+  uint32_t jitter_hist[ADS8689_JITTER_BINS];
+} timer_group_t;
+
+/* Written by the stream ISR */
+typedef struct push_group_t {
+  volatile uint32_t seq;
+  uint64_t produced;
+  uint32_t high_water;
+} push_group_t;
+
+/* Written by the sending task */
+typedef struct send_group_t {
+  volatile uint32_t seq;
+  uint64_t sent;
+} send_group_t;
+
+/* Written by the reading task */
+typedef struct rate_group_t {
+  volatile uint32_t seq;
+  int64_t window_start;
+  uint64_t produced_start;
+  uint64_t sent_start;
+  float produced_rate;
+  float sent_rate;
+} rate_group_t;
+
+static DRAM_ATTR timer_group_t timer_stats;
+static DRAM_ATTR push_group_t push_stats;
+static send_group_t send_stats;
+static rate_group_t rate_stats;
+static uint32_t ring_len;
+/* Nominal period and ns per cycle in Q16 */
+static DRAM_ATTR uint32_t period_cycles = 0;
+static DRAM_ATTR uint32_t ns_per_cycle_q16 = 0;
+/* Readers ask the writers to clear, only the writer touches its group */
+static volatile uint32_t reset_request = 0;
+static DRAM_ATTR volatile uint32_t timer_reset_seen = 0, push_reset_seen = 0;
+
+#define WRITE_BEGIN(group) ((group).seq++)
+#define WRITE_END(group) ((group).seq++)
+
+/* Copies a group, retrying while its writer is inside */
+#define READ_GROUP(dst, src) do { \
+    uint32_t _seq; \
+    do { \
+      _seq = (src).seq; \
+      memcpy(&(dst), (const void*) &(src), sizeof(dst)); \
+    } while ((_seq & 1) || _seq != (src).seq); \
+  } while (0)
+
+static inline uint32_t IRAM_ATTR log2_floor (uint32_t v) {
+  return 31 - __builtin_clz(v);
+}
+
+void ads8689_stats_init (uint32_t len) {
+  memset(&timer_stats, 0, sizeof(timer_stats));
+  memset(&push_stats, 0, sizeof(push_stats));
+  memset(&send_stats, 0, sizeof(send_stats));
+  memset(&rate_stats, 0, sizeof(rate_stats));
+  timer_stats.latency_min = UINT32_MAX;
+  ring_len = len;
+  reset_request = timer_reset_seen = push_reset_seen = 0;
+}
+
+void ads8689_stats_reset () {
+  reset_request++;
+}
+
+void ads8689_stats_set_period (uint32_t period, uint32_t cycles_per_us) {
+  period_cycles = period;
+  ns_per_cycle_q16 = cycles_per_us > 0 ? (1000u << 16) / cycles_per_us : 0;
+}
+
+static inline void IRAM_ATTR timer_check_reset () {
+  if (timer_reset_seen == reset_request) return;
+  timer_reset_seen = reset_request;
+  timer_stats.latency_count = 0;
+  timer_stats.latency_min = UINT32_MAX;
+  timer_stats.latency_max = 0;
+  timer_stats.latency_sum = 0;
+  timer_stats.jitter_max = 0;
+  memset(timer_stats.jitter_hist, 0, sizeof(timer_stats.jitter_hist));
+}
+
+void IRAM_ATTR ads8689_stats_conversion_isr (uint32_t cycles) {
+  WRITE_BEGIN(timer_stats);
+  timer_check_reset();
+  timer_stats.count++;
+  if (timer_stats.started && period_cycles > 0) {
+    uint32_t period = cycles - timer_stats.last_cycles;
+    uint32_t deviation = period > period_cycles ? period - period_cycles : period_cycles - period;
+    uint32_t ns = (uint32_t) (((uint64_t) deviation * ns_per_cycle_q16) >> 16);
+    uint32_t bin = ns < ADS8689_JITTER_BIN_NS ? 0 : log2_floor(ns / ADS8689_JITTER_BIN_NS) + 1;
+    timer_stats.jitter_hist[bin < ADS8689_JITTER_BINS ? bin : ADS8689_JITTER_BINS - 1]++;
+    if (ns > timer_stats.jitter_max) timer_stats.jitter_max = ns;
+  }
+  timer_stats.last_cycles = cycles;
+  timer_stats.started = true;
+  WRITE_END(timer_stats);
+}
+
+void IRAM_ATTR ads8689_stats_latency_isr (uint32_t latency_ns) {
+  WRITE_BEGIN(timer_stats);
+  timer_check_reset();
+  timer_stats.latency_count++;
+  timer_stats.latency_sum += latency_ns;
+  if (latency_ns < timer_stats.latency_min) timer_stats.latency_min = latency_ns;
+  if (latency_ns > timer_stats.latency_max) timer_stats.latency_max = latency_ns;
+  WRITE_END(timer_stats);
+}
+
+void IRAM_ATTR ads8689_stats_push_isr (size_t len, size_t fill) {
+  WRITE_BEGIN(push_stats);
+  if (push_reset_seen != reset_request) {
+    push_reset_seen = reset_request;
+    push_stats.high_water = 0;
+  }
+  push_stats.produced += len;
+  if (fill > push_stats.high_water) push_stats.high_water = fill;
+  WRITE_END(push_stats);
+}
+
+void ads8689_stats_sent (size_t samples) {
+  WRITE_BEGIN(send_stats);
+  send_stats.sent += samples;
+  WRITE_END(send_stats);
+}
+
+void ads8689_stats_update_rates (int64_t now_us) {
+  if (rate_stats.window_start != 0 && now_us - rate_stats.window_start < RATE_WINDOW_US) return;
+  push_group_t push;
+  send_group_t send;
+  READ_GROUP(push, push_stats);
+  READ_GROUP(send, send_stats);
+  WRITE_BEGIN(rate_stats);
+  if (rate_stats.window_start != 0) {
+    float seconds = (now_us - rate_stats.window_start) / 1e6f;
+    rate_stats.produced_rate = (push.produced - rate_stats.produced_start) / seconds;
+    rate_stats.sent_rate = (send.sent - rate_stats.sent_start) / seconds;
+  }
+  rate_stats.window_start = now_us;
+  rate_stats.produced_start = push.produced;
+  rate_stats.sent_start = send.sent;
+  WRITE_END(rate_stats);
+}
+
+void ads8689_stats_get (ads8689_stats_t *stats) {
+  timer_group_t timer;
+  push_group_t push;
+  send_group_t send;
+  rate_group_t rate;
+  READ_GROUP(timer, timer_stats);
+  READ_GROUP(push, push_stats);
+  READ_GROUP(send, send_stats);
+  READ_GROUP(rate, rate_stats);
+
+  memset(stats, 0, sizeof(ads8689_stats_t));
+  stats->produced = push.produced;
+  stats->sent = send.sent;
+  stats->produced_rate = rate.produced_rate;
+  stats->sent_rate = rate.sent_rate;
+  stats->ring_len = ring_len;
+  stats->ring_high_water = push.high_water;
+  stats->timer_count = timer.count;
+  if (timer.latency_count > 0) {
+    stats->isr_latency_min_ns = timer.latency_min;
+    stats->isr_latency_max_ns = timer.latency_max;
+    stats->isr_latency_mean_ns = (uint32_t) (timer.latency_sum / timer.latency_count);
+  }
+  stats->jitter_max_ns = timer.jitter_max;
+  memcpy(stats->jitter_hist, timer.jitter_hist, sizeof(stats->jitter_hist));
+}
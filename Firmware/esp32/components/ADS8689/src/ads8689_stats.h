@@ -0,0 +1,86 @@
+/**
+ * @file ads8689_stats.h
+ *
+ * @brief Acquisition instrumentation: conversion period jitter, timer ISR
+ * latency, ring fill high water mark, samples produced and sent. How long
+ * the sockets take is measured by the transport, see tcp_server.h.
+ *
+ * Each group of counters has a single writer (the conversion timer ISR, the
+ * stream ISR, the sending task and the reading task) and a sequence counter,
+ * so readers on any task get a consistent snapshot without locks, the same
+ * scheme as the sample clock of ads8689_stream.c. Recording is a handful of
+ * instructions and safe to leave enabled.
+ */
+#ifndef ADS8689_STATS_H
+#define ADS8689_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** Bin 0 holds deviations below ADS8689_JITTER_BIN_NS, each next bin doubles, the last is open ended */
+#define ADS8689_JITTER_BINS (12)
+#define ADS8689_JITTER_BIN_NS (50)
+
+typedef struct ads8689_stats_t {
+  /** Samples acquired since the stream started, including the ones lost to overruns */
+  uint64_t produced;
+  /** Samples the application handed to the transport */
+  uint64_t sent;
+  /** Samples per second over the last full second */
+  float produced_rate;
+  float sent_rate;
+  uint32_t overruns;
+  uint32_t dropped;
+  uint32_t ring_len;
+  /** Most samples waiting in the ring since the last reset */
+  uint32_t ring_high_water;
+  /** Conversion timer interrupts, latency is from the alarm to the handler */
+  uint32_t timer_count;
+  uint32_t isr_latency_min_ns;
+  uint32_t isr_latency_max_ns;
+  uint32_t isr_latency_mean_ns;
+  /** Deviation of the period between conversion starts from the nominal one */
+  uint32_t jitter_max_ns;
+  uint32_t jitter_hist[ADS8689_JITTER_BINS];
+} ads8689_stats_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** @brief Clears every counter, called when the stream starts */
+void ads8689_stats_init (uint32_t ring_len);
+
+/** @brief Clears the histograms, extremes and high water mark, keeps the totals */
+void ads8689_stats_reset ();
+
+/**
+ * @brief Nominal period between two ads8689_stats_conversion_isr() calls
+ * @param cycles_per_us rate of the cycle counter passed to it
+ */
+void ads8689_stats_set_period (uint32_t period_cycles, uint32_t cycles_per_us);
+
+/** @brief From the conversion timer ISR, cycles is the CPU cycle counter at entry */
+void ads8689_stats_conversion_isr (uint32_t cycles);
+
+/** @brief From the conversion timer ISR, time from the timer alarm to the handler */
+void ads8689_stats_latency_isr (uint32_t latency_ns);
+
+/** @brief From the stream ISR after a push, fill is the ring fill after it */
+void ads8689_stats_push_isr (size_t len, size_t fill);
+
+/** @brief From the task that sends the stream, once per frame handed to the transport */
+void ads8689_stats_sent (size_t samples);
+
+/** @brief From the reading task, updates the rates once a second */
+void ads8689_stats_update_rates (int64_t now_us);
+
+/** @brief Consistent snapshot without the ring counters, see ads8689_get_stats() */
+void ads8689_stats_get (ads8689_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
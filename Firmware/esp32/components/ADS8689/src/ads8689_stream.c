@@ -0,0 +1,238 @@
+#include <math.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "ads8689.h"
+#include "ads8689_stream.h"
+#include "ads8689_alarm.h"
+#include "ads8689_stats.h"
+#include "sample_ring.h"
+
+#define min(x,y) ( \
+    { __auto_type __x = (x); __auto_type __y = (y); \
+      __x < __y ? __x : __y; })
+
+/* Acquisition ring, ISR is the producer and ads8689_read_* the consumer */
+static sample_ring_t data_ring;
+static int16_t *ring_buf = NULL;
+
+/* Consumer waiting for data */
+static volatile TaskHandle_t waiting_task = NULL;
+static volatile size_t waiting_len = 0;
+
+/* A sample index and its conversion time, read consistently from another context */
+typedef struct sample_clock_t {
+  volatile uint32_t seq;
+  volatile uint64_t index;
+  volatile int64_t time;
+} sample_clock_t;
+
+/* Last latched conversion, written by the conversion timer ISR */
+static sample_clock_t sample_clock;
+/* Samples acquired since the stream started, including the dropped ones */
+static uint64_t acquired_samples = 0;
+
+/* Consumer side sample index, counting dropped samples */
+static uint64_t read_index = 0;
+static bool gap_pending = false;
+
+/* Sample frequency measurement */
+#define FS_WINDOW_US (100000)
+static float nominal_fs;
+static float measured_fs;
+static uint64_t fs_ref_index;
+static int64_t fs_ref_time = 0;
+
+/* Sample time model, a line through the latches kept by the consumer. A late
+ * latch moves the line by 1 / CLOCK_FOLLOW of its lateness, an early one all
+ * the way. Point of the line, read by any task sending frames */
+#define CLOCK_FOLLOW (8)
+static sample_clock_t clock_model;
+static uint64_t clock_latched;
+
+static inline void IRAM_ATTR write_clock (sample_clock_t *clock, uint64_t index, int64_t time) {
+  clock->seq++;
+  clock->index = index;
+  clock->time = time;
+  clock->seq++;
+}
+
+/* False until the first write */
+static bool read_clock (const sample_clock_t *clock, uint64_t *index, int64_t *time) {
+  uint32_t seq;
+  do {
+    seq = clock->seq;
+    *index = clock->index;
+    *time = clock->time;
+  } while ((seq & 1) || seq != clock->seq);
+  return seq != 0;
+}
+
+void IRAM_ATTR ads8689_stream_latch_clock (uint64_t index, int64_t time) {
+  write_clock(&sample_clock, index, time);
+}
+
+static double sample_period_us () {
+  return 1e6 / (double) (measured_fs > 0 ? measured_fs : nominal_fs);
+}
+
+esp_err_t ads8689_stream_init (size_t buffer_len, float sample_freq) {
+  /* Ring length is rounded down to a power of two */
+  size_t ring_len = 1;
+  while ((ring_len << 1) <= buffer_len / sizeof(int16_t)) ring_len <<= 1;
+  if (ring_buf == NULL || data_ring.len != ring_len) {
+    heap_caps_free(ring_buf);
+    ring_buf = (int16_t*) heap_caps_malloc(ring_len * sizeof(int16_t), MALLOC_CAP_INTERNAL);
+  }
+  if (!sample_ring_init(&data_ring, ring_buf, ring_len)) return ESP_ERR_NO_MEM;
+
+  acquired_samples = 0;
+  ads8689_alarm_reset();
+  sample_clock.seq = 0;
+  clock_model.seq = 0;
+  read_index = 0;
+  gap_pending = false;
+  nominal_fs = measured_fs = sample_freq;
+  fs_ref_time = 0;
+  ads8689_stats_init(ring_len);
+  return ESP_OK;
+}
+
+void IRAM_ATTR ads8689_stream_push (const int16_t *samples, const uint8_t *flags, size_t len, BaseType_t *task_woken) {
+  /* Alarms first, they should not wait for the ring */
+  ads8689_alarm_scan_isr(acquired_samples, samples, flags, len, task_woken);
+  sample_ring_write(&data_ring, samples, len);
+  acquired_samples += len;
+  ads8689_stats_push_isr(len, sample_ring_fill(&data_ring));
+
+  /* Wakes the consumer once enough samples are in the ring */
+  TaskHandle_t task = waiting_task;
+  if (task == NULL || sample_ring_unread(&data_ring) < waiting_len) return;
+  waiting_task = NULL;
+  vTaskNotifyGiveFromISR(task, task_woken);
+}
+
+/* Updates the measured sample frequency over a FS_WINDOW_US window and the sample time model */
+static void update_sample_clock (float *fs) {
+  uint64_t index;
+  int64_t time;
+  uint64_t model_index;
+  int64_t model_time;
+  bool modeled = read_clock(&clock_model, &model_index, &model_time);
+  if (fs != NULL) *fs = measured_fs;
+  if (!read_clock(&sample_clock, &index, &time) || (modeled && index == clock_latched)) return;
+  clock_latched = index;
+
+  if (fs_ref_time == 0) {
+    fs_ref_index = index;
+    fs_ref_time = time;
+  } else if (time - fs_ref_time >= FS_WINDOW_US) {
+    measured_fs = (float) (index - fs_ref_index) * 1000000 / (float) (time - fs_ref_time);
+    fs_ref_index = index;
+    fs_ref_time = time;
+  }
+  if (fs != NULL) *fs = measured_fs;
+
+  if (!modeled) {
+    write_clock(&clock_model, index, time);
+    return;
+  }
+  int64_t predicted = model_time + (int64_t) ((double) (index - model_index) * sample_period_us());
+  int64_t late = time - predicted;
+  write_clock(&clock_model, index, late < 0 ? time : predicted + late / CLOCK_FOLLOW);
+}
+
+const int16_t* ads8689_read_acquire (size_t *len, size_t min_len, TickType_t timeout, float *fs) {
+  if (sample_ring_unread(&data_ring) < min_len && timeout > 0) {
+    waiting_len = min_len;
+    waiting_task = xTaskGetCurrentTaskHandle();
+    /* Samples may have arrived before the handle was published */
+    if (sample_ring_unread(&data_ring) < min_len) ulTaskNotifyTake(pdTRUE, timeout);
+    waiting_task = NULL;
+  }
+  update_sample_clock(fs);
+  ads8689_stats_update_rates(esp_timer_get_time());
+
+  const int16_t *samples = sample_ring_read_acquire(&data_ring, len);
+  sample_ring_gap_t gap;
+  while (sample_ring_next_gap(&data_ring, &gap)) {
+    /* Signed, a gap queued late after a merge can be behind the reader */
+    ptrdiff_t to_gap = (ptrdiff_t) (gap.pos - sample_ring_read_index(&data_ring));
+    if (to_gap > 0) {
+      /* Never hand out a block crossing the gap */
+      if (*len > (size_t) to_gap) *len = to_gap;
+      break;
+    }
+    /* Reached the gap, following samples are shifted by the ones it lost */
+    read_index += gap.count;
+    gap_pending = true;
+    sample_ring_pop_gap(&data_ring);
+  }
+  return samples;
+}
+
+uint64_t ads8689_read_index (bool *gap) {
+  if (gap != NULL) {
+    *gap = gap_pending;
+    gap_pending = false;
+  }
+  return read_index;
+}
+
+int64_t ads8689_sample_time (uint64_t index) {
+  uint64_t model_index;
+  int64_t model_time;
+  if (!read_clock(&clock_model, &model_index, &model_time)) return esp_timer_get_time();
+  /* Signed, the index may be before the point of the line */
+  int64_t samples_after = (int64_t) (index - model_index);
+  return model_time + (int64_t) llround((double) samples_after * sample_period_us());
+}
+
+void ads8689_read_release (size_t len) {
+  size_t before = sample_ring_read_index(&data_ring);
+  sample_ring_read_release(&data_ring, len);
+  read_index += sample_ring_read_index(&data_ring) - before;
+}
+
+void ads8689_read_claim (size_t len) {
+  size_t before = sample_ring_read_index(&data_ring);
+  sample_ring_read_claim(&data_ring, len);
+  read_index += sample_ring_read_index(&data_ring) - before;
+}
+
+void ads8689_read_free (size_t len) {
+  sample_ring_read_release(&data_ring, len);
+}
+
+size_t ads8689_read_buffer (int16_t *dest, size_t max_len, float *fs) {
+  size_t read = 0;
+  while (read < max_len) {
+    size_t len;
+    const int16_t *src = ads8689_read_acquire(&len, 0, 0, fs);
+    if (src == NULL) break;
+    len = min(len, max_len - read);
+    memcpy(&dest[read], src, len * sizeof(int16_t));
+    ads8689_read_release(len);
+    read += len;
+  }
+  return read;
+}
+
+bool ads8689_index_lost () {
+  return sample_ring_index_lost(&data_ring);
+}
+
+uint32_t ads8689_get_overruns (uint32_t *dropped) {
+  if (dropped != NULL) *dropped = sample_ring_dropped(&data_ring);
+  return sample_ring_overruns(&data_ring);
+}
+
+void ads8689_get_stats (ads8689_stats_t *stats) {
+  ads8689_stats_get(stats);
+  stats->overruns = ads8689_get_overruns(&stats->dropped);
+}
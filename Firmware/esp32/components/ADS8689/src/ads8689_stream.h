@@ -0,0 +1,54 @@
+/**
+ * @file ads8689_stream.h
+ *
+ * @brief Producer side of the ADS8689 sample stream. The acquisition ISRs push
+ * converted samples here, the consumer side is the ads8689_read_* API.
+ *
+ * Nothing in here touches the SPI peripheral, so the host simulator can feed
+ * the same stream from its fake ADC.
+ */
+#ifndef ADS8689_STREAM_H
+#define ADS8689_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Allocates the sample ring and resets sample counters. A restart
+ * keeps the ring of the same length, the samples in it are dropped
+ * @param buffer_len ring size in bytes, rounded down to a power of two
+ * @param sample_freq nominal sample frequency, used until it is measured
+ */
+esp_err_t ads8689_stream_init (size_t buffer_len, float sample_freq);
+
+/**
+ * @brief Adds acquired samples to the stream and scans their alarm flags, ISR safe
+ * @param flags ADS8689_ALARM_* of each sample, NULL if none is set
+ * @param task_woken set to pdTRUE if the reader or the alarm task was woken
+ */
+void ads8689_stream_push (const int16_t *samples, const uint8_t *flags, size_t len, BaseType_t *task_woken);
+
+/**
+ * @brief Latches the time a conversion was timed, ISR safe. Called by the
+ * conversion timer at block boundaries: index and time come from the same
+ * interrupt, whatever was pushed so far. ads8689_sample_time() fits a line
+ * through the latches, keeping the earliest ones as interrupt latency only
+ * makes a latch late.
+ * @param index conversions since the stream started, the index of the sample
+ * @param time esp_timer time in us, less the interrupt latency when the timer measures it
+ */
+void ads8689_stream_latch_clock (uint64_t index, int64_t time);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
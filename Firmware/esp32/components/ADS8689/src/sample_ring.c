@@ -0,0 +1,149 @@
+#include <string.h>
+
+#include "sample_ring.h"
+
+#ifndef IRAM_ATTR
+#define IRAM_ATTR
+#endif
+
+#define min(x,y) ( \
+    { __auto_type __x = (x); __auto_type __y = (y); \
+      __x < __y ? __x : __y; })
+
+bool sample_ring_init (sample_ring_t *ring, int16_t *buf, size_t len) {
+  if (ring == NULL || buf == NULL || len == 0 || (len & (len - 1)) != 0) return false;
+  ring->buf = buf;
+  ring->len = len;
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->read, 0);
+  atomic_init(&ring->overruns, 0);
+  atomic_init(&ring->dropped, 0);
+  atomic_init(&ring->gap_head, 0);
+  atomic_init(&ring->gap_tail, 0);
+  ring->gap_open.pos = 0;
+  ring->gap_open.count = 0;
+  atomic_init(&ring->index_lost, false);
+  return true;
+}
+
+/* Hands the open gap to the consumer, false if the queue is full */
+static bool IRAM_ATTR queue_gap (sample_ring_t *ring) {
+  size_t gap_head = atomic_load_explicit(&ring->gap_head, memory_order_relaxed);
+  size_t gap_tail = atomic_load_explicit(&ring->gap_tail, memory_order_acquire);
+  if (gap_head - gap_tail == SAMPLE_RING_GAPS) return false;
+  ring->gaps[gap_head % SAMPLE_RING_GAPS] = ring->gap_open;
+  ring->gap_open.count = 0;
+  atomic_store_explicit(&ring->gap_head, gap_head + 1, memory_order_release);
+  return true;
+}
+
+size_t IRAM_ATTR sample_ring_write (sample_ring_t *ring, const int16_t *src, size_t n) {
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+  size_t space = ring->len - (head - tail);
+  size_t to_write = min(n, space);
+
+  /* The gap is queued before the head moves past it, a reader that sees the
+   * samples after it sees the gap. Without room it stays open and takes the
+   * following gaps, their positions are lost */
+  if (to_write > 0 && ring->gap_open.count > 0 && !queue_gap(ring)) {
+    atomic_store_explicit(&ring->index_lost, true, memory_order_relaxed);
+  }
+  if (to_write < n) {
+    if (ring->gap_open.count == 0) ring->gap_open.pos = head + to_write;
+    ring->gap_open.count += n - to_write;
+    atomic_fetch_add_explicit(&ring->overruns, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&ring->dropped, n - to_write, memory_order_relaxed);
+  }
+  if (to_write == 0) return 0;
+
+  size_t offset = head & (ring->len - 1);
+  size_t first = min(to_write, ring->len - offset);
+  memcpy(&ring->buf[offset], src, first * sizeof(int16_t));
+  if (first < to_write) memcpy(ring->buf, &src[first], (to_write - first) * sizeof(int16_t));
+
+  /* Publish samples only after they are in the buffer */
+  atomic_store_explicit(&ring->head, head + to_write, memory_order_release);
+  return to_write;
+}
+
+const int16_t* sample_ring_read_acquire (sample_ring_t *ring, size_t *len) {
+  size_t read = atomic_load_explicit(&ring->read, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+  size_t unread = head - read;
+  if (unread == 0) {
+    *len = 0;
+    return NULL;
+  }
+  size_t offset = read & (ring->len - 1);
+  *len = min(unread, ring->len - offset);
+  return &ring->buf[offset];
+}
+
+void sample_ring_read_claim (sample_ring_t *ring, size_t n) {
+  size_t read = atomic_load_explicit(&ring->read, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  atomic_store_explicit(&ring->read, read + min(n, head - read), memory_order_relaxed);
+}
+
+void sample_ring_read_release (sample_ring_t *ring, size_t n) {
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  n = min(n, head - tail);
+  /* Releasing samples not claimed reads them, never the case from another task */
+  size_t read = atomic_load_explicit(&ring->read, memory_order_relaxed);
+  if (read - tail < n) atomic_store_explicit(&ring->read, tail + n, memory_order_relaxed);
+  /* Space is given back to the producer only after the consumer is done reading */
+  atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+}
+
+size_t sample_ring_fill (sample_ring_t *ring) {
+  size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  return head - tail;
+}
+
+size_t sample_ring_unread (sample_ring_t *ring) {
+  size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  size_t read = atomic_load_explicit(&ring->read, memory_order_relaxed);
+  return head - read;
+}
+
+size_t sample_ring_written (sample_ring_t *ring) {
+  return atomic_load_explicit(&ring->head, memory_order_acquire);
+}
+
+size_t sample_ring_read_index (sample_ring_t *ring) {
+  return atomic_load_explicit(&ring->read, memory_order_relaxed);
+}
+
+bool sample_ring_next_gap (sample_ring_t *ring, sample_ring_gap_t *gap) {
+  size_t gap_tail = atomic_load_explicit(&ring->gap_tail, memory_order_relaxed);
+  size_t gap_head = atomic_load_explicit(&ring->gap_head, memory_order_acquire);
+  if (gap_head == gap_tail) return false;
+  *gap = ring->gaps[gap_tail % SAMPLE_RING_GAPS];
+  return true;
+}
+
+void sample_ring_pop_gap (sample_ring_t *ring) {
+  size_t gap_tail = atomic_load_explicit(&ring->gap_tail, memory_order_relaxed);
+  size_t gap_head = atomic_load_explicit(&ring->gap_head, memory_order_acquire);
+  if (gap_head == gap_tail) return;
+  /* The slot is given back only after the consumer copied it */
+  atomic_store_explicit(&ring->gap_tail, gap_tail + 1, memory_order_release);
+}
+
+bool sample_ring_index_lost (sample_ring_t *ring) {
+  return atomic_load_explicit(&ring->index_lost, memory_order_relaxed);
+}
+
+uint32_t sample_ring_overruns (sample_ring_t *ring) {
+  return atomic_load_explicit(&ring->overruns, memory_order_relaxed);
+}
+
+uint32_t sample_ring_dropped (sample_ring_t *ring) {
+  return atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+}
@@ -0,0 +1,146 @@
+/**
+ * @file sample_ring.h
+ *
+ * @brief Lock-free single producer / single consumer ring of int16 samples.
+ * The producer (ISR) copies samples in, the consumer gets pointers to the
+ * contiguous region ready to be read, so it can be handed to send() as is.
+ *
+ * Read and write indexes run freely and are only wrapped when accessing the
+ * buffer, which requires a power of two length.
+ *
+ * The consumer can claim the samples it read instead of releasing them, to
+ * hand the pointers on to another task: the read position moves past them
+ * and their space goes back to the producer only once released, from that
+ * other task.
+ *
+ * Every overrun leaves a gap in the stream, queued with its position so the
+ * reader can account for each one as it gets there. Overruns while the ring
+ * stays full add to the same gap. When more gaps are waiting than the queue
+ * holds, the newest are merged into one and the ring reports the sample index
+ * as lost.
+ */
+#ifndef SAMPLE_RING_H
+#define SAMPLE_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+/* Same layout as the C11 types, lets host C++ code embed the ring */
+#include <atomic>
+using std::atomic_bool;
+using std::atomic_size_t;
+using std::atomic_uint_least32_t;
+#else
+#include <stdatomic.h>
+#endif
+
+/** Gaps the ring keeps track of until the reader gets to them */
+#define SAMPLE_RING_GAPS 8
+
+typedef struct sample_ring_gap_t {
+  /** Position in sample_ring_written() units, where the discarded samples would have been */
+  size_t pos;
+  uint32_t count;
+} sample_ring_gap_t;
+
+typedef struct sample_ring_t {
+  int16_t *buf;
+  size_t len;
+  /** Written only by the producer */
+  atomic_size_t head;
+  /** Written only by the consumer, the oldest sample not released */
+  atomic_size_t tail;
+  /** Next sample handed out, ahead of tail by the claimed samples */
+  atomic_size_t read;
+  /** Times the producer found the ring full */
+  atomic_uint_least32_t overruns;
+  /** Samples discarded by the producer because the ring was full */
+  atomic_uint_least32_t dropped;
+  /** Gaps not reached by the reader, written by the producer and published by gap_head */
+  sample_ring_gap_t gaps[SAMPLE_RING_GAPS];
+  atomic_size_t gap_head;
+  /** Written only by the consumer */
+  atomic_size_t gap_tail;
+  /** Producer only, gap at the head, queued before samples are written past it */
+  sample_ring_gap_t gap_open;
+  /** Set once gaps had to be merged, the positions after the first are lost */
+  atomic_bool index_lost;
+} sample_ring_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Initialize ring over a caller provided buffer
+ * @param len buffer length in samples, must be a power of two
+ * @return false if len is not a power of two
+ */
+bool sample_ring_init (sample_ring_t *ring, int16_t *buf, size_t len);
+
+/**
+ * @brief Producer side, copies up to n samples into the ring. Samples that do
+ * not fit are discarded and counted as an overrun.
+ * @return samples written
+ */
+size_t sample_ring_write (sample_ring_t *ring, const int16_t *src, size_t n);
+
+/**
+ * @brief Consumer side, get the contiguous block ready to be read
+ * @param len set to the number of samples available from the returned pointer
+ * @return pointer to the oldest sample not read, NULL if there is none
+ */
+const int16_t* sample_ring_read_acquire (sample_ring_t *ring, size_t *len);
+
+/**
+ * @brief Consumer side, moves the read position past n samples previously
+ * acquired, they stay in the ring until released
+ */
+void sample_ring_read_claim (sample_ring_t *ring, size_t n);
+
+/**
+ * @brief Consumer side, frees the n oldest samples, claimed or acquired. Only
+ * claimed samples may be released from another task than the reader
+ */
+void sample_ring_read_release (sample_ring_t *ring, size_t n);
+
+/** @brief Samples in the ring, claimed ones included */
+size_t sample_ring_fill (sample_ring_t *ring);
+
+/** @brief Samples waiting to be read */
+size_t sample_ring_unread (sample_ring_t *ring);
+
+/** @brief Total number of samples ever written, used as the sample index of the head */
+size_t sample_ring_written (sample_ring_t *ring);
+
+/** @brief Total number of samples ever read by the consumer, released or claimed */
+size_t sample_ring_read_index (sample_ring_t *ring);
+
+/**
+ * @brief Consumer side, oldest gap the reader has not accounted for yet. Its
+ * position is normally ahead of sample_ring_read_index(), it may be behind
+ * only after gaps were merged.
+ * @return false if there is none
+ */
+bool sample_ring_next_gap (sample_ring_t *ring, sample_ring_gap_t *gap);
+
+/** @brief Consumer side, drops the gap returned by sample_ring_next_gap() */
+void sample_ring_pop_gap (sample_ring_t *ring);
+
+/** @brief True once more gaps were waiting than the ring holds */
+bool sample_ring_index_lost (sample_ring_t *ring);
+
+/** @brief Number of times the producer found the ring full */
+uint32_t sample_ring_overruns (sample_ring_t *ring);
+
+/** @brief Number of samples discarded by the producer */
+uint32_t sample_ring_dropped (sample_ring_t *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,276 @@
+#include <math.h>
+#include <string.h>
+
+#include "baseline.h"
+
+#define Q16_ONE (65536.0)
+#define Q16_HALF ((int64_t) 1 << 15)
+/* Raw samples of the window mode kept on the stack at once */
+#define BASELINE_CHUNK_LEN (256)
+
+static int16_t clamp16 (int32_t v) {
+  if (v > INT16_MAX) return INT16_MAX;
+  if (v < INT16_MIN) return INT16_MIN;
+  return (int16_t) v;
+}
+
+/* Correction of the next sample from the estimate, nothing before the first peg */
+static void update_offset (baseline_t *b) {
+  if (!b->valid) {
+    b->offset_q16 = 0;
+    b->step_q16 = 0;
+    return;
+  }
+  double level = b->level + (double) b->slope * (double) (int64_t) (b->index - b->level_index);
+  b->offset_q16 = llround((level - b->config.reference) * Q16_ONE);
+  b->step_q16 = llround(b->slope * Q16_ONE);
+}
+
+static void cycle_begin (baseline_t *b, uint64_t start) {
+  b->cycle_started = true;
+  b->cycle_start = start;
+  b->cycle_count = 0;
+  b->cycle_min = INT16_MAX;
+  b->cycle_max = INT16_MIN;
+  b->min_index = start;
+  b->window_sum = 0;
+  b->window_count = 0;
+  b->window_done = false;
+}
+
+/* Alpha-beta filter over the pegs, beta of a critically damped tracker */
+static void peg (baseline_t *b, float value, uint64_t index) {
+  b->pegs++;
+  if (!b->valid) {
+    b->valid = true;
+    b->level = value;
+    b->slope = 0;
+    b->level_index = index;
+    if (b->pegs == 1) b->rest = value;
+  } else {
+    float alpha = b->config.smoothing;
+    float beta = alpha * alpha / (2 - alpha);
+    float dt = (float) (int64_t) (index - b->level_index);
+    float predicted = b->level + b->slope * dt;
+    float residual = value - predicted;
+    b->level = predicted + alpha * residual;
+    /* Minima of two cycles can be next to each other across the boundary,
+     * the slope is taken over half a cycle at least */
+    float min_dt = b->config.cycle_len > 2 ? b->config.cycle_len / 2 : 1;
+    b->slope += beta * residual / (dt > min_dt ? dt : min_dt);
+    b->level_index = index;
+  }
+  update_offset(b);
+}
+
+/* A cycle with at least half of its samples out of the settling time ends in a peg */
+static void cycle_end (baseline_t *b, uint64_t next_start) {
+  if (!b->cycle_started) return;
+  uint32_t len = (uint32_t) (next_start - b->cycle_start);
+  if (b->cycle_count > 0 && b->cycle_count >= len / 2) {
+    b->last_min = b->cycle_min;
+    b->last_max = b->cycle_max;
+    if (b->config.peg == BASELINE_PEG_MINIMUM) {
+      b->quiet_index = b->min_index;
+      b->period = b->config.cycle_len;
+      peg(b, b->cycle_min, b->min_index);
+    } else {
+      b->quiet_index = b->cycle_start + b->config.window_offset;
+      b->period = len;
+    }
+    b->has_quiet = true;
+  }
+}
+
+static void subtract (baseline_t *b, const int16_t *src, int16_t *dst, size_t len) {
+  int64_t offset = b->offset_q16;
+  const int64_t step = b->step_q16;
+  for (size_t i = 0; i < len; i++) {
+    dst[i] = clamp16((int32_t) src[i] - (int32_t) ((offset + Q16_HALF) >> 16));
+    offset += step;
+  }
+  b->offset_q16 = offset;
+}
+
+/* Extremes and window of the cycle in progress, on the raw samples */
+static void accumulate (baseline_t *b, const int16_t *x, size_t len, uint64_t index) {
+  size_t i = 0;
+  if (index < b->settle_end) {
+    uint64_t skip = b->settle_end - index;
+    i = skip < len ? (size_t) skip : len;
+  }
+  int16_t lo = b->cycle_min, hi = b->cycle_max;
+  uint64_t lo_index = b->min_index;
+  for (; i < len; i++) {
+    if (x[i] < lo) {
+      lo = x[i];
+      lo_index = index + i;
+    }
+    if (x[i] > hi) hi = x[i];
+  }
+  if (index + len > b->settle_end) {
+    uint64_t first = index > b->settle_end ? index : b->settle_end;
+    b->cycle_count += (uint32_t) (index + len - first);
+  }
+  b->cycle_min = lo;
+  b->cycle_max = hi;
+  b->min_index = lo_index;
+
+  if (b->config.peg != BASELINE_PEG_WINDOW || b->window_done) return;
+  uint64_t window_start = b->cycle_start + b->config.window_offset;
+  uint64_t window_end = window_start + b->config.window_len;
+  uint64_t from = index > window_start ? index : window_start;
+  if (from < b->settle_end) from = b->settle_end;
+  uint64_t to = index + len < window_end ? index + len : window_end;
+  for (uint64_t n = from; n < to; n++) {
+    b->window_sum += x[n - index];
+    b->window_count++;
+  }
+  if (index + len >= window_end) {
+    b->window_done = true;
+    if (b->window_count > 0 && b->window_count >= b->config.window_len / 2) {
+      peg(b, (float) b->window_sum / (float) b->window_count, window_end - 1);
+    }
+  }
+}
+
+/* Cycle starts are searched on the corrected samples, the raw ones are accumulated */
+static void track_window (baseline_t *b, const int16_t *raw, const int16_t *corrected, size_t len, uint64_t index) {
+  size_t i = 0;
+  while (i < len) {
+    uint64_t start;
+    size_t found = trigger_detect(&b->cycle, &corrected[i], len - i, &start);
+    if (b->cycle_started) accumulate(b, &raw[i], found, index + i);
+    if (found == len - i) return;
+    cycle_end(b, start);
+    cycle_begin(b, start);
+    /* The start sample was scanned, it is the first of the new cycle */
+    accumulate(b, &raw[i + found], 1, start);
+    i += found + 1;
+  }
+}
+
+static void take_reset (baseline_t *b) {
+  b->reset_scheduled = false;
+  b->resets++;
+  b->last_reset = b->reset_index;
+  b->settle_end = b->reset_index + b->config.reset_settle;
+  /* The output goes back to rest, the leakage behind the slope goes on */
+  if (b->valid) {
+    b->level = b->rest;
+    b->level_index = b->reset_index;
+  }
+  /* The extremes so far are of before the reset, none is due before a cycle after it */
+  b->cycle_min = INT16_MAX;
+  b->cycle_max = INT16_MIN;
+  b->last_min = INT16_MAX;
+  b->last_max = INT16_MIN;
+  b->cycle_count = 0;
+  b->window_sum = 0;
+  b->window_count = 0;
+  update_offset(b);
+}
+
+bool baseline_init (baseline_t *b, const baseline_config_t *config) {
+  if (!(config->smoothing > 0 && config->smoothing <= 1)) return false;
+  if (config->peg == BASELINE_PEG_MINIMUM && config->cycle_len == 0) return false;
+  if (config->peg == BASELINE_PEG_WINDOW && config->window_len == 0) return false;
+  if (config->peg != BASELINE_PEG_MINIMUM && config->peg != BASELINE_PEG_WINDOW) return false;
+  memset(b, 0, sizeof(*b));
+  b->config = *config;
+  trigger_config_t cycle = {
+    .level = config->cycle_level,
+    .hysteresis = config->cycle_hysteresis,
+    .slope = config->cycle_slope,
+    .holdoff = config->cycle_len
+  };
+  trigger_detector_init(&b->cycle, &cycle);
+  baseline_restart(b, 0);
+  return true;
+}
+
+void baseline_restart (baseline_t *b, uint64_t next_index) {
+  b->index = next_index;
+  b->cycle_started = false;
+  if (b->config.peg == BASELINE_PEG_MINIMUM) cycle_begin(b, next_index);
+  trigger_detector_reset(&b->cycle, next_index);
+  if (b->reset_scheduled && b->reset_index <= next_index) {
+    b->reset_index = next_index;
+    take_reset(b);
+  }
+  update_offset(b);
+}
+
+void baseline_process (baseline_t *b, const int16_t *src, int16_t *dst, size_t len) {
+  size_t pos = 0;
+  while (pos < len) {
+    /* Up to the next reset or cycle end, where the correction changes */
+    size_t n = len - pos;
+    if (b->reset_scheduled) {
+      if (b->reset_index <= b->index) {
+        take_reset(b);
+        continue;
+      }
+      if (b->reset_index - b->index < n) n = (size_t) (b->reset_index - b->index);
+    }
+    uint64_t cycle_end_index = b->cycle_start + b->config.cycle_len;
+    if (b->config.peg == BASELINE_PEG_MINIMUM && cycle_end_index - b->index < n) {
+      n = (size_t) (cycle_end_index - b->index);
+    }
+
+    if (b->config.peg == BASELINE_PEG_MINIMUM) {
+      /* Extremes first, dst may be src */
+      accumulate(b, &src[pos], n, b->index);
+      subtract(b, &src[pos], &dst[pos], n);
+    } else {
+      /* The cycle starts are searched on the corrected samples, the raw ones
+       * are kept aside for the window */
+      int16_t raw[BASELINE_CHUNK_LEN];
+      if (n > BASELINE_CHUNK_LEN) n = BASELINE_CHUNK_LEN;
+      memcpy(raw, &src[pos], n * sizeof(int16_t));
+      subtract(b, raw, &dst[pos], n);
+      track_window(b, raw, &dst[pos], n, b->index);
+    }
+    b->index += n;
+    pos += n;
+
+    if (b->config.peg == BASELINE_PEG_MINIMUM && b->index == cycle_end_index) {
+      cycle_end(b, b->index);
+      cycle_begin(b, b->index);
+    }
+    /* A peg moved the estimate, the rest goes on from the new one */
+    update_offset(b);
+  }
+}
+
+float baseline_level (const baseline_t *b) {
+  if (!b->valid) return 0;
+  return b->level + b->slope * (float) (int64_t) (b->index - b->level_index);
+}
+
+bool baseline_reset_due (const baseline_t *b) {
+  if (b->config.reset_margin == 0 || !b->valid || !b->has_quiet || b->reset_scheduled) return false;
+  int32_t drift = (int32_t) lrintf(baseline_level(b) - b->rest);
+  int32_t high = INT16_MAX - b->config.reset_margin;
+  int32_t low = INT16_MIN + b->config.reset_margin;
+  /* Only when the reset brings them back in */
+  if (drift > 0) return b->last_max > high && b->last_max - drift <= high;
+  if (drift < 0) return b->last_min < low && b->last_min - drift >= low;
+  return false;
+}
+
+uint64_t baseline_next_quiet (const baseline_t *b, uint64_t index) {
+  if (!b->has_quiet || b->period == 0) return index;
+  if (index <= b->quiet_index) return b->quiet_index;
+  uint64_t cycles = (index - b->quiet_index + b->period - 1) / b->period;
+  return b->quiet_index + cycles * b->period;
+}
+
+void baseline_amp_reset (baseline_t *b, uint64_t index) {
+  b->reset_scheduled = true;
+  b->reset_index = index;
+  if (index <= b->index) {
+    b->reset_index = b->index;
+    take_reset(b);
+  }
+}
@@ -0,0 +1,157 @@
+/**
+ * @file baseline.h
+ *
+ * @brief Drift of a charge amplifier output, estimated from the stream and
+ * subtracted as the samples go by.
+ *
+ * Once per engine cycle the baseline is pegged: on the lowest sample of the
+ * cycle (the intake stroke), or on the mean of a window at a fixed offset
+ * after the cycle start, a crank angle window. Cycle starts of the window
+ * mode are found on the corrected samples by a trigger detector, so they do
+ * not move with the drift. An alpha-beta filter over the pegs tracks the
+ * level and its slope, and between two pegs the level is extrapolated along
+ * the slope, so a steady drift is removed without a cycle of lag:
+ *
+ *   out = x - (level + slope * (n - peg index)) + reference
+ *
+ * with one add and a shift per sample in Q16.
+ *
+ * Drift the estimate cannot correct is the one that takes the signal out of
+ * the ADC range. baseline_reset_due() tells when the cycle extremes come
+ * within the margin of a range limit because of the drift, and
+ * baseline_next_quiet() gives a sample in the quiet part of a future cycle to
+ * reset the amplifier at. From that sample on the estimate goes back to the
+ * level of the first peg, the amplifier output at rest, and the samples of
+ * the settling time are not pegged.
+ */
+#ifndef BASELINE_H
+#define BASELINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "trigger.h"
+
+typedef enum baseline_peg_t {
+  /** Lowest sample of every cycle_len samples */
+  BASELINE_PEG_MINIMUM = 0,
+  /** Mean of window_len samples window_offset after each cycle start */
+  BASELINE_PEG_WINDOW = 1
+} baseline_peg_t;
+
+typedef struct baseline_config_t {
+  baseline_peg_t peg;
+  /** Samples of one engine cycle. The minimum search runs over cycles of this
+   * length, the window mode ignores cycle starts closer than this */
+  uint32_t cycle_len;
+  /** Cycle start of the window mode, a trigger on the corrected samples */
+  int16_t cycle_level;
+  uint16_t cycle_hysteresis;
+  trigger_slope_t cycle_slope;
+  uint32_t window_offset;
+  uint32_t window_len;
+  /** Weight of a new peg, 0 to 1, 1 takes each peg as it is */
+  float smoothing;
+  /** Code the corrected baseline sits at */
+  int16_t reference;
+  /** Headroom in codes the cycle extremes keep to the range limits, a reset
+   * is due once the drift takes them closer. 0 never resets */
+  uint16_t reset_margin;
+  /** Samples the amplifier output takes to settle after a reset */
+  uint32_t reset_settle;
+} baseline_config_t;
+
+#define BASELINE_DEFAULT_CONFIG() { \
+  .peg = BASELINE_PEG_MINIMUM, \
+  .cycle_len = 4000, \
+  .cycle_level = 0, \
+  .cycle_hysteresis = 0, \
+  .cycle_slope = TRIGGER_RISING, \
+  .window_offset = 0, \
+  .window_len = 0, \
+  .smoothing = 0.2f, \
+  .reference = 0, \
+  .reset_margin = 0, \
+  .reset_settle = 0 \
+}
+
+typedef struct baseline_t {
+  baseline_config_t config;
+  trigger_detector_t cycle;
+  /** Index of the next sample */
+  uint64_t index;
+  /** Cycle in progress, its extremes and window */
+  bool cycle_started;
+  uint64_t cycle_start;
+  uint32_t cycle_count;
+  int16_t cycle_min;
+  int16_t cycle_max;
+  uint64_t min_index;
+  int64_t window_sum;
+  uint32_t window_count;
+  bool window_done;
+  /** Extremes of the last complete cycle, raw codes */
+  int16_t last_min;
+  int16_t last_max;
+  /** Quiet sample of the last complete cycle and the cycle period */
+  bool has_quiet;
+  uint64_t quiet_index;
+  uint32_t period;
+  /** Estimate, in raw codes: level at level_index and slope per sample */
+  bool valid;
+  float level;
+  float slope;
+  uint64_t level_index;
+  /** First peg, the amplifier output at rest */
+  float rest;
+  /** Correction of the next sample and its step, Q16 */
+  int64_t offset_q16;
+  int64_t step_q16;
+  /** Amplifier reset taking effect at reset_index */
+  bool reset_scheduled;
+  uint64_t reset_index;
+  uint64_t settle_end;
+  uint64_t last_reset;
+  uint32_t pegs;
+  uint32_t resets;
+} baseline_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** @brief false for a cycle or window of no samples, or a smoothing out of (0, 1] */
+bool baseline_init (baseline_t *b, const baseline_config_t *config);
+
+/**
+ * @brief Continue after a gap, the estimate is kept and extrapolated over it,
+ * the cycle in progress is dropped
+ * @param next_index index of the next sample
+ */
+void baseline_restart (baseline_t *b, uint64_t next_index);
+
+/** @brief Corrects a block of consecutive samples, src and dst may be the same */
+void baseline_process (baseline_t *b, const int16_t *src, int16_t *dst, size_t len);
+
+/** @brief Estimated baseline in raw codes at the next sample */
+float baseline_level (const baseline_t *b);
+
+/** @brief The drift takes the signal within the reset margin of a range limit
+ * and no reset is scheduled */
+bool baseline_reset_due (const baseline_t *b);
+
+/** @brief Quiet sample of a future cycle at or after index, of the period of
+ * the last cycles. index itself if no cycle was seen yet */
+uint64_t baseline_next_quiet (const baseline_t *b, uint64_t index);
+
+/** @brief The amplifier is reset at index, from then on the estimate restarts
+ * from the rest level. A sample already processed takes effect at once */
+void baseline_amp_reset (baseline_t *b, uint64_t index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
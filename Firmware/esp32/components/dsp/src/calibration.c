@@ -0,0 +1,107 @@
+#include <math.h>
+
+#include "calibration.h"
+
+/* Multiplier magnitude bound, leaves a bit for the product with a code */
+#define MULT_BITS (30)
+#define MAX_SHIFT (46)
+#define MIN_FRAC (-16)
+#define MAX_FRAC (30)
+
+#define FNV_OFFSET (2166136261u)
+#define FNV_PRIME (16777619u)
+
+static uint32_t hash_bytes (uint32_t hash, const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t*) data;
+  for (size_t i = 0; i < len; i++) hash = (hash ^ p[i]) * FNV_PRIME;
+  return hash;
+}
+
+/* Field by field, the struct padding is not part of the calibration */
+static uint32_t config_hash (const calibration_config_t *config, float lsb_volts, int8_t frac_bits) {
+  uint32_t hash = FNV_OFFSET;
+  hash = hash_bytes(hash, &config->gain, sizeof(config->gain));
+  hash = hash_bytes(hash, &config->offset, sizeof(config->offset));
+  hash = hash_bytes(hash, &config->amp_range_pc, sizeof(config->amp_range_pc));
+  hash = hash_bytes(hash, &config->amp_full_scale_v, sizeof(config->amp_full_scale_v));
+  hash = hash_bytes(hash, &config->sensitivity, sizeof(config->sensitivity));
+  hash = hash_bytes(hash, &config->sensitivity_drift, sizeof(config->sensitivity_drift));
+  hash = hash_bytes(hash, &config->zero_drift, sizeof(config->zero_drift));
+  hash = hash_bytes(hash, &config->reference_temp, sizeof(config->reference_temp));
+  hash = hash_bytes(hash, &config->temperature, sizeof(config->temperature));
+  hash = hash_bytes(hash, &lsb_volts, sizeof(lsb_volts));
+  return hash_bytes(hash, &frac_bits, sizeof(frac_bits));
+}
+
+bool calibration_init (calibration_t *cal, const calibration_config_t *config, float lsb_volts) {
+  if (config->sensitivity == 0 || config->amp_range_pc == 0 || config->amp_full_scale_v == 0 || config->gain == 0 || lsb_volts <= 0) return false;
+  double dt = (double) config->temperature - config->reference_temp;
+  double sensitivity = config->sensitivity * (1 + config->sensitivity_drift * 1e-6 * dt);
+  if (sensitivity == 0) return false;
+  double scale = config->gain * (double) lsb_volts * config->amp_range_pc / config->amp_full_scale_v / sensitivity;
+  double zero = -config->zero_drift * dt;
+  /* bar = scale * code + base */
+  double base = zero - scale * config->offset;
+
+  int frac = config->frac_bits;
+  if (frac == CALIBRATION_AUTO_FRAC) {
+    /* Linear, so the extremes are at the ends of the code range */
+    double max_abs = fmax(fabs(scale * INT16_MIN + base), fabs(scale * INT16_MAX + base));
+    frac = (int) floor(log2(INT16_MAX / max_abs));
+    while (frac > MIN_FRAC && ldexp(max_abs, frac) > INT16_MAX) frac--;
+    if (frac > MAX_FRAC) frac = MAX_FRAC;
+    if (frac < MIN_FRAC) frac = MIN_FRAC;
+  } else if (frac < MIN_FRAC || frac > MAX_FRAC) {
+    return false;
+  }
+
+  /* Most precision left in the multiplier */
+  int exponent;
+  frexp(ldexp(scale, frac), &exponent);
+  int shift = MULT_BITS - exponent;
+  if (shift < 0) return false;
+  if (shift > MAX_SHIFT) shift = MAX_SHIFT;
+  double add = ldexp(base, frac + shift);
+  if (fabs(add) >= ldexp(1, 62)) return false;
+
+  *cal = (calibration_t) {
+    .config = *config,
+    .lsb_volts = lsb_volts,
+    .scale = scale,
+    .zero = base,
+    .mult = (int32_t) llround(ldexp(scale, frac + shift)),
+    .add = llround(add) + (shift > 0 ? (int64_t) 1 << (shift - 1) : 0),
+    .shift = shift,
+    .frac_bits = frac,
+    .hash = config_hash(config, lsb_volts, frac)
+  };
+  cal->config.frac_bits = frac;
+  return true;
+}
+
+static inline int16_t convert (int16_t code, int32_t mult, int64_t add, uint8_t shift) {
+  int64_t v = ((int64_t) code * mult + add) >> shift;
+  if (v > INT16_MAX) return INT16_MAX;
+  if (v < INT16_MIN) return INT16_MIN;
+  return (int16_t) v;
+}
+
+void calibration_apply (const calibration_t *cal, const int16_t *src, int16_t *dst, size_t len) {
+  int32_t mult = cal->mult;
+  int64_t add = cal->add;
+  uint8_t shift = cal->shift;
+  size_t i = 0;
+  /* Unrolled so the loads, multiplies and saturations of four samples overlap */
+  for (; i + 4 <= len; i += 4) {
+    int16_t c0 = src[i], c1 = src[i + 1], c2 = src[i + 2], c3 = src[i + 3];
+    dst[i] = convert(c0, mult, add, shift);
+    dst[i + 1] = convert(c1, mult, add, shift);
+    dst[i + 2] = convert(c2, mult, add, shift);
+    dst[i + 3] = convert(c3, mult, add, shift);
+  }
+  for (; i < len; i++) dst[i] = convert(src[i], mult, add, shift);
+}
+
+float calibration_bar (const calibration_t *cal, int16_t value) {
+  return ldexpf(value, -cal->frac_bits);
+}
@@ -0,0 +1,98 @@
+/**
+ * @file calibration.h
+ *
+ * @brief Conversion of ADC codes to pressure in fixed point. The sensor model
+ * is linear:
+ *
+ *   volts = gain * lsb * (code - offset)
+ *   bar = volts * amp_range / amp_full_scale / (sensitivity * (1 + drift * dT))
+ *         - zero_drift * dT
+ *
+ * with dT the temperature above the reference temperature. Pressure comes out
+ * as int16 with frac_bits fractional bits (Q format, bar = value * 2^-frac), so
+ * it streams and compresses like the codes. One int32 multiply, an int64 add and
+ * a shift per sample, with saturation.
+ */
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/** Chooses the most fractional bits that keep the whole code range in int16 */
+#define CALIBRATION_AUTO_FRAC (INT8_MIN)
+
+typedef struct calibration_config_t {
+  /** Gain correction of the input stage, 1 when ideal */
+  float gain;
+  /** ADC code at zero charge */
+  int32_t offset;
+  /** Charge amplifier range in pC, giving amp_full_scale_v at its output */
+  float amp_range_pc;
+  float amp_full_scale_v;
+  /** Sensor sensitivity in pC/bar at the reference temperature */
+  float sensitivity;
+  /** Sensitivity change in ppm/°C */
+  float sensitivity_drift;
+  /** Zero shift in bar/°C */
+  float zero_drift;
+  float reference_temp;
+  /** Operating temperature of the sensor, in °C */
+  float temperature;
+  /** Fractional bits of the output, CALIBRATION_AUTO_FRAC to choose */
+  int8_t frac_bits;
+} calibration_config_t;
+
+#define CALIBRATION_DEFAULT_CONFIG() { \
+  .gain = 1, \
+  .offset = 0, \
+  .amp_range_pc = 0, \
+  .amp_full_scale_v = 10, \
+  .sensitivity = 0, \
+  .sensitivity_drift = 0, \
+  .zero_drift = 0, \
+  .reference_temp = 25, \
+  .temperature = 25, \
+  .frac_bits = CALIBRATION_AUTO_FRAC \
+}
+
+typedef struct calibration_t {
+  calibration_config_t config;
+  float lsb_volts;
+  /** bar = scale * code + zero, in float */
+  float scale;
+  float zero;
+  /** Fixed point form: out = (code * mult + add) >> shift */
+  int32_t mult;
+  int64_t add;
+  uint8_t shift;
+  int8_t frac_bits;
+  /** Hash of the configuration and ADC step, identifies the calibration */
+  uint32_t hash;
+} calibration_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Derive the fixed point conversion
+ * @param lsb_volts input voltage step of one code, see ads8689_config_lsb_volts()
+ * @return false if the model is degenerate (zero sensitivity, range or step),
+ * or the fractional bits asked do not fit the arithmetic
+ */
+bool calibration_init (calibration_t *cal, const calibration_config_t *config, float lsb_volts);
+
+/** @brief Convert codes to Q format pressure, src and dst may be the same */
+void calibration_apply (const calibration_t *cal, const int16_t *src, int16_t *dst, size_t len);
+
+/** @brief Pressure in bar of one output value */
+float calibration_bar (const calibration_t *cal, int16_t value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
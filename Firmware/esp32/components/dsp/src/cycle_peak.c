@@ -0,0 +1,88 @@
+#include <string.h>
+
+#include "cycle_peak.h"
+
+bool cycle_peak_init (cycle_peak_t *t, uint16_t cycle_len, cycle_peak_callback_t on_report, void *arg) {
+  if (cycle_len < 2) return false;
+  memset(t, 0, sizeof(*t));
+  t->cycle_len = cycle_len;
+  t->on_report = on_report;
+  t->arg = arg;
+  return true;
+}
+
+void cycle_peak_reset (cycle_peak_t *t) {
+  if (t->active) t->dropped++;
+  t->active = false;
+}
+
+/* Extremes of n samples from angle on, first occurrence kept */
+static void scan (cycle_peak_report_t *r, const int16_t *x, size_t n, uint16_t angle) {
+  int16_t hi = r->max, lo = r->min;
+  size_t hi_at = SIZE_MAX, lo_at = SIZE_MAX;
+  for (size_t i = 0; i < n; i++) {
+    if (x[i] > hi) {
+      hi = x[i];
+      hi_at = i;
+    }
+    if (x[i] < lo) {
+      lo = x[i];
+      lo_at = i;
+    }
+  }
+  if (hi_at != SIZE_MAX) {
+    r->max = hi;
+    r->max_angle = (uint16_t) (angle + hi_at);
+  }
+  if (lo_at != SIZE_MAX) {
+    r->min = lo;
+    r->min_angle = (uint16_t) (angle + lo_at);
+  }
+}
+
+void cycle_peak_process (cycle_peak_t *t, const int16_t *x, size_t len, uint64_t index, uint32_t cycle, uint16_t angle) {
+  uint32_t len_cycle = t->cycle_len;
+  uint32_t a = angle;
+  size_t i = 0;
+  /* Angle of another cycle length, the block can't be placed in the cycle */
+  if (a >= len_cycle) {
+    cycle_peak_reset(t);
+    return;
+  }
+  while (i < len) {
+    if (a == 0) {
+      if (t->active) t->dropped++;
+      t->active = true;
+      t->next_angle = 0;
+      t->current = (cycle_peak_report_t) {
+        .first_sample = index + i,
+        .cycle = cycle,
+        .cycle_len = t->cycle_len,
+        /* Both extremes until another sample beats it */
+        .max = x[i],
+        .min = x[i]
+      };
+    } else if (t->active && (t->current.cycle != cycle || t->next_angle != a)) {
+      t->dropped++;
+      t->active = false;
+    }
+
+    size_t n = len - i;
+    if (n > len_cycle - a) n = len_cycle - a;
+    if (t->active) {
+      scan(&t->current, &x[i], n, (uint16_t) a);
+      t->next_angle = (uint16_t) (a + n);
+      if (a + n == len_cycle) {
+        t->active = false;
+        t->reported++;
+        if (t->on_report != NULL) t->on_report(&t->current, t->arg);
+      }
+    }
+    i += n;
+    a += n;
+    if (a == len_cycle) {
+      a = 0;
+      cycle++;
+    }
+  }
+}
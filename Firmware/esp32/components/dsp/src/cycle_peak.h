@@ -0,0 +1,75 @@
+/**
+ * @file cycle_peak.h
+ *
+ * @brief Peak pressure of each engine cycle and where it is, the part of the
+ * cycle analysis cheap enough for the sensor: a compare per sample for the
+ * highest and lowest sample of the cycle and their angles. The peak to peak
+ * pressure is max - min. IMEP and heat release need the cylinder volume and
+ * run on the host, see Software/native/include/pas/cycle_analysis.hpp.
+ *
+ * Cycles come from the crank angle of the encoder clocked stream
+ * (ads8689_sample_angle()): the caller gives the cycle and angle of the first
+ * sample of each block, a cycle is reported once all its samples from angle 0
+ * to cycle_len - 1 went by in order. A cycle that started before the
+ * tracking, or that a gap or an angle realignment cut, is dropped.
+ */
+#ifndef CYCLE_PEAK_H
+#define CYCLE_PEAK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct cycle_peak_report_t {
+  /** Index of the sample at angle 0 */
+  uint64_t first_sample;
+  uint32_t cycle;
+  uint16_t cycle_len;
+  /** Highest and lowest sample, angle of their first occurrence */
+  int16_t max;
+  uint16_t max_angle;
+  int16_t min;
+  uint16_t min_angle;
+} cycle_peak_report_t;
+
+typedef void (*cycle_peak_callback_t) (const cycle_peak_report_t *report, void *arg);
+
+typedef struct cycle_peak_t {
+  uint16_t cycle_len;
+  cycle_peak_callback_t on_report;
+  void *arg;
+  /** Cycle in progress and the angle of its next sample */
+  bool active;
+  uint16_t next_angle;
+  cycle_peak_report_t current;
+  uint32_t reported;
+  /** Cycles cut by a gap, a realignment or an angle out of the cycle */
+  uint32_t dropped;
+} cycle_peak_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** @brief False if cycle_len is below 2 */
+bool cycle_peak_init (cycle_peak_t *t, uint16_t cycle_len, cycle_peak_callback_t on_report, void *arg);
+
+/** @brief Drops the cycle in progress, the next report is of the next whole cycle */
+void cycle_peak_reset (cycle_peak_t *t);
+
+/**
+ * @brief Tracks len consecutive samples, calls on_report at the end of each
+ * whole cycle
+ * @param index stream index of x[0]
+ * @param cycle cycle of x[0]
+ * @param angle angle of x[0], below cycle_len. A block at another angle is
+ * skipped and drops the cycle in progress
+ */
+void cycle_peak_process (cycle_peak_t *t, const int16_t *x, size_t len, uint64_t index, uint32_t cycle, uint16_t angle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,126 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "feature_extractor.h"
+
+#define min(x,y) ( \
+    { __auto_type __x = (x); __auto_type __y = (y); \
+      __x < __y ? __x : __y; })
+
+/* Floor of the log power, a bin at zero must not win the interpolation */
+#define POWER_FLOOR (1e-20f)
+
+bool feature_extractor_init (feature_extractor_t *extractor, const feature_config_t *config, feature_report_cb report, void *arg) {
+  memset(extractor, 0, sizeof(feature_extractor_t));
+  if (config->windows == 0 || !fft_real_init(&extractor->fft, config->fft_len)) return false;
+  extractor->config = *config;
+  extractor->report = report;
+  extractor->arg = arg;
+  size_t bins = config->fft_len / 2 + 1;
+  extractor->window = (int16_t*) malloc(config->fft_len * sizeof(int16_t));
+  extractor->power = (float*) malloc(bins * sizeof(float));
+  extractor->window_power = (float*) malloc(bins * sizeof(float));
+  if (extractor->window == NULL || extractor->power == NULL || extractor->window_power == NULL) {
+    feature_extractor_free(extractor);
+    return false;
+  }
+  feature_extractor_reset(extractor, 0);
+  return true;
+}
+
+void feature_extractor_free (feature_extractor_t *extractor) {
+  fft_real_free(&extractor->fft);
+  free(extractor->window);
+  free(extractor->power);
+  free(extractor->window_power);
+  memset(extractor, 0, sizeof(feature_extractor_t));
+}
+
+void feature_extractor_reset (feature_extractor_t *extractor, uint64_t next_index) {
+  extractor->fill = 0;
+  extractor->windows = 0;
+  extractor->min = INT16_MAX;
+  extractor->max = INT16_MIN;
+  extractor->sum = 0;
+  extractor->sum_sq = 0;
+  extractor->first_sample = next_index;
+  extractor->index = next_index;
+  memset(extractor->power, 0, (extractor->config.fft_len / 2 + 1) * sizeof(float));
+}
+
+float feature_dominant_bin (const float *power, size_t n_fft, float window_gain, float *amplitude) {
+  size_t half = n_fft / 2;
+  size_t peak = 1;
+  for (size_t k = 2; k < half; k++) {
+    if (power[k] > power[peak]) peak = k;
+  }
+  /* A Hann windowed sine has a near gaussian peak, a parabola fits its log */
+  float a = logf(power[peak - 1] + POWER_FLOOR);
+  float b = logf(power[peak] + POWER_FLOOR);
+  float c = logf(power[peak + 1] + POWER_FLOOR);
+  float curvature = a - 2 * b + c;
+  float delta = curvature < 0 ? 0.5f * (a - c) / curvature : 0;
+  float log_peak = b - 0.25f * (a - c) * delta;
+  *amplitude = 2 * sqrtf(expf(log_peak)) / window_gain;
+  return peak + delta;
+}
+
+static void finish_window (feature_extractor_t *extractor, float fs) {
+  feature_config_t *config = &extractor->config;
+  const int16_t *x = extractor->window;
+  size_t n = config->fft_len;
+  int16_t lo = extractor->min, hi = extractor->max;
+  int64_t sum = 0;
+  uint64_t sum_sq = 0;
+  for (size_t i = 0; i < n; i++) {
+    int32_t v = x[i];
+    if (v < lo) lo = v;
+    if (v > hi) hi = v;
+    sum += v;
+    sum_sq += (uint64_t) (v * v);
+  }
+  extractor->min = lo;
+  extractor->max = hi;
+  extractor->sum += sum;
+  extractor->sum_sq += sum_sq;
+
+  fft_real_power(&extractor->fft, x, (float) sum / n, extractor->window_power);
+  for (size_t k = 0; k <= n / 2; k++) extractor->power[k] += extractor->window_power[k];
+  extractor->windows++;
+  if (extractor->windows < config->windows) return;
+
+  uint32_t length = (uint32_t) n * config->windows;
+  double mean = (double) extractor->sum / length;
+  double variance = (double) extractor->sum_sq / length - mean * mean;
+  feature_report_t report = {
+    .first_sample = extractor->first_sample,
+    .length = length,
+    .min = extractor->min,
+    .max = extractor->max,
+    .mean = (float) mean,
+    .ac_rms = variance > 0 ? (float) sqrt(variance) : 0
+  };
+  /* Averaged power, the amplitude is the one of a single window */
+  for (size_t k = 0; k <= n / 2; k++) extractor->power[k] /= config->windows;
+  float bin = feature_dominant_bin(extractor->power, n, extractor->fft.window_gain, &report.dominant_amplitude);
+  report.dominant_freq = bin * fs / n;
+  if (extractor->report != NULL) extractor->report(&report, extractor->arg);
+  feature_extractor_reset(extractor, extractor->index);
+}
+
+void feature_extractor_process (feature_extractor_t *extractor, const int16_t *x, size_t len, float fs) {
+  size_t n = extractor->config.fft_len;
+  while (len > 0) {
+    size_t copy = min(len, n - extractor->fill);
+    memcpy(&extractor->window[extractor->fill], x, copy * sizeof(int16_t));
+    extractor->fill += copy;
+    extractor->index += copy;
+    x += copy;
+    len -= copy;
+    if (extractor->fill == n) {
+      extractor->fill = 0;
+      finish_window(extractor, fs);
+    }
+  }
+}
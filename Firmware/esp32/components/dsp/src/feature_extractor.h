@@ -0,0 +1,97 @@
+/**
+ * @file feature_extractor.h
+ *
+ * @brief Low rate summary of the sample stream: min, max, mean and RMS over a
+ * report period plus the dominant frequency of the averaged power spectrum.
+ * Each report covers windows consecutive FFT windows of fft_len samples, so a
+ * report replaces windows * fft_len samples of the stream.
+ */
+#ifndef FEATURE_EXTRACTOR_H
+#define FEATURE_EXTRACTOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "fft.h"
+
+typedef struct feature_config_t {
+  /** FFT size, power of two in [FFT_MIN_LEN, FFT_MAX_LEN] */
+  uint16_t fft_len;
+  /** FFT windows averaged in each report */
+  uint16_t windows;
+} feature_config_t;
+
+typedef struct feature_report_t {
+  /** Index of the first sample covered */
+  uint64_t first_sample;
+  /** Samples covered, fft_len * windows */
+  uint32_t length;
+  int16_t min;
+  int16_t max;
+  float mean;
+  /** RMS around the mean */
+  float ac_rms;
+  /** Peak of the averaged spectrum, interpolated between bins, Hz */
+  float dominant_freq;
+  /** Amplitude of a sine at dominant_freq with the same peak, ADC counts */
+  float dominant_amplitude;
+} feature_report_t;
+
+typedef void (*feature_report_cb) (const feature_report_t *report, void *arg);
+
+typedef struct feature_extractor_t {
+  feature_config_t config;
+  fft_real_t fft;
+  /** Samples of the window being filled */
+  int16_t *window;
+  size_t fill;
+  /** Power spectrum sum of the windows in the report */
+  float *power;
+  float *window_power;
+  uint16_t windows;
+  int16_t min;
+  int16_t max;
+  int64_t sum;
+  uint64_t sum_sq;
+  uint64_t first_sample;
+  /** Index of the next sample */
+  uint64_t index;
+  feature_report_cb report;
+  void *arg;
+} feature_extractor_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+bool feature_extractor_init (feature_extractor_t *extractor, const feature_config_t *config, feature_report_cb report, void *arg);
+
+void feature_extractor_free (feature_extractor_t *extractor);
+
+/**
+ * @brief Restart after a gap, the partial report is discarded
+ * @param next_index index of the next sample
+ */
+void feature_extractor_reset (feature_extractor_t *extractor, uint64_t next_index);
+
+/**
+ * @brief Feeds a block of consecutive samples, report is called from here
+ * @param fs sample rate, for the dominant frequency
+ */
+void feature_extractor_process (feature_extractor_t *extractor, const int16_t *x, size_t len, float fs);
+
+/**
+ * @brief Dominant frequency of a power spectrum of n_fft points, bins 1 to
+ * n_fft / 2 - 1, interpolated on the log power of the peak and its neighbours
+ * @param amplitude set to the peak amplitude for a window of sum window_gain
+ * @return frequency in bins
+ */
+float feature_dominant_bin (const float *power, size_t n_fft, float window_gain, float *amplitude);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,130 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fft.h"
+
+#ifndef M_PI
+#define M_PI (3.14159265358979323846)
+#endif
+
+bool fft_real_init (fft_real_t *fft, size_t len) {
+  memset(fft, 0, sizeof(fft_real_t));
+  if (len < FFT_MIN_LEN || len > FFT_MAX_LEN || (len & (len - 1)) != 0) return false;
+  size_t half = len / 2;
+  fft->len = len;
+  fft->twiddle = (float*) malloc(half * 2 * sizeof(float));
+  fft->bitrev = (uint16_t*) malloc(half * sizeof(uint16_t));
+  fft->window = (float*) malloc(len * sizeof(float));
+  fft->work = (float*) malloc(half * 2 * sizeof(float));
+  if (fft->twiddle == NULL || fft->bitrev == NULL || fft->window == NULL || fft->work == NULL) {
+    fft_real_free(fft);
+    return false;
+  }
+
+  for (size_t k = 0; k < half; k++) {
+    /* Double precision so the tables stay exact for the largest sizes */
+    double phase = -2 * M_PI * k / len;
+    fft->twiddle[2 * k] = (float) cos(phase);
+    fft->twiddle[2 * k + 1] = (float) sin(phase);
+  }
+  int bits = 0;
+  while (((size_t) 1 << bits) < half) bits++;
+  for (size_t i = 0; i < half; i++) {
+    size_t r = 0;
+    for (int b = 0; b < bits; b++) r |= ((i >> b) & 1) << (bits - 1 - b);
+    fft->bitrev[i] = (uint16_t) r;
+  }
+  fft->window_gain = 0;
+  for (size_t n = 0; n < len; n++) {
+    fft->window[n] = (float) (0.5 - 0.5 * cos(2 * M_PI * n / len));
+    fft->window_gain += fft->window[n];
+  }
+  return true;
+}
+
+void fft_real_free (fft_real_t *fft) {
+  free(fft->twiddle);
+  free(fft->bitrev);
+  free(fft->window);
+  free(fft->work);
+  memset(fft, 0, sizeof(fft_real_t));
+}
+
+/* In place radix-2 decimation in time over the len / 2 points of work, input
+ * already in bit reversed order. Twiddles of the n point FFT are every
+ * (len / 2) / n * 2 entry of the len table. */
+static void fft_complex (fft_real_t *fft) {
+  float *z = fft->work;
+  const float *w = fft->twiddle;
+  size_t half = fft->len / 2;
+  for (size_t size = 2; size <= half; size *= 2) {
+    size_t span = size / 2;
+    size_t step = fft->len / size;
+    for (size_t start = 0; start < half; start += size) {
+      for (size_t j = 0; j < span; j++) {
+        float wr = w[2 * j * step], wi = w[2 * j * step + 1];
+        float *a = &z[2 * (start + j)];
+        float *b = &z[2 * (start + j + span)];
+        float tr = b[0] * wr - b[1] * wi;
+        float ti = b[0] * wi + b[1] * wr;
+        b[0] = a[0] - tr;
+        b[1] = a[1] - ti;
+        a[0] += tr;
+        a[1] += ti;
+      }
+    }
+  }
+}
+
+/* Bin k of the real signal, 0 < k < len / 2, from the half size complex FFT
+ * of its even (real part) and odd (imaginary part) samples */
+static inline void split_bin (const fft_real_t *fft, size_t k, float *re, float *im) {
+  const float *z = fft->work;
+  size_t half = fft->len / 2;
+  float ar = z[2 * k], ai = z[2 * k + 1];
+  float br = z[2 * (half - k)], bi = -z[2 * (half - k) + 1];
+  /* Even part (a + b) / 2, odd part (a - b) / 2i */
+  float even_re = (ar + br) / 2, even_im = (ai + bi) / 2;
+  float odd_re = (ai - bi) / 2, odd_im = (br - ar) / 2;
+  float wr = fft->twiddle[2 * k], wi = fft->twiddle[2 * k + 1];
+  *re = even_re + odd_re * wr - odd_im * wi;
+  *im = even_im + odd_re * wi + odd_im * wr;
+}
+
+void fft_real_forward (fft_real_t *fft, const float *x, float *out) {
+  size_t half = fft->len / 2;
+  for (size_t i = 0; i < half; i++) {
+    size_t r = fft->bitrev[i];
+    fft->work[2 * r] = x[2 * i];
+    fft->work[2 * r + 1] = x[2 * i + 1];
+  }
+  fft_complex(fft);
+
+  const float *z = fft->work;
+  out[0] = z[0] + z[1];
+  out[1] = 0;
+  out[2 * half] = z[0] - z[1];
+  out[2 * half + 1] = 0;
+  for (size_t k = 1; k < half; k++) split_bin(fft, k, &out[2 * k], &out[2 * k + 1]);
+}
+
+void fft_real_power (fft_real_t *fft, const int16_t *x, float offset, float *power) {
+  size_t half = fft->len / 2;
+  const float *window = fft->window;
+  for (size_t i = 0; i < half; i++) {
+    size_t r = fft->bitrev[i];
+    fft->work[2 * r] = (x[2 * i] - offset) * window[2 * i];
+    fft->work[2 * r + 1] = (x[2 * i + 1] - offset) * window[2 * i + 1];
+  }
+  fft_complex(fft);
+
+  const float *z = fft->work;
+  power[0] = (z[0] + z[1]) * (z[0] + z[1]);
+  power[half] = (z[0] - z[1]) * (z[0] - z[1]);
+  for (size_t k = 1; k < half; k++) {
+    float re, im;
+    split_bin(fft, k, &re, &im);
+    power[k] = re * re + im * im;
+  }
+}
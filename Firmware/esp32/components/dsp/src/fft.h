@@ -0,0 +1,59 @@
+/**
+ * @file fft.h
+ *
+ * @brief Fixed size real FFT in single precision float, the ESP32 has a
+ * hardware FPU for it. A real input of len samples is transformed as a complex
+ * FFT of len / 2 points followed by a split step, with the twiddles, bit
+ * reversal table and Hann window computed once at init.
+ */
+#ifndef FFT_H
+#define FFT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define FFT_MIN_LEN (16)
+#define FFT_MAX_LEN (8192)
+
+typedef struct fft_real_t {
+  size_t len;
+  /** exp(-2 pi i k / len) for k < len / 2, interleaved re, im */
+  float *twiddle;
+  /** Bit reversed index of each of the len / 2 complex points */
+  uint16_t *bitrev;
+  float *window;
+  /** Sum of the window, full scale sine of amplitude A peaks at A * gain / 2 */
+  float window_gain;
+  /** len / 2 complex points, interleaved re, im */
+  float *work;
+} fft_real_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** @brief Allocates the tables, len a power of two in [FFT_MIN_LEN, FFT_MAX_LEN] */
+bool fft_real_init (fft_real_t *fft, size_t len);
+
+void fft_real_free (fft_real_t *fft);
+
+/**
+ * @brief Hann windowed power spectrum |X[k]|^2 of len samples, offset is
+ * subtracted first (the mean, so the DC leakage does not mask low bins)
+ * @param power len / 2 + 1 bins, from DC to Nyquist
+ */
+void fft_real_power (fft_real_t *fft, const int16_t *x, float offset, float *power);
+
+/**
+ * @brief Complex spectrum of len real samples, unwindowed
+ * @param out len / 2 + 1 bins, interleaved re, im
+ */
+void fft_real_forward (fft_real_t *fft, const float *x, float *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
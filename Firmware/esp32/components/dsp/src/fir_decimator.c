@@ -0,0 +1,209 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fir_decimator.h"
+
+#ifndef M_PI
+#define M_PI (3.14159265358979323846)
+#endif
+
+/* Kaiser window beta, about 70 dB stop band attenuation */
+#define KAISER_BETA (7.0f)
+/* Default taps per unit of decimation factor */
+#define DEFAULT_TAPS_PER_FACTOR (16)
+/* Default cutoff relative to the output Nyquist frequency */
+#define DEFAULT_CUTOFF (0.8f)
+
+/* Modified Bessel function of the first kind, order zero */
+static float bessel_i0 (float x) {
+  float sum = 1, term = 1;
+  float half_x = x / 2;
+  for (int k = 1; k < 32; k++) {
+    term *= (half_x / k) * (half_x / k);
+    sum += term;
+    if (term < sum * 1e-9f) break;
+  }
+  return sum;
+}
+
+/* Tap n of the windowed sinc, before normalization */
+static float lowpass_tap (size_t n, size_t n_taps, float cutoff, float i0_beta) {
+  float t = n - (n_taps - 1) / 2.0f;
+  float sinc = t == 0 ? 2 * cutoff : sinf(2 * M_PI * cutoff * t) / (M_PI * t);
+  float r = n_taps > 1 ? (2.0f * n / (n_taps - 1) - 1) : 0;
+  float window = bessel_i0(KAISER_BETA * sqrtf(fmaxf(0, 1 - r * r))) / i0_beta;
+  return sinc * window;
+}
+
+void fir_design_lowpass (int16_t *taps, size_t n_taps, float cutoff) {
+  if (n_taps == 0) return;
+  /* Two passes over the taps instead of a float copy, up to 4 kB on the
+   * stack of the task configuring the stream */
+  float i0_beta = bessel_i0(KAISER_BETA);
+  float sum = 0;
+  for (size_t n = 0; n < n_taps; n++) sum += lowpass_tap(n, n_taps, cutoff, i0_beta);
+  /* Unity DC gain, rounding error goes to the center tap */
+  int32_t q_sum = 0;
+  for (size_t n = 0; n < n_taps; n++) {
+    taps[n] = (int16_t) lrintf(lowpass_tap(n, n_taps, cutoff, i0_beta) / sum * 32768.0f);
+    q_sum += taps[n];
+  }
+  taps[n_taps / 2] += 32768 - q_sum;
+}
+
+size_t fir_default_taps (uint32_t factor) {
+  if (factor <= 1) return 0;
+  size_t n_taps = DEFAULT_TAPS_PER_FACTOR * factor + 1;
+  return n_taps < FIR_DECIMATOR_MAX_TAPS ? n_taps : FIR_DECIMATOR_MAX_TAPS - 1;
+}
+
+bool fir_decimator_init (fir_decimator_t *fir, const fir_decimator_config_t *config) {
+  memset(fir, 0, sizeof(fir_decimator_t));
+  if (config->factor == 0 || config->n_taps > FIR_DECIMATOR_MAX_TAPS) return false;
+
+  size_t n_taps = config->taps != NULL ? config->n_taps : fir_default_taps(config->factor);
+  if (n_taps > 0) {
+    fir->taps = (int16_t*) malloc(n_taps * sizeof(int16_t));
+    fir->delay = (int16_t*) calloc(2 * n_taps, sizeof(int16_t));
+    if (fir->taps == NULL || fir->delay == NULL) {
+      fir_decimator_free(fir);
+      return false;
+    }
+    if (config->taps != NULL) {
+      memcpy(fir->taps, config->taps, n_taps * sizeof(int16_t));
+    } else {
+      fir_design_lowpass(fir->taps, n_taps, DEFAULT_CUTOFF * 0.5f / config->factor);
+    }
+    /* |sum| <= 32768 * sum(|taps|) must fit the accumulator */
+    int32_t abs_sum = 0;
+    for (size_t i = 0; i < n_taps; i++) abs_sum += abs(fir->taps[i]);
+    if (abs_sum > UINT16_MAX) {
+      fir_decimator_free(fir);
+      return false;
+    }
+  }
+  fir->factor = config->factor;
+  fir->n_taps = n_taps;
+  return true;
+}
+
+void fir_decimator_free (fir_decimator_t *fir) {
+  free(fir->taps);
+  free(fir->delay);
+  fir->taps = NULL;
+  fir->delay = NULL;
+  fir->n_taps = 0;
+}
+
+void fir_decimator_reset (fir_decimator_t *fir, uint64_t next_index) {
+  if (fir->delay != NULL) memset(fir->delay, 0, 2 * fir->n_taps * sizeof(int16_t));
+  fir->pos = 0;
+  fir->phase = next_index % fir->factor;
+}
+
+/* Newest sample is window[0] */
+static inline int16_t fir_dot (const int16_t *taps, const int16_t *window, size_t n) {
+  int32_t acc = 1 << 14;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    acc += (int32_t) taps[i] * window[i];
+    acc += (int32_t) taps[i + 1] * window[i + 1];
+    acc += (int32_t) taps[i + 2] * window[i + 2];
+    acc += (int32_t) taps[i + 3] * window[i + 3];
+  }
+  for (; i < n; i++) acc += (int32_t) taps[i] * window[i];
+  acc >>= 15;
+  if (acc > INT16_MAX) return INT16_MAX;
+  if (acc < INT16_MIN) return INT16_MIN;
+  return (int16_t) acc;
+}
+
+size_t fir_decimator_process (fir_decimator_t *fir, const int16_t *in, size_t len, int16_t *out) {
+  size_t n_out = 0;
+  size_t n_taps = fir->n_taps;
+
+  if (n_taps == 0) {
+    /* Plain down sampling */
+    for (size_t i = 0; i < len; i++) {
+      if (++fir->phase == fir->factor) {
+        out[n_out++] = in[i];
+        fir->phase = 0;
+      }
+    }
+    return n_out;
+  }
+
+  for (size_t i = 0; i < len; i++) {
+    fir->pos = fir->pos == 0 ? n_taps - 1 : fir->pos - 1;
+    fir->delay[fir->pos] = in[i];
+    fir->delay[fir->pos + n_taps] = in[i];
+    if (++fir->phase == fir->factor) {
+      out[n_out++] = fir_dot(fir->taps, &fir->delay[fir->pos], n_taps);
+      fir->phase = 0;
+    }
+  }
+  return n_out;
+}
+
+bool fir_decimator_chain_init (fir_decimator_chain_t *chain, const fir_decimator_config_t *configs, size_t n_stages, size_t block_len) {
+  memset(chain, 0, sizeof(fir_decimator_chain_t));
+  if (n_stages > FIR_DECIMATOR_MAX_STAGES) return false;
+
+  uint32_t factor = 1;
+  for (size_t s = 0; s < n_stages; s++) {
+    if (!fir_decimator_init(&chain->stages[s], &configs[s])) {
+      chain->n_stages = s;
+      fir_decimator_chain_free(chain);
+      return false;
+    }
+    chain->n_stages = s + 1;
+    chain->delay += (chain->stages[s].n_taps > 0 ? (chain->stages[s].n_taps - 1) / 2.0f : 0) * factor;
+    factor *= configs[s].factor;
+  }
+  chain->factor = factor;
+
+  if (n_stages > 1) {
+    chain->scratch_len = block_len / configs[0].factor + 1;
+    chain->scratch = (int16_t*) malloc(chain->scratch_len * sizeof(int16_t));
+    if (chain->scratch == NULL) {
+      fir_decimator_chain_free(chain);
+      return false;
+    }
+  }
+  fir_decimator_chain_reset(chain, 0);
+  return true;
+}
+
+void fir_decimator_chain_free (fir_decimator_chain_t *chain) {
+  for (size_t s = 0; s < chain->n_stages; s++) fir_decimator_free(&chain->stages[s]);
+  free(chain->scratch);
+  chain->scratch = NULL;
+  chain->n_stages = 0;
+}
+
+void fir_decimator_chain_reset (fir_decimator_chain_t *chain, uint64_t next_index) {
+  uint64_t index = next_index;
+  for (size_t s = 0; s < chain->n_stages; s++) {
+    fir_decimator_reset(&chain->stages[s], index);
+    index /= chain->stages[s].factor;
+  }
+  chain->out_index = index;
+}
+
+size_t fir_decimator_chain_process (fir_decimator_chain_t *chain, const int16_t *in, size_t len, int16_t *out) {
+  size_t n = len;
+  if (chain->n_stages == 0) {
+    if (out != in) memmove(out, in, len * sizeof(int16_t));
+  } else if (chain->n_stages == 1) {
+    n = fir_decimator_process(&chain->stages[0], in, len, out);
+  } else {
+    n = fir_decimator_process(&chain->stages[0], in, len, chain->scratch);
+    for (size_t s = 1; s < chain->n_stages - 1; s++) {
+      n = fir_decimator_process(&chain->stages[s], chain->scratch, n, chain->scratch);
+    }
+    n = fir_decimator_process(&chain->stages[chain->n_stages - 1], chain->scratch, n, out);
+  }
+  chain->out_index += n;
+  return n;
+}
@@ -0,0 +1,115 @@
+/**
+ * @file fir_decimator.h
+ *
+ * @brief Fixed point decimating FIR filter, int16 samples and Q15 taps with
+ * int32 accumulation. Only the kept outputs are computed (polyphase form), so
+ * the cost is taps / factor multiply-accumulates per input sample.
+ *
+ * Stages can be cascaded in a chain. Outputs are aligned to the absolute input
+ * sample index: the chain with total factor M outputs at input indexes
+ * k * M + M - 1, and that output has index k in the decimated stream. This
+ * keeps the output index consistent across resets, e.g. after a gap.
+ */
+#ifndef FIR_DECIMATOR_H
+#define FIR_DECIMATOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define FIR_DECIMATOR_MAX_TAPS (1024)
+#define FIR_DECIMATOR_MAX_STAGES (4)
+
+typedef struct fir_decimator_config_t {
+  /** Decimation factor, 1 passes samples through unfiltered */
+  uint32_t factor;
+  /** Q15 taps, NULL to use a default low pass for the factor */
+  const int16_t *taps;
+  size_t n_taps;
+} fir_decimator_config_t;
+
+typedef struct fir_decimator_t {
+  uint32_t factor;
+  uint32_t phase;
+  int16_t *taps;
+  size_t n_taps;
+  /** Delay line stored twice so the window is always contiguous */
+  int16_t *delay;
+  size_t pos;
+} fir_decimator_t;
+
+typedef struct fir_decimator_chain_t {
+  fir_decimator_t stages[FIR_DECIMATOR_MAX_STAGES];
+  size_t n_stages;
+  uint32_t factor;
+  /** Group delay of the chain in input samples */
+  float delay;
+  /** Decimated index of the next output */
+  uint64_t out_index;
+  /** Intermediate buffer between stages */
+  int16_t *scratch;
+  size_t scratch_len;
+} fir_decimator_chain_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Fill taps with a Kaiser windowed sinc low pass, normalized to unity
+ * DC gain in Q15
+ * @param cutoff -6 dB frequency relative to the sample rate (0 to 0.5)
+ */
+void fir_design_lowpass (int16_t *taps, size_t n_taps, float cutoff);
+
+/** @brief Number of taps of the default anti-alias filter for a factor */
+size_t fir_default_taps (uint32_t factor);
+
+/**
+ * @brief Allocate a decimator stage
+ * @return false if the configuration is invalid: zero factor, too many taps,
+ * or taps whose absolute sum could overflow the int32 accumulator
+ */
+bool fir_decimator_init (fir_decimator_t *fir, const fir_decimator_config_t *config);
+
+void fir_decimator_free (fir_decimator_t *fir);
+
+/**
+ * @brief Clear the delay line and align the output phase
+ * @param next_index index of the next input sample
+ */
+void fir_decimator_reset (fir_decimator_t *fir, uint64_t next_index);
+
+/**
+ * @brief Filter and decimate a block, in and out may be the same buffer
+ * @return number of samples written to out, at most len / factor + 1
+ */
+size_t fir_decimator_process (fir_decimator_t *fir, const int16_t *in, size_t len, int16_t *out);
+
+/**
+ * @brief Allocate a chain of stages
+ * @param block_len largest block passed to fir_decimator_chain_process
+ */
+bool fir_decimator_chain_init (fir_decimator_chain_t *chain, const fir_decimator_config_t *configs, size_t n_stages, size_t block_len);
+
+void fir_decimator_chain_free (fir_decimator_chain_t *chain);
+
+/**
+ * @brief Reset every stage
+ * @param next_index index of the next input sample of the first stage
+ */
+void fir_decimator_chain_reset (fir_decimator_chain_t *chain, uint64_t next_index);
+
+/**
+ * @brief Run a block through all stages
+ * @param out must hold block_len / factor + 1 samples
+ * @return number of samples written to out
+ */
+size_t fir_decimator_chain_process (fir_decimator_chain_t *chain, const int16_t *in, size_t len, int16_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
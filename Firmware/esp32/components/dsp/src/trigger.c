@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "trigger.h"
+
+#define min(x,y) ( \
+    { __auto_type __x = (x); __auto_type __y = (y); \
+      __x < __y ? __x : __y; })
+
+static int16_t clamp16 (int32_t v) {
+  if (v > INT16_MAX) return INT16_MAX;
+  if (v < INT16_MIN) return INT16_MIN;
+  return (int16_t) v;
+}
+
+void trigger_detector_init (trigger_detector_t *detector, const trigger_config_t *config) {
+  detector->high = clamp16((int32_t) config->level + config->hysteresis);
+  detector->low = clamp16((int32_t) config->level - config->hysteresis);
+  detector->slope = config->slope;
+  detector->holdoff = config->holdoff;
+  trigger_detector_reset(detector, 0);
+}
+
+void trigger_detector_reset (trigger_detector_t *detector, uint64_t next_index) {
+  detector->initialized = false;
+  detector->armed = false;
+  detector->index = next_index;
+  detector->holdoff_end = next_index;
+}
+
+size_t trigger_detect (trigger_detector_t *detector, const int16_t *x, size_t len, uint64_t *trigger_index) {
+  if (len == 0) return 0;
+  const int16_t high = detector->high, low = detector->low;
+  const bool falling = detector->slope == TRIGGER_FALLING;
+  size_t i = 0;
+
+  if (!detector->initialized) {
+    detector->armed = falling ? x[0] > high : x[0] < low;
+    detector->initialized = true;
+  }
+
+  while (i < len) {
+    if (!detector->armed) {
+      /* Wait for the far side of the hysteresis band */
+      if (falling) while (i < len && x[i] <= high) i++;
+      else while (i < len && x[i] >= low) i++;
+      if (i == len) break;
+      detector->armed = true;
+      i++;
+      continue;
+    }
+    if (falling) while (i < len && x[i] >= low) i++;
+    else while (i < len && x[i] <= high) i++;
+    if (i == len) break;
+    detector->armed = false;
+    uint64_t index = detector->index + i;
+    if (index >= detector->holdoff_end) {
+      detector->holdoff_end = index + detector->holdoff;
+      detector->index += i + 1;
+      *trigger_index = index;
+      return i;
+    }
+    i++;
+  }
+  detector->index += len;
+  return len;
+}
+
+size_t trigger_find_all (trigger_detector_t *detector, const int16_t *x, size_t len, uint64_t *out, size_t max_out) {
+  size_t n = 0, pos = 0;
+  while (pos < len && n < max_out) {
+    size_t found = trigger_detect(detector, &x[pos], len - pos, &out[n]);
+    if (found == len - pos) break;
+    n++;
+    pos += found + 1;
+  }
+  return n;
+}
+
+bool trigger_engine_init (
+  trigger_engine_t *engine, const trigger_config_t *config,
+  trigger_get_capture_cb get_capture, trigger_capture_done_cb capture_done, void *arg
+) {
+  memset(engine, 0, sizeof(trigger_engine_t));
+  if (config->post_trigger == 0) return false;
+  engine->config = *config;
+  if (engine->config.holdoff < config->post_trigger) engine->config.holdoff = config->post_trigger;
+  if (config->pre_trigger > 0) {
+    engine->history = (int16_t*) malloc(config->pre_trigger * sizeof(int16_t));
+    if (engine->history == NULL) return false;
+  }
+  engine->get_capture = get_capture;
+  engine->capture_done = capture_done;
+  engine->arg = arg;
+  trigger_detector_init(&engine->detector, &engine->config);
+  return true;
+}
+
+void trigger_engine_free (trigger_engine_t *engine) {
+  free(engine->history);
+  engine->history = NULL;
+}
+
+void trigger_engine_reset (trigger_engine_t *engine, uint64_t next_index) {
+  if (engine->active != NULL) {
+    engine->active->truncated = true;
+    engine->capture_done(engine->active, engine->arg);
+    engine->active = NULL;
+  }
+  engine->history_fill = 0;
+  engine->history_pos = 0;
+  trigger_detector_reset(&engine->detector, next_index);
+}
+
+static void history_push (trigger_engine_t *engine, const int16_t *x, size_t len) {
+  size_t history_len = engine->config.pre_trigger;
+  if (history_len == 0) return;
+  if (len >= history_len) {
+    memcpy(engine->history, &x[len - history_len], history_len * sizeof(int16_t));
+    engine->history_pos = 0;
+    engine->history_fill = history_len;
+    return;
+  }
+  size_t first = min(len, history_len - engine->history_pos);
+  memcpy(&engine->history[engine->history_pos], x, first * sizeof(int16_t));
+  memcpy(engine->history, &x[first], (len - first) * sizeof(int16_t));
+  engine->history_pos = (engine->history_pos + len) % history_len;
+  engine->history_fill = min(engine->history_fill + len, history_len);
+}
+
+/* Copies samples to the active window and the history */
+static void feed (trigger_engine_t *engine, const int16_t *x, size_t len) {
+  trigger_capture_t *capture = engine->active;
+  if (capture != NULL) {
+    size_t window_len = capture->pre_trigger + engine->config.post_trigger;
+    size_t n = min(len, window_len - capture->len);
+    memcpy(&capture->samples[capture->len], x, n * sizeof(int16_t));
+    capture->len += n;
+    if (capture->len == window_len) {
+      engine->capture_done(capture, engine->arg);
+      engine->active = NULL;
+    }
+  }
+  history_push(engine, x, len);
+}
+
+static void start_capture (trigger_engine_t *engine, uint64_t trigger_index) {
+  engine->triggers++;
+  trigger_capture_t *capture = engine->get_capture(engine->arg);
+  if (capture == NULL) {
+    engine->missed++;
+    return;
+  }
+  /* History holds the samples right before the trigger, oldest at history_pos */
+  size_t pre = engine->history_fill;
+  size_t history_len = engine->config.pre_trigger;
+  size_t oldest = (engine->history_pos + history_len - pre) % (history_len ? history_len : 1);
+  size_t first = min(pre, history_len - oldest);
+  memcpy(capture->samples, &engine->history[oldest], first * sizeof(int16_t));
+  memcpy(&capture->samples[first], engine->history, (pre - first) * sizeof(int16_t));
+
+  capture->len = pre;
+  capture->pre_trigger = pre;
+  capture->trigger_index = trigger_index;
+  capture->number = engine->triggers;
+  capture->missed = engine->missed;
+  capture->truncated = false;
+  engine->missed = 0;
+  engine->active = capture;
+}
+
+void trigger_engine_process (trigger_engine_t *engine, const int16_t *x, size_t len) {
+  size_t pos = 0;
+  while (pos < len) {
+    uint64_t trigger_index;
+    size_t found = trigger_detect(&engine->detector, &x[pos], len - pos, &trigger_index);
+    feed(engine, &x[pos], found);
+    if (found == len - pos) break;
+    pos += found;
+    start_capture(engine, trigger_index);
+    /* Trigger sample is the first post trigger sample */
+    feed(engine, &x[pos], 1);
+    pos++;
+  }
+}
@@ -0,0 +1,134 @@
+/**
+ * @file trigger.h
+ *
+ * @brief Level trigger with hysteresis over a sample stream, and the capture
+ * engine that cuts pre/post trigger windows around each trigger.
+ *
+ * A falling trigger arms when a sample goes above level + hysteresis and fires
+ * on the first sample below level - hysteresis, a rising one the other way
+ * around. Same behaviour as findCross() in Software/trigger.py.
+ */
+#ifndef TRIGGER_H
+#define TRIGGER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef enum trigger_slope_t {
+  TRIGGER_FALLING = 0,
+  TRIGGER_RISING = 1
+} trigger_slope_t;
+
+typedef struct trigger_config_t {
+  int16_t level;
+  uint16_t hysteresis;
+  trigger_slope_t slope;
+  /** Samples kept before the trigger sample */
+  uint32_t pre_trigger;
+  /** Samples from the trigger sample on */
+  uint32_t post_trigger;
+  /** Samples after a trigger in which new crossings are ignored */
+  uint32_t holdoff;
+} trigger_config_t;
+
+typedef struct trigger_detector_t {
+  int16_t high;
+  int16_t low;
+  trigger_slope_t slope;
+  uint32_t holdoff;
+  bool initialized;
+  bool armed;
+  /** Index of the next sample */
+  uint64_t index;
+  uint64_t holdoff_end;
+} trigger_detector_t;
+
+/** One capture window, buffers are provided by the application */
+typedef struct trigger_capture_t {
+  int16_t *samples;
+  /** Samples in the window, up to pre_trigger + post_trigger */
+  size_t len;
+  uint64_t trigger_index;
+  /** Samples before the trigger, less than configured after a reset */
+  uint32_t pre_trigger;
+  /** Counter of triggers, including missed ones */
+  uint32_t number;
+  /** Triggers missed since the previous capture, no buffer was free */
+  uint32_t missed;
+  /** Ended early by a gap in the stream */
+  bool truncated;
+} trigger_capture_t;
+
+/** @brief Returns a free capture whose samples hold pre + post samples, NULL if none */
+typedef trigger_capture_t* (*trigger_get_capture_cb) (void *arg);
+/** @brief Called when a window is complete or truncated */
+typedef void (*trigger_capture_done_cb) (trigger_capture_t *capture, void *arg);
+
+typedef struct trigger_engine_t {
+  trigger_config_t config;
+  trigger_detector_t detector;
+  /** Circular copy of the last pre_trigger samples */
+  int16_t *history;
+  size_t history_pos;
+  size_t history_fill;
+  trigger_capture_t *active;
+  uint32_t triggers;
+  uint32_t missed;
+  trigger_get_capture_cb get_capture;
+  trigger_capture_done_cb capture_done;
+  void *arg;
+} trigger_engine_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+void trigger_detector_init (trigger_detector_t *detector, const trigger_config_t *config);
+
+/**
+ * @brief Restart detection, state is taken from the next sample
+ * @param next_index index of the next sample
+ */
+void trigger_detector_reset (trigger_detector_t *detector, uint64_t next_index);
+
+/**
+ * @brief Scans samples up to and including the next trigger
+ * @param trigger_index set to the index of the trigger sample, if found
+ * @return position of the trigger sample in x, len if there is none. Samples
+ * after it were not scanned and must be passed again.
+ */
+size_t trigger_detect (trigger_detector_t *detector, const int16_t *x, size_t len, uint64_t *trigger_index);
+
+/**
+ * @brief Indexes of all triggers in x
+ * @return number of triggers written to out, scanning stops when out is full
+ */
+size_t trigger_find_all (trigger_detector_t *detector, const int16_t *x, size_t len, uint64_t *out, size_t max_out);
+
+/**
+ * @brief Allocates the history. Holdoff is extended to post_trigger, a window
+ * must be complete before the next one starts.
+ */
+bool trigger_engine_init (
+  trigger_engine_t *engine, const trigger_config_t *config,
+  trigger_get_capture_cb get_capture, trigger_capture_done_cb capture_done, void *arg
+);
+
+void trigger_engine_free (trigger_engine_t *engine);
+
+/**
+ * @brief Restart after a gap, an active window is handed back truncated
+ * @param next_index index of the next sample
+ */
+void trigger_engine_reset (trigger_engine_t *engine, uint64_t next_index);
+
+/** @brief Feeds a block of consecutive samples */
+void trigger_engine_process (trigger_engine_t *engine, const int16_t *x, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,111 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "download_server.h"
+
+#define TAG "DOWNLOAD SERVER"
+
+/* A client that takes nothing for this long is given up */
+#define SEND_TIMEOUT_S (5)
+/* Time the client has to close its side after the last byte */
+#define LINGER_MS (1000)
+
+static int listen_socket = -1;
+static download_source_t source;
+static download_server_stats_t stats;
+
+static bool send_all (int socket, const uint8_t *data, size_t len) {
+  while (len > 0) {
+    int n = send(socket, data, len, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      ESP_LOGW(TAG, "Error occurred during sending: errno %d", errno);
+      return false;
+    }
+    data += n;
+    len -= n;
+    stats.bytes += n;
+  }
+  return true;
+}
+
+/* Closes the sending side and reads until the client leaves, closing with
+ * unread bytes would reset the connection under the last chunks */
+static void finish (int socket) {
+  shutdown(socket, SHUT_WR);
+  struct timeval timeout = { .tv_sec = 0, .tv_usec = LINGER_MS * 1000 };
+  setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  char discard[64];
+  while (recv(socket, discard, sizeof(discard), 0) > 0);
+  close(socket);
+}
+
+static void serve (int socket) {
+  static uint8_t chunk[DOWNLOAD_SERVER_CHUNK_LEN];
+  struct timeval timeout = { .tv_sec = SEND_TIMEOUT_S, .tv_usec = 0 };
+  setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  stats.downloads++;
+  int64_t start = esp_timer_get_time();
+  uint64_t bytes = stats.bytes;
+  source.rewind(source.ctx);
+  size_t len;
+  while ((len = source.read(source.ctx, chunk, sizeof(chunk))) > 0) {
+    if (!send_all(socket, chunk, len)) {
+      close(socket);
+      return;
+    }
+  }
+  int64_t duration = esp_timer_get_time() - start;
+  bytes = stats.bytes - bytes;
+  stats.completed++;
+  stats.last_rate = duration > 0 ? (uint32_t) (bytes * 1000000 / duration) : 0;
+  ESP_LOGI(TAG, "Download of %llu bytes in %lld ms", (unsigned long long) bytes, (long long) (duration / 1000));
+  finish(socket);
+}
+
+static void download_server_task () {
+  while (1) {
+    int socket = accept(listen_socket, NULL, NULL);
+    if (socket < 0) {
+      ESP_LOGE(TAG, "Unable to accept connection: errno %d", errno);
+      vTaskDelay(pdMS_TO_TICKS(100));
+      continue;
+    }
+    serve(socket);
+  }
+}
+
+bool download_server_init (const download_source_t *src) {
+  source = *src;
+  listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+  if (listen_socket < 0) {
+    ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+    return false;
+  }
+  int reuse = 1;
+  setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  struct sockaddr_in addr = {
+    .sin_family = AF_INET,
+    .sin_port = htons(DOWNLOAD_SERVER_PORT),
+    .sin_addr.s_addr = htonl(INADDR_ANY)
+  };
+  if (bind(listen_socket, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(listen_socket, 1) != 0) {
+    ESP_LOGE(TAG, "Unable to listen on port %d: errno %d", DOWNLOAD_SERVER_PORT, errno);
+    close(listen_socket);
+    listen_socket = -1;
+    return false;
+  }
+  ESP_LOGI(TAG, "Listening on port %d", DOWNLOAD_SERVER_PORT);
+  xTaskCreatePinnedToCore(download_server_task, "download_server", 4096, NULL, 4, NULL, 0);
+  return true;
+}
+
+void download_server_get_stats (download_server_stats_t *out) {
+  *out = stats;
+}
@@ -0,0 +1,48 @@
+/**
+ * @file download_server.h
+ *
+ * @brief Port for bulk downloads, the recording kept in flash. A client that
+ * connects gets everything the source has, from its oldest byte, as fast as
+ * the link takes it, then the server closes the connection. The bytes are
+ * whole stream frames, read with the same decoder as the data port.
+ *
+ * No handshake, what the client writes is discarded. One client at a time,
+ * the next waits in the listen backlog.
+ */
+#ifndef DOWNLOAD_SERVER_H
+#define DOWNLOAD_SERVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define DOWNLOAD_SERVER_PORT (3336)
+
+/* Bytes read from the source per send() */
+#ifndef DOWNLOAD_SERVER_CHUNK_LEN
+#define DOWNLOAD_SERVER_CHUNK_LEN (8 * 1024)
+#endif
+
+typedef struct download_source_t {
+  /** Called when a client connects, the next read starts from the oldest byte */
+  void (*rewind) (void *ctx);
+  /** Copies up to len bytes, whole frames, 0 once everything was read */
+  size_t (*read) (void *ctx, uint8_t *dst, size_t len);
+  void *ctx;
+} download_source_t;
+
+typedef struct download_server_stats_t {
+  /** Downloads started and sent to the end */
+  uint32_t downloads;
+  uint32_t completed;
+  uint64_t bytes;
+  /** Rate of the last completed download, bytes per second */
+  uint32_t last_rate;
+} download_server_stats_t;
+
+/** @brief Opens the port and starts the task serving the downloads */
+bool download_server_init (const download_source_t *source);
+
+void download_server_get_stats (download_server_stats_t *stats);
+
+#endif
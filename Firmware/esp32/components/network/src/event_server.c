@@ -0,0 +1,160 @@
+#include <fcntl.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "lwip/sockets.h"
+#include "esp_log.h"
+
+#include "event_server.h"
+
+#define TAG "EVENT SERVER"
+
+/* Server task wakes up this often to close the clients the sender dropped */
+#define POLL_PERIOD_MS (100)
+/* DSCP expedited forwarding */
+#define EVENT_TOS (0xB8)
+
+static int listen_socket = -1;
+/* Client sockets, -1 for a free slot. The lock is held to change them and for
+ * the duration of a send, the sender drops stalled clients itself */
+static int sockets[EVENT_SERVER_MAX_CLIENTS];
+static SemaphoreHandle_t lock;
+static event_server_stats_t stats;
+
+static void close_client (int i) {
+  close(sockets[i]);
+  sockets[i] = -1;
+  stats.clients--;
+  ESP_LOGI(TAG, "Client %d disconnected", i);
+}
+
+static void accept_client () {
+  int socket = accept(listen_socket, NULL, NULL);
+  if (socket < 0) {
+    ESP_LOGE(TAG, "Unable to accept connection: errno %d", errno);
+    return;
+  }
+  int no_delay = 1;
+  setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+  int tos = EVENT_TOS;
+  setsockopt(socket, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+  fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK);
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  int slot = -1;
+  for (int i = 0; i < EVENT_SERVER_MAX_CLIENTS && slot < 0; i++) {
+    if (sockets[i] < 0) slot = i;
+  }
+  if (slot >= 0) {
+    sockets[slot] = socket;
+    stats.clients++;
+  }
+  xSemaphoreGive(lock);
+
+  if (slot < 0) {
+    ESP_LOGW(TAG, "Refused client, %d connected", EVENT_SERVER_MAX_CLIENTS);
+    close(socket);
+    return;
+  }
+  ESP_LOGI(TAG, "Client %d connected", slot);
+}
+
+/* Clients only write to leave, whatever they send is discarded. Called with the lock */
+static void read_client (int i) {
+  char rx_buffer[64];
+  int len = recv(sockets[i], rx_buffer, sizeof(rx_buffer), 0);
+  if (len == 0 || (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) close_client(i);
+}
+
+static void event_server_task () {
+  int fds[EVENT_SERVER_MAX_CLIENTS];
+  while (1) {
+    fd_set read_set;
+    FD_ZERO(&read_set);
+    FD_SET(listen_socket, &read_set);
+    int max_fd = listen_socket;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (int i = 0; i < EVENT_SERVER_MAX_CLIENTS; i++) {
+      fds[i] = sockets[i];
+      if (fds[i] < 0) continue;
+      FD_SET(fds[i], &read_set);
+      if (fds[i] > max_fd) max_fd = fds[i];
+    }
+    xSemaphoreGive(lock);
+
+    struct timeval timeout = { .tv_sec = 0, .tv_usec = POLL_PERIOD_MS * 1000 };
+    int ready = select(max_fd + 1, &read_set, NULL, NULL, &timeout);
+    if (ready < 0) {
+      if (errno != EINTR) {
+        ESP_LOGE(TAG, "Error occurred during select: errno %d", errno);
+        vTaskDelay(pdMS_TO_TICKS(POLL_PERIOD_MS));
+      }
+      continue;
+    }
+    if (ready == 0) continue;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (int i = 0; i < EVENT_SERVER_MAX_CLIENTS; i++) {
+      /* The sender may have dropped it meanwhile */
+      if (fds[i] >= 0 && sockets[i] == fds[i] && FD_ISSET(fds[i], &read_set)) read_client(i);
+    }
+    xSemaphoreGive(lock);
+    if (FD_ISSET(listen_socket, &read_set)) accept_client();
+  }
+}
+
+bool event_server_init () {
+  for (int i = 0; i < EVENT_SERVER_MAX_CLIENTS; i++) sockets[i] = -1;
+  lock = xSemaphoreCreateMutex();
+
+  listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+  if (listen_socket < 0) {
+    ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+    return false;
+  }
+  int reuse = 1;
+  setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  struct sockaddr_in addr = {
+    .sin_family = AF_INET,
+    .sin_port = htons(EVENT_SERVER_PORT),
+    .sin_addr.s_addr = htonl(INADDR_ANY)
+  };
+  if (bind(listen_socket, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(listen_socket, EVENT_SERVER_MAX_CLIENTS) != 0) {
+    ESP_LOGE(TAG, "Unable to listen on port %d: errno %d", EVENT_SERVER_PORT, errno);
+    close(listen_socket);
+    listen_socket = -1;
+    return false;
+  }
+  ESP_LOGI(TAG, "Listening on port %d", EVENT_SERVER_PORT);
+  xTaskCreatePinnedToCore(event_server_task, "event_server", 3072, NULL, 5, NULL, 0);
+  return true;
+}
+
+size_t event_server_send (const uint8_t *frame, size_t len) {
+  if (listen_socket < 0) return 0;
+  size_t sent = 0;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  for (int i = 0; i < EVENT_SERVER_MAX_CLIENTS; i++) {
+    if (sockets[i] < 0) continue;
+    /* A partial frame would desynchronize the client, it has to reconnect */
+    if (send(sockets[i], frame, len, MSG_DONTWAIT) != (ssize_t) len) {
+      ESP_LOGW(TAG, "Client %d stalled, dropped", i);
+      stats.stalled++;
+      close_client(i);
+      continue;
+    }
+    sent++;
+  }
+  stats.events++;
+  stats.deliveries += sent;
+  xSemaphoreGive(lock);
+  return sent;
+}
+
+void event_server_get_stats (event_server_stats_t *out) {
+  xSemaphoreTake(lock, portMAX_DELAY);
+  *out = stats;
+  xSemaphoreGive(lock);
+}
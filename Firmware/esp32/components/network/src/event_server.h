@@ -0,0 +1,46 @@
+/**
+ * @file event_server.h
+ *
+ * @brief Port for urgent events, the input alarm frames. Separate from the
+ * data port so an event never waits behind coalesced stream blocks or a
+ * full send buffer: each frame is handed to the socket as soon as it is
+ * built, with Nagle off and the expedited forwarding DSCP, which WiFi WMM
+ * sends in the voice access category.
+ *
+ * No handshake, clients connect and read. A client whose send buffer is full
+ * is dropped rather than waited for.
+ */
+#ifndef EVENT_SERVER_H
+#define EVENT_SERVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define EVENT_SERVER_PORT (3335)
+
+#ifndef EVENT_SERVER_MAX_CLIENTS
+#define EVENT_SERVER_MAX_CLIENTS (2)
+#endif
+
+typedef struct event_server_stats_t {
+  uint32_t clients;
+  /** Frames sent and clients they reached */
+  uint32_t events;
+  uint32_t deliveries;
+  /** Clients dropped because a frame did not fit their send buffer */
+  uint32_t stalled;
+} event_server_stats_t;
+
+/** @brief Opens the port and starts the task accepting clients */
+bool event_server_init ();
+
+/**
+ * @brief Sends a frame to every client right away, from the calling task
+ * @returns number of clients it was handed to
+ */
+size_t event_server_send (const uint8_t *frame, size_t len);
+
+void event_server_get_stats (event_server_stats_t *stats);
+
+#endif
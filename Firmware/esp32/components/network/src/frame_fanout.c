@@ -0,0 +1,92 @@
+#include <string.h>
+
+#include "frame_fanout.h"
+
+/* Length of a record that does not fit before the end of the buffer */
+#define WRAP_MARKER (0xFFFFFFFFu)
+
+static inline size_t record_len (size_t frame_len) {
+  return sizeof(uint32_t) + ((frame_len + 3) & ~(size_t) 3);
+}
+
+/* Bytes the producer may be writing past the published head, a wrap plus a record */
+static inline size_t write_margin (const frame_fanout_t *fanout) {
+  return 2 * record_len(fanout->max_frame);
+}
+
+bool frame_fanout_init (frame_fanout_t *fanout, uint8_t *buf, size_t len, size_t max_frame) {
+  if (len == 0 || (len & (len - 1)) != 0 || len < 4 * record_len(max_frame)) return false;
+  fanout->buf = buf;
+  fanout->len = len;
+  fanout->max_frame = max_frame;
+  atomic_init(&fanout->head, 0);
+  return true;
+}
+
+bool frame_fanout_publish (frame_fanout_t *fanout, const void *head, size_t head_len, const void *body, size_t body_len) {
+  size_t frame_len = head_len + body_len;
+  if (frame_len > fanout->max_frame) return false;
+  uint32_t h = atomic_load_explicit(&fanout->head, memory_order_relaxed);
+  size_t at = h & (fanout->len - 1);
+  size_t rec = record_len(frame_len);
+  if (at + rec > fanout->len) {
+    /* Records are 4 byte aligned, there is always room for the marker */
+    uint32_t marker = WRAP_MARKER;
+    memcpy(&fanout->buf[at], &marker, sizeof(marker));
+    h += fanout->len - at;
+    at = 0;
+  }
+  uint32_t len32 = frame_len;
+  memcpy(&fanout->buf[at], &len32, sizeof(len32));
+  memcpy(&fanout->buf[at + sizeof(len32)], head, head_len);
+  if (body_len > 0) memcpy(&fanout->buf[at + sizeof(len32) + head_len], body, body_len);
+  atomic_store_explicit(&fanout->head, h + rec, memory_order_release);
+  return true;
+}
+
+void frame_fanout_cursor_init (frame_fanout_t *fanout, fanout_cursor_t *cursor) {
+  cursor->pos = atomic_load_explicit(&fanout->head, memory_order_acquire);
+  cursor->skips = 0;
+  cursor->skipped_bytes = 0;
+}
+
+/* Reader fell too far behind, continues from the newest frame */
+static void skip_to (fanout_cursor_t *cursor, uint32_t head) {
+  cursor->skips++;
+  cursor->skipped_bytes += (uint32_t) (head - cursor->pos);
+  cursor->pos = head;
+}
+
+size_t frame_fanout_read (frame_fanout_t *fanout, fanout_cursor_t *cursor, uint8_t *dst) {
+  while (1) {
+    uint32_t head = atomic_load_explicit(&fanout->head, memory_order_acquire);
+    if (head == cursor->pos) return 0;
+    if ((uint32_t) (head - cursor->pos) + write_margin(fanout) > fanout->len) {
+      skip_to(cursor, head);
+      return 0;
+    }
+    size_t at = cursor->pos & (fanout->len - 1);
+    uint32_t frame_len;
+    memcpy(&frame_len, &fanout->buf[at], sizeof(frame_len));
+    bool wrap = frame_len == WRAP_MARKER;
+    if (!wrap && frame_len <= fanout->max_frame) memcpy(dst, &fanout->buf[at + sizeof(frame_len)], frame_len);
+
+    /* Whatever was copied is only valid if the producer did not reach it meanwhile */
+    atomic_thread_fence(memory_order_acquire);
+    head = atomic_load_explicit(&fanout->head, memory_order_relaxed);
+    if ((uint32_t) (head - cursor->pos) + write_margin(fanout) > fanout->len || (!wrap && frame_len > fanout->max_frame)) {
+      skip_to(cursor, head);
+      return 0;
+    }
+    if (wrap) {
+      cursor->pos += fanout->len - at;
+      continue;
+    }
+    cursor->pos += record_len(frame_len);
+    return frame_len;
+  }
+}
+
+uint32_t frame_fanout_pending (frame_fanout_t *fanout, const fanout_cursor_t *cursor) {
+  return atomic_load_explicit(&fanout->head, memory_order_acquire) - cursor->pos;
+}
@@ -0,0 +1,63 @@
+/**
+ * @file frame_fanout.h
+ *
+ * @brief Lock-free single producer / many readers ring of stream frames. The
+ * producer never waits for a reader: each reader has its own cursor and a
+ * reader lapped by the producer skips to the newest frame, counting what it
+ * missed. Frames are copied out whole and checked afterwards, so a reader
+ * never sends a frame the producer was overwriting.
+ *
+ * Each frame is stored contiguous as a uint32 length and the frame bytes,
+ * padded to 4 bytes. A frame that would cross the end of the buffer starts
+ * over at the beginning after a wrap marker.
+ */
+#ifndef FRAME_FANOUT_H
+#define FRAME_FANOUT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+typedef struct frame_fanout_t {
+  uint8_t *buf;
+  size_t len;
+  /** Longest frame accepted */
+  size_t max_frame;
+  /** Bytes ever written, wraps at 2^32. Written only by the producer */
+  atomic_uint_least32_t head;
+} frame_fanout_t;
+
+typedef struct fanout_cursor_t {
+  uint32_t pos;
+  /** Times the reader was lapped and skipped to the newest frame */
+  uint32_t skips;
+  uint64_t skipped_bytes;
+} fanout_cursor_t;
+
+/**
+ * @brief Initialize ring over a caller provided buffer
+ * @param len buffer length in bytes, a power of two at least 4 times the
+ * stored length of the longest frame
+ */
+bool frame_fanout_init (frame_fanout_t *fanout, uint8_t *buf, size_t len, size_t max_frame);
+
+/**
+ * @brief Producer side, appends the frame made of head then body
+ * @return false if the frame is longer than max_frame
+ */
+bool frame_fanout_publish (frame_fanout_t *fanout, const void *head, size_t head_len, const void *body, size_t body_len);
+
+/** @brief Places a cursor after the last published frame */
+void frame_fanout_cursor_init (frame_fanout_t *fanout, fanout_cursor_t *cursor);
+
+/**
+ * @brief Reader side, copies the frame at the cursor into dst, dst must hold max_frame bytes
+ * @return frame length, 0 if the reader is up to date
+ */
+size_t frame_fanout_read (frame_fanout_t *fanout, fanout_cursor_t *cursor, uint8_t *dst);
+
+/** @brief Bytes published after the cursor */
+uint32_t frame_fanout_pending (frame_fanout_t *fanout, const fanout_cursor_t *cursor);
+
+#endif
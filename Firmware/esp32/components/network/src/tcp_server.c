@@ -1,40 +1,109 @@
 #include <lwip/netdb.h>
+#include <fcntl.h>
+#include <stdatomic.h>
 #include <string.h>
 #include <sys/param.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/queue.h"
 #include "lwip/err.h"
 #include "lwip/sockets.h"
 #include "lwip/sys.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
+#include "frame_fanout.h"
 #include "tcp_server.h"
 
 #define TAG "TCP SERVER"
 
 #define PORT 3333
+/* Time a new client has to send the connection request */
+#define HANDSHAKE_TIMEOUT_S (1)
+/* Server and client tasks also wake up this often to handle disconnections */
+#define POLL_PERIOD_MS (100)
 
-static TaskHandle_t tcp_server_task_handle;
-static QueueHandle_t tcp_server_queue;
+#ifndef CONFIG_LWIP_TCP_SND_BUF_DEFAULT
+#define CONFIG_LWIP_TCP_SND_BUF_DEFAULT (5744)
+#endif
+/* Largest send block, the whole segments that fit in an empty send buffer */
+#define BLOCK_MAX_LEN (CONFIG_LWIP_TCP_SND_BUF_DEFAULT / STREAM_FRAME_MSS * STREAM_FRAME_MSS)
+#define BLOCK_MIN_LEN (STREAM_FRAME_MSS)
+/* Transports reading the frames besides the TCP clients */
+#define MAX_TRANSPORTS (2)
+/* Half octave bins of send durations, up to about 1 s */
+#define SEND_BINS (40)
 
-static bool client_connected = false;
-static struct sockaddr_in6 client_addr;  // Large enough for both IPv4 or IPv6
+typedef enum client_state_t {
+  CLIENT_FREE,
+  CLIENT_ACTIVE,
+  /* Server task asked the client task to stop using the socket */
+  CLIENT_CLOSING,
+  /* Client task stopped, the server task closes the socket */
+  CLIENT_CLOSED
+} client_state_t;
+
+/* Durations of the sends of one client task, kept across its connections */
+typedef struct send_hist_t {
+  uint32_t count[SEND_BINS];
+  uint32_t max_us;
+  uint32_t reset_seen;
+} send_hist_t;
+
+typedef struct tcp_client_t {
+  atomic_int state;
+  int socket;
+  int id;
+  TaskHandle_t task;
+  fanout_cursor_t cursor;
+  volatile bool send_failed;
+  /* Written by the client task */
+  tcp_client_stats_t stats;
+  send_hist_t send_hist;
+  /* Frames coalesced for the next send, the last one may overshoot the target */
+  size_t fill;
+  size_t block_target;
+  int64_t block_deadline;
+  uint8_t block[BLOCK_MAX_LEN + STREAM_FRAME_MAX_LEN];
+} tcp_client_t;
+
+_Static_assert(TCP_SERVER_MAX_CLIENTS <= PIPELINE_STAGE_MAX_TASKS, "a client task per client in the transmit stage");
+
+static tcp_client_t clients[TCP_SERVER_MAX_CLIENTS];
+static pipeline_stage_t client_stage;
+static frame_fanout_t fanout;
+static uint8_t fanout_buf[TCP_SERVER_FANOUT_LEN];
 
 static int listen_socket;
 
+typedef struct transport_t {
+  TaskHandle_t task;
+  bool (*has_peers) ();
+} transport_t;
+
+static transport_t transports[MAX_TRANSPORTS];
+/* Published after the entry, transports are added while the stream runs */
+static atomic_size_t n_transports = 0;
+
+/* Readers ask the client tasks to clear their send durations */
+static volatile uint32_t send_reset_request = 0;
+
+static void_callback connect_cb = NULL;
+static tcp_command_callback command_cb = NULL;
+
 static void get_ip_string (struct sockaddr_in6 *addr, char *addr_string) {
   // Get the sender's ip address as string
   if (addr->sin6_family == PF_INET) {
     inet_ntoa_r(((struct sockaddr_in *)addr)->sin_addr.s_addr, addr_string, 128 - 1);
   } else if (addr->sin6_family == PF_INET6) {
     inet6_ntoa_r(addr->sin6_addr, addr_string, 128 - 1);
+  } else {
+    addr_string[0] = 0;
   }
 }
 
 static bool accept_connection (const int socket) {
-  size_t len;
+  int len;
   char rx_buffer[128];
 
   len = recv(socket, rx_buffer, sizeof(rx_buffer) - 1, 0);
@@ -45,26 +114,249 @@ static bool accept_connection (const int socket) {
     ESP_LOGW(TAG, "Connection closed");
     return false;
   } else {
+    rx_buffer[len] = 0;
     printf("%s\n", rx_buffer);
     return (strcmp("connection_request", rx_buffer) == 0)? true : false;
   }
 }
 
-static void clean_up (int socket) {
-  close(socket);
+/* Waits until the socket takes more data or the poll period elapsed */
+static void wait_writable (int socket) {
+  fd_set write_set;
+  FD_ZERO(&write_set);
+  FD_SET(socket, &write_set);
+  struct timeval timeout = { .tv_sec = 0, .tv_usec = POLL_PERIOD_MS * 1000 };
+  select(socket + 1, NULL, &write_set, NULL, &timeout);
 }
 
-static int tcp_socket;
+/* A send that took less than offered measured the free send buffer, the
+ * target follows it. A block taken whole at once lets the target grow. */
+static void adapt_block (tcp_client_t *client, size_t accepted, size_t offered) {
+  size_t target = client->block_target;
+  if (accepted == offered) {
+    if (target + STREAM_FRAME_MSS <= BLOCK_MAX_LEN) target += STREAM_FRAME_MSS;
+  } else {
+    target = accepted / STREAM_FRAME_MSS * STREAM_FRAME_MSS;
+    if (target < BLOCK_MIN_LEN) target = BLOCK_MIN_LEN;
+  }
+  client->block_target = target;
+  client->stats.block_len = target;
+}
 
-static void_callback connect_cb = NULL;
+/* Half octave bin: 0 and 1 for 0 and 1 us, then two bins per power of two */
+static uint32_t send_bin (uint32_t us) {
+  if (us < 2) return us;
+  uint32_t b = 31 - __builtin_clz(us);
+  uint32_t bin = 2 * b + ((us >> (b - 1)) & 1);
+  return bin < SEND_BINS ? bin : SEND_BINS - 1;
+}
 
-static void tcp_server_task () {
-  char rx_buffer[128];
+static uint32_t send_bin_upper (uint32_t bin) {
+  if (bin < 2) return bin + 1;
+  uint32_t base = 1u << (bin / 2);
+  return (bin & 1) ? 2 * base : base + base / 2;
+}
+
+static void record_send (tcp_client_t *client, uint32_t duration) {
+  send_hist_t *hist = &client->send_hist;
+  if (hist->reset_seen != send_reset_request) {
+    memset(hist->count, 0, sizeof(hist->count));
+    hist->max_us = 0;
+    hist->reset_seen = send_reset_request;
+  }
+  hist->count[send_bin(duration)]++;
+  if (duration > hist->max_us) hist->max_us = duration;
+  if (duration > client->stats.send_max_us) client->stats.send_max_us = duration;
+}
+
+/* Hands the first len bytes of the block to the socket, keeps the rest for the next block */
+static bool send_block (tcp_client_t *client, size_t len) {
+  int64_t start = esp_timer_get_time();
+  size_t sent = 0;
+  bool measured = false;
+  while (sent < len) {
+    if (atomic_load(&client->state) != CLIENT_ACTIVE) return false;
+    int n = send(client->socket, &client->block[sent], len - sent, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
+        return false;
+      }
+      client->stats.would_block++;
+      wait_writable(client->socket);
+      continue;
+    }
+    /* First partial send after the buffer filled up is the free space */
+    if (!measured && (sent == 0 || n < (int) (len - sent))) {
+      adapt_block(client, n, len - sent);
+      measured = true;
+    }
+    sent += n;
+  }
+  client->fill -= len;
+  if (client->fill > 0) memmove(client->block, &client->block[len], client->fill);
+  client->stats.blocks++;
+  client->stats.bytes += len;
+  record_send(client, esp_timer_get_time() - start);
+  return true;
+}
+
+/* Appends the frames after the cursor to the block, up to the target */
+static void fill_block (tcp_client_t *client) {
+  while (client->fill < client->block_target) {
+    size_t len = frame_fanout_read(&fanout, &client->cursor, &client->block[client->fill]);
+    if (len == 0) break;
+    int64_t now = esp_timer_get_time();
+    if (client->fill == 0) client->block_deadline = now + TCP_SERVER_COALESCE_US;
+    /* A clock offset answer is not held back, its transmit time is when it leaves */
+    if (stream_frame_stamp_transmit(&client->block[client->fill], len, now)) client->block_deadline = now;
+    client->fill += len;
+    client->stats.frames++;
+  }
+  client->stats.skips = client->cursor.skips;
+  client->stats.skipped_bytes = client->cursor.skipped_bytes;
+}
+
+/**
+ * Sends the frames after the client cursor, a slow client only delays itself.
+ * Frames are coalesced until the block target or the deadline of the first
+ * one, then whole segments are sent and the tail waits for the next block,
+ * all of it at the deadline, which a time frame brings forward to now. The
+ * socket is non-blocking, the task sleeps on its notification or the socket
+ * writability and never spins.
+ */
+static void client_task (void *arg) {
+  tcp_client_t *client = (tcp_client_t*) arg;
+  while (1) {
+    TickType_t wait = pdMS_TO_TICKS(POLL_PERIOD_MS);
+    if (client->fill > 0) {
+      int64_t left = client->block_deadline - esp_timer_get_time();
+      wait = left > 0 ? pdMS_TO_TICKS((left + 999) / 1000) : 0;
+      /* Deadline closer than a tick */
+      if (left > 0 && wait == 0) wait = 1;
+    }
+    if (wait > 0) ulTaskNotifyTake(pdTRUE, wait);
+    int state = atomic_load(&client->state);
+    if (state == CLIENT_CLOSING) {
+      atomic_store(&client->state, CLIENT_CLOSED);
+      continue;
+    }
+    if (state != CLIENT_ACTIVE || client->send_failed) {
+      client->fill = 0;
+      continue;
+    }
+
+    while (atomic_load(&client->state) == CLIENT_ACTIVE) {
+      fill_block(client);
+      size_t len;
+      if (client->fill > 0 && esp_timer_get_time() >= client->block_deadline) {
+        len = client->fill;
+      } else if (client->fill >= client->block_target) {
+        len = client->fill / STREAM_FRAME_MSS * STREAM_FRAME_MSS;
+      } else {
+        break;
+      }
+      if (!send_block(client, len)) {
+        /* Wakes the server task reading the client, it then closes the connection */
+        client->send_failed = true;
+        client->fill = 0;
+        shutdown(client->socket, SHUT_RD);
+        break;
+      }
+      if (client->fill > 0) client->block_deadline = esp_timer_get_time() + TCP_SERVER_COALESCE_US;
+    }
+  }
+}
+
+static void accept_client () {
   char addr_str[128];
+  struct sockaddr_in6 source_addr; // Large enough for both IPv4 or IPv6
+  socklen_t addr_len = sizeof(source_addr);
+  int socket = accept(listen_socket, (struct sockaddr *)&source_addr, &addr_len);
+  if (socket < 0) {
+    ESP_LOGE(TAG, "Unable to accept connection: errno %d", errno);
+    return;
+  }
+  get_ip_string(&source_addr, addr_str);
+
+  tcp_client_t *client = NULL;
+  for (int i = 0; i < TCP_SERVER_MAX_CLIENTS && client == NULL; i++) {
+    if (atomic_load(&clients[i].state) == CLIENT_FREE) client = &clients[i];
+  }
+  if (client == NULL) {
+    ESP_LOGW(TAG, "Refused %s, %d clients connected", addr_str, TCP_SERVER_MAX_CLIENTS);
+    close(socket);
+    return;
+  }
+
+  /* Other clients are served by this task, a silent one cannot hold it */
+  struct timeval timeout = { .tv_sec = HANDSHAKE_TIMEOUT_S, .tv_usec = 0 };
+  setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  if (!accept_connection(socket)) {
+    close(socket);
+    return;
+  }
+
+  /* Client tasks wait on select, commands are only read once select reports them */
+  fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK);
+  /* Blocks are already whole segments, the tail leaves at its deadline not at the next ACK */
+  int no_delay = 1;
+  setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+  client->socket = socket;
+  client->send_failed = false;
+  memset(&client->stats, 0, sizeof(client->stats));
+  client->fill = 0;
+  client->block_target = BLOCK_MIN_LEN;
+  client->stats.block_len = BLOCK_MIN_LEN;
+  /* New clients start from the next frame */
+  frame_fanout_cursor_init(&fanout, &client->cursor);
+  atomic_store(&client->state, CLIENT_ACTIVE);
+  ESP_LOGI(TAG, "Client %d connected from %s", client->id, addr_str);
+  if (connect_cb != NULL) connect_cb();
+}
+
+/* Reads one command, false once the client left or its task failed to send */
+static bool read_command (tcp_client_t *client) {
+  char rx_buffer[128];
+  int len = recv(client->socket, rx_buffer, sizeof(rx_buffer) - 1, 0);
+  if (len <= 0 || client->send_failed) return false;
+  rx_buffer[len] = 0;
+  /* Line endings and the terminator some clients send */
+  while (len > 0 && (rx_buffer[len - 1] == '\n' || rx_buffer[len - 1] == '\r' || rx_buffer[len - 1] == 0)) {
+    rx_buffer[--len] = 0;
+  }
+  ESP_LOGI(TAG, "Command from client %d: %s", client->id, rx_buffer);
+  if (command_cb != NULL) command_cb(rx_buffer);
+  return true;
+}
+
+static void drop_client (tcp_client_t *client) {
+  atomic_store(&client->state, CLIENT_CLOSING);
+  /* Unblocks a send in progress */
+  shutdown(client->socket, SHUT_RDWR);
+  xTaskNotifyGive(client->task);
+}
+
+/* Only this task closes client sockets, once their task no longer uses them */
+static void close_stopped_clients () {
+  for (int i = 0; i < TCP_SERVER_MAX_CLIENTS; i++) {
+    tcp_client_t *client = &clients[i];
+    if (atomic_load(&client->state) != CLIENT_CLOSED) continue;
+    close(client->socket);
+    ESP_LOGI(
+      TAG, "Client %d disconnected, %u frames, %u skips (%llu bytes)",
+      client->id, client->stats.frames, client->stats.skips, (unsigned long long) client->stats.skipped_bytes
+    );
+    atomic_store(&client->state, CLIENT_FREE);
+  }
+}
+
+static void tcp_server_task () {
   int addr_family = AF_INET;
   int ip_protocol = 0;
   struct sockaddr_in6 dest_addr;
-  static struct sockaddr_in6 recv_addr;
 
   struct sockaddr_in *dest_addr_ip4 = (struct sockaddr_in *)&dest_addr;
   dest_addr_ip4->sin_addr.s_addr = htonl(INADDR_ANY);
@@ -79,6 +371,9 @@ static void tcp_server_task () {
     return;
   }
   ESP_LOGI(TAG, "Socket created");
+  /* Connections just closed by the server do not hold the port on restart */
+  int reuse = 1;
+  setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 
   int err = bind(listen_socket, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
   if (err < 0) {
@@ -86,65 +381,175 @@ static void tcp_server_task () {
   }
   ESP_LOGI(TAG, "Socket bound, port %d", PORT);
 
-  /* Socket listen loop */
+  err = listen(listen_socket, TCP_SERVER_MAX_CLIENTS);
+  if (err != 0) {
+    ESP_LOGE(TAG, "Error occurred during listen: errno %d", errno);
+    close(listen_socket);
+    vTaskDelete(NULL);
+    return;
+  }
+  ESP_LOGI(TAG, "Listen started, up to %d clients", TCP_SERVER_MAX_CLIENTS);
+
+  /* New connections and commands of every client */
   while (1) {
-    err = listen(listen_socket, 1);
-    if (err != 0) {
-        ESP_LOGE(TAG, "Error occurred during listen: errno %d", errno);
-        clean_up(listen_socket);
-        break;
+    close_stopped_clients();
+
+    fd_set read_set;
+    FD_ZERO(&read_set);
+    FD_SET(listen_socket, &read_set);
+    int max_fd = listen_socket;
+    for (int i = 0; i < TCP_SERVER_MAX_CLIENTS; i++) {
+      if (atomic_load(&clients[i].state) != CLIENT_ACTIVE) continue;
+      FD_SET(clients[i].socket, &read_set);
+      if (clients[i].socket > max_fd) max_fd = clients[i].socket;
     }
-    ESP_LOGI(TAG, "Listen started");
-
-    struct sockaddr_in6 source_addr; // Large enough for both IPv4 or IPv6
-    uint addr_len = sizeof(source_addr);
-    tcp_socket = accept(listen_socket, (struct sockaddr *)&source_addr, &addr_len);
-    if (tcp_socket < 0) {
-        ESP_LOGE(TAG, "Unable to accept connection: errno %d", errno);
-        // break;
+    struct timeval timeout = { .tv_sec = 0, .tv_usec = POLL_PERIOD_MS * 1000 };
+    int ready = select(max_fd + 1, &read_set, NULL, NULL, &timeout);
+    if (ready < 0) {
+      if (errno != EINTR) {
+        ESP_LOGE(TAG, "Error occurred during select: errno %d", errno);
+        vTaskDelay(pdMS_TO_TICKS(POLL_PERIOD_MS));
+      }
+      continue;
     }
+    if (ready == 0) continue;
 
-    get_ip_string(&recv_addr, addr_str);
+    for (int i = 0; i < TCP_SERVER_MAX_CLIENTS; i++) {
+      tcp_client_t *client = &clients[i];
+      if (atomic_load(&client->state) != CLIENT_ACTIVE || !FD_ISSET(client->socket, &read_set)) continue;
+      if (!read_command(client)) drop_client(client);
+    }
+    if (FD_ISSET(listen_socket, &read_set)) accept_client();
+  }
+}
 
-    if (!accept_connection(tcp_socket)) continue;
+void tcp_server_init (void_callback on_connect_cb, const pipeline_stage_config_t *stage) {
+  static const pipeline_stage_config_t default_stage = TCP_SERVER_DEFAULT_STAGE();
+  connect_cb = on_connect_cb;
+  frame_fanout_init(&fanout, fanout_buf, sizeof(fanout_buf), STREAM_FRAME_MAX_LEN);
+  pipeline_stage_init(&client_stage, stage != NULL ? stage : &default_stage);
+  for (int i = 0; i < TCP_SERVER_MAX_CLIENTS; i++) {
+    clients[i].id = i;
+    atomic_init(&clients[i].state, CLIENT_FREE);
+    pipeline_stage_spawn(&client_stage, client_task, &clients[i], &clients[i].task);
+  }
+  xTaskCreatePinnedToCore(tcp_server_task, "tcp_server", 4096, NULL, 5, NULL, 0);
+}
 
-    ESP_LOGI(TAG, "Broadcast started");
-    client_connected = true;
-    if (connect_cb != NULL) connect_cb();
+void tcp_server_set_command_cb (tcp_command_callback cb) {
+  command_cb = cb;
+}
 
-    vTaskSuspend(tcp_server_task_handle);
+bool tcp_server_connected () {
+  for (int i = 0; i < TCP_SERVER_MAX_CLIENTS; i++) {
+    if (atomic_load(&clients[i].state) == CLIENT_ACTIVE) return true;
+  }
+  size_t n = atomic_load_explicit(&n_transports, memory_order_acquire);
+  for (size_t i = 0; i < n; i++) {
+    if (transports[i].has_peers()) return true;
+  }
+  return false;
+}
 
-    client_connected = false;
+static void notify_clients () {
+  for (int i = 0; i < TCP_SERVER_MAX_CLIENTS; i++) {
+    if (atomic_load(&clients[i].state) == CLIENT_ACTIVE) xTaskNotifyGive(clients[i].task);
   }
-  close(listen_socket);
-  vTaskDelete(NULL);
+  size_t n = atomic_load_explicit(&n_transports, memory_order_acquire);
+  for (size_t i = 0; i < n; i++) xTaskNotifyGive(transports[i].task);
 }
 
-void tcp_server_init (void_callback on_connect_cb) {
-  connect_cb = on_connect_cb;
-  tcp_server_queue = xQueueCreate(10, sizeof(broadcast_message_t));
-  xTaskCreatePinnedToCore(tcp_server_task, "tcp_server", 4096, NULL, 5, &tcp_server_task_handle, 0);
+bool tcp_server_add_transport (TaskHandle_t task, bool (*has_peers) ()) {
+  size_t n = atomic_load_explicit(&n_transports, memory_order_relaxed);
+  if (n == MAX_TRANSPORTS) return false;
+  transports[n] = (transport_t) { .task = task, .has_peers = has_peers };
+  atomic_store_explicit(&n_transports, n + 1, memory_order_release);
+  return true;
+}
+
+void tcp_server_frame_cursor (fanout_cursor_t *cursor) {
+  frame_fanout_cursor_init(&fanout, cursor);
+}
+
+size_t tcp_server_read_frame (fanout_cursor_t *cursor, uint8_t *dst) {
+  return frame_fanout_read(&fanout, cursor, dst);
 }
 
 bool tcp_server_send_sync (uint8_t *data, size_t len) {
-  if (!client_connected) return false;
-  
-  int sent = send(tcp_socket, data, len, 0);
-  if (sent < 0) {
-    ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
-    vTaskResume(tcp_server_task_handle);
+  if (!tcp_server_connected()) return false;
+  while (len > 0) {
+    size_t n = len < STREAM_FRAME_MAX_LEN ? len : STREAM_FRAME_MAX_LEN;
+    frame_fanout_publish(&fanout, data, n, NULL, 0);
+    data += n;
+    len -= n;
+  }
+  notify_clients();
+  return true;
+}
+
+bool tcp_server_send_frame (const stream_frame_header_t *header, const void *payload) {
+  if (!tcp_server_connected()) return false;
+  /* Copied once, header and payload together, every client sends the same bytes */
+  if (!frame_fanout_publish(&fanout, header, STREAM_FRAME_HEADER_LEN, payload, header->payload_len)) {
+    ESP_LOGE(TAG, "Frame of %u bytes over the limit", (unsigned) (STREAM_FRAME_HEADER_LEN + header->payload_len));
     return false;
   }
+  notify_clients();
   return true;
 }
 
-void send_tcp_packet (uint8_t *data, size_t len) {
-  if (!client_connected) return;
-  broadcast_message_t msg;
-  /* Deep copy the message */
-  msg.data = (uint8_t*) malloc(len);
-  msg.len = len;
-  memcpy(msg.data, data, len);
+uint32_t tcp_server_lag () {
+  uint32_t lag = 0;
+  for (int i = 0; i < TCP_SERVER_MAX_CLIENTS; i++) {
+    if (atomic_load(&clients[i].state) != CLIENT_ACTIVE) continue;
+    /* The cursor is moved by the client task, a stale position only overstates the lag */
+    uint32_t pending = frame_fanout_pending(&fanout, &clients[i].cursor);
+    if (pending > lag) lag = pending;
+  }
+  return lag;
+}
+
+void tcp_server_get_stage_stats (pipeline_stage_stats_t *stats) {
+  pipeline_stage_get_stats(&client_stage, stats);
+}
 
-  xQueueSend(tcp_server_queue, &msg, (TickType_t) 100);
-}
\ No newline at end of file
+size_t tcp_server_get_client_stats (tcp_client_stats_t *stats, size_t max_clients) {
+  size_t n = max_clients < TCP_SERVER_MAX_CLIENTS ? max_clients : TCP_SERVER_MAX_CLIENTS;
+  for (size_t i = 0; i < n; i++) {
+    stats[i] = clients[i].stats;
+    stats[i].connected = atomic_load(&clients[i].state) == CLIENT_ACTIVE;
+  }
+  return n;
+}
+
+static uint32_t send_percentile (const uint32_t *count, const tcp_send_stats_t *stats, float p) {
+  if (stats->sends == 0) return 0;
+  uint32_t target = (uint32_t) (p * stats->sends);
+  uint32_t acc = 0;
+  for (uint32_t bin = 0; bin < SEND_BINS; bin++) {
+    acc += count[bin];
+    if (acc > target) return send_bin_upper(bin);
+  }
+  return stats->max_us;
+}
+
+void tcp_server_get_send_stats (tcp_send_stats_t *stats) {
+  /* Read while the client tasks write them, a count may be one send behind */
+  uint32_t count[SEND_BINS] = { 0 };
+  memset(stats, 0, sizeof(tcp_send_stats_t));
+  for (int i = 0; i < TCP_SERVER_MAX_CLIENTS; i++) {
+    const send_hist_t *hist = &clients[i].send_hist;
+    /* Not cleared yet, the task has not sent since the reset */
+    if (hist->reset_seen != send_reset_request) continue;
+    for (uint32_t bin = 0; bin < SEND_BINS; bin++) count[bin] += hist->count[bin];
+    if (hist->max_us > stats->max_us) stats->max_us = hist->max_us;
+  }
+  for (uint32_t bin = 0; bin < SEND_BINS; bin++) stats->sends += count[bin];
+  stats->p50_us = send_percentile(count, stats, 0.5f);
+  stats->p90_us = send_percentile(count, stats, 0.9f);
+  stats->p99_us = send_percentile(count, stats, 0.99f);
+}
+
+void tcp_server_reset_send_stats () {
+  send_reset_request++;
+}
@@ -4,15 +4,142 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
 #include "network_wifi.h"
+#include "stream_frame.h"
+#include "frame_fanout.h"
+#include "pipeline_stage.h"
+
+/* Clients served at the same time, each gets every frame */
+#ifndef TCP_SERVER_MAX_CLIENTS
+#define TCP_SERVER_MAX_CLIENTS (3)
+#endif
+
+/* Frames buffered for the clients in bytes, a power of two. How far a
+ * client can fall behind before it skips frames */
+#ifndef TCP_SERVER_FANOUT_LEN
+#define TCP_SERVER_FANOUT_LEN (32 * 1024)
+#endif
+
+/* Transmit stage of the pipeline, the client tasks, next to the WiFi task */
+#define TCP_SERVER_DEFAULT_STAGE() { \
+  .name = "tcp_client", \
+  .core = 0, \
+  .priority = 5, \
+  .stack = 4096 \
+}
+
+/* Longest a queued frame waits for more to fill a send block, us */
+#ifndef TCP_SERVER_COALESCE_US
+#define TCP_SERVER_COALESCE_US (10000)
+#endif
 
-typedef struct broadcast_message_t {
-  uint8_t *data;
-  size_t len;
-} broadcast_message_t;
+/** Text command received from a client, without line ending */
+typedef void (*tcp_command_callback) (const char *command);
 
-void tcp_server_init (void_callback on_connect_cb);
+typedef struct tcp_client_stats_t {
+  bool connected;
+  uint32_t frames;
+  uint64_t bytes;
+  /** Times the client fell a whole buffer behind and skipped to the newest frame */
+  uint32_t skips;
+  uint64_t skipped_bytes;
+  /** Blocks handed to the socket and times it was full when one was ready */
+  uint32_t blocks;
+  uint32_t would_block;
+  /** Current send block target, follows the free send buffer space */
+  uint32_t block_len;
+  /** Longest time a block took to be accepted by the socket */
+  uint32_t send_max_us;
+} tcp_client_stats_t;
 
+/** Socket sends of the client tasks, percentiles are upper bin edges (half octaves) */
+typedef struct tcp_send_stats_t {
+  uint32_t sends;
+  uint32_t p50_us;
+  uint32_t p90_us;
+  uint32_t p99_us;
+  uint32_t max_us;
+} tcp_send_stats_t;
+
+/**
+ * @brief Starts the server task, on_connect_cb is called for every client that connects
+ * @param stage core and priority of the client tasks, NULL for TCP_SERVER_DEFAULT_STAGE()
+ */
+void tcp_server_init (void_callback on_connect_cb, const pipeline_stage_config_t *stage);
+
+/**
+ * @brief Handler of the commands the clients write after the connection
+ * request, called from the server task
+ */
+void tcp_server_set_command_cb (tcp_command_callback command_cb);
+
+/** @brief Queues raw bytes for every client, in frame sized pieces */
 bool tcp_server_send_sync (uint8_t *data, size_t len);
 
-#endif
\ No newline at end of file
+/**
+ * @brief True while at least one client is connected to the data port or a
+ * transport added with tcp_server_add_transport() has peers
+ */
+bool tcp_server_connected ();
+
+/**
+ * @brief Queues one stream frame, header and payload, for every connected
+ * client. Never waits for the network, each client task sends at its pace,
+ * coalescing frames into blocks of whole TCP segments sized to the free send
+ * buffer, at most TCP_SERVER_COALESCE_US after the first one was queued.
+ * A STREAM_FRAME_TIME frame is sent at once, stamped with its transmit time.
+ * Frames are queued from a single task, the one sending the stream
+ * @returns false if no client is connected
+ */
+bool tcp_server_send_frame (const stream_frame_header_t *header, const void *payload);
+
+/**
+ * @brief Bytes queued and not yet taken by the slowest TCP client, 0 without
+ * clients. A client falls TCP_SERVER_FANOUT_LEN behind before it skips frames
+ */
+uint32_t tcp_server_lag ();
+
+/**
+ * @brief CPU load of the client tasks since the last call, the transmit stage
+ * of the pipeline. Called from one task
+ */
+void tcp_server_get_stage_stats (pipeline_stage_stats_t *stats);
+
+/**
+ * @brief Counters of each client slot, since the client in it connected
+ * @returns number of slots written, at most TCP_SERVER_MAX_CLIENTS
+ */
+size_t tcp_server_get_client_stats (tcp_client_stats_t *stats, size_t max_clients);
+
+/**
+ * @brief Time the blocks of every client took to be accepted by its socket,
+ * since the last tcp_server_reset_send_stats(), over the clients connected
+ * and gone
+ */
+void tcp_server_get_send_stats (tcp_send_stats_t *stats);
+
+/** @brief Clears the send durations, each client task clears its own before its next block */
+void tcp_server_reset_send_stats ();
+
+/**
+ * @brief Another transport sending the queued frames, like the datagram
+ * stream. Its task is notified on every frame and frames are queued while
+ * has_peers() is true even with no TCP client. Called from one task, also
+ * while frames are sent
+ * @returns false if there is no room for another transport
+ */
+bool tcp_server_add_transport (TaskHandle_t task, bool (*has_peers) ());
+
+/** @brief Places a transport cursor after the last queued frame */
+void tcp_server_frame_cursor (fanout_cursor_t *cursor);
+
+/**
+ * @brief Copies the frame at a transport cursor, dst holds STREAM_FRAME_MAX_LEN bytes
+ * @returns frame length, 0 if the cursor is up to date
+ */
+size_t tcp_server_read_frame (fanout_cursor_t *cursor, uint8_t *dst);
+
+#endif
@@ -0,0 +1,191 @@
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "udp_stream.h"
+
+#define TAG "UDP STREAM"
+
+/* Sender wakes up this often without frames, to read subscriptions */
+#define POLL_PERIOD_MS (100)
+
+typedef struct udp_peer_t {
+  struct sockaddr_in addr;
+  int64_t last_seen;
+} udp_peer_t;
+
+static int udp_socket = -1;
+static bool multicast = false;
+static struct sockaddr_in group_addr;
+
+/* Written by the sender task only, the count is read by the stream task */
+static udp_peer_t peers[UDP_STREAM_MAX_PEERS];
+static atomic_int n_peers;
+
+static fanout_cursor_t cursor;
+static uint8_t frame[STREAM_FRAME_MAX_LEN];
+static udp_stream_stats_t stats;
+static tcp_command_callback command_cb = NULL;
+
+static bool has_peers () {
+  return multicast || atomic_load(&n_peers) > 0;
+}
+
+static void subscribe (const struct sockaddr_in *addr, int64_t now) {
+  int n = atomic_load(&n_peers);
+  for (int i = 0; i < n; i++) {
+    if (peers[i].addr.sin_addr.s_addr == addr->sin_addr.s_addr && peers[i].addr.sin_port == addr->sin_port) {
+      peers[i].last_seen = now;
+      return;
+    }
+  }
+  if (n == UDP_STREAM_MAX_PEERS) {
+    ESP_LOGW(TAG, "Refused viewer, %d subscribed", UDP_STREAM_MAX_PEERS);
+    return;
+  }
+  if (n == 0) tcp_server_frame_cursor(&cursor);
+  peers[n] = (udp_peer_t) { .addr = *addr, .last_seen = now };
+  atomic_store(&n_peers, n + 1);
+  ESP_LOGI(TAG, "Viewer %d subscribed", n);
+}
+
+static void unsubscribe (const struct sockaddr_in *addr) {
+  int n = atomic_load(&n_peers);
+  for (int i = 0; i < n; i++) {
+    if (peers[i].addr.sin_addr.s_addr != addr->sin_addr.s_addr || peers[i].addr.sin_port != addr->sin_port) continue;
+    peers[i] = peers[n - 1];
+    atomic_store(&n_peers, n - 1);
+    return;
+  }
+}
+
+static void expire_peers (int64_t now) {
+  int n = atomic_load(&n_peers);
+  for (int i = 0; i < n;) {
+    if (now - peers[i].last_seen < UDP_STREAM_PEER_TIMEOUT_MS * 1000LL) {
+      i++;
+      continue;
+    }
+    ESP_LOGI(TAG, "Viewer %d timed out", i);
+    peers[i] = peers[--n];
+  }
+  atomic_store(&n_peers, n);
+}
+
+/* Subscriptions and commands, the socket is non-blocking */
+static void read_datagrams () {
+  char rx_buffer[128];
+  while (1) {
+    struct sockaddr_in source;
+    socklen_t source_len = sizeof(source);
+    int len = recvfrom(udp_socket, rx_buffer, sizeof(rx_buffer) - 1, 0, (struct sockaddr*) &source, &source_len);
+    if (len <= 0) return;
+    /* Frames of the group, when this host also listens to it */
+    if (len >= (int) sizeof(uint32_t) && memcmp(rx_buffer, &(uint32_t) { STREAM_FRAME_MAGIC }, sizeof(uint32_t)) == 0) continue;
+    rx_buffer[len] = 0;
+    while (len > 0 && (rx_buffer[len - 1] == '\n' || rx_buffer[len - 1] == '\r' || rx_buffer[len - 1] == 0)) {
+      rx_buffer[--len] = 0;
+    }
+    if (strcmp(rx_buffer, "subscribe") == 0) {
+      if (!multicast) subscribe(&source, esp_timer_get_time());
+    } else if (strcmp(rx_buffer, "unsubscribe") == 0) {
+      if (!multicast) unsubscribe(&source);
+    } else if (command_cb != NULL) {
+      command_cb(rx_buffer);
+    }
+  }
+}
+
+static void send_datagram (const struct sockaddr_in *addr, size_t len) {
+  if (sendto(udp_socket, frame, len, 0, (const struct sockaddr*) addr, sizeof(*addr)) < 0) {
+    /* Out of buffers, the frame is lost like on the air */
+    stats.dropped++;
+    return;
+  }
+  stats.datagrams++;
+  stats.bytes += len;
+}
+
+/* Sends each queued frame as soon as it is queued, never coalesced */
+static void udp_stream_task () {
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(POLL_PERIOD_MS));
+    read_datagrams();
+    if (!multicast) expire_peers(esp_timer_get_time());
+    if (!has_peers()) continue;
+
+    size_t len;
+    while ((len = tcp_server_read_frame(&cursor, frame)) > 0) {
+      stream_frame_stamp_transmit(frame, len, esp_timer_get_time());
+      if (multicast) {
+        send_datagram(&group_addr, len);
+      } else {
+        int n = atomic_load(&n_peers);
+        for (int i = 0; i < n; i++) send_datagram(&peers[i].addr, len);
+      }
+    }
+    stats.skips = cursor.skips;
+  }
+}
+
+bool udp_stream_init (const udp_stream_config_t *config) {
+  uint16_t port = config->port > 0 ? config->port : UDP_STREAM_PORT;
+  udp_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+  if (udp_socket < 0) {
+    ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+    return false;
+  }
+  /* Viewers on this host may bind the group port too */
+  int reuse = 1;
+  setsockopt(udp_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  struct sockaddr_in bind_addr = {
+    .sin_family = AF_INET,
+    .sin_port = htons(port),
+    .sin_addr.s_addr = htonl(INADDR_ANY)
+  };
+  if (bind(udp_socket, (struct sockaddr*) &bind_addr, sizeof(bind_addr)) < 0) {
+    ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
+    close(udp_socket);
+    return false;
+  }
+  fcntl(udp_socket, F_SETFL, fcntl(udp_socket, F_GETFL, 0) | O_NONBLOCK);
+
+  multicast = config->group != NULL;
+  if (multicast) {
+    group_addr = (struct sockaddr_in) { .sin_family = AF_INET, .sin_port = htons(port) };
+    if (inet_aton(config->group, &group_addr.sin_addr) == 0 || !IN_MULTICAST(ntohl(group_addr.sin_addr.s_addr))) {
+      ESP_LOGE(TAG, "Invalid multicast group %s", config->group);
+      close(udp_socket);
+      return false;
+    }
+    uint8_t ttl = config->ttl > 0 ? config->ttl : 1;
+    setsockopt(udp_socket, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+  }
+
+  atomic_init(&n_peers, 0);
+  tcp_server_frame_cursor(&cursor);
+  TaskHandle_t task;
+  xTaskCreatePinnedToCore(udp_stream_task, "udp_stream", 4096, NULL, 5, &task, 0);
+  tcp_server_add_transport(task, has_peers);
+  if (multicast) {
+    ESP_LOGI(TAG, "Streaming to %s:%u", config->group, port);
+  } else {
+    ESP_LOGI(TAG, "Waiting for viewers on port %u", port);
+  }
+  return true;
+}
+
+void udp_stream_set_command_cb (tcp_command_callback cb) {
+  command_cb = cb;
+}
+
+void udp_stream_get_stats (udp_stream_stats_t *out) {
+  *out = stats;
+  out->peers = multicast ? 0 : atomic_load(&n_peers);
+}
@@ -0,0 +1,63 @@
+/**
+ * @file udp_stream.h
+ *
+ * @brief Datagram copy of the stream queued on the TCP server, one frame per
+ * datagram (at most STREAM_FRAME_MAX_LEN bytes, within the WiFi MTU). Frames
+ * lost on the way are not sent again, the receiver sees a sequence gap
+ * instead of a stalled connection.
+ *
+ * Sent to a multicast group, one transmission for any number of viewers, or
+ * to each viewer that wrote "subscribe" to the port in the last
+ * UDP_STREAM_PEER_TIMEOUT_MS. Other datagrams are commands, as on TCP.
+ */
+#ifndef UDP_STREAM_H
+#define UDP_STREAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "tcp_server.h"
+
+#define UDP_STREAM_PORT (3334)
+
+/* Unicast viewers served at the same time */
+#ifndef UDP_STREAM_MAX_PEERS
+#define UDP_STREAM_MAX_PEERS (4)
+#endif
+
+/* A viewer that did not subscribe again for this long is dropped, ms */
+#ifndef UDP_STREAM_PEER_TIMEOUT_MS
+#define UDP_STREAM_PEER_TIMEOUT_MS (5000)
+#endif
+
+typedef struct udp_stream_config_t {
+  /** IPv4 multicast group, NULL to send to the subscribed viewers */
+  const char *group;
+  /** 0 for UDP_STREAM_PORT */
+  uint16_t port;
+  /** Multicast hops, 0 for 1 */
+  uint8_t ttl;
+} udp_stream_config_t;
+
+typedef struct udp_stream_stats_t {
+  uint32_t peers;
+  uint32_t datagrams;
+  uint64_t bytes;
+  /** Datagrams the stack had no buffer for, not sent */
+  uint32_t dropped;
+  /** Times the sender fell a whole frame ring behind */
+  uint32_t skips;
+} udp_stream_stats_t;
+
+/**
+ * @brief Opens the socket and starts the sender task, after tcp_server_init()
+ * @returns false if the socket or the group could not be set up
+ */
+bool udp_stream_init (const udp_stream_config_t *config);
+
+/** @brief Handler of the commands received as datagrams, called from the sender task */
+void udp_stream_set_command_cb (tcp_command_callback command_cb);
+
+void udp_stream_get_stats (udp_stream_stats_t *stats);
+
+#endif
@@ -0,0 +1,83 @@
+#include "block_queue.h"
+
+bool block_queue_init (block_queue_t *queue, void *buf, size_t block_len, uint32_t n_blocks) {
+  if (buf == NULL || block_len == 0 || n_blocks < 2 || (n_blocks & (n_blocks - 1)) != 0) return false;
+  queue->buf = (uint8_t*) buf;
+  queue->block_len = block_len;
+  queue->n_blocks = n_blocks;
+  atomic_init(&queue->head, 0);
+  atomic_init(&queue->tail, 0);
+  atomic_init(&queue->producer, NULL);
+  atomic_init(&queue->consumer, NULL);
+  queue->stats = (block_queue_stats_t) { .n_blocks = n_blocks };
+  return true;
+}
+
+static uint8_t* block_at (const block_queue_t *queue, uint32_t count) {
+  return &queue->buf[(size_t) (count & (queue->n_blocks - 1)) * queue->block_len];
+}
+
+static bool can_write (block_queue_t *queue) {
+  uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+  return atomic_load_explicit(&queue->head, memory_order_relaxed) - tail < queue->n_blocks;
+}
+
+static bool can_read (block_queue_t *queue) {
+  uint32_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+  return head != atomic_load_explicit(&queue->tail, memory_order_relaxed);
+}
+
+/* Publishes the task before checking again, so a commit or release in
+ * between is not missed, then sleeps until the deadline */
+static bool wait_for (block_queue_t *queue, _Atomic(TaskHandle_t) *waiter, bool (*ready) (block_queue_t*), TickType_t timeout) {
+  TickType_t start = xTaskGetTickCount();
+  while (!ready(queue)) {
+    TickType_t waited = xTaskGetTickCount() - start;
+    if (timeout == 0 || (timeout != portMAX_DELAY && waited >= timeout)) return false;
+    atomic_store(waiter, xTaskGetCurrentTaskHandle());
+    if (!ready(queue)) ulTaskNotifyTake(pdTRUE, timeout == portMAX_DELAY ? portMAX_DELAY : timeout - waited);
+    atomic_store(waiter, NULL);
+  }
+  return true;
+}
+
+static void wake (_Atomic(TaskHandle_t) *waiter) {
+  TaskHandle_t task = atomic_exchange(waiter, NULL);
+  if (task != NULL) xTaskNotifyGive(task);
+}
+
+void* block_queue_write_acquire (block_queue_t *queue, TickType_t timeout) {
+  if (!can_write(queue)) {
+    queue->stats.full++;
+    if (!wait_for(queue, &queue->producer, can_write, timeout)) return NULL;
+  }
+  return block_at(queue, atomic_load_explicit(&queue->head, memory_order_relaxed));
+}
+
+void block_queue_write_commit (block_queue_t *queue) {
+  uint32_t head = atomic_load_explicit(&queue->head, memory_order_relaxed) + 1;
+  atomic_store_explicit(&queue->head, head, memory_order_release);
+  queue->stats.blocks++;
+  uint32_t fill = head - atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  if (fill > queue->stats.high_water) queue->stats.high_water = fill;
+  wake(&queue->consumer);
+}
+
+void* block_queue_read_acquire (block_queue_t *queue, TickType_t timeout) {
+  if (!wait_for(queue, &queue->consumer, can_read, timeout)) return NULL;
+  return block_at(queue, atomic_load_explicit(&queue->tail, memory_order_relaxed));
+}
+
+void block_queue_read_release (block_queue_t *queue) {
+  uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+  wake(&queue->producer);
+}
+
+uint32_t block_queue_fill (block_queue_t *queue) {
+  return atomic_load(&queue->head) - atomic_load(&queue->tail);
+}
+
+void block_queue_get_stats (block_queue_t *queue, block_queue_stats_t *stats) {
+  *stats = queue->stats;
+}
@@ -0,0 +1,86 @@
+/**
+ * @file block_queue.h
+ *
+ * @brief Lock-free single producer / single consumer queue of fixed size
+ * blocks, the handoff between two pipeline stages. The producer fills a
+ * block in place and commits it, the consumer works on it in place and
+ * releases it: no copy and no lock between the stages, only the two
+ * counters. A side that waits sleeps on its task notification, given by
+ * the other side when it commits or releases a block.
+ *
+ * The notification of the waiting task is shared with its other uses, a
+ * wait may end early and is then retried up to the timeout.
+ */
+#ifndef BLOCK_QUEUE_H
+#define BLOCK_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+typedef struct block_queue_stats_t {
+  uint32_t n_blocks;
+  /** Blocks committed, most ever waiting and times the producer found none free */
+  uint32_t blocks;
+  uint32_t high_water;
+  uint32_t full;
+} block_queue_stats_t;
+
+typedef struct block_queue_t {
+  uint8_t *buf;
+  size_t block_len;
+  uint32_t n_blocks;
+  /** Blocks ever committed and released, wrap at 2^32. Each written by one side */
+  atomic_uint_least32_t head;
+  atomic_uint_least32_t tail;
+  /** Task waiting for a block, NULL when none */
+  _Atomic(TaskHandle_t) producer;
+  _Atomic(TaskHandle_t) consumer;
+  block_queue_stats_t stats;
+} block_queue_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Cuts a caller provided buffer into n_blocks blocks of block_len bytes
+ * @param n_blocks a power of two, at least 2
+ */
+bool block_queue_init (block_queue_t *queue, void *buf, size_t block_len, uint32_t n_blocks);
+
+/**
+ * @brief Producer side, the next free block, waiting up to timeout for the
+ * consumer to release one
+ * @returns NULL if every block is still taken
+ */
+void* block_queue_write_acquire (block_queue_t *queue, TickType_t timeout);
+
+/** @brief Hands the block from block_queue_write_acquire() to the consumer */
+void block_queue_write_commit (block_queue_t *queue);
+
+/**
+ * @brief Consumer side, the oldest committed block, waiting up to timeout.
+ * The same block is returned until it is released
+ * @returns NULL if none was committed
+ */
+void* block_queue_read_acquire (block_queue_t *queue, TickType_t timeout);
+
+/** @brief Gives the block from block_queue_read_acquire() back to the producer */
+void block_queue_read_release (block_queue_t *queue);
+
+/** @brief Blocks committed and not released yet */
+uint32_t block_queue_fill (block_queue_t *queue);
+
+void block_queue_get_stats (block_queue_t *queue, block_queue_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,56 @@
+#include <string.h>
+
+#include "esp_timer.h"
+
+#include "pipeline_stage.h"
+
+void pipeline_stage_init (pipeline_stage_t *stage, const pipeline_stage_config_t *config) {
+  memset(stage, 0, sizeof(*stage));
+  stage->config = *config;
+  stage->last_report = esp_timer_get_time();
+}
+
+bool pipeline_stage_spawn (pipeline_stage_t *stage, TaskFunction_t fn, void *arg, TaskHandle_t *task) {
+  if (stage->n_tasks == PIPELINE_STAGE_MAX_TASKS) return false;
+  const pipeline_stage_config_t *config = &stage->config;
+  TaskHandle_t handle = NULL;
+  if (xTaskCreatePinnedToCore(fn, config->name, config->stack, arg, config->priority, &handle, config->core) != pdPASS) return false;
+  stage->last_run_time[stage->n_tasks] = pipeline_task_run_time(handle);
+  stage->tasks[stage->n_tasks++] = handle;
+  if (task != NULL) *task = handle;
+  return true;
+}
+
+bool pipeline_stage_start (pipeline_stage_t *stage, const pipeline_stage_config_t *config, TaskFunction_t fn, void *arg) {
+  pipeline_stage_init(stage, config);
+  return pipeline_stage_spawn(stage, fn, arg, NULL);
+}
+
+void pipeline_stage_get_stats (pipeline_stage_t *stage, pipeline_stage_stats_t *stats) {
+  int64_t now = esp_timer_get_time();
+  uint64_t ran = 0;
+  for (size_t i = 0; i < stage->n_tasks; i++) {
+    uint32_t run_time = pipeline_task_run_time(stage->tasks[i]);
+    ran += run_time - stage->last_run_time[i];
+    stage->last_run_time[i] = run_time;
+  }
+  stage->cpu_us += ran;
+  *stats = (pipeline_stage_stats_t) {
+    .name = stage->config.name,
+    .core = stage->config.core,
+    .priority = stage->config.priority,
+    .load = now > stage->last_report ? (float) ran / (float) (now - stage->last_report) : 0,
+    .cpu_us = stage->cpu_us
+  };
+  stage->last_report = now;
+}
+
+uint32_t pipeline_task_run_time (TaskHandle_t task) {
+#if configGENERATE_RUN_TIME_STATS
+  TaskStatus_t status;
+  vTaskGetInfo(task, &status, pdFALSE, eRunning);
+  return status.ulRunTimeCounter;
+#else
+  return 0;
+#endif
+}
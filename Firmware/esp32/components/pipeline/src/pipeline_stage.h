@@ -0,0 +1,86 @@
+/**
+ * @file pipeline_stage.h
+ *
+ * @brief Stage of the processing pipeline: one or more tasks with the same
+ * core, priority and stack, handing blocks to the next stage through a
+ * block_queue.h. Each stage reports the CPU time its tasks ran over the
+ * time since the last report, from the FreeRTOS run time counters
+ * (CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS with the esp_timer clock, us).
+ * On the host the tasks are pthreads pinned to the CPU of their core and
+ * the counters are the thread CPU clocks, the priorities are not applied.
+ */
+#ifndef PIPELINE_STAGE_H
+#define PIPELINE_STAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/* Tasks measured together in one stage, a task per TCP client */
+#ifndef PIPELINE_STAGE_MAX_TASKS
+#define PIPELINE_STAGE_MAX_TASKS (4)
+#endif
+
+typedef struct pipeline_stage_config_t {
+  /** Task name, the stage name in the reports */
+  const char *name;
+  /** Core the tasks are pinned to, tskNO_AFFINITY for any */
+  BaseType_t core;
+  UBaseType_t priority;
+  uint32_t stack;
+} pipeline_stage_config_t;
+
+typedef struct pipeline_stage_stats_t {
+  const char *name;
+  BaseType_t core;
+  UBaseType_t priority;
+  /** CPU time of the tasks over the time since the last report, 1 is a whole core */
+  float load;
+  /** CPU time since the stage started, us */
+  uint64_t cpu_us;
+} pipeline_stage_stats_t;
+
+typedef struct pipeline_stage_t {
+  pipeline_stage_config_t config;
+  TaskHandle_t tasks[PIPELINE_STAGE_MAX_TASKS];
+  size_t n_tasks;
+  /** Run time counters at the last report, the counters wrap at 2^32 */
+  uint32_t last_run_time[PIPELINE_STAGE_MAX_TASKS];
+  int64_t last_report;
+  uint64_t cpu_us;
+} pipeline_stage_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** @brief Sets the stage up without a task, they are added with pipeline_stage_spawn() */
+void pipeline_stage_init (pipeline_stage_t *stage, const pipeline_stage_config_t *config);
+
+/**
+ * @brief Creates a task of the stage running fn(arg), pinned to its core at its priority
+ * @returns false if the task could not be created or the stage has PIPELINE_STAGE_MAX_TASKS
+ */
+bool pipeline_stage_spawn (pipeline_stage_t *stage, TaskFunction_t fn, void *arg, TaskHandle_t *task);
+
+/** @brief pipeline_stage_init() and one task */
+bool pipeline_stage_start (pipeline_stage_t *stage, const pipeline_stage_config_t *config, TaskFunction_t fn, void *arg);
+
+/**
+ * @brief CPU load of the stage since the last call, the first call covers
+ * the time since the stage started. Called from one task
+ */
+void pipeline_stage_get_stats (pipeline_stage_t *stage, pipeline_stage_stats_t *stats);
+
+/** @brief Run time counter of a task, us, 0 without run time stats */
+uint32_t pipeline_task_run_time (TaskHandle_t task);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,37 @@
+#include <string.h>
+
+#include "esp_heap_caps.h"
+
+#include "backlog_storage.h"
+
+static bool memory_write (void *ctx, size_t offset, const void *data, size_t len) {
+  memcpy((uint8_t*) ctx + offset, data, len);
+  return true;
+}
+
+static bool memory_read (void *ctx, size_t offset, void *data, size_t len) {
+  memcpy(data, (const uint8_t*) ctx + offset, len);
+  return true;
+}
+
+void backlog_storage_memory (backlog_storage_t *storage, void *buf, size_t len) {
+  *storage = (backlog_storage_t) {
+    .len = len,
+    .write = memory_write,
+    .read = memory_read,
+    .ctx = buf
+  };
+}
+
+bool backlog_storage_alloc (backlog_storage_t *storage, size_t len, uint32_t caps) {
+  void *buf = heap_caps_malloc(len, caps);
+  if (buf == NULL) return false;
+  backlog_storage_memory(storage, buf, len);
+  return true;
+}
+
+void backlog_storage_free (backlog_storage_t *storage) {
+  heap_caps_free(storage->ctx);
+  storage->ctx = NULL;
+  storage->len = 0;
+}
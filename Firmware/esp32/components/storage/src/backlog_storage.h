@@ -0,0 +1,46 @@
+/**
+ * @file backlog_storage.h
+ *
+ * @brief Byte addressed storage behind the sample backlog. The backlog only
+ * reads and writes whole slots through these calls, so the same tiering runs
+ * over external RAM on the sensor and over a plain buffer on the host.
+ */
+#ifndef BACKLOG_STORAGE_H
+#define BACKLOG_STORAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct backlog_storage_t {
+  /** Bytes available from offset 0 */
+  size_t len;
+  /** Copies len bytes to or from offset, false on a storage error */
+  bool (*write) (void *ctx, size_t offset, const void *data, size_t len);
+  bool (*read) (void *ctx, size_t offset, void *data, size_t len);
+  void *ctx;
+} backlog_storage_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** @brief Storage over a caller provided buffer */
+void backlog_storage_memory (backlog_storage_t *storage, void *buf, size_t len);
+
+/**
+ * @brief Storage over a heap_caps_malloc() buffer, MALLOC_CAP_SPIRAM for the
+ * external RAM
+ * @returns false if the heap has no such block
+ */
+bool backlog_storage_alloc (backlog_storage_t *storage, size_t len, uint32_t caps);
+
+/** @brief Frees the buffer of backlog_storage_alloc() */
+void backlog_storage_free (backlog_storage_t *storage);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,275 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "stream_frame.h"
+#include "flash_log.h"
+
+#define SECTOR_MAGIC (0x474F4C50) /* "PLOG" in little endian */
+#define RECORD_MAGIC (0xA5)
+#define RECORD_DATA (1)
+/* Releases the sectors before the sequence it holds */
+#define RECORD_TRIM (2)
+/* Records start on a word */
+#define RECORD_ALIGN (4)
+
+typedef struct sector_header_t {
+  uint32_t magic;
+  uint32_t sequence;
+  uint32_t erases;
+  uint32_t crc;
+} sector_header_t;
+
+typedef struct record_header_t {
+  uint16_t len;
+  uint8_t type;
+  uint8_t magic;
+  /** Over the fields above and the data */
+  uint32_t crc;
+} record_header_t;
+
+static size_t sector_offset (const flash_log_t *log, uint32_t sequence) {
+  return (size_t) (sequence % log->n_sectors) * log->flash.sector_len;
+}
+
+static size_t record_span (size_t len) {
+  return (sizeof(record_header_t) + len + RECORD_ALIGN - 1) & ~(size_t) (RECORD_ALIGN - 1);
+}
+
+static uint32_t sector_crc (const sector_header_t *header) {
+  return stream_frame_crc32(0, header, offsetof(sector_header_t, crc));
+}
+
+static uint32_t record_crc (const record_header_t *record, const void *data) {
+  uint32_t crc = stream_frame_crc32(0, record, offsetof(record_header_t, crc));
+  return stream_frame_crc32(crc, data, record->len);
+}
+
+static bool read_sector_header (const flash_log_t *log, uint32_t index, sector_header_t *header) {
+  const flash_log_flash_t *flash = &log->flash;
+  if (!flash->read(flash->ctx, (size_t) index * flash->sector_len, header, sizeof(*header))) return false;
+  return header->magic == SECTOR_MAGIC && header->crc == sector_crc(header) && header->sequence % log->n_sectors == index;
+}
+
+/* Header of the record at offset of a sector, false past the last one */
+static bool read_record (const flash_log_t *log, uint32_t sequence, size_t offset, record_header_t *record) {
+  const flash_log_flash_t *flash = &log->flash;
+  if (offset + sizeof(*record) > flash->sector_len) return false;
+  if (!flash->read(flash->ctx, sector_offset(log, sequence) + offset, record, sizeof(*record))) return false;
+  return record->magic == RECORD_MAGIC && offset + sizeof(*record) + record->len <= flash->sector_len;
+}
+
+/* CRC check straight from the flash, a record may be as long as a sector */
+static bool record_intact (const flash_log_t *log, size_t at, const record_header_t *record) {
+  const flash_log_flash_t *flash = &log->flash;
+  uint8_t chunk[64];
+  uint32_t crc = stream_frame_crc32(0, record, offsetof(record_header_t, crc));
+  for (size_t done = 0; done < record->len;) {
+    size_t n = record->len - done < sizeof(chunk) ? record->len - done : sizeof(chunk);
+    if (!flash->read(flash->ctx, at + sizeof(*record) + done, chunk, n)) return false;
+    crc = stream_frame_crc32(crc, chunk, n);
+    done += n;
+  }
+  return crc == record->crc;
+}
+
+/* Walks the records of a sector, counting them and the trims. Returns
+ * where the next record goes, sector_len if the walk stopped at a torn one */
+static size_t scan_sector (flash_log_t *log, uint32_t sequence, uint32_t *trim) {
+  const flash_log_flash_t *flash = &log->flash;
+  size_t offset = sizeof(sector_header_t);
+  /* Reads as erased until a header comes from the flash */
+  uint8_t erased[sizeof(record_header_t)];
+  memset(erased, 0xFF, sizeof(erased));
+  record_header_t record;
+  memcpy(&record, erased, sizeof(record));
+  while (read_record(log, sequence, offset, &record)) {
+    size_t at = sector_offset(log, sequence) + offset;
+    if (!record_intact(log, at, &record)) return flash->sector_len;
+    if (record.type == RECORD_TRIM && record.len == sizeof(uint32_t)) {
+      uint32_t value;
+      if (flash->read(flash->ctx, at + sizeof(record), &value, sizeof(value)) && value > *trim) *trim = value;
+    } else if (record.type == RECORD_DATA) {
+      log->stats.records++;
+      log->stats.bytes += record.len;
+    }
+    offset += record_span(record.len);
+  }
+  /* Erased space ends the sector, anything else is a write cut short */
+  if (offset + sizeof(record) <= flash->sector_len && memcmp(&record, erased, sizeof(record)) != 0) return flash->sector_len;
+  return offset;
+}
+
+bool flash_log_mount (flash_log_t *log, const flash_log_flash_t *flash) {
+  uint32_t n_sectors = flash->sector_len > sizeof(sector_header_t) ? flash->len / flash->sector_len : 0;
+  if (n_sectors < 2) return false;
+  memset(log, 0, sizeof(*log));
+  log->flash = *flash;
+  log->n_sectors = n_sectors;
+  log->erases = (uint32_t*) calloc(n_sectors, sizeof(uint32_t));
+  if (log->erases == NULL) return false;
+  log->stats.sectors = n_sectors;
+
+  bool found = false;
+  for (uint32_t i = 0; i < n_sectors; i++) {
+    sector_header_t header;
+    if (!read_sector_header(log, i, &header)) continue;
+    log->erases[i] = header.erases;
+    if (!found || header.sequence > log->head) log->head = header.sequence;
+    found = true;
+  }
+  if (!found) {
+    /* Empty area, the first append opens the next sector */
+    log->offset = flash->sector_len;
+    log->tail = log->head + 1;
+    return true;
+  }
+
+  /* Sectors written before the newest one, back to a gap or a whole ring */
+  log->tail = log->head;
+  while (log->tail > 0 && log->head - log->tail + 1 < n_sectors) {
+    sector_header_t header;
+    uint32_t previous = log->tail - 1;
+    if (!read_sector_header(log, previous % n_sectors, &header) || header.sequence != previous) break;
+    log->tail = previous;
+  }
+  uint32_t trim = 0;
+  for (uint32_t sequence = log->tail; sequence != log->head + 1; sequence++) {
+    size_t offset = scan_sector(log, sequence, &trim);
+    if (sequence == log->head) log->offset = offset;
+  }
+  if (trim > log->tail) log->tail = trim;
+  if (log->tail > log->head) log->offset = flash->sector_len;
+  return true;
+}
+
+/* Erases the next sector in sequence and writes its header */
+static bool open_sector (flash_log_t *log) {
+  const flash_log_flash_t *flash = &log->flash;
+  uint32_t sequence = log->head + 1;
+  uint32_t index = sequence % log->n_sectors;
+  size_t offset = (size_t) index * flash->sector_len;
+  sector_header_t header = {
+    .magic = SECTOR_MAGIC,
+    .sequence = sequence,
+    .erases = log->erases[index] + 1
+  };
+  header.crc = sector_crc(&header);
+  if (!flash->erase(flash->ctx, offset)) {
+    log->stats.errors++;
+    return false;
+  }
+  log->erases[index] = header.erases;
+  /* The ring is full, the oldest sector went */
+  if (sequence - log->tail >= log->n_sectors) {
+    log->tail = sequence - log->n_sectors + 1;
+    log->stats.overwritten++;
+  }
+  if (!flash->write(flash->ctx, offset, &header, sizeof(header))) {
+    log->stats.errors++;
+    return false;
+  }
+  log->head = sequence;
+  log->offset = sizeof(header);
+  return true;
+}
+
+static bool append_record (flash_log_t *log, uint8_t type, const void *data, size_t len) {
+  const flash_log_flash_t *flash = &log->flash;
+  if (len == 0 || len > UINT16_MAX || sizeof(sector_header_t) + sizeof(record_header_t) + len > flash->sector_len) return false;
+  if (log->offset + sizeof(record_header_t) + len > flash->sector_len && !open_sector(log)) return false;
+
+  record_header_t record = { .len = len, .type = type, .magic = RECORD_MAGIC };
+  record.crc = record_crc(&record, data);
+  size_t at = sector_offset(log, log->head) + log->offset;
+  /* Moves on even if the write fails, a torn record is never written over */
+  log->offset += record_span(len);
+  if (
+    !flash->write(flash->ctx, at, &record, sizeof(record)) ||
+    !flash->write(flash->ctx, at + sizeof(record), data, len)
+  ) {
+    log->stats.errors++;
+    return false;
+  }
+  return true;
+}
+
+size_t flash_log_room (const flash_log_t *log, size_t min_len) {
+  size_t sector_len = log->flash.sector_len;
+  size_t empty = sector_len - sizeof(sector_header_t) - sizeof(record_header_t);
+  size_t used = log->offset + sizeof(record_header_t);
+  size_t room = used < sector_len ? sector_len - used : 0;
+  return room >= min_len ? room : empty;
+}
+
+bool flash_log_append (flash_log_t *log, const void *data, size_t len) {
+  if (!append_record(log, RECORD_DATA, data, len)) return false;
+  log->stats.records++;
+  log->stats.bytes += len;
+  return true;
+}
+
+void flash_log_rewind (const flash_log_t *log, flash_log_cursor_t *cursor) {
+  cursor->sequence = log->tail;
+  cursor->offset = sizeof(sector_header_t);
+  cursor->lost = 0;
+}
+
+size_t flash_log_read (flash_log_t *log, flash_log_cursor_t *cursor, void *dst, size_t max_len) {
+  const flash_log_flash_t *flash = &log->flash;
+  while (1) {
+    if (cursor->sequence < log->tail) {
+      /* Overwritten or cleared under the cursor */
+      cursor->lost += log->tail - cursor->sequence;
+      cursor->sequence = log->tail;
+      cursor->offset = sizeof(sector_header_t);
+    }
+    if (cursor->sequence > log->head) return 0;
+    bool open = cursor->sequence == log->head;
+    if (open && cursor->offset >= log->offset) return 0;
+
+    record_header_t record;
+    if (!read_record(log, cursor->sequence, cursor->offset, &record)) {
+      if (open) {
+        cursor->offset = log->offset;
+        return 0;
+      }
+      cursor->sequence++;
+      cursor->offset = sizeof(sector_header_t);
+      continue;
+    }
+    size_t at = sector_offset(log, cursor->sequence) + cursor->offset;
+    cursor->offset += record_span(record.len);
+    if (record.type != RECORD_DATA) continue;
+    if (
+      record.len > max_len ||
+      !flash->read(flash->ctx, at + sizeof(record), dst, record.len) ||
+      record_crc(&record, dst) != record.crc
+    ) {
+      log->stats.errors++;
+      continue;
+    }
+    return record.len;
+  }
+}
+
+bool flash_log_clear (flash_log_t *log) {
+  uint32_t tail;
+  if (log->offset + record_span(sizeof(tail)) > log->flash.sector_len && !open_sector(log)) return false;
+  tail = log->head + 1;
+  if (!append_record(log, RECORD_TRIM, &tail, sizeof(tail))) return false;
+  log->tail = tail;
+  /* Records after the trim would be released with it */
+  log->offset = log->flash.sector_len;
+  return true;
+}
+
+void flash_log_get_stats (const flash_log_t *log, flash_log_stats_t *stats) {
+  *stats = log->stats;
+  stats->used = log->tail <= log->head ? log->head - log->tail + 1 : 0;
+  stats->erase_min = stats->erase_max = log->erases[0];
+  for (uint32_t i = 1; i < log->n_sectors; i++) {
+    if (log->erases[i] < stats->erase_min) stats->erase_min = log->erases[i];
+    if (log->erases[i] > stats->erase_max) stats->erase_max = log->erases[i];
+  }
+}
@@ -0,0 +1,124 @@
+/**
+ * @file flash_log.h
+ *
+ * @brief Log of variable length records in a raw flash area, written
+ * sector by sector in a ring. Sectors are taken in sequence order, each is
+ * erased right before its first record, so every sector is erased once per
+ * pass whatever was recorded: the wear is spread evenly without a mapping
+ * table. When the ring is full the oldest sector is overwritten.
+ *
+ * Each sector starts with a header holding its sequence number, the sector
+ * is sequence % sectors, and its erase count. Records do not cross sectors,
+ * each has its length, type and CRC. After a reset the log is found again
+ * from the sector headers: the newest sector is the one appended to, its
+ * records are walked up to the first erased or torn one. Records already
+ * read are released with flash_log_clear(), which appends a trim record
+ * rather than erasing, so the next sectors are still taken in order.
+ *
+ * Not thread safe, the caller serialises appends and reads.
+ */
+#ifndef FLASH_LOG_H
+#define FLASH_LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Flash area the log is written to, a partition on the sensor */
+typedef struct flash_log_flash_t {
+  /** Bytes, a whole number of sectors */
+  size_t len;
+  /** Erase unit */
+  size_t sector_len;
+  /** Erases the sector at offset to 0xFF */
+  bool (*erase) (void *ctx, size_t offset);
+  /** Programs erased bytes, it only clears bits */
+  bool (*write) (void *ctx, size_t offset, const void *data, size_t len);
+  bool (*read) (void *ctx, size_t offset, void *data, size_t len);
+  void *ctx;
+} flash_log_flash_t;
+
+typedef struct flash_log_stats_t {
+  uint32_t sectors;
+  /** Sectors holding records not cleared yet, the open one included */
+  uint32_t used;
+  uint32_t records;
+  uint64_t bytes;
+  /** Sectors overwritten before they were cleared, the log was full */
+  uint32_t overwritten;
+  /** Least and most erased sector since the log was first written */
+  uint32_t erase_min;
+  uint32_t erase_max;
+  /** Failed flash operations and records skipped for a bad CRC */
+  uint32_t errors;
+} flash_log_stats_t;
+
+/* Read position, starts at the oldest record */
+typedef struct flash_log_cursor_t {
+  uint32_t sequence;
+  uint32_t offset;
+  /** Sectors overwritten or cleared under the cursor before it read them */
+  uint32_t lost;
+} flash_log_cursor_t;
+
+typedef struct flash_log_t {
+  flash_log_flash_t flash;
+  uint32_t n_sectors;
+  /** Sequence of the sector appended to and the write position in it,
+   * sector_len once it is closed */
+  uint32_t head;
+  uint32_t offset;
+  /** Oldest sequence not cleared */
+  uint32_t tail;
+  /** Erase count of each sector */
+  uint32_t *erases;
+  flash_log_stats_t stats;
+} flash_log_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Finds the log in the flash area, or starts an empty one if the
+ * area holds none
+ * @returns false if the area has less than two sectors or cannot be read
+ */
+bool flash_log_mount (flash_log_t *log, const flash_log_flash_t *flash);
+
+/**
+ * @brief Largest record that fits in the open sector if it takes at least
+ * min_len, else the largest record of an empty sector, where the next append goes
+ */
+size_t flash_log_room (const flash_log_t *log, size_t min_len);
+
+/**
+ * @brief Appends a record, in a new sector if the open one has no room for it
+ * @returns false if the record is longer than an empty sector takes or the flash failed
+ */
+bool flash_log_append (flash_log_t *log, const void *data, size_t len);
+
+/** @brief Places a cursor on the oldest record */
+void flash_log_rewind (const flash_log_t *log, flash_log_cursor_t *cursor);
+
+/**
+ * @brief Copies the record at the cursor and moves past it, records longer
+ * than max_len are skipped
+ * @returns record length, 0 once the cursor reached the end of the log
+ */
+size_t flash_log_read (flash_log_t *log, flash_log_cursor_t *cursor, void *dst, size_t max_len);
+
+/**
+ * @brief Releases every record, new ones go to the next sector
+ * @returns false if the trim record could not be written
+ */
+bool flash_log_clear (flash_log_t *log);
+
+void flash_log_get_stats (const flash_log_t *log, flash_log_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
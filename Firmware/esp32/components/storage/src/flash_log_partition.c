@@ -0,0 +1,46 @@
+#include "esp_log.h"
+#include "esp_partition.h"
+
+#include "flash_log_partition.h"
+
+#define TAG "FLASH LOG"
+
+/* Erase unit of the log: a 64 kB block when the partition is made of
+ * whole blocks, erased with one block command in about three times the time
+ * of a 4 kB sector, else the sector */
+static size_t erase_len (const esp_partition_t *partition) {
+  if (partition->address % FLASH_LOG_BLOCK_LEN == 0 && partition->size % FLASH_LOG_BLOCK_LEN == 0) return FLASH_LOG_BLOCK_LEN;
+  return SPI_FLASH_SEC_SIZE;
+}
+
+static bool partition_erase (void *ctx, size_t offset) {
+  const esp_partition_t *partition = (const esp_partition_t*) ctx;
+  return esp_partition_erase_range(partition, offset, erase_len(partition)) == ESP_OK;
+}
+
+static bool partition_write (void *ctx, size_t offset, const void *data, size_t len) {
+  return esp_partition_write((const esp_partition_t*) ctx, offset, data, len) == ESP_OK;
+}
+
+static bool partition_read (void *ctx, size_t offset, void *data, size_t len) {
+  return esp_partition_read((const esp_partition_t*) ctx, offset, data, len) == ESP_OK;
+}
+
+bool flash_log_partition (flash_log_flash_t *flash, const char *label) {
+  const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+  if (partition == NULL) {
+    ESP_LOGE(TAG, "no partition %s", label);
+    return false;
+  }
+  size_t sector_len = erase_len(partition);
+  *flash = (flash_log_flash_t) {
+    .len = partition->size / sector_len * sector_len,
+    .sector_len = sector_len,
+    .erase = partition_erase,
+    .write = partition_write,
+    .read = partition_read,
+    .ctx = (void*) partition
+  };
+  ESP_LOGI(TAG, "partition %s, %u kB at %#x, erased by %zu kB", label, partition->size / 1024, partition->address, sector_len / 1024);
+  return true;
+}
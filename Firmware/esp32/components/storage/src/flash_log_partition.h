@@ -0,0 +1,26 @@
+/**
+ * @file flash_log_partition.h
+ *
+ * @brief Flash log area over a raw data partition, written through
+ * esp_partition without a file system. The log sectors are the 64 kB
+ * erase blocks of the chip when the partition is aligned on them: the
+ * erases take most of the write time and a block erase clears sixteen
+ * sectors in about three sector erase times.
+ */
+#ifndef FLASH_LOG_PARTITION_H
+#define FLASH_LOG_PARTITION_H
+
+#include <stdbool.h>
+
+#include "flash_log.h"
+
+/* Block erase unit of the SPI NOR flash */
+#define FLASH_LOG_BLOCK_LEN (64 * 1024)
+
+/**
+ * @brief Finds the data partition by label
+ * @returns false if partitions.csv has none
+ */
+bool flash_log_partition (flash_log_flash_t *flash, const char *label);
+
+#endif
@@ -0,0 +1,64 @@
+#include <string.h>
+
+#include "sample_backlog.h"
+
+bool sample_backlog_init (sample_backlog_t *backlog, const backlog_storage_t *storage, size_t block_samples) {
+  size_t slot_len = sizeof(backlog_block_t) + block_samples * sizeof(int16_t);
+  /* Header of the next slot stays aligned */
+  slot_len = (slot_len + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+  if (block_samples == 0 || block_samples > UINT16_MAX || storage->len / slot_len < 2) return false;
+
+  memset(backlog, 0, sizeof(*backlog));
+  backlog->storage = *storage;
+  backlog->block_samples = block_samples;
+  backlog->slot_len = slot_len;
+  backlog->n_slots = storage->len / slot_len;
+  backlog->stats.capacity = backlog->n_slots * block_samples;
+  return true;
+}
+
+static size_t slot_offset (const sample_backlog_t *backlog, uint32_t slot) {
+  return (size_t) (slot % backlog->n_slots) * backlog->slot_len;
+}
+
+bool sample_backlog_push (sample_backlog_t *backlog, const backlog_block_t *block, const int16_t *samples) {
+  if (block->count == 0 || block->count > backlog->block_samples) return false;
+  if (backlog->head - backlog->tail == backlog->n_slots) {
+    backlog->stats.full++;
+    return false;
+  }
+  const backlog_storage_t *storage = &backlog->storage;
+  size_t offset = slot_offset(backlog, backlog->head);
+  if (!storage->write(storage->ctx, offset, block, sizeof(*block))) return false;
+  if (!storage->write(storage->ctx, offset + sizeof(*block), samples, block->count * sizeof(int16_t))) return false;
+
+  backlog->head++;
+  backlog->stats.blocks_in++;
+  backlog->stats.depth += block->count;
+  if (backlog->stats.depth > backlog->stats.high_water) backlog->stats.high_water = backlog->stats.depth;
+  return true;
+}
+
+bool sample_backlog_pop (sample_backlog_t *backlog, backlog_block_t *block, int16_t *samples) {
+  const backlog_storage_t *storage = &backlog->storage;
+  sample_backlog_stats_t *stats = &backlog->stats;
+  while (!sample_backlog_empty(backlog)) {
+    size_t offset = slot_offset(backlog, backlog->tail++);
+    if (!storage->read(storage->ctx, offset, block, sizeof(*block)) || block->count > backlog->block_samples) continue;
+    stats->depth -= block->count < stats->depth ? block->count : stats->depth;
+    if (storage->read(storage->ctx, offset + sizeof(*block), samples, block->count * sizeof(int16_t))) {
+      stats->blocks_out++;
+      return true;
+    }
+    stats->discarded += block->count;
+  }
+  /* A slot with an unreadable header took its count along */
+  stats->depth = 0;
+  return false;
+}
+
+void sample_backlog_clear (sample_backlog_t *backlog) {
+  backlog->stats.discarded += backlog->stats.depth;
+  backlog->stats.depth = 0;
+  backlog->tail = backlog->head;
+}
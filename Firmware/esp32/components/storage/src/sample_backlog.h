@@ -0,0 +1,94 @@
+/**
+ * @file sample_backlog.h
+ *
+ * @brief Second buffering tier behind the acquisition ring. When the link
+ * stalls the reader moves ring blocks into a large backlog instead of
+ * letting the ring overrun, and sends them from there as fast as the link
+ * takes them, oldest first. Each block keeps the index, time and rate of its
+ * first sample so the frames sent late carry the stream position they had.
+ *
+ * The storage is cut into fixed slots of one block header and block_samples
+ * samples, used as a FIFO. Written and read by one task, the stats may be
+ * read from any task and are only consistent field by field.
+ */
+#ifndef SAMPLE_BACKLOG_H
+#define SAMPLE_BACKLOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "backlog_storage.h"
+
+/* Stream position of the samples of one slot */
+typedef struct backlog_block_t {
+  uint64_t first_sample;
+  int64_t timestamp;
+  float sample_rate;
+  uint16_t count;
+  /** stream_frame_flags_t of the frame the block is sent in */
+  uint16_t flags;
+} backlog_block_t;
+
+typedef struct sample_backlog_stats_t {
+  /** Samples the slots hold, waiting now and the most that ever waited */
+  uint32_t capacity;
+  uint32_t depth;
+  uint32_t high_water;
+  /** Blocks stored and sent */
+  uint32_t blocks_in;
+  uint32_t blocks_out;
+  /** Blocks refused because every slot was taken */
+  uint32_t full;
+  /** Samples thrown away by sample_backlog_clear() or a storage error */
+  uint32_t discarded;
+} sample_backlog_stats_t;
+
+typedef struct sample_backlog_t {
+  backlog_storage_t storage;
+  size_t block_samples;
+  size_t slot_len;
+  uint32_t n_slots;
+  /** Slots ever written and ever read */
+  uint32_t head;
+  uint32_t tail;
+  sample_backlog_stats_t stats;
+} sample_backlog_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Cuts the storage into slots of block_samples samples
+ * @returns false if the storage holds less than two slots
+ */
+bool sample_backlog_init (sample_backlog_t *backlog, const backlog_storage_t *storage, size_t block_samples);
+
+/**
+ * @brief Appends block->count samples, at most block_samples
+ * @returns false if every slot is taken or the storage failed, the samples
+ * were not stored
+ */
+bool sample_backlog_push (sample_backlog_t *backlog, const backlog_block_t *block, const int16_t *samples);
+
+/**
+ * @brief Takes the oldest block out, samples holds block_samples samples. A
+ * block the storage fails to read is discarded and the next one returned
+ * @returns false if the backlog is empty
+ */
+bool sample_backlog_pop (sample_backlog_t *backlog, backlog_block_t *block, int16_t *samples);
+
+/** @brief Discards every block */
+void sample_backlog_clear (sample_backlog_t *backlog);
+
+static inline bool sample_backlog_empty (const sample_backlog_t *backlog) {
+  return backlog->head == backlog->tail;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
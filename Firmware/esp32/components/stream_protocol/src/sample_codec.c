@@ -0,0 +1,101 @@
+#include "sample_codec.h"
+
+#ifndef IRAM_ATTR
+#define IRAM_ATTR
+#endif
+
+#define min(x,y) ( \
+    { __auto_type __x = (x); __auto_type __y = (y); \
+      __x < __y ? __x : __y; })
+
+typedef struct bit_writer_t {
+  uint8_t *p;
+  uint32_t acc;
+  int bits;
+} bit_writer_t;
+
+/* len up to 24 bits, less than 8 bits are kept in acc between calls */
+static inline void put_bits (bit_writer_t *w, uint32_t value, int len) {
+  w->acc = (w->acc << len) | value;
+  w->bits += len;
+  while (w->bits >= 8) {
+    w->bits -= 8;
+    *w->p++ = (uint8_t) (w->acc >> w->bits);
+  }
+}
+
+static inline uint32_t zigzag (int32_t delta) {
+  return ((uint32_t) delta << 1) ^ (uint32_t) (delta >> 31);
+}
+
+static inline size_t rice_bits (const uint32_t *u, size_t n, int k) {
+  size_t bits = n * (k + 1);
+  for (size_t i = 0; i < n; i++) bits += u[i] >> k;
+  return bits;
+}
+
+/* Picks the cheapest k around the estimate from the block mean */
+static int choose_k (const uint32_t *u, size_t n, size_t *bits) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i < n; i++) sum += u[i];
+  uint32_t mean = sum / n;
+  int k = 0;
+  while (k < SAMPLE_CODEC_MAX_K && (2u << k) <= mean) k++;
+
+  int best_k = SAMPLE_CODEC_VERBATIM;
+  size_t best = 16 * n;
+  for (int c = k > 0 ? k - 1 : 0; c <= min(k + 1, SAMPLE_CODEC_MAX_K); c++) {
+    size_t cost = rice_bits(u, n, c);
+    if (cost < best) {
+      best = cost;
+      best_k = c;
+    }
+  }
+  *bits = best;
+  return best_k;
+}
+
+size_t IRAM_ATTR sample_codec_encode (const int16_t *samples, size_t len, uint8_t *out, size_t out_len, size_t *consumed) {
+  *consumed = 0;
+  if (len == 0 || out_len < 2) return 0;
+  len = min(len, (size_t) SAMPLE_CODEC_MAX_SAMPLES);
+
+  bit_writer_t w = { .p = out, .acc = 0, .bits = 0 };
+  size_t max_bits = out_len * 8;
+  size_t used_bits = 16;
+  put_bits(&w, (uint16_t) samples[0], 16);
+
+  size_t pos = 1;
+  uint32_t u[SAMPLE_CODEC_BLOCK_LEN];
+  while (pos < len) {
+    size_t n = min(len - pos, (size_t) SAMPLE_CODEC_BLOCK_LEN);
+    for (size_t i = 0; i < n; i++) {
+      u[i] = zigzag((int32_t) samples[pos + i] - samples[pos + i - 1]);
+    }
+    size_t block_bits;
+    int k = choose_k(u, n, &block_bits);
+    if (used_bits + SAMPLE_CODEC_K_BITS + block_bits > max_bits) break;
+    used_bits += SAMPLE_CODEC_K_BITS + block_bits;
+
+    put_bits(&w, k, SAMPLE_CODEC_K_BITS);
+    if (k == SAMPLE_CODEC_VERBATIM) {
+      for (size_t i = 0; i < n; i++) put_bits(&w, (uint16_t) samples[pos + i], 16);
+    } else {
+      uint32_t mask = (1u << k) - 1;
+      for (size_t i = 0; i < n; i++) {
+        uint32_t q = u[i] >> k;
+        while (q >= 24) {
+          put_bits(&w, 0, 24);
+          q -= 24;
+        }
+        put_bits(&w, 1, q + 1);
+        if (k > 0) put_bits(&w, u[i] & mask, k);
+      }
+    }
+    pos += n;
+  }
+  if (w.bits > 0) put_bits(&w, 0, 8 - w.bits);
+
+  *consumed = pos;
+  return w.p - out;
+}
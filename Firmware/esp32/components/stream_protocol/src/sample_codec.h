@@ -0,0 +1,45 @@
+/**
+ * @file sample_codec.h
+ *
+ * @brief Lossless compression of int16 sample frames, payload of the
+ * STREAM_FRAME_SAMPLES_RICE frame type.
+ *
+ * The payload is an MSB first bit stream: the first sample as 16 bits, then
+ * the deltas between consecutive samples in blocks of SAMPLE_CODEC_BLOCK_LEN.
+ * Each block starts with a 5 bit parameter k:
+ *  - 0 to 16: every delta is zigzag mapped to u and Rice coded, u >> k as
+ *    that many zero bits and a one, then the k low bits of u.
+ *  - SAMPLE_CODEC_VERBATIM: the samples themselves follow as 16 bits each.
+ * The last block may be shorter, the stream is zero padded to a byte.
+ * Frames decode on their own, a lost frame does not affect the next one.
+ */
+#ifndef SAMPLE_CODEC_H
+#define SAMPLE_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SAMPLE_CODEC_BLOCK_LEN  (32)
+#define SAMPLE_CODEC_K_BITS     (5)
+#define SAMPLE_CODEC_MAX_K      (16)
+#define SAMPLE_CODEC_VERBATIM   (31)
+/** Most samples a compressed frame may carry */
+#define SAMPLE_CODEC_MAX_SAMPLES (4096)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Encodes as many whole blocks of samples as fit in out
+ * @param consumed set to the number of samples encoded
+ * @return bytes written to out
+ */
+size_t sample_codec_encode (const int16_t *samples, size_t len, uint8_t *out, size_t out_len, size_t *consumed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
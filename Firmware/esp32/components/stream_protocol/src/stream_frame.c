@@ -0,0 +1,191 @@
+#include <string.h>
+
+#include "stream_frame.h"
+
+#define min(x,y) ( \
+    { __auto_type __x = (x); __auto_type __y = (y); \
+      __x < __y ? __x : __y; })
+
+#define CRC_LEN (offsetof(stream_frame_header_t, crc))
+
+static const uint8_t magic_bytes[4] = { 'P', 'A', 'S', 'F' };
+
+static uint32_t crc_table[256];
+static bool crc_table_ready = false;
+
+static void crc_table_init () {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+    crc_table[i] = c;
+  }
+  crc_table_ready = true;
+}
+
+uint32_t stream_frame_crc32 (uint32_t crc, const void *data, size_t len) {
+  if (!crc_table_ready) crc_table_init();
+  const uint8_t *p = (const uint8_t*) data;
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc = crc_table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+void stream_frame_init_header (
+  stream_frame_header_t *header, stream_frame_type_t type, uint16_t flags,
+  uint32_t sequence, uint64_t first_sample, int64_t timestamp, float sample_rate,
+  uint16_t sample_count, uint16_t payload_len
+) {
+  header->magic = STREAM_FRAME_MAGIC;
+  header->version = STREAM_FRAME_VERSION;
+  header->type = type;
+  header->flags = flags;
+  header->sequence = sequence;
+  header->sample_count = sample_count;
+  header->payload_len = payload_len;
+  header->first_sample = first_sample;
+  header->timestamp = timestamp;
+  header->sample_rate = sample_rate;
+  header->crc = 0;
+}
+
+static uint32_t frame_crc (const stream_frame_header_t *header, const void *payload) {
+  uint32_t crc = stream_frame_crc32(0, header, CRC_LEN);
+  return stream_frame_crc32(crc, payload, header->payload_len);
+}
+
+void stream_frame_seal (stream_frame_header_t *header, const void *payload) {
+  header->crc = frame_crc(header, payload);
+}
+
+static bool header_valid (const stream_frame_header_t *header) {
+  return header->magic == STREAM_FRAME_MAGIC
+    && header->version == STREAM_FRAME_VERSION
+    && header->payload_len <= STREAM_FRAME_MAX_PAYLOAD;
+}
+
+bool stream_frame_stamp_transmit (uint8_t *frame, size_t len, int64_t now) {
+  stream_frame_header_t header;
+  if (len < STREAM_FRAME_HEADER_LEN + sizeof(stream_time_t)) return false;
+  memcpy(&header, frame, sizeof(header));
+  if (header.type != STREAM_FRAME_TIME || !header_valid(&header)) return false;
+  if (header.payload_len < sizeof(stream_time_t) || len < STREAM_FRAME_HEADER_LEN + header.payload_len) return false;
+  uint8_t *payload = &frame[STREAM_FRAME_HEADER_LEN];
+  memcpy(&payload[offsetof(stream_time_t, transmit)], &now, sizeof(now));
+  stream_frame_seal(&header, payload);
+  memcpy(&frame[offsetof(stream_frame_header_t, crc)], &header.crc, sizeof(header.crc));
+  return true;
+}
+
+bool stream_frame_is_samples (uint8_t type) {
+  return type == STREAM_FRAME_SAMPLES || type == STREAM_FRAME_SAMPLES_RICE;
+}
+
+bool stream_frame_check (const stream_frame_header_t *header, const void *payload) {
+  return header_valid(header) && frame_crc(header, payload) == header->crc;
+}
+
+void stream_decoder_init (stream_decoder_t *decoder) {
+  memset(decoder, 0, sizeof(stream_decoder_t));
+}
+
+/* Offset of the first position that can be the start of a frame */
+static size_t find_magic (const uint8_t *p, size_t avail) {
+  for (size_t i = 0; i < avail; i++) {
+    size_t n = min(avail - i, sizeof(magic_bytes));
+    if (memcmp(&p[i], magic_bytes, n) == 0) return i;
+  }
+  return avail;
+}
+
+static void on_valid_frame (stream_decoder_t *decoder, const stream_frame_header_t *header) {
+  stream_decoder_stats_t *stats = &decoder->stats;
+  if (decoder->synced) {
+    /* A sequence going back means the sender restarted, not lost frames */
+    int32_t sequence_gap = (int32_t) (header->sequence - decoder->next_sequence);
+    if (sequence_gap > 0) stats->lost_frames += sequence_gap;
+    if (stream_frame_is_samples(header->type) && header->first_sample > decoder->next_sample) {
+      stats->lost_samples += header->first_sample - decoder->next_sample;
+    }
+  }
+  if (header->flags & STREAM_FLAG_OVERRUN) stats->overrun_flags++;
+  decoder->synced = true;
+  decoder->next_sequence = header->sequence + 1;
+  if (stream_frame_is_samples(header->type)) {
+    decoder->next_sample = header->first_sample + header->sample_count;
+    stats->samples += header->sample_count;
+  }
+  stats->frames++;
+}
+
+/**
+ * Decodes every complete frame in p, discarding bytes that can't be the start
+ * of a frame.
+ * @return bytes consumed, what is left is the beginning of a frame
+ */
+static size_t parse (stream_decoder_t *decoder, const uint8_t *p, size_t avail, stream_frame_cb cb, void *arg, size_t *frames) {
+  size_t used = 0;
+  while (used < avail) {
+    size_t skip = find_magic(&p[used], avail - used);
+    decoder->stats.skipped_bytes += skip;
+    used += skip;
+    if (avail - used < STREAM_FRAME_HEADER_LEN) break;
+
+    stream_frame_header_t header;
+    memcpy(&header, &p[used], STREAM_FRAME_HEADER_LEN);
+    if (!header_valid(&header)) {
+      /* False magic, search again from the next byte */
+      decoder->stats.skipped_bytes++;
+      used++;
+      continue;
+    }
+    size_t frame_len = STREAM_FRAME_HEADER_LEN + header.payload_len;
+    if (avail - used < frame_len) break;
+
+    const uint8_t *payload = &p[used + STREAM_FRAME_HEADER_LEN];
+    if (frame_crc(&header, payload) != header.crc) {
+      decoder->stats.crc_errors++;
+      decoder->stats.skipped_bytes++;
+      used++;
+      continue;
+    }
+    on_valid_frame(decoder, &header);
+    if (cb != NULL) cb(&header, payload, arg);
+    (*frames)++;
+    used += frame_len;
+  }
+  return used;
+}
+
+/* Bytes still missing for the frame starting at the decoder buffer */
+static size_t missing_bytes (stream_decoder_t *decoder) {
+  if (decoder->fill < STREAM_FRAME_HEADER_LEN) return STREAM_FRAME_HEADER_LEN - decoder->fill;
+  const stream_frame_header_t *header = (const stream_frame_header_t*) decoder->buf;
+  size_t frame_len = STREAM_FRAME_HEADER_LEN + min(header->payload_len, STREAM_FRAME_MAX_PAYLOAD);
+  return frame_len > decoder->fill ? frame_len - decoder->fill : 1;
+}
+
+size_t stream_decoder_push (stream_decoder_t *decoder, const uint8_t *data, size_t len, stream_frame_cb cb, void *arg) {
+  size_t frames = 0;
+  while (len > 0) {
+    if (decoder->fill == 0) {
+      /* Aligned with the stream, decode straight from the input */
+      size_t used = parse(decoder, data, len, cb, arg, &frames);
+      memcpy(decoder->buf, &data[used], len - used);
+      decoder->fill = len - used;
+      break;
+    }
+    /* Complete the pending frame, copying only the bytes it needs */
+    size_t take = min(len, missing_bytes(decoder));
+    memcpy(&decoder->buf[decoder->fill], data, take);
+    decoder->fill += take;
+    data += take;
+    len -= take;
+
+    size_t used = parse(decoder, decoder->buf, decoder->fill, cb, arg, &frames);
+    memmove(decoder->buf, &decoder->buf[used], decoder->fill - used);
+    decoder->fill -= used;
+  }
+  return frames;
+}
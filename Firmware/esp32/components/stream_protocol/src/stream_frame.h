@@ -0,0 +1,480 @@
+/**
+ * @file stream_frame.h
+ *
+ * @brief Binary frame format of the data stream on the TCP data port, shared
+ * by the firmware (encoder) and the host tools (reference decoder).
+ *
+ * Every frame is a fixed 40 byte little endian header followed by payload_len
+ * bytes. The CRC-32 (IEEE 802.3, same as zlib) covers the header up to the crc
+ * field and the payload. Frames are sized so a full frame fills one TCP segment.
+ */
+#ifndef STREAM_FRAME_H
+#define STREAM_FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define STREAM_FRAME_MAGIC    (0x46534150) /* "PASF" in little endian */
+/* 2: angle prefix, calibrated samples and 152 byte stats, decoders drop other versions */
+#define STREAM_FRAME_VERSION  (2)
+
+#ifdef CONFIG_LWIP_TCP_MSS
+#define STREAM_FRAME_MSS      CONFIG_LWIP_TCP_MSS
+#else
+#define STREAM_FRAME_MSS      (1440)
+#endif
+
+#define STREAM_FRAME_HEADER_LEN   (sizeof(stream_frame_header_t))
+#define STREAM_FRAME_MAX_LEN      (STREAM_FRAME_MSS)
+#define STREAM_FRAME_MAX_PAYLOAD  (STREAM_FRAME_MAX_LEN - STREAM_FRAME_HEADER_LEN)
+/** Raw int16 samples that fill exactly one segment */
+#define STREAM_FRAME_MAX_SAMPLES  (STREAM_FRAME_MAX_PAYLOAD / sizeof(int16_t))
+
+/* Payload types */
+typedef enum stream_frame_type_t {
+  /** Raw int16 ADC samples */
+  STREAM_FRAME_SAMPLES = 0,
+  /** Samples compressed with the codec in sample_codec.h */
+  STREAM_FRAME_SAMPLES_RICE = 1,
+  /** Part of a trigger capture window, stream_capture_header_t and int16 samples */
+  STREAM_FRAME_CAPTURE = 2,
+  /** Summary of a stretch of the stream, stream_features_t, no samples */
+  STREAM_FRAME_FEATURES = 3,
+  /** Acquisition instrumentation sent on request, stream_stats_t, no samples */
+  STREAM_FRAME_STATS = 4,
+  /** Answer to a clock offset request, stream_time_t, no samples */
+  STREAM_FRAME_TIME = 5,
+  /** ADC settings in use after an "adc" command, stream_adc_config_t, no samples */
+  STREAM_FRAME_ADC = 6,
+  /** Input alarm flags changed, stream_alarm_t, sent on the event port only */
+  STREAM_FRAME_ALARM = 7,
+  /** Calibration the samples are converted with, stream_calibration_t, no samples */
+  STREAM_FRAME_CALIBRATION = 8,
+  /** Baseline estimate after an amplifier reset, stream_baseline_t, no samples */
+  STREAM_FRAME_BASELINE = 9,
+  /** Peak pressure of an encoder cycle, stream_cycle_t, no samples */
+  STREAM_FRAME_CYCLE = 10
+} stream_frame_type_t;
+
+/* Header flags */
+typedef enum stream_frame_flags_t {
+  /** Samples were lost before the first sample of this frame */
+  STREAM_FLAG_OVERRUN = (1 << 0),
+  /** Samples are Q format pressure, see stream_calibration_t, not ADC codes */
+  STREAM_FLAG_CALIBRATED = (1 << 1),
+  /** The charge amplifier was reset at a sample of this frame, or between
+   * the previous frame and this one, see stream_baseline_t */
+  STREAM_FLAG_AMP_RESET = (1 << 2),
+  /** Conversions are clocked by a shaft encoder, the payload starts with
+   * stream_angle_t, see STREAM_ANGLE_MAX_SAMPLES */
+  STREAM_FLAG_ANGLE = (1 << 3)
+  /* Bit 7 is taken by the sensor internally, never sent */
+} stream_frame_flags_t;
+
+/* Low 8 bits of the calibration hash in the high byte of the flags of
+ * calibrated frames, to tell which calibration report they go with */
+#define STREAM_FLAG_CALIBRATION_TAG(hash) ((uint16_t) (((hash) & 0xff) << 8))
+#define STREAM_FLAG_GET_CALIBRATION_TAG(flags) ((uint8_t) ((flags) >> 8))
+
+typedef struct stream_frame_header_t {
+  uint32_t magic;
+  uint8_t version;
+  uint8_t type;
+  uint16_t flags;
+  uint32_t sequence;
+  uint16_t sample_count;
+  uint16_t payload_len;
+  /** Index of the first sample since the stream started, counting lost samples */
+  uint64_t first_sample;
+  /** esp_timer time of the first sample in us */
+  int64_t timestamp;
+  /** Measured sample rate in Hz */
+  float sample_rate;
+  uint32_t crc;
+} stream_frame_header_t;
+
+#ifdef __cplusplus
+static_assert(sizeof(stream_frame_header_t) == 40, "stream frame header must have no padding");
+#else
+_Static_assert(sizeof(stream_frame_header_t) == 40, "stream frame header must have no padding");
+#endif
+
+/**
+ * Leads the payload of every STREAM_FRAME_CAPTURE frame. first_sample of the
+ * frame header is the stream index of its first sample, the window starts at
+ * trigger_index - pre_trigger.
+ */
+typedef struct stream_capture_header_t {
+  uint64_t trigger_index;
+  /** Trigger counter, a window per number unless it was missed */
+  uint32_t number;
+  /** Triggers missed before this one, no capture buffer was free */
+  uint32_t missed;
+  /** Samples in the window */
+  uint32_t length;
+  uint32_t pre_trigger;
+} stream_capture_header_t;
+
+#define STREAM_CAPTURE_MAX_SAMPLES ((STREAM_FRAME_MAX_PAYLOAD - sizeof(stream_capture_header_t)) / sizeof(int16_t))
+
+#ifdef __cplusplus
+static_assert(sizeof(stream_capture_header_t) == 24, "capture header must have no padding");
+#else
+_Static_assert(sizeof(stream_capture_header_t) == 24, "capture header must have no padding");
+#endif
+
+/**
+ * Leads the payload of STREAM_FRAME_SAMPLES and STREAM_FRAME_SAMPLES_RICE
+ * frames flagged STREAM_FLAG_ANGLE, the samples or the compressed block follow.
+ * Sample first_sample + i is at angle (angle + i) % cycle_len of cycle
+ * cycle + (angle + i) / cycle_len, the angle counts conversions since TDC.
+ */
+typedef struct stream_angle_t {
+  /** Cycle of the first sample, counted from the first two TDC pulses */
+  uint32_t cycle;
+  /** Conversions from TDC to the first sample */
+  uint16_t angle;
+  /** Conversions of one cycle */
+  uint16_t cycle_len;
+  /** TDC pulses off the expected angle so far, the angle realigned on them */
+  uint32_t sync_errors;
+} stream_angle_t;
+
+#define STREAM_ANGLE_MAX_SAMPLES ((STREAM_FRAME_MAX_PAYLOAD - sizeof(stream_angle_t)) / sizeof(int16_t))
+
+#ifdef __cplusplus
+static_assert(sizeof(stream_angle_t) == 12, "angle header must have no padding");
+#else
+_Static_assert(sizeof(stream_angle_t) == 12, "angle header must have no padding");
+#endif
+
+/**
+ * Payload of a STREAM_FRAME_FEATURES frame. first_sample and timestamp of the
+ * frame header are those of the first sample covered, sample_count is 0.
+ * Values in ADC counts.
+ */
+typedef struct stream_features_t {
+  /** Samples covered, fft_len * windows */
+  uint32_t length;
+  int16_t min;
+  int16_t max;
+  float mean;
+  /** RMS around the mean */
+  float ac_rms;
+  /** Peak of the averaged Hann windowed spectrum, Hz */
+  float dominant_freq;
+  float dominant_amplitude;
+  uint16_t fft_len;
+  uint16_t windows;
+} stream_features_t;
+
+#ifdef __cplusplus
+static_assert(sizeof(stream_features_t) == 28, "features payload must have no padding");
+#else
+_Static_assert(sizeof(stream_features_t) == 28, "features payload must have no padding");
+#endif
+
+#define STREAM_STATS_JITTER_BINS (12)
+#define STREAM_STATS_JITTER_BIN_NS (50)
+/* Pipeline stages of stage_load: acquire, process, transmit and record */
+#define STREAM_STATS_STAGES (4)
+
+/**
+ * Payload of a STREAM_FRAME_STATS frame, also the value of the BLE stats
+ * characteristic. first_sample and timestamp of the frame header are those of
+ * the last sample acquired, sample_count is 0.
+ */
+typedef struct stream_stats_t {
+  /** Samples acquired, including the ones lost to overruns */
+  uint64_t produced;
+  /** Samples queued for the clients */
+  uint64_t sent;
+  /** Samples per second over the last full second */
+  float produced_rate;
+  float sent_rate;
+  uint32_t overruns;
+  uint32_t dropped;
+  /** Acquisition ring length and its highest fill, samples */
+  uint32_t ring_len;
+  uint32_t ring_high_water;
+  /** Conversion timer interrupts and their latency from the alarm */
+  uint32_t timer_count;
+  uint32_t isr_latency_min_ns;
+  uint32_t isr_latency_max_ns;
+  uint32_t isr_latency_mean_ns;
+  /** Deviation of the conversion period from the nominal one, bin 0 below
+   * STREAM_STATS_JITTER_BIN_NS and doubling from there, the last is open */
+  uint32_t jitter_max_ns;
+  uint32_t jitter_hist[STREAM_STATS_JITTER_BINS];
+  /** Blocks the TCP client tasks sent and how long their socket took to
+   * accept each, percentiles are upper bin edges */
+  uint32_t sends;
+  uint32_t send_p50_us;
+  uint32_t send_p90_us;
+  uint32_t send_p99_us;
+  uint32_t send_max_us;
+  /** Samples the backlog behind the ring holds, waiting to be sent now and
+   * at most, 0 without a backlog. Blocks refused when it was full */
+  uint32_t backlog_capacity;
+  uint32_t backlog_depth;
+  uint32_t backlog_high_water;
+  uint32_t backlog_full;
+  /** CPU time of each pipeline stage since the last report, permille of a
+   * core, 0 for a stage that does not run */
+  uint16_t stage_load[STREAM_STATS_STAGES];
+} stream_stats_t;
+
+#ifdef __cplusplus
+static_assert(sizeof(stream_stats_t) == 152, "stats payload must have no padding");
+#else
+_Static_assert(sizeof(stream_stats_t) == 152, "stats payload must have no padding");
+#endif
+
+/**
+ * Payload of a STREAM_FRAME_TIME frame, the answer to a "time <origin>"
+ * command. With the host time the frame arrived, the four times of an NTP
+ * exchange: the clock offset is ((receive - origin) + (transmit - arrival)) / 2
+ * give or take half the round trip. first_sample and timestamp of the frame
+ * header are those of the last sample acquired, sample_count is 0.
+ */
+typedef struct stream_time_t {
+  /** Host time the request was sent, echoed as written in the command */
+  int64_t origin;
+  /** esp_timer time the command was read, us */
+  int64_t receive;
+  /** esp_timer time the frame was handed to the socket, us, see stream_frame_stamp_transmit() */
+  int64_t transmit;
+} stream_time_t;
+
+#ifdef __cplusplus
+static_assert(sizeof(stream_time_t) == 24, "time payload must have no padding");
+#else
+_Static_assert(sizeof(stream_time_t) == 24, "time payload must have no padding");
+#endif
+
+/**
+ * Payload of a STREAM_FRAME_ADC frame, the answer to an "adc" command: the
+ * settings in use once the stream restarted, or the ones kept when the
+ * request was rejected. The sample index starts over from 0 on a restart.
+ * first_sample and timestamp of the frame header are those of the last
+ * sample acquired, sample_count is 0.
+ */
+typedef struct stream_adc_config_t {
+  /** Rate asked for and rate the conversion timer runs at, Hz */
+  float requested_rate;
+  float sample_rate;
+  /** SPI clock the divider gives, Hz */
+  uint32_t spi_clock;
+  /** RANGE_SEL code, ads8689_range_t */
+  uint8_t range;
+  /** 0 for SDO-0 only, 1 for SDO-0 and SDO-1 */
+  uint8_t sdo_mode;
+  uint8_t alarm_hysteresis;
+  /** Non zero if the request was out of range and nothing changed */
+  uint8_t rejected;
+  /** Input alarm thresholds, output codes */
+  uint16_t alarm_high;
+  uint16_t alarm_low;
+} stream_adc_config_t;
+
+#ifdef __cplusplus
+static_assert(sizeof(stream_adc_config_t) == 20, "adc payload must have no padding");
+#else
+_Static_assert(sizeof(stream_adc_config_t) == 20, "adc payload must have no padding");
+#endif
+
+/**
+ * Payload of a STREAM_FRAME_ALARM frame, sent on the event port as soon as the
+ * ADC input alarm flags change. first_sample of the frame header is the index
+ * of the first sample with the new flags, timestamp its conversion time, and
+ * sample_count is 0. The frames have their own sequence numbers.
+ */
+typedef struct stream_alarm_t {
+  /** Alarm events since boot */
+  uint32_t number;
+  /** Input alarm flags from this sample on and before it: bit 0 low, bit 1 high */
+  uint8_t flags;
+  uint8_t previous;
+  int16_t sample;
+  /** esp_timer time the stream ISR found the change, us */
+  int64_t detected;
+  /** esp_timer time the frame was handed to the socket, us */
+  int64_t sent;
+  /** Longest conversion to socket time of all the events so far, us */
+  uint32_t latency_max_us;
+  /** Events lost to a full queue */
+  uint32_t lost;
+} stream_alarm_t;
+
+#ifdef __cplusplus
+static_assert(sizeof(stream_alarm_t) == 32, "alarm payload must have no padding");
+#else
+_Static_assert(sizeof(stream_alarm_t) == 32, "alarm payload must have no padding");
+#endif
+
+/**
+ * Payload of a STREAM_FRAME_CALIBRATION frame, sent after the stream starts
+ * or restarts and on a "calibration" command. Samples of frames flagged
+ * STREAM_FLAG_CALIBRATED are pressure in bar * 2^frac_bits. first_sample and
+ * timestamp of the frame header are those of the last sample acquired,
+ * sample_count is 0.
+ */
+typedef struct stream_calibration_t {
+  /** Identifies the calibration, its low byte tags the sample frames */
+  uint32_t hash;
+  int8_t frac_bits;
+  /** 0 when the samples are ADC codes, only range and lsb_volts are then set */
+  uint8_t enabled;
+  /** RANGE_SEL code, ads8689_range_t, and its input step in volts */
+  uint16_t range;
+  float lsb_volts;
+  /** Model of the calibration record, see calibration.h */
+  float gain;
+  int32_t offset;
+  float amp_range_pc;
+  float amp_full_scale_v;
+  /** pC/bar, ppm/°C */
+  float sensitivity;
+  float sensitivity_drift;
+  /** bar/°C */
+  float zero_drift;
+  float reference_temp;
+  float temperature;
+} stream_calibration_t;
+
+#ifdef __cplusplus
+static_assert(sizeof(stream_calibration_t) == 48, "calibration payload must have no padding");
+#else
+_Static_assert(sizeof(stream_calibration_t) == 48, "calibration payload must have no padding");
+#endif
+
+/**
+ * Payload of a STREAM_FRAME_BASELINE frame, sent once an amplifier reset took
+ * effect and on a "baseline" command. first_sample and timestamp of the frame
+ * header are those of the last sample corrected, sample_count is 0. Levels in
+ * ADC codes, before the correction.
+ */
+typedef struct stream_baseline_t {
+  /** ADC sample index the last amplifier reset took effect at, also in the
+   * decimated stream */
+  uint64_t reset_index;
+  uint32_t resets;
+  /** Cycles pegged so far */
+  uint32_t pegs;
+  /** Estimate at first_sample and the amplifier output at rest */
+  float level;
+  float rest;
+  /** Slope of the estimate, codes/s */
+  float drift;
+  /** Code the corrected baseline sits at */
+  int16_t reference;
+  /** baseline_peg_t */
+  uint8_t peg;
+  /** 1 while a reset is scheduled */
+  uint8_t reset_pending;
+} stream_baseline_t;
+
+#ifdef __cplusplus
+static_assert(sizeof(stream_baseline_t) == 32, "baseline payload must have no padding");
+#else
+_Static_assert(sizeof(stream_baseline_t) == 32, "baseline payload must have no padding");
+#endif
+
+/**
+ * Payload of a STREAM_FRAME_CYCLE frame, sent for each whole cycle of an
+ * encoder clocked stream, see cycle_peak.h. first_sample and timestamp of the
+ * frame header are those of angle 0, sample_count is 0. Values in ADC codes,
+ * after the baseline correction, peak to peak is max - min.
+ */
+typedef struct stream_cycle_t {
+  uint32_t cycle;
+  uint16_t cycle_len;
+  int16_t max;
+  uint16_t max_angle;
+  int16_t min;
+  uint16_t min_angle;
+  uint16_t reserved;
+} stream_cycle_t;
+
+#ifdef __cplusplus
+static_assert(sizeof(stream_cycle_t) == 16, "cycle payload must have no padding");
+#else
+_Static_assert(sizeof(stream_cycle_t) == 16, "cycle payload must have no padding");
+#endif
+
+typedef struct stream_decoder_stats_t {
+  uint64_t frames;
+  uint64_t samples;
+  uint64_t skipped_bytes;
+  uint64_t lost_samples;
+  uint32_t lost_frames;
+  uint32_t crc_errors;
+  uint32_t overrun_flags;
+} stream_decoder_stats_t;
+
+typedef void (*stream_frame_cb) (const stream_frame_header_t *header, const uint8_t *payload, void *arg);
+
+/**
+ * Streaming decoder, accepts the TCP byte stream in chunks of any size and
+ * resynchronizes on the magic number after corrupted or missing bytes.
+ */
+typedef struct stream_decoder_t {
+  uint8_t buf[STREAM_FRAME_MAX_LEN];
+  size_t fill;
+  bool synced;
+  uint32_t next_sequence;
+  uint64_t next_sample;
+  stream_decoder_stats_t stats;
+} stream_decoder_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** @brief CRC-32 (IEEE), start with crc = 0 and feed the result back to continue */
+uint32_t stream_frame_crc32 (uint32_t crc, const void *data, size_t len);
+
+/**
+ * @brief Fills a frame header, crc is computed by stream_frame_seal()
+ */
+void stream_frame_init_header (
+  stream_frame_header_t *header, stream_frame_type_t type, uint16_t flags,
+  uint32_t sequence, uint64_t first_sample, int64_t timestamp, float sample_rate,
+  uint16_t sample_count, uint16_t payload_len
+);
+
+/** @brief Computes and stores the header crc over header and payload */
+void stream_frame_seal (stream_frame_header_t *header, const void *payload);
+
+/**
+ * @brief Writes the transmit time of a sealed STREAM_FRAME_TIME frame and seals
+ * it again, right before the transport sends it. Other frames are left as is
+ * @param frame header and payload, len bytes
+ * @returns true if the frame was a time frame
+ */
+bool stream_frame_stamp_transmit (uint8_t *frame, size_t len, int64_t now);
+
+/** @brief True for the frame types that carry ADC samples */
+bool stream_frame_is_samples (uint8_t type);
+
+/** @brief Verifies magic, version, length and crc of a complete frame */
+bool stream_frame_check (const stream_frame_header_t *header, const void *payload);
+
+void stream_decoder_init (stream_decoder_t *decoder);
+
+/**
+ * @brief Feeds received bytes to the decoder, cb is called for each valid frame.
+ * The payload pointer may point into data or into the decoder buffer and is
+ * only valid during the callback.
+ *
+ * @return number of frames decoded
+ */
+size_t stream_decoder_push (stream_decoder_t *decoder, const uint8_t *data, size_t len, stream_frame_cb cb, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
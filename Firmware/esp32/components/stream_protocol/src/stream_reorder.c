@@ -0,0 +1,119 @@
+#include <string.h>
+#include <stddef.h>
+
+#include "stream_reorder.h"
+
+/* A sequence this far behind is a restarted sender, not a late frame */
+#define RESTART_GAP (1024)
+
+void stream_reorder_init (stream_reorder_t *reorder, size_t window, int64_t max_delay_us) {
+  memset(reorder, 0, sizeof(*reorder));
+  if (window < 1) window = 1;
+  if (window > STREAM_REORDER_MAX_WINDOW) window = STREAM_REORDER_MAX_WINDOW;
+  reorder->window = window;
+  reorder->max_delay_us = max_delay_us;
+}
+
+/* Hands out the next expected frame and the ones following it, while they are held */
+static void deliver_ready (stream_reorder_t *reorder, stream_reorder_cb cb, void *arg) {
+  while (reorder->held > 0) {
+    size_t slot = reorder->next_sequence % reorder->window;
+    if (reorder->len[slot] == 0 || reorder->sequence[slot] != reorder->next_sequence) break;
+    cb(reorder->frames[slot], reorder->len[slot], arg);
+    reorder->len[slot] = 0;
+    reorder->held--;
+    reorder->next_sequence++;
+  }
+}
+
+/* Gives up the frames missing before the oldest one held */
+static void skip_missing (stream_reorder_t *reorder, stream_reorder_cb cb, void *arg) {
+  uint32_t first = 0;
+  bool found = false;
+  for (size_t i = 0; i < reorder->window; i++) {
+    if (reorder->len[i] == 0) continue;
+    uint32_t ahead = reorder->sequence[i] - reorder->next_sequence;
+    if (!found || ahead < first - reorder->next_sequence) first = reorder->sequence[i];
+    found = true;
+  }
+  if (!found) return;
+  reorder->next_sequence = first;
+  deliver_ready(reorder, cb, arg);
+}
+
+int64_t stream_reorder_deadline (const stream_reorder_t *reorder) {
+  int64_t deadline = INT64_MAX;
+  for (size_t i = 0; i < reorder->window; i++) {
+    if (reorder->len[i] == 0) continue;
+    int64_t t = reorder->arrival[i] + reorder->max_delay_us;
+    if (t < deadline) deadline = t;
+  }
+  return deadline;
+}
+
+void stream_reorder_expire (stream_reorder_t *reorder, int64_t now_us, stream_reorder_cb cb, void *arg) {
+  /* Each pass hands out at least a frame */
+  while (reorder->held > 0 && stream_reorder_deadline(reorder) <= now_us) skip_missing(reorder, cb, arg);
+}
+
+void stream_reorder_push (
+  stream_reorder_t *reorder, const uint8_t *datagram, size_t len, int64_t now_us, stream_reorder_cb cb, void *arg
+) {
+  reorder->stats.datagrams++;
+  if (len < STREAM_FRAME_HEADER_LEN || len > STREAM_FRAME_MAX_LEN) {
+    reorder->stats.runts++;
+    return;
+  }
+  uint32_t sequence;
+  memcpy(&sequence, &datagram[offsetof(stream_frame_header_t, sequence)], sizeof(sequence));
+  if (!reorder->started) {
+    reorder->started = true;
+    reorder->next_sequence = sequence;
+  }
+
+  int32_t ahead = (int32_t) (sequence - reorder->next_sequence);
+  if (ahead < -RESTART_GAP) {
+    while (reorder->held > 0) skip_missing(reorder, cb, arg);
+    reorder->next_sequence = sequence;
+    ahead = 0;
+  } else if (ahead < 0) {
+    reorder->stats.late++;
+    return;
+  }
+
+  if (ahead >= (int32_t) reorder->window) {
+    /* No room, the oldest missing frames are given up */
+    uint32_t first = sequence - (reorder->window - 1);
+    while (reorder->held > 0 && (int32_t) (first - reorder->next_sequence) > 0) {
+      size_t slot = reorder->next_sequence % reorder->window;
+      if (reorder->len[slot] > 0 && reorder->sequence[slot] == reorder->next_sequence) {
+        cb(reorder->frames[slot], reorder->len[slot], arg);
+        reorder->len[slot] = 0;
+        reorder->held--;
+      }
+      reorder->next_sequence++;
+    }
+    if ((int32_t) (first - reorder->next_sequence) > 0) reorder->next_sequence = first;
+    deliver_ready(reorder, cb, arg);
+    ahead = (int32_t) (sequence - reorder->next_sequence);
+  }
+
+  if (ahead == 0) {
+    cb(datagram, len, arg);
+    reorder->next_sequence++;
+    deliver_ready(reorder, cb, arg);
+  } else {
+    size_t slot = sequence % reorder->window;
+    if (reorder->len[slot] > 0 && reorder->sequence[slot] == sequence) {
+      reorder->stats.duplicates++;
+      return;
+    }
+    memcpy(reorder->frames[slot], datagram, len);
+    reorder->len[slot] = len;
+    reorder->sequence[slot] = sequence;
+    reorder->arrival[slot] = now_us;
+    reorder->held++;
+    reorder->stats.reordered++;
+  }
+  stream_reorder_expire(reorder, now_us, cb, arg);
+}
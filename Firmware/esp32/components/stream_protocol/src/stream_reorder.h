@@ -0,0 +1,80 @@
+/**
+ * @file stream_reorder.h
+ *
+ * @brief Puts the frames of the datagram stream back in sequence order before
+ * they reach the stream decoder. Each datagram holds one frame. A frame ahead
+ * of the next expected one waits in a window of a few frames until the missing
+ * ones arrive, the window fills up or it waited max_delay_us. Then the missing
+ * frames are given up and the decoder counts them as lost. A frame arriving
+ * after its place was given up is dropped as late.
+ */
+#ifndef STREAM_REORDER_H
+#define STREAM_REORDER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "stream_frame.h"
+
+/** Largest reorder window in frames */
+#define STREAM_REORDER_MAX_WINDOW (16)
+
+typedef struct stream_reorder_stats_t {
+  uint64_t datagrams;
+  /** Frames that arrived ahead of a missing one and waited for it */
+  uint32_t reordered;
+  /** Frames that arrived after their place was given up, dropped */
+  uint32_t late;
+  uint32_t duplicates;
+  /** Datagrams too short for a frame header */
+  uint32_t runts;
+} stream_reorder_stats_t;
+
+typedef struct stream_reorder_t {
+  size_t window;
+  int64_t max_delay_us;
+  bool started;
+  uint32_t next_sequence;
+  /** Frames held, slot sequence % window */
+  uint8_t frames[STREAM_REORDER_MAX_WINDOW][STREAM_FRAME_MAX_LEN];
+  size_t len[STREAM_REORDER_MAX_WINDOW];
+  uint32_t sequence[STREAM_REORDER_MAX_WINDOW];
+  int64_t arrival[STREAM_REORDER_MAX_WINDOW];
+  size_t held;
+  stream_reorder_stats_t stats;
+} stream_reorder_t;
+
+/** Called with each frame in order, typically feeding stream_decoder_push() */
+typedef void (*stream_reorder_cb) (const uint8_t *frame, size_t len, void *arg);
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @param window frames held at most, 1 to STREAM_REORDER_MAX_WINDOW. 1 only drops late frames
+ * @param max_delay_us longest a frame waits for a missing one before it
+ */
+void stream_reorder_init (stream_reorder_t *reorder, size_t window, int64_t max_delay_us);
+
+/** @brief Feeds one datagram received at now_us, in order frames go to cb */
+void stream_reorder_push (
+  stream_reorder_t *reorder, const uint8_t *datagram, size_t len, int64_t now_us, stream_reorder_cb cb, void *arg
+);
+
+/**
+ * @brief Gives up the missing frames before the frames held longer than
+ * max_delay_us, call it when no datagram came for a while
+ */
+void stream_reorder_expire (stream_reorder_t *reorder, int64_t now_us, stream_reorder_cb cb, void *arg);
+
+/** @brief Time at which stream_reorder_expire() next has work, INT64_MAX when nothing is held */
+int64_t stream_reorder_deadline (const stream_reorder_t *reorder);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,349 @@
+/**
+ * @file bench_flash_log.c
+ *
+ * @brief Checks and benchmarks the flash log and the recorder on the flash
+ * emulator, at the typical and maximum datasheet times of the chip:
+ *  - raw append throughput of the log over the record partition,
+ *  - even wear and readback after many passes of the ring,
+ *  - recovery after power cuts at random points of the writes,
+ *  - clear surviving a remount,
+ *  - sustainable recording rate of the recorder for signals that compress
+ *    differently: samples recorded per second of busy flash, and the stream
+ *    read back from flash must be whole.
+ *
+ * usage: bench_flash_log [seed]
+ * Exits with the number of failed checks.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "flash_log.h"
+#include "stream_frame.h"
+#include "recorder.h"
+#include "flash_emulator.h"
+
+/* Size of the record partition in partitions.csv, the sector of the chip and
+ * its erase block, the log sector on the sensor (flash_log_partition.h) */
+#define PARTITION_LEN (704 * 1024)
+#define SECTOR_LEN (FLASH_EMULATOR_SECTOR_LEN)
+#define BLOCK_LEN (FLASH_EMULATOR_BLOCK_LEN)
+/* Ring and recorder slots in front of the flash, samples */
+#define RING_LEN (4096)
+/* Samples pushed to the recorder per signal */
+#define RECORD_SAMPLES (1 << 21)
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+      failures++; \
+      printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+      printf(__VA_ARGS__); \
+      printf("\n"); \
+    } \
+  } while (0)
+
+/* Record n: its number then bytes derived from it, length varies with n */
+static size_t make_record (uint32_t n, uint8_t *buf, size_t max_len) {
+  size_t len = sizeof(n) + (n * 2654435761u) % (max_len - sizeof(n));
+  memcpy(buf, &n, sizeof(n));
+  for (size_t i = sizeof(n); i < len; i++) buf[i] = (uint8_t) (n + i * 7);
+  return len;
+}
+
+static bool check_record (const uint8_t *buf, size_t len, size_t max_len, uint32_t *n) {
+  uint8_t expected[SECTOR_LEN];
+  memcpy(n, buf, sizeof(*n));
+  return make_record(*n, expected, max_len) == len && memcmp(expected, buf, len) == 0;
+}
+
+/* Reads the whole log, the record numbers must follow each other up to last */
+static uint32_t read_back (flash_log_t *log, size_t max_len, uint32_t last, const char *what) {
+  flash_log_cursor_t cursor;
+  uint8_t buf[SECTOR_LEN];
+  flash_log_rewind(log, &cursor);
+  uint32_t count = 0, previous = 0;
+  size_t len;
+  while ((len = flash_log_read(log, &cursor, buf, sizeof(buf))) > 0) {
+    uint32_t n;
+    CHECK(check_record(buf, len, max_len, &n), "%s: record %u corrupted", what, n);
+    CHECK(count == 0 || n == previous + 1, "%s: record %u after %u", what, n, previous);
+    previous = n;
+    count++;
+  }
+  CHECK(count == 0 || previous == last, "%s: last record %u, expected %u", what, previous, last);
+  return count;
+}
+
+static void bench_throughput (const char *name, const flash_timing_t *timing, size_t sector_len) {
+  flash_emulator_t emulator;
+  flash_log_flash_t flash;
+  flash_log_t log;
+  flash_emulator_init(&emulator, PARTITION_LEN, sector_len, timing);
+  flash_emulator_bind(&emulator, &flash);
+  CHECK(flash_log_mount(&log, &flash), "mount of an erased area");
+
+  /* Frames as the recorder writes them, twice around the ring */
+  static uint8_t frame[STREAM_FRAME_MAX_LEN];
+  memset(frame, 0x5A, sizeof(frame));
+  uint64_t bytes = 0;
+  while (bytes < 2 * PARTITION_LEN) {
+    size_t len = flash_log_room(&log, 256);
+    if (len > sizeof(frame)) len = sizeof(frame);
+    CHECK(flash_log_append(&log, frame, len), "append of %zu bytes", len);
+    bytes += len;
+  }
+  flash_log_stats_t stats;
+  flash_log_get_stats(&log, &stats);
+  double seconds = emulator.stats.busy_us / 1e6;
+  printf(
+    "append   %-7s %2zu kB sectors: %.1f kB/s of records, %.1f kB/s programmed, %u erases (%.0f%% of the busy time), sectors erased %u..%u times\n",
+    name, sector_len / 1024, bytes / seconds / 1e3, emulator.stats.written / seconds / 1e3, emulator.stats.erases,
+    100.0 * emulator.stats.erase_busy_us / emulator.stats.busy_us, stats.erase_min, stats.erase_max
+  );
+  CHECK(emulator.stats.violations == 0, "%u bytes written without an erase", emulator.stats.violations);
+  free(log.erases);
+  flash_emulator_free(&emulator);
+}
+
+static void test_wear () {
+  const flash_timing_t timing = FLASH_TIMING_TYPICAL();
+  const size_t max_len = 1500;
+  flash_emulator_t emulator;
+  flash_log_flash_t flash;
+  flash_log_t log;
+  flash_emulator_init(&emulator, 8 * SECTOR_LEN, SECTOR_LEN, &timing);
+  flash_emulator_bind(&emulator, &flash);
+  flash_log_mount(&log, &flash);
+
+  uint8_t buf[SECTOR_LEN];
+  uint32_t n = 0;
+  while (emulator.stats.erases < 50 * 8) {
+    size_t len = make_record(++n, buf, max_len);
+    CHECK(flash_log_append(&log, buf, len), "append of record %u", n);
+  }
+  flash_log_stats_t stats;
+  flash_log_get_stats(&log, &stats);
+  uint32_t emulated_min = UINT32_MAX, emulated_max = 0;
+  for (int i = 0; i < 8; i++) {
+    if (emulator.sector_erases[i] < emulated_min) emulated_min = emulator.sector_erases[i];
+    if (emulator.sector_erases[i] > emulated_max) emulated_max = emulator.sector_erases[i];
+  }
+  CHECK(emulated_max - emulated_min <= 1, "sectors erased %u..%u times", emulated_min, emulated_max);
+  CHECK(stats.erase_min == emulated_min && stats.erase_max == emulated_max, "erase counts %u..%u in the log", stats.erase_min, stats.erase_max);
+  CHECK(emulator.stats.violations == 0, "%u bytes written without an erase", emulator.stats.violations);
+  uint32_t count = read_back(&log, max_len, n, "wrapped log");
+  uint32_t overwritten = log.stats.overwritten;
+  free(log.erases);
+
+  /* The same records after a reset */
+  CHECK(flash_log_mount(&log, &flash), "remount");
+  CHECK(read_back(&log, max_len, n, "remounted log") == count, "record count changed on remount");
+  flash_log_get_stats(&log, &stats);
+  CHECK(stats.erase_max - stats.erase_min <= 1, "erase counts %u..%u after remount", stats.erase_min, stats.erase_max);
+  printf(
+    "wear     %u records over %u passes of 8 sectors, erases %u..%u, %u records kept, %u sectors overwritten\n",
+    n, emulator.stats.erases / 8, emulated_min, emulated_max, count, overwritten
+  );
+  free(log.erases);
+  flash_emulator_free(&emulator);
+}
+
+static void test_power_cut (unsigned trials) {
+  const flash_timing_t timing = FLASH_TIMING_TYPICAL();
+  const size_t max_len = 700;
+  unsigned torn_sectors = 0;
+  for (unsigned trial = 0; trial < trials; trial++) {
+    flash_emulator_t emulator;
+    flash_log_flash_t flash;
+    flash_log_t log;
+    flash_emulator_init(&emulator, 16 * SECTOR_LEN, SECTOR_LEN, &timing);
+    flash_emulator_bind(&emulator, &flash);
+    flash_log_mount(&log, &flash);
+
+    /* Cut somewhere in the first half of the area, nothing is overwritten */
+    flash_emulator_cut_power(&emulator, rand() % (8 * SECTOR_LEN));
+    uint8_t buf[SECTOR_LEN];
+    uint32_t n = 0;
+    while (1) {
+      size_t len = make_record(n + 1, buf, max_len);
+      if (!flash_log_append(&log, buf, len)) break;
+      n++;
+    }
+    size_t torn_at = log.offset;
+    torn_sectors += torn_at == sizeof(uint32_t) * 4;
+    free(log.erases);
+
+    flash_emulator_restore(&emulator);
+    CHECK(flash_log_mount(&log, &flash), "trial %u: remount", trial);
+    uint32_t count = read_back(&log, max_len, n, "after power cut");
+    CHECK(count == n, "trial %u: %u records of %u after the cut", trial, count, n);
+    /* Appends go on after the torn record, never over it */
+    size_t len = make_record(n + 1, buf, max_len);
+    CHECK(flash_log_append(&log, buf, len), "trial %u: append after the cut", trial);
+    CHECK(read_back(&log, max_len, n + 1, "append after power cut") == n + 1, "trial %u: record appended after the cut", trial);
+    CHECK(emulator.stats.violations == 0, "trial %u: %u bytes written without an erase", trial, emulator.stats.violations);
+    free(log.erases);
+    flash_emulator_free(&emulator);
+  }
+  printf("power    %u cuts at random points of the writes, every record appended before the cut read back\n", trials);
+}
+
+static void test_clear () {
+  const flash_timing_t timing = FLASH_TIMING_TYPICAL();
+  flash_emulator_t emulator;
+  flash_log_flash_t flash;
+  flash_log_t log;
+  flash_emulator_init(&emulator, 8 * SECTOR_LEN, SECTOR_LEN, &timing);
+  flash_emulator_bind(&emulator, &flash);
+  flash_log_mount(&log, &flash);
+
+  uint8_t buf[SECTOR_LEN];
+  for (uint32_t n = 1; n <= 20; n++) flash_log_append(&log, buf, make_record(n, buf, 1000));
+  CHECK(flash_log_clear(&log), "clear");
+  CHECK(read_back(&log, 1000, 0, "cleared log") == 0, "records left after clear");
+  free(log.erases);
+  flash_log_mount(&log, &flash);
+  CHECK(read_back(&log, 1000, 0, "cleared log remounted") == 0, "records back after remount");
+  flash_log_append(&log, buf, make_record(21, buf, 1000));
+  CHECK(read_back(&log, 1000, 21, "append after clear") == 1, "record appended after clear");
+  printf("clear    records released by a trim record, still released after a remount\n");
+  free(log.erases);
+  flash_emulator_free(&emulator);
+}
+
+typedef enum signal_t {
+  SIGNAL_SINE,
+  SIGNAL_PULSE,
+  SIGNAL_NOISE
+} signal_t;
+
+static const char *signal_names[] = { "sine", "pulse", "noise" };
+
+static double gaussian () {
+  double u = (rand() + 1.0) / (RAND_MAX + 2.0), v = (rand() + 1.0) / (RAND_MAX + 2.0);
+  return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+/* Waveforms of the simulator at 100 kS/s: a 16 Hz sine with little noise, a
+ * pressure pulse every 20 ms, wide band noise */
+static int16_t signal_sample (signal_t signal, uint64_t index) {
+  double t = index / 100e3;
+  double v;
+  switch (signal) {
+    case SIGNAL_SINE: v = 30000 * sin(2 * M_PI * 16 * t) + 2 * gaussian(); break;
+    case SIGNAL_PULSE: {
+      double phase = fmod(t, 0.02) / 0.02 - 0.5;
+      v = 2000 + 25000 * exp(-phase * phase * 200) + 8 * gaussian();
+      break;
+    }
+    default: v = 3000 * gaussian(); break;
+  }
+  return (int16_t) (v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : v);
+}
+
+typedef struct readback_t {
+  uint64_t next_sample;
+  uint64_t samples;
+  uint32_t discontinuities;
+} readback_t;
+
+static void on_readback_frame (const stream_frame_header_t *header, const uint8_t *payload, void *arg) {
+  readback_t *r = (readback_t*) arg;
+  if (r->samples > 0 && header->first_sample != r->next_sample) r->discontinuities++;
+  r->next_sample = header->first_sample + header->sample_count;
+  r->samples += header->sample_count;
+}
+
+/* Decodes the stream frames of the partition as the download port sends them */
+static void check_recording (const flash_log_flash_t *flash, uint64_t last_sample) {
+  flash_log_t log;
+  flash_log_cursor_t cursor;
+  static uint8_t frame[STREAM_FRAME_MAX_LEN];
+  stream_decoder_t decoder;
+  readback_t readback = {};
+  CHECK(flash_log_mount(&log, flash), "mount of the recording");
+  flash_log_rewind(&log, &cursor);
+  stream_decoder_init(&decoder);
+  size_t len;
+  while ((len = flash_log_read(&log, &cursor, frame, sizeof(frame))) > 0) {
+    stream_decoder_push(&decoder, frame, len, on_readback_frame, &readback);
+  }
+  stream_decoder_stats_t *s = &decoder.stats;
+  CHECK(s->crc_errors == 0 && s->skipped_bytes == 0, "recording: %u crc errors, %llu bytes skipped", s->crc_errors, (unsigned long long) s->skipped_bytes);
+  CHECK(s->lost_frames == 0 && readback.discontinuities == 0, "recording: %u frames lost, %u gaps", s->lost_frames, readback.discontinuities);
+  CHECK(readback.next_sample == last_sample, "recording ends at sample %llu, expected %llu", (unsigned long long) readback.next_sample, (unsigned long long) last_sample);
+  printf(
+    "readback %llu frames, %.1f s of the newest samples in %u sectors, continuous and intact\n",
+    (unsigned long long) s->frames, readback.samples / 100e3, log.stats.sectors
+  );
+  free(log.erases);
+}
+
+static void bench_recorder () {
+  const flash_timing_t typical = FLASH_TIMING_TYPICAL();
+  const flash_timing_t max = FLASH_TIMING_MAX();
+  flash_emulator_t emulator;
+  flash_log_flash_t flash;
+  flash_emulator_init(&emulator, PARTITION_LEN, BLOCK_LEN, &typical);
+  flash_emulator_bind(&emulator, &flash);
+  if (!recorder_start(&flash, NULL)) {
+    CHECK(false, "recorder start");
+    return;
+  }
+
+  static int16_t block[RECORDER_BLOCK_LEN];
+  uint64_t index = 0;
+  for (int s = SIGNAL_SINE; s <= SIGNAL_NOISE; s++) {
+    for (int t = 0; t < 2; t++) {
+      emulator.timing = t == 0 ? typical : max;
+      recorder_stats_t before, after;
+      recorder_get_stats(&before);
+      uint64_t busy = emulator.stats.busy_us;
+      uint32_t erases = emulator.stats.erases;
+      uint64_t end = index + RECORD_SAMPLES;
+      while (index < end) {
+        for (int i = 0; i < RECORDER_BLOCK_LEN; i++) block[i] = signal_sample((signal_t) s, index + i);
+        /* The stream position of the first signal goes on, one stream for the readback */
+        while (recorder_push(0, index, (int64_t) (index * 10), 100e3, block, RECORDER_BLOCK_LEN) == 0) usleep(100);
+        index += RECORDER_BLOCK_LEN;
+      }
+      while (!recorder_idle()) usleep(1000);
+      recorder_get_stats(&after);
+
+      uint64_t samples = after.recorded - before.recorded;
+      double seconds = (emulator.stats.busy_us - busy) / 1e6;
+      double rate = samples / seconds;
+      double bytes_per_sample = (double) (after.bytes - before.bytes) / samples;
+      /* What the ring and the slots hold while the writer waits for an erase, at 100 kS/s */
+      double absorbed_ms = (RING_LEN + RECORDER_SLOTS * RECORDER_BLOCK_LEN) / 100e3 * 1e3;
+      printf(
+        "record   %-5s %-7s %.2f B/sample, sustains %.1f kS/s, %u erases, block erase %u ms against %.0f ms of buffers at 100 kS/s\n",
+        signal_names[s], t == 0 ? "typical" : "max", bytes_per_sample, rate / 1e3, emulator.stats.erases - erases,
+        emulator.timing.block_erase_us / 1000, absorbed_ms
+      );
+      CHECK(after.failed == 0, "%u frames not appended", after.failed);
+    }
+  }
+  CHECK(emulator.stats.violations == 0, "%u bytes written without an erase", emulator.stats.violations);
+  check_recording(&flash, index);
+}
+
+int main (int argc, char **argv) {
+  srand(argc > 1 ? atoi(argv[1]) : 1);
+  const flash_timing_t typical = FLASH_TIMING_TYPICAL();
+  const flash_timing_t max = FLASH_TIMING_MAX();
+  bench_throughput("typical", &typical, SECTOR_LEN);
+  bench_throughput("max", &max, SECTOR_LEN);
+  bench_throughput("typical", &typical, BLOCK_LEN);
+  bench_throughput("max", &max, BLOCK_LEN);
+  test_wear();
+  test_power_cut(200);
+  test_clear();
+  bench_recorder();
+  printf(failures == 0 ? "all checks passed\n" : "%d checks failed\n", failures);
+  return failures;
+}
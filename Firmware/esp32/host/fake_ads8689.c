@@ -0,0 +1,356 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "hal/cpu_hal.h"
+
+#include "ads8689.h"
+#include "ads8689_stream.h"
+#include "ads8689_alarm.h"
+#include "fake_ads8689.h"
+
+#define LOG_TAG "FAKE ADS8689"
+
+#define MAX_BLOCK_LEN (4096)
+
+static fake_ads8689_config_t config = FAKE_ADS8689_DEFAULT_CONFIG();
+static uint16_t registers[0x40];
+
+static pthread_t producer_thread;
+static volatile bool producing = false;
+static volatile uint64_t generated = 0;
+static double stream_fs;
+static ads8689_config_t adc_config = ADS8689_DEFAULT_CONFIG();
+/* Encoder stream, the engine turning it and the faults injected */
+static ads8689_encoder_config_t encoder_config;
+static uint64_t lost_edges = 0;
+static uint32_t late_tdcs = 0;
+
+void fake_ads8689_configure (const fake_ads8689_config_t *new_config) {
+  config = *new_config;
+  if (config.block_len == 0) config.block_len = 1;
+  if (config.block_len > MAX_BLOCK_LEN) config.block_len = MAX_BLOCK_LEN;
+}
+
+uint64_t fake_ads8689_generated () {
+  return generated;
+}
+
+uint16_t fake_ads8689_register (uint16_t address) {
+  return registers[(address >> 1) % 0x40];
+}
+
+static float gaussian () {
+  float u1 = ((float) rand() + 1) / ((float) RAND_MAX + 1);
+  float u2 = (float) rand() / (float) RAND_MAX;
+  return sqrtf(-2 * logf(u1)) * cosf(2 * M_PI * u2);
+}
+
+static double waveform_value (double phase) {
+  double v = 0;
+  switch (config.waveform) {
+    case FAKE_WAVE_SINE: v = sin(2 * M_PI * phase); break;
+    case FAKE_WAVE_SAW: v = 2 * phase - 1; break;
+    case FAKE_WAVE_PULSE: {
+      /* Compression and combustion peak centered at 40% of the cycle */
+      double x = (phase - 0.4) / 0.05;
+      v = exp(-x * x);
+    } break;
+    case FAKE_WAVE_NOISE: v = 0; break;
+  }
+  return v;
+}
+
+static int16_t waveform_at (double phase, double drift) {
+  double s = config.offset + drift + config.amplitude * waveform_value(phase);
+  if (config.noise > 0) s += config.noise * gaussian();
+  if (s > INT16_MAX) s = INT16_MAX;
+  if (s < INT16_MIN) s = INT16_MIN;
+  return (int16_t) lrint(s);
+}
+
+static int16_t waveform_sample (uint64_t n, double drift) {
+  double t = (double) n / (double) stream_fs;
+  return waveform_at(fmod(t * config.frequency, 1.0), drift);
+}
+
+int16_t fake_ads8689_waveform (double phase) {
+  double s = config.offset + config.amplitude * waveform_value(phase);
+  if (s > INT16_MAX) s = INT16_MAX;
+  if (s < INT16_MIN) s = INT16_MIN;
+  return (int16_t) lrint(s);
+}
+
+void fake_ads8689_encoder_faults (uint64_t *lost, uint32_t *late) {
+  *lost = lost_edges;
+  *late = late_tdcs;
+}
+
+static double uniform () {
+  return (double) rand() / ((double) RAND_MAX + 1);
+}
+
+/* Input alarm comparators, on the output code with the hysteresis as the ADC does */
+static uint8_t alarm_state = 0;
+
+static uint8_t alarm_flags (int16_t sample) {
+  uint16_t code = (uint16_t) sample;
+  uint16_t hyst = adc_config.alarm_hysteresis;
+  if (code > adc_config.alarm_high) alarm_state |= ADS8689_ALARM_HIGH;
+  else if (code + hyst < adc_config.alarm_high) alarm_state &= ~ADS8689_ALARM_HIGH;
+  if (code < adc_config.alarm_low) alarm_state |= ADS8689_ALARM_LOW;
+  else if (code > adc_config.alarm_low + hyst) alarm_state &= ~ADS8689_ALARM_LOW;
+  return alarm_state;
+}
+
+static void* producer (void *arg) {
+  int16_t block[MAX_BLOCK_LEN];
+  uint8_t flags[MAX_BLOCK_LEN];
+  /* Flags follow the data only once DATAOUT_CTL asks for them */
+  bool with_flags = (fake_ads8689_register(ADS8689_DATAOUT_CTL_REG) & (0x3 << 10)) != 0;
+  alarm_state = 0;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int64_t start_us = esp_timer_get_time();
+  uint64_t n = 0;
+  /* Charge amplifier output drift, cleared by a reset pulse seen since the last block */
+  bool resettable = config.reset_gpio >= 0 && config.reset_gpio < GPIO_NUM_MAX;
+  unsigned resets = resettable ? host_gpio_changes[config.reset_gpio] : 0;
+  double drift = 0;
+
+  while (producing) {
+    size_t len = config.block_len;
+    uint8_t any_flag = 0;
+    if (resettable && host_gpio_changes[config.reset_gpio] != resets) {
+      resets = host_gpio_changes[config.reset_gpio];
+      drift = 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+      drift += config.drift / stream_fs;
+      block[i] = waveform_sample(n + i, drift);
+      flags[i] = with_flags ? alarm_flags(block[i]) : 0;
+      any_flag |= flags[i];
+    }
+
+    /* Wait until the last sample of the block would have been converted */
+    uint64_t elapsed_ns = (uint64_t) ((n + len) * 1e9 / stream_fs);
+    struct timespec deadline = {
+      .tv_sec = start.tv_sec + (start.tv_nsec + elapsed_ns) / 1000000000ULL,
+      .tv_nsec = (start.tv_nsec + elapsed_ns) % 1000000000ULL
+    };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+
+    /* One block stands for one conversion timer interrupt, latency is the oversleep */
+    struct timespec woke;
+    clock_gettime(CLOCK_MONOTONIC, &woke);
+    ads8689_stats_conversion_isr(cpu_hal_get_cycle_count());
+    int64_t late_ns = (woke.tv_sec - deadline.tv_sec) * 1000000000LL + (woke.tv_nsec - deadline.tv_nsec);
+    ads8689_stats_latency_isr(late_ns > 0 ? (uint32_t) late_ns : 0);
+
+    /* Latched like the hardware timer does, on the conversion grid whatever the oversleep */
+    int64_t last_time = start_us + (int64_t) ((n + len - 1) * 1e6 / stream_fs);
+    ads8689_stream_latch_clock(n + len - 1, last_time);
+    BaseType_t task_woken;
+    ads8689_stream_push(block, any_flag ? flags : NULL, len, &task_woken);
+    n += len;
+    generated = n;
+  }
+  return NULL;
+}
+
+/* Sleeps until t seconds after start, then hands the block over like the
+ * conversion ISRs. The latch is the conversion time of the last sample */
+static void block_done (const struct timespec *start, int64_t start_us, double t, uint64_t n, const int16_t *block, const uint8_t *flags, size_t len) {
+  uint64_t elapsed_ns = (uint64_t) (t * 1e9);
+  struct timespec deadline = {
+    .tv_sec = start->tv_sec + (start->tv_nsec + elapsed_ns) / 1000000000ULL,
+    .tv_nsec = (start->tv_nsec + elapsed_ns) % 1000000000ULL
+  };
+  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+  ads8689_stats_conversion_isr(cpu_hal_get_cycle_count());
+  ads8689_stream_latch_clock(n + len - 1, start_us + (int64_t) (t * 1e6));
+  BaseType_t task_woken;
+  ads8689_stream_push(block, flags, len, &task_woken);
+}
+
+/**
+ * Turns the engine edge by edge: the pulse counter counts edges_per_sample
+ * edges for each conversion, the TDC pulse comes right before edge 0 of each
+ * cycle and clears the counter, unless its interrupt runs late, after the
+ * next conversion, when nothing is counted yet. A conversion samples the waveform at the angle of the first edge it
+ * counted, so it is where the angle tracking should put it only as long as
+ * no edge was lost.
+ */
+static void* engine (void *arg) {
+  int16_t block[MAX_BLOCK_LEN];
+  uint8_t flags[MAX_BLOCK_LEN];
+  bool with_flags = (fake_ads8689_register(ADS8689_DATAOUT_CTL_REG) & (0x3 << 10)) != 0;
+  alarm_state = 0;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int64_t start_us = esp_timer_get_time();
+  bool resettable = config.reset_gpio >= 0 && config.reset_gpio < GPIO_NUM_MAX;
+  unsigned resets = resettable ? host_gpio_changes[config.reset_gpio] : 0;
+  double drift = 0;
+
+  const uint32_t per_sample = encoder_config.edges_per_sample;
+  const double per_cycle = encoder_config.edges_per_cycle;
+  /* Edges per second at the mean speed, a four stroke cycle is two turns */
+  const double edge_rate = config.rpm / 120.0 * per_cycle;
+  /* A conversion can only start once the frame of the last one is read */
+  const double frame_s = 1.0 / ads8689_config_max_rate(&adc_config);
+  /* From a random angle on a conversion boundary */
+  uint64_t edge = (uint64_t) (uniform() * ads8689_encoder_cycle_len(&encoder_config)) * per_sample;
+  double t = 0, last_conversion = -1;
+  uint32_t counted = 0;
+  uint64_t n = 0;
+
+  while (producing) {
+    size_t len = config.block_len;
+    uint8_t any_flag = 0;
+    if (resettable && host_gpio_changes[config.reset_gpio] != resets) {
+      resets = host_gpio_changes[config.reset_gpio];
+      drift = 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+      bool late = false;
+      while (1) {
+        double phase = fmod((double) edge / per_cycle, 1.0);
+        if (edge % encoder_config.edges_per_cycle == 0) {
+          late = uniform() < config.tdc_late;
+          if (late) late_tdcs++;
+          else {
+            counted = 0;
+            ads8689_encoder_tdc_isr(n + i);
+          }
+        }
+        double dt = 1.0 / (edge_rate * (1 + config.rpm_variation * sin(2 * M_PI * phase)));
+        t += dt;
+        drift += config.drift * dt;
+        edge++;
+        if (config.edge_loss > 0 && uniform() < config.edge_loss) {
+          lost_edges++;
+          continue;
+        }
+        if (++counted < per_sample) continue;
+        counted = 0;
+        if (t - last_conversion < frame_s) {
+          ads8689_encoder_skipped_isr();
+          continue;
+        }
+        break;
+      }
+      last_conversion = t;
+      block[i] = waveform_at(fmod((double) (edge - per_sample) / per_cycle, 1.0), drift);
+      flags[i] = with_flags ? alarm_flags(block[i]) : 0;
+      any_flag |= flags[i];
+      /* Ran after the encoder interrupt of the same edge */
+      if (late) ads8689_encoder_tdc_isr(n + i + 1);
+    }
+    block_done(&start, start_us, t, n, block, any_flag ? flags : NULL, len);
+    n += len;
+    generated = n;
+  }
+  return NULL;
+}
+
+esp_err_t ads8689_init (spi_bus_config_t spi_config, gpio_num_t cs_gpio, spi_host_device_t spi_host_id) {
+  memset(registers, 0, sizeof(registers));
+  return ESP_OK;
+}
+
+esp_err_t ads8689_transmit (
+  ads8689_commands_t command, ads8689_reg_t address,
+  uint16_t data_write, uint8_t *data_read, size_t read_len
+) {
+  uint16_t *reg = &registers[(address >> 1) % 0x40];
+  switch (command) {
+    case ADS8689_WRITE_FULL:
+    case ADS8689_WRITE_LS: *reg = data_write; break;
+    case ADS8689_WRITE_MS: *reg = (*reg & 0x00FF) | (data_write & 0xFF00); break;
+    case ADS8689_SET_HWORD: *reg |= data_write; break;
+    case ADS8689_CLEAR_HWORD: *reg &= ~data_write; break;
+    default: break;
+  }
+  if (data_read != NULL && read_len > 0) {
+    uint8_t value[2] = { (*reg >> 8) & 0xFF, *reg & 0xFF };
+    memcpy(data_read, value, read_len < 2 ? read_len : 2);
+  }
+  return ESP_OK;
+}
+
+esp_err_t ads8689_configure (const ads8689_config_t *config) {
+  if (producing) return ESP_ERR_INVALID_STATE;
+  esp_err_t ret = ads8689_config_check(config);
+  if (ret != ESP_OK) return ret;
+  adc_config = *config;
+  return ads8689_config_write(config);
+}
+
+void ads8689_get_config (ads8689_config_t *config, uint32_t *spi_clock) {
+  *config = adc_config;
+  if (spi_clock != NULL) *spi_clock = ads8689_config_spi_clock(adc_config.spi_clock);
+}
+
+float ads8689_start_stream (size_t buffer_len, int64_t sample_freq, ads8689_stream_mode_t mode) {
+  ads8689_config_t requested = adc_config;
+  requested.sample_freq = (uint32_t) sample_freq;
+  if (producing || ads8689_config_check(&requested) != ESP_OK) {
+    ESP_LOGE(LOG_TAG, "Invalid sample frequency, stream not started");
+    return 0;
+  }
+  adc_config.sample_freq = requested.sample_freq;
+  stream_fs = ads8689_config_timer_rate(adc_config.sample_freq);
+  if (mode == ADS8689_STREAM_PER_SAMPLE) {
+    /* One push per sample is not achievable with a sleeping thread, keep 1ms blocks */
+    config.block_len = stream_fs / 1000 > 1 ? (size_t) (stream_fs / 1000) : 1;
+  }
+  if (ads8689_stream_init(buffer_len, stream_fs) != ESP_OK) {
+    ESP_LOGE(LOG_TAG, "Failed to allocate sample ring, stream not started");
+    return 0;
+  }
+  /* The host cycle counter counts nanoseconds */
+  ads8689_stats_set_period((uint32_t) (config.block_len * 1e9 / stream_fs), 1000);
+  ESP_LOGI(LOG_TAG, "Streaming at %.2f Hz in blocks of %zu samples", stream_fs, config.block_len);
+  ads8689_encoder_reset(0);
+  producing = true;
+  /* Inherits the CPU of the calling task, like the interrupts allocated on its core */
+  pthread_create(&producer_thread, NULL, producer, NULL);
+  return (float) stream_fs;
+}
+
+float ads8689_start_encoder_stream (size_t buffer_len, const ads8689_encoder_config_t *encoder, ads8689_stream_mode_t mode) {
+  if (producing || ads8689_encoder_check(encoder, &adc_config) != ESP_OK) {
+    ESP_LOGE(LOG_TAG, "Invalid encoder settings, stream not started");
+    return 0;
+  }
+  encoder_config = *encoder;
+  stream_fs = encoder->max_rate;
+  if (mode == ADS8689_STREAM_PER_SAMPLE) config.block_len = stream_fs / 1000 > 1 ? (size_t) (stream_fs / 1000) : 1;
+  if (ads8689_stream_init(buffer_len, stream_fs) != ESP_OK) {
+    ESP_LOGE(LOG_TAG, "Failed to allocate sample ring, stream not started");
+    return 0;
+  }
+  ads8689_encoder_reset(ads8689_encoder_cycle_len(encoder));
+  ads8689_stats_set_period(0, 1000);
+  lost_edges = 0;
+  late_tdcs = 0;
+  ESP_LOGI(
+    LOG_TAG, "Encoder at %.0f rpm +-%.0f%%, %u edges a conversion, %u a cycle",
+    config.rpm, config.rpm_variation * 100, encoder->edges_per_sample, encoder->edges_per_cycle
+  );
+  producing = true;
+  pthread_create(&producer_thread, NULL, engine, NULL);
+  return (float) stream_fs;
+}
+
+void ads8689_stop_stream () {
+  if (!producing) return;
+  producing = false;
+  pthread_join(producer_thread, NULL);
+}
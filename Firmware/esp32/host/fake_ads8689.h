@@ -0,0 +1,84 @@
+/**
+ * @file fake_ads8689.h
+ *
+ * @brief Fake ADS8689 for the host simulator. Implements the ads8689.h driver
+ * API and feeds the real ads8689_stream from a thread paced by CLOCK_MONOTONIC.
+ * Settings go through the same ads8689_config checks and register writes as
+ * on the board, the rate is the one the conversion timer would run at.
+ *
+ * ads8689_start_encoder_stream() turns an engine instead: the conversions
+ * follow the encoder edges at the speed of the engine and the waveform is a
+ * function of the crank angle, one period a cycle. Edges the pulse counter
+ * misses and TDC interrupts that run after the encoder one are injected at
+ * random, the real angle tracking of ads8689_encoder.c sees them.
+ */
+#ifndef FAKE_ADS8689_H
+#define FAKE_ADS8689_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum fake_waveform_t {
+  FAKE_WAVE_SINE = 0,
+  FAKE_WAVE_SAW,
+  /** Periodic combustion like pressure pulse over a flat baseline */
+  FAKE_WAVE_PULSE,
+  FAKE_WAVE_NOISE
+} fake_waveform_t;
+
+typedef struct fake_ads8689_config_t {
+  fake_waveform_t waveform;
+  /** Waveform frequency in Hz */
+  float frequency;
+  /** Peak amplitude in LSB */
+  float amplitude;
+  float offset;
+  /** Gaussian noise standard deviation in LSB */
+  float noise;
+  /** Samples pushed at once, emulates the DMA block size */
+  size_t block_len;
+  /** Charge amplifier drift in LSB/s, back to 0 on a pulse of reset_gpio */
+  float drift;
+  int reset_gpio;
+  /** Engine speed of the encoder stream, and its variation over a cycle as a
+   * fraction of it, compression slows the crank down and combustion speeds it up */
+  float rpm;
+  float rpm_variation;
+  /** Probability an encoder edge is not counted, and that a TDC interrupt
+   * runs after the conversion of its edge */
+  float edge_loss;
+  float tdc_late;
+} fake_ads8689_config_t;
+
+#define FAKE_ADS8689_DEFAULT_CONFIG() { \
+    .waveform = FAKE_WAVE_SINE, \
+    .frequency = 16, \
+    .amplitude = 30000, \
+    .offset = 0, \
+    .noise = 0, \
+    .block_len = 256, \
+    .drift = 0, \
+    .reset_gpio = -1, \
+    .rpm = 3000, \
+    .rpm_variation = 0, \
+    .edge_loss = 0, \
+    .tdc_late = 0 \
+  }
+
+/** @brief Sets the waveform, must be called before ads8689_start_stream() */
+void fake_ads8689_configure (const fake_ads8689_config_t *config);
+
+/** @brief Samples generated since the stream started */
+uint64_t fake_ads8689_generated ();
+
+/** @brief Value last written to a register through ads8689_transmit() */
+uint16_t fake_ads8689_register (uint16_t address);
+
+/** @brief Sample of the waveform without noise or drift, phase 0 to 1 of its
+ * period, of the cycle in an encoder stream */
+int16_t fake_ads8689_waveform (double phase);
+
+/** @brief Encoder edges lost and TDC interrupts run late so far */
+void fake_ads8689_encoder_faults (uint64_t *lost_edges, uint32_t *late_tdcs);
+
+#endif
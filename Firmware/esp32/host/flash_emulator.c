@@ -0,0 +1,114 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "flash_emulator.h"
+
+static bool powered (const flash_emulator_t *emulator) {
+  return emulator->power_left != 0;
+}
+
+static void busy (flash_emulator_t *emulator, uint64_t ns) {
+  emulator->stats.busy_us += ns / 1000;
+  if (emulator->realtime && ns >= 1000) usleep(ns / 1000);
+}
+
+static bool emulator_erase (void *ctx, size_t offset) {
+  flash_emulator_t *emulator = (flash_emulator_t*) ctx;
+  if (!powered(emulator) || offset % emulator->sector_len != 0 || offset >= emulator->len) return false;
+  memset(&emulator->data[offset], 0xFF, emulator->sector_len);
+  emulator->sector_erases[offset / emulator->sector_len]++;
+  emulator->stats.erases++;
+  const flash_timing_t *timing = &emulator->timing;
+  size_t len = emulator->sector_len;
+  uint64_t us;
+  if (len % FLASH_EMULATOR_BLOCK_LEN == 0) us = len / FLASH_EMULATOR_BLOCK_LEN * (uint64_t) timing->block_erase_us;
+  else us = (len + FLASH_EMULATOR_SECTOR_LEN - 1) / FLASH_EMULATOR_SECTOR_LEN * (uint64_t) timing->erase_us;
+  emulator->stats.erase_busy_us += us;
+  busy(emulator, us * 1000);
+  return true;
+}
+
+static bool emulator_write (void *ctx, size_t offset, const void *data, size_t len) {
+  flash_emulator_t *emulator = (flash_emulator_t*) ctx;
+  const flash_timing_t *timing = &emulator->timing;
+  if (!powered(emulator) || offset + len > emulator->len) return false;
+  const uint8_t *src = (const uint8_t*) data;
+  uint64_t ns = 0;
+  while (len > 0) {
+    /* One page program per chunk, like the flash driver splits the writes */
+    size_t chunk = timing->page_len - offset % timing->page_len;
+    if (chunk > len) chunk = len;
+    size_t n = chunk;
+    if (emulator->power_left >= 0 && (int64_t) n > emulator->power_left) n = emulator->power_left;
+    for (size_t i = 0; i < n; i++) {
+      uint8_t *cell = &emulator->data[offset + i];
+      if ((src[i] & ~*cell) != 0) emulator->stats.violations++;
+      *cell &= src[i];
+    }
+    ns += timing->program_us * 1000ULL + (uint64_t) n * (timing->program_byte_ns + timing->spi_byte_ns);
+    emulator->stats.written += n;
+    if (emulator->power_left >= 0) emulator->power_left -= n;
+    if (n < chunk) {
+      busy(emulator, ns);
+      return false;
+    }
+    offset += chunk;
+    src += chunk;
+    len -= chunk;
+  }
+  busy(emulator, ns);
+  return true;
+}
+
+static bool emulator_read (void *ctx, size_t offset, void *data, size_t len) {
+  flash_emulator_t *emulator = (flash_emulator_t*) ctx;
+  if (!powered(emulator) || offset + len > emulator->len) return false;
+  memcpy(data, &emulator->data[offset], len);
+  emulator->stats.read += len;
+  busy(emulator, (uint64_t) len * emulator->timing.spi_byte_ns);
+  return true;
+}
+
+bool flash_emulator_init (flash_emulator_t *emulator, size_t len, size_t sector_len, const flash_timing_t *timing) {
+  memset(emulator, 0, sizeof(*emulator));
+  if (sector_len == 0 || len % sector_len != 0 || timing->page_len == 0) return false;
+  emulator->data = (uint8_t*) malloc(len);
+  emulator->sector_erases = (uint32_t*) calloc(len / sector_len, sizeof(uint32_t));
+  if (emulator->data == NULL || emulator->sector_erases == NULL) {
+    flash_emulator_free(emulator);
+    return false;
+  }
+  memset(emulator->data, 0xFF, len);
+  emulator->len = len;
+  emulator->sector_len = sector_len;
+  emulator->timing = *timing;
+  emulator->power_left = -1;
+  return true;
+}
+
+void flash_emulator_free (flash_emulator_t *emulator) {
+  free(emulator->data);
+  free(emulator->sector_erases);
+  emulator->data = NULL;
+  emulator->sector_erases = NULL;
+}
+
+void flash_emulator_bind (flash_emulator_t *emulator, flash_log_flash_t *flash) {
+  *flash = (flash_log_flash_t) {
+    .len = emulator->len,
+    .sector_len = emulator->sector_len,
+    .erase = emulator_erase,
+    .write = emulator_write,
+    .read = emulator_read,
+    .ctx = emulator
+  };
+}
+
+void flash_emulator_cut_power (flash_emulator_t *emulator, size_t after) {
+  emulator->power_left = after;
+}
+
+void flash_emulator_restore (flash_emulator_t *emulator) {
+  emulator->power_left = -1;
+}
@@ -0,0 +1,99 @@
+/**
+ * @file flash_emulator.h
+ *
+ * @brief NOR flash in host memory behind a flash_log_flash_t, for the
+ * simulator and the flash log benchmark. Erase sets a sector to 0xFF, a
+ * write only clears bits like on the chip and counts the bytes it was asked
+ * to set back. Every operation adds its modelled duration to a busy time,
+ * from a SPI transfer time and the program and erase times of the chip, and
+ * in realtime mode the calling thread sleeps for it.
+ *
+ * A power cut is emulated by letting only so many more bytes be programmed:
+ * the write in progress stops there and every operation fails afterwards.
+ */
+#ifndef FLASH_EMULATOR_H
+#define FLASH_EMULATOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "flash_log.h"
+
+#define FLASH_EMULATOR_SECTOR_LEN (4096)
+#define FLASH_EMULATOR_BLOCK_LEN (64 * 1024)
+
+/* Durations of the chip operations */
+typedef struct flash_timing_t {
+  /** One 4 kB sector erase and one 64 kB block erase, us. Areas of whole
+   * blocks are erased by blocks, else by sectors */
+  uint32_t erase_us;
+  uint32_t block_erase_us;
+  /** Program of a page chunk: fixed part in us and per byte in ns */
+  uint32_t program_us;
+  uint32_t program_byte_ns;
+  /** Page the program time applies to, a write is cut at page boundaries */
+  uint32_t page_len;
+  /** Transfer of a byte on the SPI bus, read or written, ns */
+  uint32_t spi_byte_ns;
+} flash_timing_t;
+
+/* W25Q32 class chip on the ESP32 SPI flash bus at 40 MHz QIO, datasheet typical times */
+#define FLASH_TIMING_TYPICAL() { \
+  .erase_us = 45000, \
+  .block_erase_us = 150000, \
+  .program_us = 30, \
+  .program_byte_ns = 2500, \
+  .page_len = 256, \
+  .spi_byte_ns = 100 \
+}
+
+/* Same chip at the datasheet maximum times, a worn or hot part */
+#define FLASH_TIMING_MAX() { \
+  .erase_us = 400000, \
+  .block_erase_us = 2000000, \
+  .program_us = 120, \
+  .program_byte_ns = 11250, \
+  .page_len = 256, \
+  .spi_byte_ns = 100 \
+}
+
+typedef struct flash_emulator_stats_t {
+  uint32_t erases;
+  uint64_t written;
+  uint64_t read;
+  /** Modelled time the chip was busy, erasing included, us */
+  uint64_t busy_us;
+  uint64_t erase_busy_us;
+  /** Bytes a write tried to turn from 0 to 1 */
+  uint32_t violations;
+} flash_emulator_stats_t;
+
+typedef struct flash_emulator_t {
+  uint8_t *data;
+  size_t len;
+  size_t sector_len;
+  flash_timing_t timing;
+  /** Sleep for the modelled durations */
+  bool realtime;
+  /** Bytes left before the power cut, negative for none */
+  int64_t power_left;
+  uint32_t *sector_erases;
+  flash_emulator_stats_t stats;
+} flash_emulator_t;
+
+/** @brief Allocates an erased area of len bytes */
+bool flash_emulator_init (flash_emulator_t *emulator, size_t len, size_t sector_len, const flash_timing_t *timing);
+
+void flash_emulator_free (flash_emulator_t *emulator);
+
+/** @brief Fills the flash log area callbacks, the emulator must outlive them */
+void flash_emulator_bind (flash_emulator_t *emulator, flash_log_flash_t *flash);
+
+/** @brief Cuts the power after that many more programmed bytes */
+void flash_emulator_cut_power (flash_emulator_t *emulator, size_t after);
+
+/** @brief Powers up again, the area keeps what was written */
+void flash_emulator_restore (flash_emulator_t *emulator);
+
+#endif
@@ -0,0 +1,844 @@
+/**
+ * @file sim_main.c
+ *
+ * @brief Host simulator of the acquisition -> TCP pipeline. Runs the firmware
+ * acquisition task and TCP server (port 3333) on pthreads with a fake ADS8689.
+ * With -c a built in client measures end to end throughput and latency, from
+ * the conversion time in the frame header to the moment the frame is decoded,
+ * and asks for the driver stats every second with the "stats" command.
+ * -C runs that many clients at once, with -S the last one sleeps after each
+ * segment it reads to load the server with a slow client.
+ * -U streams datagrams too (port 3334), to a multicast group or "unicast" to
+ * subscribers, and the built in clients receive those instead, through the
+ * reorder window. -L drops and swaps that percentage of the datagrams on reception.
+ * -A sets the ADC input alarm thresholds in output codes, the events go to
+ * the event port (3335) and their latency is printed at the end.
+ * -P stalls every TCP client for stall ms at the end of each period, like a
+ * WiFi link that stops, and -B puts a backlog of that many kB behind the ring
+ * to get through the stalls without losing samples.
+ * -R records the stream while no client is connected to an emulated record
+ * partition of that many kB, at the typical flash times or the maximum ones
+ * with ",max", downloaded from the download port (3336).
+ * -K pins the pipeline stages to emulated cores, acquire, process, transmit
+ * and record, 1,1,0,1 by default. Their loads are printed every second and
+ * the share of each core they leave at the end, all emulated cores run on
+ * the CPUs of the host (core % CPUs).
+ * -Q converts the sample frames to pressure with the calibration of a sensor
+ * of that sensitivity (pC/bar) on a charge amplifier of that range (pC for
+ * 10 V), the range of the raw frames received is printed at the end in bar.
+ * -D adds a charge amplifier drift of that many LSB/s to the fake ADC and
+ * corrects it with the baseline estimator pegged on the cycle minima, the
+ * amplifier is reset through GPIO 26 once the peaks come within margin LSB of
+ * the range limits. The resets seen by the client are printed at the end.
+ * -E clocks the conversions from the encoder of an engine turning at rpm,
+ * its speed varying by that fraction over each cycle, with edges_per_cycle
+ * encoder edges a cycle (720) and a conversion every edges_per_sample (1).
+ * loss is the probability an edge is not counted and late the one a TDC
+ * interrupt runs after the conversion of its edge. The waveform is then a
+ * function of the crank angle, one period a cycle, and with no noise the
+ * client checks the samples of every raw frame against the waveform at the
+ * angle the frame gives them, and the peak of each cycle report against the
+ * extremes of the waveform.
+ *
+ * usage: pas_sim [-r rate] [-w sine|saw|pulse|noise] [-f freq] [-n noise]
+ *                [-b block] [-d factor[,factor...]] [-z]
+ *                [-T level,hysteresis,pre,post[,holdoff]] [-F fft_len,windows[,only]] [-t seconds] [-c]
+ *                [-C clients] [-S us] [-U group|unicast] [-L loss[,swap]] [-A high,low[,hysteresis]]
+ *                [-P period,stall] [-B kbytes] [-R kbytes[,max]]
+ *                [-K acquire,process,transmit[,record]] [-Q sensitivity,amp_range[,offset[,frac_bits]]]
+ *                [-D drift[,margin[,settle]]] [-E rpm[,variation[,edges_per_cycle[,edges_per_sample[,loss[,late]]]]]]
+ */
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+
+#include "ads8689.h"
+#include "acquisition.h"
+#include "tcp_server.h"
+#include "udp_stream.h"
+#include "event_server.h"
+#include "alarm_events.h"
+#include "stream_frame.h"
+#include "stream_reorder.h"
+#include "fir_decimator.h"
+#include "trigger.h"
+#include "feature_extractor.h"
+#include "calibration.h"
+#include "baseline.h"
+#include "charge_amp.h"
+#include "fake_ads8689.h"
+#include "recorder.h"
+#include "download_server.h"
+#include "flash_emulator.h"
+
+#define SIM_PORT (3333)
+#define SIM_MAX_CLIENTS (8)
+/* Reorder window of the datagram clients */
+#define SIM_REORDER_WINDOW (8)
+#define SIM_REORDER_DELAY_US (20000)
+
+/* Latency histogram, 10us bins up to 2s */
+#define LATENCY_BIN_US (10)
+#define LATENCY_BINS (200000)
+
+typedef struct sim_client_t {
+  pthread_t thread;
+  volatile bool run;
+  stream_decoder_t decoder;
+  uint32_t *latency_hist;
+  uint64_t latency_count;
+  int64_t latency_max;
+  int64_t start_time;
+  uint64_t bytes;
+  uint32_t captures;
+  uint32_t captures_missed;
+  uint32_t feature_reports;
+  stream_features_t last_features;
+  volatile int fd;
+  uint32_t stats_frames;
+  stream_stats_t last_stats;
+  /* Sleep after each segment read, 0 reads as fast as possible */
+  uint32_t recv_delay_us;
+  /* Datagram client, commands go to server_addr */
+  bool udp;
+  struct sockaddr_in server_addr;
+  stream_reorder_t reorder;
+  /* Datagram held back to arrive after the next one */
+  uint8_t swapped[STREAM_FRAME_MAX_LEN];
+  size_t swapped_len;
+  uint32_t dropped;
+  /* Last calibration report and the frames converted with it, raw ones in bar */
+  uint32_t calibration_reports;
+  stream_calibration_t calibration;
+  uint64_t calibrated_frames;
+  uint32_t untagged_frames;
+  float bar_min, bar_max;
+  /* Amplifier resets flagged in the frames and the last baseline report */
+  uint32_t reset_frames;
+  uint32_t baseline_reports;
+  stream_baseline_t baseline;
+  /* Frames with the angle of their samples, those not where the last one
+   * left off, and the samples checked against the waveform at their angle */
+  uint64_t angle_frames;
+  uint32_t angle_jumps;
+  stream_angle_t last_angle;
+  uint64_t last_angle_sample;
+  uint64_t angle_checked;
+  uint64_t angle_mismatches;
+  uint32_t last_cycle;
+  /* Cycle reports, those off the extremes of the waveform, and the last one */
+  uint32_t cycle_reports;
+  uint32_t cycle_mismatches;
+  stream_cycle_t last_cycle_report;
+} sim_client_t;
+
+static sim_client_t clients[SIM_MAX_CLIENTS];
+static int n_clients = 0;
+
+/* Stall of every TCP client at the end of each period, us */
+static int64_t stall_period_us = 0, stall_len_us = 0;
+
+/* Samples are only the waveform at their angle without noise or correction */
+static bool angle_check = false;
+
+static udp_stream_config_t udp_config = { .group = NULL };
+static bool udp_on = false;
+static double udp_loss = 0, udp_swap = 0;
+
+/* Angle of the first sample where the last frame left off, and its samples at their angle */
+static void check_angle (sim_client_t *c, const stream_frame_header_t *header, const stream_angle_t *angle, const uint8_t *samples) {
+  uint64_t position = (uint64_t) angle->cycle * angle->cycle_len + angle->angle;
+  if (c->angle_frames > 0 && c->last_angle.cycle_len == angle->cycle_len) {
+    uint64_t last = (uint64_t) c->last_angle.cycle * c->last_angle.cycle_len + c->last_angle.angle;
+    if (position - last != header->first_sample - c->last_angle_sample) c->angle_jumps++;
+  }
+  c->angle_frames++;
+  c->last_angle = *angle;
+  c->last_angle_sample = header->first_sample;
+  c->last_cycle = angle->cycle + (angle->angle + header->sample_count) / angle->cycle_len;
+  if (!angle_check || header->type != STREAM_FRAME_SAMPLES || (header->flags & STREAM_FLAG_CALIBRATED)) return;
+  for (size_t i = 0; i < header->sample_count; i++) {
+    int16_t v;
+    memcpy(&v, &samples[i * sizeof(int16_t)], sizeof(v));
+    uint32_t a = (angle->angle + i) % angle->cycle_len;
+    int16_t expected = fake_ads8689_waveform((double) a / angle->cycle_len);
+    if (abs(v - expected) > 1) c->angle_mismatches++;
+    c->angle_checked++;
+  }
+}
+
+/* Extremes of the waveform over a cycle of len samples against the report */
+static bool check_cycle (const stream_cycle_t *report) {
+  int16_t max = INT16_MIN, min = INT16_MAX;
+  for (uint32_t a = 0; a < report->cycle_len; a++) {
+    int16_t v = fake_ads8689_waveform((double) a / report->cycle_len);
+    if (v > max) max = v;
+    if (v < min) min = v;
+  }
+  int16_t at_max = fake_ads8689_waveform((double) report->max_angle / report->cycle_len);
+  int16_t at_min = fake_ads8689_waveform((double) report->min_angle / report->cycle_len);
+  return abs(report->max - max) <= 1 && abs(report->min - min) <= 1 && abs(at_max - max) <= 1 && abs(at_min - min) <= 1;
+}
+
+static void on_client_frame (const stream_frame_header_t *header, const uint8_t *payload, void *arg) {
+  sim_client_t *c = (sim_client_t*) arg;
+  if (header->type == STREAM_FRAME_CAPTURE) {
+    const stream_capture_header_t *capture = (const stream_capture_header_t*) payload;
+    if (header->first_sample == capture->trigger_index - capture->pre_trigger) {
+      c->captures++;
+      c->captures_missed += capture->missed;
+    }
+  }
+  if (header->type == STREAM_FRAME_FEATURES) {
+    /* Not a latency measure, the report is sent after its last sample */
+    memcpy(&c->last_features, payload, sizeof(stream_features_t));
+    c->feature_reports++;
+    return;
+  }
+  if (header->type == STREAM_FRAME_STATS) {
+    memcpy(&c->last_stats, payload, sizeof(stream_stats_t));
+    c->stats_frames++;
+    return;
+  }
+  if (header->type == STREAM_FRAME_CALIBRATION) {
+    memcpy(&c->calibration, payload, sizeof(stream_calibration_t));
+    c->calibration_reports++;
+    return;
+  }
+  if (header->type == STREAM_FRAME_BASELINE) {
+    memcpy(&c->baseline, payload, sizeof(stream_baseline_t));
+    c->baseline_reports++;
+    return;
+  }
+  if (header->type == STREAM_FRAME_CYCLE) {
+    memcpy(&c->last_cycle_report, payload, sizeof(stream_cycle_t));
+    c->cycle_reports++;
+    if (angle_check && !check_cycle(&c->last_cycle_report)) c->cycle_mismatches++;
+    return;
+  }
+  if (header->flags & STREAM_FLAG_AMP_RESET) c->reset_frames++;
+  /* Samples behind the angle header */
+  if (header->flags & STREAM_FLAG_ANGLE) {
+    stream_angle_t angle;
+    memcpy(&angle, payload, sizeof(angle));
+    payload += sizeof(angle);
+    if (angle.cycle_len > 0) check_angle(c, header, &angle, payload);
+  }
+  /* Frames before the first report can not be told apart */
+  if ((header->flags & STREAM_FLAG_CALIBRATED) && c->calibration_reports > 0) {
+    c->calibrated_frames++;
+    if (STREAM_FLAG_GET_CALIBRATION_TAG(header->flags) != (uint8_t) c->calibration.hash) c->untagged_frames++;
+    if (header->type == STREAM_FRAME_SAMPLES) {
+      for (size_t i = 0; i < header->sample_count; i++) {
+        int16_t v;
+        memcpy(&v, &payload[i * sizeof(int16_t)], sizeof(v));
+        float bar = ldexpf(v, -c->calibration.frac_bits);
+        if (bar < c->bar_min) c->bar_min = bar;
+        if (bar > c->bar_max) c->bar_max = bar;
+      }
+    }
+  }
+  if (header->sample_rate <= 0) return;
+  /* Latency of the newest sample in the frame */
+  int64_t last_time = header->timestamp + (int64_t) ((header->sample_count - 1) * 1e6f / header->sample_rate);
+  int64_t latency = esp_timer_get_time() - last_time;
+  if (latency < 0) latency = 0;
+  size_t bin = latency / LATENCY_BIN_US;
+  c->latency_hist[bin < LATENCY_BINS ? bin : LATENCY_BINS - 1]++;
+  c->latency_count++;
+  if (latency > c->latency_max) c->latency_max = latency;
+}
+
+static void* client_task (void *arg) {
+  sim_client_t *c = (sim_client_t*) arg;
+  int fd = -1;
+  struct sockaddr_in addr = {
+    .sin_family = AF_INET,
+    .sin_port = htons(SIM_PORT),
+    .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+  };
+  /* Server task may still be starting */
+  while (c->run) {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (c->recv_delay_us > 0 || stall_period_us > 0) {
+      /* Small window so the server side sees the client fall behind, not the host kernel buffers */
+      int rcvbuf = 4 * STREAM_FRAME_MAX_LEN;
+      setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0) break;
+    close(fd);
+    fd = -1;
+    usleep(100000);
+  }
+  if (fd < 0) return NULL;
+  send(fd, "connection_request", sizeof("connection_request"), 0);
+  c->start_time = esp_timer_get_time();
+  c->fd = fd;
+
+  uint8_t buf[1 << 16];
+  size_t recv_len = c->recv_delay_us > 0 ? STREAM_FRAME_MAX_LEN : sizeof(buf);
+  while (c->run) {
+    ssize_t len = recv(fd, buf, recv_len, 0);
+    if (len <= 0) break;
+    c->bytes += len;
+    stream_decoder_push(&c->decoder, buf, len, on_client_frame, c);
+    if (c->recv_delay_us > 0) usleep(c->recv_delay_us);
+    if (stall_period_us > 0) {
+      int64_t phase = (esp_timer_get_time() - c->start_time) % stall_period_us;
+      if (phase >= stall_period_us - stall_len_us) usleep(stall_period_us - phase);
+    }
+  }
+  c->fd = -1;
+  close(fd);
+  return NULL;
+}
+
+static void client_command (sim_client_t *c, const char *command) {
+  if (c->fd < 0) return;
+  if (c->udp) {
+    sendto(c->fd, command, strlen(command) + 1, 0, (struct sockaddr*) &c->server_addr, sizeof(c->server_addr));
+  } else {
+    send(c->fd, command, strlen(command) + 1, 0);
+  }
+}
+
+static void on_client_datagram (const uint8_t *frame, size_t len, void *arg) {
+  sim_client_t *c = (sim_client_t*) arg;
+  stream_decoder_push(&c->decoder, frame, len, on_client_frame, c);
+}
+
+/* Applies the simulated loss and swaps, then the reorder window */
+static void receive_datagram (sim_client_t *c, const uint8_t *buf, size_t len) {
+  int64_t now = esp_timer_get_time();
+  double r = rand() / (double) RAND_MAX * 100;
+  if (r < udp_loss) {
+    c->dropped++;
+    return;
+  }
+  if (c->swapped_len == 0 && r < udp_loss + udp_swap && len <= sizeof(c->swapped)) {
+    memcpy(c->swapped, buf, len);
+    c->swapped_len = len;
+    return;
+  }
+  stream_reorder_push(&c->reorder, buf, len, now, on_client_datagram, c);
+  if (c->swapped_len > 0) {
+    stream_reorder_push(&c->reorder, c->swapped, c->swapped_len, now, on_client_datagram, c);
+    c->swapped_len = 0;
+  }
+}
+
+/* Viewer of the datagram stream, joins the group or subscribes every second */
+static void* udp_client_task (void *arg) {
+  sim_client_t *c = (sim_client_t*) arg;
+  uint16_t port = udp_config.port > 0 ? udp_config.port : UDP_STREAM_PORT;
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  int rcvbuf = 1 << 21;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  c->server_addr = (struct sockaddr_in) {
+    .sin_family = AF_INET,
+    .sin_port = htons(port),
+    .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+  };
+  if (udp_config.group != NULL) {
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+    inet_aton(udp_config.group, &addr.sin_addr);
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+      perror("bind");
+      close(fd);
+      return NULL;
+    }
+    struct ip_mreq mreq = { .imr_multiaddr = addr.sin_addr, .imr_interface.s_addr = htonl(INADDR_ANY) };
+    if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) perror("join group");
+  }
+  stream_reorder_init(&c->reorder, SIM_REORDER_WINDOW, SIM_REORDER_DELAY_US);
+  c->start_time = esp_timer_get_time();
+  c->fd = fd;
+
+  uint8_t buf[STREAM_FRAME_MAX_LEN + 1];
+  int64_t last_subscribe = 0;
+  while (c->run) {
+    int64_t now = esp_timer_get_time();
+    if (udp_config.group == NULL && now - last_subscribe >= 1000000) {
+      client_command(c, "subscribe");
+      last_subscribe = now;
+    }
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    int64_t deadline = stream_reorder_deadline(&c->reorder);
+    int timeout = deadline == INT64_MAX ? 100 : (int) ((deadline - now + 999) / 1000);
+    if (poll(&pfd, 1, timeout < 0 ? 0 : timeout) > 0) {
+      ssize_t len = recv(fd, buf, sizeof(buf), 0);
+      if (len < 0) break;
+      /* Commands of the other clients reach the group port too */
+      if (len < (ssize_t) STREAM_FRAME_HEADER_LEN) continue;
+      c->bytes += len;
+      receive_datagram(c, buf, len);
+    }
+    stream_reorder_expire(&c->reorder, esp_timer_get_time(), on_client_datagram, c);
+  }
+  if (udp_config.group == NULL) client_command(c, "unsubscribe");
+  c->fd = -1;
+  close(fd);
+  return NULL;
+}
+
+static int64_t latency_percentile (sim_client_t *c, double p) {
+  uint64_t target = (uint64_t) (p * c->latency_count);
+  uint64_t acc = 0;
+  for (size_t i = 0; i < LATENCY_BINS; i++) {
+    acc += c->latency_hist[i];
+    if (acc > target) return (int64_t) i * LATENCY_BIN_US;
+  }
+  return c->latency_max;
+}
+
+static void usage () {
+  fprintf(stderr, "usage: pas_sim [-r rate] [-w sine|saw|pulse|noise] [-f freq] [-n noise] [-b block] [-d factor[,factor...]] [-z] [-T level,hysteresis,pre,post[,holdoff]] [-F fft_len,windows[,only]] [-t seconds] [-c] [-C clients] [-S us] [-U group|unicast] [-L loss[,swap]] [-A high,low[,hysteresis]] [-P period,stall] [-B kbytes] [-R kbytes[,max]] [-K acquire,process,transmit[,record]] [-Q sensitivity,amp_range[,offset[,frac_bits]]] [-D drift[,margin[,settle]]] [-E rpm[,variation[,edges_per_cycle[,edges_per_sample[,loss[,late]]]]]]\n");
+}
+
+static const char *stage_labels[ACQUISITION_STAGES] = { "acquire", "process", "capture", "transmit", "record" };
+
+/* Share of each emulated core the stages take, over the whole run from their CPU time */
+static void print_stage_usage (double elapsed) {
+  pipeline_stage_stats_t stages[ACQUISITION_STAGES];
+  acquisition_get_stage_stats(stages, ACQUISITION_STAGES);
+  double core_load[2] = {};
+  for (int i = 0; i < ACQUISITION_STAGES; i++) {
+    if (stages[i].name == NULL) continue;
+    double load = stages[i].cpu_us / 1e6 / elapsed;
+    printf(
+      "stage %-8s core %d prio %2u: %5.1f %% of a core, %.2f s CPU\n",
+      stage_labels[i], (int) stages[i].core, stages[i].priority, load * 100, stages[i].cpu_us / 1e6
+    );
+    if (stages[i].core >= 0 && stages[i].core < 2) core_load[stages[i].core] += load;
+  }
+  for (int i = 0; i < 2; i++) printf("core %d: stages %5.1f %%, headroom %5.1f %%\n", i, core_load[i] * 100, (1 - core_load[i]) * 100);
+}
+
+int main (int argc, char **argv) {
+  fake_ads8689_config_t fake = FAKE_ADS8689_DEFAULT_CONFIG();
+  double seconds = 0;
+  bool self_client = false;
+  uint32_t slow_delay_us = 0;
+  fir_decimator_config_t decimation[FIR_DECIMATOR_MAX_STAGES];
+  trigger_config_t trigger;
+  feature_config_t features;
+  ads8689_config_t adc = ADS8689_DEFAULT_CONFIG();
+  calibration_config_t calibration = CALIBRATION_DEFAULT_CONFIG();
+  baseline_config_t baseline = BASELINE_DEFAULT_CONFIG();
+  ads8689_encoder_config_t encoder = ADS8689_ENCODER_DEFAULT_CONFIG();
+  acquisition_backlog_t backlog = {};
+  flash_emulator_t record_flash;
+  flash_log_flash_t record;
+  acquisition_stages_t stages = ACQUISITION_DEFAULT_STAGES();
+  pipeline_stage_config_t transmit = TCP_SERVER_DEFAULT_STAGE();
+  acquisition_config_t acquisition_config = {
+    .decimation = decimation, .n_decimation = 0, .compress = false, .trigger = NULL, .adc = &adc, .stages = &stages
+  };
+
+  int opt;
+  while ((opt = getopt(argc, argv, "r:w:f:n:b:d:zT:F:t:cC:S:U:L:A:P:B:R:K:Q:D:E:")) != -1) {
+    switch (opt) {
+      case 'r': adc.sample_freq = atoll(optarg); break;
+      case 'f': fake.frequency = atof(optarg); break;
+      case 'n': fake.noise = atof(optarg); break;
+      case 'b': fake.block_len = atoi(optarg); break;
+      case 'd':
+        for (char *factor = strtok(optarg, ","); factor && acquisition_config.n_decimation < FIR_DECIMATOR_MAX_STAGES; factor = strtok(NULL, ",")) {
+          decimation[acquisition_config.n_decimation++] = (fir_decimator_config_t) { .factor = atoi(factor) };
+        }
+        break;
+      case 'z': acquisition_config.compress = true; break;
+      case 'T': {
+        int level = 0, hysteresis = 0, pre = 0, post = 0, holdoff = 0;
+        if (sscanf(optarg, "%d,%d,%d,%d,%d", &level, &hysteresis, &pre, &post, &holdoff) < 4) {
+          usage();
+          return 1;
+        }
+        trigger = (trigger_config_t) {
+          .level = level, .hysteresis = hysteresis, .slope = TRIGGER_FALLING,
+          .pre_trigger = pre, .post_trigger = post, .holdoff = holdoff
+        };
+        acquisition_config.trigger = &trigger;
+        break;
+      }
+      case 'F': {
+        int fft_len = 0, windows = 1, only = 0;
+        if (sscanf(optarg, "%d,%d,%d", &fft_len, &windows, &only) < 2) {
+          usage();
+          return 1;
+        }
+        features = (feature_config_t) { .fft_len = fft_len, .windows = windows };
+        acquisition_config.features = &features;
+        acquisition_config.features_only = only != 0;
+        break;
+      }
+      case 't': seconds = atof(optarg); break;
+      case 'c': self_client = true; break;
+      case 'C':
+        n_clients = atoi(optarg);
+        if (n_clients < 1 || n_clients > SIM_MAX_CLIENTS) {
+          usage();
+          return 1;
+        }
+        self_client = true;
+        break;
+      case 'S': slow_delay_us = atoi(optarg); break;
+      case 'U':
+        udp_on = true;
+        udp_config.group = strcmp(optarg, "unicast") == 0 ? NULL : optarg;
+        break;
+      case 'L':
+        if (sscanf(optarg, "%lf,%lf", &udp_loss, &udp_swap) < 1) {
+          usage();
+          return 1;
+        }
+        break;
+      case 'A': {
+        unsigned high = 0, low = 0, hysteresis = 0;
+        if (sscanf(optarg, "%u,%u,%u", &high, &low, &hysteresis) < 2) {
+          usage();
+          return 1;
+        }
+        adc.alarm_high = high;
+        adc.alarm_low = low;
+        adc.alarm_hysteresis = hysteresis;
+        break;
+      }
+      case 'P': {
+        unsigned period = 0, stall = 0;
+        if (sscanf(optarg, "%u,%u", &period, &stall) < 2 || stall >= period) {
+          usage();
+          return 1;
+        }
+        stall_period_us = period * 1000LL;
+        stall_len_us = stall * 1000LL;
+        break;
+      }
+      case 'B':
+        backlog.spiram_len = (size_t) atoi(optarg) * 1024;
+        if (backlog.spiram_len == 0) {
+          usage();
+          return 1;
+        }
+        acquisition_config.backlog = &backlog;
+        break;
+      case 'R': {
+        const flash_timing_t typical = FLASH_TIMING_TYPICAL(), max = FLASH_TIMING_MAX();
+        const char *timing = strchr(optarg, ',');
+        size_t len = atoi(optarg) * 1024 / FLASH_EMULATOR_BLOCK_LEN * FLASH_EMULATOR_BLOCK_LEN;
+        if (!flash_emulator_init(&record_flash, len, FLASH_EMULATOR_BLOCK_LEN, timing != NULL && strcmp(timing, ",max") == 0 ? &max : &typical)) {
+          usage();
+          return 1;
+        }
+        /* The writer task sleeps through the program and erase times */
+        record_flash.realtime = true;
+        flash_emulator_bind(&record_flash, &record);
+        acquisition_config.record = &record;
+        break;
+      }
+      case 'K': {
+        int acquire, process, send, record = stages.record.core;
+        if (sscanf(optarg, "%d,%d,%d,%d", &acquire, &process, &send, &record) < 3) {
+          usage();
+          return 1;
+        }
+        stages.acquire.core = acquire;
+        stages.process.core = process;
+        stages.capture.core = transmit.core = send;
+        stages.record.core = record;
+        break;
+      }
+      case 'Q': {
+        int offset = 0, frac_bits = CALIBRATION_AUTO_FRAC;
+        if (sscanf(optarg, "%f,%f,%d,%d", &calibration.sensitivity, &calibration.amp_range_pc, &offset, &frac_bits) < 2) {
+          usage();
+          return 1;
+        }
+        calibration.offset = offset;
+        calibration.frac_bits = frac_bits;
+        acquisition_config.calibration = &calibration;
+        break;
+      }
+      case 'D': {
+        unsigned margin = 2000, settle = 0;
+        if (sscanf(optarg, "%f,%u,%u", &fake.drift, &margin, &settle) < 1 || margin == 0 || margin > INT16_MAX) {
+          usage();
+          return 1;
+        }
+        fake.reset_gpio = GPIO_NUM_26;
+        baseline.reset_margin = margin;
+        baseline.reset_settle = settle;
+        acquisition_config.baseline = &baseline;
+        break;
+      }
+      case 'E': {
+        unsigned per_cycle = encoder.edges_per_cycle, per_sample = encoder.edges_per_sample;
+        if (sscanf(optarg, "%f,%f,%u,%u,%f,%f", &fake.rpm, &fake.rpm_variation, &per_cycle, &per_sample, &fake.edge_loss, &fake.tdc_late) < 1 ||
+            fake.rpm <= 0 || per_sample == 0) {
+          usage();
+          return 1;
+        }
+        encoder.edges_per_cycle = per_cycle;
+        encoder.edges_per_sample = per_sample;
+        acquisition_config.encoder = &encoder;
+        break;
+      }
+      case 'w':
+        if (strcmp(optarg, "saw") == 0) fake.waveform = FAKE_WAVE_SAW;
+        else if (strcmp(optarg, "pulse") == 0) fake.waveform = FAKE_WAVE_PULSE;
+        else if (strcmp(optarg, "noise") == 0) fake.waveform = FAKE_WAVE_NOISE;
+        else fake.waveform = FAKE_WAVE_SINE;
+        break;
+      default:
+        usage();
+        return 1;
+    }
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  if (acquisition_config.encoder != NULL) {
+    /* Up to the fastest the crank turns, within the SPI frame */
+    double rate = fake.rpm / 120.0 * encoder.edges_per_cycle / encoder.edges_per_sample * (1 + fabs(fake.rpm_variation));
+    uint32_t max_rate = ads8689_config_max_rate(&adc);
+    encoder.max_rate = rate < max_rate ? (uint32_t) ceil(rate) : max_rate;
+    angle_check = fake.noise == 0 && acquisition_config.baseline == NULL && acquisition_config.calibration == NULL;
+  }
+  if (acquisition_config.baseline != NULL) {
+    /* One waveform period per cycle, the floor of the waveform is where the pegs land */
+    baseline.cycle_len = acquisition_config.encoder != NULL ? ads8689_encoder_cycle_len(&encoder) : (uint32_t) lrint(adc.sample_freq / fake.frequency);
+    baseline.reference = (int16_t) lrintf(fake.waveform == FAKE_WAVE_PULSE ? fake.offset : fake.offset - fake.amplitude);
+    if (!charge_amp_init(GPIO_NUM_26, 0)) return 1;
+  }
+  fake_ads8689_configure(&fake);
+  tcp_server_init(NULL, &transmit);
+  if (udp_on && !udp_stream_init(&udp_config)) return 1;
+  if (!event_server_init() || !alarm_events_start()) return 1;
+  acquisition_start(&acquisition_config);
+
+  if (self_client && n_clients == 0) n_clients = 1;
+  for (int i = 0; i < n_clients; i++) {
+    sim_client_t *c = &clients[i];
+    c->run = true;
+    c->fd = -1;
+    c->latency_hist = calloc(LATENCY_BINS, sizeof(uint32_t));
+    c->recv_delay_us = i == n_clients - 1 ? slow_delay_us : 0;
+    c->udp = udp_on;
+    c->bar_min = INFINITY;
+    c->bar_max = -INFINITY;
+    stream_decoder_init(&c->decoder);
+    pthread_create(&c->thread, NULL, udp_on ? udp_client_task : client_task, c);
+  }
+
+  int64_t start = esp_timer_get_time();
+  uint64_t last_samples[SIM_MAX_CLIENTS] = {}, last_bytes[SIM_MAX_CLIENTS] = {};
+  while (seconds <= 0 || esp_timer_get_time() - start < seconds * 1e6) {
+    sleep(1);
+    uint32_t dropped;
+    uint32_t overruns = ads8689_get_overruns(&dropped);
+    printf("generated %llu\toverruns %u (%u samples)", (unsigned long long) fake_ads8689_generated(), overruns, dropped);
+    if (ads8689_index_lost()) printf(" index lost");
+    if (acquisition_config.backlog != NULL) {
+      stream_stats_t sensor;
+      acquisition_get_stats(&sensor);
+      printf("\tbacklog %u/%u", sensor.backlog_depth, sensor.backlog_capacity);
+    }
+    if (acquisition_config.record != NULL) {
+      recorder_stats_t r;
+      recorder_get_stats(&r);
+      printf("\trecorded %llu/%llu, %u/%u sectors", (unsigned long long) r.recorded, (unsigned long long) r.pushed, r.log.used, r.log.sectors);
+    }
+    pipeline_stage_stats_t stage_loads[ACQUISITION_STAGES];
+    acquisition_get_stage_stats(stage_loads, ACQUISITION_STAGES);
+    printf("\tload");
+    for (int i = 0; i < ACQUISITION_STAGES; i++) {
+      if (stage_loads[i].name != NULL) printf(" %s %.1f%%", stage_labels[i], stage_loads[i].load * 100);
+    }
+    for (int i = 0; i < n_clients; i++) {
+      sim_client_t *c = &clients[i];
+      stream_decoder_stats_t *s = &c->decoder.stats;
+      if (n_clients > 1) printf("\t[%d]", i);
+      printf(
+        "\treceived %.1f kS/s, %.1f kB/s\tlost %llu samples",
+        (s->samples - last_samples[i]) / 1e3, (c->bytes - last_bytes[i]) / 1e3, (unsigned long long) s->lost_samples
+      );
+      last_samples[i] = s->samples;
+      last_bytes[i] = c->bytes;
+    }
+    /* Stats frames go to every client, one asks */
+    if (n_clients > 0) client_command(&clients[0], "stats");
+    /* The report at start went out before the clients connected */
+    if (n_clients > 0 && acquisition_config.calibration != NULL && clients[0].calibration_reports == 0) client_command(&clients[0], "calibration");
+    if (n_clients > 0 && acquisition_config.baseline != NULL) client_command(&clients[0], "baseline");
+    printf("\n");
+  }
+
+  ads8689_stop_stream();
+  print_stage_usage((esp_timer_get_time() - start) / 1e6);
+  for (int i = 0; i < n_clients; i++) {
+    sim_client_t *c = &clients[i];
+    c->run = false;
+    stream_decoder_stats_t *s = &c->decoder.stats;
+    double elapsed = (esp_timer_get_time() - c->start_time) / 1e6;
+    if (n_clients > 1) printf("client %d%s: ", i, c->recv_delay_us > 0 ? " (slow)" : "");
+    printf(
+      "throughput %.1f kS/s, %.1f kB/s, frames %llu, lost frames %u, lost samples %llu, crc errors %u\n",
+      s->samples / elapsed / 1e3, c->bytes / elapsed / 1e3, (unsigned long long) s->frames, s->lost_frames,
+      (unsigned long long) s->lost_samples, s->crc_errors
+    );
+    printf(
+      "latency us: p50 %lld p90 %lld p99 %lld max %lld\n",
+      (long long) latency_percentile(c, 0.5), (long long) latency_percentile(c, 0.9),
+      (long long) latency_percentile(c, 0.99), (long long) c->latency_max
+    );
+    if (c->udp) {
+      stream_reorder_stats_t *r = &c->reorder.stats;
+      printf(
+        "datagrams %llu, dropped %u, reordered %u, late %u, duplicates %u\n",
+        (unsigned long long) r->datagrams, c->dropped, r->reordered, r->late, r->duplicates
+      );
+    }
+  }
+  if (udp_on) {
+    udp_stream_stats_t udp;
+    udp_stream_get_stats(&udp);
+    printf(
+      "udp server: %u datagrams, %.1f MB, %u dropped, %u skips, %u subscribed\n",
+      udp.datagrams, udp.bytes / 1e6, udp.dropped, udp.skips, udp.peers
+    );
+  }
+  if (n_clients > 0) {
+    tcp_client_stats_t server_stats[TCP_SERVER_MAX_CLIENTS];
+    size_t n = tcp_server_get_client_stats(server_stats, TCP_SERVER_MAX_CLIENTS);
+    for (size_t i = 0; i < n; i++) {
+      tcp_client_stats_t *st = &server_stats[i];
+      if (!st->connected) continue;
+      printf(
+        "server slot %zu: frames %u, %.1f MB in %u blocks (%.0f B avg, target %u B), socket full %u, skips %u (%.1f kB), send max %u us\n",
+        i, st->frames, st->bytes / 1e6, st->blocks, st->blocks > 0 ? (double) st->bytes / st->blocks : 0.0,
+        st->block_len, st->would_block, st->skips, st->skipped_bytes / 1e3, st->send_max_us
+      );
+    }
+  }
+  if (acquisition_config.record != NULL) {
+    recorder_stats_t r;
+    download_server_stats_t downloads;
+    recorder_get_stats(&r);
+    download_server_get_stats(&downloads);
+    printf(
+      "recorder: %llu samples in %u frames, %.2f B/sample, %u waits for a slot, append max %u us, flash busy %.1f s, sectors %u/%u erased %u..%u, overwritten %u\n",
+      (unsigned long long) r.recorded, r.frames, r.recorded > 0 ? (double) r.bytes / r.recorded : 0.0, r.waits, r.append_max_us,
+      record_flash.stats.busy_us / 1e6, r.log.used, r.log.sectors, r.log.erase_min, r.log.erase_max, r.log.overwritten
+    );
+    printf(
+      "downloads: %u started, %u completed, %.1f MB, last at %.1f MB/s\n",
+      downloads.downloads, downloads.completed, downloads.bytes / 1e6, downloads.last_rate / 1e6
+    );
+  }
+  alarm_events_stats_t alarms;
+  alarm_events_get_stats(&alarms);
+  if (alarms.events > 0) {
+    event_server_stats_t events;
+    event_server_get_stats(&events);
+    printf(
+      "alarm events %u, lost %u, unsent %u, to %u event clients: latency from conversion mean %u max %u us, detection max %u us\n",
+      alarms.events, alarms.lost, alarms.unsent, events.clients, alarms.latency_mean_us, alarms.latency_max_us, alarms.detection_max_us
+    );
+  }
+  if (n_clients > 0) {
+    sim_client_t client = clients[0];
+    if (client.calibration_reports > 0) {
+      stream_calibration_t *cal = &client.calibration;
+      printf(
+        "calibration %08x (%u reports): %s, range %#x at %.3g V/code, %.2f pC/bar, amplifier %.0f pC for %.1f V, bar = value * 2^-%d\n",
+        cal->hash, client.calibration_reports, cal->enabled ? "on" : "off", cal->range, cal->lsb_volts,
+        cal->sensitivity, cal->amp_range_pc, cal->amp_full_scale_v, cal->frac_bits
+      );
+      printf("  calibrated frames %llu, with another tag %u", (unsigned long long) client.calibrated_frames, client.untagged_frames);
+      if (client.bar_min <= client.bar_max) printf(", raw frames from %.3f to %.3f bar", client.bar_min, client.bar_max);
+      printf("\n");
+    }
+    if (client.baseline_reports > 0) {
+      stream_baseline_t *b = &client.baseline;
+      printf(
+        "baseline (%u reports): level %.1f, rest %.1f, drift %.1f LSB/s, %u pegs, %u amplifier resets, last at sample %llu%s\n",
+        client.baseline_reports, b->level, b->rest, b->drift, b->pegs, b->resets,
+        (unsigned long long) b->reset_index, b->reset_pending ? ", one pending" : ""
+      );
+      printf("  frames flagged with a reset %u, reset pulses %u\n", client.reset_frames, charge_amp_resets());
+    }
+    if (acquisition_config.encoder != NULL) {
+      ads8689_encoder_stats_t e;
+      uint64_t lost;
+      uint32_t late;
+      ads8689_encoder_get_stats(&e);
+      fake_ads8689_encoder_faults(&lost, &late);
+      printf(
+        "encoder: %u TDC pulses, %u late snapped back, %u sync errors (last %d), %u spurious, %u skipped edges; injected %llu lost edges, %u late TDC interrupts\n",
+        e.tdc_count, e.tdc_late, e.sync_errors, e.last_slip, e.spurious, e.skipped, (unsigned long long) lost, late
+      );
+      printf(
+        "  angle frames %llu up to cycle %u, %u not where the last one left off",
+        (unsigned long long) client.angle_frames, client.last_cycle, client.angle_jumps
+      );
+      if (angle_check) {
+        printf(
+          ", %llu samples checked, %llu off their angle (%.3f%%)",
+          (unsigned long long) client.angle_checked, (unsigned long long) client.angle_mismatches,
+          client.angle_checked > 0 ? 100.0 * client.angle_mismatches / client.angle_checked : 0.0
+        );
+      }
+      printf("\n");
+      stream_cycle_t *r = &client.last_cycle_report;
+      printf(
+        "  cycle reports %u, last cycle %u: peak %d at angle %u, low %d at angle %u, p-p %d",
+        client.cycle_reports, r->cycle, r->max, r->max_angle, r->min, r->min_angle, r->max - r->min
+      );
+      if (angle_check) printf(", %u off the waveform", client.cycle_mismatches);
+      printf("\n");
+    }
+    if (acquisition_config.trigger != NULL) {
+      printf("captures %u, missed %u\n", client.captures, client.captures_missed);
+    }
+    if (acquisition_config.features != NULL) {
+      stream_features_t *f = &client.last_features;
+      printf(
+        "feature reports %u, last: min %d max %d mean %.1f rms %.1f dominant %.2f Hz amplitude %.1f\n",
+        client.feature_reports, f->min, f->max, f->mean, f->ac_rms, f->dominant_freq, f->dominant_amplitude
+      );
+    }
+    if (client.stats_frames > 0) {
+      stream_stats_t *st = &client.last_stats;
+      printf(
+        "sensor stats (%u): produced %.1f kS/s sent %.1f kS/s, ring high water %u/%u, overruns %u (%u samples)\n"
+        "  block latency ns min %u mean %u max %u, period jitter max %u ns, send us p50 %u p90 %u p99 %u max %u\n"
+        "  jitter histogram:",
+        client.stats_frames, st->produced_rate / 1e3, st->sent_rate / 1e3, st->ring_high_water, st->ring_len,
+        st->overruns, st->dropped, st->isr_latency_min_ns, st->isr_latency_mean_ns, st->isr_latency_max_ns,
+        st->jitter_max_ns, st->send_p50_us, st->send_p90_us, st->send_p99_us, st->send_max_us
+      );
+      for (int i = 0; i < STREAM_STATS_JITTER_BINS; i++) printf(" %u", st->jitter_hist[i]);
+      printf("\n");
+      if (st->backlog_capacity > 0) {
+        printf(
+          "  backlog %u/%u samples, high water %u (%.0f ms), refused %u blocks\n",
+          st->backlog_depth, st->backlog_capacity, st->backlog_high_water,
+          st->produced_rate > 0 ? st->backlog_high_water * 1e3 / st->produced_rate : 0.0, st->backlog_full
+        );
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,52 @@
+/**
+ * @file gpio.h
+ *
+ * @brief Host stub of the GPIO driver, levels are kept in memory so the
+ * simulator can observe outputs
+ */
+#ifndef HOST_STUB_DRIVER_GPIO_H
+#define HOST_STUB_DRIVER_GPIO_H
+
+#include "esp_err.h"
+
+typedef enum {
+  GPIO_NUM_NC = -1,
+  GPIO_NUM_0 = 0, GPIO_NUM_1, GPIO_NUM_2, GPIO_NUM_3, GPIO_NUM_4, GPIO_NUM_5,
+  GPIO_NUM_6, GPIO_NUM_7, GPIO_NUM_8, GPIO_NUM_9, GPIO_NUM_10, GPIO_NUM_11,
+  GPIO_NUM_12, GPIO_NUM_13, GPIO_NUM_14, GPIO_NUM_15, GPIO_NUM_16, GPIO_NUM_17,
+  GPIO_NUM_18, GPIO_NUM_19, GPIO_NUM_20, GPIO_NUM_21, GPIO_NUM_22, GPIO_NUM_23,
+  GPIO_NUM_25 = 25, GPIO_NUM_26, GPIO_NUM_27,
+  GPIO_NUM_32 = 32, GPIO_NUM_33, GPIO_NUM_34, GPIO_NUM_35, GPIO_NUM_36,
+  GPIO_NUM_37, GPIO_NUM_38, GPIO_NUM_39,
+  GPIO_NUM_MAX
+} gpio_num_t;
+
+typedef enum {
+  GPIO_MODE_DISABLE = 0,
+  GPIO_MODE_INPUT,
+  GPIO_MODE_OUTPUT,
+  GPIO_MODE_OUTPUT_OD,
+  GPIO_MODE_INPUT_OUTPUT_OD,
+  GPIO_MODE_INPUT_OUTPUT
+} gpio_mode_t;
+
+extern int host_gpio_levels[GPIO_NUM_MAX];
+/* Level changes of each pin, a pulse shorter than the simulator looks is still seen */
+extern volatile unsigned host_gpio_changes[GPIO_NUM_MAX];
+
+static inline esp_err_t gpio_set_direction (gpio_num_t gpio, gpio_mode_t mode) {
+  return (gpio >= 0 && gpio < GPIO_NUM_MAX) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+static inline esp_err_t gpio_set_level (gpio_num_t gpio, uint32_t level) {
+  if (gpio < 0 || gpio >= GPIO_NUM_MAX) return ESP_ERR_INVALID_ARG;
+  if (host_gpio_levels[gpio] != (int) level) host_gpio_changes[gpio]++;
+  host_gpio_levels[gpio] = level;
+  return ESP_OK;
+}
+
+static inline int gpio_get_level (gpio_num_t gpio) {
+  return (gpio >= 0 && gpio < GPIO_NUM_MAX) ? host_gpio_levels[gpio] : 0;
+}
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef HOST_STUB_DRIVER_SPI_COMMON_H
+#define HOST_STUB_DRIVER_SPI_COMMON_H
+
+#include "esp_err.h"
+
+#define SPI_MASTER_FREQ_8M   (80 * 1000 * 1000 / 10)
+#define SPI_MASTER_FREQ_10M  (80 * 1000 * 1000 / 8)
+#define SPI_MASTER_FREQ_20M  (80 * 1000 * 1000 / 4)
+#define SPI_MASTER_FREQ_40M  (80 * 1000 * 1000 / 2)
+
+typedef enum {
+  SPI1_HOST = 0,
+  SPI2_HOST = 1,
+  SPI3_HOST = 2
+} spi_host_device_t;
+
+typedef struct {
+  int mosi_io_num;
+  int miso_io_num;
+  int sclk_io_num;
+  int quadwp_io_num;
+  int quadhd_io_num;
+  int max_transfer_sz;
+  uint32_t flags;
+  int intr_flags;
+} spi_bus_config_t;
+
+#endif
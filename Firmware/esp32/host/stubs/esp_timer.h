@@ -0,0 +1,43 @@
+/**
+ * @file esp_timer.h
+ *
+ * @brief Host stub of esp_timer, time is CLOCK_MONOTONIC in us so host tools
+ * on the same machine can compare it with their own clock. One shot timers
+ * run their callback on a thread of their own
+ */
+#ifndef HOST_STUB_ESP_TIMER_H
+#define HOST_STUB_ESP_TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "esp_err.h"
+
+typedef struct host_esp_timer* esp_timer_handle_t;
+typedef void (*esp_timer_cb_t) (void *arg);
+
+typedef enum {
+  ESP_TIMER_TASK = 0
+} esp_timer_dispatch_t;
+
+typedef struct {
+  esp_timer_cb_t callback;
+  void *arg;
+  esp_timer_dispatch_t dispatch_method;
+  const char *name;
+  bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+/* One thread per timer, the callbacks run on it like on the esp_timer task */
+esp_err_t esp_timer_create (const esp_timer_create_args_t *args, esp_timer_handle_t *handle);
+esp_err_t esp_timer_start_once (esp_timer_handle_t timer, uint64_t timeout_us);
+esp_err_t esp_timer_stop (esp_timer_handle_t timer);
+
+static inline int64_t esp_timer_get_time (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#endif
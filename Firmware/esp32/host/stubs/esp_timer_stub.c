@@ -0,0 +1,83 @@
+/**
+ * @file esp_timer_stub.c
+ *
+ * @brief One shot esp_timer on a thread per timer, waiting on CLOCK_MONOTONIC
+ * like esp_timer_get_time()
+ */
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "esp_timer.h"
+
+#define NOT_ARMED (INT64_MAX)
+
+struct host_esp_timer {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  esp_timer_cb_t callback;
+  void *arg;
+  /* esp_timer time the callback is due at */
+  int64_t deadline;
+};
+
+static void* timer_thread (void *arg) {
+  struct host_esp_timer *timer = (struct host_esp_timer*) arg;
+  pthread_mutex_lock(&timer->lock);
+  while (1) {
+    if (timer->deadline == NOT_ARMED) {
+      pthread_cond_wait(&timer->cond, &timer->lock);
+      continue;
+    }
+    int64_t deadline = timer->deadline;
+    if (esp_timer_get_time() < deadline) {
+      struct timespec ts = { .tv_sec = deadline / 1000000, .tv_nsec = (deadline % 1000000) * 1000 };
+      pthread_cond_timedwait(&timer->cond, &timer->lock, &ts);
+      continue;
+    }
+    /* Disarmed before the call, the callback may start it again */
+    timer->deadline = NOT_ARMED;
+    pthread_mutex_unlock(&timer->lock);
+    timer->callback(timer->arg);
+    pthread_mutex_lock(&timer->lock);
+  }
+  return NULL;
+}
+
+esp_err_t esp_timer_create (const esp_timer_create_args_t *args, esp_timer_handle_t *handle) {
+  if (args == NULL || args->callback == NULL || handle == NULL) return ESP_ERR_INVALID_ARG;
+  struct host_esp_timer *timer = calloc(1, sizeof(struct host_esp_timer));
+  if (timer == NULL) return ESP_ERR_NO_MEM;
+  timer->callback = args->callback;
+  timer->arg = args->arg;
+  timer->deadline = NOT_ARMED;
+  pthread_mutex_init(&timer->lock, NULL);
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&timer->cond, &attr);
+  pthread_create(&timer->thread, NULL, timer_thread, timer);
+  *handle = timer;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once (esp_timer_handle_t timer, uint64_t timeout_us) {
+  pthread_mutex_lock(&timer->lock);
+  if (timer->deadline != NOT_ARMED) {
+    pthread_mutex_unlock(&timer->lock);
+    return ESP_ERR_INVALID_STATE;
+  }
+  timer->deadline = esp_timer_get_time() + (int64_t) timeout_us;
+  pthread_cond_signal(&timer->cond);
+  pthread_mutex_unlock(&timer->lock);
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_stop (esp_timer_handle_t timer) {
+  pthread_mutex_lock(&timer->lock);
+  bool armed = timer->deadline != NOT_ARMED;
+  timer->deadline = NOT_ARMED;
+  pthread_cond_signal(&timer->cond);
+  pthread_mutex_unlock(&timer->lock);
+  return armed ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
@@ -0,0 +1,38 @@
+/**
+ * @file esp_wifi.h
+ *
+ * @brief Host stub with the WiFi and netif types used by network_wifi.h
+ */
+#ifndef HOST_STUB_ESP_WIFI_H
+#define HOST_STUB_ESP_WIFI_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef struct {
+  uint8_t bssid[6];
+  uint8_t ssid[33];
+  uint8_t primary;
+  int8_t rssi;
+} wifi_ap_record_t;
+
+typedef struct {
+  uint32_t addr;
+} esp_ip4_addr_t;
+
+typedef struct {
+  uint32_t addr[4];
+  uint8_t zone;
+} esp_ip6_addr_t;
+
+typedef struct {
+  esp_ip4_addr_t ip;
+  esp_ip4_addr_t netmask;
+  esp_ip4_addr_t gw;
+} esp_netif_ip_info_t;
+
+typedef struct {
+  esp_ip6_addr_t ip;
+} esp_netif_ip6_info_t;
+
+#endif
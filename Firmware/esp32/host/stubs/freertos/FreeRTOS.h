@@ -0,0 +1,35 @@
+/**
+ * @file FreeRTOS.h
+ *
+ * @brief Host stub of the FreeRTOS subset used by the firmware, tasks are
+ * pthreads and one tick is one millisecond (CONFIG_FREERTOS_HZ=1000)
+ */
+#ifndef HOST_STUB_FREERTOS_H
+#define HOST_STUB_FREERTOS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "esp_attr.h"
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE  1
+#define pdFALSE 0
+#define pdPASS  pdTRUE
+#define pdFAIL  pdFALSE
+
+#define portMAX_DELAY       ((TickType_t) 0xFFFFFFFF)
+#define configTICK_RATE_HZ  1000
+#define portTICK_PERIOD_MS  (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)   ((TickType_t) (((uint64_t) (ms) * configTICK_RATE_HZ) / 1000))
+
+/* Run time counters are the thread CPU clocks, see vTaskGetInfo() */
+#define configGENERATE_RUN_TIME_STATS 1
+
+#define portYIELD_FROM_ISR()  do {} while (0)
+
+#endif
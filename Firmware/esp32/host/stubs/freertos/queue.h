@@ -0,0 +1,24 @@
+#ifndef HOST_STUB_FREERTOS_QUEUE_H
+#define HOST_STUB_FREERTOS_QUEUE_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_queue* QueueHandle_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+QueueHandle_t xQueueCreate (UBaseType_t length, UBaseType_t item_size);
+BaseType_t xQueueSend (QueueHandle_t queue, const void *item, TickType_t ticks_to_wait);
+BaseType_t xQueueReceive (QueueHandle_t queue, void *item, TickType_t ticks_to_wait);
+UBaseType_t uxQueueMessagesWaiting (QueueHandle_t queue);
+
+#define xQueueSendFromISR(queue, item, task_woken) xQueueSend(queue, item, 0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef HOST_STUB_FREERTOS_SEMPHR_H
+#define HOST_STUB_FREERTOS_SEMPHR_H
+
+#include "freertos/queue.h"
+
+/* Binary semaphores are queues of one empty item, as in FreeRTOS */
+typedef QueueHandle_t SemaphoreHandle_t;
+
+#define xSemaphoreCreateBinary() xQueueCreate(1, 0)
+#define xSemaphoreGive(semaphore) xQueueSend(semaphore, NULL, 0)
+#define xSemaphoreTake(semaphore, ticks_to_wait) xQueueReceive(semaphore, NULL, ticks_to_wait)
+
+/* A mutex is a binary semaphore given once, no priority inheritance on the host */
+static inline SemaphoreHandle_t xSemaphoreCreateMutex (void) {
+  SemaphoreHandle_t mutex = xSemaphoreCreateBinary();
+  xSemaphoreGive(mutex);
+  return mutex;
+}
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef HOST_STUB_FREERTOS_TASK_H
+#define HOST_STUB_FREERTOS_TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_task* TaskHandle_t;
+typedef void (*TaskFunction_t) (void *arg);
+
+#define tskNO_AFFINITY (0x7FFFFFFF)
+
+typedef enum eTaskState {
+  eRunning = 0,
+  eReady,
+  eBlocked,
+  eSuspended,
+  eDeleted,
+  eInvalid
+} eTaskState;
+
+/* Subset of the fields, ulRunTimeCounter is the CPU time of the thread in us */
+typedef struct TaskStatus_t {
+  TaskHandle_t xHandle;
+  const char *pcTaskName;
+  eTaskState eCurrentState;
+  uint32_t ulRunTimeCounter;
+} TaskStatus_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief Starts a thread, pinned to host CPU core_id modulo the CPU count
+ * unless core_id is tskNO_AFFINITY. The priority is not applied
+ */
+BaseType_t xTaskCreatePinnedToCore (
+  TaskFunction_t task, const char *name, uint32_t stack_depth, void *arg,
+  UBaseType_t priority, TaskHandle_t *handle, BaseType_t core_id
+);
+
+#define xTaskCreate(task, name, stack_depth, arg, priority, handle) \
+  xTaskCreatePinnedToCore(task, name, stack_depth, arg, priority, handle, tskNO_AFFINITY)
+
+/** @brief Name and CPU time of the thread, the state is always eRunning */
+void vTaskGetInfo (TaskHandle_t task, TaskStatus_t *status, BaseType_t get_free_stack, eTaskState state);
+
+/** @brief Only NULL (the calling task) is supported */
+void vTaskDelete (TaskHandle_t task);
+void vTaskDelay (TickType_t ticks);
+TickType_t xTaskGetTickCount (void);
+TaskHandle_t xTaskGetCurrentTaskHandle (void);
+
+/** @brief Blocks the task until vTaskResume(), only the calling task can be suspended */
+void vTaskSuspend (TaskHandle_t task);
+void vTaskResume (TaskHandle_t task);
+
+uint32_t ulTaskNotifyTake (BaseType_t clear_on_exit, TickType_t ticks_to_wait);
+void xTaskNotifyGive (TaskHandle_t task);
+void vTaskNotifyGiveFromISR (TaskHandle_t task, BaseType_t *task_woken);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,228 @@
+/**
+ * @file freertos_posix.c
+ *
+ * @brief FreeRTOS task, notification and queue API on top of pthreads
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+struct host_task {
+  pthread_t thread;
+  TaskFunction_t function;
+  void *arg;
+  char name[16];
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  uint32_t notify_count;
+  bool suspended;
+};
+
+struct host_queue {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  uint8_t *items;
+  size_t item_size;
+  size_t length;
+  size_t head;
+  size_t count;
+};
+
+static __thread struct host_task *current_task = NULL;
+
+static struct timespec deadline_after (TickType_t ticks) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  uint64_t ns = (uint64_t) ticks * (1000000000 / configTICK_RATE_HZ) + ts.tv_nsec;
+  ts.tv_sec += ns / 1000000000;
+  ts.tv_nsec = ns % 1000000000;
+  return ts;
+}
+
+static struct host_task* task_alloc (TaskFunction_t function, void *arg, const char *name) {
+  struct host_task *task = calloc(1, sizeof(struct host_task));
+  task->function = function;
+  task->arg = arg;
+  strncpy(task->name, name, sizeof(task->name) - 1);
+  pthread_mutex_init(&task->lock, NULL);
+  pthread_cond_init(&task->cond, NULL);
+  return task;
+}
+
+static void* task_entry (void *arg) {
+  struct host_task *task = (struct host_task*) arg;
+  current_task = task;
+  task->function(task->arg);
+  return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore (
+  TaskFunction_t function, const char *name, uint32_t stack_depth, void *arg,
+  UBaseType_t priority, TaskHandle_t *handle, BaseType_t core_id
+) {
+  struct host_task *task = task_alloc(function, arg, name);
+  if (handle != NULL) *handle = task;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  if (core_id != tskNO_AFFINITY && core_id >= 0) {
+    /* Cores of the ESP32 on host CPUs, all on one with a single CPU */
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core_id % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+  }
+  int err = pthread_create(&task->thread, &attr, task_entry, task);
+  pthread_attr_destroy(&attr);
+  if (err != 0) return pdFAIL;
+  pthread_setname_np(task->thread, task->name);
+  pthread_detach(task->thread);
+  return pdPASS;
+}
+
+void vTaskGetInfo (TaskHandle_t task, TaskStatus_t *status, BaseType_t get_free_stack, eTaskState state) {
+  if (task == NULL) task = xTaskGetCurrentTaskHandle();
+  struct timespec ts = {};
+  clockid_t clock;
+  if (pthread_getcpuclockid(task->thread, &clock) == 0) clock_gettime(clock, &ts);
+  *status = (TaskStatus_t) {
+    .xHandle = task,
+    .pcTaskName = task->name,
+    .eCurrentState = eRunning,
+    .ulRunTimeCounter = (uint32_t) (ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000)
+  };
+}
+
+void vTaskDelete (TaskHandle_t task) {
+  if (task == NULL || task == current_task) pthread_exit(NULL);
+  /* Deleting another task is not supported on the host */
+}
+
+void vTaskDelay (TickType_t ticks) {
+  struct timespec ts = {
+    .tv_sec = ticks / configTICK_RATE_HZ,
+    .tv_nsec = (ticks % configTICK_RATE_HZ) * (1000000000 / configTICK_RATE_HZ)
+  };
+  while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+}
+
+TickType_t xTaskGetTickCount (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (TickType_t) (ts.tv_sec * configTICK_RATE_HZ + ts.tv_nsec / (1000000000 / configTICK_RATE_HZ));
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle (void) {
+  /* Threads not created by xTaskCreate get a handle on first use */
+  if (current_task == NULL) {
+    current_task = task_alloc(NULL, NULL, "host");
+    current_task->thread = pthread_self();
+  }
+  return current_task;
+}
+
+void vTaskSuspend (TaskHandle_t task) {
+  if (task == NULL) task = xTaskGetCurrentTaskHandle();
+  pthread_mutex_lock(&task->lock);
+  task->suspended = true;
+  while (task->suspended) pthread_cond_wait(&task->cond, &task->lock);
+  pthread_mutex_unlock(&task->lock);
+}
+
+void vTaskResume (TaskHandle_t task) {
+  pthread_mutex_lock(&task->lock);
+  task->suspended = false;
+  pthread_cond_broadcast(&task->cond);
+  pthread_mutex_unlock(&task->lock);
+}
+
+uint32_t ulTaskNotifyTake (BaseType_t clear_on_exit, TickType_t ticks_to_wait) {
+  struct host_task *task = xTaskGetCurrentTaskHandle();
+  struct timespec deadline = deadline_after(ticks_to_wait);
+
+  pthread_mutex_lock(&task->lock);
+  while (task->notify_count == 0 && ticks_to_wait > 0) {
+    int err = (ticks_to_wait == portMAX_DELAY)
+      ? pthread_cond_wait(&task->cond, &task->lock)
+      : pthread_cond_timedwait(&task->cond, &task->lock, &deadline);
+    if (err == ETIMEDOUT) break;
+  }
+  uint32_t count = task->notify_count;
+  if (count > 0) task->notify_count = clear_on_exit ? 0 : count - 1;
+  pthread_mutex_unlock(&task->lock);
+  return count;
+}
+
+void xTaskNotifyGive (TaskHandle_t task) {
+  pthread_mutex_lock(&task->lock);
+  task->notify_count++;
+  pthread_cond_broadcast(&task->cond);
+  pthread_mutex_unlock(&task->lock);
+}
+
+void vTaskNotifyGiveFromISR (TaskHandle_t task, BaseType_t *task_woken) {
+  xTaskNotifyGive(task);
+  if (task_woken != NULL) *task_woken = pdTRUE;
+}
+
+QueueHandle_t xQueueCreate (UBaseType_t length, UBaseType_t item_size) {
+  struct host_queue *queue = calloc(1, sizeof(struct host_queue));
+  queue->items = malloc(length * item_size);
+  queue->item_size = item_size;
+  queue->length = length;
+  pthread_mutex_init(&queue->lock, NULL);
+  pthread_cond_init(&queue->cond, NULL);
+  return queue;
+}
+
+BaseType_t xQueueSend (QueueHandle_t queue, const void *item, TickType_t ticks_to_wait) {
+  struct timespec deadline = deadline_after(ticks_to_wait);
+  pthread_mutex_lock(&queue->lock);
+  while (queue->count == queue->length) {
+    if (ticks_to_wait == 0 || pthread_cond_timedwait(&queue->cond, &queue->lock, &deadline) == ETIMEDOUT) {
+      pthread_mutex_unlock(&queue->lock);
+      return pdFAIL;
+    }
+  }
+  size_t tail = (queue->head + queue->count) % queue->length;
+  memcpy(&queue->items[tail * queue->item_size], item, queue->item_size);
+  queue->count++;
+  pthread_cond_broadcast(&queue->cond);
+  pthread_mutex_unlock(&queue->lock);
+  return pdPASS;
+}
+
+BaseType_t xQueueReceive (QueueHandle_t queue, void *item, TickType_t ticks_to_wait) {
+  struct timespec deadline = deadline_after(ticks_to_wait);
+  pthread_mutex_lock(&queue->lock);
+  while (queue->count == 0) {
+    int err = (ticks_to_wait == portMAX_DELAY)
+      ? pthread_cond_wait(&queue->cond, &queue->lock)
+      : (ticks_to_wait == 0 ? ETIMEDOUT : pthread_cond_timedwait(&queue->cond, &queue->lock, &deadline));
+    if (err == ETIMEDOUT) {
+      pthread_mutex_unlock(&queue->lock);
+      return pdFAIL;
+    }
+  }
+  memcpy(item, &queue->items[queue->head * queue->item_size], queue->item_size);
+  queue->head = (queue->head + 1) % queue->length;
+  queue->count--;
+  pthread_cond_broadcast(&queue->cond);
+  pthread_mutex_unlock(&queue->lock);
+  return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting (QueueHandle_t queue) {
+  pthread_mutex_lock(&queue->lock);
+  UBaseType_t count = queue->count;
+  pthread_mutex_unlock(&queue->lock);
+  return count;
+}
@@ -0,0 +1,4 @@
+#include "driver/gpio.h"
+
+int host_gpio_levels[GPIO_NUM_MAX];
+volatile unsigned host_gpio_changes[GPIO_NUM_MAX];
@@ -0,0 +1,18 @@
+/**
+ * @file cpu_hal.h
+ *
+ * @brief Host stub of the cycle counter, counts nanoseconds
+ */
+#ifndef CPU_HAL_H
+#define CPU_HAL_H
+
+#include <stdint.h>
+#include <time.h>
+
+static inline uint32_t cpu_hal_get_cycle_count (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t) ((uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
+
+#endif
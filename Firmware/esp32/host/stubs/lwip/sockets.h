@@ -0,0 +1,43 @@
+/**
+ * @file sockets.h
+ *
+ * @brief Host stub of the lwIP socket API, mapped to POSIX sockets
+ */
+#ifndef HOST_STUB_LWIP_SOCKETS_H
+#define HOST_STUB_LWIP_SOCKETS_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define lwip_writev writev
+
+/* lwIP send buffer of the default sdkconfig */
+#ifndef CONFIG_LWIP_TCP_SND_BUF_DEFAULT
+#define CONFIG_LWIP_TCP_SND_BUF_DEFAULT (5744)
+#endif
+
+/* Accepted sockets get the small send buffer of lwIP, a slow client then
+ * backs up into the server as on the device instead of into the host kernel */
+static inline int host_lwip_accept (int fd, struct sockaddr *addr, socklen_t *addr_len) {
+  int socket = accept(fd, addr, addr_len);
+  if (socket >= 0) {
+    int sndbuf = CONFIG_LWIP_TCP_SND_BUF_DEFAULT;
+    setsockopt(socket, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+  }
+  return socket;
+}
+#define accept host_lwip_accept
+
+#define inet_ntoa_r(addr, buf, buflen) inet_ntop(AF_INET, &(addr), buf, buflen)
+#define inet6_ntoa_r(addr, buf, buflen) inet_ntop(AF_INET6, &(addr), buf, buflen)
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef HOST_STUB_LWIP_SYS_H
+#define HOST_STUB_LWIP_SYS_H
+
+#include "lwip/sockets.h"
+#include <netdb.h>
+
+#endif
@@ -0,0 +1,44 @@
+/**
+ * @file lldesc.h
+ *
+ * @brief Host mock of the ESP32 ROM DMA linked list descriptor, same bit
+ * layout as components/esp_rom/include/esp32/rom/lldesc.h
+ */
+#ifndef HOST_STUB_LLDESC_H
+#define HOST_STUB_LLDESC_H
+
+#include <stdint.h>
+#include <sys/queue.h>
+
+typedef struct lldesc_s {
+  volatile uint32_t size  : 12,
+                    length: 12,
+                    offset: 5,
+                    sosf  : 1,
+                    eof   : 1,
+                    owner : 1;
+  volatile uint8_t *buf;
+  union {
+    volatile uint32_t empty;
+    STAILQ_ENTRY(lldesc_s) qe;
+  };
+} lldesc_t;
+
+/**
+ * @brief Emulates the SPI DMA receiving one word in continue mode. Fills the
+ * current descriptor and moves to the next one when it is full.
+ *
+ * @return next descriptor to be written by the DMA
+ */
+static inline lldesc_t* lldesc_mock_dma_push (lldesc_t *d, uint32_t word) {
+  if (!d->owner) return d;
+  *(volatile uint32_t*) (d->buf + d->length) = word;
+  d->length += sizeof(uint32_t);
+  if (d->length >= d->size) {
+    d->owner = 0;
+    return d->qe.stqe_next;
+  }
+  return d;
+}
+
+#endif
@@ -0,0 +1,176 @@
+/**
+ * @file test_dma_chain.c
+ *
+ * @brief Checks the DMA block chain against the lldesc_t mock of the SPI DMA.
+ * Frames are pushed as the ADS8689 shifts them out, every sample carrying its
+ * index, some with input alarm flags:
+ *  - a service after every block, wrapping the descriptor ring many times,
+ *  - late services finding several blocks done and one partly filled,
+ *  - blocks completed while the service runs, not overruns,
+ *  - a service so late the DMA stalled on a full ring, counted as an overrun,
+ *  - the in place conversion of the samples and flags of each block.
+ *
+ * usage: test_dma_chain
+ * Exits with the number of failed checks.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ads8689_dma_chain.h"
+
+#define N_BLOCKS (4)
+#define BLOCK_LEN (32)
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+      failures++; \
+      if (failures <= 20) { \
+        printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+      } \
+    } \
+  } while (0)
+
+typedef struct received_t {
+  uint32_t next_index;
+  uint32_t blocks;
+  uint32_t flagged_blocks;
+  /* Frames the DMA receives while the first block of a service is converted */
+  size_t push_during;
+} received_t;
+
+static ads8689_dma_chain_t chain;
+static lldesc_t desc[N_BLOCKS];
+static uint32_t words[N_BLOCKS * BLOCK_LEN];
+/* Next descriptor the mock DMA writes and index of the next frame */
+static lldesc_t *dma;
+static uint32_t dma_index;
+
+/* Alarm flags of the frame of a sample, on one sample in 97 */
+static uint8_t flags_of (uint32_t index) {
+  return index % 97 == 0 ? (uint8_t) (1 + index / 97 % 3) : 0;
+}
+
+/* Frame as the SPI DMA stores it: data in bits 29:14, flags in 13:12, big endian */
+static uint32_t frame_of (uint32_t index) {
+  uint32_t frame = ((uint32_t) (uint16_t) (int16_t) index << 14) | ((uint32_t) flags_of(index) << 12);
+  return __builtin_bswap32(frame);
+}
+
+static void dma_push (size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    lldesc_t *d = dma;
+    dma = lldesc_mock_dma_push(dma, frame_of(dma_index));
+    /* A stalled DMA drops the frame, as the SPI FIFO would */
+    if (d->owner || dma != d) dma_index++;
+  }
+}
+
+static void on_block (const int16_t *samples, const uint8_t *flags, size_t len, void *arg) {
+  received_t *r = (received_t*) arg;
+  CHECK(len == BLOCK_LEN, "block of %zu samples", len);
+  bool any = false;
+  for (size_t i = 0; i < len; i++) {
+    uint32_t index = r->next_index + i;
+    CHECK(samples[i] == (int16_t) index, "sample %d at index %u", samples[i], index);
+    uint8_t expected = flags_of(index);
+    any |= expected != 0;
+    if (flags != NULL) CHECK(flags[i] == expected, "flags %u at index %u, expected %u", flags[i], index, expected);
+  }
+  CHECK((flags != NULL) == any, "flags %s for block %u", flags != NULL ? "given" : "missing", r->blocks);
+  r->flagged_blocks += flags != NULL;
+  r->next_index += len;
+  r->blocks++;
+  dma_push(r->push_during);
+  r->push_during = 0;
+}
+
+/* The ISR passes the inlink descriptor address the DMA is at */
+static size_t service (received_t *r) {
+  return ads8689_dma_chain_service(&chain, (uint32_t) (uintptr_t) dma, on_block, r);
+}
+
+static void start (received_t *r) {
+  CHECK(ads8689_dma_chain_init(&chain, desc, words, N_BLOCKS, BLOCK_LEN), "chain init");
+  dma = ads8689_dma_chain_head(&chain);
+  dma_index = 0;
+  memset(r, 0, sizeof(*r));
+}
+
+static void test_every_block () {
+  received_t r;
+  start(&r);
+  for (int i = 0; i < 10 * N_BLOCKS; i++) {
+    dma_push(BLOCK_LEN);
+    CHECK(service(&r) == 1, "block %d not serviced alone", i);
+  }
+  CHECK(r.blocks == 10 * N_BLOCKS, "%u blocks of %u", r.blocks, 10 * N_BLOCKS);
+  CHECK(r.flagged_blocks > 0 && r.flagged_blocks < r.blocks, "%u blocks with flags", r.flagged_blocks);
+  CHECK(chain.overruns == 0, "%u overruns", chain.overruns);
+  printf("every block: %u blocks, %u with flags, %u wraps\n", r.blocks, r.flagged_blocks, r.blocks / N_BLOCKS);
+}
+
+/* Services after up to N_BLOCKS - 1 blocks and a part of the next one */
+static void test_late_service () {
+  received_t r;
+  start(&r);
+  unsigned rng = 1;
+  uint32_t pushed = 0;
+  for (int i = 0; i < 50; i++) {
+    size_t n = rand_r(&rng) % (N_BLOCKS * BLOCK_LEN - BLOCK_LEN);
+    dma_push(n);
+    pushed += n;
+    uint32_t before = r.blocks;
+    size_t handled = service(&r);
+    CHECK(handled == r.blocks - before, "%zu handled, %u given", handled, r.blocks - before);
+    CHECK(r.blocks == pushed / BLOCK_LEN, "%u blocks after %u frames", r.blocks, pushed);
+  }
+  CHECK(chain.overruns == 0, "%u overruns", chain.overruns);
+  printf("late service: %u blocks, %u frames in the partial block\n", r.blocks, pushed % BLOCK_LEN);
+}
+
+/* A late service finds all but one block done, the last one completes while it runs */
+static void test_during_service () {
+  received_t r;
+  start(&r);
+  for (int i = 0; i < 20; i++) {
+    dma_push((N_BLOCKS - 1) * BLOCK_LEN);
+    r.push_during = BLOCK_LEN;
+    CHECK(service(&r) == N_BLOCKS, "%d: every block not handled", i);
+  }
+  CHECK(r.next_index == dma_index, "at index %u, DMA at %u", r.next_index, dma_index);
+  CHECK(chain.overruns == 0, "%u overruns", chain.overruns);
+  printf("during service: %u blocks, %u overruns\n", r.blocks, chain.overruns);
+}
+
+/* The DMA fills every descriptor and stalls, the frames after are lost */
+static void test_overrun () {
+  received_t r;
+  start(&r);
+  dma_push(BLOCK_LEN + 5);
+  service(&r);
+  dma_push(N_BLOCKS * BLOCK_LEN + 40);
+  CHECK(dma_index == (N_BLOCKS + 1) * BLOCK_LEN, "DMA wrote %u frames before stalling", dma_index);
+  CHECK(service(&r) == N_BLOCKS, "stalled ring not emptied");
+  CHECK(chain.overruns == 1, "%u overruns", chain.overruns);
+  CHECK(r.blocks == N_BLOCKS + 1, "%u blocks", r.blocks);
+
+  /* Streaming resumes into the first free descriptor, in order */
+  dma_push(2 * BLOCK_LEN);
+  CHECK(service(&r) == 2, "after the overrun");
+  CHECK(r.next_index == dma_index, "at index %u, DMA at %u", r.next_index, dma_index);
+  printf("overrun: %u blocks, %u overruns\n", r.blocks, chain.overruns);
+}
+
+int main (int argc, char **argv) {
+  test_every_block();
+  test_late_service();
+  test_during_service();
+  test_overrun();
+  printf(failures == 0 ? "all checks passed\n" : "%d checks failed\n", failures);
+  return failures;
+}
@@ -0,0 +1,266 @@
+/**
+ * @file test_sample_ring.c
+ *
+ * @brief Checks the sample indexes of the acquisition stream across overruns,
+ * with the ring between a real producer thread and a real consumer thread as
+ * between the ISR and the acquire task. Every sample carries its own index as
+ * its value, the index the reader gets must match it:
+ *  - overruns in episodes of up to MAX_GAPS distinct gaps, each one pushed
+ *    while the reader is still before the previous ones, with more blocks
+ *    dropped into the same gap while the ring stays full,
+ *  - more gaps than the ring queues, the index must be reported as lost and
+ *    the total must still add up,
+ *  - blocks claimed and freed later, as the acquire stage hands them to the
+ *    process stage: they keep the ring full until freed.
+ *
+ * usage: test_sample_ring [seed]
+ * Exits with the number of failed checks.
+ */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "ads8689.h"
+#include "ads8689_stream.h"
+#include "sample_ring.h"
+
+/* Ring of 1024 samples, filled by blocks of a DMA chain */
+#define RING_BYTES (2048)
+#define BLOCK_LEN (64)
+#define EPISODES (400)
+/* Distinct gaps waiting at most, within what the ring queues */
+#define MAX_GAPS (SAMPLE_RING_GAPS - 2)
+/* Samples the reader takes between two gaps of an episode */
+#define GAP_STEP (96)
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+      failures++; \
+      if (failures <= 20) { \
+        printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+      } \
+    } \
+  } while (0)
+
+static uint64_t pushed = 0;
+static atomic_uint_least64_t consumed;
+static atomic_bool producer_done;
+static uint32_t gaps_made = 0;
+static bool block_cut = false;
+static unsigned seed;
+
+static uint32_t dropped () {
+  uint32_t dropped;
+  ads8689_get_overruns(&dropped);
+  return dropped;
+}
+
+/* A block whose samples are their indexes, dropped or not. The ring cuts the
+ * end of a block, a block dropped whole after a cut one adds to the same gap */
+static void push_block () {
+  int16_t block[BLOCK_LEN];
+  for (size_t i = 0; i < BLOCK_LEN; i++) block[i] = (int16_t) (pushed + i);
+  uint32_t before = dropped();
+  BaseType_t woken = pdFALSE;
+  ads8689_stream_push(block, NULL, BLOCK_LEN, &woken);
+  pushed += BLOCK_LEN;
+  uint32_t lost = dropped() - before;
+  if (lost > 0 && !(block_cut && lost == BLOCK_LEN)) gaps_made++;
+  block_cut = lost > 0;
+}
+
+/* Fills the ring until a block is cut, then drops a few more, mostly into the same gap */
+static void make_gap (unsigned *rng) {
+  uint32_t before = dropped();
+  while (dropped() == before) push_block();
+  for (unsigned extra = rand_r(rng) % 4; extra > 0; extra--) push_block();
+}
+
+static void wait_consumed (uint64_t target) {
+  while (atomic_load(&consumed) < target) usleep(10);
+}
+
+static void *producer_task (void *arg) {
+  unsigned rng = seed;
+  for (int episode = 0; episode < EPISODES; episode++) {
+    int gaps = 1 + episode % MAX_GAPS;
+    for (int g = 0; g < gaps; g++) {
+      make_gap(&rng);
+      /* The next one falls further, still before the reader gets here */
+      if (g + 1 < gaps) wait_consumed(atomic_load(&consumed) + GAP_STEP);
+    }
+    /* Lets the reader through every gap, the last one is queued by the next block */
+    wait_consumed(pushed - dropped());
+    push_block();
+  }
+  wait_consumed(pushed - dropped());
+  atomic_store(&producer_done, true);
+  return NULL;
+}
+
+typedef struct read_result_t {
+  uint64_t next_index;
+  uint32_t jumps;
+  uint64_t mismatches;
+} read_result_t;
+
+/* Reads in random chunks, every sample must sit at the index of its value */
+static void *consumer_task (void *arg) {
+  read_result_t *result = (read_result_t*) arg;
+  unsigned rng = seed * 7 + 1;
+  uint64_t expected = 0;
+  for (;;) {
+    size_t len;
+    const int16_t *samples = ads8689_read_acquire(&len, 0, 0, NULL);
+    if (samples == NULL) {
+      if (atomic_load(&producer_done)) break;
+      usleep(10);
+      continue;
+    }
+    size_t chunk = 1 + rand_r(&rng) % 128;
+    if (len > chunk) len = chunk;
+    bool gap;
+    uint64_t index = ads8689_read_index(&gap);
+    CHECK(index >= expected, "index %llu went back from %llu", (unsigned long long) index, (unsigned long long) expected);
+    CHECK(gap == (index != expected), "gap flag %d at index %llu after %llu", gap, (unsigned long long) index, (unsigned long long) expected);
+    result->jumps += index != expected;
+    for (size_t i = 0; i < len; i++) {
+      if (samples[i] != (int16_t) (index + i)) {
+        CHECK(result->mismatches > 0, "sample %d at index %llu", samples[i], (unsigned long long) (index + i));
+        result->mismatches++;
+      }
+    }
+    expected = index + len;
+    ads8689_read_release(len);
+    atomic_fetch_add(&consumed, len);
+    if (rand_r(&rng) % 4 == 0) usleep(rand_r(&rng) % 50);
+  }
+  result->next_index = expected;
+  return NULL;
+}
+
+static void test_threads () {
+  ads8689_stream_init(RING_BYTES, 100000);
+  pushed = 0;
+  gaps_made = 0;
+  block_cut = false;
+  atomic_store(&consumed, 0);
+  atomic_store(&producer_done, false);
+
+  read_result_t result = {};
+  pthread_t producer, consumer;
+  pthread_create(&consumer, NULL, consumer_task, &result);
+  pthread_create(&producer, NULL, producer_task, NULL);
+  pthread_join(producer, NULL);
+  pthread_join(consumer, NULL);
+
+  uint32_t lost;
+  uint32_t overruns = ads8689_get_overruns(&lost);
+  printf(
+    "threads: %llu samples, %u overruns, %u gaps (%u samples), %llu mismatched samples\n",
+    (unsigned long long) pushed, overruns, result.jumps, lost, (unsigned long long) result.mismatches
+  );
+  CHECK(result.mismatches == 0, "%llu samples at the wrong index", (unsigned long long) result.mismatches);
+  CHECK(result.jumps == gaps_made, "%u gaps seen, %u made", result.jumps, gaps_made);
+  CHECK(result.next_index == pushed, "read up to index %llu of %llu", (unsigned long long) result.next_index, (unsigned long long) pushed);
+  CHECK(!ads8689_index_lost(), "index lost with at most %d gaps waiting", MAX_GAPS);
+}
+
+/* More gaps than the ring queues, without reading in between */
+static void test_index_lost () {
+  unsigned rng = seed;
+  ads8689_stream_init(RING_BYTES, 100000);
+  pushed = 0;
+  gaps_made = 0;
+  block_cut = false;
+  for (int g = 0; g < SAMPLE_RING_GAPS + 4; g++) {
+    make_gap(&rng);
+    /* Room for the next gap at another position */
+    size_t len;
+    ads8689_read_acquire(&len, 0, 0, NULL);
+    ads8689_read_release(BLOCK_LEN);
+  }
+  push_block();
+  CHECK(ads8689_index_lost(), "index not lost after %u gaps", gaps_made);
+
+  /* The merged gap is queued by the first block once the reader made room */
+  uint64_t index = 0;
+  size_t len;
+  for (int pass = 0; pass < 2; pass++) {
+    while (ads8689_read_acquire(&len, 0, 0, NULL) != NULL) {
+      index = ads8689_read_index(NULL) + len;
+      ads8689_read_release(len);
+    }
+    if (pass == 0) push_block();
+  }
+  printf("index lost: %u gaps, read up to index %llu of %llu\n", gaps_made, (unsigned long long) index, (unsigned long long) pushed);
+  CHECK(index == pushed, "read up to index %llu of %llu", (unsigned long long) index, (unsigned long long) pushed);
+}
+
+/* Reads ahead by claiming, frees the oldest block once three are claimed */
+static void test_claim () {
+  ads8689_stream_init(RING_BYTES, 100000);
+  pushed = 0;
+  gaps_made = 0;
+  block_cut = false;
+  const int16_t *claimed[3];
+  size_t claimed_len[3];
+  size_t n_claimed = 0;
+  uint64_t index = 0;
+  uint32_t mismatches = 0;
+  for (int b = 0; b < 200; b++) {
+    push_block();
+    size_t len;
+    const int16_t *samples = ads8689_read_acquire(&len, 0, 0, NULL);
+    if (samples == NULL) continue;
+    if (len > BLOCK_LEN) len = BLOCK_LEN;
+    CHECK(ads8689_read_index(NULL) == index, "claim at index %llu, expected %llu", (unsigned long long) ads8689_read_index(NULL), (unsigned long long) index);
+    claimed[n_claimed] = samples;
+    claimed_len[n_claimed++] = len;
+    ads8689_read_claim(len);
+    index += len;
+    if (n_claimed < 3) continue;
+    /* The oldest block was not overwritten while claimed */
+    for (size_t i = 0; i < claimed_len[0]; i++) mismatches += claimed[0][i] != (int16_t) (index - claimed_len[0] - claimed_len[1] - claimed_len[2] + i);
+    ads8689_read_free(claimed_len[0]);
+    claimed[0] = claimed[1], claimed_len[0] = claimed_len[1];
+    claimed[1] = claimed[2], claimed_len[1] = claimed_len[2];
+    n_claimed = 2;
+  }
+  printf("claim: read up to index %llu of %llu, %u mismatched samples\n", (unsigned long long) index, (unsigned long long) pushed, mismatches);
+  CHECK(mismatches == 0, "%u claimed samples overwritten", mismatches);
+  CHECK(index == pushed, "read up to index %llu of %llu", (unsigned long long) index, (unsigned long long) pushed);
+  CHECK(dropped() == 0, "%u samples dropped with three blocks claimed", dropped());
+
+  /* Claimed samples hold their space until freed */
+  size_t held = 0, len;
+  for (size_t i = 0; i < n_claimed; i++) held += claimed_len[i];
+  while (held + BLOCK_LEN <= RING_BYTES / sizeof(int16_t)) {
+    push_block();
+    while (ads8689_read_acquire(&len, 0, 0, NULL) != NULL) {
+      ads8689_read_claim(len);
+      held += len;
+    }
+  }
+  push_block();
+  CHECK(dropped() > 0, "block pushed into a ring full of claimed samples");
+  ads8689_read_free(held);
+  uint32_t before = dropped();
+  push_block();
+  CHECK(dropped() == before, "block dropped after the claimed samples were freed");
+}
+
+int main (int argc, char **argv) {
+  seed = argc > 1 ? (unsigned) atoi(argv[1]) : 1;
+  test_threads();
+  test_index_lost();
+  test_claim();
+  printf(failures == 0 ? "all checks passed\n" : "%d checks failed\n", failures);
+  return failures;
+}
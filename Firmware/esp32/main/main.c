@@ -8,14 +8,26 @@
 #include "esp_spi_flash.h"
 #include "nvs_flash.h"
 #include "esp_log.h"
+#include "driver/gpio.h"
 
 #include "network_wifi.h"
 
 #include "tcp_server.h"
+#include "udp_stream.h"
+#include "event_server.h"
 #include "ble_conn/ble_server.h"
 #include "configuration.h"
-
-#include "ads8689.h"
+#include "acquisition.h"
+#include "alarm_events.h"
+#include "charge_amp.h"
+#include "flash_log_partition.h"
+
+/* Backlog behind the acquisition ring, 10 s at 100 kS/s in external RAM or
+ * what the internal heap spares next to WiFi and BLE */
+#define BACKLOG_SPIRAM_LEN (2 * 1024 * 1024)
+#define BACKLOG_INTERNAL_LEN (48 * 1024)
+/* Raw partition of partitions.csv the stream is recorded to without a client */
+#define RECORD_PARTITION "record"
 
 static bool wifi_connected = false;
 
@@ -97,59 +109,122 @@ void test_tcp_task () {
   }
 }
 
-#define SEND_BUFFER_LEN (512)
-#define CIRCULAR_BUFFER_LEN (SEND_BUFFER_LEN * 16)
+/* Converts the configured decimation stages, taps out of the int16 range disable decimation */
+static size_t decimation_from_configuration (fir_decimator_config_t *stages, size_t max_stages) {
+  Configuration *curr_conf = configuration_get_current();
+  size_t n_stages = curr_conf->n_decimation < max_stages ? curr_conf->n_decimation : max_stages;
+  for (int i = 0; i < n_stages; i++) {
+    DecimationStage *conf_stage = curr_conf->decimation[i];
+    stages[i].factor = conf_stage->factor;
+    stages[i].taps = NULL;
+    stages[i].n_taps = 0;
+    if (conf_stage->n_taps == 0) continue;
+
+    int16_t *taps = malloc(sizeof(int16_t) * conf_stage->n_taps);
+    for (int j = 0; j < conf_stage->n_taps; j++) {
+      if (conf_stage->taps[j] > INT16_MAX || conf_stage->taps[j] < INT16_MIN) {
+        ESP_LOGE("DECIMATION", "stage %d tap %d out of range", i, j);
+        free(taps);
+        for (int k = 0; k < i; k++) free((int16_t*) stages[k].taps);
+        return 0;
+      }
+      taps[j] = conf_stage->taps[j];
+    }
+    stages[i].taps = taps;
+    stages[i].n_taps = conf_stage->n_taps;
+  }
+  return n_stages;
+}
 
-static bool setup_done = false;
+static bool trigger_from_configuration (trigger_config_t *trigger) {
+  TriggerConfig *conf_trigger = configuration_get_current()->trigger;
+  if (conf_trigger == NULL || conf_trigger->posttrigger == 0) return false;
+  if (conf_trigger->level > INT16_MAX || conf_trigger->level < INT16_MIN || conf_trigger->hysteresis > INT16_MAX) {
+    ESP_LOGE("TRIGGER", "level or hysteresis out of range");
+    return false;
+  }
+  *trigger = (trigger_config_t) {
+    .level = conf_trigger->level,
+    .hysteresis = conf_trigger->hysteresis,
+    .slope = conf_trigger->rising ? TRIGGER_RISING : TRIGGER_FALLING,
+    .pre_trigger = conf_trigger->pretrigger,
+    .post_trigger = conf_trigger->posttrigger,
+    .holdoff = conf_trigger->holdoff
+  };
+  return true;
+}
 
-void adc_setup_task () {
+static bool features_from_configuration (feature_config_t *features, bool *only) {
+  FeatureConfig *conf_features = configuration_get_current()->features;
+  if (conf_features == NULL) return false;
+  if (conf_features->fftlen > FFT_MAX_LEN || conf_features->windows > UINT16_MAX) {
+    ESP_LOGE("FEATURES", "fft length or windows out of range");
+    return false;
+  }
+  *features = (feature_config_t) {
+    .fft_len = conf_features->fftlen,
+    .windows = conf_features->windows > 0 ? conf_features->windows : 1
+  };
+  *only = conf_features->only;
+  return true;
+}
 
-  spi_bus_config_t spi_bus_cfg = {
-    .mosi_io_num = GPIO_NUM_23,
-    .miso_io_num = GPIO_NUM_19,
-    .sclk_io_num = GPIO_NUM_18,
-    .quadwp_io_num = -1,
-    .quadhd_io_num = -1,
+static void udp_from_configuration () {
+  UdpConfig *conf_udp = configuration_get_current()->udp;
+  if (conf_udp == NULL) return;
+  if (conf_udp->port > UINT16_MAX || conf_udp->ttl > UINT8_MAX) {
+    ESP_LOGE("UDP", "port or ttl out of range");
+    return;
+  }
+  udp_stream_config_t udp = {
+    .group = conf_udp->group,
+    .port = conf_udp->port,
+    .ttl = conf_udp->ttl
   };
+  udp_stream_init(&udp);
+}
 
-  ads8689_init(spi_bus_cfg, GPIO_NUM_5, SPI2_HOST);
+static const ads8689_config_t* adc_from_configuration (ads8689_config_t *adc) {
+  if (!configuration_adc_settings(configuration_get_current()->adc, adc)) {
+    ESP_LOGE("ADC", "settings out of range, using the defaults");
+  }
+  return adc;
+}
 
-  /* Set input range to 1.25 * Vref */
-  ads8689_transmit(ADS8689_WRITE_LS, ADS8689_RANGE_SEL_REG, 0x0003, NULL, 0);
-  
-  ads8689_transmit(ADS8689_WRITE_LS, ADS8689_SDO_CTL_REG, 0x3 << 8, NULL, 0);
+static const calibration_config_t* calibration_from_configuration (calibration_config_t *calibration) {
+  CalibrationConfig *conf_calibration = configuration_get_current()->calibration;
+  if (conf_calibration == NULL) return NULL;
+  if (!configuration_calibration_settings(conf_calibration, calibration)) {
+    ESP_LOGE("CALIBRATION", "settings out of range, sending ADC codes");
+    return NULL;
+  }
+  return calibration;
+}
 
-  ads8689_start_stream(CIRCULAR_BUFFER_LEN, 100000);
-  setup_done = true;
-  vTaskDelete(NULL);
+static const baseline_config_t* baseline_from_configuration (baseline_config_t *baseline) {
+  BaselineConfig *conf_baseline = configuration_get_current()->baseline;
+  if (conf_baseline == NULL) return NULL;
+  if (!configuration_baseline_settings(conf_baseline, baseline)) {
+    ESP_LOGE("BASELINE", "settings out of range, drift not corrected");
+    return NULL;
+  }
+  return baseline;
 }
 
-void adc_read_task () {
-  int16_t buffer[SEND_BUFFER_LEN];
-  float fs;
-  int64_t counter = 0, countFail = 0;
-  while (1) {
-    size_t read_len = ads8689_read_buffer(buffer, SEND_BUFFER_LEN, &fs);
-    // if (read_len == 0) {
-    //   // vTaskDelay(1);
-    //   continue;
-    // }
-    if (!tcp_server_send_sync((uint8_t*) buffer, read_len * sizeof(uint16_t))) {
-      vTaskDelay(10);
-      // vTaskDelay(pdMS_TO_TICKS(10));
-    } else {
-      // vTaskDelay(1);
-      if (read_len == SEND_BUFFER_LEN) {
-        countFail++;
-      }
-      counter++;
-    }
-    if (counter == 1000) {
-      printf("[%f]\tread len: %d\n", 100.f * (float) countFail / (float) counter , read_len);
-      counter = 0;
-      countFail = 0;
-    }
+static const ads8689_encoder_config_t* encoder_from_configuration (ads8689_encoder_config_t *encoder) {
+  EncoderConfig *conf_encoder = configuration_get_current()->encoder;
+  if (conf_encoder == NULL) return NULL;
+  if (!configuration_encoder_settings(conf_encoder, encoder)) {
+    ESP_LOGE("ENCODER", "settings out of range, conversions clocked by the timer");
+    return NULL;
   }
+  return encoder;
+}
+
+static const flash_log_flash_t* record_from_partition (flash_log_flash_t *flash) {
+  if (flash_log_partition(flash, RECORD_PARTITION)) return flash;
+  ESP_LOGW("RECORDER", "no %s partition, nothing recorded without a client", RECORD_PARTITION);
+  return NULL;
 }
 
 void on_tcp_connection () {
@@ -161,25 +236,55 @@ void app_main (void) {
 
   configuration_init();
 
-  /* Setup reset GPIO */
-  gpio_set_direction(GPIO_NUM_26, GPIO_MODE_OUTPUT);
-  gpio_set_level(GPIO_NUM_26, 1);
+  /* Charge amplifier reset line, high in operation */
+  BaselineConfig *conf_baseline = configuration_get_current()->baseline;
+  uint32_t reset_pulse = conf_baseline != NULL && conf_baseline->has_resetpulse ? conf_baseline->resetpulse : 0;
+  if (!charge_amp_init(GPIO_NUM_26, reset_pulse)) ESP_LOGE("BASELINE", "charge amplifier reset line not available");
 
   ble_server_start();
 
   wifi_init(&wifi_callbacks);
   wifi_start_and_scan();
 
+  // xTaskCreatePinnedToCore(test_tcp_task, "Test Task", 8192, NULL, 10, NULL, 1);
+
+  /* Acquisition starts without a network, the recorder keeps the stream
+   * until a client connects */
+  fir_decimator_config_t decimation[FIR_DECIMATOR_MAX_STAGES];
+  trigger_config_t trigger;
+  feature_config_t features;
+  ads8689_config_t adc;
+  calibration_config_t calibration;
+  baseline_config_t baseline;
+  ads8689_encoder_config_t encoder;
+  const acquisition_backlog_t backlog = { .spiram_len = BACKLOG_SPIRAM_LEN, .internal_len = BACKLOG_INTERNAL_LEN };
+  flash_log_flash_t record;
+  bool features_only = false;
+  bool has_features = features_from_configuration(&features, &features_only);
+  acquisition_config_t acquisition_config = {
+    .trigger = trigger_from_configuration(&trigger) ? &trigger : NULL,
+    .features = has_features ? &features : NULL,
+    .features_only = features_only,
+    .decimation = decimation,
+    .n_decimation = decimation_from_configuration(decimation, FIR_DECIMATOR_MAX_STAGES),
+    .compress = configuration_get_current()->compression,
+    .calibration = calibration_from_configuration(&calibration),
+    .baseline = baseline_from_configuration(&baseline),
+    .adc = adc_from_configuration(&adc),
+    .encoder = encoder_from_configuration(&encoder),
+    .backlog = &backlog,
+    .record = record_from_partition(&record)
+  };
+  acquisition_start(&acquisition_config);
+  /* Taps are copied by the decimator */
+  for (int i = 0; i < acquisition_config.n_decimation; i++) free((int16_t*) decimation[i].taps);
+
   while (wifi_connected == false) {
     vTaskDelay(pdMS_TO_TICKS(1000));
     ESP_LOGI("WIFI", "Waiting connection");
   }
-  tcp_server_init(on_tcp_connection);
-  
-  // xTaskCreatePinnedToCore(test_tcp_task, "Test Task", 8192, NULL, 10, NULL, 1);
-
-  xTaskCreatePinnedToCore(adc_setup_task, "ADC setup", 32 * 1024, NULL, 10, NULL, 1);
-  while(!setup_done);
-  xTaskCreatePinnedToCore(adc_read_task, "ADC read", 16 * 1024, NULL, 10, NULL, 0);
+  tcp_server_init(on_tcp_connection, NULL);
+  udp_from_configuration();
+  if (!event_server_init() || !alarm_events_start()) ESP_LOGE("ALARM", "input alarm events not available");
   printf("Main done!\n");
 }
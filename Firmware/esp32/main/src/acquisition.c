@@ -0,0 +1,1338 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "hal/cpu_hal.h"
+
+#include "ads8689.h"
+#include "tcp_server.h"
+#include "udp_stream.h"
+#include "stream_frame.h"
+#include "sample_codec.h"
+#include "fir_decimator.h"
+#include "trigger.h"
+#include "feature_extractor.h"
+#include "calibration.h"
+#include "baseline.h"
+#include "cycle_peak.h"
+#include "backlog_storage.h"
+#include "sample_backlog.h"
+#include "recorder.h"
+#include "block_queue.h"
+#include "pipeline_stage.h"
+#include "charge_amp.h"
+
+#include "acquisition.h"
+
+#define SEND_BUFFER_LEN (512)
+/* The ring also holds the blocks in the stage queue */
+#define CIRCULAR_BUFFER_LEN (SEND_BUFFER_LEN * 32)
+
+/* Samples filtered per ring read when decimating */
+#define DECIMATOR_BLOCK_LEN (256)
+/* Time span of the decimated samples sent in each frame, us */
+#define DECIMATED_FRAME_PERIOD (20000)
+/* Samples waited for before compressing a frame */
+#define COMPRESSED_READ_LEN (2048)
+/* Longest the first sample of a stream frame waits for the frame to fill, ms */
+#define FRAME_DEADLINE_MS (25)
+/* A restart waiting for the process stage to empty the stage queue warns this often, ms */
+#define RESTART_DRAIN_MS (500)
+/* Capture windows in flight, one filling while the other is sent */
+#define CAPTURE_SLOTS (2)
+/* Longest capture window, pre plus post trigger samples */
+#define CAPTURE_MAX_LEN (12288)
+/* Feature reports waiting for the task that sends the stream */
+#define FEATURE_QUEUE_LEN (4)
+/* Cycle reports waiting for the sending task */
+#define CYCLE_QUEUE_LEN (8)
+/* Clock offset requests waiting for their answer, from several clients */
+#define TIME_QUEUE_LEN (4)
+/* ADC settings requests waiting for the control task */
+#define ADC_QUEUE_LEN (2)
+/* Ring blocks in flight from the acquire to the process stage, a power of two */
+#define STAGE_QUEUE_BLOCKS (4)
+/* Longest ring block handed over, a recorder block */
+#define STAGE_BLOCK_LEN (RECORDER_BLOCK_LEN)
+/* Earliest an amplifier reset is scheduled after the newest sample, for the timer to be armed in time, us */
+#define AMP_RESET_LEAD_US (2000)
+/* Stage loads are measured over this period, whoever asks first after it ends, us */
+#define STAGE_REPORT_PERIOD_US (1000000)
+/* Backlog blocks are sent while the slowest client is less than this behind,
+ * the rest of the frame buffer is room for the reports */
+#define BACKLOG_SEND_LAG (TCP_SERVER_FANOUT_LEN / 2)
+/* Capture frames wait while the slowest client is this far behind, so no
+ * client is lapped in the middle of a window */
+#define CAPTURE_SEND_LAG (TCP_SERVER_FANOUT_LEN / 2)
+
+static const char *TAG = "ACQUISITION";
+
+_Static_assert(STREAM_STATS_JITTER_BINS == ADS8689_JITTER_BINS, "stats frame and driver jitter histograms differ");
+_Static_assert(STAGE_BLOCK_LEN >= COMPRESSED_READ_LEN && STAGE_BLOCK_LEN >= STREAM_FRAME_MAX_SAMPLES, "stage block shorter than a frame read");
+
+/* Ring block in the stage queue, a block of no samples marks a stream restart */
+typedef struct stage_block_t {
+  uint64_t first_sample;
+  float fs;
+  uint32_t len;
+  /** Samples were lost in the ring before this block */
+  bool gap;
+  /** ADC input range of the samples, for the calibration */
+  ads8689_range_t range;
+  /** In the ring, claimed by the acquire stage and freed by the process
+   * stage, which owns them until then and corrects the drift in place */
+  int16_t *samples;
+} stage_block_t;
+
+static volatile bool setup_done = false;
+static uint32_t sequence = 0;
+static fir_decimator_chain_t decimator;
+static bool compress = false;
+/* Rate the conversion timer runs at, set by the control task */
+static volatile float stream_fs = 0;
+
+static trigger_engine_t trigger_engine;
+static trigger_capture_t capture_slots[CAPTURE_SLOTS];
+static QueueHandle_t free_captures, ready_captures;
+
+static feature_extractor_t feature_extractor;
+static bool features_on = false;
+static QueueHandle_t feature_reports;
+static uint32_t features_dropped = 0;
+
+/* Set by a client command, answered by the task that sends the stream */
+static volatile bool stats_requested = false;
+/* stream_time_t of the time commands, transmit is stamped by the transport */
+static QueueHandle_t time_requests;
+
+/* ADC settings in use and the requests to change them, applied by the control task */
+static ads8689_config_t adc_config = ADS8689_DEFAULT_CONFIG();
+static QueueHandle_t adc_requests;
+static volatile bool adc_report_requested = false;
+static volatile bool adc_rejected = false;
+static volatile uint32_t adc_requested_rate = 0;
+/* Conversions clocked by a shaft encoder instead of the timer, the raw
+ * stream frames then lead with the angle of their first sample */
+static ads8689_encoder_config_t encoder_config;
+static bool encoder_on = false;
+/* Samples of a full raw frame, fewer behind the angle header */
+static size_t raw_frame_len = STREAM_FRAME_MAX_SAMPLES;
+/* Peak pressure of each encoder cycle */
+static cycle_peak_t cycle_peak;
+static QueueHandle_t cycle_reports;
+static uint32_t cycle_reports_dropped = 0;
+/* Pipeline between the ring and the tasks that frame the samples */
+static acquisition_stages_t stages = ACQUISITION_DEFAULT_STAGES();
+static pipeline_stage_t acquire_stage, process_stage, capture_stage;
+static block_queue_t stage_queue;
+/* Block the process stage works on, its samples before offset are released */
+static stage_block_t *stage_reading = NULL;
+static size_t stage_offset = 0;
+static bool stage_gap = false;
+/* Loads of the last period, in the acquisition_get_stage_stats() order */
+static SemaphoreHandle_t stage_lock;
+static pipeline_stage_stats_t stage_stats[ACQUISITION_STAGES];
+static int64_t stage_report = 0;
+
+/* Ring reader handshake: parks on pause_requested while the stream restarts */
+static volatile bool pause_requested = false;
+static SemaphoreHandle_t reader_parked, reader_resume;
+
+/* Second buffering tier of the raw stream, filled while the clients lag behind */
+static sample_backlog_t backlog;
+static backlog_storage_t backlog_memory;
+static bool backlog_on = false;
+/* Raw stream kept in flash while no client is connected */
+static bool record_on = false;
+/* No decimation, trigger or features only, the acquire stage reads frames */
+static bool raw_stream = false;
+
+/* Conversion of the sample frames to pressure, derived again by the process
+ * stage when the ADC range changes. The previous one is kept for the frames
+ * still in the backlog, their flags tell which slot. The slot bit is a header
+ * flag the protocol leaves unused, cleared before the frame is sent */
+#define CALIBRATION_SLOT_FLAG (1 << 7)
+static calibration_config_t calibration_config;
+static bool calibration_on = false;
+static calibration_t calibrations[2];
+static const calibration_t *calibration_current = NULL;
+static const calibration_t *calibration_previous = NULL;
+static int calibration_range = -1;
+static volatile bool calibration_report_requested = false;
+
+/* Charge amplifier drift, subtracted from each stage block as the process
+ * stage takes it. The sample frame reaching the last reset gets the reset
+ * flag, the mark is in the index of the frames, decimated or not */
+#define NO_AMP_RESET (UINT64_MAX)
+static baseline_t baseline;
+static bool baseline_on = false;
+static bool baseline_started = false;
+static uint32_t baseline_resets = 0;
+static uint32_t amp_reset_factor = 1;
+static uint64_t amp_reset_mark = NO_AMP_RESET;
+static volatile bool baseline_report_requested = false;
+
+/* Conversion time of a decimated sample, corrected by the filter group delay */
+static int64_t decimated_time (uint64_t out_index, float fs) {
+  uint64_t input_index = (out_index + 1) * decimator.factor - 1;
+  return ads8689_sample_time(input_index) - (int64_t) (decimator.delay * 1000000 / fs);
+}
+
+/* Clocked by the timer at the rate of the settings in use, or by the encoder */
+static float start_stream () {
+  if (encoder_on) return ads8689_start_encoder_stream(CIRCULAR_BUFFER_LEN, &encoder_config, ADS8689_STREAM_DMA);
+  return ads8689_start_stream(CIRCULAR_BUFFER_LEN, adc_config.sample_freq, ADS8689_STREAM_DMA);
+}
+
+/* Stops the stream with the ring reader parked, applies the settings and
+ * restarts it. Rejected settings are checked before anything stops */
+static void adc_restart (const ads8689_config_t *request) {
+  adc_requested_rate = request->sample_freq;
+  /* The encoder rate must still fit the SPI frame */
+  adc_rejected = ads8689_config_check(request) != ESP_OK
+    || (encoder_on && ads8689_encoder_check(&encoder_config, request) != ESP_OK);
+  if (adc_rejected) {
+    ESP_LOGW(TAG, "ADC settings rejected, keeping %u Hz", adc_config.sample_freq);
+    adc_report_requested = true;
+    return;
+  }
+
+  pause_requested = true;
+  xSemaphoreTake(reader_parked, portMAX_DELAY);
+  ads8689_stop_stream();
+  if (ads8689_configure(request) == ESP_OK) adc_config = *request;
+  else adc_rejected = true;
+  float fs = start_stream();
+  if (fs > 0) stream_fs = fs;
+  pause_requested = false;
+  xSemaphoreGive(reader_resume);
+
+  ESP_LOGI(TAG, "stream restarted at %.2f Hz", stream_fs);
+  adc_report_requested = true;
+}
+
+/* Owns the ADC: starts the stream, then applies the settings requests */
+static void adc_control_task () {
+
+  spi_bus_config_t spi_bus_cfg = {
+    .mosi_io_num = GPIO_NUM_23,
+    .miso_io_num = GPIO_NUM_19,
+    .sclk_io_num = GPIO_NUM_18,
+    .quadwp_io_num = -1,
+    .quadhd_io_num = -1,
+  };
+
+  ads8689_init(spi_bus_cfg, GPIO_NUM_5, SPI2_HOST);
+
+  if (ads8689_configure(&adc_config) != ESP_OK) {
+    ESP_LOGE(TAG, "invalid ADC settings, using the defaults");
+    adc_config = (ads8689_config_t) ADS8689_DEFAULT_CONFIG();
+    ads8689_configure(&adc_config);
+  }
+  adc_requested_rate = adc_config.sample_freq;
+  stream_fs = start_stream();
+  setup_done = true;
+
+  ads8689_config_t request;
+  while (1) {
+    if (xQueueReceive(adc_requests, &request, portMAX_DELAY) == pdTRUE) adc_restart(&request);
+  }
+}
+
+/* Called by the ring reader between two reads, holds while the stream restarts */
+static void park_reader () {
+  xSemaphoreGive(reader_parked);
+  xSemaphoreTake(reader_resume, portMAX_DELAY);
+}
+
+bool acquisition_reconfigure (const ads8689_config_t *config) {
+  if (adc_requests == NULL) return false;
+  return xQueueSend(adc_requests, config, 0) == pdTRUE;
+}
+
+/* Derives the calibration of a range in the slot not in use, from the process stage */
+static void calibration_update (ads8689_range_t range) {
+  calibration_t *next = calibration_current == &calibrations[0] ? &calibrations[1] : &calibrations[0];
+  calibration_previous = calibration_current;
+  calibration_current = calibration_init(next, &calibration_config, ads8689_config_lsb_volts(range)) ? next : NULL;
+  if (calibration_current == NULL) ESP_LOGE(TAG, "calibration invalid in range %#x, sending ADC codes", range);
+  else ESP_LOGI(TAG, "calibration %08x, bar = value * 2^-%d", calibration_current->hash, calibration_current->frac_bits);
+  if (calibration_current != NULL && calibration_previous != NULL && calibration_current->hash != calibration_previous->hash &&
+    (uint8_t) calibration_current->hash == (uint8_t) calibration_previous->hash) {
+    ESP_LOGW(TAG, "calibration tag %02x also of the previous one, clients cannot tell their frames apart", (uint8_t) calibration_current->hash);
+  }
+  calibration_range = range;
+  calibration_report_requested = true;
+}
+
+/* Flags of the sample frames taken from the stage queue now */
+static uint32_t calibration_flags () {
+  if (calibration_current == NULL) return 0;
+  uint32_t slot = calibration_current == &calibrations[1] ? CALIBRATION_SLOT_FLAG : 0;
+  return STREAM_FLAG_CALIBRATED | STREAM_FLAG_CALIBRATION_TAG(calibration_current->hash) | slot;
+}
+
+/* Calibration of frame flags, NULL for ADC codes or once it is gone. The
+ * slot picks it, the tag tells when the slot was taken by a newer one */
+static const calibration_t* calibration_for (uint32_t flags) {
+  if (!(flags & STREAM_FLAG_CALIBRATED)) return NULL;
+  const calibration_t *cal = &calibrations[flags & CALIBRATION_SLOT_FLAG ? 1 : 0];
+  if (cal != calibration_current && cal != calibration_previous) return NULL;
+  return (uint8_t) cal->hash == STREAM_FLAG_GET_CALIBRATION_TAG(flags) ? cal : NULL;
+}
+
+/* Reset flag of the first sample frame of count samples from first_sample
+ * that reaches the last amplifier reset */
+static uint32_t amp_reset_flag (uint64_t first_sample, size_t count) {
+  if (amp_reset_mark == NO_AMP_RESET || amp_reset_mark >= first_sample + count) return 0;
+  amp_reset_mark = NO_AMP_RESET;
+  return STREAM_FLAG_AMP_RESET;
+}
+
+/* Raw stream frames carry the cycle and angle of their samples, once the
+ * encoder is in sync, see send_frame() */
+static uint32_t angle_flags () {
+  return encoder_on ? STREAM_FLAG_ANGLE : 0;
+}
+
+typedef struct frame_stats_t {
+  int64_t sent;
+  int64_t full;
+  int64_t samples;
+  int64_t bytes;
+} frame_stats_t;
+
+static frame_stats_t stats = {};
+static uint32_t codec_cycles = 0, codec_samples = 0;
+
+static void print_stats (size_t read_len, float fs) {
+  if (stats.sent < 1000) return;
+  uint32_t dropped;
+  uint32_t overruns = ads8689_get_overruns(&dropped);
+  printf("[%f]\tread len: %zu\tfs: %.1f\toverruns: %u (%u samples)", 100.f * (float) stats.full / (float) stats.sent, read_len, fs, overruns, dropped);
+  if (ads8689_index_lost()) printf(" index lost");
+  if (compress) {
+    printf(
+      "\tratio: %.2f\tencode: %.1f cycles/sample",
+      (float) (stats.samples * sizeof(int16_t)) / (float) stats.bytes, (float) codec_cycles / (float) codec_samples
+    );
+    codec_cycles = 0;
+    codec_samples = 0;
+  }
+  if (features_on) printf("\tfeature reports dropped: %u", features_dropped);
+  if (encoder_on) {
+    ads8689_encoder_stats_t encoder;
+    ads8689_encoder_get_stats(&encoder);
+    printf("\tTDC: %u sync errors: %u skipped edges: %u", encoder.tdc_count, encoder.sync_errors, encoder.skipped);
+    printf("\tcycles: %u cut: %u reports dropped: %u", cycle_peak.reported, cycle_peak.dropped, cycle_reports_dropped);
+  }
+  tcp_client_stats_t clients[TCP_SERVER_MAX_CLIENTS];
+  size_t n_clients = tcp_server_get_client_stats(clients, TCP_SERVER_MAX_CLIENTS);
+  for (size_t i = 0; i < n_clients; i++) {
+    if (clients[i].connected) printf("\tclient %zu skips: %u", i, clients[i].skips);
+  }
+  printf("\n");
+  memset(&stats, 0, sizeof(stats));
+}
+
+/* Queues a sealed frame for the clients, counted for the driver instrumentation */
+static bool send_counted (const stream_frame_header_t *header, const void *payload) {
+  if (!tcp_server_send_frame(header, payload)) return false;
+  ads8689_stats_sent(header->sample_count);
+  return true;
+}
+
+/**
+ * Sends one frame with up to len samples, compressed when enabled and the
+ * compressed frame holds more samples than a raw one, or the same in fewer bytes.
+ * Samples are converted to pressure first when the flags ask for a calibration.
+ * With STREAM_FLAG_ANGLE the payload starts with the stream_angle_t of the
+ * first sample, the flag is dropped while the encoder is out of sync.
+ * Returns the number of samples sent, 0 if sending failed.
+ */
+static size_t send_frame (uint32_t flags, uint64_t first_sample, int64_t timestamp, float fs, const int16_t *samples, size_t len) {
+  static uint8_t payload[STREAM_FRAME_MAX_PAYLOAD];
+  static int16_t calibrated[STAGE_BLOCK_LEN];
+  stream_frame_header_t header;
+  const calibration_t *cal = calibration_for(flags);
+  flags &= ~CALIBRATION_SLOT_FLAG;
+  if (cal != NULL) {
+    if (len > STAGE_BLOCK_LEN) len = STAGE_BLOCK_LEN;
+    calibration_apply(cal, samples, calibrated, len);
+    samples = calibrated;
+  } else {
+    flags &= ~(STREAM_FLAG_CALIBRATED | STREAM_FLAG_CALIBRATION_TAG(0xff));
+  }
+  stream_angle_t angle;
+  size_t prefix = 0;
+  if ((flags & STREAM_FLAG_ANGLE) && ads8689_sample_angle(first_sample, &angle.cycle, &angle.angle)) {
+    ads8689_encoder_stats_t encoder;
+    ads8689_encoder_get_stats(&encoder);
+    angle.cycle_len = (uint16_t) ads8689_angle_cycle_len();
+    angle.sync_errors = encoder.sync_errors;
+    memcpy(payload, &angle, sizeof(angle));
+    prefix = sizeof(angle);
+  } else {
+    flags &= ~STREAM_FLAG_ANGLE;
+  }
+  size_t max_samples = (STREAM_FRAME_MAX_PAYLOAD - prefix) / sizeof(int16_t);
+  size_t raw_len = len < max_samples ? len : max_samples;
+
+  if (compress) {
+    size_t consumed;
+    uint32_t start = cpu_hal_get_cycle_count();
+    size_t payload_len = sample_codec_encode(samples, len, &payload[prefix], sizeof(payload) - prefix, &consumed);
+    codec_cycles += cpu_hal_get_cycle_count() - start;
+    codec_samples += consumed;
+    if (consumed > raw_len || (consumed == raw_len && payload_len < raw_len * sizeof(int16_t))) {
+      stream_frame_init_header(
+        &header, STREAM_FRAME_SAMPLES_RICE, flags | amp_reset_flag(first_sample, consumed), sequence++,
+        first_sample, timestamp, fs,
+        consumed, prefix + payload_len
+      );
+      stream_frame_seal(&header, payload);
+      if (!send_counted(&header, payload)) return 0;
+      /* Full when another block would not have fit */
+      stats.full += prefix + payload_len > STREAM_FRAME_MAX_PAYLOAD - SAMPLE_CODEC_BLOCK_LEN * 2;
+      stats.sent++;
+      stats.samples += consumed;
+      stats.bytes += payload_len;
+      return consumed;
+    }
+  }
+
+  /* Behind the angle the samples are copied, otherwise sent from where they are */
+  const void *frame_payload = samples;
+  if (prefix > 0) {
+    memcpy(&payload[prefix], samples, raw_len * sizeof(int16_t));
+    frame_payload = payload;
+  }
+  stream_frame_init_header(
+    &header, STREAM_FRAME_SAMPLES, flags | amp_reset_flag(first_sample, raw_len), sequence++,
+    first_sample, timestamp, fs,
+    raw_len, prefix + raw_len * sizeof(int16_t)
+  );
+  stream_frame_seal(&header, frame_payload);
+  if (!send_counted(&header, frame_payload)) return 0;
+  stats.full += raw_len == max_samples;
+  stats.sent++;
+  stats.samples += raw_len;
+  stats.bytes += raw_len * sizeof(int16_t);
+  return raw_len;
+}
+
+/* Sends all samples, in as many frames as needed */
+static bool send_all (uint32_t flags, uint64_t first_sample, int64_t timestamp, float fs, const int16_t *samples, size_t len) {
+  size_t sent = 0;
+  while (sent < len) {
+    size_t n = send_frame(flags, first_sample + sent, timestamp + (int64_t) (sent * 1000000 / fs), fs, &samples[sent], len - sent);
+    if (n == 0) return false;
+    sent += n;
+    flags &= ~(STREAM_FLAG_OVERRUN | STREAM_FLAG_AMP_RESET);
+  }
+  return true;
+}
+
+static void on_feature_report (const feature_report_t *report, void *arg) {
+  if (xQueueSend(feature_reports, report, 0) != pdTRUE) features_dropped++;
+}
+
+/* Runs the extractor over samples read from the ring, before they are released */
+static void extract_features (const int16_t *samples, size_t len, uint64_t index, float fs) {
+  if (!features_on) return;
+  if (index != feature_extractor.index) feature_extractor_reset(&feature_extractor, index);
+  feature_extractor_process(&feature_extractor, samples, len, fs);
+}
+
+/* Sends the queued reports, only from the task that sends the stream so frames
+ * are never interleaved on the socket. Reports are dropped without a client. */
+static void send_feature_reports (float fs) {
+  if (!features_on) return;
+  feature_report_t report;
+  while (xQueueReceive(feature_reports, &report, 0) == pdTRUE) {
+    stream_features_t payload = {
+      .length = report.length,
+      .min = report.min,
+      .max = report.max,
+      .mean = report.mean,
+      .ac_rms = report.ac_rms,
+      .dominant_freq = report.dominant_freq,
+      .dominant_amplitude = report.dominant_amplitude,
+      .fft_len = feature_extractor.config.fft_len,
+      .windows = feature_extractor.config.windows
+    };
+    stream_frame_header_t header;
+    stream_frame_init_header(
+      &header, STREAM_FRAME_FEATURES, 0, sequence++,
+      report.first_sample, ads8689_sample_time(report.first_sample), fs,
+      0, sizeof(payload)
+    );
+    stream_frame_seal(&header, &payload);
+    send_counted(&header, &payload);
+  }
+}
+
+static void on_cycle_report (const cycle_peak_report_t *report, void *arg) {
+  if (xQueueSend(cycle_reports, report, 0) != pdTRUE) cycle_reports_dropped++;
+}
+
+/* Peak of each whole cycle, on the samples the features see */
+static void track_cycles (const int16_t *samples, size_t len, uint64_t index) {
+  if (!encoder_on) return;
+  uint32_t cycle;
+  uint16_t angle;
+  if (!ads8689_sample_angle(index, &cycle, &angle)) {
+    cycle_peak_reset(&cycle_peak);
+    return;
+  }
+  cycle_peak_process(&cycle_peak, samples, len, index, cycle, angle);
+}
+
+/* Sent from the task that sends the stream, like the feature reports */
+static void send_cycle_reports (float fs) {
+  if (!encoder_on) return;
+  cycle_peak_report_t report;
+  while (xQueueReceive(cycle_reports, &report, 0) == pdTRUE) {
+    stream_cycle_t payload = {
+      .cycle = report.cycle,
+      .cycle_len = report.cycle_len,
+      .max = report.max,
+      .max_angle = report.max_angle,
+      .min = report.min,
+      .min_angle = report.min_angle
+    };
+    stream_frame_header_t header;
+    stream_frame_init_header(
+      &header, STREAM_FRAME_CYCLE, 0, sequence++,
+      report.first_sample, ads8689_sample_time(report.first_sample), fs,
+      0, sizeof(payload)
+    );
+    stream_frame_seal(&header, &payload);
+    send_counted(&header, &payload);
+  }
+}
+
+/* "adc key=value ...", keys not given keep their value */
+static bool parse_adc_command (const char *args, ads8689_config_t *config) {
+  char buf[128];
+  snprintf(buf, sizeof(buf), "%s", args);
+  char *save;
+  for (char *arg = strtok_r(buf, " ", &save); arg != NULL; arg = strtok_r(NULL, " ", &save)) {
+    char *value = strchr(arg, '=');
+    if (value == NULL) return false;
+    *value++ = '\0';
+    unsigned long v = strtoul(value, NULL, 0);
+    if (strcmp(arg, "rate") == 0) config->sample_freq = v;
+    else if (strcmp(arg, "range") == 0) config->range = (ads8689_range_t) v;
+    else if (strcmp(arg, "spi") == 0) config->spi_clock = v;
+    else if (strcmp(arg, "sdo") == 0) config->sdo_mode = strcmp(value, "dual") == 0 || v == 1 ? ADS8689_SDO_DUAL : ADS8689_SDO_SINGLE;
+    else if (strcmp(arg, "alarm_high") == 0) config->alarm_high = v;
+    else if (strcmp(arg, "alarm_low") == 0) config->alarm_low = v;
+    else if (strcmp(arg, "hysteresis") == 0) config->alarm_hysteresis = v;
+    else return false;
+  }
+  return true;
+}
+
+static void on_tcp_command (const char *command) {
+  int64_t now = esp_timer_get_time();
+  if (strncmp(command, "time ", 5) == 0) {
+    stream_time_t request = { .origin = strtoll(&command[5], NULL, 10), .receive = now };
+    xQueueSend(time_requests, &request, 0);
+  } else if (strcmp(command, "stats") == 0) {
+    stats_requested = true;
+  } else if (strcmp(command, "stats_reset") == 0) {
+    ads8689_stats_reset();
+    tcp_server_reset_send_stats();
+  } else if (strcmp(command, "record_clear") == 0) {
+    if (!record_on || !recorder_clear()) ESP_LOGW(TAG, "no recording to clear");
+  } else if (strcmp(command, "calibration") == 0) {
+    calibration_report_requested = true;
+  } else if (strcmp(command, "baseline") == 0) {
+    baseline_report_requested = true;
+  } else if (strcmp(command, "adc") == 0) {
+    adc_rejected = false;
+    adc_report_requested = true;
+  } else if (strncmp(command, "adc ", 4) == 0) {
+    ads8689_config_t request = adc_config;
+    if (!parse_adc_command(&command[4], &request) || !acquisition_reconfigure(&request)) {
+      ESP_LOGW(TAG, "adc command refused: %s", command);
+      adc_rejected = true;
+      adc_report_requested = true;
+    }
+  } else {
+    ESP_LOGW(TAG, "unknown command %s", command);
+  }
+}
+
+void acquisition_get_stats (stream_stats_t *payload) {
+  ads8689_stats_t stats;
+  tcp_send_stats_t sends;
+  ads8689_get_stats(&stats);
+  tcp_server_get_send_stats(&sends);
+  *payload = (stream_stats_t) {
+    .produced = stats.produced,
+    .sent = stats.sent,
+    .produced_rate = stats.produced_rate,
+    .sent_rate = stats.sent_rate,
+    .overruns = stats.overruns,
+    .dropped = stats.dropped,
+    .ring_len = stats.ring_len,
+    .ring_high_water = stats.ring_high_water,
+    .timer_count = stats.timer_count,
+    .isr_latency_min_ns = stats.isr_latency_min_ns,
+    .isr_latency_max_ns = stats.isr_latency_max_ns,
+    .isr_latency_mean_ns = stats.isr_latency_mean_ns,
+    .jitter_max_ns = stats.jitter_max_ns,
+    .sends = sends.sends,
+    .send_p50_us = sends.p50_us,
+    .send_p90_us = sends.p90_us,
+    .send_p99_us = sends.p99_us,
+    .send_max_us = sends.max_us,
+    .backlog_capacity = backlog_on ? backlog.stats.capacity : 0,
+    .backlog_depth = backlog_on ? backlog.stats.depth : 0,
+    .backlog_high_water = backlog_on ? backlog.stats.high_water : 0,
+    .backlog_full = backlog_on ? backlog.stats.full : 0
+  };
+  memcpy(payload->jitter_hist, stats.jitter_hist, sizeof(payload->jitter_hist));
+
+  pipeline_stage_stats_t stage[ACQUISITION_STAGES];
+  acquisition_get_stage_stats(stage, ACQUISITION_STAGES);
+  float loads[STREAM_STATS_STAGES] = {
+    stage[ACQUISITION_STAGE_ACQUIRE].load,
+    stage[ACQUISITION_STAGE_PROCESS].load,
+    stage[ACQUISITION_STAGE_TRANSMIT].load + stage[ACQUISITION_STAGE_CAPTURE].load,
+    stage[ACQUISITION_STAGE_RECORD].load
+  };
+  for (int i = 0; i < STREAM_STATS_STAGES; i++) {
+    float permille = loads[i] * 1000 + 0.5f;
+    payload->stage_load[i] = permille < UINT16_MAX ? (uint16_t) permille : UINT16_MAX;
+  }
+}
+
+size_t acquisition_get_stage_stats (pipeline_stage_stats_t *stats, size_t max_stages) {
+  size_t n = max_stages < ACQUISITION_STAGES ? max_stages : ACQUISITION_STAGES;
+  if (stage_lock == NULL) {
+    memset(stats, 0, n * sizeof(pipeline_stage_stats_t));
+    return n;
+  }
+  xSemaphoreTake(stage_lock, portMAX_DELAY);
+  int64_t now = esp_timer_get_time();
+  if (stage_report == 0 || now - stage_report >= STAGE_REPORT_PERIOD_US) {
+    pipeline_stage_get_stats(&acquire_stage, &stage_stats[ACQUISITION_STAGE_ACQUIRE]);
+    pipeline_stage_get_stats(&process_stage, &stage_stats[ACQUISITION_STAGE_PROCESS]);
+    pipeline_stage_get_stats(&capture_stage, &stage_stats[ACQUISITION_STAGE_CAPTURE]);
+    tcp_server_get_stage_stats(&stage_stats[ACQUISITION_STAGE_TRANSMIT]);
+    recorder_get_stage_stats(&stage_stats[ACQUISITION_STAGE_RECORD]);
+    stage_report = now;
+  }
+  memcpy(stats, stage_stats, n * sizeof(pipeline_stage_stats_t));
+  xSemaphoreGive(stage_lock);
+  return n;
+}
+
+/* Answers a stats command, from the task that sends the stream like the feature reports */
+static void send_stats_report (float fs) {
+  if (!stats_requested) return;
+  stats_requested = false;
+
+  stream_stats_t payload;
+  acquisition_get_stats(&payload);
+  uint64_t last_sample = payload.produced > 0 ? payload.produced - 1 : 0;
+  stream_frame_header_t header;
+  stream_frame_init_header(
+    &header, STREAM_FRAME_STATS, 0, sequence++,
+    last_sample, ads8689_sample_time(last_sample), fs,
+    0, sizeof(payload)
+  );
+  stream_frame_seal(&header, &payload);
+  send_counted(&header, &payload);
+}
+
+/* Answers the adc commands once the settings are applied, like the stats reports */
+static void send_adc_report (float fs) {
+  if (!adc_report_requested) return;
+  adc_report_requested = false;
+
+  ads8689_config_t config;
+  uint32_t spi_clock;
+  ads8689_get_config(&config, &spi_clock);
+  stream_adc_config_t payload = {
+    .requested_rate = adc_requested_rate,
+    .sample_rate = stream_fs,
+    .spi_clock = spi_clock,
+    .range = config.range,
+    .sdo_mode = config.sdo_mode,
+    .alarm_hysteresis = config.alarm_hysteresis,
+    .rejected = adc_rejected,
+    .alarm_high = config.alarm_high,
+    .alarm_low = config.alarm_low
+  };
+  ads8689_stats_t stats;
+  ads8689_get_stats(&stats);
+  uint64_t last_sample = stats.produced > 0 ? stats.produced - 1 : 0;
+  stream_frame_header_t header;
+  stream_frame_init_header(
+    &header, STREAM_FRAME_ADC, 0, sequence++,
+    last_sample, ads8689_sample_time(last_sample), fs,
+    0, sizeof(payload)
+  );
+  stream_frame_seal(&header, &payload);
+  send_counted(&header, &payload);
+}
+
+/* Sends the calibration in use after a start or a range change and on the
+ * calibration command, like the adc reports */
+static void send_calibration_report (float fs) {
+  if (!calibration_report_requested) return;
+  calibration_report_requested = false;
+
+  const calibration_t *cal = calibration_current;
+  ads8689_range_t range = cal != NULL ? (ads8689_range_t) calibration_range : adc_config.range;
+  stream_calibration_t payload = {
+    .range = range,
+    .lsb_volts = ads8689_config_lsb_volts(range)
+  };
+  if (cal != NULL) {
+    payload.hash = cal->hash;
+    payload.frac_bits = cal->frac_bits;
+    payload.enabled = 1;
+    payload.gain = cal->config.gain;
+    payload.offset = cal->config.offset;
+    payload.amp_range_pc = cal->config.amp_range_pc;
+    payload.amp_full_scale_v = cal->config.amp_full_scale_v;
+    payload.sensitivity = cal->config.sensitivity;
+    payload.sensitivity_drift = cal->config.sensitivity_drift;
+    payload.zero_drift = cal->config.zero_drift;
+    payload.reference_temp = cal->config.reference_temp;
+    payload.temperature = cal->config.temperature;
+  }
+  ads8689_stats_t stats;
+  ads8689_get_stats(&stats);
+  uint64_t last_sample = stats.produced > 0 ? stats.produced - 1 : 0;
+  stream_frame_header_t header;
+  stream_frame_init_header(
+    &header, STREAM_FRAME_CALIBRATION, 0, sequence++,
+    last_sample, ads8689_sample_time(last_sample), fs,
+    0, sizeof(payload)
+  );
+  stream_frame_seal(&header, &payload);
+  send_counted(&header, &payload);
+}
+
+/* Sends the baseline estimate once an amplifier reset took effect and on the
+ * baseline command, like the calibration reports */
+static void send_baseline_report (float fs) {
+  if (!baseline_report_requested) return;
+  baseline_report_requested = false;
+
+  stream_baseline_t payload = {
+    .reset_index = baseline.last_reset,
+    .resets = baseline.resets,
+    .pegs = baseline.pegs,
+    .level = baseline_level(&baseline),
+    .rest = baseline.rest,
+    .drift = baseline.slope * fs,
+    .reference = baseline.config.reference,
+    .peg = baseline.config.peg,
+    .reset_pending = baseline.reset_scheduled
+  };
+  uint64_t last_sample = baseline.index > 0 ? baseline.index - 1 : 0;
+  stream_frame_header_t header;
+  stream_frame_init_header(
+    &header, STREAM_FRAME_BASELINE, 0, sequence++,
+    last_sample, ads8689_sample_time(last_sample), fs,
+    0, sizeof(payload)
+  );
+  stream_frame_seal(&header, &payload);
+  send_counted(&header, &payload);
+}
+
+/* Answers the time commands, the transport writes the transmit time as the frame leaves */
+static void send_time_reports (float fs) {
+  stream_time_t payload;
+  while (xQueueReceive(time_requests, &payload, 0) == pdTRUE) {
+    ads8689_stats_t stats;
+    ads8689_get_stats(&stats);
+    uint64_t last_sample = stats.produced > 0 ? stats.produced - 1 : 0;
+    payload.transmit = esp_timer_get_time();
+    stream_frame_header_t header;
+    stream_frame_init_header(
+      &header, STREAM_FRAME_TIME, 0, sequence++,
+      last_sample, ads8689_sample_time(last_sample), fs,
+      0, sizeof(payload)
+    );
+    stream_frame_seal(&header, &payload);
+    send_counted(&header, &payload);
+  }
+}
+
+/* Samples go to the backlog instead of the clients while it holds older ones
+ * or the slowest client is behind. Without a client there is nobody to keep
+ * them for, the stream goes on as if there were no backlog */
+static bool backlog_needed () {
+  if (!backlog_on) return false;
+  if (!tcp_server_connected()) {
+    if (!sample_backlog_empty(&backlog)) sample_backlog_clear(&backlog);
+    return false;
+  }
+  return !sample_backlog_empty(&backlog) || tcp_server_lag() >= BACKLOG_SEND_LAG;
+}
+
+/* Moves one ring block to the backlog with its stream position, 0 once it is full */
+static size_t backlog_store (uint32_t flags, uint64_t first_sample, float fs, const int16_t *samples, size_t len) {
+  backlog_block_t block = {
+    .first_sample = first_sample,
+    .timestamp = ads8689_sample_time(first_sample),
+    .sample_rate = fs,
+    .count = len < backlog.block_samples ? len : backlog.block_samples,
+    .flags = flags
+  };
+  block.flags |= amp_reset_flag(first_sample, block.count);
+  return sample_backlog_push(&backlog, &block, samples) ? block.count : 0;
+}
+
+/* Sends the oldest blocks as long as the slowest client keeps up, as fast as the link takes them */
+static void backlog_send () {
+  static int16_t block_samples[COMPRESSED_READ_LEN];
+  backlog_block_t block;
+  while (!sample_backlog_empty(&backlog) && tcp_server_lag() < BACKLOG_SEND_LAG) {
+    if (!sample_backlog_pop(&backlog, &block, block_samples)) break;
+    send_all(block.flags, block.first_sample, block.timestamp, block.sample_rate, block_samples, block.count);
+  }
+}
+
+/* Without a client the samples go to the recorder, in its larger blocks */
+static bool record_needed () {
+  return record_on && !tcp_server_connected();
+}
+
+/* Acquire stage, the only ring reader: claims each ring block and queues
+ * where it is, the process stage frees it once done, so the samples are not
+ * copied on the way. Before a restart the process stage gets the restart
+ * mark and empties the queue, the old samples are framed with the old clock
+ * and the ring is restarted only once none is left in the queue */
+static void adc_acquire_task () {
+  /* A compressed frame holds more than the raw frame samples */
+  size_t send_len = compress ? COMPRESSED_READ_LEN : raw_frame_len;
+  /* The raw stream waits for a full frame, a partial one leaves at the
+   * deadline. The other modes take what came every tick */
+  TickType_t timeout = raw_stream ? pdMS_TO_TICKS(FRAME_DEADLINE_MS) : 1;
+  while (1) {
+    if (pause_requested) {
+      /* The process stage drops what it cannot send during a restart, so the
+       * queue empties. Its blocks point into the ring, which waits for them */
+      TickType_t drain = pdMS_TO_TICKS(RESTART_DRAIN_MS);
+      stage_block_t *mark;
+      while ((mark = block_queue_write_acquire(&stage_queue, drain)) == NULL) {
+        ESP_LOGW(TAG, "restart waiting for the process stage, stage queue full");
+      }
+      mark->len = 0;
+      block_queue_write_commit(&stage_queue);
+      TickType_t start = xTaskGetTickCount();
+      while (block_queue_fill(&stage_queue) > 0) {
+        if (xTaskGetTickCount() - start >= drain) {
+          ESP_LOGW(TAG, "restart waiting for the process stage, %u blocks in the stage queue", block_queue_fill(&stage_queue));
+          start = xTaskGetTickCount();
+        }
+        vTaskDelay(1);
+      }
+      park_reader();
+    }
+    size_t min_len = !raw_stream ? DECIMATOR_BLOCK_LEN : record_needed() ? RECORDER_BLOCK_LEN : send_len;
+    size_t read_len;
+    float fs;
+    const int16_t *samples = ads8689_read_acquire(&read_len, min_len, timeout, &fs);
+    if (samples == NULL) continue;
+    /* The process stage is a queue behind, the samples wait in the ring */
+    stage_block_t *block = block_queue_write_acquire(&stage_queue, timeout);
+    if (block == NULL) continue;
+
+    /* A raw block is one frame, the rest joins the next one in the ring */
+    size_t max_len = raw_stream && !compress ? min_len : STAGE_BLOCK_LEN;
+    block->len = read_len < max_len ? read_len : max_len;
+    block->first_sample = ads8689_read_index(&block->gap);
+    block->fs = fs;
+    block->range = adc_config.range;
+    block->samples = (int16_t*) samples;
+    /* Claimed before the process stage can free it */
+    ads8689_read_claim(block->len);
+    block_queue_write_commit(&stage_queue);
+  }
+}
+
+/**
+ * Subtracts the drift from a block taken from the stage queue, then asks for
+ * an amplifier reset if the drift needs one. The reset is timed in the quiet
+ * part of a cycle after the newest sample converted, the stage queue and the
+ * ring hold the samples in between.
+ */
+static void baseline_correct (stage_block_t *block) {
+  if (!baseline_started || block->gap || block->first_sample != baseline.index) {
+    baseline_restart(&baseline, block->first_sample);
+    baseline_started = true;
+  }
+  baseline_process(&baseline, block->samples, block->samples, block->len);
+  if (baseline.resets != baseline_resets) {
+    baseline_resets = baseline.resets;
+    amp_reset_mark = baseline.last_reset / amp_reset_factor;
+    baseline_report_requested = true;
+    ESP_LOGI(TAG, "charge amplifier reset at sample %llu", (unsigned long long) baseline.last_reset);
+  }
+  if (!baseline_reset_due(&baseline)) return;
+
+  uint64_t end = block->first_sample + block->len;
+  int64_t ahead_us = esp_timer_get_time() - ads8689_sample_time(end) + AMP_RESET_LEAD_US;
+  uint64_t earliest = end + (ahead_us > 0 ? (uint64_t) (ahead_us * (double) block->fs / 1000000) : 0);
+  uint64_t at = baseline_next_quiet(&baseline, earliest);
+  if (charge_amp_reset_at(ads8689_sample_time(at))) baseline_amp_reset(&baseline, at);
+}
+
+/**
+ * Process stage side of the stage queue, the contract of ads8689_read_acquire()
+ * without a minimum length: the rest of the oldest block. Returns NULL with
+ * restart set once the blocks of the stream before a restart are all read.
+ */
+static const int16_t* stage_read_acquire (size_t *len, TickType_t timeout, float *fs, bool *restart) {
+  *restart = false;
+  *len = 0;
+  if (stage_reading == NULL) {
+    stage_reading = block_queue_read_acquire(&stage_queue, timeout);
+    if (stage_reading == NULL) return NULL;
+    stage_offset = 0;
+    stage_gap = stage_reading->gap;
+    if (stage_reading->len == 0) {
+      block_queue_read_release(&stage_queue);
+      stage_reading = NULL;
+      baseline_started = false;
+      *restart = true;
+      return NULL;
+    }
+    if (calibration_on && (int) stage_reading->range != calibration_range) calibration_update(stage_reading->range);
+    if (baseline_on) baseline_correct(stage_reading);
+  }
+  *fs = stage_reading->fs;
+  *len = stage_reading->len - stage_offset;
+  return &stage_reading->samples[stage_offset];
+}
+
+/* Index of the first sample of stage_read_acquire(), gap is reported once like the ring does */
+static uint64_t stage_read_index (bool *gap) {
+  *gap = stage_gap;
+  stage_gap = false;
+  return stage_reading->first_sample + stage_offset;
+}
+
+/* Releases samples from the start of the block, the block and its ring samples once they all are */
+static void stage_read_release (size_t len) {
+  stage_offset += len;
+  if (stage_offset < stage_reading->len) return;
+  ads8689_read_free(stage_reading->len);
+  block_queue_read_release(&stage_queue);
+  stage_reading = NULL;
+}
+
+static void adc_read_task () {
+  float fs = 0;
+  /* Wakes up at the frame deadline of the acquire stage at least */
+  TickType_t timeout = pdMS_TO_TICKS(FRAME_DEADLINE_MS);
+  /* Overrun flag of the samples a full backlog left in the stage queue */
+  uint32_t held_flags = 0;
+  while (1) {
+    size_t read_len;
+    bool restart;
+    /* Samples are sent straight from the stage queue, one frame per TCP segment */
+    const int16_t *samples = stage_read_acquire(&read_len, timeout, &fs, &restart);
+    /* Older samples first, the new ones join them in the backlog */
+    if (backlog_on) backlog_send();
+    if (samples == NULL) continue;
+
+    bool gap;
+    uint64_t first_sample = stage_read_index(&gap);
+    uint32_t flags = held_flags | (gap ? STREAM_FLAG_OVERRUN : 0);
+    size_t sent;
+    if (backlog_needed()) {
+      sent = backlog_store(flags | calibration_flags() | angle_flags(), first_sample, fs, samples, read_len);
+      held_flags = sent == 0 ? flags : 0;
+    } else if (record_needed()) {
+      uint32_t record_flags = flags | amp_reset_flag(first_sample, read_len);
+      sent = recorder_push(record_flags, first_sample, ads8689_sample_time(first_sample), fs, samples, read_len);
+      held_flags = sent == 0 ? record_flags : 0;
+    } else {
+      held_flags = 0;
+      sent = send_frame(flags | calibration_flags() | angle_flags(), first_sample, ads8689_sample_time(first_sample), fs, samples, read_len);
+      if (sent == 0) {
+        /* No client, the frame is dropped but the stream keeps its pace */
+        sent = read_len < raw_frame_len ? read_len : raw_frame_len;
+      }
+    }
+    if (sent == 0 && pause_requested) {
+      /* A restart waits for the stage queue, the samples the backlog or the
+       * recorder cannot take are dropped instead of holding it */
+      sent = read_len;
+      held_flags = STREAM_FLAG_OVERRUN;
+    }
+    if (sent == 0) {
+      /* Backlog or recorder full, the samples wait in the stage queue and the
+       * ring until the clients or the flash take some */
+      vTaskDelay(1);
+      continue;
+    }
+    extract_features(samples, sent, first_sample, fs);
+    track_cycles(samples, sent, first_sample);
+    stage_read_release(sent);
+    send_feature_reports(fs);
+    send_cycle_reports(fs);
+    send_stats_report(fs);
+    send_adc_report(fs);
+    send_calibration_report(fs);
+    send_baseline_report(fs);
+    send_time_reports(fs);
+    print_stats(sent, fs);
+  }
+}
+
+/* Decimated samples in DECIMATED_FRAME_PERIOD at the rate the stream runs at */
+static size_t decimated_frame_len (uint32_t factor, float fs) {
+  size_t frame_len = (size_t) (fs / factor * DECIMATED_FRAME_PERIOD / 1000000);
+  if (frame_len < 1) frame_len = 1;
+  if (frame_len > STREAM_FRAME_MAX_SAMPLES) frame_len = STREAM_FRAME_MAX_SAMPLES;
+  return frame_len;
+}
+
+/* Filters each block read from the ring into the pending frame, which is sent
+ * once it holds about DECIMATED_FRAME_PERIOD of output samples */
+static void adc_decimate_task () {
+  static int16_t frame[STREAM_FRAME_MAX_SAMPLES];
+  size_t pending = 0;
+  uint64_t frame_first = 0;
+  uint32_t frame_flags = 0;
+  float fs = stream_fs;
+  bool started = false;
+
+  uint32_t factor = decimator.factor;
+  size_t frame_len = decimated_frame_len(factor, fs);
+
+  while (1) {
+    size_t read_len;
+    bool restart;
+    const int16_t *samples = stage_read_acquire(&read_len, 1, &fs, &restart);
+    if (restart) {
+      /* The pending samples are of the old rate, sent before the restart */
+      if (pending > 0) {
+        send_all(frame_flags | calibration_flags(), frame_first, decimated_time(frame_first, fs), fs / factor, frame, pending);
+        pending = 0;
+      }
+      started = false;
+    }
+    if (samples == NULL) continue;
+    if (read_len > DECIMATOR_BLOCK_LEN) read_len = DECIMATOR_BLOCK_LEN;
+
+    bool gap;
+    uint64_t index = stage_read_index(&gap);
+    if (!started) frame_len = decimated_frame_len(factor, fs);
+    if (gap || !started) {
+      /* Filter history is lost, restart aligned to the new position */
+      if (pending > 0) {
+        send_all(frame_flags | calibration_flags(), frame_first, decimated_time(frame_first, fs), fs / factor, frame, pending);
+        pending = 0;
+      }
+      fir_decimator_chain_reset(&decimator, index);
+      frame_flags = gap ? STREAM_FLAG_OVERRUN : 0;
+      started = true;
+    }
+
+    if (pending == 0) frame_first = decimator.out_index;
+    pending += fir_decimator_chain_process(&decimator, samples, read_len, &frame[pending]);
+    extract_features(samples, read_len, index, fs);
+    track_cycles(samples, read_len, index);
+    stage_read_release(read_len);
+
+    if (pending >= frame_len || pending + DECIMATOR_BLOCK_LEN / factor + 1 > STREAM_FRAME_MAX_SAMPLES) {
+      /* Dropped without a client */
+      send_all(frame_flags | calibration_flags(), frame_first, decimated_time(frame_first, fs), fs / factor, frame, pending);
+      pending = 0;
+      frame_flags = 0;
+    }
+    send_feature_reports(fs);
+    send_cycle_reports(fs);
+    send_stats_report(fs);
+    send_adc_report(fs);
+    send_calibration_report(fs);
+    send_baseline_report(fs);
+    send_time_reports(fs);
+    print_stats(read_len, fs);
+  }
+}
+
+static trigger_capture_t* get_free_capture (void *arg) {
+  trigger_capture_t *capture;
+  return xQueueReceive(free_captures, &capture, 0) == pdTRUE ? capture : NULL;
+}
+
+static void on_capture_done (trigger_capture_t *capture, void *arg) {
+  xQueueSend(ready_captures, &capture, portMAX_DELAY);
+}
+
+/* Runs the trigger over every sample, never waits for the network */
+static void adc_trigger_task () {
+  bool started = false;
+  float fs;
+  while (1) {
+    size_t read_len;
+    bool restart;
+    const int16_t *samples = stage_read_acquire(&read_len, 1, &fs, &restart);
+    if (restart) started = false;
+    if (samples == NULL) continue;
+
+    bool gap;
+    uint64_t index = stage_read_index(&gap);
+    if (gap || !started) {
+      trigger_engine_reset(&trigger_engine, index);
+      started = true;
+    }
+    trigger_engine_process(&trigger_engine, samples, read_len);
+    extract_features(samples, read_len, index, fs);
+    track_cycles(samples, read_len, index);
+    stage_read_release(read_len);
+  }
+}
+
+/* Waits until the slowest client took the frames ahead of a capture frame, false once none is left */
+static bool capture_wait_clients () {
+  while (tcp_server_lag() >= CAPTURE_SEND_LAG) {
+    if (!tcp_server_connected()) return false;
+    vTaskDelay(1);
+  }
+  return tcp_server_connected();
+}
+
+/* Sends complete windows, waiting for the slowest client as long as one stays connected */
+static void capture_send_task () {
+  static uint8_t payload[STREAM_FRAME_MAX_PAYLOAD];
+  stream_capture_header_t *capture_header = (stream_capture_header_t*) payload;
+  int16_t *payload_samples = (int16_t*) &payload[sizeof(stream_capture_header_t)];
+  while (1) {
+    trigger_capture_t *capture;
+    /* Wakes up for the feature reports and stats requests between captures */
+    send_feature_reports(stream_fs);
+    send_cycle_reports(stream_fs);
+    send_stats_report(stream_fs);
+    send_adc_report(stream_fs);
+    send_calibration_report(stream_fs);
+    send_baseline_report(stream_fs);
+    send_time_reports(stream_fs);
+    if (xQueueReceive(ready_captures, &capture, pdMS_TO_TICKS(100)) != pdTRUE) continue;
+
+    *capture_header = (stream_capture_header_t) {
+      .trigger_index = capture->trigger_index,
+      .number = capture->number,
+      .missed = capture->missed,
+      .length = capture->len,
+      .pre_trigger = capture->pre_trigger
+    };
+    uint64_t first_sample = capture->trigger_index - capture->pre_trigger;
+    size_t sent = 0;
+    while (sent < capture->len && capture_wait_clients()) {
+      size_t len = capture->len - sent;
+      if (len > STREAM_CAPTURE_MAX_SAMPLES) len = STREAM_CAPTURE_MAX_SAMPLES;
+      memcpy(payload_samples, &capture->samples[sent], len * sizeof(int16_t));
+
+      stream_frame_header_t header;
+      stream_frame_init_header(
+        &header, STREAM_FRAME_CAPTURE, capture->truncated ? STREAM_FLAG_OVERRUN : 0, sequence++,
+        first_sample + sent, ads8689_sample_time(first_sample + sent), stream_fs,
+        len, sizeof(stream_capture_header_t) + len * sizeof(int16_t)
+      );
+      stream_frame_seal(&header, payload);
+      /* Only fails once the last client left */
+      if (!send_counted(&header, payload)) break;
+      sent += len;
+    }
+    if (sent < capture->len) ESP_LOGW(TAG, "capture %u dropped, no client", capture->number);
+    xQueueSend(free_captures, &capture, 0);
+  }
+}
+
+/* Only the feature reports leave the sensor */
+static void adc_features_task () {
+  float fs;
+  while (1) {
+    size_t read_len;
+    bool restart;
+    const int16_t *samples = stage_read_acquire(&read_len, 1, &fs, &restart);
+    if (samples == NULL) continue;
+
+    bool gap;
+    uint64_t index = stage_read_index(&gap);
+    extract_features(samples, read_len, index, fs);
+    track_cycles(samples, read_len, index);
+    stage_read_release(read_len);
+    send_feature_reports(fs);
+    send_cycle_reports(fs);
+    send_stats_report(fs);
+    send_adc_report(fs);
+    send_calibration_report(fs);
+    send_baseline_report(fs);
+    send_time_reports(fs);
+  }
+}
+
+static bool features_setup (const feature_config_t *features) {
+  if (!feature_extractor_init(&feature_extractor, features, on_feature_report, NULL)) {
+    ESP_LOGE(TAG, "invalid feature configuration");
+    return false;
+  }
+  feature_reports = xQueueCreate(FEATURE_QUEUE_LEN, sizeof(feature_report_t));
+  ESP_LOGI(TAG, "feature report every %u x %u samples", features->windows, features->fft_len);
+  return true;
+}
+
+static bool trigger_setup (const trigger_config_t *trigger) {
+  size_t window_len = trigger->pre_trigger + trigger->post_trigger;
+  if (window_len > CAPTURE_MAX_LEN) {
+    ESP_LOGE(TAG, "capture window of %zu samples is over the limit of %u", window_len, CAPTURE_MAX_LEN);
+    return false;
+  }
+  if (!trigger_engine_init(&trigger_engine, trigger, get_free_capture, on_capture_done, NULL)) {
+    ESP_LOGE(TAG, "invalid trigger configuration");
+    return false;
+  }
+  free_captures = xQueueCreate(CAPTURE_SLOTS, sizeof(trigger_capture_t*));
+  ready_captures = xQueueCreate(CAPTURE_SLOTS, sizeof(trigger_capture_t*));
+  for (int i = 0; i < CAPTURE_SLOTS; i++) {
+    capture_slots[i].samples = (int16_t*) malloc(window_len * sizeof(int16_t));
+    if (capture_slots[i].samples == NULL) {
+      ESP_LOGE(TAG, "no memory for capture buffers");
+      return false;
+    }
+    trigger_capture_t *slot = &capture_slots[i];
+    xQueueSend(free_captures, &slot, 0);
+  }
+  ESP_LOGI(
+    TAG, "trigger at %d, hysteresis %u, %u + %u samples",
+    trigger->level, trigger->hysteresis, trigger->pre_trigger, trigger->post_trigger
+  );
+  return true;
+}
+
+/* Takes the backlog memory in external RAM, or in internal RAM without it */
+static bool backlog_alloc (const acquisition_backlog_t *sizes) {
+  if (sizes->spiram_len > 0 && backlog_storage_alloc(&backlog_memory, sizes->spiram_len, MALLOC_CAP_SPIRAM)) return true;
+  if (sizes->internal_len == 0) return false;
+  ESP_LOGW(TAG, "no external RAM, backlog in internal RAM");
+  return backlog_storage_alloc(&backlog_memory, sizes->internal_len, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+}
+
+void acquisition_start (const acquisition_config_t *config) {
+  bool decimate = false;
+  features_on = config != NULL && config->features != NULL && features_setup(config->features);
+  bool features_only = features_on && config->features_only;
+  bool triggered = !features_only && config != NULL && config->trigger != NULL && trigger_setup(config->trigger);
+  compress = config != NULL && config->compress;
+  if (!features_only && !triggered && config != NULL && config->n_decimation > 0) {
+    decimate = fir_decimator_chain_init(&decimator, config->decimation, config->n_decimation, DECIMATOR_BLOCK_LEN);
+    if (decimate) {
+      ESP_LOGI(TAG, "decimation by %u, %zu stages, delay %.1f samples", decimator.factor, decimator.n_stages, decimator.delay);
+    } else {
+      ESP_LOGE(TAG, "invalid decimation configuration, sending raw stream");
+    }
+  }
+
+  if (config != NULL && config->adc != NULL) adc_config = *config->adc;
+  if (config != NULL && config->encoder != NULL) {
+    encoder_on = ads8689_encoder_check(config->encoder, &adc_config) == ESP_OK;
+    if (encoder_on) {
+      encoder_config = *config->encoder;
+      raw_frame_len = STREAM_ANGLE_MAX_SAMPLES;
+      cycle_peak_init(&cycle_peak, (uint16_t) ads8689_encoder_cycle_len(&encoder_config), on_cycle_report, NULL);
+      cycle_reports = xQueueCreate(CYCLE_QUEUE_LEN, sizeof(cycle_peak_report_t));
+      ESP_LOGI(
+        TAG, "conversions every %u encoder edges, %u a cycle",
+        encoder_config.edges_per_sample, ads8689_encoder_cycle_len(&encoder_config)
+      );
+    } else {
+      ESP_LOGE(TAG, "invalid encoder settings, conversions clocked by the timer");
+    }
+  }
+
+  if (config != NULL && config->backlog != NULL) {
+    if (features_only || triggered || decimate) {
+      ESP_LOGW(TAG, "backlog only behind the raw stream, not allocated");
+    } else if (!backlog_alloc(config->backlog)) {
+      ESP_LOGE(TAG, "no memory for the backlog");
+    } else {
+      backlog_on = sample_backlog_init(&backlog, &backlog_memory, compress ? COMPRESSED_READ_LEN : raw_frame_len);
+      if (backlog_on) {
+        ESP_LOGI(TAG, "backlog of %u samples behind the ring", backlog.stats.capacity);
+      } else {
+        ESP_LOGE(TAG, "backlog storage of %zu bytes too small", backlog_memory.len);
+        backlog_storage_free(&backlog_memory);
+      }
+    }
+  }
+
+  if (config != NULL && config->stages != NULL) stages = *config->stages;
+  raw_stream = !features_only && !triggered && !decimate;
+  if (config != NULL && config->record != NULL) {
+    if (features_only || triggered || decimate) {
+      ESP_LOGW(TAG, "recording only of the raw stream, not used");
+    } else {
+      record_on = recorder_start(config->record, &stages.record);
+    }
+  }
+
+  if (config != NULL && config->calibration != NULL) {
+    if (features_only || triggered) {
+      ESP_LOGW(TAG, "calibration only of the sample stream, not used");
+    } else {
+      calibration_config = *config->calibration;
+      calibration_on = true;
+    }
+  }
+
+  if (config != NULL && config->baseline != NULL) {
+    baseline_on = baseline_init(&baseline, config->baseline);
+    if (!baseline_on) ESP_LOGE(TAG, "invalid baseline configuration, drift not corrected");
+    else ESP_LOGI(TAG, "baseline pegged every %u samples, reset margin %u", config->baseline->cycle_len, config->baseline->reset_margin);
+    if (decimate) amp_reset_factor = decimator.factor;
+  }
+
+  reader_parked = xSemaphoreCreateBinary();
+  reader_resume = xSemaphoreCreateBinary();
+  adc_requests = xQueueCreate(ADC_QUEUE_LEN, sizeof(ads8689_config_t));
+  time_requests = xQueueCreate(TIME_QUEUE_LEN, sizeof(stream_time_t));
+  tcp_server_set_command_cb(on_tcp_command);
+  udp_stream_set_command_cb(on_tcp_command);
+  stage_lock = xSemaphoreCreateMutex();
+  void *stage_buf = malloc(STAGE_QUEUE_BLOCKS * sizeof(stage_block_t));
+  if (!block_queue_init(&stage_queue, stage_buf, sizeof(stage_block_t), STAGE_QUEUE_BLOCKS)) {
+    ESP_LOGE(TAG, "no memory for the stage queue");
+    return;
+  }
+  /* The interrupts of the stream are allocated on the core of the control task */
+  xTaskCreatePinnedToCore(adc_control_task, "ADC control", 8 * 1024, NULL, 10, NULL, stages.acquire.core);
+  while(!setup_done);
+  pipeline_stage_start(&acquire_stage, &stages.acquire, adc_acquire_task, NULL);
+  if (features_only) {
+    pipeline_stage_start(&process_stage, &stages.process, adc_features_task, NULL);
+  } else if (triggered) {
+    pipeline_stage_start(&process_stage, &stages.process, adc_trigger_task, NULL);
+    pipeline_stage_start(&capture_stage, &stages.capture, capture_send_task, NULL);
+  } else if (decimate) {
+    pipeline_stage_start(&process_stage, &stages.process, adc_decimate_task, NULL);
+  } else {
+    pipeline_stage_start(&process_stage, &stages.process, adc_read_task, NULL);
+  }
+  ESP_LOGI(
+    TAG, "acquire on core %d, process on core %d, %u blocks of %u samples between them",
+    stages.acquire.core, stages.process.core, STAGE_QUEUE_BLOCKS, STAGE_BLOCK_LEN
+  );
+}
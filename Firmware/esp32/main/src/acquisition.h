@@ -0,0 +1,130 @@
+#ifndef ACQUISITION_H
+#define ACQUISITION_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "fir_decimator.h"
+#include "trigger.h"
+#include "feature_extractor.h"
+#include "calibration.h"
+#include "baseline.h"
+#include "stream_frame.h"
+#include "ads8689.h"
+#include "flash_log.h"
+#include "pipeline_stage.h"
+#include "recorder.h"
+
+/**
+ * Tasks of the pipeline the samples go through: the acquire stage hands the
+ * ring blocks on through a block queue as they fill, next to the ADC interrupts, the
+ * process stage filters, triggers, extracts features and frames them, the
+ * transmit stage (tcp_server.h) and the record stage (recorder.h) take the
+ * frames from there
+ */
+typedef struct acquisition_stages_t {
+  /** Also the core of the ADC control task and of the ADC interrupts */
+  pipeline_stage_config_t acquire;
+  pipeline_stage_config_t process;
+  /** Sends the capture windows in trigger mode */
+  pipeline_stage_config_t capture;
+  pipeline_stage_config_t record;
+} acquisition_stages_t;
+
+/* The ADC and the sample processing on core 1, the network on core 0 with WiFi */
+#define ACQUISITION_DEFAULT_STAGES() { \
+  .acquire = { .name = "ADC acquire", .core = 1, .priority = 12, .stack = 4 * 1024 }, \
+  .process = { .name = "ADC process", .core = 1, .priority = 10, .stack = 16 * 1024 }, \
+  .capture = { .name = "Capture send", .core = 0, .priority = 9, .stack = 8 * 1024 }, \
+  .record = RECORDER_DEFAULT_STAGE() \
+}
+
+/* Stages of acquisition_get_stage_stats() */
+typedef enum acquisition_stage_t {
+  ACQUISITION_STAGE_ACQUIRE,
+  ACQUISITION_STAGE_PROCESS,
+  ACQUISITION_STAGE_CAPTURE,
+  ACQUISITION_STAGE_TRANSMIT,
+  ACQUISITION_STAGE_RECORD,
+  ACQUISITION_STAGES
+} acquisition_stage_t;
+
+/* Backlog memory, the external RAM is tried first */
+typedef struct acquisition_backlog_t {
+  /** Bytes of external RAM, 0 to skip it */
+  size_t spiram_len;
+  /** Bytes of internal RAM without external RAM, 0 for none */
+  size_t internal_len;
+} acquisition_backlog_t;
+
+typedef struct acquisition_config_t {
+  /** Decimation stages applied before sending, none for the raw stream */
+  const fir_decimator_config_t *decimation;
+  size_t n_decimation;
+  /** Send lossless compressed frames when they are smaller than raw ones */
+  bool compress;
+  /** Send only the windows around each trigger instead of the stream, takes
+   * precedence over decimation */
+  const trigger_config_t *trigger;
+  /** Feature reports sent along the stream, NULL for none */
+  const feature_config_t *features;
+  /** Send the feature reports only, no samples */
+  bool features_only;
+  /** Calibration the sample frames are converted to pressure with, of the
+   * raw or decimated stream, NULL to send ADC codes. Trigger levels, captures,
+   * feature reports and the recording stay in ADC codes */
+  const calibration_config_t *calibration;
+  /** Drift of the charge amplifier estimated and subtracted in the process
+   * stage, before everything else, NULL to leave the codes as they come. The
+   * amplifier is reset through charge_amp.h when the drift nears the range
+   * limits, charge_amp_init() must be called before */
+  const baseline_config_t *baseline;
+  /** ADC settings at start, NULL for ADS8689_DEFAULT_CONFIG() */
+  const ads8689_config_t *adc;
+  /** Shaft encoder clocking the conversions instead of the timer, the sample
+   * rate of the adc settings is then unused. The raw stream frames carry the
+   * cycle and angle of their samples (STREAM_FLAG_ANGLE), the decimated ones
+   * and the recording do not. NULL for the timer */
+  const ads8689_encoder_config_t *encoder;
+  /** Size of the backlog the raw stream falls back to while the clients lag
+   * behind, instead of overrunning the ring. Allocated only when the raw
+   * stream is sent, NULL for none */
+  const acquisition_backlog_t *backlog;
+  /** Flash area the raw stream is recorded to while no client is connected,
+   * downloaded from the download port. NULL for none, see recorder.h */
+  const flash_log_flash_t *record;
+  /** Cores and priorities of the pipeline tasks, NULL for ACQUISITION_DEFAULT_STAGES() */
+  const acquisition_stages_t *stages;
+} acquisition_config_t;
+
+/**
+ * @brief Configures the ADS8689, starts the stream and the task that sends
+ * the acquired samples to the TCP server. Returns once the stream is running.
+ * @param config NULL to send the raw stream
+ */
+void acquisition_start (const acquisition_config_t *config);
+
+/**
+ * @brief Snapshot of the driver instrumentation in the layout of the stats
+ * frame, the same the "stats" TCP command sends. Safe from any task
+ */
+void acquisition_get_stats (stream_stats_t *stats);
+
+/**
+ * @brief CPU load of each pipeline stage over the last second,
+ * in the acquisition_stage_t order. A stage that does not run
+ * reports a zero load and no name. Safe from any task
+ * @returns stages written
+ */
+size_t acquisition_get_stage_stats (pipeline_stage_stats_t *stats, size_t max_stages);
+
+/**
+ * @brief Queues new ADC settings, the same as the "adc" TCP command. The
+ * control task parks the ring reader, stops the stream, applies them and
+ * restarts it, then reports the rate it runs at in a STREAM_FRAME_ADC frame.
+ * Settings ads8689_config_check() refuses are reported and leave the stream running
+ * @return false before acquisition_start() or if requests are already waiting
+ */
+bool acquisition_reconfigure (const ads8689_config_t *config);
+
+#endif
@@ -0,0 +1,93 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "ads8689.h"
+#include "ads8689_alarm.h"
+#include "event_server.h"
+#include "stream_frame.h"
+
+#include "alarm_events.h"
+
+static const char *TAG = "ALARM";
+
+/* Above the stream tasks, alone on the core of the ADC control task */
+#define ALARM_TASK_PRIORITY (15)
+#define ALARM_TASK_CORE (1)
+
+static uint32_t sequence = 0;
+/* Written by the alarm task, read consistently by alarm_events_get_stats() */
+static volatile uint32_t stats_seq = 0;
+static alarm_events_stats_t stats;
+static uint64_t latency_sum_us = 0;
+
+static void record (int64_t conversion, int64_t detected, int64_t sent, size_t clients) {
+  uint32_t latency = sent > conversion ? (uint32_t) (sent - conversion) : 0;
+  uint32_t detection = detected > conversion ? (uint32_t) (detected - conversion) : 0;
+  stats_seq++;
+  stats.events++;
+  stats.lost = ads8689_alarm_lost();
+  if (clients == 0) stats.unsent++;
+  if (latency > stats.latency_max_us) stats.latency_max_us = latency;
+  if (detection > stats.detection_max_us) stats.detection_max_us = detection;
+  latency_sum_us += latency;
+  stats.latency_mean_us = (uint32_t) (latency_sum_us / stats.events);
+  stats_seq++;
+}
+
+static void alarm_task () {
+  while (1) {
+    ads8689_alarm_event_t event;
+    if (!ads8689_alarm_wait(&event, portMAX_DELAY)) continue;
+
+    ads8689_config_t config;
+    ads8689_get_config(&config, NULL);
+    int64_t conversion = ads8689_sample_time(event.index);
+
+    uint8_t frame[STREAM_FRAME_HEADER_LEN + sizeof(stream_alarm_t)];
+    stream_alarm_t payload = {
+      .number = stats.events,
+      .flags = event.flags,
+      .previous = event.previous,
+      .sample = event.sample,
+      .detected = event.detected,
+      .latency_max_us = stats.latency_max_us,
+      .lost = ads8689_alarm_lost()
+    };
+    stream_frame_header_t header;
+    stream_frame_init_header(
+      &header, STREAM_FRAME_ALARM, 0, sequence++,
+      event.index, conversion, ads8689_config_timer_rate(config.sample_freq),
+      0, sizeof(payload)
+    );
+    /* Stamped last, the frame leaves right after */
+    payload.sent = esp_timer_get_time();
+    stream_frame_seal(&header, &payload);
+    memcpy(frame, &header, sizeof(header));
+    memcpy(&frame[sizeof(header)], &payload, sizeof(payload));
+    size_t clients = event_server_send(frame, sizeof(frame));
+    record(conversion, event.detected, payload.sent, clients);
+
+    ESP_LOGW(
+      TAG, "input alarm flags %u -> %u at sample %llu (%d), sent %lld us after conversion",
+      event.previous, event.flags, (unsigned long long) event.index, event.sample, (long long) (payload.sent - conversion)
+    );
+  }
+}
+
+bool alarm_events_start () {
+  if (ads8689_alarm_init(ALARM_EVENTS_QUEUE_LEN) != ESP_OK) return false;
+  xTaskCreatePinnedToCore(alarm_task, "Alarm events", 4 * 1024, NULL, ALARM_TASK_PRIORITY, NULL, ALARM_TASK_CORE);
+  return true;
+}
+
+void alarm_events_get_stats (alarm_events_stats_t *out) {
+  uint32_t seq;
+  do {
+    seq = stats_seq;
+    *out = stats;
+  } while ((seq & 1) || seq != stats_seq);
+}
@@ -0,0 +1,46 @@
+/**
+ * @file alarm_events.h
+ *
+ * @brief Sends the ADC input alarm events on the event port. A task above
+ * the stream tasks waits on the driver alarm queue and hands a
+ * STREAM_FRAME_ALARM frame to the event server as soon as an event comes,
+ * so the over-pressure notice does not wait for the samples to be sent.
+ *
+ * Latency is measured from the conversion time of the sample to the moment
+ * the frame is handed to the socket: at most one DMA block for the ISR to see
+ * the flags, then the task wake up and the send. It is kept per event in the
+ * frame and as a running max and mean here.
+ */
+#ifndef ALARM_EVENTS_H
+#define ALARM_EVENTS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Events waiting for the task, a burst of threshold crossings */
+#ifndef ALARM_EVENTS_QUEUE_LEN
+#define ALARM_EVENTS_QUEUE_LEN (16)
+#endif
+
+typedef struct alarm_events_stats_t {
+  uint32_t events;
+  /** Events the driver queue had no room for */
+  uint32_t lost;
+  /** Events no client was connected for */
+  uint32_t unsent;
+  /** Conversion to socket time, us */
+  uint32_t latency_max_us;
+  uint32_t latency_mean_us;
+  /** Conversion to detection by the stream ISR, us */
+  uint32_t detection_max_us;
+} alarm_events_stats_t;
+
+/**
+ * @brief Creates the driver alarm queue and starts the sending task, before
+ * acquisition_start() and after event_server_init()
+ */
+bool alarm_events_start ();
+
+void alarm_events_get_stats (alarm_events_stats_t *stats);
+
+#endif
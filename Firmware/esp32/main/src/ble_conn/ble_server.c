@@ -1,6 +1,7 @@
 
 #include "ble_conn/ble_server.h"
 #include "configuration.h"
+#include "acquisition.h"
 
 #include "esp_log.h"
 #include "esp_nimble_hci.h"
@@ -39,6 +40,8 @@ static const ble_uuid128_t nick_id = UUID128_INIT(0xBC, 0x8A, 0xBF, 0x45, 0xCA,
 static const ble_uuid128_t configuration_id = UUID128_INIT(0xBC, 0x8A, 0xBF, 0x45, 0xCA, 0x05, 0x50, 0xBA, 0x40, 0x42, 0xB0, 0x00, 0x20, 0x10, 0x64, 0xF3); // 0x1020
 // f3641021-00b0-4240-ba50-05ca45bf8abc
 static const ble_uuid128_t command_id = UUID128_INIT(0xBC, 0x8A, 0xBF, 0x45, 0xCA, 0x05, 0x50, 0xBA, 0x40, 0x42, 0xB0, 0x00, 0x21, 0x10, 0x64, 0xF3); // 0x1021
+// f3641030-00b0-4240-ba50-05ca45bf8abc
+static const ble_uuid128_t stats_id = UUID128_INIT(0xBC, 0x8A, 0xBF, 0x45, 0xCA, 0x05, 0x50, 0xBA, 0x40, 0x42, 0xB0, 0x00, 0x30, 0x10, 0x64, 0xF3); // 0x1030
 
 static uint16_t ip_handle = 0, net_status_handle = 0, conn_handle = 0, configuration_handle = 0, command_handle = 0;
 
@@ -85,7 +88,7 @@ static void notify_ack (bool ack) {
     .nwt = NULL,
   };
   size_t len = ble_command__get_packed_size(&cmd);
-  printf("ble_command size %d\n", len);
+  printf("ble_command size %zu\n", len);
   len = ble_command__pack(&cmd, payload);
 
   cmd.command = (ack)? BLE_COMMANDS__ACK : BLE_COMMANDS__NACK;
@@ -134,6 +137,72 @@ static int write_command_cb (uint16_t conn_handle, uint16_t attr_handle, struct
       notify_ack(true);
       break;
     }
+    case BLE_COMMANDS__SET_DECIMATION: {
+      printf("Set decimation: %zu stages\n", cmd->n_decimation);
+      configuration_set_decimation(cmd->n_decimation, cmd->decimation);
+      notify_ack(true);
+      break;
+    }
+    case BLE_COMMANDS__SET_COMPRESSION: {
+      printf("Set compression: %d\n", cmd->compression);
+      configuration_set_compression(cmd->compression);
+      notify_ack(true);
+      break;
+    }
+    case BLE_COMMANDS__SET_TRIGGER: {
+      printf("Set trigger: %s\n", cmd->trigger ? "on" : "off");
+      configuration_set_trigger(cmd->trigger);
+      notify_ack(true);
+      break;
+    }
+    case BLE_COMMANDS__SET_FEATURES: {
+      printf("Set features: %s\n", cmd->features ? "on" : "off");
+      configuration_set_features(cmd->features);
+      notify_ack(true);
+      break;
+    }
+    case BLE_COMMANDS__SET_UDP: {
+      printf("Set udp: %s\n", cmd->udp ? (cmd->udp->group ? cmd->udp->group : "unicast") : "off");
+      configuration_set_udp(cmd->udp);
+      notify_ack(true);
+      break;
+    }
+    case BLE_COMMANDS__SET_ADC: {
+      ads8689_config_t adc;
+      bool valid = configuration_adc_settings(cmd->adc, &adc);
+      printf("Set adc: %u Hz%s\n", adc.sample_freq, valid ? "" : ", out of range");
+      /* Saved only if valid, the stream restarts with them */
+      if (valid) {
+        configuration_set_adc(cmd->adc);
+        valid = acquisition_reconfigure(&adc);
+      }
+      notify_ack(valid);
+      break;
+    }
+    case BLE_COMMANDS__SET_CALIBRATION: {
+      calibration_config_t calibration;
+      bool valid = cmd->calibration == NULL || configuration_calibration_settings(cmd->calibration, &calibration);
+      printf("Set calibration: %s\n", cmd->calibration ? (valid ? "on" : "out of range") : "off");
+      if (valid) configuration_set_calibration(cmd->calibration);
+      notify_ack(valid);
+      break;
+    }
+    case BLE_COMMANDS__SET_BASELINE: {
+      baseline_config_t baseline;
+      bool valid = cmd->baseline == NULL || configuration_baseline_settings(cmd->baseline, &baseline);
+      printf("Set baseline: %s\n", cmd->baseline ? (valid ? "on" : "out of range") : "off");
+      if (valid) configuration_set_baseline(cmd->baseline);
+      notify_ack(valid);
+      break;
+    }
+    case BLE_COMMANDS__SET_ENCODER: {
+      ads8689_encoder_config_t encoder;
+      bool valid = cmd->encoder == NULL || configuration_encoder_settings(cmd->encoder, &encoder);
+      printf("Set encoder: %s\n", cmd->encoder ? (valid ? "on" : "out of range") : "off");
+      if (valid) configuration_set_encoder(cmd->encoder);
+      notify_ack(valid);
+      break;
+    }
     default: {
       notify_ack(false);
       break;
@@ -154,6 +223,13 @@ static int read_configuration_cb (uint16_t conn_handle, uint16_t attr_handle, st
   return ret;
 }
 
+/* Acquisition instrumentation, a stream_stats_t as in the stats frame */
+static int read_stats_cb (uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg) {
+  stream_stats_t stats;
+  acquisition_get_stats(&stats);
+  return os_mbuf_append(ctxt->om, (uint8_t*) &stats, sizeof(stats));
+}
+
 static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
   {
     .type = BLE_GATT_SVC_TYPE_PRIMARY,
@@ -186,6 +262,11 @@ static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
         .access_cb = write_command_cb,
         .flags = BLE_GATT_WRITE_PERM | BLE_GATT_CHR_F_INDICATE,
       },
+      {
+        .uuid = &stats_id.u,
+        .access_cb = read_stats_cb,
+        .flags = BLE_GATT_READ_PERM,
+      },
       { 0 }
     },
   },
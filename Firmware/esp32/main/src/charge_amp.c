@@ -0,0 +1,63 @@
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "charge_amp.h"
+
+static const char *TAG = "CHARGE AMP";
+
+static gpio_num_t reset_gpio = GPIO_NUM_NC;
+static uint32_t pulse_len_us = CHARGE_AMP_RESET_PULSE_US;
+static esp_timer_handle_t pulse_timer = NULL;
+/* Set from the scheduling until the line is high again */
+static volatile bool pulse_pending = false;
+static volatile bool line_low = false;
+static volatile uint32_t resets = 0;
+
+/* Same timer for both edges, the falling one arms the rising one */
+static void on_pulse_edge (void *arg) {
+  if (!line_low) {
+    gpio_set_level(reset_gpio, 0);
+    line_low = true;
+    esp_timer_start_once(pulse_timer, pulse_len_us);
+    return;
+  }
+  gpio_set_level(reset_gpio, 1);
+  line_low = false;
+  resets++;
+  pulse_pending = false;
+}
+
+bool charge_amp_init (gpio_num_t gpio, uint32_t pulse_us) {
+  if (gpio_set_direction(gpio, GPIO_MODE_OUTPUT) != ESP_OK) return false;
+  gpio_set_level(gpio, 1);
+  reset_gpio = gpio;
+  if (pulse_us > 0) pulse_len_us = pulse_us;
+  if (pulse_timer != NULL) return true;
+  esp_timer_create_args_t args = {
+    .callback = on_pulse_edge,
+    .arg = NULL,
+    .dispatch_method = ESP_TIMER_TASK,
+    .name = "charge amp reset"
+  };
+  if (esp_timer_create(&args, &pulse_timer) != ESP_OK) {
+    ESP_LOGE(TAG, "no timer for the reset pulses");
+    pulse_timer = NULL;
+    return false;
+  }
+  return true;
+}
+
+bool charge_amp_reset_at (int64_t time_us) {
+  if (pulse_timer == NULL || pulse_pending) return false;
+  int64_t delay = time_us - esp_timer_get_time();
+  pulse_pending = true;
+  if (esp_timer_start_once(pulse_timer, delay > 0 ? (uint64_t) delay : 0) != ESP_OK) {
+    pulse_pending = false;
+    return false;
+  }
+  return true;
+}
+
+uint32_t charge_amp_resets () {
+  return resets;
+}
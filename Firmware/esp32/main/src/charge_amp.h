@@ -0,0 +1,37 @@
+/**
+ * @file charge_amp.h
+ *
+ * @brief Reset line of the charge amplifier of the V2 board, GPIO 26, high in
+ * operation. A reset is a low pulse that brings the amplifier output back to
+ * its rest level, started by an esp_timer at a given esp_timer time so it
+ * lands in the quiet part of a cycle whatever the task that asked is doing.
+ */
+#ifndef CHARGE_AMP_H
+#define CHARGE_AMP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "driver/gpio.h"
+
+/* Low time of the reset pulse, us */
+#ifndef CHARGE_AMP_RESET_PULSE_US
+#define CHARGE_AMP_RESET_PULSE_US (1000)
+#endif
+
+/**
+ * @brief Drives the line high and creates the pulse timer
+ * @param pulse_us low time of a reset, 0 for CHARGE_AMP_RESET_PULSE_US
+ */
+bool charge_amp_init (gpio_num_t gpio, uint32_t pulse_us);
+
+/**
+ * @brief Schedules a reset pulse starting at time_us, at once if it is past
+ * @return false without charge_amp_init() or while a pulse is scheduled
+ */
+bool charge_amp_reset_at (int64_t time_us);
+
+/** @brief Pulses done since the start */
+uint32_t charge_amp_resets ();
+
+#endif
@@ -186,6 +186,216 @@ void configuration_set_nickname (char *nick) {
   configuration_save_to_flash(&global_config);
 }
 
+void configuration_set_decimation (size_t n_stages, DecimationStage **stages) {
+  for (int i = 0; i < global_config.n_decimation; i++) {
+    free(global_config.decimation[i]->taps);
+    free(global_config.decimation[i]);
+  }
+  free(global_config.decimation);
+  global_config.decimation = NULL;
+  global_config.n_decimation = 0;
+
+  if (n_stages > 0) {
+    global_config.decimation = (DecimationStage**) malloc(sizeof(DecimationStage*) * n_stages);
+    for (int i = 0; i < n_stages; i++) {
+      DecimationStage *stage = (DecimationStage*) malloc(sizeof(DecimationStage));
+      decimation_stage__init(stage);
+      stage->factor = stages[i]->factor;
+      stage->n_taps = stages[i]->n_taps;
+      if (stage->n_taps > 0) {
+        stage->taps = (int32_t*) malloc(sizeof(int32_t) * stage->n_taps);
+        memcpy(stage->taps, stages[i]->taps, sizeof(int32_t) * stage->n_taps);
+      }
+      global_config.decimation[i] = stage;
+    }
+    global_config.n_decimation = n_stages;
+  }
+  configuration_save_to_flash(&global_config);
+}
+
+void configuration_set_compression (bool enable) {
+  global_config.has_compression = true;
+  global_config.compression = enable;
+  configuration_save_to_flash(&global_config);
+}
+
+void configuration_set_trigger (TriggerConfig *trigger) {
+  free(global_config.trigger);
+  global_config.trigger = NULL;
+  if (trigger != NULL) {
+    TriggerConfig *new_trigger = (TriggerConfig*) malloc(sizeof(TriggerConfig));
+    *new_trigger = *trigger;
+    global_config.trigger = new_trigger;
+  }
+  configuration_save_to_flash(&global_config);
+}
+
+void configuration_set_features (FeatureConfig *features) {
+  free(global_config.features);
+  global_config.features = NULL;
+  if (features != NULL) {
+    FeatureConfig *new_features = (FeatureConfig*) malloc(sizeof(FeatureConfig));
+    *new_features = *features;
+    global_config.features = new_features;
+  }
+  configuration_save_to_flash(&global_config);
+}
+
+void configuration_set_udp (UdpConfig *udp) {
+  if (global_config.udp != NULL) free(global_config.udp->group);
+  free(global_config.udp);
+  global_config.udp = NULL;
+  if (udp != NULL) {
+    UdpConfig *new_udp = (UdpConfig*) malloc(sizeof(UdpConfig));
+    *new_udp = *udp;
+    if (udp->group != NULL) {
+      new_udp->group = (char*) malloc(strlen(udp->group) + 1);
+      strcpy(new_udp->group, udp->group);
+    }
+    global_config.udp = new_udp;
+  }
+  configuration_save_to_flash(&global_config);
+}
+
+void configuration_set_adc (AdcConfig *adc) {
+  free(global_config.adc);
+  global_config.adc = NULL;
+  if (adc != NULL) {
+    AdcConfig *new_adc = (AdcConfig*) malloc(sizeof(AdcConfig));
+    *new_adc = *adc;
+    global_config.adc = new_adc;
+  }
+  configuration_save_to_flash(&global_config);
+}
+
+bool configuration_adc_settings (const AdcConfig *conf_adc, ads8689_config_t *adc) {
+  *adc = (ads8689_config_t) ADS8689_DEFAULT_CONFIG();
+  if (conf_adc == NULL) return true;
+  if (conf_adc->alarmhigh > UINT16_MAX || conf_adc->alarmlow > UINT16_MAX || conf_adc->alarmhysteresis > UINT8_MAX) {
+    ESP_LOGE(TAG, "ADC alarm thresholds out of range");
+    return false;
+  }
+  ads8689_config_t conf = {
+    .sample_freq = conf_adc->samplerate,
+    .range = (ads8689_range_t) conf_adc->range,
+    .sdo_mode = conf_adc->sdodual ? ADS8689_SDO_DUAL : ADS8689_SDO_SINGLE,
+    .spi_clock = conf_adc->spiclock,
+    .alarm_high = conf_adc->alarmhigh,
+    .alarm_low = conf_adc->alarmlow,
+    .alarm_hysteresis = conf_adc->alarmhysteresis
+  };
+  if (ads8689_config_check(&conf) != ESP_OK) return false;
+  *adc = conf;
+  return true;
+}
+
+void configuration_set_calibration (CalibrationConfig *calibration) {
+  free(global_config.calibration);
+  global_config.calibration = NULL;
+  if (calibration != NULL) {
+    CalibrationConfig *new_calibration = (CalibrationConfig*) malloc(sizeof(CalibrationConfig));
+    *new_calibration = *calibration;
+    global_config.calibration = new_calibration;
+  }
+  configuration_save_to_flash(&global_config);
+}
+
+bool configuration_calibration_settings (const CalibrationConfig *conf_calibration, calibration_config_t *calibration) {
+  if (conf_calibration == NULL) return false;
+  if (conf_calibration->has_fracbits && (conf_calibration->fracbits > INT8_MAX || conf_calibration->fracbits <= CALIBRATION_AUTO_FRAC)) {
+    ESP_LOGE(TAG, "calibration fractional bits out of range");
+    return false;
+  }
+  *calibration = (calibration_config_t) {
+    .gain = conf_calibration->gain,
+    .offset = conf_calibration->offset,
+    .amp_range_pc = conf_calibration->amprange,
+    .amp_full_scale_v = conf_calibration->ampfullscale,
+    .sensitivity = conf_calibration->sensitivity,
+    .sensitivity_drift = conf_calibration->sensitivitydrift,
+    .zero_drift = conf_calibration->zerodrift,
+    .reference_temp = conf_calibration->referencetemp,
+    .temperature = conf_calibration->temperature,
+    .frac_bits = conf_calibration->has_fracbits ? conf_calibration->fracbits : CALIBRATION_AUTO_FRAC
+  };
+  return true;
+}
+
+void configuration_set_baseline (BaselineConfig *baseline) {
+  free(global_config.baseline);
+  global_config.baseline = NULL;
+  if (baseline != NULL) {
+    BaselineConfig *new_baseline = (BaselineConfig*) malloc(sizeof(BaselineConfig));
+    *new_baseline = *baseline;
+    global_config.baseline = new_baseline;
+  }
+  configuration_save_to_flash(&global_config);
+}
+
+bool configuration_baseline_settings (const BaselineConfig *conf_baseline, baseline_config_t *baseline) {
+  if (conf_baseline == NULL) return false;
+  if (conf_baseline->cyclelevel > INT16_MAX || conf_baseline->cyclelevel < INT16_MIN || conf_baseline->cyclehysteresis > INT16_MAX ||
+      conf_baseline->reference > INT16_MAX || conf_baseline->reference < INT16_MIN || conf_baseline->resetmargin > INT16_MAX) {
+    ESP_LOGE(TAG, "baseline levels out of range");
+    return false;
+  }
+  if (conf_baseline->cyclelen == 0 || (conf_baseline->window && conf_baseline->windowlen == 0) ||
+      !(conf_baseline->smoothing > 0 && conf_baseline->smoothing <= 1)) {
+    ESP_LOGE(TAG, "baseline cycle, window or smoothing invalid");
+    return false;
+  }
+  *baseline = (baseline_config_t) {
+    .peg = conf_baseline->window ? BASELINE_PEG_WINDOW : BASELINE_PEG_MINIMUM,
+    .cycle_len = conf_baseline->cyclelen,
+    .cycle_level = conf_baseline->cyclelevel,
+    .cycle_hysteresis = conf_baseline->cyclehysteresis,
+    .cycle_slope = conf_baseline->cyclerising ? TRIGGER_RISING : TRIGGER_FALLING,
+    .window_offset = conf_baseline->windowoffset,
+    .window_len = conf_baseline->windowlen,
+    .smoothing = conf_baseline->smoothing,
+    .reference = conf_baseline->reference,
+    .reset_margin = conf_baseline->resetmargin,
+    .reset_settle = conf_baseline->resetsettle
+  };
+  return true;
+}
+
+void configuration_set_encoder (EncoderConfig *encoder) {
+  free(global_config.encoder);
+  global_config.encoder = NULL;
+  if (encoder != NULL) {
+    EncoderConfig *new_encoder = (EncoderConfig*) malloc(sizeof(EncoderConfig));
+    *new_encoder = *encoder;
+    global_config.encoder = new_encoder;
+  }
+  configuration_save_to_flash(&global_config);
+}
+
+bool configuration_encoder_settings (const EncoderConfig *conf_encoder, ads8689_encoder_config_t *encoder) {
+  if (conf_encoder == NULL) return false;
+  *encoder = (ads8689_encoder_config_t) ADS8689_ENCODER_DEFAULT_CONFIG();
+  if (conf_encoder->has_encodergpio) encoder->encoder_gpio = (gpio_num_t) conf_encoder->encodergpio;
+  if (conf_encoder->has_tdcgpio) encoder->tdc_gpio = (gpio_num_t) conf_encoder->tdcgpio;
+  if (!GPIO_IS_VALID_GPIO(encoder->encoder_gpio) || !GPIO_IS_VALID_GPIO(encoder->tdc_gpio) || encoder->encoder_gpio == encoder->tdc_gpio) {
+    ESP_LOGE(TAG, "encoder inputs invalid");
+    return false;
+  }
+  if (conf_encoder->edgespersample == 0 || conf_encoder->edgespersample > INT16_MAX ||
+      conf_encoder->edgespercycle % conf_encoder->edgespersample != 0 || conf_encoder->maxrate == 0) {
+    ESP_LOGE(TAG, "encoder division or rate invalid");
+    return false;
+  }
+  encoder->edges_per_sample = (uint16_t) conf_encoder->edgespersample;
+  encoder->edges_per_cycle = conf_encoder->edgespercycle;
+  encoder->max_rate = conf_encoder->maxrate;
+  uint32_t cycle_len = ads8689_encoder_cycle_len(encoder);
+  if (cycle_len < 2 || cycle_len > UINT16_MAX) {
+    ESP_LOGE(TAG, "encoder cycle of %u conversions out of range", cycle_len);
+    return false;
+  }
+  return true;
+}
+
 void configuration_parse_protobuf (uint8_t *payload, size_t len) {
   Configuration *received_conf = configuration__unpack(NULL, len, payload);
   if (received_conf == NULL) {
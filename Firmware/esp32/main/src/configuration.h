@@ -3,6 +3,10 @@
 
 #include "esp_err.h"
 #include "configuration.pb-c.h"
+#include "ads8689_config.h"
+#include "calibration.h"
+#include "baseline.h"
+#include "ads8689_encoder.h"
 
 /**
  * @brief Mounts configuration flash partition and search for saved configuration.
@@ -47,4 +51,83 @@ void configuration_remove_wifi_network (char *ssid);
  */
 void configuration_set_nickname (char *nick);
 
+/**
+ * @brief set decimation stages applied before streaming, takes effect on the
+ * next acquisition start
+ */
+void configuration_set_decimation (size_t n_stages, DecimationStage **stages);
+
+/**
+ * @brief enable lossless compression of the sample stream, takes effect on the
+ * next acquisition start
+ */
+void configuration_set_compression (bool enable);
+
+/**
+ * @brief set the firmware trigger, NULL to stream continuously. Takes effect on
+ * the next acquisition start
+ */
+void configuration_set_trigger (TriggerConfig *trigger);
+
+/**
+ * @brief set the on device feature reports, NULL to turn them off. Takes effect
+ * on the next acquisition start
+ */
+void configuration_set_features (FeatureConfig *features);
+
+/**
+ * @brief set the datagram stream, NULL to turn it off. Takes effect on the next
+ * acquisition start
+ */
+void configuration_set_udp (UdpConfig *udp);
+
+/**
+ * @brief set the ADC settings, NULL for the defaults. Saved only, see
+ * acquisition_reconfigure() to apply them to a running stream
+ */
+void configuration_set_adc (AdcConfig *adc);
+
+/**
+ * @brief converts ADC settings, ADS8689_DEFAULT_CONFIG() for NULL
+ * @returns false if a setting is out of range, adc is then left to the defaults
+ */
+bool configuration_adc_settings (const AdcConfig *conf_adc, ads8689_config_t *adc);
+
+/**
+ * @brief set the calibration the samples are converted with, NULL to stream
+ * ADC codes. Takes effect on the next acquisition start
+ */
+void configuration_set_calibration (CalibrationConfig *calibration);
+
+/**
+ * @brief converts a calibration record
+ * @returns false for NULL or fractional bits out of range
+ */
+bool configuration_calibration_settings (const CalibrationConfig *conf_calibration, calibration_config_t *calibration);
+
+/**
+ * @brief set the drift correction of the charge amplifier, NULL to turn it
+ * off. Takes effect on the next acquisition start
+ */
+void configuration_set_baseline (BaselineConfig *baseline);
+
+/**
+ * @brief converts a baseline record
+ * @returns false for NULL, levels out of int16 or an empty cycle or window
+ */
+bool configuration_baseline_settings (const BaselineConfig *conf_baseline, baseline_config_t *baseline);
+
+/**
+ * @brief set the shaft encoder clocking the conversions, NULL for the
+ * conversion timer. Takes effect on the next acquisition start
+ */
+void configuration_set_encoder (EncoderConfig *encoder);
+
+/**
+ * @brief converts an encoder record, the rate is checked against the ADC
+ * settings by the acquisition
+ * @returns false for NULL, an edge count out of range or an input that is not a GPIO
+ */
+bool configuration_encoder_settings (const EncoderConfig *conf_encoder, ads8689_encoder_config_t *encoder);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,198 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "stream_frame.h"
+#include "sample_codec.h"
+#include "download_server.h"
+
+#include "recorder.h"
+
+static const char *TAG = "RECORDER";
+
+/* Smallest payload worth starting a frame in the rest of a sector, bytes */
+#define RECORD_MIN_PAYLOAD (256)
+
+_Static_assert(RECORDER_BLOCK_LEN <= SAMPLE_CODEC_MAX_SAMPLES, "recorder block longer than a compressed frame takes");
+
+typedef struct record_slot_t {
+  uint64_t first_sample;
+  int64_t timestamp;
+  float sample_rate;
+  uint32_t flags;
+  size_t len;
+  int16_t *samples;
+} record_slot_t;
+
+static record_slot_t slots[RECORDER_SLOTS];
+static QueueHandle_t free_slots, ready_slots;
+
+/* The writer appends and the download server reads the log, under the lock */
+static flash_log_t record_log;
+static SemaphoreHandle_t lock;
+static pipeline_stage_t writer_stage;
+static flash_log_cursor_t download_cursor;
+
+static uint32_t sequence = 0;
+static recorder_stats_t stats;
+
+/* Appends one frame per call, as many samples as the payload and the open sector take */
+static size_t record_frame (const record_slot_t *slot, size_t offset, uint32_t flags) {
+  static uint8_t frame[STREAM_FRAME_MAX_LEN];
+  stream_frame_header_t header;
+  uint8_t *payload = &frame[sizeof(header)];
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  size_t room = flash_log_room(&record_log, sizeof(header) + RECORD_MIN_PAYLOAD) - sizeof(header);
+  if (room > STREAM_FRAME_MAX_PAYLOAD) room = STREAM_FRAME_MAX_PAYLOAD;
+  size_t consumed;
+  size_t payload_len = sample_codec_encode(&slot->samples[offset], slot->len - offset, payload, room, &consumed);
+  stream_frame_init_header(
+    &header, STREAM_FRAME_SAMPLES_RICE, flags, sequence++,
+    slot->first_sample + offset, slot->timestamp + (int64_t) (offset * 1000000 / slot->sample_rate), slot->sample_rate,
+    consumed, payload_len
+  );
+  stream_frame_seal(&header, payload);
+  memcpy(frame, &header, sizeof(header));
+
+  int64_t start = esp_timer_get_time();
+  bool appended = flash_log_append(&record_log, frame, sizeof(header) + payload_len);
+  uint32_t duration = (uint32_t) (esp_timer_get_time() - start);
+  xSemaphoreGive(lock);
+
+  if (duration > stats.append_max_us) stats.append_max_us = duration;
+  if (!appended) {
+    stats.failed++;
+    return 0;
+  }
+  stats.frames++;
+  stats.bytes += sizeof(header) + payload_len;
+  return consumed;
+}
+
+static void writer_task () {
+  while (1) {
+    record_slot_t *slot;
+    if (xQueueReceive(ready_slots, &slot, portMAX_DELAY) != pdTRUE) continue;
+    size_t offset = 0;
+    uint32_t flags = slot->flags;
+    while (offset < slot->len) {
+      size_t n = record_frame(slot, offset, flags);
+      if (n == 0) {
+        ESP_LOGW(TAG, "flash append failed, %zu samples lost", slot->len - offset);
+        break;
+      }
+      offset += n;
+      flags = 0;
+    }
+    stats.recorded += offset;
+    xQueueSend(free_slots, &slot, 0);
+  }
+}
+
+/* Download source: whole frames from the oldest, a download takes the frames recorded meanwhile too */
+static void download_rewind (void *ctx) {
+  xSemaphoreTake(lock, portMAX_DELAY);
+  flash_log_rewind(&record_log, &download_cursor);
+  xSemaphoreGive(lock);
+}
+
+static size_t download_read (void *ctx, uint8_t *dst, size_t len) {
+  size_t n = 0;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  while (len - n >= STREAM_FRAME_MAX_LEN) {
+    size_t record_len = flash_log_read(&record_log, &download_cursor, &dst[n], len - n);
+    if (record_len == 0) break;
+    n += record_len;
+  }
+  xSemaphoreGive(lock);
+  return n;
+}
+
+bool recorder_start (const flash_log_flash_t *flash, const pipeline_stage_config_t *stage) {
+  static const pipeline_stage_config_t default_stage = RECORDER_DEFAULT_STAGE();
+  if (!flash_log_mount(&record_log, flash)) {
+    ESP_LOGE(TAG, "no log in a flash area of %zu bytes", flash->len);
+    return false;
+  }
+  free_slots = xQueueCreate(RECORDER_SLOTS, sizeof(record_slot_t*));
+  ready_slots = xQueueCreate(RECORDER_SLOTS, sizeof(record_slot_t*));
+  for (int i = 0; i < RECORDER_SLOTS; i++) {
+    slots[i].samples = (int16_t*) malloc(RECORDER_BLOCK_LEN * sizeof(int16_t));
+    if (slots[i].samples == NULL) {
+      ESP_LOGE(TAG, "no memory for the recorder slots");
+      return false;
+    }
+    record_slot_t *slot = &slots[i];
+    xQueueSend(free_slots, &slot, 0);
+  }
+  lock = xSemaphoreCreateMutex();
+
+  flash_log_stats_t log_stats;
+  flash_log_get_stats(&record_log, &log_stats);
+  ESP_LOGI(
+    TAG, "log of %u sectors, %u used, %u records, erases %u..%u",
+    log_stats.sectors, log_stats.used, log_stats.records, log_stats.erase_min, log_stats.erase_max
+  );
+  pipeline_stage_start(&writer_stage, stage != NULL ? stage : &default_stage, writer_task, NULL);
+
+  download_source_t source = {
+    .rewind = download_rewind,
+    .read = download_read,
+    .ctx = NULL
+  };
+  if (!download_server_init(&source)) ESP_LOGE(TAG, "recording cannot be downloaded");
+  return true;
+}
+
+size_t recorder_push (uint32_t flags, uint64_t first_sample, int64_t timestamp, float fs, const int16_t *samples, size_t len) {
+  record_slot_t *slot;
+  if (free_slots == NULL || len == 0) return 0;
+  if (xQueueReceive(free_slots, &slot, 0) != pdTRUE) {
+    stats.waits++;
+    return 0;
+  }
+  slot->first_sample = first_sample;
+  slot->timestamp = timestamp;
+  slot->sample_rate = fs;
+  slot->flags = flags;
+  slot->len = len < RECORDER_BLOCK_LEN ? len : RECORDER_BLOCK_LEN;
+  memcpy(slot->samples, samples, slot->len * sizeof(int16_t));
+  xQueueSend(ready_slots, &slot, 0);
+  stats.pushed += slot->len;
+  return slot->len;
+}
+
+bool recorder_idle () {
+  return free_slots == NULL || uxQueueMessagesWaiting(free_slots) == RECORDER_SLOTS;
+}
+
+bool recorder_clear () {
+  if (lock == NULL) return false;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool cleared = flash_log_clear(&record_log);
+  xSemaphoreGive(lock);
+  ESP_LOGI(TAG, "recording cleared");
+  return cleared;
+}
+
+void recorder_get_stage_stats (pipeline_stage_stats_t *out) {
+  if (writer_stage.n_tasks == 0) {
+    *out = (pipeline_stage_stats_t) {};
+    return;
+  }
+  pipeline_stage_get_stats(&writer_stage, out);
+}
+
+void recorder_get_stats (recorder_stats_t *out) {
+  if (lock != NULL) xSemaphoreTake(lock, portMAX_DELAY);
+  *out = stats;
+  flash_log_get_stats(&record_log, &out->log);
+  if (lock != NULL) xSemaphoreGive(lock);
+}
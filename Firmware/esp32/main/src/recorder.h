@@ -0,0 +1,88 @@
+/**
+ * @file recorder.h
+ *
+ * @brief Store and forward of the raw stream while no client is connected.
+ * The ring reader hands its blocks to the recorder instead of dropping them,
+ * a writer task below it compresses them into STREAM_FRAME_SAMPLES_RICE
+ * frames and appends each frame as a record of the flash log
+ * (flash_log.h). The blocks wait in a few RAM slots meanwhile, so a sector
+ * erase holds the writer and not the reader.
+ *
+ * The recording is downloaded from the download port (download_server.h),
+ * every frame from the oldest, with the stream position it was recorded
+ * with: the frames read exactly like the data port, gaps where the recorder
+ * fell behind carry the overrun flag. It stays in flash until the
+ * "record_clear" command, a full log overwrites its oldest sector.
+ */
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "flash_log.h"
+#include "pipeline_stage.h"
+
+/* Samples of a RAM slot, at most SAMPLE_CODEC_MAX_SAMPLES */
+#ifndef RECORDER_BLOCK_LEN
+#define RECORDER_BLOCK_LEN (2048)
+#endif
+/* RAM slots between the reader and the writer, the longest flash stall they
+ * absorb is RECORDER_SLOTS * RECORDER_BLOCK_LEN samples */
+#ifndef RECORDER_SLOTS
+#define RECORDER_SLOTS (8)
+#endif
+
+/* Record stage of the pipeline, the writer task, below the stream tasks so
+ * a flash stall only delays the writer */
+#define RECORDER_DEFAULT_STAGE() { \
+  .name = "Recorder", \
+  .core = 1, \
+  .priority = 5, \
+  .stack = 4096 \
+}
+
+typedef struct recorder_stats_t {
+  /** Samples handed to the recorder and written to flash */
+  uint64_t pushed;
+  uint64_t recorded;
+  uint32_t frames;
+  /** Frame bytes written, headers included */
+  uint64_t bytes;
+  /** Blocks refused because every RAM slot was waiting for the writer */
+  uint32_t waits;
+  /** Frames the flash log could not append */
+  uint32_t failed;
+  /** Longest append, a sector erase included, us */
+  uint32_t append_max_us;
+  flash_log_stats_t log;
+} recorder_stats_t;
+
+/**
+ * @brief Mounts the log on the flash area, starts the writer task and the
+ * download server. The flash_log_flash_t is copied
+ * @param stage core and priority of the writer, NULL for RECORDER_DEFAULT_STAGE()
+ * @returns false if no log fits in the area or there is no memory for the slots
+ */
+bool recorder_start (const flash_log_flash_t *flash, const pipeline_stage_config_t *stage);
+
+/**
+ * @brief Copies up to RECORDER_BLOCK_LEN samples into a free slot for the
+ * writer, never waits. timestamp is the time of the first sample
+ * @returns samples taken, 0 if every slot is taken
+ */
+size_t recorder_push (uint32_t flags, uint64_t first_sample, int64_t timestamp, float fs, const int16_t *samples, size_t len);
+
+/** @brief Samples pushed are all in flash */
+bool recorder_idle ();
+
+/** @brief Releases the recording, the next frames start a new one */
+bool recorder_clear ();
+
+void recorder_get_stats (recorder_stats_t *stats);
+
+/** @brief CPU load of the writer since the last call, zero before recorder_start(). Called from one task */
+void recorder_get_stage_stats (pipeline_stage_stats_t *stats);
+
+#endif
@@ -9,11 +9,13 @@ import pydbus
 import os
 
 import protobuf.configuration_pb2 as proto
+from tcpClient import DeviceStats
 
 IP_UUID = "f3641001-00b0-4240-ba50-05ca45bf8abc"
 STATUS_UUID = "f3641010-00b0-4240-ba50-05ca45bf8abc"
 CMD_UUID = "f3641021-00b0-4240-ba50-05ca45bf8abc"
 CONF_UUID = "f3641020-00b0-4240-ba50-05ca45bf8abc"
+STATS_UUID = "f3641030-00b0-4240-ba50-05ca45bf8abc"
 class BLEOperations(Enum):
   NOP = 0
   SCAN = 1
@@ -21,6 +23,7 @@ class BLEOperations(Enum):
   DISCONNECT = 3
   READ_CONF = 4
   SEND_COMMAND = 5
+  READ_STATS = 6
 
 def disconnectConnectedDevices():
   if os.name == 'posix':
@@ -44,6 +47,7 @@ class BLECLient(QThread):
   bleDisconnectedSignal = pyqtSignal()
   bleConfigUpdatedSignal = pyqtSignal()
   bleFailedSignal = pyqtSignal()
+  bleStatsSignal = pyqtSignal(object)
 
   def __init__(self):
     super(BLECLient, self).__init__()
@@ -145,6 +149,15 @@ class BLECLient(QThread):
           self.deviceConfiguration.ParseFromString(rawConf)
           self.bleConfigUpdatedSignal.emit()
 
+        case BLEOperations.READ_STATS:
+          self.resetOperation()
+          try:
+            rawStats = await self.client.read_gatt_char(STATS_UUID)
+          except Exception as e:
+            self.handleBleException(e)
+            continue
+          self.bleStatsSignal.emit(DeviceStats(bytes(rawStats)))
+
         
 
   def scanDevices(self):
@@ -187,6 +200,155 @@ class BLECLient(QThread):
     if (self.deviceConnected):
       self.op = BLEOperations.SEND_COMMAND
   
+  def setDecimation(self, factors, taps=None):
+    """ Decimation stages applied on the sensor, effective after a restart.
+    taps: optional list of Q15 tap lists, one per stage """
+    cmd = proto.bleCommand()
+    cmd.command = proto.SET_DECIMATION
+    for i, factor in enumerate(factors):
+      stage = cmd.decimation.add()
+      stage.factor = factor
+      if taps is not None:
+        stage.taps.extend(taps[i])
+    self.commandData = bytearray(cmd.SerializeToString())
+    if (self.deviceConnected):
+      self.op = BLEOperations.SEND_COMMAND
+
+  def setCompression(self, enable):
+    """ Lossless compression of the sample stream, effective after a restart """
+    cmd = proto.bleCommand()
+    cmd.command = proto.SET_COMPRESSION
+    cmd.compression = enable
+    self.commandData = bytearray(cmd.SerializeToString())
+    if (self.deviceConnected):
+      self.op = BLEOperations.SEND_COMMAND
+
+  def setTrigger(self, level, postTrigger, hysteresis=0, rising=False, preTrigger=0, holdoff=0):
+    """ Sensor side trigger, only the windows around each crossing are sent.
+    level and hysteresis in ADC counts, windows in output samples, effective after a restart.
+    postTrigger = 0 goes back to the continuous stream """
+    cmd = proto.bleCommand()
+    cmd.command = proto.SET_TRIGGER
+    cmd.trigger.level = level
+    cmd.trigger.hysteresis = hysteresis
+    cmd.trigger.rising = rising
+    cmd.trigger.preTrigger = preTrigger
+    cmd.trigger.postTrigger = postTrigger
+    cmd.trigger.holdoff = holdoff
+    self.commandData = bytearray(cmd.SerializeToString())
+    if (self.deviceConnected):
+      self.op = BLEOperations.SEND_COMMAND
+
+  def setFeatures(self, fftLen, windows=1, only=False):
+    """ Feature reports (min, max, RMS, dominant frequency) every fftLen * windows samples,
+    only turns the sample stream off. fftLen = 0 turns the reports off, effective after a restart """
+    cmd = proto.bleCommand()
+    cmd.command = proto.SET_FEATURES
+    if fftLen > 0:
+      cmd.features.fftLen = fftLen
+      cmd.features.windows = windows
+      cmd.features.only = only
+    self.commandData = bytearray(cmd.SerializeToString())
+    if (self.deviceConnected):
+      self.op = BLEOperations.SEND_COMMAND
+
+  def setUdp(self, enabled, group=None, port=0, ttl=0):
+    """ Datagram stream to a multicast group, or to the viewers subscribing when group is None.
+    port = 0 for 3334, effective after a restart """
+    cmd = proto.bleCommand()
+    cmd.command = proto.SET_UDP
+    if enabled:
+      if group != None:
+        cmd.udp.group = group
+      cmd.udp.port = port
+      cmd.udp.ttl = ttl
+    self.commandData = bytearray(cmd.SerializeToString())
+    if (self.deviceConnected):
+      self.op = BLEOperations.SEND_COMMAND
+
+  def setAdc(self, sampleRate=100000, range=3, sdoDual=False, spiClock=20000000, alarmHigh=65535, alarmLow=0, alarmHysteresis=0):
+    """ ADS8689 settings, applied at once: the stream restarts from sample 0 at the new rate.
+    range is the RANGE_SEL code, 3 for +-1.25 Vref. Refused (NACK) when the conversion
+    frame does not fit the rate at this SPI clock """
+    cmd = proto.bleCommand()
+    cmd.command = proto.SET_ADC
+    cmd.adc.sampleRate = sampleRate
+    cmd.adc.range = range
+    cmd.adc.sdoDual = sdoDual
+    cmd.adc.spiClock = spiClock
+    cmd.adc.alarmHigh = alarmHigh
+    cmd.adc.alarmLow = alarmLow
+    cmd.adc.alarmHysteresis = alarmHysteresis
+    self.commandData = bytearray(cmd.SerializeToString())
+    if (self.deviceConnected):
+      self.op = BLEOperations.SEND_COMMAND
+
+  def setCalibration(self, sensitivity, ampRange, ampFullScale=10, gain=1, offset=0,
+                     sensitivityDrift=0, zeroDrift=0, referenceTemp=25, temperature=25, fracBits=None):
+    """ Sensor calibration the sensor converts the samples to pressure with (pC/bar, pC for
+    ampFullScale volts, ppm/°C, bar/°C). sensitivity = 0 streams ADC codes, effective after a restart """
+    cmd = proto.bleCommand()
+    cmd.command = proto.SET_CALIBRATION
+    if sensitivity != 0:
+      cmd.calibration.sensitivity = sensitivity
+      cmd.calibration.ampRange = ampRange
+      cmd.calibration.ampFullScale = ampFullScale
+      cmd.calibration.gain = gain
+      cmd.calibration.offset = offset
+      cmd.calibration.sensitivityDrift = sensitivityDrift
+      cmd.calibration.zeroDrift = zeroDrift
+      cmd.calibration.referenceTemp = referenceTemp
+      cmd.calibration.temperature = temperature
+      if fracBits != None:
+        cmd.calibration.fracBits = fracBits
+    self.commandData = bytearray(cmd.SerializeToString())
+    if (self.deviceConnected):
+      self.op = BLEOperations.SEND_COMMAND
+
+  def setBaseline(self, cycleLen, window=False, cycleLevel=0, cycleHysteresis=0, cycleRising=True,
+                  windowOffset=0, windowLen=0, smoothing=0.2, reference=0, resetMargin=0, resetSettle=0, resetPulse=None):
+    """ Charge amplifier drift correction, pegged once per cycle of cycleLen samples on the
+    lowest sample or with window on the mean of windowLen samples windowOffset after each
+    crossing of cycleLevel. The amplifier is reset once the cycle extremes come within
+    resetMargin codes of the range limits. cycleLen = 0 turns it off, effective after a restart """
+    cmd = proto.bleCommand()
+    cmd.command = proto.SET_BASELINE
+    if cycleLen != 0:
+      cmd.baseline.cycleLen = cycleLen
+      cmd.baseline.window = window
+      cmd.baseline.cycleLevel = cycleLevel
+      cmd.baseline.cycleHysteresis = cycleHysteresis
+      cmd.baseline.cycleRising = cycleRising
+      cmd.baseline.windowOffset = windowOffset
+      cmd.baseline.windowLen = windowLen
+      cmd.baseline.smoothing = smoothing
+      cmd.baseline.reference = reference
+      cmd.baseline.resetMargin = resetMargin
+      cmd.baseline.resetSettle = resetSettle
+      if resetPulse != None:
+        cmd.baseline.resetPulse = resetPulse
+    self.commandData = bytearray(cmd.SerializeToString())
+    if (self.deviceConnected):
+      self.op = BLEOperations.SEND_COMMAND
+
+  def setEncoder(self, edgesPerCycle, edgesPerSample=1, maxRate=100000, encoderGpio=None, tdcGpio=None):
+    """ Conversions clocked by a shaft encoder, one every edgesPerSample edges, with a TDC
+    pulse every edgesPerCycle edges. The raw stream frames then carry the cycle and angle
+    of their samples. edgesPerCycle = 0 goes back to the timer, effective after a restart """
+    cmd = proto.bleCommand()
+    cmd.command = proto.SET_ENCODER
+    if edgesPerCycle != 0:
+      cmd.encoder.edgesPerCycle = edgesPerCycle
+      cmd.encoder.edgesPerSample = edgesPerSample
+      cmd.encoder.maxRate = maxRate
+      if encoderGpio != None:
+        cmd.encoder.encoderGpio = encoderGpio
+      if tdcGpio != None:
+        cmd.encoder.tdcGpio = tdcGpio
+    self.commandData = bytearray(cmd.SerializeToString())
+    if (self.deviceConnected):
+      self.op = BLEOperations.SEND_COMMAND
+
   def resetSensor(self):
     cmd = proto.bleCommand()
     cmd.command = proto.RESTART
@@ -197,6 +359,11 @@ class BLECLient(QThread):
   def readConfiguration(self):
     self.op = BLEOperations.READ_CONF
 
+  def readStats(self):
+    """ Acquisition driver stats, emitted as a DeviceStats by bleStatsSignal """
+    if (self.deviceConnected):
+      self.op = BLEOperations.READ_STATS
+
 
   def run(self):
     asyncio.run(self.__asyncThread())
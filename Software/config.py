@@ -5,10 +5,17 @@ from PyQt5.QtWidgets import \
   QApplication, QGridLayout, QVBoxLayout, QHBoxLayout, \
   QPushButton, QListWidgetItem, QWidget, \
   QMessageBox, QTableWidget, QCheckBox, \
-  QDoubleSpinBox, QLineEdit, QLabel, QTabWidget, QScrollArea
+  QDoubleSpinBox, QLineEdit, QLabel, QTabWidget, QScrollArea, QComboBox
 
 from bleManager import BLECLient
 
+""" Output rates and the decimation stages that produce them from 100 kS/s """
+OUTPUT_RATES = [
+  ('100 kS/s', []),
+  ('10 kS/s', [10]),
+  ('1 kS/s', [10, 10]),
+]
+
 def clearLayoutWidgets(layout):
   while layout.count():
     child = layout.takeAt(0)
@@ -101,6 +108,25 @@ class ConfigTab(QWidget):
     self.btAddNet.clicked.connect(self.addWifi)
     self.grid.addWidget(self.btAddNet, 5, 6, 1, 1)
 
+    """ Output rate """
+
+    self.grid.addWidget(QLabel("Output Rate"), 6, 2, 1, 1)
+    self.rateBox = QComboBox()
+    self.rateBox.addItems([r[0] for r in OUTPUT_RATES])
+    self.rateBox.setDisabled(True)
+    self.compressionBox.setDisabled(True)
+    self.grid.addWidget(self.rateBox, 6, 3, 1, 1)
+
+    self.btSetRate = QPushButton("Set")
+    self.btSetRate.setDefault(True)
+    self.btSetRate.clicked.connect(self.setOutputRate)
+    self.grid.addWidget(self.btSetRate, 6, 4, 1, 1)
+
+    self.compressionBox = QCheckBox("Compression")
+    self.compressionBox.setDisabled(True)
+    self.compressionBox.clicked.connect(self.setCompression)
+    self.grid.addWidget(self.compressionBox, 6, 5, 1, 1)
+
     self.bleClient = BLECLient()
     self.bleClient.scanDoneSignal.connect(self.updateDeviceList)
     self.bleClient.bleConnectedSignal.connect(self.onBleConnect)
@@ -139,8 +165,19 @@ class ConfigTab(QWidget):
   def setSensorNickname(self):
     self.bleClient.setNickname(self.nickText.text())
 
+  def setOutputRate(self):
+    self.bleClient.setDecimation(OUTPUT_RATES[self.rateBox.currentIndex()][1])
+
+  def setCompression(self):
+    self.bleClient.setCompression(self.compressionBox.isChecked())
+
   def onConfigUpdate(self):
     self.nickText.setText(self.bleClient.deviceConfiguration.nickName)
+    self.compressionBox.setChecked(self.bleClient.deviceConfiguration.compression)
+    factors = [s.factor for s in self.bleClient.deviceConfiguration.decimation]
+    for i, r in enumerate(OUTPUT_RATES):
+      if r[1] == factors:
+        self.rateBox.setCurrentIndex(i)
     self.updateNetsList()
 
   def updateNetsList(self):
@@ -171,6 +208,8 @@ class ConfigTab(QWidget):
     self.pwdText.setDisabled(False)
     self.btReset.setDisabled(False)
     self.nickText.setDisabled(False)
+    self.rateBox.setDisabled(False)
+    self.compressionBox.setDisabled(False)
 
     print(status)
     self.bleClient.readConfiguration()
@@ -180,6 +219,7 @@ class ConfigTab(QWidget):
     self.ssidText.setDisabled(True)
     self.pwdText.setDisabled(True)
     self.nickText.setDisabled(True)
+    self.rateBox.setDisabled(True)
 
     self.btScan.setText('Scan Devices')
     self.statusLabel.setText("BLE: Disconnected")
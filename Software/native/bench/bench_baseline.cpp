@@ -0,0 +1,193 @@
+/**
+ * @file bench_baseline.cpp
+ *
+ * @brief Throughput and tracking error of the firmware baseline estimator on a
+ * simulated pressure trace with charge amplifier drift: a steady ramp plus a
+ * random walk, large enough to take the peaks out of the ADC range in a few
+ * seconds. Amplifier resets are simulated the way acquisition.c schedules
+ * them, a lead of a few ms after the estimator asks, in the quiet part of the
+ * cycle, and the drift starts again from zero there. Both peg modes run on the
+ * same trace. The error is the corrected sample against the drift free trace,
+ * outside the settling time of the resets.
+ *
+ * usage: bench_baseline [drift codes/s] [random walk codes/s^0.5]
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "baseline.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+static const size_t TRACE_LEN = 1 << 23;
+static const double FS = 100000;
+static const double CYCLE_HZ = 50;
+static const uint32_t CYCLE_LEN = (uint32_t) (FS / CYCLE_HZ);
+/* Samples fed at once, a stage block of the firmware */
+static const size_t BLOCK_LEN = 2048;
+/* Delay between the estimator asking and the earliest reset, the stage queue */
+static const uint64_t RESET_LEAD = 800;
+static const uint32_t RESET_SETTLE = 200;
+static const uint16_t RESET_MARGIN = 2000;
+static const double MAX_RMS_ERROR = 60;
+
+/* Same pressure cycle as bench_trigger, lowest at the cycle boundary */
+static std::vector<int16_t> pressure_trace (double noise_codes) {
+  std::mt19937 rng(1);
+  std::normal_distribution<double> noise(0, noise_codes);
+  std::vector<int16_t> x(TRACE_LEN);
+  for (size_t i = 0; i < TRACE_LEN; i++) {
+    double phase = std::fmod(i * CYCLE_HZ / FS, 1.0) * 2 - 1;
+    double compression = 8000 / (1.2 - 0.8 * std::cos(M_PI * phase));
+    double combustion = 12000 * std::exp(-std::pow((phase - 0.05) / 0.06, 2));
+    x[i] = (int16_t) std::lrint(-12000 + compression + combustion + noise(rng));
+  }
+  return x;
+}
+
+static double seconds_since (bench_clock::time_point t0) {
+  return std::chrono::duration<double>(bench_clock::now() - t0).count();
+}
+
+typedef struct run_result_t {
+  double seconds;
+  double rms_error;
+  double max_error;
+  size_t clipped;
+  uint32_t pegs;
+  uint32_t resets;
+} run_result_t;
+
+/**
+ * Feeds the drifting trace block by block. The drift of each sample comes
+ * from the ramp and walk since the last reset, so it depends on when the
+ * estimator asked for one
+ */
+static run_result_t run (const baseline_config_t &config, const std::vector<int16_t> &clean, double ramp, double walk, double true_floor) {
+  baseline_t b;
+  run_result_t result = {};
+  if (!baseline_init(&b, &config)) {
+    std::fprintf(stderr, "Invalid baseline configuration\n");
+    std::exit(1);
+  }
+  std::mt19937 rng(2);
+  std::normal_distribution<double> step(0, walk / std::sqrt(FS));
+  std::vector<int16_t> raw(BLOCK_LEN), out(BLOCK_LEN);
+  double drift = 0;
+  uint64_t reset_at = UINT64_MAX;
+  uint64_t settle_end = 0;
+  double sum_sq = 0;
+  size_t counted = 0;
+
+  for (size_t first = 0; first < TRACE_LEN; first += BLOCK_LEN) {
+    size_t len = std::min(BLOCK_LEN, TRACE_LEN - first);
+    for (size_t i = 0; i < len; i++) {
+      uint64_t n = first + i;
+      if (n == reset_at) {
+        drift = 0;
+        settle_end = n + RESET_SETTLE;
+        reset_at = UINT64_MAX;
+      }
+      drift += ramp / FS + step(rng);
+      double v = clean[n] + drift;
+      if (v >= INT16_MAX || v <= INT16_MIN) result.clipped++;
+      raw[i] = (int16_t) std::lrint(std::fmax(INT16_MIN, std::fmin(INT16_MAX, v)));
+    }
+
+    /* In place, as the process stage corrects the stage blocks */
+    std::copy(raw.begin(), raw.begin() + len, out.begin());
+    auto t0 = bench_clock::now();
+    baseline_process(&b, out.data(), out.data(), len);
+    result.seconds += seconds_since(t0);
+
+    /* What the firmware does after each stage block */
+    if (baseline_reset_due(&b)) {
+      reset_at = baseline_next_quiet(&b, first + len + RESET_LEAD);
+      baseline_amp_reset(&b, reset_at);
+    }
+
+    /* Settled once the first cycles are pegged */
+    for (size_t i = 0; i < len; i++) {
+      uint64_t n = first + i;
+      if (n < 3 * CYCLE_LEN || n < settle_end || raw[i] == INT16_MAX || raw[i] == INT16_MIN) continue;
+      double expected = clean[n] - true_floor + config.reference;
+      double e = out[i] - expected;
+      sum_sq += e * e;
+      result.max_error = std::fmax(result.max_error, std::fabs(e));
+      counted++;
+    }
+  }
+  result.rms_error = counted > 0 ? std::sqrt(sum_sq / counted) : 0;
+  result.pegs = b.pegs;
+  result.resets = b.resets;
+  return result;
+}
+
+static void print_result (const char *name, const run_result_t &r) {
+  std::printf(
+    "  %-8s %8.1f MS/s %9.0f cycles/s\tpegs %u\tresets %u\tclipped %zu\terror rms %.1f max %.0f codes\n",
+    name, TRACE_LEN / r.seconds / 1e6, TRACE_LEN / r.seconds / CYCLE_LEN, r.pegs, r.resets, r.clipped, r.rms_error, r.max_error
+  );
+}
+
+int main (int argc, char **argv) {
+  double ramp = argc > 1 ? std::atof(argv[1]) : 4000;
+  double walk = argc > 2 ? std::atof(argv[2]) : 200;
+  std::vector<int16_t> clean = pressure_trace(20);
+
+  /* The minimum peg sits on the lowest sample, noise included */
+  int16_t lowest = INT16_MAX, highest = INT16_MIN;
+  for (size_t i = 0; i < CYCLE_LEN; i++) {
+    lowest = std::min(lowest, clean[i]);
+    highest = std::max(highest, clean[i]);
+  }
+
+  /* Without correction or resets the ramp alone takes the peaks, or the
+   * floor, out of the range */
+  double clip_s = ramp > 0 ? (INT16_MAX - highest) / ramp : (INT16_MIN - lowest) / ramp;
+  size_t uncorrected_clipped = 0;
+  for (size_t i = 0; i < TRACE_LEN; i++) {
+    double v = clean[i] + ramp * i / FS;
+    uncorrected_clipped += v >= INT16_MAX || v <= INT16_MIN;
+  }
+
+  std::printf(
+    "%zu samples, %u per cycle, drift %.0f codes/s + walk %.0f codes/s^0.5, "
+    "uncorrected peaks clip after %.1f s (%zu samples without resets)\n",
+    TRACE_LEN, CYCLE_LEN, ramp, walk, clip_s, uncorrected_clipped
+  );
+
+  baseline_config_t minimum = BASELINE_DEFAULT_CONFIG();
+  minimum.cycle_len = CYCLE_LEN;
+  minimum.reference = -8000;
+  minimum.reset_margin = RESET_MARGIN;
+  minimum.reset_settle = RESET_SETTLE;
+  run_result_t m = run(minimum, clean, ramp, walk, lowest);
+
+  /* Window of 5% of the cycle around the lowest pressure, after a rising
+   * crossing of the compression stroke. The reference keeps the corrected
+   * trace where the drift free one is, so the crossing is found on it */
+  baseline_config_t window = minimum;
+  window.peg = BASELINE_PEG_WINDOW;
+  window.cycle_level = 0;
+  window.cycle_hysteresis = 500;
+  window.cycle_slope = TRIGGER_RISING;
+  window.cycle_len = CYCLE_LEN * 3 / 4;
+  size_t crossing = 0;
+  while (crossing < CYCLE_LEN && clean[crossing] <= window.cycle_level + window.cycle_hysteresis) crossing++;
+  window.window_len = CYCLE_LEN / 20;
+  window.window_offset = (uint32_t) (CYCLE_LEN - crossing - window.window_len / 2);
+  double window_floor = 0;
+  for (size_t i = 0; i < window.window_len; i++) window_floor += clean[crossing + window.window_offset + i];
+  run_result_t w = run(window, clean, ramp, walk, window_floor / window.window_len);
+
+  print_result("minimum", m);
+  print_result("window", w);
+  bool ok = m.rms_error <= MAX_RMS_ERROR && w.rms_error <= MAX_RMS_ERROR && m.resets > 0 && w.resets > 0;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,84 @@
+/**
+ * @file bench_calibration.cpp
+ *
+ * @brief Throughput of the firmware calibration kernel next to the per sample
+ * float64 conversion realTime.py did on the host, and the error of its fixed
+ * point output against the float model, in output steps. The output is
+ * rounded, so the error stays within half a step plus the float rounding of
+ * the model.
+ *
+ * usage: bench_calibration [sensitivity pC/bar] [amplifier range pC]
+ */
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "calibration.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+static const size_t TRACE_LEN = 1 << 23;
+static const int ROUNDS = 8;
+static const double MAX_ERROR = 0.51;
+/* Input step of the +-1.25 Vref range, ads8689_config_lsb_volts() */
+static const float LSB_VOLTS = 2.5f * 4.096f / 65536;
+
+static double seconds_since (bench_clock::time_point t0) {
+  return std::chrono::duration<double>(bench_clock::now() - t0).count();
+}
+
+int main (int argc, char **argv) {
+  calibration_config_t config = CALIBRATION_DEFAULT_CONFIG();
+  config.sensitivity = argc > 1 ? std::atof(argv[1]) : 20;
+  config.amp_range_pc = argc > 2 ? std::atof(argv[2]) : 1000;
+  config.offset = 37;
+  config.sensitivity_drift = -200;
+  config.zero_drift = 0.002f;
+  config.temperature = 180;
+  calibration_t cal;
+  if (!calibration_init(&cal, &config, LSB_VOLTS)) {
+    std::fprintf(stderr, "Invalid calibration\n");
+    return 1;
+  }
+
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int> code(INT16_MIN, INT16_MAX);
+  std::vector<int16_t> x(TRACE_LEN), q(TRACE_LEN);
+  std::vector<double> bar(TRACE_LEN);
+  for (auto &v : x) v = (int16_t) code(rng);
+
+  /* What every client did: codes times a constant in float64 */
+  auto t0 = bench_clock::now();
+  for (int r = 0; r < ROUNDS; r++) {
+    for (size_t i = 0; i < TRACE_LEN; i++) bar[i] = cal.scale * (double) x[i] + cal.zero;
+  }
+  double float_s = seconds_since(t0) / ROUNDS;
+
+  t0 = bench_clock::now();
+  for (int r = 0; r < ROUNDS; r++) calibration_apply(&cal, x.data(), q.data(), TRACE_LEN);
+  double kernel_s = seconds_since(t0) / ROUNDS;
+
+  double step = std::ldexp(1.0, -cal.frac_bits);
+  double max_error = 0;
+  size_t saturated = 0;
+  for (size_t i = 0; i < TRACE_LEN; i++) {
+    double expected = bar[i] / step;
+    if (expected >= INT16_MAX || expected <= INT16_MIN) {
+      saturated++;
+      continue;
+    }
+    max_error = std::fmax(max_error, std::fabs(q[i] - expected));
+  }
+
+  std::printf(
+    "calibration %08x: %.4g bar/code, bar = value * 2^-%d, mult %d add %lld shift %u\n",
+    cal.hash, cal.scale, cal.frac_bits, cal.mult, (long long) cal.add, cal.shift
+  );
+  std::printf("%zu samples\n", x.size());
+  std::printf("  float64 convert   %8.1f MS/s\n", x.size() / float_s / 1e6);
+  std::printf("  calibration_apply %8.1f MS/s\tmax error %.3f steps, %zu saturated\n", x.size() / kernel_s / 1e6, max_error, saturated);
+  return max_error <= MAX_ERROR ? 0 : 1;
+}
@@ -0,0 +1,156 @@
+/**
+ * @file bench_codec.cpp
+ *
+ * @brief Compression ratio and speed of the sample codec. Traces are split in
+ * frames the way the firmware sends them, each frame filled up to one segment.
+ * Reports the payload ratio, the on air ratio counting frame headers, encode
+ * time and cycles per sample (x86 TSC) and decode throughput, and checks the
+ * round trip is lossless.
+ *
+ * usage: bench_codec [recorded.raw ...]
+ * Recorded traces are raw little endian int16, as written by pas_receive -o.
+ */
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC (1)
+#endif
+
+#include "stream_frame.h"
+#include "pas/sample_codec.hpp"
+
+using bench_clock = std::chrono::steady_clock;
+
+static const size_t TRACE_LEN = 1 << 21;
+static const double FS = 100000;
+
+struct Trace {
+  std::string name;
+  std::vector<int16_t> samples;
+};
+
+static int16_t clamp16 (double v) {
+  if (v > INT16_MAX) return INT16_MAX;
+  if (v < INT16_MIN) return INT16_MIN;
+  return (int16_t) std::lrint(v);
+}
+
+static std::vector<Trace> synthetic_traces () {
+  std::mt19937 rng(1);
+  std::normal_distribution<double> noise(0, 2);
+  std::uniform_int_distribution<int> full_scale(INT16_MIN, INT16_MAX);
+  std::vector<Trace> traces(4);
+
+  /* Cylinder pressure like: 50 Hz cycles, compression ramp and a combustion peak */
+  traces[0].name = "pressure (50 Hz cycle, 2 LSB noise)";
+  traces[1].name = "sine 1 kHz full scale, 2 LSB noise";
+  traces[2].name = "gaussian noise, 1000 LSB";
+  traces[3].name = "uniform full scale noise";
+  std::normal_distribution<double> wide(0, 1000);
+  for (size_t i = 0; i < TRACE_LEN; i++) {
+    double phase = std::fmod(i * 50 / FS, 1.0) * 2 - 1;
+    double compression = 8000 / (1.2 - 0.8 * std::cos(M_PI * phase));
+    double combustion = 12000 * std::exp(-std::pow((phase - 0.05) / 0.06, 2));
+    traces[0].samples.push_back(clamp16(-12000 + compression + combustion + noise(rng)));
+    traces[1].samples.push_back(clamp16(32000 * std::sin(2 * M_PI * 1000 * i / FS) + noise(rng)));
+    traces[2].samples.push_back(clamp16(wide(rng)));
+    traces[3].samples.push_back((int16_t) full_scale(rng));
+  }
+  return traces;
+}
+
+static bool load_trace (const char *path, Trace &trace) {
+  FILE *f = std::fopen(path, "rb");
+  if (f == nullptr) return false;
+  int16_t block[4096];
+  size_t len;
+  while ((len = std::fread(block, sizeof(int16_t), 4096, f)) > 0) {
+    trace.samples.insert(trace.samples.end(), block, block + len);
+  }
+  std::fclose(f);
+  trace.name = path;
+  return !trace.samples.empty();
+}
+
+struct EncodedFrame {
+  size_t first;
+  size_t count;
+  std::vector<uint8_t> payload;
+};
+
+static void run (const Trace &trace) {
+  const std::vector<int16_t> &x = trace.samples;
+  std::vector<EncodedFrame> frames;
+  frames.reserve(x.size() / STREAM_FRAME_MAX_SAMPLES + 1);
+  uint8_t payload[STREAM_FRAME_MAX_PAYLOAD];
+
+  /* Same input chunks as the firmware, as much as a frame can hold */
+  auto t0 = bench_clock::now();
+#ifdef HAVE_TSC
+  uint64_t c0 = __rdtsc();
+#endif
+  size_t pos = 0;
+  while (pos < x.size()) {
+    size_t consumed;
+    size_t len = sample_codec_encode(&x[pos], x.size() - pos, payload, sizeof(payload), &consumed);
+    frames.push_back({pos, consumed, std::vector<uint8_t>(payload, payload + len)});
+    pos += consumed;
+  }
+#ifdef HAVE_TSC
+  uint64_t cycles = __rdtsc() - c0;
+#endif
+  double encode_s = std::chrono::duration<double>(bench_clock::now() - t0).count();
+
+  size_t payload_bytes = 0;
+  for (const EncodedFrame &f : frames) payload_bytes += f.payload.size();
+  size_t raw_frames = (x.size() + STREAM_FRAME_MAX_SAMPLES - 1) / STREAM_FRAME_MAX_SAMPLES;
+  double raw_air = x.size() * sizeof(int16_t) + raw_frames * STREAM_FRAME_HEADER_LEN;
+  double air = payload_bytes + frames.size() * STREAM_FRAME_HEADER_LEN;
+
+  std::vector<int16_t> decoded(SAMPLE_CODEC_MAX_SAMPLES);
+  size_t errors = 0;
+  t0 = bench_clock::now();
+  for (const EncodedFrame &f : frames) {
+    if (!pas::decode_samples(f.payload.data(), f.payload.size(), decoded.data(), f.count)
+        || std::memcmp(decoded.data(), &x[f.first], f.count * sizeof(int16_t)) != 0) {
+      errors++;
+    }
+  }
+  double decode_s = std::chrono::duration<double>(bench_clock::now() - t0).count();
+
+  std::printf("%s\n", trace.name.c_str());
+  std::printf(
+    "  ratio %.2f (payload), %.2f (on air)\t%.2f bits/sample\t%.0f samples/frame\n",
+    x.size() * sizeof(int16_t) / (double) payload_bytes, raw_air / air,
+    payload_bytes * 8.0 / x.size(), (double) x.size() / frames.size()
+  );
+  std::printf("  encode %.1f ns/sample", encode_s * 1e9 / x.size());
+#ifdef HAVE_TSC
+  std::printf(", %.1f TSC cycles/sample", (double) cycles / x.size());
+#endif
+  std::printf(
+    "\tdecode %.1f MS/s\t%s\n",
+    x.size() / decode_s / 1e6, errors == 0 ? "lossless" : "MISMATCH"
+  );
+  if (errors > 0) std::printf("  %zu of %zu frames failed\n", errors, frames.size());
+}
+
+int main (int argc, char **argv) {
+  for (const Trace &trace : synthetic_traces()) run(trace);
+  for (int i = 1; i < argc; i++) {
+    Trace trace;
+    if (!load_trace(argv[i], trace)) {
+      std::fprintf(stderr, "Failed to read %s\n", argv[i]);
+      return 1;
+    }
+    run(trace);
+  }
+  return 0;
+}
@@ -0,0 +1,235 @@
+/**
+ * @file bench_cycles.cpp
+ *
+ * @brief Cycle analysis checks and throughput. Four stroke cycles are
+ * synthesized from first principles: intake at 0.9 bar, polytropic
+ * compression from inlet BDC, a Wiebe heat release integrated through the
+ * first law with the same gamma as the analysis, expansion to exhaust BDC and
+ * exhaust at 1.1 bar, each cycle with its own heat and start of combustion.
+ * The pressure is quantized as a calibrated stream sends it, with noise.
+ * IMEP, heat release and CA50 of the analyzer are checked against the
+ * integrated values, the batch against one call per cycle, and the peaks of
+ * the firmware cycle tracker against the analyzer. Then the batch is timed
+ * on one thread and on every core.
+ *
+ * usage: bench_cycles [cycles] [threads]
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "pas/cycle_analysis.hpp"
+#include "cycle_peak.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+static const uint32_t CYCLE_LEN = 720;
+/* 2^-8 bar per code, the Q8 of a calibrated stream */
+static const double SCALE = 1.0 / 256;
+static const double NOISE_BAR = 0.02;
+static const double GAMMA = 1.32;
+/* Wiebe shape, combustion over BURN_DEG from a start near SOC_DEG */
+static const double WIEBE_A = 5;
+static const double WIEBE_M = 2;
+static const double SOC_DEG = -12;
+static const double BURN_DEG = 55;
+static const double HEAT_J = 1000;
+/* Distinct synthesized cycles, repeated up to the cycle count */
+static const size_t SHAPES = 64;
+static const size_t BLOCK_LEN = 2048;
+static const double MIN_CYCLES_PER_S = 10000;
+
+static const double MAX_IMEP_ERROR = 0.02;
+static const double MAX_HEAT_ERROR = 0.02;
+static const double MAX_CA50_ERROR = 0.5;
+
+struct Truth {
+  double imep_net;
+  double imep_gross;
+  double heat;
+  double ca50;
+};
+
+static double seconds_since (bench_clock::time_point t0) {
+  return std::chrono::duration<double>(bench_clock::now() - t0).count();
+}
+
+static double wiebe (double angle, double soc) {
+  double y = (angle - soc) / BURN_DEG;
+  return y <= 0 ? 0 : 1 - std::exp(-WIEBE_A * std::pow(y, WIEBE_M + 1));
+}
+
+/* dp/da of the first law, constant gamma and no heat transfer, p in Pa */
+static double dp_da (const pas::EngineGeometry &g, double angle, double p, double heat, double soc) {
+  const double h = 1e-4;
+  double v = g.volume(angle);
+  double dv = (g.volume(angle + h) - g.volume(angle - h)) / (2 * h);
+  double dq = heat * (wiebe(angle + h, soc) - wiebe(angle - h, soc)) / (2 * h);
+  return ((GAMMA - 1) * dq - GAMMA * p * dv) / v;
+}
+
+/**
+ * One cycle from -360 to 359 degrees, a sample a degree. Compression and
+ * expansion are integrated in RK4 substeps with the p dV work alongside
+ */
+static Truth synthesize (const pas::EngineGeometry &g, double heat, double soc, std::mt19937 &rng, int16_t *out) {
+  const int SUBSTEPS = 20;
+  const double h = 1.0 / SUBSTEPS;
+  std::normal_distribution<double> noise(0, NOISE_BAR);
+  std::vector<double> p(CYCLE_LEN);
+  double vd = g.displacement();
+  double pa = 0.9e5, work = 0;
+  for (uint32_t i = 0; i < CYCLE_LEN; i++) {
+    double angle = -360.0 + i;
+    if (angle < -180) {
+      p[i] = 0.9e5;
+    } else if (angle >= 180) {
+      p[i] = 1.1e5;
+    } else {
+      p[i] = pa;
+      if (angle == 179) continue;
+      for (int s = 0; s < SUBSTEPS; s++) {
+        double a = angle + s * h;
+        double k1 = dp_da(g, a, pa, heat, soc);
+        double k2 = dp_da(g, a + h / 2, pa + h / 2 * k1, heat, soc);
+        double k3 = dp_da(g, a + h / 2, pa + h / 2 * k2, heat, soc);
+        double k4 = dp_da(g, a + h, pa + h * k3, heat, soc);
+        double next = pa + h / 6 * (k1 + 2 * k2 + 2 * k3 + k4);
+        work += (pa + next) / 2 * (g.volume(a + h) - g.volume(a));
+        pa = next;
+      }
+    }
+  }
+  /* The last degree of expansion, to BDC at the step of the sample */
+  work += pa * (g.volume(180) - g.volume(179));
+  for (uint32_t i = 0; i < CYCLE_LEN; i++) {
+    out[i] = (int16_t) std::lrint((p[i] / 1e5 + noise(rng)) / SCALE);
+  }
+  Truth t;
+  t.imep_gross = work / vd / 1e5;
+  /* Intake at 0.9 bar over a stroke, exhaust at 1.1 bar */
+  t.imep_net = t.imep_gross + (0.9 - 1.1);
+  t.heat = heat;
+  t.ca50 = soc + BURN_DEG * std::pow(std::log(2.0) / WIEBE_A, 1 / (WIEBE_M + 1));
+  return t;
+}
+
+static void on_peak (const cycle_peak_report_t *report, void *arg) {
+  static_cast<std::vector<cycle_peak_report_t>*>(arg)->push_back(*report);
+}
+
+int main (int argc, char **argv) {
+  size_t n_cycles = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 50000;
+  unsigned threads = argc > 2 ? (unsigned) std::atoi(argv[2]) : 0;
+  if (n_cycles < SHAPES) n_cycles = SHAPES;
+
+  pas::CycleAnalysisConfig config;
+  config.cycle_len = CYCLE_LEN;
+  config.scale = SCALE;
+  config.gamma = GAMMA;
+  pas::CycleAnalyzer analyzer(config);
+
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<double> heat_var(0.9, 1.1), soc_var(-3, 3);
+  std::vector<int16_t> samples(n_cycles * CYCLE_LEN);
+  std::vector<Truth> truth(SHAPES);
+  for (size_t c = 0; c < SHAPES; c++) {
+    truth[c] = synthesize(config.geometry, HEAT_J * heat_var(rng), SOC_DEG + soc_var(rng), rng, &samples[c * CYCLE_LEN]);
+  }
+  for (size_t c = SHAPES; c < n_cycles; c++) {
+    std::memcpy(&samples[c * CYCLE_LEN], &samples[(c % SHAPES) * CYCLE_LEN], CYCLE_LEN * sizeof(int16_t));
+  }
+  std::vector<uint64_t> starts(n_cycles);
+  for (size_t c = 0; c < n_cycles; c++) starts[c] = c * CYCLE_LEN;
+
+  std::printf(
+    "%zu cycles of %u samples, bore %.0f stroke %.0f conrod %.1f mm, CR %.1f, kernels %s\n",
+    n_cycles, CYCLE_LEN, config.geometry.bore, config.geometry.stroke, config.geometry.conrod,
+    config.geometry.compression_ratio, pas::cycle_kernels()
+  );
+
+  /* Accuracy against the integrated cycles */
+  double imep_error = 0, gross_error = 0, heat_error = 0, ca50_error = 0;
+  for (size_t c = 0; c < SHAPES; c++) {
+    pas::CycleMetrics m = analyzer.analyze(&samples[c * CYCLE_LEN]);
+    imep_error = std::fmax(imep_error, std::fabs(m.imep_net - truth[c].imep_net));
+    gross_error = std::fmax(gross_error, std::fabs(m.imep_gross - truth[c].imep_gross));
+    heat_error = std::fmax(heat_error, std::fabs(m.heat_release / truth[c].heat - 1));
+    ca50_error = std::fmax(ca50_error, std::fabs(m.ca50 - truth[c].ca50));
+  }
+  pas::CycleMetrics first = analyzer.analyze(&samples[0]);
+  std::printf(
+    "  cycle 0: p_max %.2f bar at %.0f deg, IMEP net %.3f (%.3f) gross %.3f (%.3f) bar, PMEP %.3f bar, "
+    "Q %.0f J (%.0f), CA10/50/90 %.1f/%.1f/%.1f deg (CA50 %.1f), dp/da max %.2f bar/deg\n",
+    first.p_max, first.p_max_angle, first.imep_net, truth[0].imep_net, first.imep_gross, truth[0].imep_gross,
+    first.pmep, first.heat_release, truth[0].heat, first.ca10, first.ca50, first.ca90, truth[0].ca50, first.dp_max
+  );
+  std::printf(
+    "  largest error over %zu cycles: IMEP net %.4f gross %.4f bar, Q %.2f %%, CA50 %.2f deg\n",
+    SHAPES, imep_error, gross_error, heat_error * 100, ca50_error
+  );
+
+  /* The batch gives the same as one call per cycle */
+  std::vector<pas::CycleMetrics> out(n_cycles);
+  analyzer.analyze(samples.data(), starts.data(), n_cycles, out.data(), threads);
+  size_t batch_mismatches = 0;
+  for (size_t c = 0; c < n_cycles; c++) {
+    pas::CycleMetrics m = analyzer.analyze(&samples[c * CYCLE_LEN]);
+    batch_mismatches += std::memcmp(&m, &out[c], sizeof(m)) != 0;
+  }
+
+  /* The sensor side peaks, fed as stage blocks of an encoder clocked stream */
+  std::vector<cycle_peak_report_t> reports;
+  cycle_peak_t peak;
+  cycle_peak_init(&peak, CYCLE_LEN, on_peak, &reports);
+  for (size_t first_sample = 0; first_sample < samples.size(); first_sample += BLOCK_LEN) {
+    size_t len = std::min(BLOCK_LEN, samples.size() - first_sample);
+    cycle_peak_process(
+      &peak, &samples[first_sample], len, first_sample,
+      (uint32_t) (first_sample / CYCLE_LEN), (uint16_t) (first_sample % CYCLE_LEN)
+    );
+  }
+  size_t peak_mismatches = reports.size() == n_cycles ? 0 : n_cycles;
+  for (size_t c = 0; c < reports.size() && c < n_cycles; c++) {
+    const cycle_peak_report_t &r = reports[c];
+    peak_mismatches += std::fabs(r.max * SCALE - out[c].p_max) > 1e-4 || analyzer.angle(r.max_angle) != out[c].p_max_angle ||
+      std::fabs((r.max - r.min) * SCALE - out[c].p_pp) > 1e-4;
+  }
+
+  /* A block at an angle past the cycle drops the cycle in progress, the next one is reported */
+  std::vector<cycle_peak_report_t> after_bad;
+  cycle_peak_init(&peak, CYCLE_LEN, on_peak, &after_bad);
+  cycle_peak_process(&peak, &samples[0], CYCLE_LEN / 2, 0, 0, 0);
+  cycle_peak_process(&peak, &samples[CYCLE_LEN / 2], 1, CYCLE_LEN / 2, 0, (uint16_t) (CYCLE_LEN + 5));
+  cycle_peak_process(&peak, &samples[CYCLE_LEN], CYCLE_LEN, CYCLE_LEN, 1, 0);
+  peak_mismatches += after_bad.size() != 1 || peak.dropped != 1 || (after_bad.size() == 1 && after_bad[0].cycle != 1);
+  std::printf("  batch mismatches %zu, sensor peak mismatches %zu of %zu reports\n", batch_mismatches, peak_mismatches, reports.size());
+
+  /* Throughput, best of a few runs */
+  unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+  unsigned all = threads > 0 ? threads : cores;
+  double single_s = INFINITY, all_s = INFINITY;
+  for (int run = 0; run < 3; run++) {
+    auto t0 = bench_clock::now();
+    analyzer.analyze(samples.data(), starts.data(), n_cycles, out.data(), 1);
+    single_s = std::fmin(single_s, seconds_since(t0));
+    t0 = bench_clock::now();
+    analyzer.analyze(samples.data(), starts.data(), n_cycles, out.data(), all);
+    all_s = std::fmin(all_s, seconds_since(t0));
+  }
+  double single_rate = n_cycles / single_s, all_rate = n_cycles / all_s;
+  std::printf(
+    "  1 thread %10.0f cycles/s %7.1f MS/s\n  %u threads %8.0f cycles/s %7.1f MS/s\n",
+    single_rate, single_rate * CYCLE_LEN / 1e6, all, all_rate, all_rate * CYCLE_LEN / 1e6
+  );
+
+  bool ok = imep_error <= MAX_IMEP_ERROR && gross_error <= MAX_IMEP_ERROR && heat_error <= MAX_HEAT_ERROR &&
+    ca50_error <= MAX_CA50_ERROR && batch_mismatches == 0 && peak_mismatches == 0 && all_rate >= MIN_CYCLES_PER_S;
+  return ok ? 0 : 1;
+}
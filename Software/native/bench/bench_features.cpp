@@ -0,0 +1,114 @@
+/**
+ * @file bench_features.cpp
+ *
+ * @brief Cost of the firmware FFT and feature extractor. The FFT is checked
+ * against a double precision DFT, bench_features.py compares it with numpy.fft.
+ *
+ * usage: bench_features [recorded.raw]
+ */
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "fft.h"
+#include "feature_extractor.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+static const double FS = 100000;
+
+static std::vector<int16_t> test_signal (size_t len) {
+  std::mt19937 rng(1);
+  std::normal_distribution<double> noise(0, 200);
+  std::vector<int16_t> x(len);
+  for (size_t i = 0; i < len; i++) {
+    double t = i / FS;
+    x[i] = (int16_t) std::lrint(1000 + 12000 * std::sin(2 * M_PI * 50.3 * t) + 3000 * std::sin(2 * M_PI * 1234.5 * t) + noise(rng));
+  }
+  return x;
+}
+
+static std::vector<int16_t> load_trace (const char *path) {
+  std::vector<int16_t> x;
+  FILE *f = std::fopen(path, "rb");
+  if (f == nullptr) return x;
+  int16_t block[4096];
+  size_t len;
+  while ((len = std::fread(block, sizeof(int16_t), 4096, f)) > 0) x.insert(x.end(), block, block + len);
+  std::fclose(f);
+  return x;
+}
+
+/* Windowed power spectrum by direct DFT in double precision */
+static std::vector<double> reference_power (const int16_t *x, size_t n, const float *window) {
+  std::vector<double> power(n / 2 + 1);
+  for (size_t k = 0; k <= n / 2; k++) {
+    std::complex<double> acc = 0;
+    for (size_t i = 0; i < n; i++) {
+      acc += (double) x[i] * window[i] * std::polar(1.0, -2 * M_PI * (double) ((k * i) % n) / n);
+    }
+    power[k] = std::norm(acc);
+  }
+  return power;
+}
+
+int main (int argc, char **argv) {
+  std::vector<int16_t> x = argc > 1 ? load_trace(argv[1]) : test_signal(1 << 22);
+  if (x.size() < FFT_MAX_LEN) {
+    std::fprintf(stderr, "Need at least %d samples\n", FFT_MAX_LEN);
+    return 1;
+  }
+
+  std::printf("fft_len\tus/fft\tMS/s\tmax error (of peak)\n");
+  for (size_t n = 256; n <= FFT_MAX_LEN; n *= 2) {
+    fft_real_t fft;
+    fft_real_init(&fft, n);
+    std::vector<float> power(n / 2 + 1);
+    size_t ffts = x.size() / n;
+    auto t0 = bench_clock::now();
+    for (size_t i = 0; i < ffts; i++) fft_real_power(&fft, &x[i * n], 0, power.data());
+    double elapsed = std::chrono::duration<double>(bench_clock::now() - t0).count();
+
+    double error = 0, peak = 0;
+    if (n <= 2048) {
+      fft_real_power(&fft, x.data(), 0, power.data());
+      std::vector<double> reference = reference_power(x.data(), n, fft.window);
+      for (size_t k = 0; k <= n / 2; k++) {
+        peak = std::max(peak, reference[k]);
+        error = std::max(error, std::fabs(std::sqrt(power[k]) - std::sqrt(reference[k])));
+      }
+      error /= std::sqrt(peak);
+    }
+    std::printf("%zu\t%.2f\t%.1f\t", n, elapsed / ffts * 1e6, ffts * n / elapsed / 1e6);
+    if (peak > 0) std::printf("%.2e\n", error);
+    else std::printf("-\n");
+    fft_real_free(&fft);
+  }
+
+  /* Whole extractor in firmware sized blocks */
+  feature_config_t config = { 4096, 25 };
+  feature_extractor_t extractor;
+  feature_report_t last = {};
+  size_t reports = 0;
+  struct Output { feature_report_t *last; size_t *reports; } output = { &last, &reports };
+  feature_extractor_init(&extractor, &config, [] (const feature_report_t *report, void *arg) {
+    Output *o = static_cast<Output*>(arg);
+    *o->last = *report;
+    (*o->reports)++;
+  }, &output);
+  auto t0 = bench_clock::now();
+  for (size_t pos = 0; pos < x.size(); pos += 256) {
+    feature_extractor_process(&extractor, &x[pos], std::min<size_t>(256, x.size() - pos), FS);
+  }
+  double elapsed = std::chrono::duration<double>(bench_clock::now() - t0).count();
+  feature_extractor_free(&extractor);
+  std::printf(
+    "extractor %u x %u: %.1f MS/s, %zu reports, last: min %d max %d mean %.1f rms %.1f dominant %.2f Hz amplitude %.1f\n",
+    config.windows, config.fft_len, x.size() / elapsed / 1e6, reports,
+    last.min, last.max, last.mean, last.ac_rms, last.dominant_freq, last.dominant_amplitude
+  );
+  return 0;
+}
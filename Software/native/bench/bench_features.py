@@ -0,0 +1,54 @@
+""" Firmware FFT and feature extractor (through libpas_native) against numpy.fft
+
+usage: python3 bench_features.py [seconds of signal]
+"""
+import os
+import sys
+import time
+import numpy as np
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..'))
+import nativeReceiver
+import dsp
+
+FS = 100e3
+
+def testSignal(seconds):
+  t = np.arange(int(seconds * FS)) / FS
+  noise = np.random.default_rng(1).normal(0, 200, t.size)
+  x = 1000 + 12000 * np.sin(2 * np.pi * 50.3 * t) + 3000 * np.sin(2 * np.pi * 1234.5 * t) + noise
+  return np.round(x).astype(np.int16)
+
+def timeCall(fn, repeat):
+  t = time.perf_counter()
+  for _ in range(repeat):
+    result = fn()
+  return (time.perf_counter() - t) / repeat, result
+
+def main():
+  seconds = float(sys.argv[1]) if len(sys.argv) > 1 else 2
+  x = testSignal(seconds)
+
+  print('fft_len  numpy.fft.rfft us  firmware fft us  max error (of peak)')
+  for n in [256, 1024, 4096, 8192]:
+    block = x[:n]
+    window = 0.5 - 0.5 * np.cos(2 * np.pi * np.arange(n) / n)
+    numpyTime, reference = timeCall(lambda: np.abs(np.fft.rfft(block * window)) ** 2, 200)
+    nativeTime, power = timeCall(lambda: nativeReceiver.powerSpectrum(block), 200)
+    error = np.max(np.abs(np.sqrt(power) - np.sqrt(reference))) / np.sqrt(reference.max())
+    print(f'{n:7d}  {numpyTime * 1e6:17.1f}  {nativeTime * 1e6:15.1f}  {error:.2e}')
+
+  """ What realTime.py computes every second, against the sensor reports over the same samples """
+  numpyTime, (freq, power, _) = timeCall(lambda: dsp.getSpectrum(x, FS), 5)
+  nativeTime, reports = timeCall(lambda: nativeReceiver.extractFeatures(x, FS, 4096, 10), 5)
+  print(f'dsp.getSpectrum over {x.size} samples: {numpyTime * 1e3:.1f} ms, dominant {freq[np.argmax(power)]:.2f} Hz')
+  print(f'extractFeatures over {x.size} samples: {nativeTime * 1e3:.1f} ms, {len(reports)} reports')
+  for r in reports[:3]:
+    print(
+      f'  sample {r.firstSample}: min {r.min} max {r.max} mean {r.mean:.1f} rms {r.acRms:.1f} '
+      f'dominant {r.dominantFreq:.2f} Hz amplitude {r.dominantAmplitude:.1f}'
+    )
+  print(f'  {x.size * 2} bytes of samples against {len(reports) * (40 + 28)} bytes of feature frames')
+
+if __name__ == '__main__':
+  main()
@@ -0,0 +1,175 @@
+/**
+ * @file bench_pyramid.cpp
+ *
+ * @brief Min/max pyramid checks and benchmarks: the SIMD reduction against a
+ * scalar loop, renders with raw samples against a scan of every column, then
+ * a pyramid built from a long synthetic trace in frame sized appends, timed
+ * renders of random windows at screen width, save and load.
+ *
+ * usage: bench_pyramid [samples] [columns] [file.pasp]
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "pas/pyramid.hpp"
+
+using bench_clock = std::chrono::steady_clock;
+
+static const size_t FRAME_LEN = 700;
+/* Not a multiple of the bin length, so frames and bins never line up */
+static const size_t TRACE_LEN = (1 << 22) + 12345;
+static const size_t CHECK_LEN = 1 << 24;
+
+static double seconds_since (bench_clock::time_point t0) {
+  return std::chrono::duration<double>(bench_clock::now() - t0).count();
+}
+
+/* Sine with a random walk on top */
+static std::vector<int16_t> make_trace (size_t len, uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  std::normal_distribution<double> step(0, 40);
+  std::vector<int16_t> x(len);
+  double walk = 0;
+  for (size_t i = 0; i < len; i++) {
+    walk = std::clamp(walk + step(rng), -8000.0, 8000.0);
+    x[i] = (int16_t) std::lround(12000 * std::sin(2 * M_PI * i / 1000.0) + walk);
+  }
+  return x;
+}
+
+static pas::PyramidBin scan (const int16_t *x, uint64_t begin, uint64_t end) {
+  int16_t mn = x[begin], mx = x[begin];
+  int64_t sum = 0;
+  for (uint64_t i = begin; i < end; i++) {
+    mn = std::min(mn, x[i]);
+    mx = std::max(mx, x[i]);
+    sum += x[i];
+  }
+  return { mn, mx, (float) ((double) sum / (end - begin)) };
+}
+
+int main (int argc, char **argv) {
+  uint64_t n_samples = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000000ull;
+  size_t columns = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 2000;
+  std::string path = argc > 3 ? argv[3] : "bench_pyramid.pasp";
+  std::mt19937_64 rng(1);
+
+  /* Kernel */
+  std::vector<int16_t> check = make_trace(CHECK_LEN, 2);
+  int16_t mn, mx;
+  int64_t sum;
+  const int reps = 20;
+  auto t0 = bench_clock::now();
+  for (int r = 0; r < reps; r++) pas::reduce_samples(check.data(), check.size(), mn, mx, sum);
+  double simd_s = seconds_since(t0);
+  pas::PyramidBin ref;
+  t0 = bench_clock::now();
+  for (int r = 0; r < reps; r++) ref = scan(check.data(), 0, check.size());
+  double scan_s = seconds_since(t0);
+  bool ok = mn == ref.min && mx == ref.max && (float) ((double) sum / check.size()) == ref.mean;
+  std::printf("reduce %zu samples\n", check.size());
+  std::printf("  simd       %8.2f GS/s\t%s\n", check.size() * reps / simd_s / 1e9, ok ? "same as scalar" : "MISMATCH");
+  std::printf("  scalar     %8.2f GS/s\n", check.size() * reps / scan_s / 1e9);
+
+  /* Exact renders with raw samples, pyramid built in random sized appends */
+  pas::MinMaxPyramid small;
+  std::uniform_int_distribution<size_t> frame(1, 5000);
+  for (size_t done = 0; done < check.size();) {
+    size_t n = std::min(frame(rng), check.size() - done);
+    small.append(check.data() + done, n);
+    done += n;
+  }
+  pas::MinMaxPyramid whole;
+  whole.append(check.data(), check.size());
+  bool same_levels = small.levels() == whole.levels();
+  for (size_t l = 0; same_levels && l < small.levels(); l++) {
+    for (size_t i = 0; i < small.level(l).size(); i++) {
+      const pas::PyramidBin &a = small.level(l)[i], &b = whole.level(l)[i];
+      same_levels &= a.min == b.min && a.max == b.max && std::fabs(a.mean - b.mean) <= 1e-3f * (1 + std::fabs(b.mean));
+    }
+  }
+  std::vector<pas::PyramidBin> out(columns), expect(columns);
+  std::uniform_int_distribution<uint64_t> pos(0, check.size());
+  bool exact = true;
+  for (int r = 0; r < 200; r++) {
+    uint64_t a = pos(rng), b = pos(rng);
+    if (a > b) std::swap(a, b);
+    if (a == b) continue;
+    size_t cols = small.render(a, b, columns, check.data(), out.data());
+    for (size_t c = 0; c < cols; c++) {
+      pas::PyramidBin e = scan(check.data(), a + (b - a) * c / cols, a + (b - a) * (c + 1) / cols);
+      exact &= out[c].min == e.min && out[c].max == e.max && std::fabs(out[c].mean - e.mean) <= 1e-2f * (1 + std::fabs(e.mean));
+    }
+  }
+  std::printf(
+    "  appends    %s\n  render     %s\n",
+    same_levels ? "same as one append" : "MISMATCH", exact ? "same as scan" : "MISMATCH"
+  );
+  ok &= same_levels && exact;
+  check = {};
+
+  /* Long trace */
+  std::vector<int16_t> trace = make_trace(TRACE_LEN, 3);
+  pas::MinMaxPyramid pyramid;
+  t0 = bench_clock::now();
+  for (uint64_t done = 0; done < n_samples;) {
+    size_t at = done % TRACE_LEN;
+    size_t n = std::min<uint64_t>({ FRAME_LEN, n_samples - done, TRACE_LEN - at });
+    pyramid.append(trace.data() + at, n);
+    done += n;
+  }
+  double build_s = seconds_since(t0);
+  size_t bins = 0;
+  for (size_t l = 0; l < pyramid.levels(); l++) bins += pyramid.level(l).size();
+  std::printf("%llu samples, %zu levels\n", (unsigned long long) n_samples, pyramid.levels());
+  std::printf(
+    "  build      %8.1f MS/s\t%8.1f MB of bins\n",
+    n_samples / build_s / 1e6, bins * sizeof(pas::PyramidBin) / 1e6
+  );
+
+  /* Random windows from one column per bin up to the whole trace */
+  const int n_renders = 2000;
+  std::uniform_real_distribution<double> zoom(std::log((double) columns * pyramid.base()), std::log((double) n_samples));
+  std::vector<double> times;
+  bool bounded = true;
+  for (int r = 0; r < n_renders; r++) {
+    uint64_t len = std::min<uint64_t>(n_samples, (uint64_t) std::exp(zoom(rng)));
+    uint64_t begin = std::uniform_int_distribution<uint64_t>(0, n_samples - len)(rng);
+    t0 = bench_clock::now();
+    size_t cols = pyramid.render(begin, begin + len, columns, nullptr, out.data());
+    times.push_back(seconds_since(t0));
+    for (size_t c = 0; c < cols; c++) bounded &= out[c].min <= out[c].mean && out[c].mean <= out[c].max;
+  }
+  std::sort(times.begin(), times.end());
+  double mean = 0;
+  for (double t : times) mean += t;
+  mean /= times.size();
+  std::printf(
+    "  render     %8.1f us mean\t%8.1f us p99\t%8.1f us max\t%zu columns %s\n",
+    mean * 1e6, times[times.size() * 99 / 100] * 1e6, times.back() * 1e6, columns, bounded ? "" : "OUT OF BOUNDS"
+  );
+  std::printf("  scan       %8.1f ms estimated for the whole trace\n", n_samples * scan_s / (CHECK_LEN * reps) * 1e3);
+  ok &= bounded;
+
+  t0 = bench_clock::now();
+  pyramid.save(path);
+  double save_s = seconds_since(t0);
+  t0 = bench_clock::now();
+  pas::MinMaxPyramid loaded = pas::MinMaxPyramid::load(path);
+  double load_s = seconds_since(t0);
+  std::vector<pas::PyramidBin> again(columns);
+  size_t cols = pyramid.render(0, n_samples, columns, nullptr, out.data());
+  bool same = loaded.size() == n_samples && loaded.render(0, n_samples, columns, nullptr, again.data()) == cols;
+  for (size_t c = 0; same && c < cols; c++) {
+    same = out[c].min == again[c].min && out[c].max == again[c].max && out[c].mean == again[c].mean;
+  }
+  std::printf("  save       %8.1f ms\n  load       %8.1f ms\t%s\n", save_s * 1e3, load_s * 1e3, same ? "same renders" : "MISMATCH");
+  std::remove(path.c_str());
+  ok &= same;
+  return ok ? 0 : 1;
+}
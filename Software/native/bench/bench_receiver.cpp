@@ -0,0 +1,142 @@
+/**
+ * @file bench_receiver.cpp
+ *
+ * @brief Decode throughput benchmarks for the stream receiver.
+ *  - decode: stream_decoder_push() over an in memory stream split in random chunks
+ *  - loopback: a fake sensor on 127.0.0.1 streams pre-encoded frames as fast as
+ *    possible into pas::Receiver while the main thread drains the ring
+ *
+ * usage: bench_receiver [seconds]
+ */
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "pas/receiver.hpp"
+
+using bench_clock = std::chrono::steady_clock;
+
+/* Frames carrying a slow sine, as the firmware would send them */
+static std::vector<uint8_t> make_stream (size_t n_frames) {
+  std::vector<uint8_t> stream;
+  stream.reserve(n_frames * STREAM_FRAME_MAX_LEN);
+  int16_t samples[STREAM_FRAME_MAX_SAMPLES];
+  uint64_t index = 0;
+  for (size_t f = 0; f < n_frames; f++) {
+    for (size_t i = 0; i < STREAM_FRAME_MAX_SAMPLES; i++) {
+      samples[i] = (int16_t) (10000 * ((index + i) % 6250) / 6250);
+    }
+    stream_frame_header_t header;
+    stream_frame_init_header(
+      &header, STREAM_FRAME_SAMPLES, 0, f, index, index * 10, 100e3f,
+      STREAM_FRAME_MAX_SAMPLES, sizeof(samples)
+    );
+    stream_frame_seal(&header, samples);
+    const uint8_t *h = reinterpret_cast<const uint8_t*>(&header);
+    const uint8_t *p = reinterpret_cast<const uint8_t*>(samples);
+    stream.insert(stream.end(), h, h + sizeof(header));
+    stream.insert(stream.end(), p, p + sizeof(samples));
+    index += STREAM_FRAME_MAX_SAMPLES;
+  }
+  return stream;
+}
+
+static void bench_decode (const std::vector<uint8_t> &stream, double seconds) {
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<size_t> chunk(1, 4096);
+  stream_decoder_t decoder;
+  stream_decoder_init(&decoder);
+
+  auto start = bench_clock::now();
+  double elapsed = 0;
+  uint64_t bytes = 0;
+  while (elapsed < seconds) {
+    size_t pos = 0;
+    while (pos < stream.size()) {
+      size_t len = std::min(chunk(rng), stream.size() - pos);
+      stream_decoder_push(&decoder, &stream[pos], len, nullptr, nullptr);
+      pos += len;
+    }
+    bytes += stream.size();
+    elapsed = std::chrono::duration<double>(bench_clock::now() - start).count();
+  }
+  std::printf(
+    "decode:   %8.2f MS/s  %8.1f MB/s  (lost %u frames, %u crc errors)\n",
+    decoder.stats.samples / elapsed / 1e6, bytes / elapsed / 1e6,
+    decoder.stats.lost_frames, decoder.stats.crc_errors
+  );
+}
+
+static void bench_loopback (const std::vector<uint8_t> &stream, double seconds) {
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  if (bind(listen_fd, (sockaddr*) &addr, sizeof(addr)) != 0 || listen(listen_fd, 1) != 0) {
+    std::perror("fake server");
+    return;
+  }
+  socklen_t addr_len = sizeof(addr);
+  getsockname(listen_fd, (sockaddr*) &addr, &addr_len);
+
+  std::atomic<bool> serving{true};
+  std::thread server([&] {
+    int fd = accept(listen_fd, nullptr, nullptr);
+    char handshake[128];
+    recv(fd, handshake, sizeof(handshake), 0);
+    /* Resend the same frames, the receiver only counts sequence gaps */
+    while (serving.load()) {
+      if (send(fd, stream.data(), stream.size(), MSG_NOSIGNAL) < 0) break;
+    }
+    close(fd);
+  });
+
+  pas::ReceiverConfig config;
+  config.host = "127.0.0.1";
+  config.port = ntohs(addr.sin_port);
+  pas::Receiver receiver(config);
+  receiver.start();
+
+  std::vector<int16_t> block(1 << 16);
+  uint64_t read = 0;
+  auto start = bench_clock::now();
+  double elapsed = 0;
+  while (elapsed < seconds && receiver.running()) {
+    size_t len = receiver.read(block.data(), block.size());
+    if (len == 0) std::this_thread::yield();
+    read += len;
+    elapsed = std::chrono::duration<double>(bench_clock::now() - start).count();
+  }
+  pas::ReceiverStats s = receiver.stats();
+  serving.store(false);
+  receiver.stop();
+  server.join();
+  close(listen_fd);
+
+  std::printf(
+    "loopback: %8.2f MS/s  %8.1f MB/s  (read %.2f MS/s, ring dropped %u, crc errors %u)\n",
+    s.samples / elapsed / 1e6, s.bytes / elapsed / 1e6, read / elapsed / 1e6,
+    s.ring_dropped, s.crc_errors
+  );
+}
+
+int main (int argc, char **argv) {
+  double seconds = argc > 1 ? std::atof(argv[1]) : 2.0;
+  std::vector<uint8_t> stream = make_stream(4096);
+  bench_decode(stream, seconds);
+  bench_loopback(stream, seconds);
+  return 0;
+}
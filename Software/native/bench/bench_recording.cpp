@@ -0,0 +1,114 @@
+/**
+ * @file bench_recording.cpp
+ *
+ * @brief Recording format checks and benchmarks: writes a synthetic stream in
+ * frame sized appends with a gap every few seconds, maps it back, compares
+ * every sample and checks seek() against a scan of the chunk timestamps.
+ *
+ * usage: bench_recording [samples] [file.pasr]
+ */
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "pas/recording.hpp"
+
+using bench_clock = std::chrono::steady_clock;
+
+static const double FS = 100e3;
+static const size_t FRAME_LEN = 700;
+/* A few frames lost every this many frames */
+static const size_t GAP_EVERY = 500;
+
+static double seconds_since (bench_clock::time_point t0) {
+  return std::chrono::duration<double>(bench_clock::now() - t0).count();
+}
+
+static int16_t sample_at (uint64_t index) {
+  return (int16_t) ((index * 7919) % 65536 - 32768);
+}
+
+/* First position at or after time, scanning every chunk */
+static uint64_t seek_reference (const pas::RecordingReader &reader, int64_t time) {
+  int64_t target = reader.chunks().front().timestamp + time;
+  for (const pas::RecordingChunk &chunk : reader.chunks()) {
+    if (chunk.timestamp + (int64_t) std::llround((chunk.sample_count - 1) * 1e6 / FS) < target) continue;
+    for (uint64_t k = 0; k < chunk.sample_count; k++) {
+      if (chunk.timestamp + (int64_t) std::llround(k * 1e6 / FS) >= target) return chunk.offset + k;
+    }
+  }
+  return reader.size();
+}
+
+int main (int argc, char **argv) {
+  uint64_t n_samples = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000000ull;
+  std::string path = argc > 2 ? argv[2] : "bench_recording.pasr";
+
+  std::vector<int16_t> frame(FRAME_LEN);
+  uint64_t index = 1000, written = 0, gaps = 0;
+  auto t0 = bench_clock::now();
+  {
+    pas::RecordingInfo info;
+    info.range_sel = 0x0003;
+    info.conversion = 4096.0 / 32767 * 1.25 / 1000;
+    pas::RecordingWriter writer(path, info);
+    for (size_t f = 0; written < n_samples; f++) {
+      if (f % GAP_EVERY == GAP_EVERY - 1) {
+        index += 3 * FRAME_LEN;
+        gaps++;
+      }
+      size_t len = std::min<uint64_t>(FRAME_LEN, n_samples - written);
+      for (size_t i = 0; i < len; i++) frame[i] = sample_at(index + i);
+      writer.append(index, (int64_t) std::llround(index * 1e6 / FS), FS, frame.data(), len);
+      index += len;
+      written += len;
+    }
+    writer.close();
+  }
+  double write_s = seconds_since(t0);
+  std::printf("%llu samples, %llu gaps\n", (unsigned long long) n_samples, (unsigned long long) gaps);
+  std::printf("  write      %8.1f MS/s\t%8.1f MB/s\n", n_samples / write_s / 1e6, n_samples * 2 / write_s / 1e6);
+
+  t0 = bench_clock::now();
+  pas::RecordingReader reader(path);
+  double open_s = seconds_since(t0);
+  bool ok = reader.complete() && reader.size() == n_samples;
+
+  /* Every sample in place, using the stream index of its chunk */
+  t0 = bench_clock::now();
+  int64_t sum = 0;
+  for (const pas::RecordingChunk &chunk : reader.chunks()) {
+    const int16_t *x = reader.samples() + chunk.offset;
+    for (uint32_t k = 0; k < chunk.sample_count; k++) {
+      ok &= x[k] == sample_at(chunk.first_sample + k);
+      sum += x[k];
+    }
+  }
+  double read_s = seconds_since(t0);
+  std::printf("  open       %8.3f ms\t%zu chunks\n", open_s * 1e3, reader.chunks().size());
+  std::printf("  read       %8.1f MS/s\t%s (sum %lld)\n", n_samples / read_s / 1e6, ok ? "same samples" : "MISMATCH", (long long) sum);
+
+  std::mt19937_64 rng(1);
+  int64_t duration = reader.time_at(reader.size() - 1);
+  std::uniform_int_distribution<int64_t> time(0, duration);
+  const size_t n_checks = 200, n_seeks = 1000000;
+  bool seek_ok = true;
+  for (size_t i = 0; i < n_checks; i++) {
+    int64_t t = time(rng);
+    seek_ok &= reader.seek(t) == seek_reference(reader, t);
+  }
+  t0 = bench_clock::now();
+  uint64_t acc = 0;
+  for (size_t i = 0; i < n_seeks; i++) acc += reader.seek(time(rng));
+  double seek_s = seconds_since(t0);
+  std::printf(
+    "  seek       %8.1f ns\t%s (%llu)\n",
+    seek_s / n_seeks * 1e9, seek_ok ? "same as scan" : "MISMATCH", (unsigned long long) (acc % 1000)
+  );
+  std::remove(path.c_str());
+  std::remove(pas::pyramid_path(path).c_str());
+  return ok && seek_ok ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+/**
+ * @file bench_trigger.cpp
+ *
+ * @brief Throughput of the firmware trigger kernel and capture engine on a
+ * simulated pressure trace. The kernel result is checked against a per sample
+ * port of findCross() from trigger.py; bench_trigger.py compares it with the
+ * Python function itself.
+ *
+ * usage: bench_trigger [recorded.raw]
+ */
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "trigger.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+static const size_t TRACE_LEN = 1 << 23;
+static const double FS = 100000;
+
+static std::vector<int16_t> pressure_trace () {
+  std::mt19937 rng(1);
+  std::normal_distribution<double> noise(0, 20);
+  std::vector<int16_t> x(TRACE_LEN);
+  for (size_t i = 0; i < TRACE_LEN; i++) {
+    double phase = std::fmod(i * 50 / FS, 1.0) * 2 - 1;
+    double compression = 8000 / (1.2 - 0.8 * std::cos(M_PI * phase));
+    double combustion = 12000 * std::exp(-std::pow((phase - 0.05) / 0.06, 2));
+    x[i] = (int16_t) std::lrint(-12000 + compression + combustion + noise(rng));
+  }
+  return x;
+}
+
+static std::vector<int16_t> load_trace (const char *path) {
+  std::vector<int16_t> x;
+  FILE *f = std::fopen(path, "rb");
+  if (f == nullptr) return x;
+  int16_t block[4096];
+  size_t len;
+  while ((len = std::fread(block, sizeof(int16_t), 4096, f)) > 0) x.insert(x.end(), block, block + len);
+  std::fclose(f);
+  return x;
+}
+
+/* findCross() of trigger.py, one sample at a time */
+static std::vector<uint64_t> find_cross_reference (const std::vector<int16_t> &x, int level, int hysteresis) {
+  std::vector<uint64_t> cross;
+  int up = level + hysteresis, down = level - hysteresis;
+  bool is_up = x[0] > up;
+  for (size_t i = 0; i < x.size(); i++) {
+    if (is_up && x[i] < down) {
+      is_up = false;
+      cross.push_back(i);
+    } else if (!is_up && x[i] > up) {
+      is_up = true;
+    }
+  }
+  return cross;
+}
+
+static double seconds_since (bench_clock::time_point t0) {
+  return std::chrono::duration<double>(bench_clock::now() - t0).count();
+}
+
+struct EngineBench {
+  std::vector<int16_t> buffer;
+  trigger_capture_t capture;
+  size_t windows = 0;
+};
+
+static trigger_capture_t* bench_get_capture (void *arg) {
+  return &static_cast<EngineBench*>(arg)->capture;
+}
+
+static void bench_capture_done (trigger_capture_t *, void *arg) {
+  static_cast<EngineBench*>(arg)->windows++;
+}
+
+int main (int argc, char **argv) {
+  std::vector<int16_t> x = argc > 1 ? load_trace(argv[1]) : pressure_trace();
+  if (x.empty()) {
+    std::fprintf(stderr, "Failed to read %s\n", argv[1]);
+    return 1;
+  }
+  int16_t level = 0;
+  uint16_t hysteresis = 500;
+
+  auto t0 = bench_clock::now();
+  std::vector<uint64_t> reference = find_cross_reference(x, level, hysteresis);
+  double reference_s = seconds_since(t0);
+
+  trigger_config_t config = {};
+  config.level = level;
+  config.hysteresis = hysteresis;
+  config.slope = TRIGGER_FALLING;
+  trigger_detector_t detector;
+  trigger_detector_init(&detector, &config);
+  std::vector<uint64_t> found(reference.size() + 16);
+  t0 = bench_clock::now();
+  size_t n = trigger_find_all(&detector, x.data(), x.size(), found.data(), found.size());
+  double kernel_s = seconds_since(t0);
+  found.resize(n);
+
+  std::printf("%zu samples, %zu triggers\n", x.size(), n);
+  std::printf("  reference loop  %8.1f MS/s\n", x.size() / reference_s / 1e6);
+  std::printf("  trigger_detect  %8.1f MS/s\t%s\n", x.size() / kernel_s / 1e6, found == reference ? "same triggers" : "MISMATCH");
+
+  /* Whole engine in firmware sized blocks, 2000 + 6000 sample windows */
+  config.pre_trigger = 2000;
+  config.post_trigger = 6000;
+  EngineBench bench;
+  bench.buffer.resize(config.pre_trigger + config.post_trigger);
+  bench.capture.samples = bench.buffer.data();
+  trigger_engine_t engine;
+  trigger_engine_init(&engine, &config, bench_get_capture, bench_capture_done, &bench);
+  trigger_engine_reset(&engine, 0);
+  t0 = bench_clock::now();
+  for (size_t pos = 0; pos < x.size(); pos += 256) {
+    trigger_engine_process(&engine, &x[pos], std::min<size_t>(256, x.size() - pos));
+  }
+  double engine_s = seconds_since(t0);
+  trigger_engine_free(&engine);
+  std::printf("  capture engine  %8.1f MS/s\t%zu windows\n", x.size() / engine_s / 1e6, bench.windows);
+  return found == reference ? 0 : 1;
+}
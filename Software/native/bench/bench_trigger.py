@@ -0,0 +1,44 @@
+""" Firmware trigger kernel (through libpas_native) against findCross() of trigger.py
+
+usage: python3 bench_trigger.py [seconds of signal]
+"""
+import os
+import sys
+import time
+import ctypes
+import numpy as np
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..'))
+import nativeReceiver
+from trigger import findCross
+
+FS = 100e3
+
+def pressureTrace(seconds):
+  i = np.arange(int(seconds * FS))
+  phase = np.fmod(i * 50 / FS, 1.0) * 2 - 1
+  compression = 8000 / (1.2 - 0.8 * np.cos(np.pi * phase))
+  combustion = 12000 * np.exp(-((phase - 0.05) / 0.06) ** 2)
+  noise = np.random.default_rng(1).normal(0, 20, i.size)
+  return np.round(-12000 + compression + combustion + noise).astype(np.int16)
+
+def main():
+  seconds = float(sys.argv[1]) if len(sys.argv) > 1 else 1
+  x = pressureTrace(seconds)
+  level, hysteresis = 0, 500
+
+  t = time.perf_counter()
+  reference = findCross(x, level, hysteresis)
+  pythonTime = time.perf_counter() - t
+
+  t = time.perf_counter()
+  native = nativeReceiver.findCross(x, level, hysteresis)
+  nativeTime = time.perf_counter() - t
+
+  print(f'{x.size} samples, {native.size} triggers')
+  print(f'  trigger.py findCross  {x.size / pythonTime / 1e6:10.3f} MS/s')
+  print(f'  native trigger        {x.size / nativeTime / 1e6:10.3f} MS/s  ({pythonTime / nativeTime:.0f}x)')
+  print('  same triggers' if np.array_equal(reference, native) else '  MISMATCH')
+
+if __name__ == '__main__':
+  main()
@@ -0,0 +1,132 @@
+/**
+ * @file clock_sync.hpp
+ *
+ * @brief Puts sensor samples on the host clock, to line up the streams of
+ * several sensors. ClockSync estimates the offset and drift of a sensor
+ * esp_timer clock from NTP style exchanges (stream_time_t), SampleClock fits
+ * the sample index to sensor time line from the frame headers and resample()
+ * interpolates a stream on a time grid shared by all streams.
+ *
+ * Each exchange bounds the offset by half its round trip. Queueing only adds
+ * delay, so only the fastest exchanges of the window are kept and a line
+ * through them gives the offset and its drift, each weighted down by how much
+ * slower it was than the fastest. A fixed difference between
+ * the two directions biases the offset by half of it, the same on every
+ * sensor of a network so the streams still line up.
+ */
+#ifndef PAS_CLOCK_SYNC_HPP
+#define PAS_CLOCK_SYNC_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+
+namespace pas {
+
+/** Host clock of the exchanges and of the aligned sample times, CLOCK_REALTIME in us */
+int64_t host_time_us ();
+
+class ClockSync {
+public:
+  /**
+   * @param window exchanges kept, the drift is fitted over their span
+   * @param keep fraction of the window fitted, the exchanges with the shortest round trips
+   */
+  explicit ClockSync (size_t window = 1024, double keep = 0.5);
+
+  /**
+   * @brief Adds one exchange, times in us: t1 host sent the request, t2 sensor
+   * read it, t3 sensor sent the answer, t4 host read it
+   * @returns false if the times are inconsistent and the exchange was dropped
+   */
+  bool add (int64_t t1, int64_t t2, int64_t t3, int64_t t4);
+  void reset ();
+
+  /** True once an exchange was added */
+  bool synced () const { return !exchanges_.empty(); }
+  /** Host time of a sensor time, us */
+  double to_host (double sensor_us) const;
+  /** Sensor time of a host time, us */
+  double to_sensor (double host_us) const;
+  /** Host minus sensor time at the last exchange, us */
+  double offset_us () const;
+  /** Offset change per second of sensor time in ppm, positive when the sensor clock is slow */
+  double drift_ppm () const { return slope_ * 1e6; }
+  /** Shortest round trip in the window, us */
+  int64_t min_delay_us () const;
+  /** Exchanges added since the last reset */
+  uint64_t exchanges () const { return count_; }
+
+private:
+  struct Exchange {
+    int64_t sensor;
+    /* Host minus sensor time, us */
+    double offset;
+    int64_t delay;
+  };
+
+  void fit ();
+
+  size_t window_;
+  double keep_;
+  std::deque<Exchange> exchanges_;
+  uint64_t count_ = 0;
+  /* offset = offset_ + slope_ * (sensor - ref_) */
+  int64_t ref_ = 0;
+  double offset_ = 0;
+  double slope_ = 0;
+};
+
+/**
+ * Line from the sample index to the sensor time of the conversion, least
+ * squares over the headers (first_sample, timestamp) of the last frames. The
+ * header timestamps are whole microseconds, the line is not.
+ */
+class SampleClock {
+public:
+  explicit SampleClock (size_t window = 256);
+
+  /**
+   * @brief Adds a frame header, an index going back (sensor restart) starts
+   * over. sample_rate gives the period until two frames came
+   */
+  void add (uint64_t first_sample, int64_t timestamp, float sample_rate);
+  void reset ();
+
+  bool valid () const { return !points_.empty(); }
+  /** Sensor time of a sample, us */
+  double time (uint64_t index) const;
+  /** Time between two samples, us, 0 before the first frame */
+  double period_us () const { return period_; }
+
+private:
+  struct Point {
+    uint64_t index;
+    int64_t time;
+  };
+
+  void fit ();
+
+  size_t window_;
+  std::deque<Point> points_;
+  /* time = time_ + period_ * (index - index_) */
+  uint64_t index_ = 0;
+  double time_ = 0;
+  double period_ = 0;
+};
+
+/**
+ * @brief Linear interpolation of a stream on the time grid out_t0 + k * out_period
+ * @param first_time time of samples[0], same unit as the grid
+ * @param period time between two input samples
+ * @param out out_n values, NAN where the grid is outside the input
+ * @returns grid points inside the input
+ */
+size_t resample (
+  const int16_t *samples, size_t n, double first_time, double period,
+  double out_t0, double out_period, size_t out_n, float *out
+);
+
+}
+
+#endif
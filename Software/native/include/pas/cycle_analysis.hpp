@@ -0,0 +1,145 @@
+/**
+ * @file cycle_analysis.hpp
+ *
+ * @brief Combustion metrics of engine cycles from cylinder pressure: peak
+ * pressure and its angle, peak to peak, IMEP, pumping losses, apparent heat
+ * release with its rate and burn angles, and the highest pressure rise rate.
+ *
+ * A cycle is cycle_len samples evenly spread over the crank angle of a cycle,
+ * sample 0 at first_angle degrees after firing TDC. An encoder clocked stream
+ * gives exactly that from one TDC pulse to the next, a timer clocked one only
+ * at a steady speed. The cylinder volume is the slider crank one:
+ *
+ *   V(a) = Vc + A (r + l - r cos a - sqrt(l^2 - r^2 sin^2 a))
+ *
+ * with the clearance volume Vc from the compression ratio. The work is
+ * sum(p dV) with dV over each sample step: net IMEP over the whole cycle,
+ * gross IMEP over compression and expansion (-180 to 180 degrees) and PMEP
+ * the difference. The apparent heat release is the single zone one with a
+ * constant gamma and no heat transfer,
+ *
+ *   dQ = gamma / (gamma - 1) p dV + 1 / (gamma - 1) V dp
+ *
+ * accumulated over the heat release window. The burn angles CA10, CA50 and
+ * CA90 are where it crosses 10, 50 and 90 % between its lowest value and its
+ * highest after that.
+ *
+ * The volume terms are tabulated once per configuration, so a cycle is one
+ * pass converting the samples to bar with both IMEP dot products, and one
+ * heat release pass over the window, each a SIMD kernel (AVX2, SSE2 or
+ * NEON). The batch call spreads the cycles over threads. The sensor computes
+ * the peak and peak to peak alone on its stream, see cycle_peak.h.
+ */
+#ifndef PAS_CYCLE_ANALYSIS_HPP
+#define PAS_CYCLE_ANALYSIS_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace pas {
+
+struct EngineGeometry {
+  /** mm */
+  double bore = 86;
+  double stroke = 86;
+  double conrod = 143.5;
+  double compression_ratio = 10.5;
+
+  /** Swept volume, m^3 */
+  double displacement () const;
+  /** Cylinder volume at a crank angle in degrees after firing TDC, m^3 */
+  double volume (double angle) const;
+};
+
+struct CycleAnalysisConfig {
+  EngineGeometry geometry;
+  /** Samples of one cycle */
+  uint32_t cycle_len = 720;
+  /** Crank angle of one cycle, 720 four stroke or 360 two stroke */
+  double cycle_deg = 720;
+  /** Angle of sample 0, degrees after firing TDC */
+  double first_angle = -360;
+  /** bar = sample * scale + offset, scale positive, 2^-frac_bits for a
+   * calibrated stream */
+  double scale = 1;
+  double offset = 0;
+  /** The mean over peg_len degrees from peg_angle is set to peg_bar, a
+   * relative sensor pegged at inlet BDC. 0 keeps the pressure as it is */
+  double peg_angle = -180;
+  double peg_len = 0;
+  double peg_bar = 1;
+  /** Ratio of specific heats of the heat release */
+  double gamma = 1.32;
+  /** Heat release window, degrees after firing TDC */
+  double hr_start = -30;
+  double hr_end = 90;
+};
+
+struct CycleMetrics {
+  /** bar, the angle in degrees after firing TDC */
+  float p_max = 0;
+  float p_max_angle = 0;
+  float p_min = 0;
+  float p_pp = 0;
+  /** bar */
+  float imep_net = 0;
+  float imep_gross = 0;
+  float pmep = 0;
+  /** J, the rate in J/deg */
+  float heat_release = 0;
+  float hrr_max = 0;
+  float hrr_max_angle = 0;
+  /** Burn angles, degrees after firing TDC, NAN without heat released */
+  float ca10 = 0;
+  float ca50 = 0;
+  float ca90 = 0;
+  /** Highest pressure rise rate in the heat release window, bar/deg */
+  float dp_max = 0;
+  float dp_max_angle = 0;
+};
+
+class CycleAnalyzer {
+public:
+  /** Tabulates the volume terms, throws std::invalid_argument */
+  explicit CycleAnalyzer (const CycleAnalysisConfig &config);
+
+  const CycleAnalysisConfig& config () const { return config_; }
+  uint32_t cycle_len () const { return config_.cycle_len; }
+  /** Crank angle of sample i, degrees after firing TDC */
+  double angle (double i) const { return config_.first_angle + i * step_; }
+
+  /**
+   * @brief Metrics of one cycle, thread safe
+   * @param hrr cycle_len heat release rates in J/deg if not null, 0 outside
+   * the window
+   */
+  CycleMetrics analyze (const int16_t *cycle, float *hrr = nullptr) const;
+  /**
+   * @brief Metrics of n cycles, cycle i at samples + starts[i], spread over
+   * threads, 0 for one per core
+   */
+  void analyze (const int16_t *samples, const uint64_t *starts, size_t n, CycleMetrics *out, unsigned threads = 0) const;
+
+private:
+  CycleAnalysisConfig config_;
+  /** Degrees per sample */
+  double step_;
+  /** dV / Vd of each sample step, and the same inside -180 to 180 degrees */
+  std::vector<float> work_net_;
+  std::vector<float> work_gross_;
+  /** dQ = hr_p * p + hr_dp * (p[i + 1] - p[i - 1]), J with p in bar */
+  std::vector<float> hr_p_;
+  std::vector<float> hr_dp_;
+  size_t hr_begin_ = 0;
+  size_t hr_end_ = 0;
+  size_t peg_begin_ = 0;
+  size_t peg_end_ = 0;
+};
+
+/** SIMD kernels in use: avx2, sse2, neon or scalar */
+const char* cycle_kernels ();
+
+}
+
+#endif
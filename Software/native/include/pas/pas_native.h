@@ -0,0 +1,444 @@
+/**
+ * @file pas_native.h
+ *
+ * @brief C interface of the native library, meant to be loaded with ctypes.
+ * Functions returning int give 0 on success and -1 on failure, the reason is
+ * available from pas_last_error().
+ */
+#ifndef PAS_NATIVE_H
+#define PAS_NATIVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct pas_receiver pas_receiver_t;
+typedef struct pas_pyramid pas_pyramid_t;
+
+typedef struct pas_receiver_stats_t {
+  uint64_t bytes;
+  uint64_t frames;
+  uint64_t samples;
+  uint64_t skipped_bytes;
+  uint64_t lost_samples;
+  uint32_t lost_frames;
+  uint32_t crc_errors;
+  uint32_t overrun_flags;
+  uint32_t ring_dropped;
+  uint32_t decode_errors;
+  uint32_t captures;
+  uint32_t captures_missed;
+  uint32_t feature_reports;
+  float sample_rate;
+  /** Datagrams that waited for a missing frame, came too late or twice */
+  uint32_t reordered;
+  uint32_t late_frames;
+  uint32_t duplicates;
+  /** Clock offset exchanges with the sensor, their shortest round trip in us */
+  uint32_t time_exchanges;
+  uint32_t clock_delay_us;
+  /** Host minus sensor clock in us and its drift, see clock_sync.hpp */
+  double clock_offset_us;
+  float clock_drift_ppm;
+  /** Alarm events received, 1 while the event port is connected */
+  uint32_t alarms;
+  int32_t alarm_connected;
+  /** Sample frames flagged with a charge amplifier reset */
+  uint32_t amp_resets;
+  /** Sample frames tagged with a crank angle, and the tag of the last one:
+   * cycle and angle of its first sample angle_sample, conversions per cycle
+   * and TDC pulses off the expected angle so far */
+  uint32_t angle_frames;
+  uint64_t angle_sample;
+  uint32_t angle_cycle;
+  uint16_t angle;
+  uint16_t angle_cycle_len;
+  uint32_t angle_sync_errors;
+  /** Cycle reports received, see pas_receiver_read_cycle() */
+  uint32_t cycle_reports;
+} pas_receiver_stats_t;
+
+typedef struct pas_capture_info_t {
+  uint64_t trigger_index;
+  /** Time of the first sample in us */
+  int64_t timestamp;
+  uint32_t number;
+  uint32_t missed;
+  uint32_t pre_trigger;
+  /** Samples in the window, may be more than were copied */
+  uint32_t length;
+  float sample_rate;
+  int32_t truncated;
+} pas_capture_info_t;
+
+/** Feature report, from the sensor or pas_extract_features(). Values in ADC counts */
+typedef struct pas_feature_report_t {
+  uint64_t first_sample;
+  /** Time of the first sample covered in us, 0 offline */
+  int64_t timestamp;
+  float sample_rate;
+  uint32_t length;
+  int16_t min;
+  int16_t max;
+  float mean;
+  float ac_rms;
+  float dominant_freq;
+  float dominant_amplitude;
+  uint16_t fft_len;
+  uint16_t windows;
+} pas_feature_report_t;
+
+/** ADC settings in use on the sensor, answer to pas_receiver_configure_adc() */
+typedef struct pas_adc_report_t {
+  uint64_t last_sample;
+  /** Rate asked for and rate the conversion timer runs at, Hz */
+  float requested_rate;
+  float sample_rate;
+  uint32_t spi_clock;
+  /** RANGE_SEL code */
+  uint8_t range;
+  /** 1 with data on SDO-0 and SDO-1 */
+  uint8_t sdo_mode;
+  uint8_t alarm_hysteresis;
+  /** 1 if the settings asked for were refused and nothing changed */
+  uint8_t rejected;
+  uint16_t alarm_high;
+  uint16_t alarm_low;
+} pas_adc_report_t;
+
+/** Calibration the sensor converts the samples with, pressure in bar = value * scale */
+typedef struct pas_calibration_report_t {
+  uint64_t last_sample;
+  uint32_t hash;
+  int8_t frac_bits;
+  /** 0 while the samples are ADC codes */
+  uint8_t enabled;
+  /** RANGE_SEL code and its input step in volts */
+  uint16_t range;
+  float lsb_volts;
+  float gain;
+  int32_t offset;
+  /** pC for amp_full_scale_v volts */
+  float amp_range_pc;
+  float amp_full_scale_v;
+  /** pC/bar, ppm/°C */
+  float sensitivity;
+  float sensitivity_drift;
+  /** bar/°C */
+  float zero_drift;
+  float reference_temp;
+  float temperature;
+  /** 2^-frac_bits, 0 for ADC codes */
+  double scale;
+} pas_calibration_report_t;
+
+/** Peak of an encoder cycle found by the sensor, ADC counts and conversions from TDC */
+typedef struct pas_cycle_report_t {
+  /** Sample at angle 0 and its time in us */
+  uint64_t first_sample;
+  int64_t timestamp;
+  uint32_t cycle;
+  uint16_t cycle_len;
+  int16_t max;
+  uint16_t max_angle;
+  int16_t min;
+  uint16_t min_angle;
+} pas_cycle_report_t;
+
+/** Engine and analysis settings of pas_analyze_cycles(), see cycle_analysis.hpp */
+typedef struct pas_cycle_config_t {
+  /** mm */
+  double bore;
+  double stroke;
+  double conrod;
+  double compression_ratio;
+  uint32_t cycle_len;
+  double cycle_deg;
+  double first_angle;
+  /** bar = sample * scale + offset */
+  double scale;
+  double offset;
+  /** Pegging window, peg_len 0 for none */
+  double peg_angle;
+  double peg_len;
+  double peg_bar;
+  double gamma;
+  double hr_start;
+  double hr_end;
+} pas_cycle_config_t;
+
+/** Metrics of one cycle, bar, J and degrees after firing TDC */
+typedef struct pas_cycle_metrics_t {
+  float p_max;
+  float p_max_angle;
+  float p_min;
+  float p_pp;
+  float imep_net;
+  float imep_gross;
+  float pmep;
+  float heat_release;
+  float hrr_max;
+  float hrr_max_angle;
+  float ca10;
+  float ca50;
+  float ca90;
+  float dp_max;
+  float dp_max_angle;
+} pas_cycle_metrics_t;
+
+/** Drift estimate of the charge amplifier baseline, codes and codes/s */
+typedef struct pas_baseline_report_t {
+  uint64_t last_sample;
+  /** First sample after the last amplifier reset */
+  uint64_t reset_index;
+  uint32_t resets;
+  uint32_t pegs;
+  float level;
+  float rest;
+  float drift;
+  int16_t reference;
+  /** 0 on the cycle minima, 1 on a crank angle window */
+  uint8_t peg;
+  uint8_t reset_pending;
+} pas_baseline_report_t;
+
+/** Change of the ADC input alarm flags, times in us */
+typedef struct pas_alarm_event_t {
+  /** First sample with the new flags and its conversion time, sensor clock */
+  uint64_t index;
+  int64_t timestamp;
+  /** Sensor time the stream ISR found the change and the frame was sent */
+  int64_t detected;
+  int64_t sent;
+  /** Host time the frame was read, and from the conversion to then, NAN until the clocks are known */
+  int64_t arrival;
+  double latency_us;
+  uint32_t number;
+  /** Events the sensor lost to a full queue */
+  uint32_t lost;
+  /** Longest conversion to socket time on the sensor so far */
+  uint32_t latency_max_us;
+  int16_t sample;
+  /** Bit 0 low, bit 1 high, from this sample on and before it */
+  uint8_t flags;
+  uint8_t previous;
+  float sample_rate;
+} pas_alarm_event_t;
+
+/** Column of a pyramid render, ADC counts */
+typedef struct pas_pyramid_bin_t {
+  int16_t min;
+  int16_t max;
+  float mean;
+} pas_pyramid_bin_t;
+
+/** @brief Message of the last failed call in this thread */
+const char* pas_last_error ();
+
+/**
+ * @brief Creates a receiver, no connection is made until pas_receiver_start()
+ * @param ring_len samples buffered between the socket and the application
+ */
+pas_receiver_t* pas_receiver_create (const char *host, uint16_t port, size_t ring_len);
+
+/**
+ * @brief Creates a receiver of the datagram stream, see pas_receiver_create()
+ * @param host sensor the subscription and commands are sent to, NULL with a group only
+ * @param group IPv4 multicast group to join, NULL to subscribe to host
+ * @param port datagram port of the sensor, 0 for 3334
+ */
+pas_receiver_t* pas_receiver_create_udp (const char *host, const char *group, uint16_t port, size_t ring_len);
+
+int pas_receiver_start (pas_receiver_t *receiver);
+
+/** @brief 1 while connected and receiving */
+int pas_receiver_running (pas_receiver_t *receiver);
+
+/**
+ * @brief Copies up to max_len samples into dst, returns the number copied.
+ * Stops before a gap, the samples copied are consecutive
+ */
+size_t pas_receiver_read (pas_receiver_t *receiver, int16_t *dst, size_t max_len);
+
+/** @brief Stream index of the next sample pas_receiver_read() copies */
+uint64_t pas_receiver_next_sample_index (pas_receiver_t *receiver);
+
+/**
+ * @brief Host time of a stream index in us (CLOCK_REALTIME), the same clock
+ * for every receiver of the process. NAN until the sensor clock is known
+ */
+double pas_receiver_sample_time (pas_receiver_t *receiver, uint64_t index);
+
+size_t pas_receiver_available (pas_receiver_t *receiver);
+
+void pas_receiver_get_stats (pas_receiver_t *receiver, pas_receiver_stats_t *stats);
+
+/**
+ * @brief Changes the ADC settings, "key=value ..." with keys rate, range, spi,
+ * sdo (single or dual), alarm_high, alarm_low and hysteresis. An empty string
+ * asks for the settings in use. The stream restarts from sample 0
+ * @return 0, -1 if the command could not be sent
+ */
+int pas_receiver_configure_adc (pas_receiver_t *receiver, const char *settings);
+
+/**
+ * @brief Latest ADC settings report of the sensor
+ * @return 1 if a report came since the last call, 0 otherwise
+ */
+int pas_receiver_read_adc_report (pas_receiver_t *receiver, pas_adc_report_t *report);
+
+/**
+ * @brief Asks for the calibration in use, also sent after a start or an ADC range change
+ * @return 0, -1 if the command could not be sent
+ */
+int pas_receiver_request_calibration (pas_receiver_t *receiver);
+
+/**
+ * @brief Latest calibration report of the sensor
+ * @return 1 if a report came since the last call, 0 otherwise
+ */
+int pas_receiver_read_calibration (pas_receiver_t *receiver, pas_calibration_report_t *report);
+
+/**
+ * @brief Asks for the baseline estimate, also sent after each charge amplifier reset
+ * @return 0, -1 if the command could not be sent
+ */
+int pas_receiver_request_baseline (pas_receiver_t *receiver);
+
+/**
+ * @brief Latest baseline report of the sensor
+ * @return 1 if a report came since the last call, 0 otherwise
+ */
+int pas_receiver_read_baseline (pas_receiver_t *receiver, pas_baseline_report_t *report);
+
+/**
+ * @brief Pops the oldest input alarm event, received on the event port (3335)
+ * @return 1 if an event was read, 0 if there is none
+ */
+int pas_receiver_read_alarm (pas_receiver_t *receiver, pas_alarm_event_t *event);
+
+/**
+ * @brief Pops the oldest complete trigger capture and copies up to max_len of
+ * its samples into dst
+ * @return 1 if a capture was read, 0 if there is none
+ */
+int pas_receiver_read_capture (pas_receiver_t *receiver, pas_capture_info_t *info, int16_t *dst, size_t max_len);
+
+/**
+ * @brief Falling (or rising) crossings with hysteresis, the firmware trigger
+ * kernel. Same result as findCross() in trigger.py on the same samples.
+ * @return number of crossing indexes written to out
+ */
+size_t pas_find_triggers (
+  const int16_t *x, size_t len, int16_t level, uint16_t hysteresis, int rising,
+  uint64_t *out, size_t max_out
+);
+
+/**
+ * @brief Pops the oldest feature report sent by the sensor
+ * @return 1 if a report was read, 0 if there is none
+ */
+int pas_receiver_read_features (pas_receiver_t *receiver, pas_feature_report_t *report);
+
+/**
+ * @brief Pops the oldest cycle report sent by the sensor
+ * @return 1 if a report was read, 0 if there is none
+ */
+int pas_receiver_read_cycle (pas_receiver_t *receiver, pas_cycle_report_t *report);
+
+/** @brief Default settings, a 720 sample four stroke cycle from -360 degrees */
+void pas_cycle_config_default (pas_cycle_config_t *config);
+
+/**
+ * @brief Metrics of n cycles, cycle i at samples + starts[i], spread over
+ * threads, 0 for one per core
+ * @return 0, -1 on an invalid configuration
+ */
+int pas_analyze_cycles (
+  const pas_cycle_config_t *config, const int16_t *samples, const uint64_t *starts, size_t n,
+  pas_cycle_metrics_t *out, unsigned threads
+);
+
+/**
+ * @brief Runs the firmware feature extractor over x, a report every
+ * fft_len * windows samples
+ * @return number of reports written to out, -1 on an invalid configuration
+ */
+int pas_extract_features (
+  const int16_t *x, size_t len, float fs, uint16_t fft_len, uint16_t windows,
+  pas_feature_report_t *out, size_t max_out
+);
+
+/**
+ * @brief Hann windowed power spectrum of len samples, the firmware FFT. The
+ * tables are built on every call, bench_features times the kernel alone
+ * @param power len / 2 + 1 bins
+ * @return 0, -1 if len is not a supported power of two
+ */
+int pas_power_spectrum (const int16_t *x, size_t len, float offset, float *power);
+
+/**
+ * @brief Writes every received sample frame to a recording, ending the
+ * running one
+ * @param range_sel ADS8689_RANGE_SEL_REG value, stored in the header
+ * @param conversion ADC counts to engineering units, stored in the header
+ */
+int pas_receiver_start_recording (pas_receiver_t *receiver, const char *path, uint16_t range_sel, double conversion);
+
+/** @brief Finishes the running recording, writing its index */
+int pas_receiver_stop_recording (pas_receiver_t *receiver);
+
+/**
+ * @brief Linear interpolation of a stream on the time grid t0 + k * out_period,
+ * to put the streams of several receivers on one time base
+ * @param first_time time of x[0], pas_receiver_sample_time() of its index
+ * @param out out_len values, NAN where the grid is outside the samples
+ * @return grid points inside the samples
+ */
+size_t pas_resample (
+  const int16_t *x, size_t len, double first_time, double period,
+  double t0, double out_period, size_t out_len, float *out
+);
+
+/**
+ * @brief Empty min/max pyramid, see pyramid.hpp
+ * @param base samples per bin of the finest level
+ * @param fanout bins of a level per bin of the next one
+ */
+pas_pyramid_t* pas_pyramid_create (uint32_t base, uint16_t fanout);
+
+/** @brief Reads a pyramid saved with a recording (file.pasp) or pas_pyramid_save() */
+pas_pyramid_t* pas_pyramid_load (const char *path);
+
+int pas_pyramid_save (pas_pyramid_t *pyramid, const char *path);
+
+void pas_pyramid_append (pas_pyramid_t *pyramid, const int16_t *x, size_t len);
+
+uint64_t pas_pyramid_size (pas_pyramid_t *pyramid);
+
+/**
+ * @brief Min, max and mean of columns of equal length over positions
+ * [begin, end), from a few bins per column
+ * @param raw samples the pyramid was built from or NULL, with them the
+ * column edges are exact
+ * @return number of columns written to out, at most columns
+ */
+size_t pas_pyramid_render (
+  pas_pyramid_t *pyramid, uint64_t begin, uint64_t end, size_t columns,
+  const int16_t *raw, pas_pyramid_bin_t *out
+);
+
+void pas_pyramid_destroy (pas_pyramid_t *pyramid);
+
+/** @brief Stops and frees the receiver */
+void pas_receiver_destroy (pas_receiver_t *receiver);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,109 @@
+/**
+ * @file pyramid.hpp
+ *
+ * @brief Min/max/mean decimation pyramid of a sample array, for plotting any
+ * window of a long recording from a couple of points per screen column.
+ *
+ * Level 0 has a bin every base samples, level l a bin every base * fanout^l
+ * samples, up to a level with a single bin. The last bin of each level holds
+ * the samples appended so far, so the pyramid is exact at any time while
+ * samples are appended.
+ *
+ * Saved next to a recording (.pasp), little endian:
+ *  - PyramidHeader, 32 bytes
+ *  - bin count of each level, uint64
+ *  - bins of level 0, then level 1, ...
+ */
+#ifndef PAS_PYRAMID_HPP
+#define PAS_PYRAMID_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace pas {
+
+constexpr uint16_t PYRAMID_VERSION = 1;
+
+#pragma pack(push, 1)
+struct PyramidBin {
+  int16_t min;
+  int16_t max;
+  float mean;
+};
+
+struct PyramidHeader {
+  char magic[4];
+  uint16_t version;
+  uint16_t fanout;
+  uint32_t base;
+  uint32_t levels;
+  uint64_t n_samples;
+  uint8_t reserved[8];
+};
+#pragma pack(pop)
+
+static_assert(sizeof(PyramidBin) == 8, "pyramid bin must have no padding");
+static_assert(sizeof(PyramidHeader) == 32, "pyramid header must have no padding");
+
+/** Pyramid file of a recording, file.pasr gives file.pasp */
+std::string pyramid_path (const std::string &recording_path);
+
+class MinMaxPyramid {
+public:
+  explicit MinMaxPyramid (uint32_t base = 64, uint16_t fanout = 8);
+
+  /** Reads a saved pyramid, throws std::system_error or std::runtime_error on a bad file */
+  static MinMaxPyramid load (const std::string &path);
+  /** Throws std::system_error */
+  void save (const std::string &path) const;
+
+  void append (const int16_t *samples, size_t len);
+  void clear ();
+
+  uint64_t size () const { return n_samples_; }
+  uint32_t base () const { return base_; }
+  uint16_t fanout () const { return fanout_; }
+  size_t levels () const { return levels_.size(); }
+  /** Samples per bin of a level */
+  uint64_t bin_len (size_t level) const { return bin_len_[level]; }
+  const std::vector<PyramidBin>& level (size_t level) const { return levels_[level]; }
+
+  /**
+   * @brief Reduces positions [begin, end) to columns of equal length, each
+   * column the min, max and mean of its samples
+   * @param raw the samples the pyramid was built from, position 0 first. With
+   * raw the columns are exact, without it a column edge is rounded out to a
+   * bin at most 1 / fanout of a column long (a level 0 bin when zoomed in)
+   * and there is at most one column per level 0 bin
+   * @returns number of columns written to out
+   */
+  size_t render (uint64_t begin, uint64_t end, size_t columns, const int16_t *raw, PyramidBin *out) const;
+
+private:
+  struct Accumulator;
+
+  void update_levels (uint64_t from);
+  void reduce (
+    size_t level, uint64_t bin, uint64_t begin, uint64_t end, const int16_t *raw, size_t floor, Accumulator &acc
+  ) const;
+
+  uint32_t base_;
+  uint16_t fanout_;
+  uint64_t n_samples_ = 0;
+  /** Sum of the samples in the last level 0 bin, the mean alone would round */
+  int64_t tail_sum_ = 0;
+  std::vector<uint64_t> bin_len_;
+  std::vector<std::vector<PyramidBin>> levels_;
+};
+
+/**
+ * @brief Min, max and sum of len samples, SIMD where the CPU has it. The
+ * building block of the pyramid, exposed for the benchmark
+ */
+void reduce_samples (const int16_t *x, size_t len, int16_t &min, int16_t &max, int64_t &sum);
+
+}
+
+#endif
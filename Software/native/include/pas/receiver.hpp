@@ -0,0 +1,376 @@
+/**
+ * @file receiver.hpp
+ *
+ * @brief Receiver for the framed sample stream of the TCP data port (3333)
+ * or of the datagram stream (3334, udp_stream.h). A background thread decodes
+ * frames straight from the socket buffer into a preallocated sample ring, the
+ * application pulls samples from it. Datagrams go through a reorder window
+ * first (stream_reorder.h), the frames that never came count as lost.
+ * Sample times are put on the host clock (clock_sync.hpp) by exchanges with
+ * the sensor over the same socket, to line up the streams of several sensors.
+ * Input alarm events come on their own port (3335, event_server.h), read by
+ * the same thread as soon as they arrive.
+ */
+#ifndef PAS_RECEIVER_HPP
+#define PAS_RECEIVER_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <cmath>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+
+#include "stream_frame.h"
+#include "stream_reorder.h"
+#include "sample_ring.h"
+#include "pas/clock_sync.hpp"
+#include "pas/recording.hpp"
+
+namespace pas {
+
+enum class Transport {
+  tcp,
+  /** Datagrams, a gap instead of a stall when the network drops frames */
+  udp
+};
+
+struct ReceiverConfig {
+  std::string host;
+  uint16_t port = 3333;
+  Transport transport = Transport::tcp;
+  /** Datagram port of the sensor, the port of the group too */
+  uint16_t udp_port = 3334;
+  /** IPv4 multicast group to join, empty to subscribe to host */
+  std::string group;
+  /** Frames held waiting for a missing one and for how long, see stream_reorder.h */
+  size_t reorder_window = 8;
+  int64_t reorder_delay_us = 20000;
+  /** Ring length in samples, rounded up to a power of two */
+  size_t ring_len = 1 << 22;
+  /** Bytes read from the socket per recv() */
+  size_t recv_len = 1 << 16;
+  /** Socket receive buffer, 0 keeps the system default */
+  int socket_buffer = 1 << 21;
+  /** Message accept_connection() expects on the server */
+  std::string handshake = "connection_request";
+  /** Complete trigger captures kept until read, oldest are dropped */
+  size_t max_captures = 16;
+  /** Feature reports kept until read, oldest are dropped */
+  size_t max_feature_reports = 256;
+  /** Cycle reports kept until read, oldest are dropped */
+  size_t max_cycle_reports = 256;
+  /** Time between two clock offset exchanges with the sensor, 0 to not align the sample times */
+  int64_t time_sync_interval_us = 100000;
+  /** Event port of the sensor, 0 to not receive the alarm events */
+  uint16_t alarm_port = 3335;
+  /** Alarm events kept until read, oldest are dropped */
+  size_t max_alarms = 256;
+};
+
+/** Window around a firmware trigger, see stream_capture_header_t */
+struct Capture {
+  uint64_t trigger_index = 0;
+  uint32_t number = 0;
+  /** Triggers the sensor missed before this one */
+  uint32_t missed = 0;
+  uint32_t pre_trigger = 0;
+  /** Time of the first sample in us */
+  int64_t timestamp = 0;
+  float sample_rate = 0;
+  /** Cut short by a gap on the sensor or frames lost on the way */
+  bool truncated = false;
+  std::vector<int16_t> samples;
+};
+
+/** On device summary of a stretch of the stream, see stream_features_t */
+struct FeatureReport {
+  uint64_t first_sample = 0;
+  /** Time of the first sample covered in us */
+  int64_t timestamp = 0;
+  float sample_rate = 0;
+  stream_features_t values = {};
+};
+
+/** Peak pressure the sensor found over an encoder cycle, see stream_cycle_t */
+struct CycleReport {
+  /** Index of the sample at angle 0 and its time in us */
+  uint64_t first_sample = 0;
+  int64_t timestamp = 0;
+  float sample_rate = 0;
+  stream_cycle_t values = {};
+};
+
+/** Driver instrumentation of the sensor, answer to request_stats(), see stream_stats_t */
+struct DeviceStats {
+  /** Last sample acquired when the stats were taken and its time in us */
+  uint64_t last_sample = 0;
+  int64_t timestamp = 0;
+  stream_stats_t values = {};
+};
+
+/** ADC settings in use, answer to configure_adc(), see stream_adc_config_t */
+struct AdcReport {
+  /** Last sample acquired when the settings were read and its time in us */
+  uint64_t last_sample = 0;
+  int64_t timestamp = 0;
+  stream_adc_config_t values = {};
+};
+
+/** Calibration the sample frames are converted with, see stream_calibration_t */
+struct CalibrationReport {
+  /** Last sample acquired when the report was sent and its time in us */
+  uint64_t last_sample = 0;
+  int64_t timestamp = 0;
+  stream_calibration_t values = {};
+  /** Bar per sample value, 0 while the samples are ADC codes */
+  double scale () const { return values.enabled ? std::ldexp(1.0, -values.frac_bits) : 0; }
+};
+
+/** Drift estimate of the charge amplifier baseline, see stream_baseline_t */
+struct BaselineReport {
+  /** Last sample corrected when the report was sent and its time in us */
+  uint64_t last_sample = 0;
+  int64_t timestamp = 0;
+  stream_baseline_t values = {};
+};
+
+/** Change of the ADC input alarm flags, see stream_alarm_t */
+struct AlarmEvent {
+  /** First sample with the new flags and its conversion time on the sensor clock, us */
+  uint64_t index = 0;
+  int64_t timestamp = 0;
+  float sample_rate = 0;
+  stream_alarm_t values = {};
+  /** Host time the frame was read, us */
+  int64_t arrival = 0;
+  /** From the conversion to the arrival on the host clock, NAN until the clocks are known */
+  double latency_us = 0;
+};
+
+struct ReceiverStats {
+  uint64_t bytes = 0;
+  uint64_t frames = 0;
+  uint64_t samples = 0;
+  uint64_t skipped_bytes = 0;
+  uint64_t lost_samples = 0;
+  uint32_t lost_frames = 0;
+  uint32_t crc_errors = 0;
+  uint32_t overrun_flags = 0;
+  /** Sample frames flagged with a charge amplifier reset */
+  uint32_t amp_resets = 0;
+  /** Sample frames tagged with a crank angle, and the tag of the last one,
+   * see stream_angle_t. angle_sample is the index of its first sample */
+  uint32_t angle_frames = 0;
+  uint64_t angle_sample = 0;
+  stream_angle_t angle = {};
+  /** Samples lost because the application did not read fast enough */
+  uint32_t ring_dropped = 0;
+  /** Frames with a valid crc whose payload could not be decoded */
+  uint32_t decode_errors = 0;
+  /** Trigger captures received and missed by the sensor */
+  uint32_t captures = 0;
+  uint32_t captures_missed = 0;
+  uint32_t feature_reports = 0;
+  uint32_t cycle_reports = 0;
+  uint32_t device_stats = 0;
+  /** Alarm events received, false while the event port is not connected */
+  uint32_t alarms = 0;
+  bool alarm_connected = false;
+  /** Samples written to the running recording */
+  uint64_t recorded = 0;
+  float sample_rate = 0;
+  /** Datagrams that waited for a missing frame, came too late or twice */
+  uint32_t reordered = 0;
+  uint32_t late_frames = 0;
+  uint32_t duplicates = 0;
+  /** Host minus sensor clock, its drift and the shortest round trip of the exchanges, see ClockSync */
+  double clock_offset_us = 0;
+  double clock_drift_ppm = 0;
+  int64_t clock_delay_us = 0;
+  uint64_t time_exchanges = 0;
+};
+
+class Receiver {
+public:
+  explicit Receiver (ReceiverConfig config);
+  ~Receiver ();
+
+  Receiver (const Receiver&) = delete;
+  Receiver& operator= (const Receiver&) = delete;
+
+  /**
+   * @brief Connects and sends the handshake, or opens the datagram socket and
+   * joins the group or subscribes. Starts the receive thread, throws std::system_error
+   */
+  void start ();
+  /** Stops the receive thread and closes the connection */
+  void stop ();
+  /** False once the connection was closed or failed, see error() */
+  bool running () const { return run_.load(std::memory_order_acquire); }
+  std::string error () const;
+
+  /**
+   * @brief Copies up to max_len samples, returns the number copied. Stops
+   * before a gap in the stream, the samples copied are consecutive
+   */
+  size_t read (int16_t *dst, size_t max_len);
+  /** Stream index (first_sample) of the next sample read() copies */
+  uint64_t next_sample_index ();
+  /** Host time (host_time_us()) of a stream index in us, NAN until the clocks are known */
+  double sample_time (uint64_t index) const;
+  /** Samples waiting to be read */
+  size_t available ();
+  /** Pops the oldest complete capture, false if there is none */
+  bool read_capture (Capture &capture);
+  /** Pops the oldest feature report, false if there is none */
+  bool read_features (FeatureReport &report);
+  /** Pops the oldest cycle report, false if there is none */
+  bool read_cycle (CycleReport &report);
+  /** Asks the sensor for its driver stats, the answer comes as a stats frame. Throws std::system_error */
+  void request_stats ();
+  /** Latest device stats not read yet, false if none came since the last call */
+  bool read_device_stats (DeviceStats &stats);
+  /**
+   * @brief Sends the "adc" command: settings as "key=value ..." (rate, range,
+   * spi, sdo, alarm_high, alarm_low, hysteresis), empty to only ask for the
+   * settings in use. The sensor restarts the stream from sample 0 and answers
+   * with an adc frame. Throws std::system_error
+   */
+  void configure_adc (const std::string &settings);
+  /** Latest adc report not read yet, false if none came since the last call */
+  bool read_adc_report (AdcReport &report);
+  /**
+   * @brief Asks for the calibration in use, the sensor also sends it after a
+   * start or an ADC range change. Throws std::system_error
+   */
+  void request_calibration ();
+  /** Latest calibration report not read yet, false if none came since the last call */
+  bool read_calibration (CalibrationReport &report);
+  /**
+   * @brief Asks for the baseline estimate, the sensor also sends it after
+   * each amplifier reset. Throws std::system_error
+   */
+  void request_baseline ();
+  /** Latest baseline report not read yet, false if none came since the last call */
+  bool read_baseline (BaselineReport &report);
+  /** Pops the oldest alarm event, false if there is none */
+  bool read_alarm (AlarmEvent &event);
+  /**
+   * @brief Writes every sample frame to a recording from the receive thread,
+   * ending the running one. Throws std::system_error
+   */
+  void start_recording (const std::string &path, RecordingInfo info);
+  /** Closes the running recording, throws std::system_error if it could not be finished */
+  void stop_recording ();
+
+  ReceiverStats stats () const;
+
+private:
+  int open_tcp ();
+  int open_udp ();
+  int open_alarm ();
+  void read_alarm_socket ();
+  void run ();
+  void run_udp ();
+  void send_command (const char *command, size_t len);
+  static void on_datagram_frame (const uint8_t *frame, size_t len, void *arg);
+  static void on_frame (const stream_frame_header_t *header, const uint8_t *payload, void *arg);
+  void on_capture_frame (const stream_frame_header_t *header, const uint8_t *payload);
+  void finish_capture ();
+  void on_features_frame (const stream_frame_header_t *header, const uint8_t *payload);
+  void on_cycle_frame (const stream_frame_header_t *header, const uint8_t *payload);
+  void on_stats_frame (const stream_frame_header_t *header, const uint8_t *payload);
+  void on_time_frame (const stream_frame_header_t *header, const uint8_t *payload);
+  void on_adc_frame (const stream_frame_header_t *header, const uint8_t *payload);
+  void on_calibration_frame (const stream_frame_header_t *header, const uint8_t *payload);
+  void on_baseline_frame (const stream_frame_header_t *header, const uint8_t *payload);
+  static void on_alarm_frame (const stream_frame_header_t *header, const uint8_t *payload, void *arg);
+  void request_time (int64_t now);
+  void write_samples (const stream_frame_header_t *header, const int16_t *samples);
+
+  ReceiverConfig config_;
+  int socket_ = -1;
+  std::thread thread_;
+  std::atomic<bool> run_{false};
+
+  std::vector<int16_t> ring_buf_;
+  sample_ring_t ring_;
+  stream_decoder_t decoder_;
+  std::vector<uint8_t> recv_buf_;
+  /* Sensor address datagram commands go to */
+  sockaddr_storage udp_peer_ = {};
+  socklen_t udp_peer_len_ = 0;
+  std::unique_ptr<stream_reorder_t> reorder_;
+  /* Event port, its own frame sequence */
+  int alarm_socket_ = -1;
+  stream_decoder_t alarm_decoder_;
+
+  mutable std::mutex stats_mutex_;
+  uint64_t bytes_ = 0;
+  uint32_t decode_errors_ = 0;
+  uint32_t amp_resets_ = 0;
+  uint32_t angle_frames_ = 0;
+  uint64_t angle_sample_ = 0;
+  stream_angle_t angle_ = {};
+  uint32_t capture_count_ = 0;
+  uint32_t captures_missed_ = 0;
+  uint32_t feature_count_ = 0;
+  uint32_t cycle_count_ = 0;
+  uint32_t device_stats_count_ = 0;
+  std::unique_ptr<RecordingWriter> recorder_;
+
+  /* Capture being assembled, only touched by the receive thread */
+  Capture assembling_;
+  bool assembling_active_ = false;
+  size_t assembling_received_ = 0;
+
+  std::mutex captures_mutex_;
+  std::deque<Capture> captures_;
+  std::mutex features_mutex_;
+  std::deque<FeatureReport> feature_reports_;
+  std::mutex cycles_mutex_;
+  std::deque<CycleReport> cycle_reports_;
+  std::mutex device_stats_mutex_;
+  DeviceStats device_stats_;
+  bool device_stats_new_ = false;
+  AdcReport adc_report_;
+  bool adc_report_new_ = false;
+  CalibrationReport calibration_;
+  bool calibration_new_ = false;
+  BaselineReport baseline_;
+  bool baseline_new_ = false;
+  std::mutex alarms_mutex_;
+  std::deque<AlarmEvent> alarms_;
+  uint32_t alarm_count_ = 0;
+  float sample_rate_ = 0;
+  std::string error_;
+
+  /* Sensor clock on the host clock and sample index on the sensor clock, under stats_mutex_ */
+  ClockSync clock_;
+  SampleClock sample_clock_;
+  /* Time requests waiting for their answer and when the last one went, receive thread only */
+  std::deque<int64_t> time_origins_;
+  int64_t last_time_request_ = 0;
+  /* Host time the bytes being decoded were read from the socket */
+  int64_t arrival_ = 0;
+
+  /* Ring position where the stream index jumps, so read() knows the index of what it copies */
+  struct RingSegment {
+    size_t ring_pos;
+    uint64_t first_sample;
+  };
+  std::mutex segments_mutex_;
+  std::deque<RingSegment> segments_;
+  uint64_t next_first_sample_ = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,174 @@
+/**
+ * @file recording.hpp
+ *
+ * @brief Binary recording of the sample stream (.pasr).
+ *
+ * Layout, little endian:
+ *  - RecordingHeader, 64 bytes
+ *  - raw int16 samples, in chunks of up to chunk_len samples written back to
+ *    back, so the whole recording is one int16 array starting at byte 64
+ *  - index, one RecordingChunk per chunk
+ *  - RecordingTrailer, 32 bytes, at the end of the file
+ *
+ * A chunk ends early where the stream had a gap, so the samples of a chunk
+ * are contiguous in the stream and sample k of chunk c was converted at
+ * c.timestamp + k / sample_rate. A file without trailer (writer killed) is
+ * read as a single chunk holding every complete sample.
+ *
+ * The writer also saves a min/max pyramid of the samples as file.pasp, see
+ * pyramid.hpp.
+ */
+#ifndef PAS_RECORDING_HPP
+#define PAS_RECORDING_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "pas/pyramid.hpp"
+
+namespace pas {
+
+constexpr uint16_t RECORDING_VERSION = 1;
+/** Chunk starts after lost samples */
+constexpr uint32_t RECORDING_CHUNK_GAP = 1u << 0;
+
+#pragma pack(push, 1)
+struct RecordingHeader {
+  char magic[4];
+  uint16_t version;
+  uint16_t header_len;
+  uint32_t chunk_len;
+  /** ADS8689_RANGE_SEL_REG value of the acquisition */
+  uint16_t range_sel;
+  uint16_t reserved;
+  double sample_rate;
+  /** Multiplier from ADC counts to engineering units */
+  double conversion;
+  /** Host time the recording started, unix us */
+  int64_t start_time;
+  /** Stream index of the first sample */
+  uint64_t first_sample;
+  uint8_t reserved_end[16];
+};
+
+struct RecordingChunk {
+  /** Position of the first sample in the sample array */
+  uint64_t offset;
+  /** Stream index and conversion time (sensor clock, us) of the first sample */
+  uint64_t first_sample;
+  int64_t timestamp;
+  uint32_t sample_count;
+  uint32_t flags;
+};
+
+struct RecordingTrailer {
+  /** Byte offset of the index */
+  uint64_t index_offset;
+  uint64_t n_chunks;
+  uint64_t n_samples;
+  char magic[4];
+  uint32_t reserved;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(RecordingHeader) == 64, "recording header must have no padding");
+static_assert(sizeof(RecordingChunk) == 32, "recording chunk must have no padding");
+static_assert(sizeof(RecordingTrailer) == 32, "recording trailer must have no padding");
+
+struct RecordingInfo {
+  /** 0 takes the rate of the first samples appended */
+  double sample_rate = 0;
+  uint16_t range_sel = 0;
+  double conversion = 1;
+  /** Unix us, 0 for now */
+  int64_t start_time = 0;
+  size_t chunk_len = 1 << 16;
+  /** Saves a MinMaxPyramid of the samples next to the recording on close */
+  bool pyramid = true;
+};
+
+/** Writes a recording, samples are buffered up to one chunk */
+class RecordingWriter {
+public:
+  /** Creates the file, throws std::system_error */
+  RecordingWriter (const std::string &path, RecordingInfo info);
+  ~RecordingWriter ();
+
+  RecordingWriter (const RecordingWriter&) = delete;
+  RecordingWriter& operator= (const RecordingWriter&) = delete;
+
+  /**
+   * @brief Appends samples as they come from the stream, a first_sample past
+   * the end of the previous append starts a chunk marked as a gap
+   * @param timestamp conversion time of samples[0], us
+   */
+  void append (uint64_t first_sample, int64_t timestamp, float sample_rate, const int16_t *samples, size_t len);
+  /** Writes the last chunk, the index, the trailer and the pyramid, throws std::system_error */
+  void close ();
+
+  uint64_t samples () const { return n_samples_ + pending_.size(); }
+  size_t chunks () const { return index_.size() + (pending_.empty() ? 0 : 1); }
+
+private:
+  void flush_chunk ();
+  void write (const void *data, size_t len);
+
+  FILE *file_ = nullptr;
+  std::string path_;
+  RecordingHeader header_ = {};
+  std::vector<int16_t> pending_;
+  RecordingChunk chunk_ = {};
+  std::vector<RecordingChunk> index_;
+  uint64_t n_samples_ = 0;
+  uint64_t next_sample_ = 0;
+  bool started_ = false;
+  bool save_pyramid_;
+  MinMaxPyramid pyramid_;
+};
+
+/** Memory mapped recording, samples are read in place */
+class RecordingReader {
+public:
+  /** Maps the file, throws std::system_error or std::runtime_error on a bad file */
+  explicit RecordingReader (const std::string &path);
+  ~RecordingReader ();
+
+  RecordingReader (const RecordingReader&) = delete;
+  RecordingReader& operator= (const RecordingReader&) = delete;
+
+  const RecordingHeader& header () const { return header_; }
+  /** All samples, valid as long as the reader */
+  const int16_t* samples () const { return samples_; }
+  uint64_t size () const { return n_samples_; }
+  const std::vector<RecordingChunk>& chunks () const { return index_; }
+  /** False if the file has no trailer and was recovered */
+  bool complete () const { return complete_; }
+
+  /** Chunk holding the sample at position pos, O(1) unless the stream had gaps */
+  size_t chunk_at (uint64_t pos) const;
+  /**
+   * @brief Position of the first sample converted at or after time, in us from
+   * the first sample. Estimated from the rate then corrected over the chunks
+   * @returns size() past the end
+   */
+  uint64_t seek (int64_t time) const;
+  /** Time of the sample at position pos, us from the first sample */
+  int64_t time_at (uint64_t pos) const;
+
+private:
+  int fd_ = -1;
+  const uint8_t *map_ = nullptr;
+  size_t map_len_ = 0;
+  RecordingHeader header_ = {};
+  const int16_t *samples_ = nullptr;
+  uint64_t n_samples_ = 0;
+  std::vector<RecordingChunk> index_;
+  bool complete_ = true;
+};
+
+}
+
+#endif
@@ -0,0 +1,25 @@
+/**
+ * @file sample_codec.hpp
+ *
+ * @brief Decoder of the compressed sample payload (STREAM_FRAME_SAMPLES_RICE),
+ * the format is described in the firmware sample_codec.h.
+ */
+#ifndef PAS_SAMPLE_CODEC_HPP
+#define PAS_SAMPLE_CODEC_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+#include "sample_codec.h"
+
+namespace pas {
+
+/**
+ * Decodes count samples from a compressed payload.
+ * @return false if the payload ends early or has an invalid block parameter
+ */
+bool decode_samples (const uint8_t *payload, size_t payload_len, int16_t *out, size_t count);
+
+}
+
+#endif
@@ -0,0 +1,191 @@
+#include "pas/clock_sync.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+namespace pas {
+
+/* Shorter spans fit the offset alone, the drift would be mostly noise */
+static const int64_t MIN_DRIFT_SPAN_US = 2000000;
+/* Share of the fitted exchanges that sets the weight scale, the fastest 1/32 */
+static const size_t SCALE_SHARE = 32;
+
+int64_t host_time_us () {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::system_clock::now().time_since_epoch()
+  ).count();
+}
+
+/* Weighted least squares y = a + b * x */
+template <typename Points, typename X, typename Y, typename W>
+static void fit_line (const Points &points, X x_of, Y y_of, W w_of, double &a, double &b) {
+  double sw = 0, sx = 0, sy = 0;
+  for (const auto &p : points) {
+    double w = w_of(p);
+    sw += w;
+    sx += w * x_of(p);
+    sy += w * y_of(p);
+  }
+  double mx = sx / sw, my = sy / sw;
+  double sxx = 0, sxy = 0;
+  for (const auto &p : points) {
+    double w = w_of(p);
+    double dx = x_of(p) - mx;
+    sxx += w * dx * dx;
+    sxy += w * dx * (y_of(p) - my);
+  }
+  b = sxx > 0 ? sxy / sxx : 0;
+  a = my - b * mx;
+}
+
+ClockSync::ClockSync (size_t window, double keep)
+  : window_(std::max<size_t>(window, 1)), keep_(std::clamp(keep, 0.0, 1.0)) {
+}
+
+void ClockSync::reset () {
+  exchanges_.clear();
+  count_ = 0;
+  ref_ = 0;
+  offset_ = 0;
+  slope_ = 0;
+}
+
+bool ClockSync::add (int64_t t1, int64_t t2, int64_t t3, int64_t t4) {
+  int64_t delay = (t4 - t1) - (t3 - t2);
+  if (t4 < t1 || t3 < t2 || delay < 0) return false;
+  Exchange e;
+  e.sensor = t2 + (t3 - t2) / 2;
+  /* Differences first, both clocks count from far apart origins */
+  e.offset = (static_cast<double>(t1 - t2) + static_cast<double>(t4 - t3)) / 2;
+  e.delay = delay;
+  /* Sensor restarted, its clock too */
+  if (!exchanges_.empty() && e.sensor < exchanges_.back().sensor) reset();
+  exchanges_.push_back(e);
+  while (exchanges_.size() > window_) exchanges_.pop_front();
+  count_++;
+  fit();
+  return true;
+}
+
+void ClockSync::fit () {
+  std::vector<const Exchange*> points;
+  points.reserve(exchanges_.size());
+  for (const Exchange &e : exchanges_) points.push_back(&e);
+  size_t kept = std::max<size_t>(1, static_cast<size_t>(std::lround(keep_ * points.size())));
+  std::sort(
+    points.begin(), points.end(),
+    [] (const Exchange *a, const Exchange *b) { return a->delay < b->delay; }
+  );
+  points.resize(kept);
+
+  /* An exchange delayed by e more than the fastest is off by up to e / 2 the
+   * way it was delayed, so it weighs 1 / (1 + (e / scale)^2). The scale is
+   * the delay of the fastest few, how much a quiet exchange varies */
+  int64_t fastest = points.front()->delay;
+  double scale = std::max<double>(1, points[kept / SCALE_SHARE]->delay - fastest);
+  auto weight = [fastest, scale] (const Exchange *e) {
+    double excess = (e->delay - fastest) / scale;
+    return 1 / (1 + excess * excess);
+  };
+
+  auto span = std::minmax_element(
+    points.begin(), points.end(),
+    [] (const Exchange *a, const Exchange *b) { return a->sensor < b->sensor; }
+  );
+  ref_ = (*span.second)->sensor;
+  bool drift = ref_ - (*span.first)->sensor >= MIN_DRIFT_SPAN_US;
+  fit_line(
+    points,
+    [this, drift] (const Exchange *e) { return drift ? static_cast<double>(e->sensor - ref_) : 0.0; },
+    [] (const Exchange *e) { return e->offset; },
+    weight, offset_, slope_
+  );
+}
+
+double ClockSync::to_host (double sensor_us) const {
+  return sensor_us + offset_ + slope_ * (sensor_us - ref_);
+}
+
+double ClockSync::to_sensor (double host_us) const {
+  return ref_ + (host_us - ref_ - offset_) / (1 + slope_);
+}
+
+double ClockSync::offset_us () const {
+  if (exchanges_.empty()) return 0;
+  return offset_ + slope_ * static_cast<double>(exchanges_.back().sensor - ref_);
+}
+
+int64_t ClockSync::min_delay_us () const {
+  int64_t delay = 0;
+  for (size_t i = 0; i < exchanges_.size(); i++) {
+    if (i == 0 || exchanges_[i].delay < delay) delay = exchanges_[i].delay;
+  }
+  return delay;
+}
+
+SampleClock::SampleClock (size_t window) : window_(std::max<size_t>(window, 2)) {
+}
+
+void SampleClock::reset () {
+  points_.clear();
+  index_ = 0;
+  time_ = 0;
+  period_ = 0;
+}
+
+void SampleClock::add (uint64_t first_sample, int64_t timestamp, float sample_rate) {
+  if (!points_.empty() && first_sample <= points_.back().index) reset();
+  points_.push_back({ first_sample, timestamp });
+  while (points_.size() > window_) points_.pop_front();
+  index_ = first_sample;
+  if (points_.size() < 2) {
+    time_ = timestamp;
+    period_ = sample_rate > 0 ? 1e6 / sample_rate : 0;
+    return;
+  }
+  fit();
+}
+
+void SampleClock::fit () {
+  /* Relative to the newest frame, where the line is used */
+  double a, b;
+  fit_line(
+    points_,
+    [this] (const Point &p) { return static_cast<double>(static_cast<int64_t>(p.index - index_)); },
+    [this] (const Point &p) { return static_cast<double>(p.time - points_.back().time); },
+    [] (const Point &) { return 1.0; }, a, b
+  );
+  time_ = points_.back().time + a;
+  period_ = b;
+}
+
+double SampleClock::time (uint64_t index) const {
+  return time_ + period_ * static_cast<double>(static_cast<int64_t>(index - index_));
+}
+
+size_t resample (
+  const int16_t *samples, size_t n, double first_time, double period,
+  double out_t0, double out_period, size_t out_n, float *out
+) {
+  size_t inside = 0;
+  for (size_t k = 0; k < out_n; k++) {
+    double x = (out_t0 + k * out_period - first_time) / period;
+    if (n == 0 || !(period > 0) || !(x >= 0) || x > n - 1) {
+      out[k] = NAN;
+      continue;
+    }
+    size_t i = static_cast<size_t>(x);
+    if (i + 1 >= n) {
+      out[k] = samples[n - 1];
+    } else {
+      double f = x - i;
+      out[k] = static_cast<float>(samples[i] + f * (samples[i + 1] - samples[i]));
+    }
+    inside++;
+  }
+  return inside;
+}
+
+}
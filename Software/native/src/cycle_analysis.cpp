@@ -0,0 +1,386 @@
+#include "pas/cycle_analysis.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "pas/pyramid.hpp"
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define PAS_CYCLE_SSE2
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define PAS_CYCLE_NEON
+#include <arm_neon.h>
+#endif
+
+namespace pas {
+
+static const double PA_PER_BAR = 1e5;
+static const double PI = 3.14159265358979323846;
+/* Fewer cycles than this per thread are not worth starting one */
+static const size_t MIN_THREAD_CYCLES = 64;
+
+double EngineGeometry::displacement () const {
+  double area = PI / 4 * bore * bore * 1e-6;
+  return area * stroke * 1e-3;
+}
+
+double EngineGeometry::volume (double angle) const {
+  double area = PI / 4 * bore * bore * 1e-6;
+  double r = stroke / 2 * 1e-3, l = conrod * 1e-3;
+  double a = angle * PI / 180;
+  double s = std::sin(a);
+  double travel = r + l - r * std::cos(a) - std::sqrt(l * l - r * r * s * s);
+  return displacement() / (compression_ratio - 1) + area * travel;
+}
+
+namespace {
+
+/* Samples to bar, with the sum of p * w1 and p * w2 */
+void convert_dot_scalar (
+  const int16_t *x, size_t n, float scale, float offset, const float *w1, const float *w2, float *p, float &d1, float &d2
+) {
+  float s1 = 0, s2 = 0;
+  for (size_t i = 0; i < n; i++) {
+    float v = x[i] * scale + offset;
+    p[i] = v;
+    s1 += v * w1[i];
+    s2 += v * w2[i];
+  }
+  d1 = s1;
+  d2 = s2;
+}
+
+/* dq[i] = a[i] p[i] + c[i] (p[i + 1] - p[i - 1]) over [begin, end), 0 < begin, end < length of p */
+void heat_release_scalar (const float *p, const float *a, const float *c, size_t begin, size_t end, float *dq) {
+  for (size_t i = begin; i < end; i++) dq[i] = a[i] * p[i] + c[i] * (p[i + 1] - p[i - 1]);
+}
+
+#ifdef PAS_CYCLE_SSE2
+float sum_sse2 (__m128 v) {
+  float lanes[4];
+  _mm_storeu_ps(lanes, v);
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+void convert_dot_sse2 (
+  const int16_t *x, size_t n, float scale, float offset, const float *w1, const float *w2, float *p, float &d1, float &d2
+) {
+  const __m128 vs = _mm_set1_ps(scale), vo = _mm_set1_ps(offset);
+  __m128 a1 = _mm_setzero_ps(), b1 = _mm_setzero_ps(), a2 = _mm_setzero_ps(), b2 = _mm_setzero_ps();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+    /* Sign extended by the arithmetic shift of each sample doubled up */
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+    __m128 p0 = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(lo), vs), vo);
+    __m128 p1 = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(hi), vs), vo);
+    _mm_storeu_ps(p + i, p0);
+    _mm_storeu_ps(p + i + 4, p1);
+    a1 = _mm_add_ps(a1, _mm_mul_ps(p0, _mm_loadu_ps(w1 + i)));
+    b1 = _mm_add_ps(b1, _mm_mul_ps(p1, _mm_loadu_ps(w1 + i + 4)));
+    a2 = _mm_add_ps(a2, _mm_mul_ps(p0, _mm_loadu_ps(w2 + i)));
+    b2 = _mm_add_ps(b2, _mm_mul_ps(p1, _mm_loadu_ps(w2 + i + 4)));
+  }
+  float t1, t2;
+  convert_dot_scalar(x + i, n - i, scale, offset, w1 + i, w2 + i, p + i, t1, t2);
+  d1 = sum_sse2(_mm_add_ps(a1, b1)) + t1;
+  d2 = sum_sse2(_mm_add_ps(a2, b2)) + t2;
+}
+
+void heat_release_sse2 (const float *p, const float *a, const float *c, size_t begin, size_t end, float *dq) {
+  size_t i = begin;
+  for (; i + 4 <= end; i += 4) {
+    __m128 dp = _mm_sub_ps(_mm_loadu_ps(p + i + 1), _mm_loadu_ps(p + i - 1));
+    __m128 v = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(p + i)), _mm_mul_ps(_mm_loadu_ps(c + i), dp));
+    _mm_storeu_ps(dq + i, v);
+  }
+  heat_release_scalar(p, a, c, i, end, dq);
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define PAS_CYCLE_AVX2
+/* Built for AVX2 and FMA whatever the compiler flags, used if the CPU has them */
+__attribute__((target("avx2,fma")))
+float sum_avx2 (__m256 v) {
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  float lanes[4];
+  _mm_storeu_ps(lanes, s);
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+__attribute__((target("avx2,fma")))
+void convert_dot_avx2 (
+  const int16_t *x, size_t n, float scale, float offset, const float *w1, const float *w2, float *p, float &d1, float &d2
+) {
+  const __m256 vs = _mm256_set1_ps(scale), vo = _mm256_set1_ps(offset);
+  __m256 a1 = _mm256_setzero_ps(), b1 = _mm256_setzero_ps(), a2 = _mm256_setzero_ps(), b2 = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i)));
+    __m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i + 8)));
+    __m256 p0 = _mm256_fmadd_ps(_mm256_cvtepi32_ps(lo), vs, vo);
+    __m256 p1 = _mm256_fmadd_ps(_mm256_cvtepi32_ps(hi), vs, vo);
+    _mm256_storeu_ps(p + i, p0);
+    _mm256_storeu_ps(p + i + 8, p1);
+    a1 = _mm256_fmadd_ps(p0, _mm256_loadu_ps(w1 + i), a1);
+    b1 = _mm256_fmadd_ps(p1, _mm256_loadu_ps(w1 + i + 8), b1);
+    a2 = _mm256_fmadd_ps(p0, _mm256_loadu_ps(w2 + i), a2);
+    b2 = _mm256_fmadd_ps(p1, _mm256_loadu_ps(w2 + i + 8), b2);
+  }
+  float t1, t2;
+  convert_dot_scalar(x + i, n - i, scale, offset, w1 + i, w2 + i, p + i, t1, t2);
+  d1 = sum_avx2(_mm256_add_ps(a1, b1)) + t1;
+  d2 = sum_avx2(_mm256_add_ps(a2, b2)) + t2;
+}
+
+__attribute__((target("avx2,fma")))
+void heat_release_avx2 (const float *p, const float *a, const float *c, size_t begin, size_t end, float *dq) {
+  size_t i = begin;
+  for (; i + 8 <= end; i += 8) {
+    __m256 dp = _mm256_sub_ps(_mm256_loadu_ps(p + i + 1), _mm256_loadu_ps(p + i - 1));
+    __m256 v = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(p + i), _mm256_mul_ps(_mm256_loadu_ps(c + i), dp));
+    _mm256_storeu_ps(dq + i, v);
+  }
+  heat_release_scalar(p, a, c, i, end, dq);
+}
+#endif
+#endif
+
+#ifdef PAS_CYCLE_NEON
+void convert_dot_neon (
+  const int16_t *x, size_t n, float scale, float offset, const float *w1, const float *w2, float *p, float &d1, float &d2
+) {
+  const float32x4_t vs = vdupq_n_f32(scale), vo = vdupq_n_f32(offset);
+  float32x4_t a1 = vdupq_n_f32(0), b1 = vdupq_n_f32(0), a2 = vdupq_n_f32(0), b2 = vdupq_n_f32(0);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    int16x8_t v = vld1q_s16(x + i);
+    float32x4_t p0 = vfmaq_f32(vo, vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), vs);
+    float32x4_t p1 = vfmaq_f32(vo, vcvtq_f32_s32(vmovl_high_s16(v)), vs);
+    vst1q_f32(p + i, p0);
+    vst1q_f32(p + i + 4, p1);
+    a1 = vfmaq_f32(a1, p0, vld1q_f32(w1 + i));
+    b1 = vfmaq_f32(b1, p1, vld1q_f32(w1 + i + 4));
+    a2 = vfmaq_f32(a2, p0, vld1q_f32(w2 + i));
+    b2 = vfmaq_f32(b2, p1, vld1q_f32(w2 + i + 4));
+  }
+  float t1, t2;
+  convert_dot_scalar(x + i, n - i, scale, offset, w1 + i, w2 + i, p + i, t1, t2);
+  d1 = vaddvq_f32(vaddq_f32(a1, b1)) + t1;
+  d2 = vaddvq_f32(vaddq_f32(a2, b2)) + t2;
+}
+
+void heat_release_neon (const float *p, const float *a, const float *c, size_t begin, size_t end, float *dq) {
+  size_t i = begin;
+  for (; i + 4 <= end; i += 4) {
+    float32x4_t dp = vsubq_f32(vld1q_f32(p + i + 1), vld1q_f32(p + i - 1));
+    vst1q_f32(dq + i, vfmaq_f32(vmulq_f32(vld1q_f32(c + i), dp), vld1q_f32(a + i), vld1q_f32(p + i)));
+  }
+  heat_release_scalar(p, a, c, i, end, dq);
+}
+#endif
+
+struct Kernels {
+  const char *name;
+  void (*convert_dot) (const int16_t*, size_t, float, float, const float*, const float*, float*, float&, float&);
+  void (*heat_release) (const float*, const float*, const float*, size_t, size_t, float*);
+};
+
+Kernels select_kernels () {
+#if defined(PAS_CYCLE_AVX2)
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return { "avx2", convert_dot_avx2, heat_release_avx2 };
+  }
+#endif
+#if defined(PAS_CYCLE_SSE2)
+  return { "sse2", convert_dot_sse2, heat_release_sse2 };
+#elif defined(PAS_CYCLE_NEON)
+  return { "neon", convert_dot_neon, heat_release_neon };
+#else
+  return { "scalar", convert_dot_scalar, heat_release_scalar };
+#endif
+}
+
+const Kernels kernels = select_kernels();
+
+/* Angle moved into [-cycle_deg / 2, cycle_deg / 2), firing TDC at 0 */
+double wrap_angle (double angle, double cycle_deg) {
+  double a = std::fmod(angle + cycle_deg / 2, cycle_deg);
+  if (a < 0) a += cycle_deg;
+  return a - cycle_deg / 2;
+}
+
+}
+
+const char* cycle_kernels () {
+  return kernels.name;
+}
+
+/* Samples of a window of angles, the window may not cross the end of the cycle */
+static void window_samples (const CycleAnalyzer &analyzer, double from, double to, size_t &begin, size_t &end, const char *what) {
+  const CycleAnalysisConfig &c = analyzer.config();
+  double step = c.cycle_deg / c.cycle_len;
+  double start = from - c.first_angle;
+  start -= std::floor(start / c.cycle_deg) * c.cycle_deg;
+  double stop = start + (to - from);
+  if (!(to > from) || stop > c.cycle_deg) {
+    throw std::invalid_argument(std::string(what) + " window must lie inside the cycle");
+  }
+  begin = (size_t) std::ceil(start / step - 1e-9);
+  end = std::min((size_t) std::floor(stop / step + 1e-9) + 1, (size_t) c.cycle_len);
+}
+
+CycleAnalyzer::CycleAnalyzer (const CycleAnalysisConfig &config) : config_(config) {
+  const EngineGeometry &g = config.geometry;
+  if (!(g.bore > 0 && g.stroke > 0 && g.conrod > g.stroke / 2 && g.compression_ratio > 1)) {
+    throw std::invalid_argument("invalid engine geometry");
+  }
+  if (config.cycle_len < 8 || !(config.cycle_deg > 0)) throw std::invalid_argument("invalid cycle length");
+  if (!(config.scale > 0)) throw std::invalid_argument("scale must be positive");
+  if (!(config.gamma > 1)) throw std::invalid_argument("gamma must be above 1");
+
+  size_t n = config.cycle_len;
+  step_ = config.cycle_deg / n;
+  double vd = g.displacement();
+  work_net_.resize(n);
+  work_gross_.resize(n);
+  hr_p_.assign(n, 0);
+  hr_dp_.assign(n, 0);
+  std::vector<double> dv(n);
+  for (size_t i = 0; i < n; i++) {
+    double a = wrap_angle(angle(i), config.cycle_deg);
+    double lo = a - step_ / 2, hi = a + step_ / 2;
+    dv[i] = g.volume(hi) - g.volume(lo);
+    work_net_[i] = (float) (dv[i] / vd);
+    /* Clipped to compression and expansion, so the gross work closes too */
+    double glo = std::max(lo, -180.0), ghi = std::min(hi, 180.0);
+    work_gross_[i] = ghi > glo ? (float) ((g.volume(ghi) - g.volume(glo)) / vd) : 0.0f;
+  }
+
+  window_samples(*this, config.hr_start, config.hr_end, hr_begin_, hr_end_, "heat release");
+  /* The pressure derivative needs a sample on each side */
+  hr_begin_ = std::max(hr_begin_, (size_t) 1);
+  hr_end_ = std::min(hr_end_, n - 1);
+  if (hr_end_ < hr_begin_ + 2) throw std::invalid_argument("heat release window shorter than two samples");
+  double k = 1 / (config.gamma - 1);
+  for (size_t i = hr_begin_; i < hr_end_; i++) {
+    hr_p_[i] = (float) (config.gamma * k * dv[i] * PA_PER_BAR);
+    hr_dp_[i] = (float) (k * g.volume(angle(i)) * PA_PER_BAR / 2);
+  }
+
+  if (config.peg_len > 0) {
+    window_samples(*this, config.peg_angle, config.peg_angle + config.peg_len, peg_begin_, peg_end_, "peg");
+    if (peg_end_ <= peg_begin_) throw std::invalid_argument("peg window holds no sample");
+  }
+}
+
+CycleMetrics CycleAnalyzer::analyze (const int16_t *cycle, float *hrr) const {
+  thread_local std::vector<float> p, dq;
+  size_t n = config_.cycle_len;
+  p.resize(n);
+  dq.resize(n);
+  CycleMetrics m;
+
+  double scale = config_.scale, offset = config_.offset;
+  if (peg_end_ > peg_begin_) {
+    int64_t sum = 0;
+    for (size_t i = peg_begin_; i < peg_end_; i++) sum += cycle[i];
+    offset = config_.peg_bar - scale * (double) sum / (double) (peg_end_ - peg_begin_);
+  }
+
+  float net, gross;
+  kernels.convert_dot(cycle, n, (float) scale, (float) offset, work_net_.data(), work_gross_.data(), p.data(), net, gross);
+  m.imep_net = net;
+  m.imep_gross = gross;
+  m.pmep = net - gross;
+
+  int16_t lo, hi;
+  int64_t sum;
+  reduce_samples(cycle, n, lo, hi, sum);
+  size_t hi_at = std::find(cycle, cycle + n, hi) - cycle;
+  m.p_max = (float) (hi * scale + offset);
+  m.p_max_angle = (float) angle(hi_at);
+  m.p_min = (float) (lo * scale + offset);
+  m.p_pp = (float) ((hi - lo) * scale);
+
+  kernels.heat_release(p.data(), hr_p_.data(), hr_dp_.data(), hr_begin_, hr_end_, dq.data());
+  if (hrr != nullptr) {
+    std::fill(hrr, hrr + n, 0.0f);
+    for (size_t i = hr_begin_; i < hr_end_; i++) hrr[i] = (float) (dq[i] / step_);
+  }
+
+  /* Accumulated in place, q[i] is the heat released up to half a step after sample i */
+  double q = 0, q_max = 0, hrr_max = -INFINITY, dp_max = -INFINITY;
+  size_t max_at = hr_begin_ - 1, hrr_at = hr_begin_, dp_at = hr_begin_;
+  for (size_t i = hr_begin_; i < hr_end_; i++) {
+    if (dq[i] > hrr_max) {
+      hrr_max = dq[i];
+      hrr_at = i;
+    }
+    float dp = p[i + 1] - p[i - 1];
+    if (dp > dp_max) {
+      dp_max = dp;
+      dp_at = i;
+    }
+    q += dq[i];
+    dq[i] = (float) q;
+    if (q > q_max) {
+      q_max = q;
+      max_at = i;
+    }
+  }
+  m.hrr_max = (float) (hrr_max / step_);
+  m.hrr_max_angle = (float) angle(hrr_at);
+  m.dp_max = (float) (dp_max / 2 / step_);
+  m.dp_max_angle = (float) angle(dp_at);
+
+  /* Lowest point before the highest, the start of combustion */
+  double q_min = 0;
+  size_t min_at = hr_begin_ - 1;
+  for (size_t i = hr_begin_; i <= max_at && i < hr_end_; i++) {
+    if (dq[i] < q_min) {
+      q_min = dq[i];
+      min_at = i;
+    }
+  }
+  m.heat_release = (float) (q_max - q_min);
+  float *burn[3] = { &m.ca10, &m.ca50, &m.ca90 };
+  const double fractions[3] = { 0.1, 0.5, 0.9 };
+  for (int f = 0; f < 3; f++) {
+    if (!(q_max > q_min)) {
+      *burn[f] = NAN;
+      continue;
+    }
+    double target = q_min + fractions[f] * (q_max - q_min);
+    double prev = q_min;
+    size_t i = min_at + 1;
+    while (i < max_at && dq[i] < target) prev = dq[i++];
+    double frac = dq[i] > prev ? (target - prev) / (dq[i] - prev) : 1;
+    /* Crossed between half a step before and half a step after sample i */
+    *burn[f] = (float) angle((double) i - 0.5 + frac);
+  }
+  return m;
+}
+
+void CycleAnalyzer::analyze (const int16_t *samples, const uint64_t *starts, size_t n, CycleMetrics *out, unsigned threads) const {
+  if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = (unsigned) std::min<size_t>(threads, std::max<size_t>(1, n / MIN_THREAD_CYCLES));
+  auto run = [&] (size_t from, size_t to) {
+    for (size_t i = from; i < to; i++) out[i] = analyze(samples + starts[i]);
+  };
+  std::vector<std::thread> workers;
+  size_t per_thread = (n + threads - 1) / threads;
+  for (unsigned t = 1; t < threads; t++) {
+    size_t from = std::min(n, t * per_thread), to = std::min(n, from + per_thread);
+    workers.emplace_back(run, from, to);
+  }
+  run(0, std::min(n, per_thread));
+  for (std::thread &w : workers) w.join();
+}
+
+}
@@ -0,0 +1,423 @@
+#include "pas/pas_native.h"
+#include "pas/receiver.hpp"
+#include "pas/pyramid.hpp"
+#include "pas/clock_sync.hpp"
+#include "pas/cycle_analysis.hpp"
+#include "trigger.h"
+#include "feature_extractor.h"
+#include "fft.h"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <vector>
+
+struct pas_receiver {
+  pas::Receiver receiver;
+  explicit pas_receiver (pas::ReceiverConfig config) : receiver(std::move(config)) {}
+};
+
+struct pas_pyramid {
+  pas::MinMaxPyramid pyramid;
+  explicit pas_pyramid (pas::MinMaxPyramid p) : pyramid(std::move(p)) {}
+};
+
+static_assert(sizeof(pas_pyramid_bin_t) == sizeof(pas::PyramidBin), "pyramid bin layout");
+
+static thread_local std::string last_error;
+
+const char* pas_last_error () {
+  return last_error.c_str();
+}
+
+pas_receiver_t* pas_receiver_create (const char *host, uint16_t port, size_t ring_len) {
+  try {
+    pas::ReceiverConfig config;
+    config.host = host;
+    config.port = port;
+    if (ring_len > 0) config.ring_len = ring_len;
+    return new pas_receiver(config);
+  } catch (const std::exception &e) {
+    last_error = e.what();
+    return nullptr;
+  }
+}
+
+pas_receiver_t* pas_receiver_create_udp (const char *host, const char *group, uint16_t port, size_t ring_len) {
+  try {
+    pas::ReceiverConfig config;
+    config.transport = pas::Transport::udp;
+    if (host != nullptr) config.host = host;
+    if (group != nullptr) config.group = group;
+    if (port > 0) config.udp_port = port;
+    if (ring_len > 0) config.ring_len = ring_len;
+    return new pas_receiver(config);
+  } catch (const std::exception &e) {
+    last_error = e.what();
+    return nullptr;
+  }
+}
+
+int pas_receiver_start (pas_receiver_t *receiver) {
+  try {
+    receiver->receiver.start();
+    return 0;
+  } catch (const std::exception &e) {
+    last_error = e.what();
+    return -1;
+  }
+}
+
+int pas_receiver_running (pas_receiver_t *receiver) {
+  return receiver->receiver.running() ? 1 : 0;
+}
+
+size_t pas_receiver_read (pas_receiver_t *receiver, int16_t *dst, size_t max_len) {
+  return receiver->receiver.read(dst, max_len);
+}
+
+uint64_t pas_receiver_next_sample_index (pas_receiver_t *receiver) {
+  return receiver->receiver.next_sample_index();
+}
+
+double pas_receiver_sample_time (pas_receiver_t *receiver, uint64_t index) {
+  return receiver->receiver.sample_time(index);
+}
+
+size_t pas_receiver_available (pas_receiver_t *receiver) {
+  return receiver->receiver.available();
+}
+
+void pas_receiver_get_stats (pas_receiver_t *receiver, pas_receiver_stats_t *stats) {
+  pas::ReceiverStats s = receiver->receiver.stats();
+  stats->bytes = s.bytes;
+  stats->frames = s.frames;
+  stats->samples = s.samples;
+  stats->skipped_bytes = s.skipped_bytes;
+  stats->lost_samples = s.lost_samples;
+  stats->lost_frames = s.lost_frames;
+  stats->crc_errors = s.crc_errors;
+  stats->overrun_flags = s.overrun_flags;
+  stats->amp_resets = s.amp_resets;
+  stats->ring_dropped = s.ring_dropped;
+  stats->decode_errors = s.decode_errors;
+  stats->captures = s.captures;
+  stats->captures_missed = s.captures_missed;
+  stats->feature_reports = s.feature_reports;
+  stats->sample_rate = s.sample_rate;
+  stats->reordered = s.reordered;
+  stats->late_frames = s.late_frames;
+  stats->duplicates = s.duplicates;
+  stats->time_exchanges = static_cast<uint32_t>(s.time_exchanges);
+  stats->clock_delay_us = static_cast<uint32_t>(s.clock_delay_us);
+  stats->clock_offset_us = s.clock_offset_us;
+  stats->clock_drift_ppm = static_cast<float>(s.clock_drift_ppm);
+  stats->alarms = s.alarms;
+  stats->alarm_connected = s.alarm_connected ? 1 : 0;
+  stats->angle_frames = s.angle_frames;
+  stats->angle_sample = s.angle_sample;
+  stats->angle_cycle = s.angle.cycle;
+  stats->angle = s.angle.angle;
+  stats->angle_cycle_len = s.angle.cycle_len;
+  stats->angle_sync_errors = s.angle.sync_errors;
+  stats->cycle_reports = s.cycle_reports;
+}
+
+int pas_receiver_read_capture (pas_receiver_t *receiver, pas_capture_info_t *info, int16_t *dst, size_t max_len) {
+  pas::Capture capture;
+  if (!receiver->receiver.read_capture(capture)) return 0;
+  info->trigger_index = capture.trigger_index;
+  info->timestamp = capture.timestamp;
+  info->number = capture.number;
+  info->missed = capture.missed;
+  info->pre_trigger = capture.pre_trigger;
+  info->length = capture.samples.size();
+  info->sample_rate = capture.sample_rate;
+  info->truncated = capture.truncated ? 1 : 0;
+  std::memcpy(dst, capture.samples.data(), std::min(max_len, capture.samples.size()) * sizeof(int16_t));
+  return 1;
+}
+
+size_t pas_find_triggers (
+  const int16_t *x, size_t len, int16_t level, uint16_t hysteresis, int rising,
+  uint64_t *out, size_t max_out
+) {
+  trigger_config_t config = {};
+  config.level = level;
+  config.hysteresis = hysteresis;
+  config.slope = rising ? TRIGGER_RISING : TRIGGER_FALLING;
+  trigger_detector_t detector;
+  trigger_detector_init(&detector, &config);
+  return trigger_find_all(&detector, x, len, out, max_out);
+}
+
+int pas_receiver_configure_adc (pas_receiver_t *receiver, const char *settings) {
+  try {
+    receiver->receiver.configure_adc(settings != nullptr ? settings : "");
+    return 0;
+  } catch (const std::exception &e) {
+    last_error = e.what();
+    return -1;
+  }
+}
+
+int pas_receiver_read_adc_report (pas_receiver_t *receiver, pas_adc_report_t *report) {
+  pas::AdcReport r;
+  if (!receiver->receiver.read_adc_report(r)) return 0;
+  const stream_adc_config_t &v = r.values;
+  *report = {
+    r.last_sample, v.requested_rate, v.sample_rate, v.spi_clock, v.range, v.sdo_mode,
+    v.alarm_hysteresis, v.rejected, v.alarm_high, v.alarm_low
+  };
+  return 1;
+}
+
+int pas_receiver_request_calibration (pas_receiver_t *receiver) {
+  try {
+    receiver->receiver.request_calibration();
+    return 0;
+  } catch (const std::exception &e) {
+    last_error = e.what();
+    return -1;
+  }
+}
+
+int pas_receiver_read_calibration (pas_receiver_t *receiver, pas_calibration_report_t *report) {
+  pas::CalibrationReport r;
+  if (!receiver->receiver.read_calibration(r)) return 0;
+  const stream_calibration_t &v = r.values;
+  *report = {
+    r.last_sample, v.hash, v.frac_bits, v.enabled, v.range, v.lsb_volts, v.gain, v.offset,
+    v.amp_range_pc, v.amp_full_scale_v, v.sensitivity, v.sensitivity_drift, v.zero_drift,
+    v.reference_temp, v.temperature, r.scale()
+  };
+  return 1;
+}
+
+int pas_receiver_request_baseline (pas_receiver_t *receiver) {
+  try {
+    receiver->receiver.request_baseline();
+    return 0;
+  } catch (const std::exception &e) {
+    last_error = e.what();
+    return -1;
+  }
+}
+
+int pas_receiver_read_baseline (pas_receiver_t *receiver, pas_baseline_report_t *report) {
+  pas::BaselineReport r;
+  if (!receiver->receiver.read_baseline(r)) return 0;
+  const stream_baseline_t &v = r.values;
+  *report = {
+    r.last_sample, v.reset_index, v.resets, v.pegs, v.level, v.rest, v.drift,
+    v.reference, v.peg, v.reset_pending
+  };
+  return 1;
+}
+
+int pas_receiver_read_alarm (pas_receiver_t *receiver, pas_alarm_event_t *event) {
+  pas::AlarmEvent e;
+  if (!receiver->receiver.read_alarm(e)) return 0;
+  const stream_alarm_t &v = e.values;
+  *event = {
+    e.index, e.timestamp, v.detected, v.sent, e.arrival, e.latency_us, v.number, v.lost,
+    v.latency_max_us, v.sample, v.flags, v.previous, e.sample_rate
+  };
+  return 1;
+}
+
+int pas_receiver_read_features (pas_receiver_t *receiver, pas_feature_report_t *report) {
+  pas::FeatureReport r;
+  if (!receiver->receiver.read_features(r)) return 0;
+  const stream_features_t &v = r.values;
+  *report = {
+    r.first_sample, r.timestamp, r.sample_rate, v.length, v.min, v.max,
+    v.mean, v.ac_rms, v.dominant_freq, v.dominant_amplitude, v.fft_len, v.windows
+  };
+  return 1;
+}
+
+int pas_receiver_read_cycle (pas_receiver_t *receiver, pas_cycle_report_t *report) {
+  pas::CycleReport r;
+  if (!receiver->receiver.read_cycle(r)) return 0;
+  const stream_cycle_t &v = r.values;
+  *report = { r.first_sample, r.timestamp, v.cycle, v.cycle_len, v.max, v.max_angle, v.min, v.min_angle };
+  return 1;
+}
+
+void pas_cycle_config_default (pas_cycle_config_t *config) {
+  pas::CycleAnalysisConfig c;
+  const pas::EngineGeometry &g = c.geometry;
+  *config = {
+    g.bore, g.stroke, g.conrod, g.compression_ratio, c.cycle_len, c.cycle_deg, c.first_angle,
+    c.scale, c.offset, c.peg_angle, c.peg_len, c.peg_bar, c.gamma, c.hr_start, c.hr_end
+  };
+}
+
+int pas_analyze_cycles (
+  const pas_cycle_config_t *config, const int16_t *samples, const uint64_t *starts, size_t n,
+  pas_cycle_metrics_t *out, unsigned threads
+) {
+  pas::CycleAnalysisConfig c;
+  c.geometry.bore = config->bore;
+  c.geometry.stroke = config->stroke;
+  c.geometry.conrod = config->conrod;
+  c.geometry.compression_ratio = config->compression_ratio;
+  c.cycle_len = config->cycle_len;
+  c.cycle_deg = config->cycle_deg;
+  c.first_angle = config->first_angle;
+  c.scale = config->scale;
+  c.offset = config->offset;
+  c.peg_angle = config->peg_angle;
+  c.peg_len = config->peg_len;
+  c.peg_bar = config->peg_bar;
+  c.gamma = config->gamma;
+  c.hr_start = config->hr_start;
+  c.hr_end = config->hr_end;
+  try {
+    pas::CycleAnalyzer analyzer(c);
+    std::vector<pas::CycleMetrics> metrics(n);
+    analyzer.analyze(samples, starts, n, metrics.data(), threads);
+    for (size_t i = 0; i < n; i++) {
+      const pas::CycleMetrics &m = metrics[i];
+      out[i] = {
+        m.p_max, m.p_max_angle, m.p_min, m.p_pp, m.imep_net, m.imep_gross, m.pmep, m.heat_release,
+        m.hrr_max, m.hrr_max_angle, m.ca10, m.ca50, m.ca90, m.dp_max, m.dp_max_angle
+      };
+    }
+    return 0;
+  } catch (const std::exception &e) {
+    last_error = e.what();
+    return -1;
+  }
+}
+
+namespace {
+
+struct ExtractOutput {
+  pas_feature_report_t *out;
+  size_t max_out;
+  size_t count;
+  float fs;
+  feature_config_t config;
+};
+
+void on_report (const feature_report_t *report, void *arg) {
+  ExtractOutput *o = static_cast<ExtractOutput*>(arg);
+  if (o->count >= o->max_out) return;
+  o->out[o->count++] = {
+    report->first_sample, 0, o->fs, report->length, report->min, report->max,
+    report->mean, report->ac_rms, report->dominant_freq, report->dominant_amplitude,
+    o->config.fft_len, o->config.windows
+  };
+}
+
+}
+
+int pas_extract_features (
+  const int16_t *x, size_t len, float fs, uint16_t fft_len, uint16_t windows,
+  pas_feature_report_t *out, size_t max_out
+) {
+  ExtractOutput output = { out, max_out, 0, fs, { fft_len, windows } };
+  feature_extractor_t extractor;
+  if (!feature_extractor_init(&extractor, &output.config, on_report, &output)) {
+    last_error = "invalid feature configuration";
+    return -1;
+  }
+  feature_extractor_process(&extractor, x, len, fs);
+  feature_extractor_free(&extractor);
+  return (int) output.count;
+}
+
+int pas_power_spectrum (const int16_t *x, size_t len, float offset, float *power) {
+  fft_real_t fft;
+  if (!fft_real_init(&fft, len)) {
+    last_error = "unsupported fft length";
+    return -1;
+  }
+  fft_real_power(&fft, x, offset, power);
+  fft_real_free(&fft);
+  return 0;
+}
+
+int pas_receiver_start_recording (pas_receiver_t *receiver, const char *path, uint16_t range_sel, double conversion) {
+  try {
+    pas::RecordingInfo info;
+    info.range_sel = range_sel;
+    info.conversion = conversion;
+    receiver->receiver.start_recording(path, info);
+    return 0;
+  } catch (const std::exception &e) {
+    last_error = e.what();
+    return -1;
+  }
+}
+
+int pas_receiver_stop_recording (pas_receiver_t *receiver) {
+  try {
+    receiver->receiver.stop_recording();
+    return 0;
+  } catch (const std::exception &e) {
+    last_error = e.what();
+    return -1;
+  }
+}
+
+size_t pas_resample (
+  const int16_t *x, size_t len, double first_time, double period,
+  double t0, double out_period, size_t out_len, float *out
+) {
+  return pas::resample(x, len, first_time, period, t0, out_period, out_len, out);
+}
+
+pas_pyramid_t* pas_pyramid_create (uint32_t base, uint16_t fanout) {
+  try {
+    return new pas_pyramid(pas::MinMaxPyramid(base, fanout));
+  } catch (const std::exception &e) {
+    last_error = e.what();
+    return nullptr;
+  }
+}
+
+pas_pyramid_t* pas_pyramid_load (const char *path) {
+  try {
+    return new pas_pyramid(pas::MinMaxPyramid::load(path));
+  } catch (const std::exception &e) {
+    last_error = e.what();
+    return nullptr;
+  }
+}
+
+int pas_pyramid_save (pas_pyramid_t *pyramid, const char *path) {
+  try {
+    pyramid->pyramid.save(path);
+    return 0;
+  } catch (const std::exception &e) {
+    last_error = e.what();
+    return -1;
+  }
+}
+
+void pas_pyramid_append (pas_pyramid_t *pyramid, const int16_t *x, size_t len) {
+  pyramid->pyramid.append(x, len);
+}
+
+uint64_t pas_pyramid_size (pas_pyramid_t *pyramid) {
+  return pyramid->pyramid.size();
+}
+
+size_t pas_pyramid_render (
+  pas_pyramid_t *pyramid, uint64_t begin, uint64_t end, size_t columns,
+  const int16_t *raw, pas_pyramid_bin_t *out
+) {
+  return pyramid->pyramid.render(begin, end, columns, raw, reinterpret_cast<pas::PyramidBin*>(out));
+}
+
+void pas_pyramid_destroy (pas_pyramid_t *pyramid) {
+  delete pyramid;
+}
+
+void pas_receiver_destroy (pas_receiver_t *receiver) {
+  delete receiver;
+}
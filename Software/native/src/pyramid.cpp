@@ -0,0 +1,349 @@
+#include "pas/pyramid.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <system_error>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define PAS_PYRAMID_SSE2
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define PAS_PYRAMID_NEON
+#include <arm_neon.h>
+#endif
+
+namespace pas {
+
+static const char PYRAMID_MAGIC[4] = { 'P', 'A', 'S', 'P' };
+/* Samples summed in 32 bit lanes before widening, far from overflowing */
+static const size_t SUM_BLOCK = 1 << 16;
+
+namespace {
+
+void reduce_scalar (const int16_t *x, size_t len, int16_t &min, int16_t &max, int64_t &sum) {
+  int16_t mn = std::numeric_limits<int16_t>::max(), mx = std::numeric_limits<int16_t>::min();
+  int64_t s = 0;
+  for (size_t i = 0; i < len; i++) {
+    mn = std::min(mn, x[i]);
+    mx = std::max(mx, x[i]);
+    s += x[i];
+  }
+  min = mn;
+  max = mx;
+  sum = s;
+}
+
+#ifdef PAS_PYRAMID_SSE2
+void reduce_sse2 (const int16_t *x, size_t len, int16_t &min, int16_t &max, int64_t &sum) {
+  const __m128i ones = _mm_set1_epi16(1);
+  __m128i vmin = _mm_set1_epi16(std::numeric_limits<int16_t>::max());
+  __m128i vmax = _mm_set1_epi16(std::numeric_limits<int16_t>::min());
+  int64_t s = 0;
+  size_t i = 0;
+  while (i + 8 <= len) {
+    size_t block_end = std::min(len, i + SUM_BLOCK);
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 8 <= block_end; i += 8) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+      vmin = _mm_min_epi16(vmin, v);
+      vmax = _mm_max_epi16(vmax, v);
+      acc = _mm_add_epi32(acc, _mm_madd_epi16(v, ones));
+    }
+    int32_t lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+    s += (int64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  }
+  int16_t mins[8], maxs[8];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(mins), vmin);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(maxs), vmax);
+  int16_t mn, mx;
+  int64_t tail;
+  reduce_scalar(x + i, len - i, mn, mx, tail);
+  for (int k = 0; k < 8; k++) {
+    mn = std::min(mn, mins[k]);
+    mx = std::max(mx, maxs[k]);
+  }
+  min = mn;
+  max = mx;
+  sum = s + tail;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define PAS_PYRAMID_AVX2
+/* Built for AVX2 whatever the compiler flags, used if the CPU has it */
+__attribute__((target("avx2")))
+void reduce_avx2 (const int16_t *x, size_t len, int16_t &min, int16_t &max, int64_t &sum) {
+  const __m256i ones = _mm256_set1_epi16(1);
+  __m256i vmin = _mm256_set1_epi16(std::numeric_limits<int16_t>::max());
+  __m256i vmax = _mm256_set1_epi16(std::numeric_limits<int16_t>::min());
+  int64_t s = 0;
+  size_t i = 0;
+  while (i + 16 <= len) {
+    size_t block_end = std::min(len, i + SUM_BLOCK);
+    __m256i acc = _mm256_setzero_si256();
+    for (; i + 16 <= block_end; i += 16) {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i));
+      vmin = _mm256_min_epi16(vmin, v);
+      vmax = _mm256_max_epi16(vmax, v);
+      acc = _mm256_add_epi32(acc, _mm256_madd_epi16(v, ones));
+    }
+    int32_t lanes[8];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+    for (int k = 0; k < 8; k++) s += lanes[k];
+  }
+  int16_t mins[16], maxs[16];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(mins), vmin);
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(maxs), vmax);
+  int16_t mn, mx;
+  int64_t tail;
+  reduce_scalar(x + i, len - i, mn, mx, tail);
+  for (int k = 0; k < 16; k++) {
+    mn = std::min(mn, mins[k]);
+    mx = std::max(mx, maxs[k]);
+  }
+  min = mn;
+  max = mx;
+  sum = s + tail;
+}
+#endif
+#endif
+
+#ifdef PAS_PYRAMID_NEON
+void reduce_neon (const int16_t *x, size_t len, int16_t &min, int16_t &max, int64_t &sum) {
+  int16x8_t vmin = vdupq_n_s16(std::numeric_limits<int16_t>::max());
+  int16x8_t vmax = vdupq_n_s16(std::numeric_limits<int16_t>::min());
+  int64_t s = 0;
+  size_t i = 0;
+  while (i + 8 <= len) {
+    size_t block_end = std::min(len, i + SUM_BLOCK);
+    int32x4_t acc = vdupq_n_s32(0);
+    for (; i + 8 <= block_end; i += 8) {
+      int16x8_t v = vld1q_s16(x + i);
+      vmin = vminq_s16(vmin, v);
+      vmax = vmaxq_s16(vmax, v);
+      acc = vpadalq_s16(acc, v);
+    }
+    s += vaddlvq_s32(acc);
+  }
+  int16_t mn, mx;
+  int64_t tail;
+  reduce_scalar(x + i, len - i, mn, mx, tail);
+  min = std::min(mn, vminvq_s16(vmin));
+  max = std::max(mx, vmaxvq_s16(vmax));
+  sum = s + tail;
+}
+#endif
+
+typedef void (*reduce_fn) (const int16_t*, size_t, int16_t&, int16_t&, int64_t&);
+
+reduce_fn select_reduce () {
+#if defined(PAS_PYRAMID_AVX2)
+  if (__builtin_cpu_supports("avx2")) return reduce_avx2;
+#endif
+#if defined(PAS_PYRAMID_SSE2)
+  return reduce_sse2;
+#elif defined(PAS_PYRAMID_NEON)
+  return reduce_neon;
+#else
+  return reduce_scalar;
+#endif
+}
+
+const reduce_fn reduce_best = select_reduce();
+
+}
+
+void reduce_samples (const int16_t *x, size_t len, int16_t &min, int16_t &max, int64_t &sum) {
+  reduce_best(x, len, min, max, sum);
+}
+
+std::string pyramid_path (const std::string &recording_path) {
+  const std::string ext = ".pasr";
+  if (recording_path.size() >= ext.size() && recording_path.compare(recording_path.size() - ext.size(), ext.size(), ext) == 0) {
+    return recording_path.substr(0, recording_path.size() - ext.size()) + ".pasp";
+  }
+  return recording_path + ".pasp";
+}
+
+struct MinMaxPyramid::Accumulator {
+  int16_t min = std::numeric_limits<int16_t>::max();
+  int16_t max = std::numeric_limits<int16_t>::min();
+  double sum = 0;
+  uint64_t count = 0;
+
+  void add (const PyramidBin &bin, uint64_t len) {
+    min = std::min(min, bin.min);
+    max = std::max(max, bin.max);
+    sum += (double) bin.mean * len;
+    count += len;
+  }
+};
+
+MinMaxPyramid::MinMaxPyramid (uint32_t base, uint16_t fanout) : base_(base), fanout_(fanout) {
+  if (base == 0 || fanout < 2) throw std::invalid_argument("invalid pyramid base or fanout");
+  clear();
+}
+
+void MinMaxPyramid::clear () {
+  n_samples_ = 0;
+  tail_sum_ = 0;
+  bin_len_.assign(1, base_);
+  levels_.assign(1, {});
+}
+
+void MinMaxPyramid::append (const int16_t *samples, size_t len) {
+  uint64_t from = n_samples_;
+  std::vector<PyramidBin> &bins = levels_[0];
+  size_t done = 0;
+  while (done < len) {
+    uint64_t filled = n_samples_ % base_;
+    size_t n = std::min<uint64_t>(len - done, base_ - filled);
+    int16_t mn, mx;
+    int64_t sum;
+    reduce_samples(samples + done, n, mn, mx, sum);
+    if (filled == 0) {
+      bins.push_back({ mn, mx, 0 });
+      tail_sum_ = 0;
+    }
+    PyramidBin &bin = bins.back();
+    bin.min = std::min(bin.min, mn);
+    bin.max = std::max(bin.max, mx);
+    tail_sum_ += sum;
+    bin.mean = (float) ((double) tail_sum_ / (filled + n));
+    n_samples_ += n;
+    done += n;
+  }
+  if (len > 0) update_levels(from);
+}
+
+void MinMaxPyramid::update_levels (uint64_t from) {
+  for (size_t l = 1; ; l++) {
+    if (l == levels_.size()) {
+      if (levels_[l - 1].size() <= 1) break;
+      bin_len_.push_back(bin_len_[l - 1] * fanout_);
+      levels_.emplace_back();
+      from = 0;
+    }
+    const std::vector<PyramidBin> &children = levels_[l - 1];
+    std::vector<PyramidBin> &bins = levels_[l];
+    uint64_t len = bin_len_[l], child_len = bin_len_[l - 1];
+    bins.resize((n_samples_ + len - 1) / len);
+    /* Bins before the one holding from are complete and unchanged */
+    for (uint64_t i = from / len; i < bins.size(); i++) {
+      Accumulator acc;
+      uint64_t last = std::min<uint64_t>((i + 1) * fanout_, children.size());
+      for (uint64_t c = i * fanout_; c < last; c++) {
+        acc.add(children[c], std::min((c + 1) * child_len, n_samples_) - c * child_len);
+      }
+      bins[i] = { acc.min, acc.max, (float) (acc.sum / acc.count) };
+    }
+  }
+}
+
+void MinMaxPyramid::reduce (
+  size_t level, uint64_t bin, uint64_t begin, uint64_t end, const int16_t *raw, size_t floor, Accumulator &acc
+) const {
+  uint64_t bin_begin = bin * bin_len_[level];
+  uint64_t bin_end = std::min(bin_begin + bin_len_[level], n_samples_);
+  uint64_t b = std::max(bin_begin, begin), e = std::min(bin_end, end);
+  if (b >= e) return;
+  if ((b == bin_begin && e == bin_end) || (level == floor && raw == nullptr)) {
+    acc.add(levels_[level][bin], bin_end - bin_begin);
+  } else if (level == 0) {
+    int16_t mn, mx;
+    int64_t sum;
+    reduce_samples(raw + b, e - b, mn, mx, sum);
+    acc.min = std::min(acc.min, mn);
+    acc.max = std::max(acc.max, mx);
+    acc.sum += sum;
+    acc.count += e - b;
+  } else {
+    uint64_t last = std::min<uint64_t>((bin + 1) * fanout_, levels_[level - 1].size());
+    for (uint64_t c = bin * fanout_; c < last; c++) reduce(level - 1, c, begin, end, raw, floor, acc);
+  }
+}
+
+size_t MinMaxPyramid::render (uint64_t begin, uint64_t end, size_t columns, const int16_t *raw, PyramidBin *out) const {
+  end = std::min(end, n_samples_);
+  if (begin >= end || columns == 0) return 0;
+  uint64_t len = end - begin;
+  columns = std::min<uint64_t>(columns, len);
+  if (raw == nullptr) columns = std::min<uint64_t>(columns, (len + base_ - 1) / base_);
+
+  /* Coarsest level with bins no longer than a column, a column spans less than fanout of them */
+  size_t level = 0;
+  uint64_t column_len = len / columns;
+  while (level + 1 < levels_.size() && bin_len_[level + 1] <= column_len) level++;
+  /* Without raw samples the edges stop a level below, within 1 / fanout of a column */
+  size_t floor = raw == nullptr && level > 0 ? level - 1 : 0;
+
+  for (size_t c = 0; c < columns; c++) {
+    uint64_t b = begin + len * c / columns, e = begin + len * (c + 1) / columns;
+    Accumulator acc;
+    for (uint64_t i = b / bin_len_[level]; i <= (e - 1) / bin_len_[level]; i++) reduce(level, i, b, e, raw, floor, acc);
+    out[c] = { acc.min, acc.max, (float) (acc.sum / acc.count) };
+  }
+  return columns;
+}
+
+void MinMaxPyramid::save (const std::string &path) const {
+  FILE *file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr) throw std::system_error(errno, std::generic_category(), path);
+  PyramidHeader header = {};
+  std::memcpy(header.magic, PYRAMID_MAGIC, sizeof(PYRAMID_MAGIC));
+  header.version = PYRAMID_VERSION;
+  header.fanout = fanout_;
+  header.base = base_;
+  header.levels = levels_.size();
+  header.n_samples = n_samples_;
+  std::vector<uint64_t> counts;
+  for (const std::vector<PyramidBin> &bins : levels_) counts.push_back(bins.size());
+
+  bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1
+    && std::fwrite(counts.data(), sizeof(uint64_t), counts.size(), file) == counts.size();
+  for (size_t l = 0; ok && l < levels_.size(); l++) {
+    ok = std::fwrite(levels_[l].data(), sizeof(PyramidBin), levels_[l].size(), file) == levels_[l].size();
+  }
+  int err = errno;
+  if (std::fclose(file) != 0 && ok) {
+    ok = false;
+    err = errno;
+  }
+  if (!ok) throw std::system_error(err, std::generic_category(), "pyramid write " + path);
+}
+
+MinMaxPyramid MinMaxPyramid::load (const std::string &path) {
+  FILE *file = std::fopen(path.c_str(), "rb");
+  if (file == nullptr) throw std::system_error(errno, std::generic_category(), path);
+  PyramidHeader header = {};
+  bool ok = std::fread(&header, sizeof(header), 1, file) == 1
+    && std::memcmp(header.magic, PYRAMID_MAGIC, sizeof(PYRAMID_MAGIC)) == 0
+    && header.version == PYRAMID_VERSION && header.base > 0 && header.fanout >= 2
+    && header.levels > 0 && header.levels < 64;
+  MinMaxPyramid pyramid(ok ? header.base : 1, ok ? header.fanout : 2);
+  std::vector<uint64_t> counts(ok ? header.levels : 0);
+  ok = ok && std::fread(counts.data(), sizeof(uint64_t), counts.size(), file) == counts.size();
+  pyramid.n_samples_ = header.n_samples;
+  pyramid.levels_.clear();
+  pyramid.bin_len_.clear();
+  for (size_t l = 0; ok && l < counts.size(); l++) {
+    uint64_t len = l == 0 ? header.base : pyramid.bin_len_.back() * header.fanout;
+    ok = counts[l] == (header.n_samples + len - 1) / len;
+    pyramid.bin_len_.push_back(len);
+    pyramid.levels_.emplace_back(ok ? counts[l] : 0);
+    ok = ok && std::fread(pyramid.levels_[l].data(), sizeof(PyramidBin), counts[l], file) == counts[l];
+  }
+  std::fclose(file);
+  if (!ok) throw std::runtime_error(path + ": not a pyramid or unsupported version");
+  /* Appending continues the last level 0 bin */
+  uint64_t filled = pyramid.n_samples_ % pyramid.base_;
+  if (filled > 0) pyramid.tail_sum_ = std::llround((double) pyramid.levels_[0].back().mean * filled);
+  return pyramid;
+}
+
+}
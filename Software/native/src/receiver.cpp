@@ -0,0 +1,737 @@
+#include "pas/receiver.hpp"
+#include "pas/sample_codec.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <system_error>
+
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+namespace pas {
+
+/* Time requests without an answer yet, older ones are given up */
+static const size_t MAX_TIME_REQUESTS = 8;
+
+static size_t next_power_of_two (size_t n) {
+  size_t p = 1;
+  while (p < n) p <<= 1;
+  return p;
+}
+
+static int64_t now_us () {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+}
+
+Receiver::Receiver (ReceiverConfig config)
+  : config_(std::move(config)),
+    ring_buf_(next_power_of_two(config_.ring_len)),
+    recv_buf_(config_.recv_len) {
+  sample_ring_init(&ring_, ring_buf_.data(), ring_buf_.size());
+  stream_decoder_init(&decoder_);
+  stream_decoder_init(&alarm_decoder_);
+}
+
+Receiver::~Receiver () {
+  stop();
+}
+
+int Receiver::open_tcp () {
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *result = nullptr;
+  std::string port = std::to_string(config_.port);
+  int err = getaddrinfo(config_.host.c_str(), port.c_str(), &hints, &result);
+  if (err != 0) {
+    throw std::system_error(EHOSTUNREACH, std::generic_category(), gai_strerror(err));
+  }
+
+  int fd = -1;
+  for (addrinfo *ai = result; ai != nullptr; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0) continue;
+    if (config_.socket_buffer > 0) {
+      setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &config_.socket_buffer, sizeof(config_.socket_buffer));
+    }
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+    close(fd);
+    fd = -1;
+  }
+  int connect_errno = errno;
+  freeaddrinfo(result);
+  if (fd < 0) throw std::system_error(connect_errno, std::generic_category(), "connect " + config_.host);
+
+  /* accept_connection() compares a C string, send the terminator too */
+  const std::string &msg = config_.handshake;
+  if (send(fd, msg.c_str(), msg.size() + 1, MSG_NOSIGNAL) < 0) {
+    int send_errno = errno;
+    close(fd);
+    throw std::system_error(send_errno, std::generic_category(), "handshake");
+  }
+  return fd;
+}
+
+int Receiver::open_udp () {
+  /* Subscriptions and commands go to the sensor, a group alone needs no host */
+  if (!config_.host.empty()) {
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo *result = nullptr;
+    std::string port = std::to_string(config_.udp_port);
+    int err = getaddrinfo(config_.host.c_str(), port.c_str(), &hints, &result);
+    if (err != 0) {
+      throw std::system_error(EHOSTUNREACH, std::generic_category(), gai_strerror(err));
+    }
+    std::memcpy(&udp_peer_, result->ai_addr, result->ai_addrlen);
+    udp_peer_len_ = result->ai_addrlen;
+    freeaddrinfo(result);
+  } else if (config_.group.empty()) {
+    throw std::system_error(EDESTADDRREQ, std::generic_category(), "datagram stream needs a host or a group");
+  }
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) throw std::system_error(errno, std::generic_category(), "socket");
+  if (config_.socket_buffer > 0) {
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &config_.socket_buffer, sizeof(config_.socket_buffer));
+  }
+  if (!config_.group.empty()) {
+    /* Other viewers on this host listen to the group port too */
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(config_.udp_port);
+    ip_mreq mreq = {};
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (inet_aton(config_.group.c_str(), &mreq.imr_multiaddr) == 0) {
+      close(fd);
+      throw std::system_error(EINVAL, std::generic_category(), "multicast group " + config_.group);
+    }
+    addr.sin_addr = mreq.imr_multiaddr;
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0
+        || setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+      int join_errno = errno;
+      close(fd);
+      throw std::system_error(join_errno, std::generic_category(), "join " + config_.group);
+    }
+  }
+  reorder_ = std::make_unique<stream_reorder_t>();
+  stream_reorder_init(reorder_.get(), config_.reorder_window, config_.reorder_delay_us);
+  return fd;
+}
+
+/* No handshake on the event port, the sensor may not have one, -1 then */
+int Receiver::open_alarm () {
+  if (config_.alarm_port == 0 || config_.host.empty()) return -1;
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *result = nullptr;
+  std::string port = std::to_string(config_.alarm_port);
+  if (getaddrinfo(config_.host.c_str(), port.c_str(), &hints, &result) != 0) return -1;
+  int fd = -1;
+  for (addrinfo *ai = result; ai != nullptr; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0) continue;
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(result);
+  return fd;
+}
+
+void Receiver::start () {
+  if (thread_.joinable()) return;
+  socket_ = config_.transport == Transport::udp ? open_udp() : open_tcp();
+  alarm_socket_ = open_alarm();
+  run_.store(true, std::memory_order_release);
+  thread_ = std::thread(config_.transport == Transport::udp ? &Receiver::run_udp : &Receiver::run, this);
+}
+
+void Receiver::start_recording (const std::string &path, RecordingInfo info) {
+  auto recorder = std::make_unique<RecordingWriter>(path, info);
+  std::unique_ptr<RecordingWriter> previous;
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    previous = std::move(recorder_);
+    recorder_ = std::move(recorder);
+  }
+  if (previous) previous->close();
+}
+
+void Receiver::stop_recording () {
+  std::unique_ptr<RecordingWriter> recorder;
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    recorder = std::move(recorder_);
+  }
+  if (recorder) recorder->close();
+}
+
+void Receiver::stop () {
+  /* The datagram thread polls, shutdown only wakes a TCP recv */
+  run_.store(false, std::memory_order_release);
+  if (socket_ >= 0) shutdown(socket_, SHUT_RDWR);
+  if (thread_.joinable()) thread_.join();
+  if (socket_ >= 0) close(socket_);
+  socket_ = -1;
+  if (alarm_socket_ >= 0) close(alarm_socket_);
+  alarm_socket_ = -1;
+  run_.store(false, std::memory_order_release);
+}
+
+std::string Receiver::error () const {
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  return error_;
+}
+
+void Receiver::on_frame (const stream_frame_header_t *header, const uint8_t *payload, void *arg) {
+  Receiver *self = static_cast<Receiver*>(arg);
+  int16_t samples[SAMPLE_CODEC_MAX_SAMPLES];
+  bool sample_frame = header->type == STREAM_FRAME_SAMPLES || header->type == STREAM_FRAME_SAMPLES_RICE;
+  if (sample_frame && (header->flags & STREAM_FLAG_ANGLE)) {
+    /* Crank angle of the first sample ahead of the samples */
+    if (header->payload_len < sizeof(stream_angle_t)) {
+      self->decode_errors_++;
+      return;
+    }
+    std::memcpy(&self->angle_, payload, sizeof(stream_angle_t));
+    self->angle_sample_ = header->first_sample;
+    self->angle_frames_++;
+  }
+  size_t prefix = sample_frame && (header->flags & STREAM_FLAG_ANGLE) ? sizeof(stream_angle_t) : 0;
+  if (header->type == STREAM_FRAME_SAMPLES) {
+    /* Payload may be unaligned inside the socket buffer, ring copy handles it */
+    if (header->sample_count * sizeof(int16_t) > header->payload_len - prefix) {
+      self->decode_errors_++;
+      return;
+    }
+    std::memcpy(samples, payload + prefix, header->sample_count * sizeof(int16_t));
+  } else if (header->type == STREAM_FRAME_SAMPLES_RICE) {
+    if (header->sample_count > SAMPLE_CODEC_MAX_SAMPLES
+        || !decode_samples(payload + prefix, header->payload_len - prefix, samples, header->sample_count)) {
+      self->decode_errors_++;
+      return;
+    }
+  } else if (header->type == STREAM_FRAME_CAPTURE) {
+    self->on_capture_frame(header, payload);
+    return;
+  } else if (header->type == STREAM_FRAME_FEATURES) {
+    self->on_features_frame(header, payload);
+    return;
+  } else if (header->type == STREAM_FRAME_STATS) {
+    self->on_stats_frame(header, payload);
+    return;
+  } else if (header->type == STREAM_FRAME_TIME) {
+    self->on_time_frame(header, payload);
+    return;
+  } else if (header->type == STREAM_FRAME_ADC) {
+    self->on_adc_frame(header, payload);
+    return;
+  } else if (header->type == STREAM_FRAME_CALIBRATION) {
+    self->on_calibration_frame(header, payload);
+    return;
+  } else if (header->type == STREAM_FRAME_BASELINE) {
+    self->on_baseline_frame(header, payload);
+    return;
+  } else if (header->type == STREAM_FRAME_CYCLE) {
+    self->on_cycle_frame(header, payload);
+    return;
+  } else {
+    return;
+  }
+  if (header->flags & STREAM_FLAG_AMP_RESET) self->amp_resets_++;
+  self->sample_rate_ = header->sample_rate;
+  self->write_samples(header, samples);
+  if (self->recorder_) {
+    try {
+      self->recorder_->append(header->first_sample, header->timestamp, header->sample_rate, samples, header->sample_count);
+    } catch (const std::exception &e) {
+      /* Stream goes on, the file keeps what was written */
+      self->error_ = std::string("recording stopped: ") + e.what();
+      self->recorder_.reset();
+    }
+  }
+}
+
+void Receiver::write_samples (const stream_frame_header_t *header, const int16_t *samples) {
+  size_t pos = sample_ring_written(&ring_);
+  if (header->first_sample != next_first_sample_ || pos == 0) {
+    /* Marked before the samples are visible, read() must not run past it */
+    std::lock_guard<std::mutex> lock(segments_mutex_);
+    segments_.push_back({ pos, header->first_sample });
+  }
+  size_t written = sample_ring_write(&ring_, samples, header->sample_count);
+  next_first_sample_ = header->first_sample + written;
+  sample_clock_.add(header->first_sample, header->timestamp, header->sample_rate);
+}
+
+void Receiver::on_capture_frame (const stream_frame_header_t *header, const uint8_t *payload) {
+  stream_capture_header_t capture;
+  if (header->payload_len < sizeof(capture) + header->sample_count * sizeof(int16_t)) {
+    decode_errors_++;
+    return;
+  }
+  std::memcpy(&capture, payload, sizeof(capture));
+  uint64_t start = capture.trigger_index - capture.pre_trigger;
+  uint64_t offset = header->first_sample - start;
+  if (offset + header->sample_count > capture.length) {
+    decode_errors_++;
+    return;
+  }
+
+  if (assembling_active_ && assembling_.number != capture.number) {
+    /* Rest of the previous window never came */
+    assembling_.truncated = true;
+    finish_capture();
+  }
+  if (!assembling_active_) {
+    assembling_ = Capture();
+    assembling_.trigger_index = capture.trigger_index;
+    assembling_.number = capture.number;
+    assembling_.missed = capture.missed;
+    assembling_.pre_trigger = capture.pre_trigger;
+    assembling_.sample_rate = header->sample_rate;
+    assembling_.samples.assign(capture.length, 0);
+    assembling_active_ = true;
+    assembling_received_ = 0;
+  }
+  if (offset == 0) assembling_.timestamp = header->timestamp;
+  if (header->flags & STREAM_FLAG_OVERRUN) assembling_.truncated = true;
+  std::memcpy(&assembling_.samples[offset], payload + sizeof(capture), header->sample_count * sizeof(int16_t));
+  assembling_received_ += header->sample_count;
+  if (assembling_received_ >= capture.length) finish_capture();
+}
+
+void Receiver::finish_capture () {
+  if (assembling_.truncated) assembling_.samples.resize(assembling_received_);
+  capture_count_++;
+  captures_missed_ += assembling_.missed;
+  {
+    std::lock_guard<std::mutex> lock(captures_mutex_);
+    captures_.push_back(std::move(assembling_));
+    while (captures_.size() > config_.max_captures) captures_.pop_front();
+  }
+  assembling_active_ = false;
+}
+
+void Receiver::on_features_frame (const stream_frame_header_t *header, const uint8_t *payload) {
+  if (header->payload_len < sizeof(stream_features_t)) {
+    decode_errors_++;
+    return;
+  }
+  FeatureReport report;
+  report.first_sample = header->first_sample;
+  report.timestamp = header->timestamp;
+  report.sample_rate = header->sample_rate;
+  std::memcpy(&report.values, payload, sizeof(stream_features_t));
+  feature_count_++;
+  std::lock_guard<std::mutex> lock(features_mutex_);
+  feature_reports_.push_back(report);
+  while (feature_reports_.size() > config_.max_feature_reports) feature_reports_.pop_front();
+}
+
+bool Receiver::read_features (FeatureReport &report) {
+  std::lock_guard<std::mutex> lock(features_mutex_);
+  if (feature_reports_.empty()) return false;
+  report = feature_reports_.front();
+  feature_reports_.pop_front();
+  return true;
+}
+
+void Receiver::on_cycle_frame (const stream_frame_header_t *header, const uint8_t *payload) {
+  if (header->payload_len < sizeof(stream_cycle_t)) {
+    decode_errors_++;
+    return;
+  }
+  CycleReport report;
+  report.first_sample = header->first_sample;
+  report.timestamp = header->timestamp;
+  report.sample_rate = header->sample_rate;
+  std::memcpy(&report.values, payload, sizeof(stream_cycle_t));
+  cycle_count_++;
+  std::lock_guard<std::mutex> lock(cycles_mutex_);
+  cycle_reports_.push_back(report);
+  while (cycle_reports_.size() > config_.max_cycle_reports) cycle_reports_.pop_front();
+}
+
+bool Receiver::read_cycle (CycleReport &report) {
+  std::lock_guard<std::mutex> lock(cycles_mutex_);
+  if (cycle_reports_.empty()) return false;
+  report = cycle_reports_.front();
+  cycle_reports_.pop_front();
+  return true;
+}
+
+void Receiver::on_stats_frame (const stream_frame_header_t *header, const uint8_t *payload) {
+  if (header->payload_len < sizeof(stream_stats_t)) {
+    decode_errors_++;
+    return;
+  }
+  device_stats_count_++;
+  std::lock_guard<std::mutex> lock(device_stats_mutex_);
+  device_stats_.last_sample = header->first_sample;
+  device_stats_.timestamp = header->timestamp;
+  std::memcpy(&device_stats_.values, payload, sizeof(stream_stats_t));
+  device_stats_new_ = true;
+}
+
+void Receiver::on_time_frame (const stream_frame_header_t *header, const uint8_t *payload) {
+  if (header->payload_len < sizeof(stream_time_t)) {
+    decode_errors_++;
+    return;
+  }
+  stream_time_t time;
+  std::memcpy(&time, payload, sizeof(time));
+  /* Answers to the other viewers of the stream are not ours */
+  auto origin = std::find(time_origins_.begin(), time_origins_.end(), time.origin);
+  if (origin == time_origins_.end()) return;
+  time_origins_.erase(time_origins_.begin(), origin + 1);
+  clock_.add(time.origin, time.receive, time.transmit, arrival_);
+}
+
+void Receiver::on_adc_frame (const stream_frame_header_t *header, const uint8_t *payload) {
+  if (header->payload_len < sizeof(stream_adc_config_t)) {
+    decode_errors_++;
+    return;
+  }
+  std::lock_guard<std::mutex> lock(device_stats_mutex_);
+  adc_report_.last_sample = header->first_sample;
+  adc_report_.timestamp = header->timestamp;
+  std::memcpy(&adc_report_.values, payload, sizeof(stream_adc_config_t));
+  adc_report_new_ = true;
+}
+
+void Receiver::on_calibration_frame (const stream_frame_header_t *header, const uint8_t *payload) {
+  if (header->payload_len < sizeof(stream_calibration_t)) {
+    decode_errors_++;
+    return;
+  }
+  std::lock_guard<std::mutex> lock(device_stats_mutex_);
+  calibration_.last_sample = header->first_sample;
+  calibration_.timestamp = header->timestamp;
+  std::memcpy(&calibration_.values, payload, sizeof(stream_calibration_t));
+  calibration_new_ = true;
+}
+
+void Receiver::on_baseline_frame (const stream_frame_header_t *header, const uint8_t *payload) {
+  if (header->payload_len < sizeof(stream_baseline_t)) {
+    decode_errors_++;
+    return;
+  }
+  std::lock_guard<std::mutex> lock(device_stats_mutex_);
+  baseline_.last_sample = header->first_sample;
+  baseline_.timestamp = header->timestamp;
+  std::memcpy(&baseline_.values, payload, sizeof(stream_baseline_t));
+  baseline_new_ = true;
+}
+
+void Receiver::on_alarm_frame (const stream_frame_header_t *header, const uint8_t *payload, void *arg) {
+  Receiver *self = static_cast<Receiver*>(arg);
+  if (header->type != STREAM_FRAME_ALARM) return;
+  if (header->payload_len < sizeof(stream_alarm_t)) {
+    self->decode_errors_++;
+    return;
+  }
+  AlarmEvent event;
+  event.index = header->first_sample;
+  event.timestamp = header->timestamp;
+  event.sample_rate = header->sample_rate;
+  std::memcpy(&event.values, payload, sizeof(stream_alarm_t));
+  event.arrival = self->arrival_;
+  event.latency_us = self->clock_.synced() ? event.arrival - self->clock_.to_host(header->timestamp) : NAN;
+  self->alarm_count_++;
+  std::lock_guard<std::mutex> lock(self->alarms_mutex_);
+  self->alarms_.push_back(event);
+  while (self->alarms_.size() > self->config_.max_alarms) self->alarms_.pop_front();
+}
+
+bool Receiver::read_alarm (AlarmEvent &event) {
+  std::lock_guard<std::mutex> lock(alarms_mutex_);
+  if (alarms_.empty()) return false;
+  event = alarms_.front();
+  alarms_.pop_front();
+  return true;
+}
+
+/* Called with stats_mutex_ held, the stream goes on if the event port closes */
+void Receiver::read_alarm_socket () {
+  uint8_t buf[STREAM_FRAME_MAX_LEN];
+  ssize_t len = recv(alarm_socket_, buf, sizeof(buf), MSG_DONTWAIT);
+  if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+  if (len <= 0) {
+    close(alarm_socket_);
+    alarm_socket_ = -1;
+    return;
+  }
+  arrival_ = host_time_us();
+  bytes_ += len;
+  stream_decoder_push(&alarm_decoder_, buf, len, &Receiver::on_alarm_frame, this);
+}
+
+void Receiver::request_time (int64_t now) {
+  if (config_.time_sync_interval_us <= 0 || now - last_time_request_ < config_.time_sync_interval_us) return;
+  last_time_request_ = now;
+  char command[32];
+  int64_t origin = host_time_us();
+  int len = std::snprintf(command, sizeof(command), "time %lld", static_cast<long long>(origin));
+  try {
+    send_command(command, len + 1);
+  } catch (const std::system_error&) {
+    /* A group alone has nobody to ask, a failed send is retried next interval */
+    return;
+  }
+  time_origins_.push_back(origin);
+  while (time_origins_.size() > MAX_TIME_REQUESTS) time_origins_.pop_front();
+}
+
+void Receiver::send_command (const char *command, size_t len) {
+  if (socket_ < 0) throw std::system_error(ENOTCONN, std::generic_category(), command);
+  ssize_t sent;
+  if (config_.transport == Transport::udp) {
+    if (udp_peer_len_ == 0) throw std::system_error(EDESTADDRREQ, std::generic_category(), command);
+    sent = sendto(socket_, command, len, 0, reinterpret_cast<const sockaddr*>(&udp_peer_), udp_peer_len_);
+  } else {
+    sent = send(socket_, command, len, MSG_NOSIGNAL);
+  }
+  if (sent < 0) throw std::system_error(errno, std::generic_category(), command);
+}
+
+void Receiver::request_stats () {
+  /* One command per segment, the server reads it as a C string */
+  static const char command[] = "stats";
+  send_command(command, sizeof(command));
+}
+
+bool Receiver::read_device_stats (DeviceStats &stats) {
+  std::lock_guard<std::mutex> lock(device_stats_mutex_);
+  if (!device_stats_new_) return false;
+  stats = device_stats_;
+  device_stats_new_ = false;
+  return true;
+}
+
+void Receiver::configure_adc (const std::string &settings) {
+  std::string command = settings.empty() ? "adc" : "adc " + settings;
+  send_command(command.c_str(), command.size() + 1);
+}
+
+bool Receiver::read_adc_report (AdcReport &report) {
+  std::lock_guard<std::mutex> lock(device_stats_mutex_);
+  if (!adc_report_new_) return false;
+  report = adc_report_;
+  adc_report_new_ = false;
+  return true;
+}
+
+void Receiver::request_calibration () {
+  static const char command[] = "calibration";
+  send_command(command, sizeof(command));
+}
+
+bool Receiver::read_calibration (CalibrationReport &report) {
+  std::lock_guard<std::mutex> lock(device_stats_mutex_);
+  if (!calibration_new_) return false;
+  report = calibration_;
+  calibration_new_ = false;
+  return true;
+}
+
+void Receiver::request_baseline () {
+  static const char command[] = "baseline";
+  send_command(command, sizeof(command));
+}
+
+bool Receiver::read_baseline (BaselineReport &report) {
+  std::lock_guard<std::mutex> lock(device_stats_mutex_);
+  if (!baseline_new_) return false;
+  report = baseline_;
+  baseline_new_ = false;
+  return true;
+}
+
+bool Receiver::read_capture (Capture &capture) {
+  std::lock_guard<std::mutex> lock(captures_mutex_);
+  if (captures_.empty()) return false;
+  capture = std::move(captures_.front());
+  captures_.pop_front();
+  return true;
+}
+
+void Receiver::run () {
+  while (run_.load(std::memory_order_acquire)) {
+    /* Wakes up for the next time request, the stream may be idle */
+    int64_t now = now_us();
+    request_time(now);
+    int timeout = -1;
+    if (config_.time_sync_interval_us > 0) {
+      int64_t wait = last_time_request_ + config_.time_sync_interval_us - now;
+      timeout = wait > 0 ? static_cast<int>((wait + 999) / 1000) : 0;
+    }
+    pollfd pfd[2] = { { socket_, POLLIN, 0 }, { alarm_socket_, POLLIN, 0 } };
+    int ready = poll(pfd, alarm_socket_ >= 0 ? 2 : 1, timeout);
+    if (ready == 0 || (ready < 0 && errno == EINTR)) continue;
+    if (ready > 0 && alarm_socket_ >= 0 && pfd[1].revents != 0) {
+      std::lock_guard<std::mutex> lock(stats_mutex_);
+      read_alarm_socket();
+    }
+    if (ready > 0 && pfd[0].revents == 0) continue;
+    ssize_t len = ready < 0 ? -1 : recv(socket_, recv_buf_.data(), recv_buf_.size(), 0);
+    int64_t arrival = host_time_us();
+    if (len <= 0) {
+      if (len < 0 && errno == EINTR) continue;
+      std::lock_guard<std::mutex> lock(stats_mutex_);
+      error_ = (len == 0) ? "connection closed" : std::strerror(errno);
+      break;
+    }
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    arrival_ = arrival;
+    bytes_ += len;
+    stream_decoder_push(&decoder_, recv_buf_.data(), len, &Receiver::on_frame, this);
+  }
+  run_.store(false, std::memory_order_release);
+}
+
+void Receiver::on_datagram_frame (const uint8_t *frame, size_t len, void *arg) {
+  Receiver *self = static_cast<Receiver*>(arg);
+  stream_decoder_push(&self->decoder_, frame, len, &Receiver::on_frame, self);
+}
+
+void Receiver::run_udp () {
+  static const char subscribe[] = "subscribe";
+  static const char unsubscribe[] = "unsubscribe";
+  bool unicast = config_.group.empty();
+  int64_t last_subscribe = 0;
+  while (run_.load(std::memory_order_acquire)) {
+    int64_t now = now_us();
+    if (unicast && now - last_subscribe >= 1000000) {
+      /* Renews the subscription, the sensor forgets silent viewers */
+      try {
+        send_command(subscribe, sizeof(subscribe));
+      } catch (const std::system_error&) {
+        /* Retried in a second, the network may come back */
+      }
+      last_subscribe = now;
+    }
+    request_time(now);
+    int64_t deadline = stream_reorder_deadline(reorder_.get());
+    int timeout = deadline == INT64_MAX || deadline - now > 100000 ? 100 : static_cast<int>((deadline - now + 999) / 1000);
+    pollfd pfd[2] = { { socket_, POLLIN, 0 }, { alarm_socket_, POLLIN, 0 } };
+    int ready = poll(pfd, alarm_socket_ >= 0 ? 2 : 1, timeout < 0 ? 0 : timeout);
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    if (ready < 0 && errno != EINTR) {
+      error_ = std::strerror(errno);
+      break;
+    }
+    if (ready > 0 && alarm_socket_ >= 0 && pfd[1].revents != 0) read_alarm_socket();
+    if (ready > 0 && pfd[0].revents != 0) {
+      ssize_t len = recv(socket_, recv_buf_.data(), recv_buf_.size(), MSG_DONTWAIT);
+      arrival_ = host_time_us();
+      if (len > 0) {
+        bytes_ += len;
+        stream_reorder_push(reorder_.get(), recv_buf_.data(), len, now_us(), &Receiver::on_datagram_frame, this);
+      }
+    }
+    stream_reorder_expire(reorder_.get(), now_us(), &Receiver::on_datagram_frame, this);
+  }
+  if (unicast) {
+    try {
+      send_command(unsubscribe, sizeof(unsubscribe));
+    } catch (const std::system_error&) {
+    }
+  }
+  run_.store(false, std::memory_order_release);
+}
+
+size_t Receiver::read (int16_t *dst, size_t max_len) {
+  size_t tail = sample_ring_read_index(&ring_);
+  {
+    std::lock_guard<std::mutex> lock(segments_mutex_);
+    while (segments_.size() > 1 && segments_[1].ring_pos <= tail) segments_.pop_front();
+    if (segments_.size() > 1) max_len = std::min(max_len, segments_[1].ring_pos - tail);
+  }
+  size_t read = 0;
+  while (read < max_len) {
+    size_t len;
+    const int16_t *src = sample_ring_read_acquire(&ring_, &len);
+    if (src == nullptr) break;
+    len = std::min(len, max_len - read);
+    std::memcpy(&dst[read], src, len * sizeof(int16_t));
+    sample_ring_read_release(&ring_, len);
+    read += len;
+  }
+  return read;
+}
+
+uint64_t Receiver::next_sample_index () {
+  size_t tail = sample_ring_read_index(&ring_);
+  std::lock_guard<std::mutex> lock(segments_mutex_);
+  while (segments_.size() > 1 && segments_[1].ring_pos <= tail) segments_.pop_front();
+  if (segments_.empty()) return 0;
+  return segments_.front().first_sample + (tail - segments_.front().ring_pos);
+}
+
+double Receiver::sample_time (uint64_t index) const {
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  if (!clock_.synced() || !sample_clock_.valid()) return NAN;
+  return clock_.to_host(sample_clock_.time(index));
+}
+
+size_t Receiver::available () {
+  return sample_ring_fill(&ring_);
+}
+
+ReceiverStats Receiver::stats () const {
+  ReceiverStats stats;
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  const stream_decoder_stats_t &d = decoder_.stats;
+  stats.bytes = bytes_;
+  stats.frames = d.frames;
+  stats.samples = d.samples;
+  stats.skipped_bytes = d.skipped_bytes;
+  stats.lost_samples = d.lost_samples;
+  stats.lost_frames = d.lost_frames;
+  stats.crc_errors = d.crc_errors;
+  stats.overrun_flags = d.overrun_flags;
+  stats.amp_resets = amp_resets_;
+  stats.angle_frames = angle_frames_;
+  stats.angle_sample = angle_sample_;
+  stats.angle = angle_;
+  stats.ring_dropped = sample_ring_dropped(const_cast<sample_ring_t*>(&ring_));
+  stats.decode_errors = decode_errors_;
+  stats.captures = capture_count_;
+  stats.captures_missed = captures_missed_;
+  stats.feature_reports = feature_count_;
+  stats.cycle_reports = cycle_count_;
+  stats.device_stats = device_stats_count_;
+  stats.alarms = alarm_count_;
+  stats.alarm_connected = alarm_socket_ >= 0;
+  stats.recorded = recorder_ ? recorder_->samples() : 0;
+  stats.sample_rate = sample_rate_;
+  if (reorder_) {
+    stats.reordered = reorder_->stats.reordered;
+    stats.late_frames = reorder_->stats.late;
+    stats.duplicates = reorder_->stats.duplicates;
+  }
+  stats.clock_offset_us = clock_.offset_us();
+  stats.clock_drift_ppm = clock_.drift_ppm();
+  stats.clock_delay_us = clock_.min_delay_us();
+  stats.time_exchanges = clock_.exchanges();
+  return stats;
+}
+
+}
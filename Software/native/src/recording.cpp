@@ -0,0 +1,208 @@
+#include "pas/recording.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace pas {
+
+static const char HEADER_MAGIC[4] = { 'P', 'A', 'S', 'R' };
+static const char TRAILER_MAGIC[4] = { 'P', 'A', 'S', 'I' };
+
+RecordingWriter::RecordingWriter (const std::string &path, RecordingInfo info) : path_(path), save_pyramid_(info.pyramid) {
+  if (info.chunk_len == 0 || info.chunk_len > UINT32_MAX) throw std::invalid_argument("invalid chunk length");
+  if (info.start_time == 0) {
+    info.start_time = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()
+    ).count();
+  }
+  std::memcpy(header_.magic, HEADER_MAGIC, sizeof(HEADER_MAGIC));
+  header_.version = RECORDING_VERSION;
+  header_.header_len = sizeof(RecordingHeader);
+  header_.chunk_len = info.chunk_len;
+  header_.range_sel = info.range_sel;
+  header_.sample_rate = info.sample_rate;
+  header_.conversion = info.conversion;
+  header_.start_time = info.start_time;
+  pending_.reserve(info.chunk_len);
+
+  file_ = std::fopen(path.c_str(), "wb");
+  if (file_ == nullptr) throw std::system_error(errno, std::generic_category(), path);
+  /* Rewritten on close with the first sample and the rate */
+  write(&header_, sizeof(header_));
+}
+
+RecordingWriter::~RecordingWriter () {
+  try {
+    close();
+  } catch (const std::exception&) {
+    /* Samples written so far stay readable without the index */
+  }
+}
+
+void RecordingWriter::write (const void *data, size_t len) {
+  if (std::fwrite(data, 1, len, file_) != len) throw std::system_error(errno, std::generic_category(), "recording write");
+}
+
+void RecordingWriter::flush_chunk () {
+  if (pending_.empty()) return;
+  write(pending_.data(), pending_.size() * sizeof(int16_t));
+  chunk_.sample_count = pending_.size();
+  index_.push_back(chunk_);
+  n_samples_ += pending_.size();
+  pending_.clear();
+}
+
+void RecordingWriter::append (uint64_t first_sample, int64_t timestamp, float sample_rate, const int16_t *samples, size_t len) {
+  if (file_ == nullptr || len == 0) return;
+  if (!started_) {
+    header_.first_sample = first_sample;
+    if (header_.sample_rate <= 0) header_.sample_rate = sample_rate;
+    next_sample_ = first_sample;
+    started_ = true;
+  }
+  uint32_t flags = 0;
+  if (first_sample != next_sample_) {
+    /* Samples in between were lost, the chunk would no longer be evenly spaced */
+    flush_chunk();
+    flags = RECORDING_CHUNK_GAP;
+  }
+  double us_per_sample = header_.sample_rate > 0 ? 1e6 / header_.sample_rate : 0;
+
+  size_t done = 0;
+  while (done < len) {
+    if (pending_.empty()) {
+      chunk_.offset = n_samples_;
+      chunk_.first_sample = first_sample + done;
+      chunk_.timestamp = timestamp + (int64_t) std::llround(done * us_per_sample);
+      chunk_.flags = flags;
+      flags = 0;
+    }
+    size_t n = std::min(len - done, (size_t) header_.chunk_len - pending_.size());
+    pending_.insert(pending_.end(), samples + done, samples + done + n);
+    if (save_pyramid_) pyramid_.append(samples + done, n);
+    done += n;
+    if (pending_.size() == header_.chunk_len) flush_chunk();
+  }
+  next_sample_ = first_sample + len;
+}
+
+void RecordingWriter::close () {
+  if (file_ == nullptr) return;
+  FILE *file = file_;
+  try {
+    flush_chunk();
+    RecordingTrailer trailer = {};
+    trailer.index_offset = sizeof(RecordingHeader) + n_samples_ * sizeof(int16_t);
+    trailer.n_chunks = index_.size();
+    trailer.n_samples = n_samples_;
+    std::memcpy(trailer.magic, TRAILER_MAGIC, sizeof(TRAILER_MAGIC));
+    write(index_.data(), index_.size() * sizeof(RecordingChunk));
+    write(&trailer, sizeof(trailer));
+    if (std::fseek(file_, 0, SEEK_SET) != 0) throw std::system_error(errno, std::generic_category(), "recording seek");
+    write(&header_, sizeof(header_));
+  } catch (...) {
+    std::fclose(file);
+    file_ = nullptr;
+    throw;
+  }
+  file_ = nullptr;
+  if (std::fclose(file) != 0) throw std::system_error(errno, std::generic_category(), "recording close");
+  /* Positions in the pyramid are positions in the sample array, gaps are not in either */
+  if (save_pyramid_) pyramid_.save(pyramid_path(path_));
+}
+
+RecordingReader::RecordingReader (const std::string &path) {
+  fd_ = ::open(path.c_str(), O_RDONLY);
+  if (fd_ < 0) throw std::system_error(errno, std::generic_category(), path);
+  struct stat st;
+  if (fstat(fd_, &st) != 0 || (size_t) st.st_size < sizeof(RecordingHeader)) {
+    ::close(fd_);
+    throw std::runtime_error(path + ": not a recording");
+  }
+  map_len_ = st.st_size;
+  void *map = mmap(nullptr, map_len_, PROT_READ, MAP_SHARED, fd_, 0);
+  if (map == MAP_FAILED) {
+    int err = errno;
+    ::close(fd_);
+    throw std::system_error(err, std::generic_category(), "mmap " + path);
+  }
+  map_ = static_cast<const uint8_t*>(map);
+
+  std::memcpy(&header_, map_, sizeof(header_));
+  if (std::memcmp(header_.magic, HEADER_MAGIC, sizeof(HEADER_MAGIC)) != 0
+      || header_.version != RECORDING_VERSION || header_.header_len < sizeof(RecordingHeader)
+      || header_.header_len > map_len_ || header_.header_len % sizeof(int16_t) != 0) {
+    munmap(const_cast<uint8_t*>(map_), map_len_);
+    ::close(fd_);
+    throw std::runtime_error(path + ": not a recording or unsupported version");
+  }
+  samples_ = reinterpret_cast<const int16_t*>(map_ + header_.header_len);
+
+  RecordingTrailer trailer = {};
+  if (map_len_ >= header_.header_len + sizeof(trailer)) {
+    std::memcpy(&trailer, map_ + map_len_ - sizeof(trailer), sizeof(trailer));
+  }
+  size_t index_len = trailer.n_chunks * sizeof(RecordingChunk);
+  complete_ = std::memcmp(trailer.magic, TRAILER_MAGIC, sizeof(TRAILER_MAGIC)) == 0
+    && trailer.index_offset == header_.header_len + trailer.n_samples * sizeof(int16_t)
+    && trailer.index_offset + index_len + sizeof(trailer) == map_len_;
+  if (complete_) {
+    n_samples_ = trailer.n_samples;
+    index_.resize(trailer.n_chunks);
+    std::memcpy(index_.data(), map_ + trailer.index_offset, index_len);
+  } else {
+    /* Writer did not finish, every complete sample as one chunk */
+    n_samples_ = (map_len_ - header_.header_len) / sizeof(int16_t);
+    if (n_samples_ > 0) index_.push_back({ 0, header_.first_sample, 0, (uint32_t) n_samples_, 0 });
+  }
+}
+
+RecordingReader::~RecordingReader () {
+  if (map_ != nullptr) munmap(const_cast<uint8_t*>(map_), map_len_);
+  if (fd_ >= 0) ::close(fd_);
+}
+
+size_t RecordingReader::chunk_at (uint64_t pos) const {
+  if (index_.empty()) return 0;
+  /* Chunks only end early at gaps, so the estimate is never past the right one */
+  size_t c = std::min((size_t) (pos / std::max<uint32_t>(header_.chunk_len, 1)), index_.size() - 1);
+  while (c > 0 && index_[c].offset > pos) c--;
+  while (c + 1 < index_.size() && index_[c + 1].offset <= pos) c++;
+  return c;
+}
+
+int64_t RecordingReader::time_at (uint64_t pos) const {
+  if (index_.empty() || header_.sample_rate <= 0) return 0;
+  const RecordingChunk &chunk = index_[chunk_at(pos)];
+  return chunk.timestamp - index_.front().timestamp
+    + (int64_t) std::llround((pos - chunk.offset) * 1e6 / header_.sample_rate);
+}
+
+uint64_t RecordingReader::seek (int64_t time) const {
+  if (index_.empty()) return 0;
+  if (time <= 0 || header_.sample_rate <= 0) return 0;
+  int64_t target = index_.front().timestamp + time;
+  double samples_per_us = header_.sample_rate / 1e6;
+
+  size_t c = chunk_at((uint64_t) (time * samples_per_us));
+  while (c > 0 && index_[c].timestamp > target) c--;
+  while (c + 1 < index_.size() && index_[c + 1].timestamp <= target) c++;
+
+  const RecordingChunk &chunk = index_[c];
+  uint64_t k = (uint64_t) std::ceil((target - chunk.timestamp) * samples_per_us - 1e-6);
+  /* In a gap, the next chunk starts after the time */
+  if (k >= chunk.sample_count) return c + 1 < index_.size() ? index_[c + 1].offset : n_samples_;
+  return chunk.offset + k;
+}
+
+}
@@ -0,0 +1,94 @@
+#include "pas/sample_codec.hpp"
+
+namespace pas {
+
+namespace {
+
+/* MSB first reader with a 64 bit window, valid bits are left aligned */
+class BitReader {
+public:
+  BitReader (const uint8_t *data, size_t len) : p_(data), end_(data + len) {}
+
+  bool get (int n, uint32_t &value) {
+    if (bits_ < n) {
+      refill();
+      if (bits_ < n) return false;
+    }
+    value = n == 0 ? 0 : (uint32_t) (acc_ >> (64 - n));
+    acc_ = n == 0 ? acc_ : acc_ << n;
+    bits_ -= n;
+    return true;
+  }
+
+  /* Counts zero bits up to and including the next one */
+  bool unary (uint32_t &zeros) {
+    zeros = 0;
+    while (true) {
+      if (bits_ == 0 || acc_ == 0) {
+        zeros += bits_;
+        acc_ = 0;
+        bits_ = 0;
+        refill();
+        if (bits_ == 0) return false;
+        continue;
+      }
+      int z = __builtin_clzll(acc_);
+      zeros += z;
+      acc_ = z == 63 ? 0 : acc_ << (z + 1);
+      bits_ -= z + 1;
+      return true;
+    }
+  }
+
+private:
+  void refill () {
+    while (bits_ <= 56 && p_ < end_) {
+      acc_ |= (uint64_t) *p_++ << (56 - bits_);
+      bits_ += 8;
+    }
+  }
+
+  const uint8_t *p_;
+  const uint8_t *end_;
+  uint64_t acc_ = 0;
+  int bits_ = 0;
+};
+
+}
+
+bool decode_samples (const uint8_t *payload, size_t payload_len, int16_t *out, size_t count) {
+  if (count == 0) return true;
+  BitReader reader(payload, payload_len);
+  uint32_t value;
+  if (!reader.get(16, value)) return false;
+  int32_t prev = (int16_t) value;
+  out[0] = (int16_t) prev;
+
+  size_t pos = 1;
+  while (pos < count) {
+    size_t n = count - pos < SAMPLE_CODEC_BLOCK_LEN ? count - pos : SAMPLE_CODEC_BLOCK_LEN;
+    uint32_t k;
+    if (!reader.get(SAMPLE_CODEC_K_BITS, k)) return false;
+    if (k == SAMPLE_CODEC_VERBATIM) {
+      for (size_t i = 0; i < n; i++) {
+        if (!reader.get(16, value)) return false;
+        prev = (int16_t) value;
+        out[pos + i] = (int16_t) prev;
+      }
+    } else if (k <= SAMPLE_CODEC_MAX_K) {
+      for (size_t i = 0; i < n; i++) {
+        uint32_t q, low;
+        if (!reader.unary(q) || !reader.get(k, low)) return false;
+        uint32_t u = (q << k) | low;
+        prev += (int32_t) (u >> 1) ^ -(int32_t) (u & 1);
+        out[pos + i] = (int16_t) prev;
+      }
+    } else {
+      return false;
+    }
+    pos += n;
+  }
+  return true;
+}
+
+}
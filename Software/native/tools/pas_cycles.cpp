@@ -0,0 +1,434 @@
+/**
+ * @file pas_cycles.cpp
+ *
+ * @brief Combustion metrics of every cycle of a recording (.pasr), a raw
+ * int16 file or a live stream (an address), see pas/cycle_analysis.hpp.
+ * Cycles start at a fixed phase, sample -0 and every cycle_len samples after
+ * it, or on a rising trigger (-T level,hysteresis[,pre]) pre samples before
+ * the crossing. A stream tagged with the crank angle of an encoder gives the
+ * phase itself, angle 0 of the sensor being first_angle. Cycles cut by a gap
+ * in the stream are skipped. Cycles are analyzed in batches spread over the
+ * cores, written to a CSV with -o, and summed up at the end: mean IMEP and
+ * its coefficient of variation, peak pressure, heat release and CA50. A live
+ * stream also prints the summary every second, with the cycle peaks the
+ * sensor found.
+ *
+ * -k gives bar per sample and the offset (2^-frac_bits for a calibrated
+ * stream), -P pegs each cycle instead: the mean over len degrees from angle
+ * set to bar.
+ *
+ * usage: pas_cycles <file.pasr|file.raw|address> [-g bore,stroke,conrod,cr] [-n cycle_len] [-A first_angle[,cycle_deg]]
+ *   [-k scale[,offset]] [-P angle,len,bar] [-y gamma] [-w start,end] [-0 first_sample | -T level,hysteresis[,pre]]
+ *   [-j threads] [-t seconds] [-o file.csv]
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "pas/cycle_analysis.hpp"
+#include "pas/receiver.hpp"
+#include "pas/recording.hpp"
+#include "trigger.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+/* Complete cycles waiting before a batch is analyzed */
+static const size_t BATCH_CYCLES = 4096;
+
+static void usage () {
+  std::fprintf(
+    stderr,
+    "usage: pas_cycles <file.pasr|file.raw|address> [-g bore,stroke,conrod,cr] [-n cycle_len] [-A first_angle[,cycle_deg]]\n"
+    "  [-k scale[,offset]] [-P angle,len,bar] [-y gamma] [-w start,end] [-0 first_sample | -T level,hysteresis[,pre]]\n"
+    "  [-j threads] [-t seconds] [-o file.csv]\n"
+  );
+}
+
+/* Comma separated numbers, returns how many were read */
+static int parse_list (const char *s, double *v, int max) {
+  int n = 0;
+  while (n < max && *s != '\0') {
+    char *end;
+    v[n] = std::strtod(s, &end);
+    if (end == s) return -1;
+    n++;
+    s = *end == ',' ? end + 1 : end;
+    if (*end != ',' && *end != '\0') return -1;
+  }
+  return *s == '\0' ? n : -1;
+}
+
+static bool ends_with (const char *s, const char *suffix) {
+  size_t n = std::strlen(s), m = std::strlen(suffix);
+  return n >= m && std::strcmp(s + n - m, suffix) == 0;
+}
+
+struct Summary {
+  uint64_t cycles = 0;
+  uint64_t cut = 0;
+  double imep = 0;
+  double imep_sq = 0;
+  double gross = 0;
+  double pmep = 0;
+  double p_max = 0;
+  double p_max_top = -INFINITY;
+  double heat = 0;
+  double ca50 = 0;
+  uint64_t burned = 0;
+  double seconds = 0;
+
+  void add (const pas::CycleMetrics &m) {
+    cycles++;
+    imep += m.imep_net;
+    imep_sq += (double) m.imep_net * m.imep_net;
+    gross += m.imep_gross;
+    pmep += m.pmep;
+    p_max += m.p_max;
+    p_max_top = std::max(p_max_top, (double) m.p_max);
+    heat += m.heat_release;
+    if (!std::isnan(m.ca50)) {
+      ca50 += m.ca50;
+      burned++;
+    }
+  }
+
+  void print (const char *prefix) const {
+    if (cycles == 0) {
+      std::printf("%sno whole cycle, %llu cut\n", prefix, (unsigned long long) cut);
+      return;
+    }
+    double mean = imep / cycles;
+    double sd = std::sqrt(std::max(0.0, imep_sq / cycles - mean * mean));
+    std::printf(
+      "%s%llu cycles (%llu cut)\tIMEP net %.3f bar COV %.2f %%\tgross %.3f PMEP %.3f bar\tp_max %.2f bar (top %.2f)"
+      "\tQ %.1f J\tCA50 %.1f deg\t%.0f cycles/s\n",
+      prefix, (unsigned long long) cycles, (unsigned long long) cut, mean, mean != 0 ? 100 * sd / std::fabs(mean) : 0.0,
+      gross / cycles, pmep / cycles, p_max / cycles, p_max_top, heat / cycles,
+      burned > 0 ? ca50 / burned : NAN, seconds > 0 ? cycles / seconds : 0.0
+    );
+  }
+};
+
+/**
+ * Consecutive samples in, cycles out. Samples are kept from the oldest cycle
+ * start still waiting, a jump of the stream index drops the cycles it cut
+ */
+class CycleStream {
+public:
+  CycleStream (const pas::CycleAnalyzer &analyzer, unsigned threads, FILE *csv)
+    : analyzer_(analyzer), threads_(threads), csv_(csv) {}
+
+  /** Cycles start every cycle_len samples from the sample at index */
+  void set_phase (uint64_t index) {
+    analyze();
+    phase_ = index % analyzer_.cycle_len();
+    phased_ = true;
+    next_start_ = first_start(buf_first_);
+  }
+
+  /** Cycles start pre samples before each trigger */
+  void set_trigger (const trigger_config_t &config, uint32_t pre) {
+    trigger_detector_init(&detector_, &config);
+    pre_ = pre;
+    phased_ = false;
+  }
+
+  void feed (uint64_t index, const int16_t *x, size_t len) {
+    if (len == 0) return;
+    if (!started_ || index != buf_first_ + buf_.size()) restart(index);
+    size_t old = buf_.size();
+    buf_.insert(buf_.end(), x, x + len);
+    uint64_t end = buf_first_ + buf_.size();
+    if (phased_) {
+      while (next_start_ + analyzer_.cycle_len() <= end) {
+        pending_.push_back(next_start_);
+        next_start_ += analyzer_.cycle_len();
+      }
+    } else {
+      triggers_.resize(len / std::max<uint32_t>(1, detector_.holdoff) + 1);
+      size_t n = trigger_find_all(&detector_, &buf_[old], len, triggers_.data(), triggers_.size());
+      for (size_t i = 0; i < n; i++) {
+        if (triggers_[i] >= buf_first_ + pre_) waiting_.push_back(triggers_[i] - pre_);
+        else summary_.cut++;
+      }
+      while (!waiting_.empty() && waiting_.front() + analyzer_.cycle_len() <= end) {
+        pending_.push_back(waiting_.front());
+        waiting_.pop_front();
+      }
+    }
+    if (pending_.size() >= BATCH_CYCLES) analyze();
+  }
+
+  /** Analyzes the complete cycles waiting */
+  void analyze () {
+    if (pending_.empty()) return;
+    starts_.resize(pending_.size());
+    for (size_t i = 0; i < pending_.size(); i++) starts_[i] = pending_[i] - buf_first_;
+    out_.resize(pending_.size());
+    auto t0 = bench_clock::now();
+    analyzer_.analyze(buf_.data(), starts_.data(), starts_.size(), out_.data(), threads_);
+    summary_.seconds += std::chrono::duration<double>(bench_clock::now() - t0).count();
+    for (size_t i = 0; i < out_.size(); i++) {
+      const pas::CycleMetrics &m = out_[i];
+      summary_.add(m);
+      if (csv_ == nullptr) continue;
+      std::fprintf(
+        csv_, "%llu,%llu,%.4f,%.2f,%.4f,%.4f,%.4f,%.4f,%.4f,%.2f,%.3f,%.2f,%.2f,%.2f,%.2f,%.4f,%.2f\n",
+        (unsigned long long) (summary_.cycles - 1), (unsigned long long) pending_[i],
+        m.p_max, m.p_max_angle, m.p_min, m.p_pp, m.imep_net, m.imep_gross, m.pmep, m.heat_release,
+        m.hrr_max, m.hrr_max_angle, m.ca10, m.ca50, m.ca90, m.dp_max, m.dp_max_angle
+      );
+    }
+    pending_.clear();
+    trim();
+  }
+
+  const Summary& summary () const { return summary_; }
+
+private:
+  /* First start at or after index */
+  uint64_t first_start (uint64_t index) const {
+    uint64_t n = analyzer_.cycle_len();
+    uint64_t k = (index + n - phase_ + n - 1) / n;
+    return k * n + phase_ - n;
+  }
+
+  void restart (uint64_t index) {
+    analyze();
+    summary_.cut += waiting_.size() + (buf_.empty() ? 0 : 1);
+    waiting_.clear();
+    buf_.clear();
+    buf_first_ = index;
+    started_ = true;
+    if (phased_) next_start_ = first_start(index);
+    else trigger_detector_reset(&detector_, index);
+  }
+
+  /* Drops the samples before the oldest start still needed */
+  void trim () {
+    uint64_t end = buf_first_ + buf_.size();
+    uint64_t keep;
+    if (phased_) keep = next_start_;
+    else if (!waiting_.empty()) keep = waiting_.front();
+    else keep = end - std::min<uint64_t>(end - buf_first_, pre_);
+    keep = std::max(keep, buf_first_);
+    if (keep > end) keep = end;
+    buf_.erase(buf_.begin(), buf_.begin() + (keep - buf_first_));
+    buf_first_ = keep;
+  }
+
+  const pas::CycleAnalyzer &analyzer_;
+  unsigned threads_;
+  FILE *csv_;
+  std::vector<int16_t> buf_;
+  uint64_t buf_first_ = 0;
+  bool started_ = false;
+  bool phased_ = true;
+  uint64_t phase_ = 0;
+  uint64_t next_start_ = 0;
+  trigger_detector_t detector_ = {};
+  uint32_t pre_ = 0;
+  std::vector<uint64_t> triggers_;
+  /* Starts whose cycle is not complete yet, and complete ones not analyzed */
+  std::deque<uint64_t> waiting_;
+  std::deque<uint64_t> pending_;
+  std::vector<uint64_t> starts_;
+  std::vector<pas::CycleMetrics> out_;
+  Summary summary_;
+};
+
+static int run_stream (const char *address, CycleStream &stream, const pas::CycleAnalyzer &analyzer, bool phase_given, double seconds) {
+  pas::ReceiverConfig config;
+  config.host = address;
+  pas::Receiver receiver(config);
+  try {
+    receiver.start();
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "Failed to connect: %s\n", e.what());
+    return 1;
+  }
+  std::vector<int16_t> block(1 << 16);
+  auto start = bench_clock::now();
+  auto last_print = start;
+  uint32_t tagged_len = 0;
+  pas::CycleReport peak;
+  bool have_peak = false;
+  while (receiver.running()) {
+    /* The angle tags fix the phase once they come, unless it was given */
+    pas::ReceiverStats s = receiver.stats();
+    if (!phase_given && s.angle_frames > 0 && s.angle.cycle_len != tagged_len) {
+      tagged_len = s.angle.cycle_len;
+      if (tagged_len != analyzer.cycle_len()) {
+        std::fprintf(stderr, "Stream cycles are %u samples, analyzing %u\n", tagged_len, analyzer.cycle_len());
+      }
+      stream.set_phase(s.angle_sample - s.angle.angle);
+    }
+    uint64_t index = receiver.next_sample_index();
+    size_t len = receiver.read(block.data(), block.size());
+    if (len == 0) std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    else stream.feed(index, block.data(), len);
+    while (receiver.read_cycle(peak)) have_peak = true;
+
+    auto now = bench_clock::now();
+    if (now - last_print >= std::chrono::seconds(1)) {
+      stream.analyze();
+      stream.summary().print("");
+      if (have_peak) {
+        const stream_cycle_t &v = peak.values;
+        std::printf(
+          "  sensor: cycle %u max %d at %.1f deg, min %d at %.1f deg, p-p %d\n",
+          v.cycle, v.max, analyzer.angle(v.max_angle), v.min, analyzer.angle(v.min_angle), v.max - v.min
+        );
+      }
+      last_print = now;
+    }
+    if (seconds > 0 && std::chrono::duration<double>(now - start).count() >= seconds) break;
+  }
+  if (!receiver.running() && !receiver.error().empty()) {
+    std::fprintf(stderr, "Stream stopped: %s\n", receiver.error().c_str());
+  }
+  receiver.stop();
+  return 0;
+}
+
+int main (int argc, char **argv) {
+  if (argc < 2) {
+    usage();
+    return 1;
+  }
+  const char *input = argv[1];
+  pas::CycleAnalysisConfig config;
+  double seconds = 10;
+  unsigned threads = 0;
+  const char *csv_path = nullptr;
+  uint64_t first_sample = 0;
+  bool phase_given = false;
+  bool triggered = false;
+  trigger_config_t trigger = {};
+  uint32_t pre = 0;
+
+  for (int i = 2; i < argc; i++) {
+    double v[4];
+    bool ok = i + 1 < argc;
+    const char *arg = argv[i];
+    if (!ok) {
+      usage();
+      return 1;
+    }
+    const char *value = argv[++i];
+    if (std::strcmp(arg, "-g") == 0) {
+      ok = parse_list(value, v, 4) == 4;
+      config.geometry.bore = v[0];
+      config.geometry.stroke = v[1];
+      config.geometry.conrod = v[2];
+      config.geometry.compression_ratio = v[3];
+    } else if (std::strcmp(arg, "-n") == 0) config.cycle_len = (uint32_t) std::strtoul(value, nullptr, 10);
+    else if (std::strcmp(arg, "-A") == 0) {
+      int n = parse_list(value, v, 2);
+      ok = n >= 1;
+      config.first_angle = v[0];
+      if (n == 2) config.cycle_deg = v[1];
+    } else if (std::strcmp(arg, "-k") == 0) {
+      int n = parse_list(value, v, 2);
+      ok = n >= 1;
+      config.scale = v[0];
+      if (n == 2) config.offset = v[1];
+    } else if (std::strcmp(arg, "-P") == 0) {
+      ok = parse_list(value, v, 3) == 3;
+      config.peg_angle = v[0];
+      config.peg_len = v[1];
+      config.peg_bar = v[2];
+    } else if (std::strcmp(arg, "-y") == 0) config.gamma = std::atof(value);
+    else if (std::strcmp(arg, "-w") == 0) {
+      ok = parse_list(value, v, 2) == 2;
+      config.hr_start = v[0];
+      config.hr_end = v[1];
+    } else if (std::strcmp(arg, "-0") == 0) {
+      first_sample = std::strtoull(value, nullptr, 10);
+      phase_given = true;
+    } else if (std::strcmp(arg, "-T") == 0) {
+      int n = parse_list(value, v, 3);
+      ok = n >= 2;
+      trigger.level = (int16_t) v[0];
+      trigger.hysteresis = (uint16_t) v[1];
+      if (n == 3) pre = (uint32_t) v[2];
+      triggered = true;
+    } else if (std::strcmp(arg, "-j") == 0) threads = (unsigned) std::atoi(value);
+    else if (std::strcmp(arg, "-t") == 0) seconds = std::atof(value);
+    else if (std::strcmp(arg, "-o") == 0) csv_path = value;
+    else ok = false;
+    if (!ok) {
+      usage();
+      return 1;
+    }
+  }
+
+  std::unique_ptr<pas::CycleAnalyzer> analyzer;
+  try {
+    analyzer.reset(new pas::CycleAnalyzer(config));
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "Invalid configuration: %s\n", e.what());
+    return 1;
+  }
+
+  FILE *csv = nullptr;
+  if (csv_path != nullptr) {
+    csv = std::fopen(csv_path, "w");
+    if (csv == nullptr) {
+      std::perror(csv_path);
+      return 1;
+    }
+    std::fprintf(
+      csv, "cycle,first_sample,p_max,p_max_angle,p_min,p_pp,imep_net,imep_gross,pmep,heat_release,"
+      "hrr_max,hrr_max_angle,ca10,ca50,ca90,dp_max,dp_max_angle\n"
+    );
+  }
+
+  CycleStream stream(*analyzer, threads, csv);
+  if (triggered) {
+    /* One trigger a cycle */
+    trigger.slope = TRIGGER_RISING;
+    trigger.holdoff = config.cycle_len / 2;
+    stream.set_trigger(trigger, pre);
+  } else {
+    stream.set_phase(first_sample);
+  }
+
+  int result = 0;
+  if (ends_with(input, ".pasr")) {
+    try {
+      pas::RecordingReader reader(input);
+      /* Chunks after a gap start a new run of cycles, the others follow on */
+      for (const pas::RecordingChunk &c : reader.chunks()) {
+        stream.feed(c.first_sample, reader.samples() + c.offset, c.sample_count);
+      }
+    } catch (const std::exception &e) {
+      std::fprintf(stderr, "Failed to read %s: %s\n", input, e.what());
+      result = 1;
+    }
+  } else if (FILE *raw = std::fopen(input, "rb")) {
+    std::vector<int16_t> block(1 << 20);
+    uint64_t index = 0;
+    size_t len;
+    while ((len = std::fread(block.data(), sizeof(int16_t), block.size(), raw)) > 0) {
+      stream.feed(index, block.data(), len);
+      index += len;
+    }
+    std::fclose(raw);
+  } else {
+    result = run_stream(input, stream, *analyzer, phase_given || triggered, seconds);
+  }
+  stream.analyze();
+
+  std::printf("kernels %s, ", pas::cycle_kernels());
+  stream.summary().print("total: ");
+  if (csv != nullptr) std::fclose(csv);
+  return result;
+}
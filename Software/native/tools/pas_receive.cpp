@@ -0,0 +1,260 @@
+/**
+ * @file pas_receive.cpp
+ *
+ * @brief Connects to a sensor, prints stream statistics every second and
+ * optionally dumps the raw int16 samples to a file or writes a recording
+ * (pas/recording.hpp) with -r. With -s the driver stats of the sensor are
+ * requested and printed along. -u receives the datagram stream instead, from
+ * the multicast group given or subscribing to the sensor with "unicast", -p
+ * then gives the datagram port. -a changes the ADC settings once frames come,
+ * "rate=50000 spi=10000000" for example or "" to only print them. Input
+ * alarm events of the event port are printed as they come, with their
+ * latency from the conversion on the sensor and on the host clock. With
+ * -p 3336 the recording the sensor kept in flash is downloaded, until the
+ * sensor closes the connection. The calibration the sensor converts the
+ * samples to pressure with is asked for once frames come and printed with
+ * each report, so is the charge amplifier baseline estimate, sent again
+ * after each amplifier reset. An encoder clocked stream also prints the crank
+ * angle of its last frame and the peak of the last cycle the sensor reported.
+ *
+ * usage: pas_receive <address> [-p port] [-u group|unicast] [-t seconds] [-o file.raw] [-r file.pasr] [-s] [-a settings]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "pas/receiver.hpp"
+
+static void usage () {
+  std::fprintf(stderr, "usage: pas_receive <address> [-p port] [-u group|unicast] [-t seconds] [-o file.raw] [-r file.pasr] [-s] [-a settings]\n");
+}
+
+int main (int argc, char **argv) {
+  if (argc < 2) {
+    usage();
+    return 1;
+  }
+  pas::ReceiverConfig config;
+  config.host = argv[1];
+  double seconds = 0;
+  const char *out_path = nullptr;
+  const char *recording_path = nullptr;
+  bool device_stats = false;
+  const char *adc_settings = nullptr;
+  bool calibration_requested = false;
+
+  for (int i = 2; i < argc; i++) {
+    if (std::strcmp(argv[i], "-p") == 0 && i + 1 < argc) config.port = config.udp_port = std::atoi(argv[++i]);
+    else if (std::strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+      config.transport = pas::Transport::udp;
+      if (std::strcmp(argv[++i], "unicast") != 0) config.group = argv[i];
+    }
+    else if (std::strcmp(argv[i], "-t") == 0 && i + 1 < argc) seconds = std::atof(argv[++i]);
+    else if (std::strcmp(argv[i], "-o") == 0 && i + 1 < argc) out_path = argv[++i];
+    else if (std::strcmp(argv[i], "-r") == 0 && i + 1 < argc) recording_path = argv[++i];
+    else if (std::strcmp(argv[i], "-s") == 0) device_stats = true;
+    else if (std::strcmp(argv[i], "-a") == 0 && i + 1 < argc) adc_settings = argv[++i];
+    else {
+      usage();
+      return 1;
+    }
+  }
+
+  FILE *out = nullptr;
+  if (out_path != nullptr) {
+    out = std::fopen(out_path, "wb");
+    if (out == nullptr) {
+      std::perror(out_path);
+      return 1;
+    }
+  }
+
+  pas::Receiver receiver(config);
+  try {
+    receiver.start();
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "Failed to connect: %s\n", e.what());
+    return 1;
+  }
+
+  if (recording_path != nullptr) {
+    /* Range and conversion of the firmware defaults, see realTime.py */
+    pas::RecordingInfo info;
+    info.range_sel = 0x0003;
+    info.conversion = 4096.0 / 32767 * 1.25 / 1000;
+    try {
+      receiver.start_recording(recording_path, info);
+    } catch (const std::exception &e) {
+      std::fprintf(stderr, "Failed to start recording: %s\n", e.what());
+      return 1;
+    }
+  }
+
+  using clock = std::chrono::steady_clock;
+  std::vector<int16_t> block(1 << 16);
+  auto start = clock::now();
+  auto last_print = start;
+  uint64_t last_samples = 0;
+  uint64_t last_bytes = 0;
+
+  while (receiver.running()) {
+    size_t len = receiver.read(block.data(), block.size());
+    if (len == 0) std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    else if (out != nullptr) std::fwrite(block.data(), sizeof(int16_t), len, out);
+    pas::AlarmEvent alarm;
+    while (receiver.read_alarm(alarm)) {
+      const stream_alarm_t &v = alarm.values;
+      std::printf(
+        "ALARM %u: flags %u -> %u at sample %llu (%d)\tdetected +%lld us\tsent +%lld us\tarrived +%.0f us\tsensor max %u us\tlost %u\n",
+        v.number, v.previous, v.flags, (unsigned long long) alarm.index, v.sample,
+        (long long) (v.detected - alarm.timestamp), (long long) (v.sent - alarm.timestamp), alarm.latency_us,
+        v.latency_max_us, v.lost
+      );
+    }
+    if (adc_settings != nullptr && receiver.stats().frames > 0) {
+      /* Once frames come, the server read the handshake alone */
+      try {
+        receiver.configure_adc(adc_settings);
+      } catch (const std::exception &e) {
+        std::fprintf(stderr, "ADC command failed: %s\n", e.what());
+      }
+      adc_settings = nullptr;
+    }
+    if (!calibration_requested && receiver.stats().frames > 0) {
+      try {
+        receiver.request_calibration();
+        receiver.request_baseline();
+      } catch (const std::exception &e) {
+        std::fprintf(stderr, "Calibration request failed: %s\n", e.what());
+      }
+      calibration_requested = true;
+    }
+
+    auto now = clock::now();
+    if (now - last_print >= std::chrono::seconds(1)) {
+      pas::ReceiverStats s = receiver.stats();
+      double dt = std::chrono::duration<double>(now - last_print).count();
+      std::printf(
+        "%.3f kS/s\t%.1f kB/s\tfs %.1f Hz\tframes %llu\tlost frames %u\tlost samples %llu\tcrc errors %u\tdecode errors %u\toverruns %u\n",
+        (s.samples - last_samples) / dt / 1e3, (s.bytes - last_bytes) / dt / 1e3, s.sample_rate, (unsigned long long) s.frames,
+        s.lost_frames, (unsigned long long) s.lost_samples, s.crc_errors, s.decode_errors, s.overrun_flags
+      );
+      if (config.transport == pas::Transport::udp) {
+        std::printf("  datagrams: reordered %u\tlate %u\tduplicates %u\n", s.reordered, s.late_frames, s.duplicates);
+      }
+      if (s.time_exchanges > 0) {
+        /* Age on the host clock of the next sample to read, the delay through the sensor, network and ring */
+        double age = pas::host_time_us() - receiver.sample_time(receiver.next_sample_index());
+        std::printf(
+          "  clock: offset %.1f us\tdrift %.2f ppm\tround trip %lld us\texchanges %llu\tnext sample age %.0f us\n",
+          s.clock_offset_us, s.clock_drift_ppm, (long long) s.clock_delay_us, (unsigned long long) s.time_exchanges, age
+        );
+      }
+      if (s.angle_frames > 0) {
+        std::printf(
+          "  angle: cycle %u angle %u/%u at sample %llu\tTDC sync errors %u\ttagged frames %u\n",
+          s.angle.cycle, s.angle.angle, s.angle.cycle_len, (unsigned long long) s.angle_sample,
+          s.angle.sync_errors, s.angle_frames
+        );
+      }
+      pas::CycleReport cycle;
+      bool have_cycle = false;
+      while (receiver.read_cycle(cycle)) have_cycle = true;
+      if (have_cycle) {
+        const stream_cycle_t &v = cycle.values;
+        std::printf(
+          "  cycle %u: max %d at angle %u\tmin %d at angle %u\tp-p %d\treports %u\n",
+          v.cycle, v.max, v.max_angle, v.min, v.min_angle, v.max - v.min, s.cycle_reports
+        );
+      }
+      last_samples = s.samples;
+      last_bytes = s.bytes;
+      last_print = now;
+
+      pas::DeviceStats d;
+      if (device_stats && receiver.read_device_stats(d)) {
+        const stream_stats_t &v = d.values;
+        std::printf(
+          "  sensor: produced %.1f kS/s sent %.1f kS/s\tring %u/%u\toverruns %u (%u samples)"
+          "\tisr latency ns %u/%u/%u\tjitter max %u ns\tsend us p50 %u p90 %u p99 %u max %u\n",
+          v.produced_rate / 1e3, v.sent_rate / 1e3, v.ring_high_water, v.ring_len, v.overruns, v.dropped,
+          v.isr_latency_min_ns, v.isr_latency_mean_ns, v.isr_latency_max_ns, v.jitter_max_ns,
+          v.send_p50_us, v.send_p90_us, v.send_p99_us, v.send_max_us
+        );
+        std::printf(
+          "  stage load: acquire %.1f %%\tprocess %.1f %%\ttransmit %.1f %%\trecord %.1f %%\n",
+          v.stage_load[0] / 10.0, v.stage_load[1] / 10.0, v.stage_load[2] / 10.0, v.stage_load[3] / 10.0
+        );
+        if (v.backlog_capacity > 0) {
+          std::printf(
+            "  backlog: %u/%u samples\thigh water %u\trefused %u blocks\n",
+            v.backlog_depth, v.backlog_capacity, v.backlog_high_water, v.backlog_full
+          );
+        }
+      }
+      pas::AdcReport a;
+      if (receiver.read_adc_report(a)) {
+        const stream_adc_config_t &v = a.values;
+        std::printf(
+          "  adc: %s%.2f Hz (asked %.0f)\trange %#x\t%s SDO\tSPI %u Hz\talarms %u..%u hysteresis %u\n",
+          v.rejected ? "REJECTED, kept " : "", v.sample_rate, v.requested_rate, v.range,
+          v.sdo_mode ? "dual" : "single", v.spi_clock, v.alarm_low, v.alarm_high, v.alarm_hysteresis
+        );
+      }
+      pas::CalibrationReport c;
+      if (receiver.read_calibration(c)) {
+        const stream_calibration_t &v = c.values;
+        if (v.enabled) {
+          std::printf(
+            "  calibration %08x: bar = value * %g\trange %#x at %.4g V/code\t%.3f pC/bar\tamplifier %.0f pC for %.1f V"
+            "\tgain %.4f offset %d\tdrift %.0f ppm/C %.4f bar/C at %.1f C (ref %.1f C)\n",
+            v.hash, c.scale(), v.range, v.lsb_volts, v.sensitivity, v.amp_range_pc, v.amp_full_scale_v,
+            v.gain, v.offset, v.sensitivity_drift, v.zero_drift, v.temperature, v.reference_temp
+          );
+        } else {
+          std::printf("  calibration: off, ADC codes\trange %#x at %.4g V/code\n", v.range, v.lsb_volts);
+        }
+      }
+      pas::BaselineReport b;
+      if (receiver.read_baseline(b)) {
+        const stream_baseline_t &v = b.values;
+        std::printf(
+          "  baseline: %s pegs %u\tlevel %.1f rest %.1f codes\tdrift %.1f codes/s\tamplifier resets %u, last at sample %llu%s\tflagged frames %u\n",
+          v.peg ? "window" : "minimum", v.pegs, v.level, v.rest, v.drift, v.resets,
+          (unsigned long long) v.reset_index, v.reset_pending ? ", one pending" : "", receiver.stats().amp_resets
+        );
+      }
+      if (device_stats) {
+        try {
+          receiver.request_stats();
+        } catch (const std::exception &e) {
+          std::fprintf(stderr, "Stats request failed: %s\n", e.what());
+        }
+      }
+    }
+    if (seconds > 0 && std::chrono::duration<double>(now - start).count() >= seconds) break;
+  }
+  if (!receiver.running() && !receiver.error().empty()) {
+    std::fprintf(stderr, "Stream stopped: %s\n", receiver.error().c_str());
+  }
+  receiver.stop();
+  /* A download from the recording port ends before the first print */
+  pas::ReceiverStats s = receiver.stats();
+  std::printf(
+    "total: %llu samples in %llu frames, %llu bytes\tlost frames %u\tlost samples %llu\tcrc errors %u\tdecode errors %u\toverruns %u\n",
+    (unsigned long long) s.samples, (unsigned long long) s.frames, (unsigned long long) s.bytes,
+    s.lost_frames, (unsigned long long) s.lost_samples, s.crc_errors, s.decode_errors, s.overrun_flags
+  );
+  if (recording_path != nullptr) {
+    try {
+      receiver.stop_recording();
+    } catch (const std::exception &e) {
+      std::fprintf(stderr, "Failed to finish recording: %s\n", e.what());
+    }
+  }
+  if (out != nullptr) std::fclose(out);
+  return 0;
+}
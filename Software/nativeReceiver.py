@@ -0,0 +1,505 @@
+import os
+import time
+import ctypes
+import logging
+import numpy as np
+
+from threading import Thread
+
+from tcpClient import Capture
+
+""" Built with: cmake -S native -B native/build && cmake --build native/build """
+LIB_PATH = os.environ.get(
+  'PAS_NATIVE_LIB',
+  os.path.join(os.path.dirname(os.path.abspath(__file__)), 'native', 'build', 'libpas_native.so')
+)
+
+class ReceiverStats(ctypes.Structure):
+  _fields_ = [
+    ('bytes', ctypes.c_uint64),
+    ('frames', ctypes.c_uint64),
+    ('samples', ctypes.c_uint64),
+    ('skippedBytes', ctypes.c_uint64),
+    ('lostSamples', ctypes.c_uint64),
+    ('lostFrames', ctypes.c_uint32),
+    ('crcErrors', ctypes.c_uint32),
+    ('overrunFlags', ctypes.c_uint32),
+    ('ringDropped', ctypes.c_uint32),
+    ('decodeErrors', ctypes.c_uint32),
+    ('captures', ctypes.c_uint32),
+    ('capturesMissed', ctypes.c_uint32),
+    ('featureReports', ctypes.c_uint32),
+    ('sampleRate', ctypes.c_float),
+    ('reordered', ctypes.c_uint32),
+    ('lateFrames', ctypes.c_uint32),
+    ('duplicates', ctypes.c_uint32),
+    ('timeExchanges', ctypes.c_uint32),
+    ('clockDelayUs', ctypes.c_uint32),
+    ('clockOffsetUs', ctypes.c_double),
+    ('clockDriftPpm', ctypes.c_float),
+    ('alarms', ctypes.c_uint32),
+    ('alarmConnected', ctypes.c_int32),
+    ('ampResets', ctypes.c_uint32),
+    ('angleFrames', ctypes.c_uint32),
+    ('angleSample', ctypes.c_uint64),
+    ('angleCycle', ctypes.c_uint32),
+    ('angle', ctypes.c_uint16),
+    ('angleCycleLen', ctypes.c_uint16),
+    ('angleSyncErrors', ctypes.c_uint32),
+    ('cycleReports', ctypes.c_uint32),
+  ]
+
+class CaptureInfo(ctypes.Structure):
+  _fields_ = [
+    ('triggerIndex', ctypes.c_uint64),
+    ('timestamp', ctypes.c_int64),
+    ('number', ctypes.c_uint32),
+    ('missed', ctypes.c_uint32),
+    ('preTrigger', ctypes.c_uint32),
+    ('length', ctypes.c_uint32),
+    ('sampleRate', ctypes.c_float),
+    ('truncated', ctypes.c_int32),
+  ]
+
+class FeatureReport(ctypes.Structure):
+  """ Same attributes as tcpClient.FeatureReport """
+  _fields_ = [
+    ('firstSample', ctypes.c_uint64),
+    ('timestamp', ctypes.c_int64),
+    ('sampleRate', ctypes.c_float),
+    ('length', ctypes.c_uint32),
+    ('min', ctypes.c_int16),
+    ('max', ctypes.c_int16),
+    ('mean', ctypes.c_float),
+    ('acRms', ctypes.c_float),
+    ('dominantFreq', ctypes.c_float),
+    ('dominantAmplitude', ctypes.c_float),
+    ('fftLen', ctypes.c_uint16),
+    ('windows', ctypes.c_uint16),
+  ]
+
+class AdcReport(ctypes.Structure):
+  """ pas_adc_report_t, ADC settings in use on the sensor """
+  _fields_ = [
+    ('lastSample', ctypes.c_uint64),
+    ('requestedRate', ctypes.c_float),
+    ('sampleRate', ctypes.c_float),
+    ('spiClock', ctypes.c_uint32),
+    ('range', ctypes.c_uint8),
+    ('sdoMode', ctypes.c_uint8),
+    ('alarmHysteresis', ctypes.c_uint8),
+    ('rejected', ctypes.c_uint8),
+    ('alarmHigh', ctypes.c_uint16),
+    ('alarmLow', ctypes.c_uint16),
+  ]
+
+class CalibrationReport(ctypes.Structure):
+  """ pas_calibration_report_t, calibration the sensor converts the samples with,
+  pressure in bar = sample * scale. scale is 0 while the samples are ADC codes """
+  _fields_ = [
+    ('lastSample', ctypes.c_uint64),
+    ('hash', ctypes.c_uint32),
+    ('fracBits', ctypes.c_int8),
+    ('enabled', ctypes.c_uint8),
+    ('range', ctypes.c_uint16),
+    ('lsbVolts', ctypes.c_float),
+    ('gain', ctypes.c_float),
+    ('offset', ctypes.c_int32),
+    ('ampRange', ctypes.c_float),
+    ('ampFullScale', ctypes.c_float),
+    ('sensitivity', ctypes.c_float),
+    ('sensitivityDrift', ctypes.c_float),
+    ('zeroDrift', ctypes.c_float),
+    ('referenceTemp', ctypes.c_float),
+    ('temperature', ctypes.c_float),
+    ('scale', ctypes.c_double),
+  ]
+
+class BaselineReport(ctypes.Structure):
+  """ pas_baseline_report_t, drift estimate of the charge amplifier baseline in codes
+  and codes/s, resetIndex is the first sample after the last amplifier reset """
+  _fields_ = [
+    ('lastSample', ctypes.c_uint64),
+    ('resetIndex', ctypes.c_uint64),
+    ('resets', ctypes.c_uint32),
+    ('pegs', ctypes.c_uint32),
+    ('level', ctypes.c_float),
+    ('rest', ctypes.c_float),
+    ('drift', ctypes.c_float),
+    ('reference', ctypes.c_int16),
+    ('peg', ctypes.c_uint8),
+    ('resetPending', ctypes.c_uint8),
+  ]
+
+class CycleReport(ctypes.Structure):
+  """ pas_cycle_report_t, peak of an encoder cycle found by the sensor, codes and
+  conversions from TDC, firstSample is the sample at angle 0 """
+  _fields_ = [
+    ('firstSample', ctypes.c_uint64),
+    ('timestamp', ctypes.c_int64),
+    ('cycle', ctypes.c_uint32),
+    ('cycleLen', ctypes.c_uint16),
+    ('max', ctypes.c_int16),
+    ('maxAngle', ctypes.c_uint16),
+    ('min', ctypes.c_int16),
+    ('minAngle', ctypes.c_uint16),
+  ]
+
+class CycleConfig(ctypes.Structure):
+  """ pas_cycle_config_t, engine in mm and analysis settings, see cycle_analysis.hpp """
+  _fields_ = [
+    ('bore', ctypes.c_double),
+    ('stroke', ctypes.c_double),
+    ('conrod', ctypes.c_double),
+    ('compression_ratio', ctypes.c_double),
+    ('cycle_len', ctypes.c_uint32),
+    ('cycle_deg', ctypes.c_double),
+    ('first_angle', ctypes.c_double),
+    ('scale', ctypes.c_double),
+    ('offset', ctypes.c_double),
+    ('peg_angle', ctypes.c_double),
+    ('peg_len', ctypes.c_double),
+    ('peg_bar', ctypes.c_double),
+    ('gamma', ctypes.c_double),
+    ('hr_start', ctypes.c_double),
+    ('hr_end', ctypes.c_double),
+  ]
+
+class AlarmEvent(ctypes.Structure):
+  """ pas_alarm_event_t, change of the ADC input alarm flags (bit 0 low, bit 1 high), times in us """
+  _fields_ = [
+    ('index', ctypes.c_uint64),
+    ('timestamp', ctypes.c_int64),
+    ('detected', ctypes.c_int64),
+    ('sent', ctypes.c_int64),
+    ('arrival', ctypes.c_int64),
+    ('latencyUs', ctypes.c_double),
+    ('number', ctypes.c_uint32),
+    ('lost', ctypes.c_uint32),
+    ('latencyMaxUs', ctypes.c_uint32),
+    ('sample', ctypes.c_int16),
+    ('flags', ctypes.c_uint8),
+    ('previous', ctypes.c_uint8),
+    ('sampleRate', ctypes.c_float),
+  ]
+
+""" pas_pyramid_bin_t """
+PYRAMID_BIN = np.dtype([('min', '<i2'), ('max', '<i2'), ('mean', '<f4')])
+""" pas_cycle_metrics_t, bar, J and degrees after firing TDC """
+CYCLE_METRICS = np.dtype([(name, '<f4') for name in (
+  'p_max', 'p_max_angle', 'p_min', 'p_pp', 'imep_net', 'imep_gross', 'pmep', 'heat_release',
+  'hrr_max', 'hrr_max_angle', 'ca10', 'ca50', 'ca90', 'dp_max', 'dp_max_angle'
+)])
+
+_lib = None
+
+def loadLibrary():
+  global _lib
+  if _lib is not None:
+    return _lib
+  lib = ctypes.CDLL(LIB_PATH)
+  lib.pas_last_error.restype = ctypes.c_char_p
+  lib.pas_receiver_create.argtypes = [ctypes.c_char_p, ctypes.c_uint16, ctypes.c_size_t]
+  lib.pas_receiver_create.restype = ctypes.c_void_p
+  lib.pas_receiver_create_udp.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_uint16, ctypes.c_size_t]
+  lib.pas_receiver_create_udp.restype = ctypes.c_void_p
+  lib.pas_receiver_start.argtypes = [ctypes.c_void_p]
+  lib.pas_receiver_running.argtypes = [ctypes.c_void_p]
+  lib.pas_receiver_read.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t]
+  lib.pas_receiver_read.restype = ctypes.c_size_t
+  lib.pas_receiver_next_sample_index.argtypes = [ctypes.c_void_p]
+  lib.pas_receiver_next_sample_index.restype = ctypes.c_uint64
+  lib.pas_receiver_sample_time.argtypes = [ctypes.c_void_p, ctypes.c_uint64]
+  lib.pas_receiver_sample_time.restype = ctypes.c_double
+  lib.pas_resample.argtypes = [
+    ctypes.c_void_p, ctypes.c_size_t, ctypes.c_double, ctypes.c_double,
+    ctypes.c_double, ctypes.c_double, ctypes.c_size_t, ctypes.c_void_p
+  ]
+  lib.pas_resample.restype = ctypes.c_size_t
+  lib.pas_receiver_available.argtypes = [ctypes.c_void_p]
+  lib.pas_receiver_available.restype = ctypes.c_size_t
+  lib.pas_receiver_get_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(ReceiverStats)]
+  lib.pas_receiver_destroy.argtypes = [ctypes.c_void_p]
+  lib.pas_receiver_read_capture.argtypes = [ctypes.c_void_p, ctypes.POINTER(CaptureInfo), ctypes.c_void_p, ctypes.c_size_t]
+  lib.pas_find_triggers.argtypes = [
+    ctypes.c_void_p, ctypes.c_size_t, ctypes.c_int16, ctypes.c_uint16, ctypes.c_int, ctypes.c_void_p, ctypes.c_size_t
+  ]
+  lib.pas_find_triggers.restype = ctypes.c_size_t
+  lib.pas_receiver_read_features.argtypes = [ctypes.c_void_p, ctypes.POINTER(FeatureReport)]
+  lib.pas_receiver_configure_adc.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+  lib.pas_receiver_read_adc_report.argtypes = [ctypes.c_void_p, ctypes.POINTER(AdcReport)]
+  lib.pas_receiver_request_calibration.argtypes = [ctypes.c_void_p]
+  lib.pas_receiver_read_calibration.argtypes = [ctypes.c_void_p, ctypes.POINTER(CalibrationReport)]
+  lib.pas_receiver_request_baseline.argtypes = [ctypes.c_void_p]
+  lib.pas_receiver_read_baseline.argtypes = [ctypes.c_void_p, ctypes.POINTER(BaselineReport)]
+  lib.pas_receiver_read_alarm.argtypes = [ctypes.c_void_p, ctypes.POINTER(AlarmEvent)]
+  lib.pas_extract_features.argtypes = [
+    ctypes.c_void_p, ctypes.c_size_t, ctypes.c_float, ctypes.c_uint16, ctypes.c_uint16, ctypes.c_void_p, ctypes.c_size_t
+  ]
+  lib.pas_receiver_start_recording.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint16, ctypes.c_double]
+  lib.pas_receiver_stop_recording.argtypes = [ctypes.c_void_p]
+  lib.pas_pyramid_create.argtypes = [ctypes.c_uint32, ctypes.c_uint16]
+  lib.pas_pyramid_create.restype = ctypes.c_void_p
+  lib.pas_pyramid_load.argtypes = [ctypes.c_char_p]
+  lib.pas_pyramid_load.restype = ctypes.c_void_p
+  lib.pas_pyramid_save.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+  lib.pas_pyramid_append.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t]
+  lib.pas_pyramid_size.argtypes = [ctypes.c_void_p]
+  lib.pas_pyramid_size.restype = ctypes.c_uint64
+  lib.pas_pyramid_render.argtypes = [
+    ctypes.c_void_p, ctypes.c_uint64, ctypes.c_uint64, ctypes.c_size_t, ctypes.c_void_p, ctypes.c_void_p
+  ]
+  lib.pas_pyramid_render.restype = ctypes.c_size_t
+  lib.pas_pyramid_destroy.argtypes = [ctypes.c_void_p]
+  lib.pas_power_spectrum.argtypes = [ctypes.c_void_p, ctypes.c_size_t, ctypes.c_float, ctypes.c_void_p]
+  lib.pas_receiver_read_cycle.argtypes = [ctypes.c_void_p, ctypes.POINTER(CycleReport)]
+  lib.pas_cycle_config_default.argtypes = [ctypes.POINTER(CycleConfig)]
+  lib.pas_analyze_cycles.argtypes = [
+    ctypes.POINTER(CycleConfig), ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t, ctypes.c_void_p, ctypes.c_uint
+  ]
+  _lib = lib
+  return lib
+
+def isAvailable():
+  try:
+    loadLibrary()
+    return True
+  except OSError:
+    return False
+
+def findCross(signal: np.ndarray, triggerLevel: int, hysteresis: int, rising=False):
+  """ trigger.findCross on int16 samples with the firmware kernel """
+  lib = loadLibrary()
+  x = np.ascontiguousarray(signal, dtype=np.int16)
+  out = np.empty(x.size // 2 + 1, dtype=np.uint64)
+  n = lib.pas_find_triggers(x.ctypes.data, x.size, triggerLevel, hysteresis, int(rising), out.ctypes.data, out.size)
+  return out[:n].astype(int)
+
+def powerSpectrum(signal: np.ndarray, offset=0.0):
+  """ Hann windowed |X[k]|^2 of int16 samples with the firmware FFT, size a power of two """
+  lib = loadLibrary()
+  x = np.ascontiguousarray(signal, dtype=np.int16)
+  power = np.empty(x.size // 2 + 1, dtype=np.float32)
+  if lib.pas_power_spectrum(x.ctypes.data, x.size, offset, power.ctypes.data) != 0:
+    raise ValueError(lib.pas_last_error().decode())
+  return power
+
+def extractFeatures(signal: np.ndarray, fs: float, fftLen=4096, windows=1):
+  """ Firmware feature reports over int16 samples, one every fftLen * windows samples """
+  lib = loadLibrary()
+  x = np.ascontiguousarray(signal, dtype=np.int16)
+  reports = (FeatureReport * max(1, x.size // (fftLen * windows)))()
+  n = lib.pas_extract_features(x.ctypes.data, x.size, fs, fftLen, windows, reports, len(reports))
+  if n < 0:
+    raise ValueError(lib.pas_last_error().decode())
+  return reports[:n]
+
+def resample(signal: np.ndarray, firstTime: float, period: float, t0: float, outPeriod: float, outLen: int):
+  """ int16 samples starting at firstTime, linearly interpolated on t0 + k * outPeriod, NaN outside them.
+  With NativeTcpClient.blockTime() of several sensors the streams share one time base """
+  lib = loadLibrary()
+  x = np.ascontiguousarray(signal, dtype=np.int16)
+  out = np.empty(max(outLen, 0), dtype=np.float32)
+  lib.pas_resample(x.ctypes.data, x.size, firstTime, period, t0, outPeriod, out.size, out.ctypes.data)
+  return out
+
+class Pyramid():
+  """ Min/max/mean pyramid of int16 samples, renders any window from a few bins per column """
+  def __init__(self, base=64, fanout=8, path=None):
+    self.lib = loadLibrary()
+    if path is None:
+      self.handle = self.lib.pas_pyramid_create(base, fanout)
+    else:
+      self.handle = self.lib.pas_pyramid_load(path.encode())
+    if not self.handle:
+      raise ValueError(self.lib.pas_last_error().decode())
+
+  def __del__(self):
+    if getattr(self, 'handle', None):
+      self.lib.pas_pyramid_destroy(self.handle)
+      self.handle = None
+
+  def __len__(self):
+    return self.lib.pas_pyramid_size(self.handle)
+
+  def append(self, samples: np.ndarray):
+    x = np.ascontiguousarray(samples, dtype=np.int16)
+    self.lib.pas_pyramid_append(self.handle, x.ctypes.data, x.size)
+
+  def save(self, path: str):
+    if self.lib.pas_pyramid_save(self.handle, path.encode()) != 0:
+      raise OSError(self.lib.pas_last_error().decode())
+
+  def render(self, begin: int, end: int, columns: int, raw=None) -> np.ndarray:
+    """ Up to columns PYRAMID_BIN over positions [begin, end). raw are the samples the pyramid was built from,
+    with them the column edges are exact """
+    out = np.empty(max(columns, 0), dtype=PYRAMID_BIN)
+    rawPtr = None
+    if raw is not None:
+      if raw.dtype != np.int16 or not raw.flags['C_CONTIGUOUS'] or raw.size < len(self):
+        raise ValueError('raw must be the contiguous int16 samples of the pyramid')
+      rawPtr = raw.ctypes.data
+    n = self.lib.pas_pyramid_render(self.handle, begin, end, out.size, rawPtr, out.ctypes.data)
+    return out[:n]
+
+def analyzeCycles(signal: np.ndarray, starts, threads=0, **settings):
+  """ CYCLE_METRICS of the cycles of samples starting at starts, spread over threads (0 for
+  every core). settings are the CycleConfig fields, scale gives bar per sample """
+  lib = loadLibrary()
+  config = CycleConfig()
+  lib.pas_cycle_config_default(ctypes.byref(config))
+  for key, value in settings.items():
+    setattr(config, key, value)
+  x = np.ascontiguousarray(signal, dtype=np.int16)
+  first = np.ascontiguousarray(starts, dtype=np.uint64)
+  if first.size > 0 and (first.max() + config.cycle_len > x.size):
+    raise ValueError('cycle past the end of the samples')
+  out = np.empty(first.size, dtype=CYCLE_METRICS)
+  if lib.pas_analyze_cycles(ctypes.byref(config), x.ctypes.data, first.ctypes.data, first.size, out.ctypes.data, threads) != 0:
+    raise ValueError(lib.pas_last_error().decode())
+  return out
+
+class NativeTcpClient():
+  """ Drop in replacement of TcpClient backed by libpas_native.
+  udp = 'unicast' or a multicast group receives the datagram stream of udpPort instead.
+  onAlarmCb gets the AlarmEvent of the event port first thing every poll, onCycleCb the
+  CycleReport of each encoder cycle """
+  def __init__(
+      self, address: str, onDataCb, port=3333, ringLen=1 << 22, blockLen=1 << 15, pollInterval=0.01,
+      onCaptureCb=None, maxCaptureLen=1 << 16, onFeaturesCb=None, udp=None, udpPort=3334, onAlarmCb=None, onCycleCb=None
+    ):
+    self.lib = loadLibrary()
+    self.onDataCb = onDataCb
+    self.onAlarmCb = onAlarmCb
+    self.onCaptureCb = onCaptureCb
+    self.onFeaturesCb = onFeaturesCb
+    self.onCycleCb = onCycleCb
+    self.captureBlock = np.zeros(maxCaptureLen, dtype=np.int16)
+    self.pollInterval = pollInterval
+    self.block = np.zeros(blockLen, dtype=np.int16)
+    if udp == None:
+      self.handle = self.lib.pas_receiver_create(address.encode(), port, ringLen)
+    else:
+      group = None if udp == 'unicast' else udp.encode()
+      self.handle = self.lib.pas_receiver_create_udp(address.encode(), group, udpPort, ringLen)
+    if not self.handle:
+      raise RuntimeError(self.lib.pas_last_error().decode())
+    self.isRun = False
+    self.pollThread = None
+    self.blockIndex = 0
+    self.lastCalibration = None
+    self.lastBaseline = None
+
+  def connect(self, startMsg=None):
+    if self.lib.pas_receiver_start(self.handle) != 0:
+      raise ConnectionError(self.lib.pas_last_error().decode())
+    self.isRun = True
+    self.pollThread = Thread(target=self.__pollTask)
+    self.pollThread.start()
+    logging.info('Native receiver started')
+
+  def stats(self):
+    stats = ReceiverStats()
+    self.lib.pas_receiver_get_stats(self.handle, ctypes.byref(stats))
+    return stats
+
+  def sampleTime(self, index: int):
+    """ Host time (time.time() clock) of a stream index in us, NaN until the sensor clock is known """
+    return self.lib.pas_receiver_sample_time(self.handle, index)
+
+  def blockTime(self):
+    """ Host time of the first sample given to onDataCb in us, to call from the callback """
+    return self.sampleTime(self.blockIndex)
+
+  def configureAdc(self, **settings):
+    """ Changes the ADC settings without a restart of the sensor, keys rate, range, spi,
+    sdo ('single' or 'dual'), alarm_high, alarm_low and hysteresis. None given asks for
+    the settings in use. The stream restarts from sample 0, see adcReport() """
+    command = ' '.join('%s=%s' % (key, value) for key, value in settings.items())
+    if self.lib.pas_receiver_configure_adc(self.handle, command.encode()) != 0:
+      raise OSError(self.lib.pas_last_error().decode())
+
+  def adcReport(self):
+    """ AdcReport of the last configureAdc(), None until it came """
+    report = AdcReport()
+    if self.lib.pas_receiver_read_adc_report(self.handle, ctypes.byref(report)) != 1:
+      return None
+    return report
+
+  def requestCalibration(self):
+    """ Asks for the calibration in use, the sensor also sends it after a start or a range change """
+    if self.lib.pas_receiver_request_calibration(self.handle) != 0:
+      raise OSError(self.lib.pas_last_error().decode())
+
+  def calibration(self):
+    """ Latest CalibrationReport, None until one came """
+    report = CalibrationReport()
+    if self.lib.pas_receiver_read_calibration(self.handle, ctypes.byref(report)) == 1:
+      self.lastCalibration = report
+    return self.lastCalibration
+
+  def requestBaseline(self):
+    """ Asks for the baseline estimate, the sensor also sends it after each amplifier reset """
+    if self.lib.pas_receiver_request_baseline(self.handle) != 0:
+      raise OSError(self.lib.pas_last_error().decode())
+
+  def baseline(self):
+    """ Latest BaselineReport, None until one came """
+    report = BaselineReport()
+    if self.lib.pas_receiver_read_baseline(self.handle, ctypes.byref(report)) == 1:
+      self.lastBaseline = report
+    return self.lastBaseline
+
+  def startRecording(self, path: str, rangeSel: int, conversion: float):
+    """ Received samples are written to a .pasr recording from the receive thread """
+    if self.lib.pas_receiver_start_recording(self.handle, path.encode(), rangeSel, conversion) != 0:
+      raise OSError(self.lib.pas_last_error().decode())
+
+  def stopRecording(self):
+    if self.lib.pas_receiver_stop_recording(self.handle) != 0:
+      raise OSError(self.lib.pas_last_error().decode())
+
+  def closeConnection(self):
+    self.isRun = False
+    if self.pollThread != None:
+      self.pollThread.join()
+    if self.handle:
+      self.lib.pas_receiver_destroy(self.handle)
+      self.handle = None
+
+  def __readCaptures(self):
+    info = CaptureInfo()
+    while self.lib.pas_receiver_read_capture(self.handle, ctypes.byref(info), self.captureBlock.ctypes.data, self.captureBlock.size) == 1:
+      capture = Capture(info.triggerIndex, info.number, info.missed, info.length, info.preTrigger, info.sampleRate)
+      capture.samples = self.captureBlock[:min(info.length, self.captureBlock.size)].copy()
+      capture.received = capture.samples.size
+      capture.truncated = bool(info.truncated)
+      self.onCaptureCb(capture)
+
+  def __pollTask(self):
+    blockPtr = self.block.ctypes.data
+    while self.isRun and self.lib.pas_receiver_running(self.handle):
+      if self.onAlarmCb != None:
+        event = AlarmEvent()
+        while self.lib.pas_receiver_read_alarm(self.handle, ctypes.byref(event)) == 1:
+          self.onAlarmCb(event)
+          event = AlarmEvent()
+      if self.onCaptureCb != None:
+        self.__readCaptures()
+      if self.onFeaturesCb != None:
+        report = FeatureReport()
+        while self.lib.pas_receiver_read_features(self.handle, ctypes.byref(report)) == 1:
+          self.onFeaturesCb(report)
+          report = FeatureReport()
+      if self.onCycleCb != None:
+        report = CycleReport()
+        while self.lib.pas_receiver_read_cycle(self.handle, ctypes.byref(report)) == 1:
+          self.onCycleCb(report)
+          report = CycleReport()
+      self.blockIndex = self.lib.pas_receiver_next_sample_index(self.handle)
+      n = self.lib.pas_receiver_read(self.handle, blockPtr, self.block.size)
+      if n == 0:
+        time.sleep(self.pollInterval)
+        continue
+      """ View is only valid during the callback, next read overwrites it """
+      self.onDataCb(self.block[:n], n)
@@ -5,7 +5,6 @@ import logging
 
 import numpy as np
 import pandas as pd
-import csv
 
 from PyQt5 import QtWidgets
 
@@ -20,16 +19,22 @@ import pyqtgraph as pg
 from prefixed import Float
 
 from tcpClient import TcpClient
+import nativeReceiver
 from trigger import *
 from decorators import *
 import dsp
+import recording
 
 INT16_MAX = 32767
+""" ADC codes to volts of the default range, for sensors that send codes. Captures and
+feature reports are always codes """
 CONVERSION_CONSTANT = 4096 / INT16_MAX * 1.25 / 1000
 SAMPLE_FREQUENCY = 100e3
 
 BUFFER_LEN = 50000
 MAX_DISPLAY_LEN = 10000
+""" Longest window shown, in seconds """
+MAX_HISTORY = 24 * 3600
 
 DEFAULT_SERVER_IP = '192.168.0.100'
 
@@ -100,6 +105,15 @@ class PlotTab(QWidget):
     self.nWavesBox.setValue(2)
     self.grid.addWidget(self.nWavesBox, 1, 6)
 
+    """ Seconds shown without trigger, past the buffer they are drawn from the pyramid of the whole stream """
+    self.historyBox = QDoubleSpinBox()
+    self.historyBox.setStepType(QtWidgets.QAbstractSpinBox.StepType.AdaptiveDecimalStepType)
+    self.historyBox.setRange(MAX_DISPLAY_LEN / SAMPLE_FREQUENCY, MAX_HISTORY)
+    self.historyBox.setValue(MAX_DISPLAY_LEN / SAMPLE_FREQUENCY)
+    self.historyBox.setDecimals(1)
+    self.historyBox.setSuffix(' s')
+    self.grid.addWidget(self.historyBox, 1, 7)
+
     self.ipLabel = QLabel('Server IP : BLE Disconnected')
     # self.ipLabel.setMaximumWidth(120)
     self.grid.addWidget(self.ipLabel, 9, 1)
@@ -135,9 +149,19 @@ class PlotTab(QWidget):
     
     self.bufferLen = BUFFER_LEN
     self.stream = None
+    """ Multiplier of the stream samples, 2^-fracBits bar once the sensor reports its calibration """
+    self.conversion = CONVERSION_CONSTANT
+    self.calibrationRequested = False
+    """ Min/max pyramid of every sample received since connecting, None without the native library """
+    self.pyramid = None
 
     """ Trigger """
     self.triggerOn = True
+    """ Windows captured by the sensor trigger, replace the software trigger when present """
+    self.lastCapture = None
+    self.captureFreq = None
+    """ Latest report of the sensor feature stream, fills the summary table when present """
+    self.lastFeatures = None
 
     """ Graph Itens """
 
@@ -235,34 +259,61 @@ class PlotTab(QWidget):
   def startRecording(self):
     if self.btRecord.text() == 'Start Recording':
       self.recordingStartTime = dt.now()
-      self.btRecord.setText('Stop Recording')
-      self.recordingFileName = f'{RECORDING_PATH}/recording-' + self.recordingStartTime.strftime('%Y-%m-%d--%H-%M-%S') + '.csv'
-      self.baseTimestamp = self.recordingStartTime.timestamp()
+      self.recordingFileName = f'{RECORDING_PATH}/recording-' + self.recordingStartTime.strftime('%Y-%m-%d--%H-%M-%S') + '.pasr'
       if not os.path.exists(RECORDING_PATH):
         os.makedirs(RECORDING_PATH)
-      self.recFp = open(self.recordingFileName, 'w')
-      self.recordingWriter = csv.writer(self.recFp)
-      self.recordingWriter.writerow(['timestamp', 'pressureData'])
+      if isinstance(self.stream, nativeReceiver.NativeTcpClient):
+        """ Written from the receive thread with the sensor sample indexes and timestamps """
+        self.stream.startRecording(self.recordingFileName, recording.RANGE_SEL, self.conversion)
+      else:
+        self.recordingWriter = recording.RecordingWriter(self.recordingFileName, sampleRate=SAMPLE_FREQUENCY)
+      self.btRecord.setText('Stop Recording')
       self.recordingData = True
 
     elif self.btRecord.text() == 'Stop Recording':
       self.recordingData = False
       self.btRecord.setText('Start Recording')
-      self.recFp.close()
-      
+      if self.recordingWriter != None:
+        with updateDataLock:
+          self.recordingWriter.close()
+          self.recordingWriter = None
+      elif self.stream != None:
+        self.stream.stopRecording()
+      logging.info(f'Recording saved to {self.recordingFileName}')
 
   """ Callback to be called from tcpClient on received data """
   @synchronized(updateDataLock)
   def __onTcpData(self, data, dataLen):
+    if not self.calibrationRequested:
+      """ After the first frames, the sensor has read the handshake """
+      self.stream.requestCalibration()
+      self.calibrationRequested = True
+    calibration = self.stream.calibration()
+    self.conversion = calibration.scale if calibration is not None and calibration.scale else CONVERSION_CONSTANT
     if self.paused:
       return
-    scaledData = data * CONVERSION_CONSTANT
+    scaledData = data * self.conversion
     self.pressure[:-dataLen] = self.pressure[dataLen:]
     self.pressure[-dataLen:] = scaledData
-    if self.recordingData == True:
-      time = [self.baseTimestamp + i/100 for i in range(dataLen)]
-      self.recordingWriter.writerows(np.array([time, data]).transpose())
-      self.baseTimestamp += dataLen/100
+    if self.pyramid != None:
+      self.pyramid.append(data)
+    if self.recordingWriter != None:
+      self.recordingWriter.append(data)
+
+  """ Callback to be called from the stream thread on each sensor trigger capture """
+  @synchronized(updateDataLock)
+  def __onCapture(self, capture):
+    if self.paused:
+      return
+    last = self.lastCapture
+    if last is not None and capture.number > last.number and capture.triggerIndex > last.triggerIndex:
+      """ Every trigger in between was counted by the sensor even when not captured """
+      self.captureFreq = capture.sampleRate * (capture.number - last.number) / (capture.triggerIndex - last.triggerIndex)
+    self.lastCapture = capture
+
+  """ Callback to be called from the stream thread on each sensor feature report """
+  def __onFeatures(self, report):
+    self.lastFeatures = report
 
   def updateIp(self, ip):
     self.serverIP = ip
@@ -274,7 +325,12 @@ class PlotTab(QWidget):
       return False
     ipAddr = self.serverIP
     try:
-      self.stream = TcpClient(ipAddr, 'h', self.__onTcpData, port=3333)
+      if nativeReceiver.isAvailable():
+        self.pyramid = nativeReceiver.Pyramid()
+        self.stream = nativeReceiver.NativeTcpClient(ipAddr, self.__onTcpData, port=3333, onCaptureCb=self.__onCapture, onFeaturesCb=self.__onFeatures)
+      else:
+        self.stream = TcpClient(ipAddr, 'h', self.__onTcpData, port=3333, onCaptureCb=self.__onCapture, onFeaturesCb=self.__onFeatures)
+      self.calibrationRequested = False
       self.stream.connect('connection_request')
     except Exception as e:
       msg = QMessageBox()
@@ -324,10 +380,19 @@ class PlotTab(QWidget):
     if self.paused:
       return
 
+    self.showFeatures()
     if not self.triggerBox.checkState():
-      self.dataLines[0].setData(self.xAxis[-MAX_DISPLAY_LEN:], self.pressure[-MAX_DISPLAY_LEN:])
+      historyLen = int(self.historyBox.value() * SAMPLE_FREQUENCY)
+      if self.pyramid != None and historyLen > MAX_DISPLAY_LEN:
+        self.plotHistory(historyLen)
+      else:
+        self.dataLines[0].setData(self.xAxis[-MAX_DISPLAY_LEN:], self.pressure[-MAX_DISPLAY_LEN:])
       self.dataLines[1].setData([], [])
       return
+
+    if self.lastCapture is not None:
+      self.plotCapture(self.lastCapture)
+      return
     
     plotData, crossIndexes = findWave(self.pressure, int(self.nWavesBox.value()), self.triggerValueBox.value(), self.triggerHistBox.value())
     if plotData.size == 0:
@@ -336,6 +401,8 @@ class PlotTab(QWidget):
     self.dataLines[0].setData(xAxis, plotData)
     self.dataLines[1].setData([xAxis[i] for i in crossIndexes], [plotData[i] for i in crossIndexes])
     
+    if self.lastFeatures is not None:
+      return
     """ Measure values """
     freq = SAMPLE_FREQUENCY / (crossIndexes[1] - crossIndexes[0])
     ppValue = plotData.max() - plotData.min()
@@ -344,6 +411,44 @@ class PlotTab(QWidget):
     self.summaryTable.item(0, 0).setText(f'{Float(freq):!.2h}\tHz')
     self.summaryTable.item(0, 1).setText(f'{Float(ppValue):!.2h}\tPressure [N/m²]')
 
+  def plotHistory(self, historyLen):
+    """ Last historyLen samples as the min and max of each screen column, whatever their number """
+    end = len(self.pyramid)
+    begin = max(0, end - historyLen)
+    columns = max(int(self.mainGraph.vb.width()), 100)
+    bins = self.pyramid.render(begin, end, columns)
+    if bins.size == 0:
+      return
+    xAxis = np.repeat(np.arange(bins.size) * (end - begin) / bins.size / SAMPLE_FREQUENCY * 1000, 2)
+    plotData = np.empty(bins.size * 2)
+    plotData[0::2] = bins['min']
+    plotData[1::2] = bins['max']
+    self.dataLines[0].setData(xAxis, plotData * self.conversion)
+
+  def showFeatures(self):
+    report = self.lastFeatures
+    if report is None:
+      return
+    ppValue = (report.max - report.min) * CONVERSION_CONSTANT
+    self.summaryTable.item(0, 0).setText(f'{Float(report.dominantFreq):!.2h}\tHz')
+    self.summaryTable.item(0, 1).setText(f'{Float(ppValue):!.2h}\tPressure [N/m²]')
+
+  def plotCapture(self, capture):
+    plotData = capture.samples * CONVERSION_CONSTANT
+    if plotData.size == 0:
+      return
+    fs = capture.sampleRate if capture.sampleRate > 0 else SAMPLE_FREQUENCY
+    xAxis = (np.arange(plotData.size) - capture.preTrigger) / fs * 1000
+    self.dataLines[0].setData(xAxis, plotData)
+    if capture.preTrigger < plotData.size:
+      self.dataLines[1].setData([0], [plotData[capture.preTrigger]])
+    if self.lastFeatures is not None:
+      return
+    ppValue = plotData.max() - plotData.min()
+    if self.captureFreq is not None:
+      self.summaryTable.item(0, 0).setText(f'{Float(self.captureFreq):!.2h}\tHz')
+    self.summaryTable.item(0, 1).setText(f'{Float(ppValue):!.2h}\tPressure [N/m²]')
+
   @synchronized(updateDataLock)
   def updateFFTData(self):
     if self.paused:
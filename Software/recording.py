@@ -0,0 +1,332 @@
+""" Binary recordings of the sample stream (.pasr), see native/include/pas/recording.hpp for the layout.
+The native receiver writes them from its receive thread, RecordingWriter is the pure python writer.
+The native writer also saves a min/max pyramid next to the recording (.pasp) to plot long windows.
+
+usage: recording.py info <file.pasr>
+       recording.py tocsv <file.pasr> <file.csv>
+       recording.py fromcsv <file.csv> <file.pasr> [sampleRate]
+       recording.py pyramid <file.pasr>
+"""
+import sys
+import struct
+import time
+
+import numpy as np
+
+HEADER = struct.Struct('<4sHHIHHddqQ16x')
+CHUNK = np.dtype([
+  ('offset', '<u8'), ('firstSample', '<u8'), ('timestamp', '<i8'), ('sampleCount', '<u4'), ('flags', '<u4')
+])
+TRAILER = struct.Struct('<QQQ4sI')
+HEADER_MAGIC = b'PASR'
+TRAILER_MAGIC = b'PASI'
+VERSION = 1
+CHUNK_GAP = 1
+DEFAULT_CHUNK_LEN = 1 << 16
+
+""" Firmware defaults, see acquisition.c and realTime.py """
+RANGE_SEL = 0x0003
+CONVERSION_CONSTANT = 4096 / 32767 * 1.25 / 1000
+
+CSV_CHUNK_LEN = 1 << 20
+
+def pyramidPath(path: str) -> str:
+  """ Pyramid saved next to a recording, file.pasr gives file.pasp """
+  return (path[:-len('.pasr')] if path.endswith('.pasr') else path) + '.pasp'
+
+class Recording():
+  """ Memory mapped recording, samples and window() are zero copy views of the file """
+  def __init__(self, path: str):
+    self.path = path
+    raw = np.memmap(path, dtype=np.uint8, mode='r')
+    if raw.size < HEADER.size:
+      raise ValueError(f'{path}: not a recording')
+    (
+      magic, version, headerLen, self.chunkLen, self.rangeSel, _,
+      self.sampleRate, self.conversion, self.startTime, self.firstSample
+    ) = HEADER.unpack_from(raw)
+    if magic != HEADER_MAGIC or version != VERSION or headerLen < HEADER.size or headerLen % 2 != 0:
+      raise ValueError(f'{path}: not a recording or unsupported version')
+
+    trailer = TRAILER.unpack_from(raw, raw.size - TRAILER.size) if raw.size >= headerLen + TRAILER.size else None
+    self.complete = (
+      trailer is not None and trailer[3] == TRAILER_MAGIC
+      and trailer[0] == headerLen + trailer[2] * 2
+      and trailer[0] + trailer[1] * CHUNK.itemsize + TRAILER.size == raw.size
+    )
+    if self.complete:
+      indexOffset, nChunks, nSamples = trailer[:3]
+      self.chunks = np.frombuffer(raw, dtype=CHUNK, count=nChunks, offset=indexOffset)
+    else:
+      """ Writer did not finish, every complete sample as one chunk """
+      nSamples = (raw.size - headerLen) // 2
+      self.chunks = np.array([(0, self.firstSample, 0, nSamples, 0)], dtype=CHUNK)[:1 if nSamples > 0 else 0]
+    self.samples = np.frombuffer(raw, dtype='<i2', count=nSamples, offset=headerLen)
+    self.__raw = raw
+    self.__pyramid = None
+
+  def __len__(self):
+    return self.samples.size
+
+  def duration(self):
+    """ Seconds from the first to the last sample """
+    return self.timeAt(len(self) - 1) if len(self) > 0 else 0
+
+  def chunkAt(self, pos: int) -> int:
+    """ Chunk holding the sample at position pos, chunks only end early at gaps so the estimate is never past it """
+    offsets = self.chunks['offset']
+    c = min(pos // max(self.chunkLen, 1), offsets.size - 1)
+    while c > 0 and offsets[c] > pos:
+      c -= 1
+    while c + 1 < offsets.size and offsets[c + 1] <= pos:
+      c += 1
+    return int(c)
+
+  def timeAt(self, pos: int) -> float:
+    """ Seconds from the first sample to the sample at position pos """
+    if self.chunks.size == 0 or self.sampleRate <= 0:
+      return 0.0
+    chunk = self.chunks[self.chunkAt(pos)]
+    return (int(chunk['timestamp']) - int(self.chunks[0]['timestamp'])) / 1e6 + (pos - int(chunk['offset'])) / self.sampleRate
+
+  def seek(self, t: float) -> int:
+    """ Position of the first sample at or after t seconds from the first one, len() past the end """
+    if self.chunks.size == 0 or t <= 0 or self.sampleRate <= 0:
+      return 0
+    timestamps = self.chunks['timestamp']
+    target = int(timestamps[0]) + t * 1e6
+    c = self.chunkAt(int(t * self.sampleRate))
+    while c > 0 and timestamps[c] > target:
+      c -= 1
+    while c + 1 < timestamps.size and timestamps[c + 1] <= target:
+      c += 1
+    chunk = self.chunks[c]
+    k = int(np.ceil((target - int(chunk['timestamp'])) * self.sampleRate / 1e6 - 1e-6))
+    if k >= chunk['sampleCount']:
+      """ In a gap, the next chunk starts after t """
+      return int(self.chunks[c + 1]['offset']) if c + 1 < self.chunks.size else len(self)
+    return int(chunk['offset']) + k
+
+  def timesAt(self, positions: np.ndarray) -> np.ndarray:
+    """ Seconds from the first sample of the samples at positions, sorted or not """
+    positions = np.asarray(positions, dtype=np.int64)
+    if self.chunks.size == 0 or self.sampleRate <= 0:
+      return np.zeros(positions.shape)
+    c = np.searchsorted(self.chunks['offset'], positions, side='right') - 1
+    c = np.clip(c, 0, self.chunks.size - 1)
+    chunks = self.chunks[c]
+    base = (chunks['timestamp'] - self.chunks[0]['timestamp']) / 1e6
+    return base + (positions - chunks['offset'].astype(np.int64)) / self.sampleRate
+
+  def pyramid(self):
+    """ Native pyramid of the samples, the saved one when it matches the recording, else built in memory """
+    if self.__pyramid is None:
+      import nativeReceiver
+      pyramid = None
+      try:
+        pyramid = nativeReceiver.Pyramid(path=pyramidPath(self.path))
+      except ValueError:
+        pass
+      if pyramid is None or len(pyramid) != len(self):
+        pyramid = nativeReceiver.Pyramid()
+        pyramid.append(self.samples)
+      self.__pyramid = pyramid
+    return self.__pyramid
+
+  def overview(self, start: float, duration: float, columns: int):
+    """ Window of duration seconds from start reduced to at most columns of equal length, for plotting.
+    Returns (time of the first sample of each column, min, max, mean) in seconds and ADC counts. Reads a few
+    pyramid bins per column with the native library, else scans the window """
+    begin, end = self.seek(start), self.seek(start + duration)
+    columns = min(columns, end - begin)
+    if columns <= 0:
+      empty = np.empty(0)
+      return empty, empty, empty, empty
+    import nativeReceiver
+    if nativeReceiver.isAvailable():
+      bins = self.pyramid().render(begin, end, columns, self.samples)
+      mn, mx, mean = bins['min'], bins['max'], bins['mean']
+    else:
+      x = self.samples[begin:end]
+      edges = (end - begin) * np.arange(columns) // columns
+      mn, mx = np.minimum.reduceat(x, edges), np.maximum.reduceat(x, edges)
+      mean = np.add.reduceat(x.astype(np.int64), edges) / np.diff(np.append(edges, end - begin))
+    edges = begin + (end - begin) * np.arange(mn.size) // mn.size
+    return self.timesAt(edges), mn, mx, mean
+
+  def window(self, start: float, duration: float) -> np.ndarray:
+    """ Samples from start for duration seconds, in ADC counts """
+    return self.samples[self.seek(start):self.seek(start + duration)]
+
+  def times(self, begin: int, end: int) -> np.ndarray:
+    """ Seconds from the first sample of the samples at positions [begin, end) """
+    out = np.empty(max(end - begin, 0), dtype=np.float64)
+    pos = begin
+    while pos < end:
+      c = self.chunkAt(pos)
+      chunk = self.chunks[c]
+      chunkEnd = min(end, int(chunk['offset']) + int(chunk['sampleCount']))
+      base = (int(chunk['timestamp']) - int(self.chunks[0]['timestamp'])) / 1e6
+      out[pos - begin:chunkEnd - begin] = base + (np.arange(pos, chunkEnd) - int(chunk['offset'])) / self.sampleRate
+      pos = chunkEnd
+    return out
+
+class RecordingWriter():
+  """ Writes a recording, same files as the native writer """
+  def __init__(self, path: str, sampleRate=0.0, rangeSel=RANGE_SEL, conversion=CONVERSION_CONSTANT, startTime=None, chunkLen=DEFAULT_CHUNK_LEN):
+    self.sampleRate = sampleRate
+    self.rangeSel = rangeSel
+    self.conversion = conversion
+    self.startTime = int(time.time() * 1e6) if startTime is None else startTime
+    self.chunkLen = chunkLen
+    self.firstSample = 0
+    self.index = []
+    self.pending = []
+    self.pendingLen = 0
+    self.chunk = None
+    self.nSamples = 0
+    self.nextSample = None
+    self.fp = open(path, 'wb')
+    """ Rewritten on close with the first sample and the rate """
+    self.__writeHeader()
+
+  def __writeHeader(self):
+    self.fp.write(HEADER.pack(
+      HEADER_MAGIC, VERSION, HEADER.size, self.chunkLen, self.rangeSel, 0,
+      self.sampleRate, self.conversion, self.startTime, self.firstSample
+    ))
+
+  def __flushChunk(self):
+    if self.pendingLen == 0:
+      return
+    for block in self.pending:
+      self.fp.write(block.tobytes())
+    self.chunk[3] = self.pendingLen
+    self.index.append(tuple(self.chunk))
+    self.nSamples += self.pendingLen
+    self.pending = []
+    self.pendingLen = 0
+
+  def append(self, samples: np.ndarray, firstSample=None, timestamp=None):
+    """ Appends int16 samples, firstSample past the end of the previous append starts a chunk marked as a gap.
+    Without firstSample the samples follow the previous ones, without timestamp (us) they are spaced by the rate """
+    samples = np.ascontiguousarray(samples, dtype='<i2')
+    if samples.size == 0:
+      return
+    if self.nextSample is None:
+      self.firstSample = 0 if firstSample is None else firstSample
+      self.nextSample = self.firstSample
+    if firstSample is None:
+      firstSample = self.nextSample
+    usPerSample = 1e6 / self.sampleRate if self.sampleRate > 0 else 0
+    if timestamp is None:
+      timestamp = round((firstSample - self.firstSample) * usPerSample)
+    flags = 0
+    if firstSample != self.nextSample:
+      """ Samples in between were lost, the chunk would no longer be evenly spaced """
+      self.__flushChunk()
+      flags = CHUNK_GAP
+    done = 0
+    while done < samples.size:
+      if self.pendingLen == 0:
+        self.chunk = [self.nSamples, firstSample + done, timestamp + round(done * usPerSample), 0, flags]
+        flags = 0
+      n = min(samples.size - done, self.chunkLen - self.pendingLen)
+      self.pending.append(samples[done:done + n].copy())
+      self.pendingLen += n
+      done += n
+      if self.pendingLen == self.chunkLen:
+        self.__flushChunk()
+    self.nextSample = firstSample + samples.size
+
+  def close(self):
+    """ Writes the last chunk, the index and the trailer """
+    if self.fp is None:
+      return
+    self.__flushChunk()
+    indexOffset = HEADER.size + self.nSamples * 2
+    self.fp.write(np.array(self.index, dtype=CHUNK).tobytes())
+    self.fp.write(TRAILER.pack(indexOffset, len(self.index), self.nSamples, TRAILER_MAGIC, 0))
+    self.fp.seek(0)
+    self.__writeHeader()
+    self.fp.close()
+    self.fp = None
+
+def toCsv(path: str, csvPath: str):
+  """ Writes the timestamp (unix s), pressureData (ADC counts) CSV realTime.py used to record """
+  rec = Recording(path)
+  with open(csvPath, 'w') as fp:
+    fp.write('timestamp,pressureData\n')
+    for begin in range(0, len(rec), CSV_CHUNK_LEN):
+      end = min(begin + CSV_CHUNK_LEN, len(rec))
+      t = rec.startTime / 1e6 + rec.times(begin, end)
+      np.savetxt(fp, np.column_stack([t, rec.samples[begin:end]]), fmt=['%.6f', '%d'], delimiter=',')
+
+def fromCsv(csvPath: str, path: str, sampleRate=None):
+  """ Converts a timestamp, pressureData CSV. Without sampleRate the rate comes from the timestamps and a step over
+  one period is a gap. CSVs recorded by realTime.py before this format stepped 10 ms per sample whatever the rate,
+  pass the rate for those and the samples are taken as contiguous """
+  import pandas as pd
+  writer = None
+  for df in pd.read_csv(csvPath, chunksize=CSV_CHUNK_LEN):
+    t = df['timestamp'].to_numpy(dtype=np.float64)
+    x = np.round(df['pressureData'].to_numpy(dtype=np.float64)).astype(np.int16)
+    if t.size == 0:
+      continue
+    if writer is not None and sampleRate is not None:
+      writer.append(x)
+      continue
+    if writer is None:
+      if sampleRate is None and t.size < 2:
+        raise ValueError(f'{csvPath}: too short to find the sample rate')
+      t0 = t[0]
+      prevTime, prevIndex = t0, -1
+      fs = sampleRate
+      if fs is None:
+        """ Timestamps are rounded, the median step only tells samples from gaps apart. The rate is then
+        averaged over every one sample step, so long gaps round to the right number of samples """
+        dt = np.diff(t)
+        single = np.round(dt / np.median(dt[:1000])) == 1
+        fs = np.count_nonzero(single) / dt[single].sum()
+      writer = RecordingWriter(path, sampleRate=fs, startTime=int(round(t0 * 1e6)))
+      if sampleRate is not None:
+        writer.append(x)
+        continue
+    """ Stream index from the steps, rounding each step keeps the rounding of the timestamps from adding up """
+    steps = np.maximum(np.round(np.diff(np.concatenate([[prevTime], t])) * fs), 1).astype(np.int64)
+    if prevIndex < 0:
+      steps[0] = 0
+    index = max(prevIndex, 0) + np.cumsum(steps)
+    bounds = [0, *(np.flatnonzero(steps[1:] != 1) + 1), t.size]
+    for begin, end in zip(bounds[:-1], bounds[1:]):
+      writer.append(x[begin:end], firstSample=int(index[begin]), timestamp=int(round((t[begin] - t0) * 1e6)))
+    prevTime, prevIndex = t[-1], int(index[-1])
+  if writer is None:
+    raise ValueError(f'{csvPath}: no samples')
+  writer.close()
+
+if __name__ == '__main__':
+  if len(sys.argv) < 3:
+    print(__doc__)
+    exit(1)
+  if sys.argv[1] == 'info':
+    rec = Recording(sys.argv[2])
+    gaps = int(np.count_nonzero(rec.chunks['flags'] & CHUNK_GAP))
+    print(
+      f'{len(rec)} samples at {rec.sampleRate:.1f} Hz, {rec.duration():.3f} s, {rec.chunks.size} chunks, {gaps} gaps'
+      f'{"" if rec.complete else ", recovered without index"}\n'
+      f'range sel {rec.rangeSel:#x}, conversion {rec.conversion:g}, started {time.ctime(rec.startTime / 1e6)}'
+    )
+  elif sys.argv[1] == 'tocsv' and len(sys.argv) >= 4:
+    toCsv(sys.argv[2], sys.argv[3])
+  elif sys.argv[1] == 'fromcsv' and len(sys.argv) >= 4:
+    fromCsv(sys.argv[2], sys.argv[3], float(sys.argv[4]) if len(sys.argv) > 4 else None)
+  elif sys.argv[1] == 'pyramid':
+    """ For recordings written without one, by the python writer or fromcsv """
+    import nativeReceiver
+    pyramid = nativeReceiver.Pyramid()
+    pyramid.append(Recording(sys.argv[2]).samples)
+    pyramid.save(pyramidPath(sys.argv[2]))
+  else:
+    print(__doc__)
+    exit(1)
@@ -2,15 +2,298 @@ import time
 import sys
 import struct
 import socket
+import zlib
 import numpy as np
 import logging
 
 from threading import Thread
 
+""" Stream frame format, see Firmware/esp32/components/stream_protocol/src/stream_frame.h """
+FRAME_MAGIC = b'PASF'
+FRAME_VERSION = 2
+FRAME_HEADER = struct.Struct('<IBBHIHHQqfI')
+FRAME_CRC_LEN = FRAME_HEADER.size - 4
+FRAME_MAX_PAYLOAD = 1440 - FRAME_HEADER.size
+FRAME_SAMPLES = 0
+FRAME_SAMPLES_RICE = 1
+FRAME_CAPTURE = 2
+FRAME_FEATURES = 3
+FRAME_STATS = 4
+FRAME_CALIBRATION = 8
+FRAME_BASELINE = 9
+FRAME_CYCLE = 10
+FLAG_OVERRUN = 1
+FLAG_CALIBRATED = 2
+FLAG_AMP_RESET = 4
+FLAG_ANGLE = 8
+CAPTURE_HEADER = struct.Struct('<QIIII')
+FEATURES_PAYLOAD = struct.Struct('<IhhffffHH')
+STATS_JITTER_BINS = 12
+STATS_JITTER_BIN_NS = 50
+STATS_STAGES = 4
+STATS_PAYLOAD = struct.Struct(f'<QQff9I{STATS_JITTER_BINS}I5I4I{STATS_STAGES}H')
+CALIBRATION_PAYLOAD = struct.Struct('<IbBHffi7f')
+BASELINE_PAYLOAD = struct.Struct('<QIIfffhBB')
+CYCLE_PAYLOAD = struct.Struct('<IHhHhHH')
+""" Crank angle of the first sample: cycle, angle, cycle length, sync errors """
+ANGLE_PREFIX = struct.Struct('<IHHI')
+
+""" Sample codec, see Firmware/esp32/components/stream_protocol/src/sample_codec.h """
+CODEC_BLOCK_LEN = 32
+CODEC_VERBATIM = 31
+
+def decodeRice(payload: bytes, count: int) -> np.ndarray:
+  """ Pure python decoder of compressed frames, the native receiver is much faster """
+  bits = ''.join(f'{b:08b}' for b in payload)
+  samples = np.empty(count, dtype=np.int16)
+  if count == 0:
+    return samples
+  prev = int(bits[0:16], 2)
+  prev -= (prev & 0x8000) << 1
+  samples[0] = prev
+  pos = 16
+  i = 1
+  while i < count:
+    n = min(CODEC_BLOCK_LEN, count - i)
+    k = int(bits[pos:pos + 5], 2)
+    pos += 5
+    if k == CODEC_VERBATIM:
+      for j in range(n):
+        prev = int(bits[pos:pos + 16], 2)
+        prev -= (prev & 0x8000) << 1
+        samples[i + j] = prev
+        pos += 16
+    else:
+      for j in range(n):
+        one = bits.index('1', pos)
+        u = (one - pos) << k
+        pos = one + 1
+        if k > 0:
+          u |= int(bits[pos:pos + k], 2)
+          pos += k
+        prev += (u >> 1) ^ -(u & 1)
+        samples[i + j] = prev
+    i += n
+  return samples
+
+class Capture():
+  """ Window around one firmware trigger, samples[preTrigger] is the trigger sample """
+  def __init__(self, triggerIndex, number, missed, length, preTrigger, sampleRate):
+    self.triggerIndex = triggerIndex
+    self.number = number
+    self.missed = missed
+    self.preTrigger = preTrigger
+    self.sampleRate = sampleRate
+    self.samples = np.zeros(length, dtype=np.int16)
+    self.received = 0
+    self.truncated = False
+
+class FeatureReport():
+  """ Summary of fftLen * windows samples computed by the sensor, values in ADC counts """
+  def __init__(self, header, payload: bytes):
+    self.firstSample = header[7]
+    self.timestamp = header[8]
+    self.sampleRate = header[9]
+    (
+      self.length, self.min, self.max, self.mean, self.acRms,
+      self.dominantFreq, self.dominantAmplitude, self.fftLen, self.windows
+    ) = FEATURES_PAYLOAD.unpack_from(payload)
+
+class DeviceStats():
+  """ Acquisition driver stats of the sensor, from a stats frame or the BLE stats characteristic.
+  jitterHist[0] counts periods within STATS_JITTER_BIN_NS of nominal, each next bin doubles """
+  def __init__(self, payload: bytes, header=None):
+    self.lastSample = header[7] if header is not None else None
+    self.timestamp = header[8] if header is not None else None
+    values = STATS_PAYLOAD.unpack_from(payload)
+    (
+      self.produced, self.sent, self.producedRate, self.sentRate,
+      self.overruns, self.dropped, self.ringLen, self.ringHighWater,
+      self.timerCount, self.isrLatencyMinNs, self.isrLatencyMaxNs, self.isrLatencyMeanNs,
+      self.jitterMaxNs
+    ) = values[:13]
+    self.jitterHist = list(values[13:13 + STATS_JITTER_BINS])
+    (
+      self.sends, self.sendP50Us, self.sendP90Us, self.sendP99Us, self.sendMaxUs,
+      self.backlogCapacity, self.backlogDepth, self.backlogHighWater, self.backlogFull
+    ) = values[13 + STATS_JITTER_BINS:-STATS_STAGES]
+    # Permille of a core: acquire, process, transmit and record stages
+    self.stageLoad = list(values[-STATS_STAGES:])
+
+class Calibration():
+  """ Calibration the sensor converts the samples with, pressure in bar = sample * scale.
+  scale is None while the samples are ADC codes """
+  def __init__(self, header, payload: bytes):
+    self.lastSample = header[7]
+    self.timestamp = header[8]
+    (
+      self.hash, self.fracBits, self.enabled, self.range, self.lsbVolts, self.gain, self.offset,
+      self.ampRange, self.ampFullScale, self.sensitivity, self.sensitivityDrift, self.zeroDrift,
+      self.referenceTemp, self.temperature
+    ) = CALIBRATION_PAYLOAD.unpack_from(payload)
+    self.scale = 2.0 ** -self.fracBits if self.enabled else None
+
+class Baseline():
+  """ Drift estimate of the charge amplifier baseline, in codes and codes/s. resetIndex
+  is the first sample after the last amplifier reset """
+  def __init__(self, header, payload: bytes):
+    self.lastSample = header[7]
+    self.timestamp = header[8]
+    (
+      self.resetIndex, self.resets, self.pegs, self.level, self.rest, self.drift,
+      self.reference, self.peg, self.resetPending
+    ) = BASELINE_PAYLOAD.unpack_from(payload)
+
+class CycleReport():
+  """ Highest and lowest sample of an encoder cycle found by the sensor, codes and
+  conversions from TDC. firstSample is the sample at angle 0 """
+  def __init__(self, header, payload: bytes):
+    self.firstSample = header[7]
+    self.timestamp = header[8]
+    self.sampleRate = header[9]
+    (
+      self.cycle, self.cycleLen, self.max, self.maxAngle, self.min, self.minAngle, _
+    ) = CYCLE_PAYLOAD.unpack_from(payload)
+
+class FrameDecoder():
+  """ Splits the TCP byte stream in frames, resyncing on the magic number """
+  def __init__(self):
+    self.buffer = bytearray()
+    self.nextSequence = None
+    self.nextSample = None
+    self.lostFrames = 0
+    self.lostSamples = 0
+    self.crcErrors = 0
+    self.sampleRate = None
+    self.capture = None
+    self.captures = []
+    self.featureReports = []
+    self.cycleReports = []
+    self.deviceStats = None
+    self.calibration = None
+    self.baseline = None
+    self.ampResets = 0
+    """ (firstSample, cycle, angle, cycleLen, syncErrors) of the last frame tagged with a crank angle """
+    self.angle = None
+
+  def __pushCapture(self, header, payload: bytes):
+    triggerIndex, number, missed, length, preTrigger = CAPTURE_HEADER.unpack_from(payload)
+    offset = header[7] - (triggerIndex - preTrigger)
+    count = header[5]
+    if offset + count > length:
+      return
+    if self.capture is not None and self.capture.number != number:
+      """ Rest of the previous window never came """
+      self.capture.truncated = True
+      self.capture.samples = self.capture.samples[:self.capture.received]
+      self.captures.append(self.capture)
+      self.capture = None
+    if self.capture is None:
+      self.capture = Capture(triggerIndex, number, missed, length, preTrigger, header[9])
+    self.capture.samples[offset:offset + count] = np.frombuffer(payload, dtype='<i2', count=count, offset=CAPTURE_HEADER.size)
+    self.capture.received += count
+    if self.capture.received >= length:
+      self.captures.append(self.capture)
+      self.capture = None
+
+  def popCaptures(self):
+    """ Complete capture windows since the last call """
+    captures = self.captures
+    self.captures = []
+    return captures
+
+  def popDeviceStats(self):
+    """ Latest device stats since the last call, None if none came """
+    stats = self.deviceStats
+    self.deviceStats = None
+    return stats
+
+  def popFeatureReports(self):
+    """ Feature reports since the last call """
+    reports = self.featureReports
+    self.featureReports = []
+    return reports
+
+  def popCycleReports(self):
+    """ Cycle reports since the last call """
+    reports = self.cycleReports
+    self.cycleReports = []
+    return reports
+
+  def push(self, data: bytes):
+    """ Returns a list of (header, samples) for each complete sample frame,
+    capture frames are assembled and returned by popCaptures, feature reports by popFeatureReports,
+    cycle reports by popCycleReports, device stats by popDeviceStats. The latest calibration is
+    kept in calibration """
+    self.buffer += data
+    frames = []
+    pos = 0
+    bufLen = len(self.buffer)
+    while True:
+      start = self.buffer.find(FRAME_MAGIC, pos)
+      if start < 0:
+        pos = max(pos, bufLen - len(FRAME_MAGIC) + 1)
+        break
+      pos = start
+      if bufLen - pos < FRAME_HEADER.size:
+        break
+      header = FRAME_HEADER.unpack_from(self.buffer, pos)
+      version, frameType, flags, sequence, count, payloadLen, firstSample = header[1:8]
+      if version != FRAME_VERSION or payloadLen > FRAME_MAX_PAYLOAD:
+        pos += 1
+        continue
+      end = pos + FRAME_HEADER.size + payloadLen
+      if bufLen < end:
+        break
+      crc = zlib.crc32(self.buffer[pos:pos + FRAME_CRC_LEN])
+      crc = zlib.crc32(self.buffer[pos + FRAME_HEADER.size:end], crc)
+      if crc != header[10]:
+        self.crcErrors += 1
+        pos += 1
+        continue
+      if self.nextSequence is not None:
+        gap = (sequence - self.nextSequence) & 0xFFFFFFFF
+        """ A sequence going back means the sensor restarted """
+        if gap < 0x80000000:
+          self.lostFrames += gap
+        if frameType in (FRAME_SAMPLES, FRAME_SAMPLES_RICE) and firstSample > self.nextSample:
+          self.lostSamples += firstSample - self.nextSample
+      self.nextSequence = (sequence + 1) & 0xFFFFFFFF
+      if frameType in (FRAME_SAMPLES, FRAME_SAMPLES_RICE):
+        self.nextSample = firstSample + count
+        self.sampleRate = header[9]
+        if flags & FLAG_AMP_RESET:
+          self.ampResets += 1
+        start = pos + FRAME_HEADER.size
+        if flags & FLAG_ANGLE:
+          self.angle = (firstSample,) + ANGLE_PREFIX.unpack_from(self.buffer, start)
+          start += ANGLE_PREFIX.size
+        if frameType == FRAME_SAMPLES:
+          samples = np.frombuffer(self.buffer, dtype='<i2', count=count, offset=start).copy()
+        else:
+          samples = decodeRice(bytes(self.buffer[start:end]), count)
+        frames.append((header, samples))
+      elif frameType == FRAME_CAPTURE:
+        self.__pushCapture(header, bytes(self.buffer[pos + FRAME_HEADER.size:end]))
+      elif frameType == FRAME_FEATURES and payloadLen >= FEATURES_PAYLOAD.size:
+        self.featureReports.append(FeatureReport(header, bytes(self.buffer[pos + FRAME_HEADER.size:end])))
+      elif frameType == FRAME_STATS and payloadLen >= STATS_PAYLOAD.size:
+        self.deviceStats = DeviceStats(bytes(self.buffer[pos + FRAME_HEADER.size:end]), header)
+      elif frameType == FRAME_CALIBRATION and payloadLen >= CALIBRATION_PAYLOAD.size:
+        self.calibration = Calibration(header, bytes(self.buffer[pos + FRAME_HEADER.size:end]))
+      elif frameType == FRAME_BASELINE and payloadLen >= BASELINE_PAYLOAD.size:
+        self.baseline = Baseline(header, bytes(self.buffer[pos + FRAME_HEADER.size:end]))
+      elif frameType == FRAME_CYCLE and payloadLen >= CYCLE_PAYLOAD.size:
+        self.cycleReports.append(CycleReport(header, bytes(self.buffer[pos + FRAME_HEADER.size:end])))
+      pos = end
+    del self.buffer[:pos]
+    return frames
+
 class TcpClient():
   def __init__(
       self, address: str, dataFormat: str, onDataCb, 
-      packetHeader=b'\xFD', maxPacketLen=2048, port=3333
+      packetHeader=b'\xFD', maxPacketLen=2048, port=3333, onCaptureCb=None, onFeaturesCb=None, onStatsCb=None,
+      onCycleCb=None
     ):
     self.serverAddr = address
     self.port = port
@@ -19,6 +302,10 @@ class TcpClient():
     self.header = packetHeader
     self.maxPacketLen = maxPacketLen
     self.onDataCb = onDataCb
+    self.onCaptureCb = onCaptureCb
+    self.onFeaturesCb = onFeaturesCb
+    self.onStatsCb = onStatsCb
+    self.onCycleCb = onCycleCb
 
     self.currException = None
     
@@ -60,6 +347,32 @@ class TcpClient():
       if not self.isRun:
         raise self.currException
   
+  def requestStats(self):
+    """ Asks the sensor for its driver stats, they come back to onStatsCb """
+    self.socket.sendall(b'stats\0')
+
+  def requestCalibration(self):
+    """ Asks for the calibration in use, the sensor also sends it after a start or a range change """
+    self.socket.sendall(b'calibration\0')
+
+  def calibration(self):
+    """ Latest Calibration, None until one came """
+    decoder = getattr(self, 'decoder', None)
+    return decoder.calibration if decoder is not None else None
+
+  def requestBaseline(self):
+    """ Asks for the baseline estimate, the sensor also sends it after each amplifier reset """
+    self.socket.sendall(b'baseline\0')
+
+  def baseline(self):
+    """ Latest Baseline, None until one came """
+    decoder = getattr(self, 'decoder', None)
+    return decoder.baseline if decoder is not None else None
+
+  def resetStats(self):
+    """ Clears the histograms, extremes and high water mark on the sensor """
+    self.socket.sendall(b'stats_reset\0')
+
   def closeConnection(self):
     self.isRun = False
     self.socket.close()
@@ -67,12 +380,12 @@ class TcpClient():
       self.socketThread.join()
 
   def __socketTask(self):
-    totalLen = 0
-    packet = bytes([])
+    decoder = FrameDecoder()
+    self.decoder = decoder
     while self.isRun:
       
       try:
-        rawData = self.socket.recv(2048)
+        rawData = self.socket.recv(16384)
       except Exception as e:
         self.currException = e
         self.isRun = False
@@ -82,24 +395,24 @@ class TcpClient():
       if not rawData:
         continue
       self.isReceiving = True
-      rawDataLen = rawData.__len__()
-      totalLen += rawDataLen
-      if (totalLen >= self.maxPacketLen):
-        copyLen = rawDataLen - (totalLen - self.maxPacketLen)
-        packet += rawData[:copyLen]
-        unpacked = np.array(list(struct.iter_unpack(self.dataFormat, packet))).transpose()[0]
-        unpackedLen = unpacked.size
-        logging.debug(f'Received {totalLen} bytes')
-        self.onDataCb(unpacked, unpackedLen)
-        
-        totalLen -= self.maxPacketLen
-        if totalLen == 0:
-          packet = bytes([])
-        else:
-          packet = rawData[copyLen:]
-
-      else:
-        packet += rawData
+      frames = decoder.push(rawData)
+      if self.onCaptureCb != None:
+        for capture in decoder.popCaptures():
+          self.onCaptureCb(capture)
+      if self.onFeaturesCb != None:
+        for report in decoder.popFeatureReports():
+          self.onFeaturesCb(report)
+      if self.onCycleCb != None:
+        for report in decoder.popCycleReports():
+          self.onCycleCb(report)
+      stats = decoder.popDeviceStats()
+      if self.onStatsCb != None and stats != None:
+        self.onStatsCb(stats)
+      if not frames:
+        continue
+      unpacked = np.concatenate([samples for _, samples in frames])
+      logging.debug(f'Received {len(frames)} frames, {unpacked.size} samples')
+      self.onDataCb(unpacked, unpacked.size)
     
       
 # -----------  Config  ----------